@@ -0,0 +1,27 @@
+find_library(zstd NAMES zstd libzstd)
+find_path(zstd_include NAMES zstd.h zdict.h)
+
+if(zstd AND zstd_include)
+  message("Found system installed zstd")
+  target_include_directories(clio PUBLIC ${zstd_include})
+  target_link_libraries(clio PUBLIC ${zstd})
+else()
+  message("System installed zstd not found. Will build")
+  FetchContent_Declare(
+    zstd
+    URL https://github.com/facebook/zstd/releases/download/v1.5.2/zstd-1.5.2.tar.gz
+  )
+
+  FetchContent_GetProperties(zstd)
+
+  if(NOT zstd_POPULATED)
+    FetchContent_Populate(zstd)
+    set(ZSTD_BUILD_PROGRAMS OFF CACHE BOOL "" FORCE)
+    set(ZSTD_BUILD_SHARED OFF CACHE BOOL "" FORCE)
+    set(ZSTD_BUILD_TESTS OFF CACHE BOOL "" FORCE)
+    add_subdirectory(${zstd_SOURCE_DIR}/build/cmake ${zstd_BINARY_DIR} EXCLUDE_FROM_ALL)
+  endif()
+
+  target_include_directories(clio PUBLIC ${zstd_SOURCE_DIR}/lib)
+  target_link_libraries(clio PUBLIC libzstd_static)
+endif()
@@ -0,0 +1,704 @@
+#include <ripple/protocol/Indexes.h>
+#include <ripple/protocol/STLedgerEntry.h>
+#include <ripple/protocol/STTx.h>
+#include <ripple/protocol/TxFormats.h>
+#include <ripple/protocol/TER.h>
+#include <benchmark/benchmark.h>
+#include <boost/json.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <atomic>
+#include <backend/BackendInterface.h>
+#include <backend/SimpleCache.h>
+#include <etl/ETLHelpers.h>
+#include <map>
+#include <optional>
+#include <random>
+#include <rpc/RPCHelpers.h>
+#include <thread>
+#include <vector>
+
+// Benchmarks of the hot paths of reads and of the ETL, on synthetic data
+// shaped like mainnet: uniformly distributed keys, objects of 100 to 400
+// bytes, order books of single page quality directories and payments that
+// modify two account roots. Run with --benchmark_out=results.json
+// --benchmark_out_format=json to compare results between releases
+
+namespace {
+
+// objects in the cache, about a tenth of mainnet
+constexpr size_t numObjects = 1 << 18;
+// objects modified by a ledger
+constexpr size_t objectsPerLedger = 1000;
+
+std::mt19937_64&
+rng()
+{
+    static thread_local std::mt19937_64 rng{42};
+    return rng;
+}
+
+template <class T>
+T
+randomUint()
+{
+    T value;
+    std::generate(value.begin(), value.end(), []() {
+        return static_cast<unsigned char>(rng()());
+    });
+    return value;
+}
+
+Backend::Blob
+randomBlob(size_t minSize = 100, size_t maxSize = 400)
+{
+    Backend::Blob blob(minSize + rng()() % (maxSize - minSize + 1));
+    std::generate(blob.begin(), blob.end(), []() {
+        return static_cast<unsigned char>(rng()());
+    });
+    return blob;
+}
+
+std::vector<Backend::LedgerObject> const&
+objects()
+{
+    static std::vector<Backend::LedgerObject> const objects = []() {
+        std::vector<Backend::LedgerObject> objects;
+        objects.reserve(numObjects);
+        for (size_t i = 0; i < numObjects; ++i)
+            objects.push_back({randomUint<ripple::uint256>(), randomBlob()});
+        std::sort(
+            objects.begin(), objects.end(), [](auto const& a, auto const& b) {
+                return a.key < b.key;
+            });
+        return objects;
+    }();
+    return objects;
+}
+
+// A full cache of objects() as of ledger 1, which is only read
+struct FullCache
+{
+    Backend::SimpleCache cache;
+
+    FullCache()
+    {
+        cache.update(objects(), 1);
+        cache.setFull();
+    }
+};
+
+Backend::SimpleCache const&
+fullCache()
+{
+    static FullCache const full;
+    return full.cache;
+}
+
+// objects() in a random order, so lookups do not walk the cache in order
+std::vector<ripple::uint256> const&
+shuffledKeys()
+{
+    static std::vector<ripple::uint256> const keys = []() {
+        std::vector<ripple::uint256> keys;
+        keys.reserve(numObjects);
+        for (auto const& object : objects())
+            keys.push_back(object.key);
+        std::shuffle(keys.begin(), keys.end(), rng());
+        return keys;
+    }();
+    return keys;
+}
+
+void
+cacheGet(benchmark::State& state)
+{
+    auto const& cache = fullCache();
+    auto const& keys = shuffledKeys();
+    size_t i = state.thread_index() * (numObjects / state.threads());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cache.get(keys[i++ % numObjects], 1));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(cacheGet)->ThreadRange(1, 8)->UseRealTime();
+
+void
+cacheGetView(benchmark::State& state)
+{
+    auto const& cache = fullCache();
+    auto const& keys = shuffledKeys();
+    size_t i = state.thread_index() * (numObjects / state.threads());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cache.getView(keys[i++ % numObjects], 1));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(cacheGetView)->ThreadRange(1, 8)->UseRealTime();
+
+void
+cacheGetSuccessor(benchmark::State& state)
+{
+    auto const& cache = fullCache();
+    auto const& keys = shuffledKeys();
+    size_t i = state.thread_index() * (numObjects / state.threads());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+            cache.getSuccessor(keys[i++ % numObjects], 1));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(cacheGetSuccessor)->ThreadRange(1, 8)->UseRealTime();
+
+// A cache that is updated with a new ledger of objectsPerLedger modified
+// objects at a time
+struct UpdatedCache
+{
+    Backend::SimpleCache cache;
+    std::atomic_uint32_t seq = 1;
+    std::vector<std::vector<Backend::LedgerObject>> ledgers;
+
+    UpdatedCache()
+    {
+        cache.update(objects(), seq);
+        cache.setFull();
+        auto const& keys = shuffledKeys();
+        for (size_t i = 0; i < 64; ++i)
+        {
+            std::vector<Backend::LedgerObject> ledger;
+            for (size_t j = 0; j < objectsPerLedger; ++j)
+                ledger.push_back(
+                    {keys[(i * objectsPerLedger + j) % numObjects],
+                     randomBlob()});
+            ledgers.push_back(std::move(ledger));
+        }
+    }
+
+    void
+    update()
+    {
+        auto next = seq + 1;
+        cache.update(ledgers[next % ledgers.size()], next);
+        seq = next;
+    }
+};
+
+UpdatedCache&
+updatedCache()
+{
+    static UpdatedCache cache;
+    return cache;
+}
+
+void
+cacheUpdate(benchmark::State& state)
+{
+    auto& cache = updatedCache();
+    for (auto _ : state)
+        cache.update();
+    state.SetItemsProcessed(state.iterations() * objectsPerLedger);
+}
+BENCHMARK(cacheUpdate)->UseRealTime();
+
+// Reads of the latest ledger while another thread writes new ledgers as
+// fast as it can, as the ETL does while RPCs are served
+void
+cacheGetWhileUpdating(benchmark::State& state)
+{
+    auto& cache = updatedCache();
+    auto const& keys = shuffledKeys();
+    std::atomic_bool stop = false;
+    std::atomic_uint64_t ledgers = 0;
+    std::optional<std::thread> writer;
+    if (state.thread_index() == 0)
+        writer.emplace([&]() {
+            while (!stop)
+            {
+                cache.update();
+                ++ledgers;
+            }
+        });
+    size_t i = state.thread_index() * (numObjects / state.threads());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(
+            cache.cache.getView(keys[i++ % numObjects], cache.seq));
+    state.SetItemsProcessed(state.iterations());
+    if (writer)
+    {
+        stop = true;
+        writer->join();
+        state.counters["ledgers"] = benchmark::Counter(
+            ledgers.load(), benchmark::Counter::kIsRate);
+    }
+}
+BENCHMARK(cacheGetWhileUpdating)->ThreadRange(1, 8)->UseRealTime();
+
+constexpr size_t handoffs = 1 << 16;
+
+// Elements handed from a producer thread to this one, through a queue of
+// at most range(0) elements, as between the stages of the ETL
+void
+threadSafeQueue(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        ThreadSafeQueue<std::optional<uint32_t>> queue(state.range(0));
+        std::thread producer{[&queue]() {
+            for (uint32_t i = 0; i < handoffs; ++i)
+                queue.push(i);
+            queue.push({});
+        }};
+        while (auto i = queue.pop())
+            benchmark::DoNotOptimize(*i);
+        producer.join();
+    }
+    state.SetItemsProcessed(state.iterations() * handoffs);
+}
+BENCHMARK(threadSafeQueue)->Arg(1)->Arg(64)->Arg(4096)->UseRealTime();
+
+void
+spscQueue(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        SpscQueue<std::optional<uint32_t>> queue(state.range(0));
+        std::thread producer{[&queue]() {
+            for (uint32_t i = 0; i < handoffs; ++i)
+                queue.push(i);
+            queue.push({});
+        }};
+        while (auto i = queue.pop())
+            benchmark::DoNotOptimize(*i);
+        producer.join();
+    }
+    state.SetItemsProcessed(state.iterations() * handoffs);
+}
+BENCHMARK(spscQueue)->Arg(1)->Arg(64)->Arg(4096)->UseRealTime();
+
+// A backend that serves the latest version of its objects from memory and
+// discards writes, so reads only measure the work of BackendInterface
+class MockBackend : public Backend::BackendInterface
+{
+    std::map<ripple::uint256, Backend::Blob> objects_;
+    uint32_t const seq_;
+
+public:
+    MockBackend(std::vector<Backend::LedgerObject> const& objects, uint32_t seq)
+        : BackendInterface({}), seq_(seq)
+    {
+        for (auto const& object : objects)
+            objects_[object.key] = object.blob;
+        updateRange(seq);
+    }
+
+    std::optional<ripple::LedgerInfo>
+    doFetchLedgerBySequence(uint32_t sequence) const override
+    {
+        ripple::LedgerInfo info;
+        info.seq = sequence;
+        return info;
+    }
+
+    std::optional<ripple::LedgerInfo>
+    doFetchLedgerByHash(ripple::uint256 const& hash) const override
+    {
+        return {};
+    }
+
+    std::optional<uint32_t>
+    fetchLatestLedgerSequence() const override
+    {
+        return seq_;
+    }
+
+    std::optional<Backend::TransactionAndMetadata>
+    doFetchTransaction(ripple::uint256 const& hash) const override
+    {
+        return {};
+    }
+
+    std::vector<Backend::TransactionAndMetadata>
+    doFetchTransactions(
+        std::vector<ripple::uint256> const& hashes) const override
+    {
+        return std::vector<Backend::TransactionAndMetadata>(hashes.size());
+    }
+
+    Backend::AccountTransactions
+    fetchAccountTransactions(
+        ripple::AccountID const& account,
+        std::uint32_t limit,
+        bool forward,
+        std::optional<Backend::AccountTransactionsCursor> const& cursor)
+        const override
+    {
+        return {};
+    }
+
+    std::vector<Backend::TransactionAndMetadata>
+    fetchAllTransactionsInLedger(uint32_t ledgerSequence) const override
+    {
+        return {};
+    }
+
+    std::vector<ripple::uint256>
+    fetchAllTransactionHashesInLedger(uint32_t ledgerSequence) const override
+    {
+        return {};
+    }
+
+    std::optional<Backend::Blob>
+    doFetchLedgerObject(ripple::uint256 const& key, uint32_t sequence)
+        const override
+    {
+        auto it = objects_.find(key);
+        if (it == objects_.end())
+            return {};
+        return it->second;
+    }
+
+    std::vector<Backend::Blob>
+    doFetchLedgerObjects(
+        std::vector<ripple::uint256> const& keys,
+        uint32_t sequence) const override
+    {
+        std::vector<Backend::Blob> blobs;
+        blobs.reserve(keys.size());
+        for (auto const& key : keys)
+            blobs.push_back(doFetchLedgerObject(key, sequence).value_or(
+                Backend::Blob{}));
+        return blobs;
+    }
+
+    std::vector<Backend::LedgerObject>
+    fetchLedgerDiff(uint32_t ledgerSequence) const override
+    {
+        return {};
+    }
+
+    std::optional<ripple::uint256>
+    doFetchSuccessorKey(ripple::uint256 key, uint32_t ledgerSequence)
+        const override
+    {
+        auto it = objects_.upper_bound(key);
+        if (it == objects_.end())
+            return {};
+        return it->first;
+    }
+
+    std::optional<Backend::LedgerRange>
+    hardFetchLedgerRange() const override
+    {
+        return Backend::LedgerRange{seq_, seq_};
+    }
+
+    void
+    writeLedger(ripple::LedgerInfo const&, std::string&&) override
+    {
+    }
+
+    void
+    writeTransaction(
+        std::string&&,
+        uint32_t,
+        uint32_t,
+        std::string&&,
+        std::string&&) override
+    {
+    }
+
+    void
+    writeAccountTransactions(
+        std::vector<Backend::AccountTransactionsData>&&) override
+    {
+    }
+
+    void
+    writeSuccessor(std::string&&, uint32_t, std::string&&) override
+    {
+    }
+
+    void
+    startWrites() override
+    {
+    }
+
+    bool
+    doOnlineDelete(uint32_t) const override
+    {
+        return true;
+    }
+
+    void
+    open(bool) override
+    {
+    }
+
+    void
+    close() override
+    {
+    }
+
+private:
+    void
+    doWriteLedgerObject(std::string&&, uint32_t, std::string&&) override
+    {
+    }
+
+    bool
+    doFinishWrites(uint32_t) override
+    {
+        return true;
+    }
+};
+
+// An order book of single page quality directories of 1 to 32 offers
+struct Book
+{
+    ripple::uint256 book;
+    std::vector<Backend::LedgerObject> objects;
+
+    explicit Book(size_t numDirs)
+    {
+        book.data()[0] = 0xAB;
+        for (size_t q = 1; q <= numDirs; ++q)
+        {
+            auto dir = ripple::getQualityIndex(book, q);
+            std::vector<ripple::uint256> offers(1 + rng()() % 32);
+            for (auto& offer : offers)
+            {
+                offer = randomUint<ripple::uint256>();
+                objects.push_back({offer, randomBlob(150, 250)});
+            }
+            ripple::STLedgerEntry sle{ripple::ltDIR_NODE, dir};
+            sle.setFieldH256(ripple::sfRootIndex, dir);
+            sle.setFieldV256(ripple::sfIndexes, ripple::STVector256{offers});
+            ripple::Serializer s;
+            sle.add(s);
+            objects.push_back({dir, s.peekData()});
+        }
+    }
+};
+
+// A page of range(0) offers of a book with range(0) / 4 directories, read
+// from the database if range(1) is 0, and from the book index of a full
+// cache otherwise
+void
+fetchBookOffers(benchmark::State& state)
+{
+    uint32_t const seq = 2;
+    uint32_t const limit = state.range(0);
+    Book book{std::max<size_t>(limit / 4, 1)};
+    MockBackend backend{book.objects, seq};
+    if (state.range(1))
+    {
+        backend.cache().update(book.objects, seq);
+        backend.cache().setFull();
+        backend.bookIndex().update({}, seq);
+    }
+    size_t offers = 0;
+    for (auto _ : state)
+        offers += backend.fetchBookOffers(book.book, seq, limit, {})
+                      .offers.size();
+    state.SetItemsProcessed(offers);
+    state.SetLabel(state.range(1) ? "cache" : "database");
+}
+BENCHMARK(fetchBookOffers)
+    ->ArgsProduct({{20, 200}, {0, 1}})
+    ->ArgNames({"limit", "cached"});
+
+// A payment from one account to another, and its metadata
+Backend::TransactionAndMetadata
+payment()
+{
+    auto const from = randomUint<ripple::AccountID>();
+    auto const to = randomUint<ripple::AccountID>();
+    ripple::STAmount const amount{1000000};
+    auto assemble = [&](ripple::STObject& obj) {
+        obj.setAccountID(ripple::sfAccount, from);
+        obj.setAccountID(ripple::sfDestination, to);
+        obj.setFieldAmount(ripple::sfAmount, amount);
+        obj.setFieldAmount(ripple::sfFee, ripple::STAmount{12});
+        obj.setFieldU32(ripple::sfSequence, 12345);
+        obj.setFieldU32(ripple::sfFlags, 0);
+        obj.setFieldU32(ripple::sfLastLedgerSequence, 70000000);
+        obj.setFieldVL(ripple::sfSigningPubKey, randomBlob(33, 33));
+        obj.setFieldVL(ripple::sfTxnSignature, randomBlob(71, 71));
+    };
+    ripple::STTx tx{ripple::ttPAYMENT, assemble};
+
+    ripple::STObject meta{ripple::sfTransactionMetaData};
+    meta.setFieldU8(ripple::sfTransactionResult, ripple::tesSUCCESS);
+    meta.setFieldU32(ripple::sfTransactionIndex, 7);
+    meta.setFieldAmount(ripple::sfDeliveredAmount, amount);
+    ripple::STArray nodes{ripple::sfAffectedNodes};
+    for (auto const& account : {from, to})
+    {
+        ripple::STObject node{ripple::sfModifiedNode};
+        node.setFieldU16(ripple::sfLedgerEntryType, ripple::ltACCOUNT_ROOT);
+        node.setFieldH256(
+            ripple::sfLedgerIndex, ripple::keylet::account(account).key);
+        node.setFieldH256(
+            ripple::sfPreviousTxnID, randomUint<ripple::uint256>());
+        node.setFieldU32(ripple::sfPreviousTxnLgrSeq, 69999990);
+        ripple::STObject finalFields{ripple::sfFinalFields};
+        finalFields.setAccountID(ripple::sfAccount, account);
+        finalFields.setFieldAmount(
+            ripple::sfBalance, ripple::STAmount{25000000});
+        finalFields.setFieldU32(ripple::sfFlags, 0);
+        finalFields.setFieldU32(ripple::sfOwnerCount, 3);
+        finalFields.setFieldU32(ripple::sfSequence, 12346);
+        ripple::STObject previousFields{ripple::sfPreviousFields};
+        previousFields.setFieldAmount(
+            ripple::sfBalance, ripple::STAmount{24000000});
+        node.emplace_back(std::move(finalFields));
+        node.emplace_back(std::move(previousFields));
+        nodes.push_back(std::move(node));
+    }
+    meta.setFieldArray(ripple::sfAffectedNodes, nodes);
+
+    ripple::Serializer txBlob;
+    tx.add(txBlob);
+    ripple::Serializer metaBlob;
+    meta.add(metaBlob);
+    return {txBlob.peekData(), metaBlob.peekData(), 70000000, 700000000};
+}
+
+void
+deserializeTxPlusMeta(benchmark::State& state)
+{
+    auto const blobs = payment();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(RPC::deserializeTxPlusMeta(blobs));
+    state.SetBytesProcessed(
+        state.iterations() *
+        (blobs.transaction.size() + blobs.metadata.size()));
+}
+BENCHMARK(deserializeTxPlusMeta);
+
+void
+toExpandedJson(benchmark::State& state)
+{
+    auto const blobs = payment();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(RPC::toExpandedJson(blobs));
+    state.SetBytesProcessed(
+        state.iterations() *
+        (blobs.transaction.size() + blobs.metadata.size()));
+}
+BENCHMARK(toExpandedJson);
+
+// How evenly range(0) markers split uniformly distributed keys. imbalance
+// is the share of the largest partition over that of an even split
+void
+markers(benchmark::State& state)
+{
+    auto const& keys = objects();
+    std::vector<ripple::uint256> markers;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(markers = getMarkers(state.range(0)));
+
+    size_t largest = 0;
+    for (size_t i = 0; i < markers.size(); ++i)
+    {
+        auto cmp = [](auto const& object, auto const& key) {
+            return object.key < key;
+        };
+        auto begin =
+            std::lower_bound(keys.begin(), keys.end(), markers[i], cmp);
+        auto end = i + 1 < markers.size()
+            ? std::lower_bound(keys.begin(), keys.end(), markers[i + 1], cmp)
+            : keys.end();
+        largest = std::max<size_t>(largest, end - begin);
+    }
+    state.counters["imbalance"] =
+        static_cast<double>(largest) * markers.size() / keys.size();
+}
+BENCHMARK(markers)->RangeMultiplier(4)->Range(4, 256);
+
+// An account_tx response of numTransactions payments
+boost::json::object
+accountTxResponse(size_t numTransactions)
+{
+    auto const blobs = payment();
+    boost::json::array txns;
+    for (size_t i = 0; i < numTransactions; ++i)
+    {
+        auto [txn, meta] = RPC::toExpandedJson(blobs);
+        boost::json::object obj;
+        obj["meta"] = std::move(meta);
+        obj["tx"] = std::move(txn);
+        obj["tx"].as_object()["ledger_index"] = blobs.ledgerSequence;
+        obj["tx"].as_object()["date"] = blobs.date;
+        obj["validated"] = true;
+        txns.push_back(std::move(obj));
+    }
+    boost::json::object result;
+    result["account"] = ripple::to_string(randomUint<ripple::AccountID>());
+    result["ledger_index_min"] = 32570;
+    result["ledger_index_max"] = blobs.ledgerSequence;
+    result["limit"] = numTransactions;
+    result["transactions"] = std::move(txns);
+    boost::json::object response;
+    response["result"] = std::move(result);
+    return response;
+}
+
+// A ledger_data response of count objects, in hex
+boost::json::object
+ledgerDataResponse(size_t count)
+{
+    boost::json::array state;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto const& object = objects()[i];
+        boost::json::object obj;
+        obj["data"] = ripple::strHex(object.blob);
+        obj["index"] = ripple::strHex(object.key);
+        state.push_back(std::move(obj));
+    }
+    boost::json::object result;
+    result["ledger_index"] = 70000000;
+    result["marker"] = ripple::strHex(objects()[count].key);
+    result["state"] = std::move(state);
+    boost::json::object response;
+    response["result"] = std::move(result);
+    return response;
+}
+
+void
+serializeAccountTx(benchmark::State& state)
+{
+    auto const response = accountTxResponse(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state)
+        bytes += boost::json::serialize(response).size();
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(serializeAccountTx)->Arg(20)->Arg(200);
+
+void
+serializeLedgerData(benchmark::State& state)
+{
+    auto const response = ledgerDataResponse(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state)
+        bytes += boost::json::serialize(response).size();
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(serializeLedgerData)->Arg(256)->Arg(2048);
+
+}  // namespace
+
+int
+main(int argc, char** argv)
+{
+    // the backend logs every read at debug level
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
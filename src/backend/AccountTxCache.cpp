@@ -0,0 +1,208 @@
+#include <backend/AccountTxCache.h>
+#include <algorithm>
+#include <limits>
+namespace Backend {
+
+void
+AccountTxCache::trim(Entry& entry)
+{
+    if (entry.rows.size() <= maxRows)
+        return;
+    entry.rows.resize(maxRows);
+    entry.floor = key(entry.rows.back());
+}
+
+std::optional<AccountTxCache::Page>
+AccountTxCache::get(
+    ripple::AccountID const& account,
+    uint32_t limit,
+    bool forward,
+    std::optional<AccountTransactionsCursor> const& cursor,
+    uint32_t maxSeq)
+{
+    std::lock_guard lck{mtx_};
+    auto it = entries_.find(account);
+    if (it == entries_.end() || it->second.through < maxSeq)
+    {
+        ++misses_;
+        return {};
+    }
+    auto& entry = it->second;
+    auto const& rows = entry.rows;
+
+    Page page;
+    if (forward)
+    {
+        // rows at or above the cursor, oldest first
+        Key start = cursor
+            ? Key{cursor->ledgerSequence, cursor->transactionIndex}
+            : Key{0, 0};
+        if (start < entry.floor)
+        {
+            ++misses_;
+            return {};
+        }
+        auto end = std::partition_point(
+            rows.begin(), rows.end(), [&start](Row const& row) {
+                return key(row) >= start;
+            });
+        for (auto row = std::make_reverse_iterator(end);
+             row != rows.rend() && page.hashes.size() < limit;
+             ++row)
+            page.hashes.push_back(row->hash);
+        if (page.hashes.size() == limit)
+        {
+            auto const& last = *(end - limit);
+            page.cursor = {last.ledgerSequence, last.transactionIndex + 1};
+        }
+    }
+    else
+    {
+        // rows below the cursor, newest first
+        Key start = cursor
+            ? Key{cursor->ledgerSequence, cursor->transactionIndex}
+            : Key{
+                  std::numeric_limits<uint32_t>::max(),
+                  std::numeric_limits<uint32_t>::max()};
+        auto row = std::partition_point(
+            rows.begin(), rows.end(), [&start](Row const& row) {
+                return key(row) >= start;
+            });
+        for (; row != rows.end() && page.hashes.size() < limit; ++row)
+            page.hashes.push_back(row->hash);
+        if (page.hashes.size() == limit)
+        {
+            auto const& last = *(row - 1);
+            page.cursor = {last.ledgerSequence, last.transactionIndex};
+        }
+        // the rest of the page is below the cached rows
+        else if (entry.floor != Key{0, 0})
+        {
+            ++misses_;
+            return {};
+        }
+    }
+
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, entry.lru);
+    return page;
+}
+
+void
+AccountTxCache::insert(
+    ripple::AccountID const& account,
+    uint32_t through,
+    std::optional<AccountTransactionsCursor> const& cursor,
+    std::vector<Row> const& rows,
+    uint32_t limit)
+{
+    std::lock_guard lck{mtx_};
+    // a ledger was applied since the read. It may not include that ledger
+    if (through < latestSeq_)
+        return;
+
+    Key start = cursor ? Key{cursor->ledgerSequence, cursor->transactionIndex}
+                       : Key{
+                             std::numeric_limits<uint32_t>::max(),
+                             std::numeric_limits<uint32_t>::max()};
+    bool const full = rows.size() >= limit;
+    auto it = entries_.find(account);
+    if (it == entries_.end())
+    {
+        // only a read of the newest rows caches the account. account_tx
+        // starts those at the most recent ledger, and index INT32_MAX
+        if (start < Key{through, std::numeric_limits<int32_t>::max()})
+            return;
+        if (entries_.size() >= maxAccounts_)
+        {
+            entries_.erase(lru_.back());
+            lru_.pop_back();
+        }
+
+        Entry entry;
+        // rows of a ledger still being written are added once it is applied
+        for (auto const& row : rows)
+            if (row.ledgerSequence <= through)
+                entry.rows.push_back(row);
+        entry.floor = full ? key(rows.back()) : Key{0, 0};
+        entry.through = through;
+        lru_.push_front(account);
+        entry.lru = lru_.begin();
+        trim(entry);
+        entries_.emplace(account, std::move(entry));
+        return;
+    }
+
+    // the next page below the cached rows. rows are all older than these
+    auto& entry = it->second;
+    if (entry.floor == Key{0, 0} || start != entry.floor ||
+        entry.rows.size() >= maxRows)
+        return;
+    entry.rows.insert(entry.rows.end(), rows.begin(), rows.end());
+    entry.floor = full ? key(rows.back()) : Key{0, 0};
+    trim(entry);
+}
+
+void
+AccountTxCache::update(
+    std::vector<AccountTransactionsData> const& data,
+    uint32_t seq)
+{
+    auto groups = groupAccountTransactions(data);
+    std::lock_guard lck{mtx_};
+    if (seq <= latestSeq_)
+        return;
+    latestSeq_ = seq;
+
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        auto& entry = it->second;
+        // cached after the ledger was applied to the database
+        if (entry.through >= seq)
+        {
+            ++it;
+            continue;
+        }
+        if (entry.through + 1 != seq)
+        {
+            lru_.erase(entry.lru);
+            it = entries_.erase(it);
+            continue;
+        }
+
+        // groups are sorted by account
+        auto group = std::lower_bound(
+            groups.begin(),
+            groups.end(),
+            it->first,
+            [](AccountLedgerTransactions const& group,
+               ripple::AccountID const& account) {
+                return group.account < account;
+            });
+        if (group != groups.end() && group->account == it->first)
+        {
+            // transactions are in index order, so the last one is newest
+            for (auto& [index, hash] : group->transactions)
+                entry.rows.push_front({seq, index, hash});
+            trim(entry);
+        }
+        entry.through = seq;
+        ++it;
+    }
+}
+
+size_t
+AccountTxCache::size()
+{
+    std::lock_guard lck{mtx_};
+    return entries_.size();
+}
+
+std::pair<uint64_t, uint64_t>
+AccountTxCache::stats()
+{
+    std::lock_guard lck{mtx_};
+    return {hits_, misses_};
+}
+
+}  // namespace Backend
@@ -0,0 +1,120 @@
+#ifndef CLIO_ACCOUNTTXCACHE_H_INCLUDED
+#define CLIO_ACCOUNTTXCACHE_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <backend/DBHelpers.h>
+#include <backend/Types.h>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+namespace Backend {
+// In-memory heads of the account_tx partitions of recently requested
+// accounts, as of the most recent ledger.
+//
+// An account is cached the first time a page of its newest transactions is
+// read from the database, and kept up to date with the transactions of every
+// following ledger. Pages read further back extend the cached rows, so a
+// client paging through the history of a hot account resumes from memory
+// where the previous page ended.
+class AccountTxCache
+{
+public:
+    struct Row
+    {
+        uint32_t ledgerSequence;
+        uint32_t transactionIndex;
+        ripple::uint256 hash;
+    };
+
+    struct Page
+    {
+        std::vector<ripple::uint256> hashes;
+        // set if the page is full, as for a read from the database
+        std::optional<AccountTransactionsCursor> cursor;
+    };
+
+private:
+    // ledger sequence and transaction index, the clustering key of account_tx
+    using Key = std::pair<uint32_t, uint32_t>;
+
+    struct Entry
+    {
+        // newest first
+        std::deque<Row> rows;
+        // every row of the account at or above floor is in rows. {0, 0} once
+        // rows hold the whole history of the account
+        Key floor;
+        // rows are complete up to this ledger
+        uint32_t through;
+        std::list<ripple::AccountID>::iterator lru;
+    };
+
+    std::mutex mtx_;
+    std::unordered_map<ripple::AccountID, Entry, ripple::hardened_hash<>>
+        entries_;
+    // most recently used first
+    std::list<ripple::AccountID> lru_;
+    uint32_t latestSeq_ = 0;
+    size_t const maxAccounts_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    // beyond this, the oldest rows of an account are dropped
+    static constexpr size_t maxRows = 512;
+
+    static Key
+    key(Row const& row)
+    {
+        return {row.ledgerSequence, row.transactionIndex};
+    }
+
+    void
+    trim(Entry& entry);
+
+public:
+    explicit AccountTxCache(size_t maxAccounts) : maxAccounts_(maxAccounts)
+    {
+    }
+
+    // A page of the transactions of account, as fetchAccountTransactions()
+    // returns it. maxSeq is the most recent ledger the page must include.
+    // empty optional if the cache does not hold every row of the page
+    std::optional<Page>
+    get(ripple::AccountID const& account,
+        uint32_t limit,
+        bool forward,
+        std::optional<AccountTransactionsCursor> const& cursor,
+        uint32_t maxSeq);
+
+    // Add rows, the result of a backward read of up to limit rows of account
+    // below cursor, from a database whose most recent ledger was through.
+    // Reads from the head of the account cache it. Reads continuing from the
+    // oldest cached row extend it. Other reads are ignored
+    void
+    insert(
+        ripple::AccountID const& account,
+        uint32_t through,
+        std::optional<AccountTransactionsCursor> const& cursor,
+        std::vector<Row> const& rows,
+        uint32_t limit);
+
+    // Apply the account_tx rows of ledger seq. Accounts not up to date with
+    // the previous ledger are dropped, and cached again when next requested
+    void
+    update(std::vector<AccountTransactionsData> const& data, uint32_t seq);
+
+    size_t
+    size();
+
+    // hits and misses of get()
+    std::pair<uint64_t, uint64_t>
+    stats();
+};
+
+}  // namespace Backend
+#endif
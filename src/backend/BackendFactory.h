@@ -22,6 +22,16 @@ make_Backend(boost::json::object const& config)
 
     std::shared_ptr<BackendInterface> backend = nullptr;
 
+    // the cache is owned by BackendInterface, which only sees the config of
+    // the selected database
+    if (config.contains("cache") && dbConfig.contains(type))
+    {
+        dbConfig.at(type).as_object()["cache"] = config.at("cache");
+        dbConfig.at(type).as_object()["read_only"] = readOnly;
+    }
+    if (config.contains("compression") && dbConfig.contains(type))
+        dbConfig.at(type).as_object()["compression"] = config.at("compression");
+
     if (boost::iequals(type, "cassandra"))
     {
         if (config.contains("online_delete"))
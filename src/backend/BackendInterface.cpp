@@ -1,17 +1,144 @@
 #include <ripple/protocol/Indexes.h>
 #include <ripple/protocol/STLedgerEntry.h>
 #include <backend/BackendInterface.h>
+#include <log/Log.h>
+#include <log/Trace.h>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 namespace Backend {
+uint32_t
+BackendInterface::numCacheVersions(boost::json::object const& config)
+{
+    if (!config.contains("cache"))
+        return defaultCacheVersions;
+    auto const& cacheConfig = config.at("cache").as_object();
+    if (!cacheConfig.contains("num_versions"))
+        return defaultCacheVersions;
+    return cacheConfig.at("num_versions").as_int64();
+}
+
+uint64_t
+BackendInterface::transactionCacheBytes(boost::json::object const& config)
+{
+    uint64_t megabytes = defaultTransactionCacheMB;
+    if (config.contains("cache") &&
+        config.at("cache").as_object().contains("transactions_mb"))
+        megabytes =
+            config.at("cache").as_object().at("transactions_mb").as_int64();
+    return megabytes << 20;
+}
+
+uint32_t
+BackendInterface::accountTxCacheSize(boost::json::object const& config)
+{
+    if (!config.contains("cache"))
+        return defaultAccountTxCacheSize;
+    auto const& cacheConfig = config.at("cache").as_object();
+    if (!cacheConfig.contains("account_tx_accounts"))
+        return defaultAccountTxCacheSize;
+    return cacheConfig.at("account_tx_accounts").as_int64();
+}
+
+uint32_t
+BackendInterface::trustLineCacheSize(boost::json::object const& config)
+{
+    if (!config.contains("cache"))
+        return defaultTrustLineCacheSize;
+    auto const& cacheConfig = config.at("cache").as_object();
+    if (!cacheConfig.contains("trust_line_accounts"))
+        return defaultTrustLineCacheSize;
+    return cacheConfig.at("trust_line_accounts").as_int64();
+}
+
+uint32_t
+BackendInterface::ledgerHeaderCacheSize(boost::json::object const& config)
+{
+    if (!config.contains("cache"))
+        return defaultLedgerHeaderCacheSize;
+    auto const& cacheConfig = config.at("cache").as_object();
+    if (!cacheConfig.contains("ledger_headers"))
+        return defaultLedgerHeaderCacheSize;
+    return cacheConfig.at("ledger_headers").as_int64();
+}
+
+size_t
+BackendInterface::partialCacheBytes(boost::json::object const& config)
+{
+    if (!config.contains("cache"))
+        return 0;
+    auto const& cacheConfig = config.at("cache").as_object();
+    if (!cacheConfig.contains("mode") ||
+        cacheConfig.at("mode").as_string() != "partial")
+        return 0;
+    // the ETL of a writer reads successors from the full cache
+    if (!config.contains("read_only") || !config.at("read_only").as_bool())
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " - partial cache requires read_only. Using the "
+            << "full cache";
+        return 0;
+    }
+    uint64_t megabytes = defaultPartialCacheMB;
+    if (cacheConfig.contains("max_mb"))
+        megabytes = cacheConfig.at("max_mb").as_int64();
+    return megabytes << 20;
+}
+
+void
+BackendInterface::putPartial(
+    ripple::uint256 const& key,
+    uint32_t sequence,
+    Blob const& blob) const
+{
+    if (partialCache_.enabled())
+        partialCache_.put(
+            key, sequence, blob.empty() ? BlobView{} : BlobView{Blob{blob}});
+}
+
+std::optional<ripple::LedgerInfo>
+BackendInterface::fetchLedgerBySequence(uint32_t sequence) const
+{
+    if (auto info = headerCache_.get(sequence))
+        return info;
+    if (auto info = Prefetched::header(sequence))
+        return info;
+    return ledgerFlights_.run(sequence, [&]() {
+        Trace::Span span{"db.ledger"};
+        span.attribute("sequence", sequence);
+        ReadCounter::add(1);
+        return doFetchLedgerBySequence(sequence);
+    });
+}
+
+std::optional<ripple::LedgerInfo>
+BackendInterface::fetchLedgerByHash(ripple::uint256 const& hash) const
+{
+    if (auto info = headerCache_.get(hash))
+        return info;
+    ReadCounter::add(1);
+    return doFetchLedgerByHash(hash);
+}
+
 bool
 BackendInterface::finishWrites(uint32_t ledgerSequence)
 {
-    auto commitRes = doFinishWrites();
+    auto commitRes = doFinishWrites(ledgerSequence);
     if (commitRes)
     {
         updateRange(ledgerSequence);
     }
     return commitRes;
 }
+
+bool
+BackendInterface::finishBackfill(uint32_t ledgerSequence)
+{
+    auto commitRes = doFinishBackfill(ledgerSequence);
+    if (commitRes)
+        updateRange(ledgerSequence);
+    return commitRes;
+}
 void
 BackendInterface::writeLedgerObject(
     std::string&& key,
@@ -39,6 +166,43 @@ BackendInterface::hardFetchLedgerRangeNoThrow() const
         }
     }
 }
+std::optional<Blob>
+BackendInterface::readLedgerObject(
+    ripple::uint256 const& key,
+    uint32_t sequence) const
+{
+    return objectFlights_.run({key, sequence}, [&]() {
+        Trace::Span span{"db.object"};
+        span.attribute("sequence", sequence);
+        ReadCounter::add(1);
+        return doFetchLedgerObject(key, sequence);
+    });
+}
+
+std::optional<ripple::uint256>
+BackendInterface::readSuccessorKey(
+    ripple::uint256 const& key,
+    uint32_t ledgerSequence) const
+{
+    return successorFlights_.run({key, ledgerSequence}, [&]() {
+        Trace::Span span{"db.successor"};
+        span.attribute("sequence", ledgerSequence);
+        ReadCounter::add(1);
+        return doFetchSuccessorKey(key, ledgerSequence);
+    });
+}
+
+boost::json::object
+BackendInterface::coalescedReads() const
+{
+    boost::json::object report;
+    report["objects"] = objectFlights_.report();
+    report["successors"] = successorFlights_.report();
+    report["transactions"] = transactionFlights_.report();
+    report["ledgers"] = ledgerFlights_.report();
+    return report;
+}
+
 // *** state data methods
 std::optional<Blob>
 BackendInterface::fetchLedgerObject(
@@ -48,21 +212,36 @@ BackendInterface::fetchLedgerObject(
     auto obj = cache_.get(key, sequence);
     if (obj)
     {
-        BOOST_LOG_TRIVIAL(debug)
+        CLIO_LOG_SAMPLED(debug)
             << __func__ << " - cache hit - " << ripple::strHex(key);
         return *obj;
     }
+    else if (auto partial = partialCache_.get(key, sequence))
+    {
+        CLIO_LOG_SAMPLED(debug)
+            << __func__ << " - partial cache hit - " << ripple::strHex(key);
+        if (partial->empty())
+            return {};
+        return partial->toBlob();
+    }
+    else if (auto prefetched = Prefetched::object(key, sequence))
+    {
+        if (prefetched->empty())
+            return {};
+        return prefetched->toBlob();
+    }
     else
     {
-        BOOST_LOG_TRIVIAL(debug)
+        CLIO_LOG_SAMPLED(debug)
             << __func__ << " - cache miss - " << ripple::strHex(key);
-        auto dbObj = doFetchLedgerObject(key, sequence);
+        auto dbObj = readLedgerObject(key, sequence);
         if (!dbObj)
-            BOOST_LOG_TRIVIAL(debug)
+            CLIO_LOG_SAMPLED(debug)
                 << __func__ << " - missed cache and missed in db";
         else
-            BOOST_LOG_TRIVIAL(debug)
+            CLIO_LOG_SAMPLED(debug)
                 << __func__ << " - missed cache but found in db";
+        putPartial(key, sequence, dbObj ? *dbObj : Blob{});
         return dbObj;
     }
 }
@@ -75,28 +254,114 @@ BackendInterface::fetchLedgerObjects(
     std::vector<Blob> results;
     results.resize(keys.size());
     std::vector<ripple::uint256> misses;
+    std::vector<size_t> missIndexes;
     for (size_t i = 0; i < keys.size(); ++i)
     {
         auto obj = cache_.get(keys[i], sequence);
         if (obj)
-            results[i] = *obj;
+            results[i] = std::move(*obj);
+        else if (auto partial = partialCache_.get(keys[i], sequence))
+            results[i] = partial->toBlob();
         else
+        {
             misses.push_back(keys[i]);
+            missIndexes.push_back(i);
+        }
     }
-    BOOST_LOG_TRIVIAL(debug)
+    CLIO_LOG_SAMPLED(debug)
         << __func__ << " - cache hits = " << keys.size() - misses.size()
         << " - cache misses = " << misses.size();
 
     if (misses.size())
     {
+        Trace::Span span{"db.objects"};
+        span.attribute("sequence", sequence);
+        span.attribute("keys", misses.size());
+        span.attribute("cache_hits", keys.size() - misses.size());
+        ReadCounter::add(misses.size());
         auto objs = doFetchLedgerObjects(misses, sequence);
-        for (size_t i = 0, j = 0; i < results.size(); ++i)
+        for (size_t j = 0; j < objs.size(); ++j)
         {
-            if (results[i].size() == 0)
-            {
-                results[i] = objs[j];
-                ++j;
-            }
+            putPartial(misses[j], sequence, objs[j]);
+            results[missIndexes[j]] = std::move(objs[j]);
+        }
+    }
+    return results;
+}
+std::optional<BlobView>
+BackendInterface::fetchLedgerObjectView(
+    ripple::uint256 const& key,
+    uint32_t sequence) const
+{
+    if (auto view = cache_.getView(key, sequence))
+    {
+        CLIO_LOG_SAMPLED(debug)
+            << __func__ << " - cache hit - " << ripple::strHex(key);
+        return view;
+    }
+    if (auto view = partialCache_.get(key, sequence))
+    {
+        CLIO_LOG_SAMPLED(debug)
+            << __func__ << " - partial cache hit - " << ripple::strHex(key);
+        if (view->empty())
+            return {};
+        return view;
+    }
+    if (auto view = Prefetched::object(key, sequence))
+    {
+        if (view->empty())
+            return {};
+        return view;
+    }
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - cache miss - " << ripple::strHex(key);
+    auto dbObj = readLedgerObject(key, sequence);
+    BlobView view = dbObj ? BlobView{std::move(*dbObj)} : BlobView{};
+    partialCache_.put(key, sequence, view);
+    if (view.empty())
+        return {};
+    return view;
+}
+
+std::vector<BlobView>
+BackendInterface::fetchLedgerObjectViews(
+    std::vector<ripple::uint256> const& keys,
+    uint32_t sequence) const
+{
+    std::vector<BlobView> results;
+    results.resize(keys.size());
+    std::vector<ripple::uint256> misses;
+    std::vector<size_t> missIndexes;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (auto view = cache_.getView(keys[i], sequence))
+            results[i] = std::move(*view);
+        else if (auto partial = partialCache_.get(keys[i], sequence))
+            results[i] = std::move(*partial);
+        else
+        {
+            misses.push_back(keys[i]);
+            missIndexes.push_back(i);
+        }
+    }
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - cache hits = " << keys.size() - misses.size()
+        << " - cache misses = " << misses.size();
+
+    if (misses.size())
+    {
+        Trace::Span span{"db.objects"};
+        span.attribute("sequence", sequence);
+        span.attribute("keys", misses.size());
+        span.attribute("cache_hits", keys.size() - misses.size());
+        ReadCounter::add(misses.size());
+        auto objs = doFetchLedgerObjects(misses, sequence);
+        for (size_t j = 0; j < objs.size(); ++j)
+        {
+            auto& view = results[missIndexes[j]];
+            if (objs[j].size())
+                view = BlobView{std::move(objs[j])};
+            partialCache_.put(misses[j], sequence, view);
         }
     }
     return results;
@@ -109,13 +374,355 @@ BackendInterface::fetchSuccessorKey(
 {
     auto succ = cache_.getSuccessor(key, ledgerSequence);
     if (succ)
-        BOOST_LOG_TRIVIAL(debug)
+    {
+        CLIO_LOG_SAMPLED(debug)
             << __func__ << " - cache hit - " << ripple::strHex(key);
-    else
-        BOOST_LOG_TRIVIAL(debug)
-            << __func__ << " - cache miss - " << ripple::strHex(key);
-    return succ ? succ->key : doFetchSuccessorKey(key, ledgerSequence);
+        return succ->key;
+    }
+    if (auto partial = partialCache_.successor(key, ledgerSequence))
+        return partial;
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - cache miss - " << ripple::strHex(key);
+    auto dbSucc = readSuccessorKey(key, ledgerSequence);
+    if (dbSucc)
+        partialCache_.putSuccessors(key, ledgerSequence, {*dbSucc});
+    return dbSucc;
+}
+void
+BackendInterface::fetchLedgerObjectsAsync(
+    std::vector<ripple::uint256> const& keys,
+    uint32_t sequence,
+    ReadHandler<std::vector<Blob>> handler) const
+{
+    std::vector<Blob> results;
+    results.resize(keys.size());
+    std::vector<ripple::uint256> misses;
+    std::vector<size_t> missIndexes;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (auto obj = cache_.get(keys[i], sequence))
+            results[i] = std::move(*obj);
+        else if (auto partial = partialCache_.get(keys[i], sequence))
+            results[i] = partial->toBlob();
+        else
+        {
+            misses.push_back(keys[i]);
+            missIndexes.push_back(i);
+        }
+    }
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - cache hits = " << keys.size() - misses.size()
+        << " - cache misses = " << misses.size();
+
+    if (misses.empty())
+    {
+        handler({}, std::move(results));
+        return;
+    }
+    ReadCounter::add(misses.size());
+    doFetchLedgerObjectsAsync(
+        misses,
+        sequence,
+        [this,
+         misses,
+         sequence,
+         results = std::move(results),
+         missIndexes = std::move(missIndexes),
+         handler = std::move(handler)](
+            boost::system::error_code ec, std::vector<Blob> objs) mutable {
+            if (ec)
+                return handler(ec, {});
+            for (size_t j = 0; j < objs.size(); ++j)
+            {
+                putPartial(misses[j], sequence, objs[j]);
+                results[missIndexes[j]] = std::move(objs[j]);
+            }
+            handler(ec, std::move(results));
+        });
+}
+
+namespace {
+// run a synchronous read, and pass its result or timeout to handler
+template <class T, class F>
+void
+completeSync(ReadHandler<T> const& handler, F&& read)
+{
+    T result;
+    try
+    {
+        result = read();
+    }
+    catch (DatabaseTimeout const&)
+    {
+        handler(boost::asio::error::timed_out, {});
+        return;
+    }
+    handler({}, std::move(result));
+}
+}  // namespace
+
+void
+BackendInterface::doFetchLedgerObjectsAsync(
+    std::vector<ripple::uint256> const& keys,
+    uint32_t sequence,
+    ReadHandler<std::vector<Blob>> handler) const
+{
+    completeSync(
+        handler, [&]() { return doFetchLedgerObjects(keys, sequence); });
+}
+
+void
+BackendInterface::fetchLedgerBySequenceAsync(
+    uint32_t sequence,
+    ReadHandler<std::optional<ripple::LedgerInfo>> handler) const
+{
+    completeSync(handler, [&]() { return fetchLedgerBySequence(sequence); });
+}
+
+void
+BackendInterface::doFetchTransactionsAsync(
+    std::vector<ripple::uint256> const& hashes,
+    ReadHandler<std::vector<TransactionAndMetadata>> handler) const
+{
+    completeSync(handler, [&]() { return doFetchTransactions(hashes); });
 }
+
+std::optional<TransactionAndMetadata>
+BackendInterface::fetchTransaction(ripple::uint256 const& hash) const
+{
+    if (auto txn = txCache_.get(hash))
+        return txn;
+    auto txn = transactionFlights_.run(hash, [&]() {
+        Trace::Span span{"db.transaction"};
+        ReadCounter::add(1);
+        return doFetchTransaction(hash);
+    });
+    if (txn)
+        txCache_.put(hash, *txn);
+    return txn;
+}
+
+std::vector<TransactionAndMetadata>
+BackendInterface::fetchTransactions(
+    std::vector<ripple::uint256> const& hashes) const
+{
+    std::vector<TransactionAndMetadata> results;
+    results.resize(hashes.size());
+    std::vector<ripple::uint256> misses;
+    std::vector<size_t> missIndexes;
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        if (auto txn = txCache_.get(hashes[i]))
+            results[i] = std::move(*txn);
+        else
+        {
+            misses.push_back(hashes[i]);
+            missIndexes.push_back(i);
+        }
+    }
+    if (misses.empty())
+        return results;
+
+    Trace::Span span{"db.transactions"};
+    span.attribute("hashes", misses.size());
+    span.attribute("cache_hits", hashes.size() - misses.size());
+    ReadCounter::add(misses.size());
+    auto txns = doFetchTransactions(misses);
+    for (size_t j = 0; j < txns.size(); ++j)
+    {
+        // transactions that were not found are empty
+        if (txns[j].transaction.size())
+            txCache_.put(misses[j], txns[j]);
+        results[missIndexes[j]] = std::move(txns[j]);
+    }
+    return results;
+}
+
+AccountTransactions
+BackendInterface::fetchAccountTransactions(
+    ripple::AccountID const& account,
+    std::uint32_t limit,
+    bool forward,
+    std::optional<AccountTransactionsCursor> const& cursor) const
+{
+    auto page = fetchAccountTransactionHashes(account, limit, forward, cursor);
+    return {fetchTransactions(page.hashes), page.cursor};
+}
+
+void
+BackendInterface::fetchTransactionsAsync(
+    std::vector<ripple::uint256> const& hashes,
+    ReadHandler<std::vector<TransactionAndMetadata>> handler) const
+{
+    std::vector<TransactionAndMetadata> results;
+    results.resize(hashes.size());
+    std::vector<ripple::uint256> misses;
+    std::vector<size_t> missIndexes;
+    for (size_t i = 0; i < hashes.size(); ++i)
+    {
+        if (auto txn = txCache_.get(hashes[i]))
+            results[i] = std::move(*txn);
+        else
+        {
+            misses.push_back(hashes[i]);
+            missIndexes.push_back(i);
+        }
+    }
+    if (misses.empty())
+    {
+        handler({}, std::move(results));
+        return;
+    }
+    ReadCounter::add(misses.size());
+    doFetchTransactionsAsync(
+        misses,
+        [this,
+         misses,
+         results = std::move(results),
+         missIndexes = std::move(missIndexes),
+         handler = std::move(handler)](
+            boost::system::error_code ec,
+            std::vector<TransactionAndMetadata> txns) mutable {
+            if (ec)
+                return handler(ec, {});
+            for (size_t j = 0; j < txns.size(); ++j)
+            {
+                if (txns[j].transaction.size())
+                    txCache_.put(misses[j], txns[j]);
+                results[missIndexes[j]] = std::move(txns[j]);
+            }
+            handler(ec, std::move(results));
+        });
+}
+
+std::vector<ripple::uint256>
+BackendInterface::fetchSuccessorKeys(
+    ripple::uint256 key,
+    uint32_t ledgerSequence,
+    std::uint32_t count) const
+{
+    std::vector<ripple::uint256> keys;
+    while (keys.size() < count)
+    {
+        auto succ = cache_.getSuccessor(
+            keys.size() ? keys.back() : key, ledgerSequence);
+        if (!succ)
+            break;
+        keys.push_back(succ->key);
+    }
+    while (keys.size() < count)
+    {
+        auto succ = partialCache_.successor(
+            keys.size() ? keys.back() : key, ledgerSequence);
+        if (!succ)
+            break;
+        keys.push_back(*succ);
+    }
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - cache hits = " << keys.size() << " - "
+        << ripple::strHex(key);
+    if (keys.size() < count)
+    {
+        Trace::Span span{"db.successors"};
+        span.attribute("sequence", ledgerSequence);
+        span.attribute("cache_hits", keys.size());
+        auto const first = keys.size() ? keys.back() : key;
+        auto rest =
+            doFetchSuccessorKeys(first, ledgerSequence, count - keys.size());
+        ReadCounter::add(rest.size());
+        partialCache_.putSuccessors(first, ledgerSequence, rest);
+        keys.insert(keys.end(), rest.begin(), rest.end());
+    }
+    return keys;
+}
+
+std::vector<ripple::uint256>
+BackendInterface::doFetchSuccessorKeys(
+    ripple::uint256 key,
+    uint32_t ledgerSequence,
+    std::uint32_t count) const
+{
+    std::vector<ripple::uint256> keys;
+    while (keys.size() < count)
+    {
+        auto succ = doFetchSuccessorKey(
+            keys.size() ? keys.back() : key, ledgerSequence);
+        if (!succ)
+            break;
+        keys.push_back(std::move(*succ));
+    }
+    return keys;
+}
+
+std::vector<ripple::SLE>
+BackendInterface::fetchDirectoryPages(
+    ripple::uint256 const& root,
+    uint32_t ledgerSequence) const
+{
+    std::vector<ripple::SLE> pages;
+    walkDirectoryPages(root, ledgerSequence, [&pages](ripple::SLE const& page) {
+        pages.push_back(page);
+        return true;
+    });
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " - pages = " << pages.size() << " - "
+        << ripple::strHex(root);
+    return pages;
+}
+
+void
+BackendInterface::walkDirectoryPages(
+    ripple::uint256 const& root,
+    uint32_t ledgerSequence,
+    std::function<bool(ripple::SLE const&)> const& atPage,
+    std::uint32_t prefetch) const
+{
+    auto rootPage = fetchLedgerObjectView(root, ledgerSequence);
+    if (!rootPage)
+        return;
+    ripple::SLE page{ripple::SerialIter{rootPage->data, rootPage->size}, root};
+    if (!atPage(page))
+        return;
+
+    // a page is appended with the number after the last page, which the root
+    // records as its previous page. Deleting pages leaves gaps, but the chain
+    // stays in ascending order, so the pages left to visit are numbered
+    // between the next page and the last one
+    auto const last = page.getFieldU64(ripple::sfIndexPrevious);
+    auto next = page.getFieldU64(ripple::sfIndexNext);
+    std::unordered_map<std::uint64_t, BlobView> prefetched;
+    prefetch = std::clamp<std::uint32_t>(prefetch, 1, directoryPrefetch);
+    while (next)
+    {
+        auto it = prefetched.find(next);
+        if (it == prefetched.end())
+        {
+            prefetched.clear();
+            std::vector<ripple::uint256> keys;
+            for (auto n = next;
+                 keys.size() < prefetch && (n == next || n <= last);
+                 ++n)
+                keys.push_back(ripple::keylet::page(root, n).key);
+            auto views = fetchLedgerObjectViews(keys, ledgerSequence);
+            for (size_t i = 0; i < views.size(); ++i)
+            {
+                if (!views[i].empty())
+                    prefetched.emplace(next + i, std::move(views[i]));
+            }
+            prefetch = std::min(2 * prefetch, directoryPrefetch);
+            it = prefetched.find(next);
+            if (it == prefetched.end())
+                break;
+        }
+        ripple::SLE dir{
+            ripple::SerialIter{it->second.data, it->second.size},
+            ripple::keylet::page(root, next).key};
+        if (!atPage(dir))
+            return;
+        next = dir.getFieldU64(ripple::sfIndexNext);
+    }
+}
+
 std::optional<LedgerObject>
 BackendInterface::fetchSuccessorObject(
     ripple::uint256 key,
@@ -137,35 +744,84 @@ BackendInterface::fetchBookOffers(
     std::uint32_t limit,
     std::optional<ripple::uint256> const& cursor) const
 {
-    // TODO try to speed this up. This can take a few seconds. The goal is
-    // to get it down to a few hundred milliseconds.
     BookOffersPage page;
+    auto keys = fetchBookOfferKeys(book, ledgerSequence, limit);
+    auto objs = fetchLedgerObjects(keys, ledgerSequence);
+    for (size_t i = 0; i < keys.size() && i < limit; ++i)
+    {
+        CLIO_LOG_SAMPLED(debug)
+            << __func__ << " key = " << ripple::strHex(keys[i])
+            << " blob = " << ripple::strHex(objs[i])
+            << " ledgerSequence = " << ledgerSequence;
+        assert(objs[i].size());
+        page.offers.push_back({keys[i], objs[i]});
+    }
+    return page;
+}
+
+std::vector<ripple::uint256>
+BackendInterface::fetchBookOfferKeys(
+    ripple::uint256 const& book,
+    uint32_t ledgerSequence,
+    std::uint32_t limit) const
+{
+    std::vector<ripple::uint256> keys;
+    if (auto offers = bookIndex_.getOffers(book, ledgerSequence, limit))
+    {
+        keys = std::move(*offers);
+    }
+    else if (
+        cache_.isFull() && ledgerSequence == bookIndex_.latestSequence())
+    {
+        // walk the whole book once, so later requests are served from the
+        // index
+        std::vector<LedgerObject> pages;
+        keys = walkBookDirectories(
+            book, ledgerSequence, std::numeric_limits<uint32_t>::max(), &pages);
+        if (bookIndex_.insert(book, ledgerSequence, pages))
+        {
+            CLIO_LOG_SAMPLED(debug)
+                << __func__ << " indexed book " << ripple::strHex(book)
+                << ". num pages = " << pages.size();
+        }
+    }
+    else
+    {
+        keys = walkBookDirectories(book, ledgerSequence, limit, nullptr);
+    }
+    // walks stop at the end of a directory page, or of the book
+    if (keys.size() > limit)
+        keys.resize(limit);
+    return keys;
+}
+
+std::vector<ripple::uint256>
+BackendInterface::walkBookDirectories(
+    ripple::uint256 const& book,
+    uint32_t ledgerSequence,
+    std::uint32_t limit,
+    std::vector<LedgerObject>* pages) const
+{
     const ripple::uint256 bookEnd = ripple::getQualityNext(book);
     ripple::uint256 uTipIndex = book;
-    bool done = false;
     std::vector<ripple::uint256> keys;
-    auto getMillis = [](auto diff) {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(diff)
-            .count();
-    };
-    auto begin = std::chrono::system_clock::now();
+    Trace::Span span{"walk_book_directories"};
     uint32_t numSucc = 0;
     uint32_t numPages = 0;
-    long succMillis = 0;
-    long pageMillis = 0;
     while (keys.size() < limit)
     {
-        auto mid1 = std::chrono::system_clock::now();
-        auto offerDir = fetchSuccessorObject(uTipIndex, ledgerSequence);
-        auto mid2 = std::chrono::system_clock::now();
+        auto offerDir = [&]() {
+            Trace::Span succSpan{"book_successor"};
+            return fetchSuccessorObject(uTipIndex, ledgerSequence);
+        }();
         numSucc++;
-        succMillis += getMillis(mid2 - mid1);
         if (!offerDir || offerDir->key > bookEnd)
         {
             BOOST_LOG_TRIVIAL(debug) << __func__ << " - offerDir.has_value() "
                                      << offerDir.has_value() << " breaking";
             break;
         }
+        Trace::Span pagesSpan{"book_pages"};
         while (keys.size() < limit)
         {
             ++numPages;
@@ -176,6 +832,8 @@ BackendInterface::fetchBookOffers(
                 offerDir->key};
             auto indexes = sle.getFieldV256(ripple::sfIndexes);
             keys.insert(keys.end(), indexes.begin(), indexes.end());
+            if (pages)
+                pages->push_back(*offerDir);
             auto next = sle.getFieldU64(ripple::sfIndexNext);
             if (!next)
             {
@@ -189,37 +847,14 @@ BackendInterface::fetchBookOffers(
             offerDir->blob = *nextDir;
             offerDir->key = nextKey.key;
         }
-        auto mid3 = std::chrono::system_clock::now();
-        pageMillis += getMillis(mid3 - mid2);
-    }
-    auto mid = std::chrono::system_clock::now();
-    auto objs = fetchLedgerObjects(keys, ledgerSequence);
-    for (size_t i = 0; i < keys.size() && i < limit; ++i)
-    {
-        BOOST_LOG_TRIVIAL(debug)
-            << __func__ << " key = " << ripple::strHex(keys[i])
-            << " blob = " << ripple::strHex(objs[i])
-            << " ledgerSequence = " << ledgerSequence;
-        assert(objs[i].size());
-        page.offers.push_back({keys[i], objs[i]});
     }
-    auto end = std::chrono::system_clock::now();
-    BOOST_LOG_TRIVIAL(debug)
-        << __func__ << " "
-        << "Fetching " << std::to_string(keys.size()) << " offers took "
-        << std::to_string(getMillis(mid - begin))
-        << " milliseconds. Fetching next dir took "
-        << std::to_string(succMillis) << " milliseonds. Fetched next dir "
-        << std::to_string(numSucc) << " times"
-        << " Fetching next page of dir took " << std::to_string(pageMillis)
-        << " milliseconds"
-        << ". num pages = " << std::to_string(numPages)
-        << ". Fetching all objects took "
-        << std::to_string(getMillis(end - mid))
-        << " milliseconds. total time = "
-        << std::to_string(getMillis(end - begin)) << " milliseconds";
-
-    return page;
+    span.attribute("offers", keys.size());
+    span.attribute("successors", numSucc);
+    span.attribute("pages", numPages);
+    CLIO_LOG_SAMPLED(debug)
+        << __func__ << " fetched " << keys.size() << " offers. successors = "
+        << numSucc << ". num pages = " << numPages;
+    return keys;
 }
 
 LedgerPage
@@ -231,16 +866,8 @@ BackendInterface::fetchLedgerPage(
 {
     LedgerPage page;
 
-    std::vector<ripple::uint256> keys;
-    while (keys.size() < limit)
-    {
-        ripple::uint256 const& curCursor =
-            keys.size() ? keys.back() : cursor ? *cursor : firstKey;
-        auto succ = fetchSuccessorKey(curCursor, ledgerSequence);
-        if (!succ)
-            break;
-        keys.push_back(std::move(*succ));
-    }
+    auto keys =
+        fetchSuccessorKeys(cursor ? *cursor : firstKey, ledgerSequence, limit);
 
     auto objects = fetchLedgerObjects(keys, ledgerSequence);
     for (size_t i = 0; i < objects.size(); ++i)
@@ -253,9 +880,40 @@ BackendInterface::fetchLedgerPage(
     return page;
 }
 
+void
+BackendInterface::scanLedger(
+    uint32_t ledgerSequence,
+    std::function<void(std::vector<LedgerObject>&&)> const& handler,
+    std::uint32_t) const
+{
+    std::optional<ripple::uint256> cursor;
+    while (true)
+    {
+        LedgerPage page;
+        try
+        {
+            page = fetchLedgerPage(cursor, ledgerSequence, 256);
+        }
+        catch (DatabaseTimeout const&)
+        {
+            BOOST_LOG_TRIVIAL(warning)
+                << __func__ << " - database timeout fetching page";
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        cursor = page.cursor;
+        handler(std::move(page.objects));
+        if (!cursor)
+            return;
+    }
+}
+
 std::optional<ripple::Fees>
 BackendInterface::fetchFees(std::uint32_t seq) const
 {
+    if (auto fees = headerCache_.fees(seq))
+        return fees;
+
     ripple::Fees fees;
 
     auto key = ripple::keylet::fees().key;
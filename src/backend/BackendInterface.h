@@ -1,10 +1,25 @@
 #ifndef RIPPLE_APP_REPORTING_BACKENDINTERFACE_H_INCLUDED
 #define RIPPLE_APP_REPORTING_BACKENDINTERFACE_H_INCLUDED
 #include <ripple/ledger/ReadView.h>
+#include <ripple/protocol/STLedgerEntry.h>
 #include <boost/asio.hpp>
+#include <backend/AccountTxCache.h>
+#include <backend/BlobCodec.h>
+#include <backend/BookIndex.h>
 #include <backend/DBHelpers.h>
+#include <backend/LedgerHeaderCache.h>
+#include <backend/PartialCache.h>
 #include <backend/SimpleCache.h>
+#include <backend/SingleFlight.h>
+#include <backend/TransactionCache.h>
+#include <backend/TrustLineCache.h>
 #include <backend/Types.h>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 namespace Backend {
 
 class DatabaseTimeout : public std::exception
@@ -16,14 +31,281 @@ class DatabaseTimeout : public std::exception
     }
 };
 
+// Counts the objects the requests running on a thread read from the
+// database, rather than a cache, so requests can be charged for the work
+// they cause. Reads are counted while a Scope is alive on the thread
+class ReadCounter
+{
+    static inline thread_local uint64_t* current_ = nullptr;
+
+public:
+    class Scope
+    {
+        uint64_t* const previous_;
+
+    public:
+        explicit Scope(uint64_t& reads) : previous_(current_)
+        {
+            current_ = &reads;
+        }
+
+        ~Scope()
+        {
+            current_ = previous_;
+        }
+
+        Scope(Scope const&) = delete;
+        Scope&
+        operator=(Scope const&) = delete;
+    };
+
+    static void
+    add(uint64_t reads)
+    {
+        if (current_)
+            *current_ += reads;
+    }
+
+    // The counter of this thread. A coroutine takes it along when it
+    // suspends, and sets it again on the thread it resumes on
+    static uint64_t*
+    current()
+    {
+        return current_;
+    }
+
+    static void
+    setCurrent(uint64_t* reads)
+    {
+        current_ = reads;
+    }
+};
+
+// A ledger header and objects read ahead, in one read for many requests
+// that need them, such as the requests of a batch. Requests running on a
+// thread find them while a Scope is alive on the thread
+class Prefetched
+{
+    static inline thread_local Prefetched const* current_ = nullptr;
+
+    uint32_t sequence_ = 0;
+    std::optional<ripple::LedgerInfo> header_;
+    std::unordered_map<ripple::uint256, BlobView, ripple::hardened_hash<>>
+        objects_;
+
+public:
+    Prefetched() = default;
+
+    // objects[i] is the object of keys[i] as of sequence
+    Prefetched(
+        uint32_t sequence,
+        std::optional<ripple::LedgerInfo> header,
+        std::vector<ripple::uint256> const& keys,
+        std::vector<BlobView>&& objects)
+        : sequence_(sequence), header_(std::move(header))
+    {
+        for (size_t i = 0; i < keys.size() && i < objects.size(); ++i)
+            objects_.emplace(keys[i], std::move(objects[i]));
+    }
+
+    class Scope
+    {
+        Prefetched const* const previous_;
+
+    public:
+        explicit Scope(Prefetched const& prefetched) : previous_(current_)
+        {
+            current_ = &prefetched;
+        }
+
+        ~Scope()
+        {
+            current_ = previous_;
+        }
+
+        Scope(Scope const&) = delete;
+        Scope&
+        operator=(Scope const&) = delete;
+    };
+
+    // The objects read ahead for this thread, taken along by coroutines
+    // like ReadCounter::current()
+    static Prefetched const*
+    current()
+    {
+        return current_;
+    }
+
+    static void
+    setCurrent(Prefetched const* prefetched)
+    {
+        current_ = prefetched;
+    }
+
+    // The header of ledger sequence, if it was read ahead
+    static std::optional<ripple::LedgerInfo>
+    header(uint32_t sequence)
+    {
+        if (!current_ || current_->sequence_ != sequence)
+            return {};
+        return current_->header_;
+    }
+
+    // The object of key as of sequence, if it was read ahead. Empty if the
+    // object does not exist
+    static std::optional<BlobView>
+    object(ripple::uint256 const& key, uint32_t sequence)
+    {
+        if (!current_ || current_->sequence_ != sequence)
+            return {};
+        auto it = current_->objects_.find(key);
+        if (it == current_->objects_.end())
+            return {};
+        return it->second;
+    }
+};
+
+// Completion handler of an asynchronous read. If the read failed or timed out,
+// the error is boost::asio::error::timed_out and the value is empty
+template <class T>
+using ReadHandler = std::function<void(boost::system::error_code, T)>;
+
 class BackendInterface
 {
+    // number of most recent ledgers served from the cache for every object
+    static constexpr uint32_t defaultCacheVersions = 8;
+
+    static uint32_t
+    numCacheVersions(boost::json::object const& config);
+
+    // accounts whose newest transactions are kept in memory
+    static constexpr uint32_t defaultAccountTxCacheSize = 1024;
+
+    static uint32_t
+    accountTxCacheSize(boost::json::object const& config);
+
+    static constexpr uint64_t defaultTransactionCacheMB = 256;
+
+    static uint64_t
+    transactionCacheBytes(boost::json::object const& config);
+
+    // accounts whose trust lines are kept in memory
+    static constexpr uint32_t defaultTrustLineCacheSize = 1024;
+
+    static uint32_t
+    trustLineCacheSize(boost::json::object const& config);
+
+    // most recent ledgers whose headers and fees are kept in memory
+    static constexpr uint32_t defaultLedgerHeaderCacheSize = 256;
+
+    static uint32_t
+    ledgerHeaderCacheSize(boost::json::object const& config);
+
+    // memory budget of the partial cache, when cache.mode is "partial"
+    static constexpr uint64_t defaultPartialCacheMB = 4096;
+
+    // 0 unless the partial cache is configured
+    static size_t
+    partialCacheBytes(boost::json::object const& config);
+
+    // add an object read from the database to the partial cache. blob is
+    // empty if the object does not exist
+    void
+    putPartial(ripple::uint256 const& key, uint32_t sequence, Blob const& blob)
+        const;
+
+    // Concurrent reads of the same thing that miss the caches share one
+    // query. Mutable, since reads join and leave them
+    mutable SingleFlight<KeyAndSeq, std::optional<Blob>, KeyAndSeqHash>
+        objectFlights_;
+    mutable SingleFlight<
+        KeyAndSeq,
+        std::optional<ripple::uint256>,
+        KeyAndSeqHash>
+        successorFlights_;
+    mutable SingleFlight<
+        ripple::uint256,
+        std::optional<TransactionAndMetadata>,
+        ripple::hardened_hash<>>
+        transactionFlights_;
+    mutable SingleFlight<uint32_t, std::optional<ripple::LedgerInfo>>
+        ledgerFlights_;
+
+    // doFetchLedgerObject and doFetchSuccessorKey, through the flights
+    std::optional<Blob>
+    readLedgerObject(ripple::uint256 const& key, uint32_t sequence) const;
+
+    std::optional<ripple::uint256>
+    readSuccessorKey(ripple::uint256 const& key, uint32_t ledgerSequence)
+        const;
+
+    // directory pages fetched per round trip by fetchDirectoryPages()
+    static constexpr std::uint32_t directoryPrefetch = 32;
+
+    // Start a read with initiate, which is passed a ReadHandler<T>, and
+    // complete token once the read completes. The handler of token is always
+    // invoked through its associated executor, never from a driver thread
+    template <class T, class CompletionToken, class Initiate>
+    static auto
+    asyncRead(CompletionToken&& token, Initiate&& initiate)
+    {
+        return boost::asio::async_initiate<
+            CompletionToken,
+            void(boost::system::error_code, T)>(
+            [](auto handler, auto initiate) {
+                using Handler = std::decay_t<decltype(handler)>;
+                auto shared = std::make_shared<Handler>(std::move(handler));
+                auto work = boost::asio::make_work_guard(
+                    boost::asio::get_associated_executor(*shared));
+                initiate(ReadHandler<T>{
+                    [shared, work](boost::system::error_code ec, T value) {
+                        boost::asio::post(
+                            work.get_executor(),
+                            [shared, ec, value = std::move(value)]() mutable {
+                                (*shared)(ec, std::move(value));
+                            });
+                    }});
+            },
+            token,
+            std::forward<Initiate>(initiate));
+    }
+
+    // keys of the offers of book, up to limit, by walking its directories.
+    // if pages is set, every directory page walked is appended to it
+    std::vector<ripple::uint256>
+    walkBookDirectories(
+        ripple::uint256 const& book,
+        uint32_t ledgerSequence,
+        std::uint32_t limit,
+        std::vector<LedgerObject>* pages) const;
+
 protected:
-    std::optional<LedgerRange> range;
+    // mutable, since online delete raises the minimum
+    mutable std::optional<LedgerRange> range;
     SimpleCache cache_;
+    // mutable, since books are indexed the first time they are read
+    mutable BookIndex bookIndex_;
+    // mutable, since accounts are cached the first time they are read
+    mutable AccountTxCache accountTxCache_;
+    // mutable, since reads insert the transactions they fetch
+    mutable TransactionCache txCache_;
+    // mutable, since accounts are cached the first time they are read
+    mutable TrustLineCache trustLineCache_;
+    LedgerHeaderCache headerCache_;
+    // mutable, since reads insert the objects and successors they fetch
+    mutable PartialCache partialCache_;
+    // compresses the blobs backends write, and decompresses those they read
+    BlobCodec const codec_;
 
 public:
     BackendInterface(boost::json::object const& config)
+        : cache_{numCacheVersions(config)}
+        , accountTxCache_{accountTxCacheSize(config)}
+        , txCache_{transactionCacheBytes(config)}
+        , trustLineCache_{trustLineCacheSize(config)}
+        , headerCache_{ledgerHeaderCacheSize(config)}
+        , partialCache_{partialCacheBytes(config)}
+        , codec_{config}
     {
     }
     virtual ~BackendInterface()
@@ -50,11 +332,79 @@ public:
         return cache_;
     }
 
+    BookIndex&
+    bookIndex()
+    {
+        return bookIndex_;
+    }
+
+    AccountTxCache&
+    accountTxCache()
+    {
+        return accountTxCache_;
+    }
+
+    TransactionCache&
+    transactionCache() const
+    {
+        return txCache_;
+    }
+
+    TrustLineCache&
+    trustLineCache() const
+    {
+        return trustLineCache_;
+    }
+
+    LedgerHeaderCache const&
+    headerCache() const
+    {
+        return headerCache_;
+    }
+
+    LedgerHeaderCache&
+    headerCache()
+    {
+        return headerCache_;
+    }
+
+    // caches part of the state instead of cache_, on read-only nodes
+    PartialCache&
+    partialCache()
+    {
+        return partialCache_;
+    }
+
+    PartialCache const&
+    partialCache() const
+    {
+        return partialCache_;
+    }
+
+    BlobCodec const&
+    codec() const
+    {
+        return codec_;
+    }
+
+    // database reads run, and reads that shared one running already, of
+    // objects, successors, transactions and ledger headers
+    boost::json::object
+    coalescedReads() const;
+
+    // recent ledgers are served from the header cache, without reading the
+    // database
+    std::optional<ripple::LedgerInfo>
+    fetchLedgerBySequence(uint32_t sequence) const;
+
+    std::optional<ripple::LedgerInfo>
+    fetchLedgerByHash(ripple::uint256 const& hash) const;
+
     virtual std::optional<ripple::LedgerInfo>
-    fetchLedgerBySequence(uint32_t sequence) const = 0;
+    doFetchLedgerBySequence(uint32_t sequence) const = 0;
 
     virtual std::optional<ripple::LedgerInfo>
-    fetchLedgerByHash(ripple::uint256 const& hash) const = 0;
+    doFetchLedgerByHash(ripple::uint256 const& hash) const = 0;
 
     virtual std::optional<uint32_t>
     fetchLatestLedgerSequence() const = 0;
@@ -69,14 +419,31 @@ public:
     fetchFees(std::uint32_t seq) const;
 
     // *** transaction methods
+    // cache hits are not read from the database. Transactions read from it
+    // are added to the cache
+    std::optional<TransactionAndMetadata>
+    fetchTransaction(ripple::uint256 const& hash) const;
+
+    std::vector<TransactionAndMetadata>
+    fetchTransactions(std::vector<ripple::uint256> const& hashes) const;
+
     virtual std::optional<TransactionAndMetadata>
-    fetchTransaction(ripple::uint256 const& hash) const = 0;
+    doFetchTransaction(ripple::uint256 const& hash) const = 0;
 
     virtual std::vector<TransactionAndMetadata>
-    fetchTransactions(std::vector<ripple::uint256> const& hashes) const = 0;
+    doFetchTransactions(std::vector<ripple::uint256> const& hashes) const = 0;
 
-    virtual AccountTransactions
+    AccountTransactions
     fetchAccountTransactions(
+        ripple::AccountID const& account,
+        std::uint32_t limit,
+        bool forward = false,
+        std::optional<AccountTransactionsCursor> const& cursor = {}) const;
+
+    // Same as above, but only the hashes of the transactions, which
+    // fetchTransactions() reads
+    virtual AccountTransactionHashes
+    fetchAccountTransactionHashes(
         ripple::AccountID const& account,
         std::uint32_t limit,
         bool forward = false,
@@ -96,6 +463,17 @@ public:
     fetchLedgerObjects(
         std::vector<ripple::uint256> const& keys,
         uint32_t sequence) const;
+
+    // Same as above, but cache hits are returned without copying the blob.
+    // Prefer these in read paths that only deserialize the object
+    std::optional<BlobView>
+    fetchLedgerObjectView(ripple::uint256 const& key, uint32_t sequence) const;
+
+    std::vector<BlobView>
+    fetchLedgerObjectViews(
+        std::vector<ripple::uint256> const& keys,
+        uint32_t sequence) const;
+
     virtual std::optional<Blob>
     doFetchLedgerObject(ripple::uint256 const& key, uint32_t sequence)
         const = 0;
@@ -117,6 +495,17 @@ public:
         std::uint32_t limit,
         std::uint32_t limitHint = 0) const;
 
+    // Call handler with every object of ledger ledgerSequence, a batch at a
+    // time and in no particular order. Backends that can split the ledger
+    // scan up to concurrency parts of it at once, calling handler from as
+    // many threads. Timeouts are retried. The default pages through
+    // successors on the calling thread
+    virtual void
+    scanLedger(
+        uint32_t ledgerSequence,
+        std::function<void(std::vector<LedgerObject>&&)> const& handler,
+        std::uint32_t concurrency) const;
+
     // Fetches the successor to key/index
     std::optional<LedgerObject>
     fetchSuccessorObject(ripple::uint256 key, uint32_t ledgerSequence) const;
@@ -127,6 +516,41 @@ public:
     virtual std::optional<ripple::uint256>
     doFetchSuccessorKey(ripple::uint256 key, uint32_t ledgerSequence) const = 0;
 
+    // Fetches up to count keys following key, in order. Served from the cache
+    // as far as it can, then from the database
+    std::vector<ripple::uint256>
+    fetchSuccessorKeys(
+        ripple::uint256 key,
+        uint32_t ledgerSequence,
+        std::uint32_t count) const;
+
+    // Same as above, from the database only. The default follows the
+    // successor chain one key at a time. Backends that can walk the chain
+    // server side override this to fetch all keys in one round trip
+    virtual std::vector<ripple::uint256>
+    doFetchSuccessorKeys(
+        ripple::uint256 key,
+        uint32_t ledgerSequence,
+        std::uint32_t count) const;
+
+    // Fetches every page of the directory rooted at root, in the order of the
+    // chain of next pointers. Pages that are not in the cache are fetched
+    // ahead of the chain, up to directoryPrefetch pages per round trip, using
+    // the page numbers the chain is expected to follow
+    std::vector<ripple::SLE>
+    fetchDirectoryPages(ripple::uint256 const& root, uint32_t ledgerSequence)
+        const;
+
+    // Same as above, but hands each page to atPage as soon as it is read, and
+    // stops once atPage returns false. The first round trip fetches prefetch
+    // pages, and each one after twice as many, up to directoryPrefetch
+    void
+    walkDirectoryPages(
+        ripple::uint256 const& root,
+        uint32_t ledgerSequence,
+        std::function<bool(ripple::SLE const&)> const& atPage,
+        std::uint32_t prefetch = directoryPrefetch) const;
+
     BookOffersPage
     fetchBookOffers(
         ripple::uint256 const& book,
@@ -134,12 +558,145 @@ public:
         std::uint32_t limit,
         std::optional<ripple::uint256> const& cursor = {}) const;
 
+    // Same as above, but only the keys of the offers, which
+    // fetchLedgerObjects() reads
+    std::vector<ripple::uint256>
+    fetchBookOfferKeys(
+        ripple::uint256 const& book,
+        uint32_t ledgerSequence,
+        std::uint32_t limit) const;
+
+    // *** asynchronous read methods
+    // Asynchronous versions of the reads above, which complete token instead
+    // of blocking the calling thread until the database responds. Any asio
+    // completion token works, such as a callback, boost::asio::use_future or
+    // a yield_context. Handlers use them through the reads of RPCHelpers.h.
+    // The primitives are the do*Async methods, which backends with an
+    // asynchronous driver override. The defaults perform the synchronous
+    // read and then call the handler
+    template <class CompletionToken>
+    auto
+    asyncFetchLedgerObject(
+        ripple::uint256 const& key,
+        uint32_t sequence,
+        CompletionToken&& token) const
+    {
+        return asyncRead<std::optional<Blob>>(
+            std::forward<CompletionToken>(token),
+            [this, key, sequence](ReadHandler<std::optional<Blob>> handler) {
+                fetchLedgerObjectsAsync(
+                    {key},
+                    sequence,
+                    [handler = std::move(handler)](
+                        boost::system::error_code ec, std::vector<Blob> objs) {
+                        if (ec || objs.empty() || objs[0].empty())
+                            handler(ec, {});
+                        else
+                            handler(ec, std::move(objs[0]));
+                    });
+            });
+    }
+
+    template <class CompletionToken>
+    auto
+    asyncFetchLedgerObjects(
+        std::vector<ripple::uint256> keys,
+        uint32_t sequence,
+        CompletionToken&& token) const
+    {
+        return asyncRead<std::vector<Blob>>(
+            std::forward<CompletionToken>(token),
+            [this, keys = std::move(keys), sequence](
+                ReadHandler<std::vector<Blob>> handler) {
+                fetchLedgerObjectsAsync(keys, sequence, std::move(handler));
+            });
+    }
+
+    template <class CompletionToken>
+    auto
+    asyncFetchLedgerBySequence(uint32_t sequence, CompletionToken&& token)
+        const
+    {
+        return asyncRead<std::optional<ripple::LedgerInfo>>(
+            std::forward<CompletionToken>(token),
+            [this, sequence](
+                ReadHandler<std::optional<ripple::LedgerInfo>> handler) {
+                if (auto info = headerCache_.get(sequence))
+                    handler({}, std::move(info));
+                else
+                    fetchLedgerBySequenceAsync(sequence, std::move(handler));
+            });
+    }
+
+    template <class CompletionToken>
+    auto
+    asyncFetchTransactions(
+        std::vector<ripple::uint256> hashes,
+        CompletionToken&& token) const
+    {
+        return asyncRead<std::vector<TransactionAndMetadata>>(
+            std::forward<CompletionToken>(token),
+            [this, hashes = std::move(hashes)](
+                ReadHandler<std::vector<TransactionAndMetadata>> handler) {
+                fetchTransactionsAsync(hashes, std::move(handler));
+            });
+    }
+
+    // cache hits complete immediately, misses are read with
+    // doFetchLedgerObjectsAsync
+    void
+    fetchLedgerObjectsAsync(
+        std::vector<ripple::uint256> const& keys,
+        uint32_t sequence,
+        ReadHandler<std::vector<Blob>> handler) const;
+
+    virtual void
+    doFetchLedgerObjectsAsync(
+        std::vector<ripple::uint256> const& keys,
+        uint32_t sequence,
+        ReadHandler<std::vector<Blob>> handler) const;
+
+    virtual void
+    fetchLedgerBySequenceAsync(
+        uint32_t sequence,
+        ReadHandler<std::optional<ripple::LedgerInfo>> handler) const;
+
+    // cache hits complete immediately, misses are read with
+    // doFetchTransactionsAsync
+    void
+    fetchTransactionsAsync(
+        std::vector<ripple::uint256> const& hashes,
+        ReadHandler<std::vector<TransactionAndMetadata>> handler) const;
+
+    virtual void
+    doFetchTransactionsAsync(
+        std::vector<ripple::uint256> const& hashes,
+        ReadHandler<std::vector<TransactionAndMetadata>> handler) const;
+
+    // backend specific statistics, reported by server_info
+    virtual boost::json::object
+    stats() const
+    {
+        return {};
+    }
+
     virtual std::optional<LedgerRange>
     hardFetchLedgerRange() const = 0;
     // Doesn't throw DatabaseTimeout. Should be used with care.
     std::optional<LedgerRange>
     hardFetchLedgerRangeNoThrow() const;
 
+    // Wait until ledgerSequence may have been committed by another process,
+    // or until timeout. Backends that are notified of commits return as soon
+    // as they are. The others sleep for the whole timeout, so callers that
+    // fetch the range after every wait keep polling
+    virtual void
+    waitForCommit(uint32_t ledgerSequence, std::chrono::milliseconds timeout)
+        const
+    {
+        std::this_thread::sleep_for(timeout);
+    }
+
     void
     updateRange(uint32_t newMax)
     {
@@ -179,10 +736,51 @@ public:
     startWrites() = 0;
 
     // Tell the database we have finished writing all data for a particular
-    // ledger
+    // ledger. Waits for the writes of that ledger, and then commits it
     bool
     finishWrites(uint32_t ledgerSequence);
 
+    // Number of ledgers that may be written at once. If greater than 1, the
+    // writes of the next ledger may be issued before finishWrites() is called
+    // for the previous ledgers, as long as no more than this many ledgers are
+    // uncommitted. Ledgers must still be committed in order
+    virtual uint32_t
+    writeWindow() const
+    {
+        return 1;
+    }
+
+    // Whether the objects of the ledger being written may be written from
+    // different threads at once, as the initial ledger download does when it
+    // fetches from several ETL sources
+    virtual bool
+    supportsConcurrentWrites() const
+    {
+        return false;
+    }
+
+    // Whether different ledgers may be written from different threads at
+    // once, without startWrites() and finishWrites(), as the backfill of a
+    // historical range does. The ledgers are then committed together by
+    // finishBackfill()
+    virtual bool
+    supportsBackfill() const
+    {
+        return false;
+    }
+
+    // Wait for every write issued so far to finish
+    virtual void
+    waitForWrites()
+    {
+    }
+
+    // Commit every ledger after the latest committed ledger, up to and
+    // including ledgerSequence, after waiting for their writes. Every one of
+    // them must have been written. Requires supportsBackfill()
+    bool
+    finishBackfill(uint32_t ledgerSequence);
+
     virtual bool
     doOnlineDelete(uint32_t numLedgersToKeep) const = 0;
 
@@ -205,7 +803,13 @@ private:
         std::string&& blob) = 0;
 
     virtual bool
-    doFinishWrites() = 0;
+    doFinishWrites(uint32_t ledgerSequence) = 0;
+
+    virtual bool
+    doFinishBackfill(uint32_t ledgerSequence)
+    {
+        return false;
+    }
 };
 
 }  // namespace Backend
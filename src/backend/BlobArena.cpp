@@ -0,0 +1,68 @@
+#include <backend/BlobArena.h>
+#include <cassert>
+#include <cstring>
+namespace Backend {
+
+uint32_t
+BlobArena::newSlab(uint32_t capacity)
+{
+    Slab slab{
+        std::shared_ptr<unsigned char[]>(new unsigned char[capacity]),
+        capacity,
+        0,
+        0};
+    if (freeSlabs_.size())
+    {
+        auto idx = freeSlabs_.back();
+        freeSlabs_.pop_back();
+        slabs_[idx] = std::move(slab);
+        return idx;
+    }
+    slabs_.push_back(std::move(slab));
+    return slabs_.size() - 1;
+}
+
+BlobRef
+BlobArena::store(unsigned char const* data, size_t size)
+{
+    assert(size);
+    uint32_t idx;
+    if (size > slabSize)
+    {
+        idx = newSlab(size);
+    }
+    else
+    {
+        if (current_ >= slabs_.size() ||
+            slabs_[current_].capacity - slabs_[current_].used < size)
+            current_ = newSlab(slabSize);
+        idx = current_;
+    }
+    auto& slab = slabs_[idx];
+    BlobRef ref{idx, slab.used, static_cast<uint32_t>(size)};
+    std::memcpy(slab.data.get() + slab.used, data, size);
+    slab.used += size;
+    slab.live += size;
+    usedBytes_ += size;
+    liveBytes_ += size;
+    return ref;
+}
+
+void
+BlobArena::release(BlobRef const& ref)
+{
+    auto& slab = slabs_[ref.slab];
+    assert(slab.live >= ref.size);
+    slab.live -= ref.size;
+    liveBytes_ -= ref.size;
+}
+
+uint64_t
+BlobArena::allocatedBytes() const
+{
+    uint64_t bytes = 0;
+    for (auto const& slab : slabs_)
+        bytes += slab.capacity;
+    return bytes;
+}
+}  // namespace Backend
@@ -0,0 +1,141 @@
+#ifndef CLIO_BLOBARENA_H_INCLUDED
+#define CLIO_BLOBARENA_H_INCLUDED
+
+#include <backend/Types.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+namespace Backend {
+// Location of a blob in a BlobArena
+struct BlobRef
+{
+    uint32_t slab = 0;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+};
+
+// Stores blobs back to back in large slabs, so the cache pays neither an
+// allocation nor a vector header per object. Slabs are append only: space of
+// released blobs is reclaimed by relocating the live blobs of mostly dead
+// slabs into new ones and freeing the old slabs. Slabs are reference
+// counted, so views handed out by view() remain valid after the slab has been
+// reclaimed. Not thread safe; the owner is expected to serialize access.
+class BlobArena
+{
+    struct Slab
+    {
+        std::shared_ptr<unsigned char[]> data;
+        uint32_t capacity = 0;
+        uint32_t used = 0;
+        uint32_t live = 0;
+    };
+    std::vector<Slab> slabs_;
+    // indexes of freed slots in slabs_
+    std::vector<uint32_t> freeSlabs_;
+    // slab new blobs are appended to. slabs_.size() if none
+    uint32_t current_ = 0;
+    uint64_t usedBytes_ = 0;
+    uint64_t liveBytes_ = 0;
+
+    uint32_t
+    newSlab(uint32_t capacity);
+
+public:
+    // blobs larger than this get a slab of their own
+    static constexpr uint32_t slabSize = 1 << 20;
+
+    BlobRef
+    store(unsigned char const* data, size_t size);
+
+    BlobRef
+    store(Blob const& blob)
+    {
+        return store(blob.data(), blob.size());
+    }
+
+    // the space of ref can be reused after the next reclaim()
+    void
+    release(BlobRef const& ref);
+
+    unsigned char const*
+    data(BlobRef const& ref) const
+    {
+        return slabs_[ref.slab].data.get() + ref.offset;
+    }
+
+    Blob
+    load(BlobRef const& ref) const
+    {
+        auto start = data(ref);
+        return {start, start + ref.size};
+    }
+
+    BlobView
+    view(BlobRef const& ref) const
+    {
+        return {slabs_[ref.slab].data, data(ref), ref.size};
+    }
+
+    // whether at least half of the stored bytes have been released
+    bool
+    needsReclaim() const
+    {
+        return usedBytes_ > slabSize &&
+            (usedBytes_ - liveBytes_) * 2 > usedBytes_;
+    }
+
+    // Relocate the live blobs of every slab that is at least half dead and
+    // free those slabs. forEachRef is called with a function that must be
+    // invoked on every live BlobRef, and updates it in place if needed.
+    template <class F>
+    void
+    reclaim(F&& forEachRef);
+
+    // bytes of live blobs
+    uint64_t
+    liveBytes() const
+    {
+        return liveBytes_;
+    }
+
+    // bytes allocated for slabs
+    uint64_t
+    allocatedBytes() const;
+};
+
+template <class F>
+void
+BlobArena::reclaim(F&& forEachRef)
+{
+    std::vector<bool> victims(slabs_.size(), false);
+    bool any = false;
+    for (size_t i = 0; i < slabs_.size(); ++i)
+    {
+        auto const& slab = slabs_[i];
+        if (slab.data && slab.live * 2 <= slab.used)
+            victims[i] = any = true;
+    }
+    if (!any)
+        return;
+    // never append relocated blobs to a slab that is about to be freed
+    if (current_ < victims.size() && victims[current_])
+        current_ = slabs_.size();
+
+    forEachRef([this, &victims](BlobRef& ref) {
+        if (ref.slab < victims.size() && victims[ref.slab])
+            ref = store(data(ref), ref.size);
+    });
+
+    for (size_t i = 0; i < victims.size(); ++i)
+    {
+        if (!victims[i])
+            continue;
+        auto& slab = slabs_[i];
+        usedBytes_ -= slab.used;
+        liveBytes_ -= slab.live;
+        slab = {};
+        freeSlabs_.push_back(i);
+    }
+}
+}  // namespace Backend
+#endif
@@ -0,0 +1,260 @@
+#include <boost/log/trivial.hpp>
+#include <backend/BlobCodec.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <zdict.h>
+#include <zstd.h>
+namespace Backend {
+
+namespace {
+// blobs are ledger objects and transactions. Anything claiming to be larger
+// is corrupt
+constexpr std::size_t maxRawSize = 64 << 20;
+
+// zstd contexts are not thread safe, and are costly to create
+ZSTD_CCtx*
+compressContext()
+{
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{
+        ZSTD_createCCtx(), &ZSTD_freeCCtx};
+    return cctx.get();
+}
+
+ZSTD_DCtx*
+decompressContext()
+{
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{
+        ZSTD_createDCtx(), &ZSTD_freeDCtx};
+    return dctx.get();
+}
+
+std::string
+readFile(std::string const& path)
+{
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    if (!in)
+        throw std::runtime_error("could not open dictionary " + path);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+}  // namespace
+
+char const*
+toString(BlobTable table)
+{
+    switch (table)
+    {
+        case BlobTable::objects:
+            return "objects";
+        case BlobTable::transactions:
+            return "transactions";
+        default:
+            return "metadata";
+    }
+}
+
+BlobCodec::BlobCodec(boost::json::object const& config)
+{
+    if (!config.contains("compression") ||
+        !config.at("compression").is_object())
+        return;
+    auto const& codecConfig = config.at("compression").as_object();
+    if (codecConfig.contains("enabled"))
+        enabled_ = codecConfig.at("enabled").as_bool();
+    if (codecConfig.contains("level"))
+        level_ = codecConfig.at("level").as_int64();
+    if (codecConfig.contains("min_size"))
+        minSize_ = codecConfig.at("min_size").as_int64();
+    if (!codecConfig.contains("dictionaries"))
+        return;
+
+    auto const& dictsConfig = codecConfig.at("dictionaries").as_object();
+    for (std::size_t i = 0; i < numBlobTables; ++i)
+    {
+        auto name = toString(static_cast<BlobTable>(i));
+        if (!dictsConfig.contains(name))
+            continue;
+        std::vector<std::string> paths;
+        if (dictsConfig.at(name).is_string())
+            paths.push_back(dictsConfig.at(name).as_string().c_str());
+        else
+            for (auto const& path : dictsConfig.at(name).as_array())
+                paths.push_back(path.as_string().c_str());
+        for (auto const& path : paths)
+        {
+            auto contents = readFile(path);
+            Dictionary dict;
+            dict.id = ZDICT_getDictID(contents.data(), contents.size());
+            if (!dict.id)
+                throw std::runtime_error(
+                    path + " is not a trained zstd dictionary");
+            dict.compress = {
+                ZSTD_createCDict(contents.data(), contents.size(), level_),
+                &ZSTD_freeCDict};
+            dict.decompress = {
+                ZSTD_createDDict(contents.data(), contents.size()),
+                &ZSTD_freeDDict};
+            if (!dict.compress || !dict.decompress)
+                throw std::runtime_error("could not load dictionary " + path);
+            BOOST_LOG_TRIVIAL(info)
+                << __func__ << " : loaded dictionary " << dict.id << " for "
+                << name << " from " << path;
+            dictionaries_[i].push_back(std::move(dict));
+        }
+    }
+}
+
+std::string
+BlobCodec::compress(BlobTable table, void const* data, std::size_t size) const
+{
+    if (!enabled_ || size < minSize_)
+        return {};
+    auto const& dicts = dictionaries_[static_cast<std::size_t>(table)];
+    std::string compressed(2 + ZSTD_compressBound(size), '\0');
+    compressed[0] = tag;
+    compressed[1] = static_cast<char>(Format::zstd);
+    auto const capacity = compressed.size() - 2;
+    auto const written = dicts.empty()
+        ? ZSTD_compressCCtx(
+              compressContext(),
+              &compressed[2],
+              capacity,
+              data,
+              size,
+              level_)
+        : ZSTD_compress_usingCDict(
+              compressContext(),
+              &compressed[2],
+              capacity,
+              data,
+              size,
+              dicts.front().compress.get());
+    if (ZSTD_isError(written) || written + 2 >= size)
+        return {};
+    compressed.resize(written + 2);
+    return compressed;
+}
+
+template <class Bytes>
+void
+BlobCodec::encodeBytes(BlobTable table, Bytes& blob) const
+{
+    if (!enabled_)
+        return;
+    auto& counters = counters_[static_cast<std::size_t>(table)];
+    counters.rawBytes += blob.size();
+    if (auto compressed = compress(table, blob.data(), blob.size());
+        !compressed.empty())
+    {
+        blob.assign(compressed.begin(), compressed.end());
+        ++counters.encoded;
+    }
+    counters.storedBytes += blob.size();
+}
+
+void
+BlobCodec::encode(BlobTable table, std::string& blob) const
+{
+    encodeBytes(table, blob);
+}
+
+void
+BlobCodec::encode(BlobTable table, Blob& blob) const
+{
+    encodeBytes(table, blob);
+}
+
+Blob
+BlobCodec::decode(BlobTable table, Blob&& blob) const
+{
+    if (blob.empty() || blob[0] != tag)
+        return std::move(blob);
+    if (blob.size() < 2 || blob[1] != static_cast<unsigned char>(Format::zstd))
+        throw std::runtime_error(
+            std::string{"BlobCodec::decode - unknown format of "} +
+            toString(table) + " blob");
+
+    auto const* frame = blob.data() + 2;
+    auto const frameSize = blob.size() - 2;
+    auto const rawSize = ZSTD_getFrameContentSize(frame, frameSize);
+    if (rawSize == ZSTD_CONTENTSIZE_ERROR ||
+        rawSize == ZSTD_CONTENTSIZE_UNKNOWN || rawSize > maxRawSize)
+        throw std::runtime_error(
+            std::string{"BlobCodec::decode - corrupt "} + toString(table) +
+            " blob");
+
+    ZSTD_DDict const* ddict = nullptr;
+    if (auto id = ZSTD_getDictID_fromFrame(frame, frameSize))
+    {
+        for (auto const& dict :
+             dictionaries_[static_cast<std::size_t>(table)])
+        {
+            if (dict.id == id)
+                ddict = dict.decompress.get();
+        }
+        if (!ddict)
+            throw std::runtime_error(
+                std::string{"BlobCodec::decode - "} + toString(table) +
+                " dictionary " + std::to_string(id) + " is not configured");
+    }
+
+    Blob raw(rawSize);
+    auto const read = ddict
+        ? ZSTD_decompress_usingDDict(
+              decompressContext(),
+              raw.data(),
+              raw.size(),
+              frame,
+              frameSize,
+              ddict)
+        : ZSTD_decompressDCtx(
+              decompressContext(), raw.data(), raw.size(), frame, frameSize);
+    if (ZSTD_isError(read) || read != raw.size())
+        throw std::runtime_error(
+            std::string{"BlobCodec::decode - corrupt "} + toString(table) +
+            " blob");
+    ++counters_[static_cast<std::size_t>(table)].decoded;
+    return raw;
+}
+
+std::string
+BlobCodec::train(std::vector<std::string> const& samples, std::size_t maxSize)
+{
+    std::string buffer;
+    std::vector<std::size_t> sizes;
+    for (auto const& sample : samples)
+    {
+        buffer += sample;
+        sizes.push_back(sample.size());
+    }
+    std::string dict(maxSize, '\0');
+    auto const size = ZDICT_trainFromBuffer(
+        dict.data(), dict.size(), buffer.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(size))
+        throw std::runtime_error(
+            std::string{"BlobCodec::train - "} + ZDICT_getErrorName(size));
+    dict.resize(size);
+    return dict;
+}
+
+boost::json::object
+BlobCodec::report() const
+{
+    boost::json::object report;
+    for (std::size_t i = 0; i < numBlobTables; ++i)
+    {
+        auto const& counters = counters_[i];
+        boost::json::object tableReport;
+        tableReport["dictionaries"] = dictionaries_[i].size();
+        tableReport["compressed"] = counters.encoded.load();
+        tableReport["raw_bytes"] = counters.rawBytes.load();
+        tableReport["stored_bytes"] = counters.storedBytes.load();
+        tableReport["decompressed"] = counters.decoded.load();
+        report[toString(static_cast<BlobTable>(i))] = std::move(tableReport);
+    }
+    return report;
+}
+
+}  // namespace Backend
@@ -0,0 +1,122 @@
+#ifndef CLIO_BLOBCODEC_H_INCLUDED
+#define CLIO_BLOBCODEC_H_INCLUDED
+
+#include <boost/json.hpp>
+#include <backend/Types.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace Backend {
+
+// The columns whose blobs can be compressed. Each has dictionaries of its
+// own, since objects, transactions and metadata share little
+enum class BlobTable : std::uint8_t { objects, transactions, metadata };
+
+constexpr std::size_t numBlobTables = 3;
+
+char const*
+toString(BlobTable table);
+
+// Compresses the blobs written to the objects and transactions tables with
+// zstd, and decompresses them as they are read.
+//
+// A compressed blob starts with a zero byte, then a byte naming its format.
+// Serialized objects, transactions and metadata never start with a zero
+// byte, so blobs written before compression was enabled, and blobs that
+// did not get smaller, are stored as they are and read back unchanged.
+//
+// A dictionary trained on the blobs of a table compresses small blobs far
+// better than zstd does on its own. The first dictionary of a table
+// compresses, and every dictionary of it decompresses the blobs that were
+// compressed with it, so dictionaries can be replaced without rewriting the
+// rows written with the previous one. Blobs compressed without a dictionary
+// are always readable
+class BlobCodec
+{
+public:
+    // the byte a compressed blob starts with
+    static constexpr unsigned char tag = 0x00;
+
+    enum class Format : unsigned char { zstd = 1 };
+
+private:
+    struct Dictionary
+    {
+        std::uint32_t id = 0;
+        std::shared_ptr<ZSTD_CDict_s> compress;
+        std::shared_ptr<ZSTD_DDict_s> decompress;
+    };
+
+    struct Counters
+    {
+        std::atomic_uint64_t encoded{0};
+        std::atomic_uint64_t rawBytes{0};
+        std::atomic_uint64_t storedBytes{0};
+        std::atomic_uint64_t decoded{0};
+    };
+
+    bool enabled_ = false;
+    int level_ = 3;
+    // smaller blobs are stored as they are
+    std::size_t minSize_ = 64;
+    std::array<std::vector<Dictionary>, numBlobTables> dictionaries_;
+    mutable std::array<Counters, numBlobTables> counters_;
+
+    // blob compressed for table, or empty if that is not smaller
+    std::string
+    compress(BlobTable table, void const* data, std::size_t size) const;
+
+    template <class Bytes>
+    void
+    encodeBytes(BlobTable table, Bytes& blob) const;
+
+public:
+    // Decodes compressed blobs, but stores new ones as they are
+    BlobCodec() = default;
+
+    // from compression: enabled, level, min_size and dictionaries, an
+    // object of the files of the dictionaries of each table. A table names
+    // one file or an array of them, the one that compresses first. Throws
+    // if a dictionary cannot be read
+    explicit BlobCodec(boost::json::object const& config);
+
+    bool
+    enabled() const
+    {
+        return enabled_;
+    }
+
+    // Replace blob with its compressed form, if compression is enabled and
+    // it gets smaller
+    void
+    encode(BlobTable table, std::string& blob) const;
+
+    void
+    encode(BlobTable table, Blob& blob) const;
+
+    // blob, decompressed if it was compressed. Throws std::runtime_error if
+    // it is corrupt, or was compressed with a dictionary that is not
+    // configured
+    Blob
+    decode(BlobTable table, Blob&& blob) const;
+
+    // A dictionary of at most maxSize bytes, trained on samples of the blobs
+    // of a table. Throws std::runtime_error if there are too few samples
+    static std::string
+    train(std::vector<std::string> const& samples, std::size_t maxSize);
+
+    // blobs compressed, their bytes before and after, and blobs
+    // decompressed, by table
+    boost::json::object
+    report() const;
+};
+
+}  // namespace Backend
+#endif
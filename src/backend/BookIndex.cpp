@@ -0,0 +1,156 @@
+#include <ripple/protocol/Indexes.h>
+#include <ripple/protocol/STLedgerEntry.h>
+#include <backend/BookIndex.h>
+#include <backend/DBHelpers.h>
+#include <mutex>
+namespace Backend {
+
+void
+BookIndex::setPage(
+    ripple::uint256 const& key,
+    ripple::uint256 const& dir,
+    Page page)
+{
+    auto book = books_.find(getBookBase(dir));
+    if (book == books_.end())
+        return;
+    book->second[dir][key] = std::move(page);
+    pageDirs_[key] = dir;
+}
+
+void
+BookIndex::erasePage(ripple::uint256 const& key)
+{
+    auto dir = pageDirs_.find(key);
+    if (dir == pageDirs_.end())
+        return;
+    auto book = books_.find(getBookBase(dir->second));
+    if (book != books_.end())
+    {
+        if (auto pages = book->second.find(dir->second);
+            pages != book->second.end())
+        {
+            pages->second.erase(key);
+            if (pages->second.empty())
+                book->second.erase(pages);
+        }
+    }
+    pageDirs_.erase(dir);
+}
+
+void
+BookIndex::update(std::vector<LedgerObject> const& objs, uint32_t seq)
+{
+    std::unique_lock lck{mtx_};
+    if (latestSeq_ && seq != latestSeq_ + 1)
+    {
+        books_.clear();
+        pageDirs_.clear();
+    }
+    latestSeq_ = seq;
+    if (books_.empty())
+        return;
+    for (auto const& obj : objs)
+    {
+        if (obj.blob.empty())
+        {
+            erasePage(obj.key);
+            continue;
+        }
+        if (!isBookDir(obj.key, obj.blob))
+            continue;
+        ripple::STLedgerEntry const sle{
+            ripple::SerialIter{obj.blob.data(), obj.blob.size()}, obj.key};
+        auto const& indexes = sle.getFieldV256(ripple::sfIndexes);
+        setPage(
+            obj.key,
+            sle.getFieldH256(ripple::sfRootIndex),
+            {{indexes.begin(), indexes.end()},
+             sle.getFieldU64(ripple::sfIndexNext)});
+    }
+}
+
+bool
+BookIndex::insert(
+    ripple::uint256 const& book,
+    uint32_t seq,
+    std::vector<LedgerObject> const& pages)
+{
+    std::unique_lock lck{mtx_};
+    if (seq != latestSeq_)
+        return false;
+    if (books_.count(book))
+        return true;
+    if (books_.size() >= maxBooks)
+        return false;
+    books_[book];
+    for (auto const& page : pages)
+    {
+        ripple::STLedgerEntry const sle{
+            ripple::SerialIter{page.blob.data(), page.blob.size()}, page.key};
+        auto const& indexes = sle.getFieldV256(ripple::sfIndexes);
+        setPage(
+            page.key,
+            sle.getFieldH256(ripple::sfRootIndex),
+            {{indexes.begin(), indexes.end()},
+             sle.getFieldU64(ripple::sfIndexNext)});
+    }
+    return true;
+}
+
+std::optional<std::vector<ripple::uint256>>
+BookIndex::getOffers(
+    ripple::uint256 const& book,
+    uint32_t seq,
+    uint32_t limit) const
+{
+    std::shared_lock lck{mtx_};
+    if (seq != latestSeq_)
+        return {};
+    auto it = books_.find(book);
+    if (it == books_.end())
+        return {};
+
+    std::vector<ripple::uint256> offers;
+    for (auto const& [dir, pages] : it->second)
+    {
+        // pages are ordered by the chain of next pointers from the first page
+        auto page = pages.find(dir);
+        // a missing page means a directory was modified in a way the index
+        // could not follow. callers fall back to walking the directories
+        if (page == pages.end())
+            return {};
+        while (offers.size() < limit)
+        {
+            auto const& [key, content] = *page;
+            offers.insert(
+                offers.end(), content.offers.begin(), content.offers.end());
+            if (!content.next)
+                break;
+            page = pages.find(ripple::keylet::page(dir, content.next).key);
+            if (page == pages.end())
+                return {};
+        }
+        if (offers.size() >= limit)
+            break;
+    }
+    if (offers.size() > limit)
+        offers.resize(limit);
+    return offers;
+}
+
+uint32_t
+BookIndex::latestSequence() const
+{
+    std::shared_lock lck{mtx_};
+    return latestSeq_;
+}
+
+size_t
+BookIndex::numBooks() const
+{
+    std::shared_lock lck{mtx_};
+    return books_.size();
+}
+
+}  // namespace Backend
@@ -0,0 +1,86 @@
+#ifndef CLIO_BOOKINDEX_H_INCLUDED
+#define CLIO_BOOKINDEX_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <backend/Types.h>
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+namespace Backend {
+// In-memory index of the offer directories of order books, as of the most
+// recent ledger.
+//
+// Books are indexed the first time they are requested, from a full walk of
+// their directories, and kept up to date with the directory pages modified by
+// every following ledger. Reading a page of offers is then a walk over the
+// in-memory pages, without fetching or deserializing any directory.
+class BookIndex
+{
+    struct Page
+    {
+        std::vector<ripple::uint256> offers;
+        // page number of the next page in the directory. 0 if last
+        uint64_t next = 0;
+    };
+
+    // pages of one quality directory, by key. the key of the first page is
+    // the key of the directory
+    using Directory =
+        std::unordered_map<ripple::uint256, Page, ripple::hardened_hash<>>;
+
+    // directories of one book, by key, which sorts them by quality
+    using Book = std::map<ripple::uint256, Directory>;
+
+    mutable std::shared_mutex mtx_;
+    uint32_t latestSeq_ = 0;
+    std::unordered_map<ripple::uint256, Book, ripple::hardened_hash<>> books_;
+    // directory of every page in books_
+    std::unordered_map<
+        ripple::uint256,
+        ripple::uint256,
+        ripple::hardened_hash<>>
+        pageDirs_;
+
+    // beyond this, requested books are served by walking their directories
+    static constexpr size_t maxBooks = 1 << 14;
+
+    // set page, of directory dir, if the book of dir is indexed
+    void
+    setPage(ripple::uint256 const& key, ripple::uint256 const& dir, Page page);
+
+    void
+    erasePage(ripple::uint256 const& key);
+
+public:
+    // Apply the objects modified in ledger seq. If a ledger was skipped, the
+    // index is cleared, and books are indexed again when next requested
+    void
+    update(std::vector<LedgerObject> const& objs, uint32_t seq);
+
+    // Start indexing book. pages are all directory pages of the book in
+    // ledger seq. Ignored if the index is not at ledger seq
+    // returns true if the book is now indexed
+    bool
+    insert(
+        ripple::uint256 const& book,
+        uint32_t seq,
+        std::vector<LedgerObject> const& pages);
+
+    // keys of up to limit offers of book in ledger seq, best quality first.
+    // empty optional if the book is not indexed for ledger seq
+    std::optional<std::vector<ripple::uint256>>
+    getOffers(ripple::uint256 const& book, uint32_t seq, uint32_t limit)
+        const;
+
+    uint32_t
+    latestSequence() const;
+
+    size_t
+    numBooks() const;
+};
+
+}  // namespace Backend
+#endif
@@ -0,0 +1,226 @@
+#include <backend/CacheSnapshot.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+namespace Backend {
+
+namespace {
+constexpr char magic[8] = {'C', 'L', 'I', 'O', 'S', 'N', 'A', 'P'};
+constexpr uint32_t version = 2;
+// key, sequence and size
+constexpr size_t recordHeaderSize = 40;
+constexpr size_t recordAlignment = 8;
+constexpr uint64_t checksumSeed = 0xcbf29ce484222325;
+
+size_t
+padded(size_t size)
+{
+    return (size + recordAlignment - 1) & ~(recordAlignment - 1);
+}
+
+// not cryptographic. detects corruption and truncation, one word at a time
+uint64_t
+checksum(uint64_t h, unsigned char const* data, size_t size)
+{
+    constexpr uint64_t prime = 0x100000001b3;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        h = (h ^ word) * prime;
+        h ^= h >> 29;
+    }
+    for (; i < size; ++i)
+        h = (h ^ data[i]) * prime;
+    return h;
+}
+
+template <class T>
+void
+put(unsigned char* out, size_t offset, T const& value)
+{
+    std::memcpy(out + offset, &value, sizeof(value));
+}
+
+template <class T>
+T
+get(unsigned char const* in, size_t offset)
+{
+    T value;
+    std::memcpy(&value, in + offset, sizeof(value));
+    return value;
+}
+
+void
+encodeHeader(unsigned char* out, CacheSnapshot::Header const& header)
+{
+    std::memcpy(out, magic, sizeof(magic));
+    put(out, 8, version);
+    put(out, 12, header.seq);
+    put(out, 16, header.numObjects);
+    put(out, 24, header.checksum);
+    std::memcpy(out + 32, header.ledgerHash.data(), header.ledgerHash.size());
+}
+
+std::optional<CacheSnapshot::Header>
+decodeHeader(unsigned char const* in)
+{
+    if (std::memcmp(in, magic, sizeof(magic)) != 0 ||
+        get<uint32_t>(in, 8) != version)
+        return {};
+    CacheSnapshot::Header header;
+    header.seq = get<uint32_t>(in, 12);
+    header.numObjects = get<uint64_t>(in, 16);
+    header.checksum = get<uint64_t>(in, 24);
+    std::memcpy(header.ledgerHash.data(), in + 32, header.ledgerHash.size());
+    return header;
+}
+}  // namespace
+
+CacheSnapshot::Writer::Writer(
+    std::string const& path,
+    uint32_t seq,
+    ripple::uint256 const& ledgerHash)
+    : path_(path)
+    , tmpPath_(path + ".tmp")
+    , out_(tmpPath_, std::ios::binary | std::ios::trunc)
+{
+    header_.seq = seq;
+    header_.ledgerHash = ledgerHash;
+    header_.checksum = checksumSeed;
+    // the header is filled in by commit()
+    char placeholder[headerSize] = {};
+    out_.write(placeholder, sizeof(placeholder));
+}
+
+CacheSnapshot::Writer::~Writer()
+{
+    if (!committed_)
+    {
+        out_.close();
+        std::remove(tmpPath_.c_str());
+    }
+}
+
+void
+CacheSnapshot::Writer::encode(std::string& out, Record const& record)
+{
+    auto offset = out.size();
+    out.resize(offset + recordHeaderSize + padded(record.size));
+    auto dest = reinterpret_cast<unsigned char*>(out.data()) + offset;
+    std::memcpy(dest, record.key.data(), record.key.size());
+    put(dest, 32, record.seq);
+    put(dest, 36, record.size);
+    std::memcpy(dest + recordHeaderSize, record.data, record.size);
+    std::memset(
+        dest + recordHeaderSize + record.size,
+        0,
+        padded(record.size) - record.size);
+}
+
+void
+CacheSnapshot::Writer::write(std::string const& records, uint64_t numRecords)
+{
+    // records are padded, so the checksum can be computed chunk by chunk
+    assert(records.size() % recordAlignment == 0);
+    header_.checksum = checksum(
+        header_.checksum,
+        reinterpret_cast<unsigned char const*>(records.data()),
+        records.size());
+    header_.numObjects += numRecords;
+    out_.write(records.data(), records.size());
+}
+
+bool
+CacheSnapshot::Writer::commit()
+{
+    unsigned char header[headerSize] = {};
+    encodeHeader(header, header_);
+    out_.seekp(0);
+    out_.write(reinterpret_cast<char const*>(header), sizeof(header));
+    out_.close();
+    if (!out_ || std::rename(tmpPath_.c_str(), path_.c_str()) != 0)
+        return false;
+    committed_ = true;
+    return true;
+}
+
+CacheSnapshot::CacheSnapshot(std::string const& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= headerSize)
+    {
+        void* mapped =
+            ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data_ = static_cast<unsigned char const*>(mapped);
+            size_ = st.st_size;
+            ::madvise(mapped, size_, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);
+    if (!data_)
+        return;
+
+    auto header = decodeHeader(data_);
+    if (!header ||
+        checksum(checksumSeed, data_ + headerSize, size_ - headerSize) !=
+            header->checksum)
+        return;
+
+    // make sure every record is within the file, so decode() can trust it
+    size_t offset = headerSize;
+    for (uint64_t i = 0; i < header->numObjects; ++i)
+    {
+        if (offset + recordHeaderSize > size_)
+            return;
+        auto size = get<uint32_t>(data_, offset + 36);
+        auto next = offset + recordHeaderSize + padded(size);
+        if (next > size_)
+            return;
+        offset = next;
+    }
+    if (offset != size_)
+        return;
+    header_ = header;
+}
+
+CacheSnapshot::~CacheSnapshot()
+{
+    if (data_)
+        ::munmap(const_cast<unsigned char*>(data_), size_);
+}
+
+std::optional<CacheSnapshot::Header>
+CacheSnapshot::readHeader(std::string const& path)
+{
+    std::ifstream in{path, std::ios::binary};
+    unsigned char header[headerSize];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)))
+        return {};
+    return decodeHeader(header);
+}
+
+CacheSnapshot::Record
+CacheSnapshot::decode(size_t& offset) const
+{
+    Record record;
+    std::memcpy(record.key.data(), data_ + offset, record.key.size());
+    record.seq = get<uint32_t>(data_, offset + 32);
+    record.size = get<uint32_t>(data_, offset + 36);
+    record.data = data_ + offset + recordHeaderSize;
+    offset += recordHeaderSize + padded(record.size);
+    return record;
+}
+
+}  // namespace Backend
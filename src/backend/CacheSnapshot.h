@@ -0,0 +1,119 @@
+#ifndef CLIO_CACHESNAPSHOT_H_INCLUDED
+#define CLIO_CACHESNAPSHOT_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+namespace Backend {
+// A file holding every object of one ledger, as written by SimpleCache.
+//
+// All fields are in native byte order. The header is:
+//   magic (8 bytes), format version (4), ledger sequence (4),
+//   number of records (8), checksum of everything after the header (8),
+//   ledger hash (32)
+// It is followed by one record per object, in key order:
+//   key (32), sequence the object was last modified in (4), blob size (4),
+//   blob, zero padded to a multiple of 8 bytes
+// so every record is 8 byte aligned when the file is memory mapped, and can
+// be read in place. The header is written last, so an interrupted write
+// never looks like a valid snapshot.
+class CacheSnapshot
+{
+public:
+    struct Header
+    {
+        uint32_t seq = 0;
+        ripple::uint256 ledgerHash;
+        uint64_t numObjects = 0;
+        uint64_t checksum = 0;
+    };
+
+    // data points into the mapped file
+    struct Record
+    {
+        ripple::uint256 key;
+        uint32_t seq = 0;
+        unsigned char const* data = nullptr;
+        uint32_t size = 0;
+    };
+
+    static constexpr size_t headerSize = 64;
+
+    // Writes a snapshot to a temporary file, which is moved to path once
+    // complete. Records must be written in key order
+    class Writer
+    {
+        std::string path_;
+        std::string tmpPath_;
+        std::ofstream out_;
+        Header header_;
+        bool committed_ = false;
+
+    public:
+        Writer(
+            std::string const& path,
+            uint32_t seq,
+            ripple::uint256 const& ledgerHash);
+
+        ~Writer();
+
+        // append the encoding of record to out
+        static void
+        encode(std::string& out, Record const& record);
+
+        // write numRecords records produced by encode()
+        void
+        write(std::string const& records, uint64_t numRecords);
+
+        // write the header and move the file into place. returns false if
+        // any write failed, in which case the file is discarded
+        bool
+        commit();
+    };
+
+private:
+    unsigned char const* data_ = nullptr;
+    size_t size_ = 0;
+    std::optional<Header> header_;
+
+    // decode the record at offset and advance offset past it
+    Record
+    decode(size_t& offset) const;
+
+public:
+    // Map the snapshot at path, and verify its checksum and structure
+    explicit CacheSnapshot(std::string const& path);
+
+    ~CacheSnapshot();
+
+    CacheSnapshot(CacheSnapshot const&) = delete;
+    CacheSnapshot&
+    operator=(CacheSnapshot const&) = delete;
+
+    // empty if the file is missing, truncated or corrupt
+    std::optional<Header> const&
+    header() const
+    {
+        return header_;
+    }
+
+    // read only the header of the snapshot at path, without validating the
+    // rest of the file
+    static std::optional<Header>
+    readHeader(std::string const& path);
+
+    // call f with every record, in key order. requires header()
+    template <class F>
+    void
+    forEachRecord(F&& f) const
+    {
+        size_t offset = headerSize;
+        for (uint64_t i = 0; i < header_->numObjects; ++i)
+            f(decode(offset));
+    }
+};
+
+}  // namespace Backend
+#endif
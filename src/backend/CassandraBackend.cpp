@@ -1,7 +1,12 @@
+#include <ripple/basics/hardened_hash.h>
 #include <backend/CassandraBackend.h>
 #include <backend/DBHelpers.h>
+#include <algorithm>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <unordered_map>
+#include <unordered_set>
 namespace Backend {
 template <class T, class F>
 void
@@ -19,6 +24,7 @@ processAsyncWriteResponse(T& requestParams, CassFuture* fut, F func)
             << cass_error_desc(rc) << " id= " << requestParams.toString()
             << ", retrying in " << wait.count() << " milliseconds";
         ++requestParams.currentRetries;
+        backend.failedAsyncWrite();
         std::shared_ptr<boost::asio::steady_timer> timer =
             std::make_shared<boost::asio::steady_timer>(
                 backend.getIOContext(),
@@ -44,27 +50,79 @@ processAsyncWrite(CassFuture* fut, void* cbData)
     processAsyncWriteResponse(requestParams, fut, requestParams.retry);
 }
 
-template <class T, class B>
+// Free list of equally sized blocks, shared by all threads. Callback data is
+// allocated by the thread issuing a write and freed by a driver thread, so a
+// free list per thread would never give blocks back to the writer
+template <size_t Size>
+class BlockPool
+{
+    std::mutex mtx_;
+    std::vector<void*> free_;
+    static constexpr size_t maxFree = 1 << 14;
+
+public:
+    void*
+    allocate()
+    {
+        {
+            std::lock_guard lck(mtx_);
+            if (!free_.empty())
+            {
+                void* block = free_.back();
+                free_.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(Size);
+    }
+
+    void
+    deallocate(void* block)
+    {
+        {
+            std::lock_guard lck(mtx_);
+            if (free_.size() < maxFree)
+            {
+                free_.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+};
+
+// Q is the type bind returns: a CassandraStatement, or a CassandraBatch
+template <class T, class B, class Q = CassandraStatement>
 struct WriteCallbackData
 {
     CassandraBackend const* backend;
     T data;
-    std::function<void(WriteCallbackData<T, B>&, bool)> retry;
+    std::function<void(WriteCallbackData&, bool)> retry;
     uint32_t currentRetries;
+    ConcurrencyLimiter::clock::time_point start;
+    // ledger whose commit waits for this write
+    uint32_t ledger;
     std::atomic<int> refs = 1;
     std::string id;
+    // bound once and kept until the write succeeds, so retries don't bind
+    // it again. Recycled then
+    std::optional<Q> statement;
 
     WriteCallbackData(
         CassandraBackend const* b,
         T&& d,
         B bind,
         std::string const& identifier)
-        : backend(b), data(std::move(d)), id(identifier)
+        : backend(b)
+        , data(std::move(d))
+        , ledger(b->writingLedger())
+        , id(identifier)
     {
         retry = [bind, this](auto& params, bool isRetry) {
-            auto statement = bind(params);
+            if (!params.statement)
+                params.statement.emplace(bind(params));
             backend->executeAsyncWrite(
-                statement,
+                *params.statement,
                 processAsyncWrite<
                     typename std::remove_reference<decltype(params)>::type>,
                 params,
@@ -80,11 +138,39 @@ struct WriteCallbackData
     virtual void
     finish()
     {
-        backend->finishAsyncWrite();
+        statement->recycle();
+        backend->finishAsyncWrite(start, ledger);
         int remaining = --refs;
         if (remaining == 0)
             delete this;
     }
+
+    // thousands of writes are issued per ledger. Their callback data is
+    // reused, rather than allocated for each. Derived types are bigger, and
+    // are allocated as usual
+    static auto&
+    pool()
+    {
+        // never destroyed, since driver threads can free writes at exit
+        static auto* pool = new BlockPool<sizeof(WriteCallbackData)>;
+        return *pool;
+    }
+
+    static void*
+    operator new(size_t size)
+    {
+        if (size != sizeof(WriteCallbackData))
+            return ::operator new(size);
+        return pool().allocate();
+    }
+
+    static void
+    operator delete(void* block, size_t size)
+    {
+        if (size != sizeof(WriteCallbackData))
+            return ::operator delete(block);
+        pool().deallocate(block);
+    }
     virtual ~WriteCallbackData()
     {
     }
@@ -123,6 +209,7 @@ struct BulkWriteCallbackData : public WriteCallbackData<T, B>
     void
     finish() override
     {
+        this->statement->recycle();
         // TODO: it would be nice to avoid this lock.
         std::lock_guard lck(mtx);
         if (--numRemaining == 0)
@@ -144,6 +231,19 @@ makeAndExecuteAsyncWrite(
     auto* cb = new WriteCallbackData(b, std::move(d), bind, id);
     cb->start();
 }
+// Like makeAndExecuteAsyncWrite, but bind returns a CassandraBatch
+template <class T, class B>
+void
+makeAndExecuteAsyncBatchWrite(
+    CassandraBackend const* b,
+    T&& d,
+    B bind,
+    std::string const& id)
+{
+    auto* cb = new WriteCallbackData<T, B, CassandraBatch>(
+        b, std::move(d), bind, id);
+    cb->start();
+}
 template <class T, class B>
 std::shared_ptr<BulkWriteCallbackData<T, B>>
 makeAndExecuteBulkAsyncWrite(
@@ -166,6 +266,7 @@ CassandraBackend::doWriteLedgerObject(
     std::string&& blob)
 {
     BOOST_LOG_TRIVIAL(trace) << "Writing ledger object to cassandra";
+    codec_.encode(BlobTable::objects, blob);
     if (range)
         makeAndExecuteAsyncWrite(
             this,
@@ -223,6 +324,8 @@ CassandraBackend::writeLedger(
     ripple::LedgerInfo const& ledgerInfo,
     std::string&& header)
 {
+    // every write issued from here until the next ledger belongs to this one
+    ledgerSequence_ = ledgerInfo.seq;
     makeAndExecuteAsyncWrite(
         this,
         std::move(std::make_tuple(ledgerInfo.seq, std::move(header))),
@@ -245,32 +348,63 @@ CassandraBackend::writeLedger(
             return statement;
         },
         "ledger_hash");
-    ledgerSequence_ = ledgerInfo.seq;
 }
 void
 CassandraBackend::writeAccountTransactions(
     std::vector<AccountTransactionsData>&& data)
 {
-    for (auto& record : data)
+    // the rows of an account in a ledger share a partition, and are written
+    // as one batch rather than one write each. Busy accounts, such as
+    // exchanges and AMM-like issuers, are affected by many transactions of
+    // a ledger. Huge groups are split, to stay under the batch size limit
+    static constexpr size_t maxBatchRows = 64;
+    for (auto& group : groupAccountTransactions(data))
     {
-        for (auto& account : record.accounts)
+        auto& txns = group.transactions;
+        for (size_t start = 0; start < txns.size(); start += maxBatchRows)
         {
-            makeAndExecuteAsyncWrite(
+            auto end = std::min(txns.size(), start + maxBatchRows);
+            if (end - start == 1)
+            {
+                makeAndExecuteAsyncWrite(
+                    this,
+                    std::make_tuple(
+                        group.account,
+                        group.ledgerSequence,
+                        txns[start].first,
+                        txns[start].second),
+                    [this](auto& params) {
+                        CassandraStatement statement(insertAccountTx_);
+                        auto& [account, lgrSeq, txnIdx, hash] = params.data;
+                        statement.bindNextBytes(account);
+                        statement.bindNextIntTuple(lgrSeq, txnIdx);
+                        statement.bindNextBytes(hash);
+                        return statement;
+                    },
+                    "account_tx");
+                continue;
+            }
+            makeAndExecuteAsyncBatchWrite(
                 this,
-                std::move(std::make_tuple(
-                    std::move(account),
-                    record.ledgerSequence,
-                    record.transactionIndex,
-                    record.txHash)),
+                AccountLedgerTransactions{
+                    group.account,
+                    group.ledgerSequence,
+                    {txns.begin() + start, txns.begin() + end}},
                 [this](auto& params) {
-                    CassandraStatement statement(insertAccountTx_);
-                    auto& [account, lgrSeq, txnIdx, hash] = params.data;
-                    statement.bindNextBytes(account);
-                    statement.bindNextIntTuple(lgrSeq, txnIdx);
-                    statement.bindNextBytes(hash);
-                    return statement;
+                    CassandraBatch batch;
+                    auto& rows = params.data;
+                    for (auto& [txnIdx, hash] : rows.transactions)
+                    {
+                        CassandraStatement statement(insertAccountTx_);
+                        statement.bindNextBytes(rows.account);
+                        statement.bindNextIntTuple(
+                            rows.ledgerSequence, txnIdx);
+                        statement.bindNextBytes(hash);
+                        batch.add(std::move(statement));
+                    }
+                    return batch;
                 },
-                "account_tx");
+                "account_tx_batch");
         }
     }
 }
@@ -283,6 +417,8 @@ CassandraBackend::writeTransaction(
     std::string&& metadata)
 {
     BOOST_LOG_TRIVIAL(trace) << "Writing txn to cassandra";
+    codec_.encode(BlobTable::transactions, transaction);
+    codec_.encode(BlobTable::metadata, metadata);
     std::string hashCpy = hash;
 
     makeAndExecuteAsyncWrite(
@@ -346,91 +482,187 @@ CassandraBackend::fetchAllTransactionsInLedger(uint32_t ledgerSequence) const
     return fetchTransactions(hashes);
 }
 
-struct ReadCallbackData
+namespace {
+uint64_t
+rotl64(uint64_t x, int r)
 {
-    std::function<void(CassandraResult&)> onSuccess;
-    std::atomic_int& numOutstanding;
-    std::mutex& mtx;
-    std::condition_variable& cv;
-    std::atomic_bool errored = false;
-    ReadCallbackData(
-        std::atomic_int& numOutstanding,
-        std::mutex& m,
-        std::condition_variable& cv,
-        std::function<void(CassandraResult&)> onSuccess)
-        : numOutstanding(numOutstanding), mtx(m), cv(cv), onSuccess(onSuccess)
-    {
-    }
+    return (x << r) | (x >> (64 - r));
+}
 
-    void
-    finish(CassFuture* fut)
+uint64_t
+fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Token of key with the Murmur3Partitioner, which is MurmurHash3_x64_128
+// with a seed of 0. Keys are a multiple of 16 bytes, so there is no tail
+int64_t
+murmur3Token(ripple::uint256 const& key)
+{
+    constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+    constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    for (size_t i = 0; i < key.size(); i += 16)
     {
-        CassError rc = cass_future_error_code(fut);
-        if (rc != CASS_OK)
-        {
-            errored = true;
-        }
-        else
-        {
-            CassandraResult result{cass_future_get_result(fut)};
-            onSuccess(result);
-        }
-        std::lock_guard lck(mtx);
-        if (--numOutstanding == 0)
-            cv.notify_one();
+        uint64_t k1;
+        uint64_t k2;
+        std::memcpy(&k1, key.data() + i, sizeof(k1));
+        std::memcpy(&k2, key.data() + i + 8, sizeof(k2));
+
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
     }
-};
-void
-processAsyncRead(CassFuture* fut, void* cbData)
-{
-    ReadCallbackData& cb = *static_cast<ReadCallbackData*>(cbData);
-    cb.finish(fut);
+    h1 ^= key.size();
+    h2 ^= key.size();
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    auto token = static_cast<int64_t>(h1);
+    return token == std::numeric_limits<int64_t>::min()
+        ? std::numeric_limits<int64_t>::max()
+        : token;
 }
-std::vector<TransactionAndMetadata>
-CassandraBackend::fetchTransactions(
-    std::vector<ripple::uint256> const& hashes) const
+}  // namespace
+
+template <class T, class OnRow>
+void
+CassandraBackend::executeKeyedReads(
+    std::vector<ripple::uint256> const& keys,
+    CassandraPreparedStatement const& select,
+    CassandraPreparedStatement const& selectBatch,
+    std::optional<uint32_t> sequence,
+    OnRow onRow,
+    ReadHandler<std::vector<T>> handler) const
 {
-    std::size_t const numHashes = hashes.size();
-    std::atomic_int numOutstanding = numHashes;
-    std::condition_variable cv;
-    std::mutex mtx;
-    std::vector<TransactionAndMetadata> results{numHashes};
-    std::vector<std::shared_ptr<ReadCallbackData>> cbs;
-    cbs.reserve(numHashes);
-    auto start = std::chrono::system_clock::now();
-    for (std::size_t i = 0; i < hashes.size(); ++i)
+    if (readBatchSize_ <= 1 || keys.size() <= 1)
     {
-        CassandraStatement statement{selectTransaction_};
-        statement.bindNextBytes(hashes[i]);
-        cbs.push_back(std::make_shared<ReadCallbackData>(
-            numOutstanding, mtx, cv, [i, &results](auto& result) {
+        return executeAsyncReads<T>(
+            keys.size(),
+            keys.size(),
+            [&keys, &select, sequence](size_t i) {
+                CassandraStatement statement{select};
+                statement.bindNextBytes(keys[i]);
+                if (sequence)
+                    statement.bindNextInt(*sequence);
+                return statement;
+            },
+            [onRow](auto& results, size_t i, CassandraResult& result) {
                 if (result.hasResult())
-                    results[i] = {
-                        result.getBytes(),
-                        result.getBytes(),
-                        result.getUInt32(),
-                        result.getUInt32()};
-            }));
-        executeAsyncRead(statement, processAsyncRead, *cbs[i]);
+                    onRow(results[i], result);
+            },
+            std::move(handler));
     }
-    assert(results.size() == cbs.size());
 
-    std::unique_lock<std::mutex> lck(mtx);
-    cv.wait(lck, [&numOutstanding]() { return numOutstanding == 0; });
-    auto end = std::chrono::system_clock::now();
-    for (auto const& cb : cbs)
+    // keys that are close on the token ring tend to share replicas, so
+    // grouping by token keeps the rows of a group on few nodes
+    using Positions = std::unordered_map<
+        ripple::uint256,
+        std::vector<size_t>,
+        ripple::hardened_hash<>>;
+    auto positions = std::make_shared<Positions>();
+    std::vector<std::pair<int64_t, ripple::uint256>> tokens;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        auto& at = (*positions)[keys[i]];
+        if (at.empty())
+            tokens.push_back({murmur3Token(keys[i]), keys[i]});
+        at.push_back(i);
+    }
+    std::sort(tokens.begin(), tokens.end());
+    std::vector<std::vector<ripple::uint256>> groups;
+    for (size_t i = 0; i < tokens.size(); ++i)
     {
-        if (cb->errored)
-            throw DatabaseTimeout();
+        if (i % readBatchSize_ == 0)
+            groups.emplace_back();
+        groups.back().push_back(tokens[i].second);
     }
 
+    executeAsyncReads<T>(
+        keys.size(),
+        groups.size(),
+        [&groups, &selectBatch, sequence](size_t i) {
+            CassandraStatement statement{selectBatch};
+            statement.bindNextBytesList(groups[i]);
+            if (sequence)
+                statement.bindNextInt(*sequence);
+            return statement;
+        },
+        [onRow, positions](auto& results, size_t, CassandraResult& result) {
+            if (!result.hasResult())
+                return;
+            do
+            {
+                auto at = positions->find(result.getUInt256());
+                if (at == positions->end())
+                    continue;
+                auto& first = results[at->second.front()];
+                onRow(first, result);
+                for (size_t j = 1; j < at->second.size(); ++j)
+                    results[at->second[j]] = first;
+            } while (result.nextRow());
+        },
+        std::move(handler));
+}
+
+std::vector<TransactionAndMetadata>
+CassandraBackend::doFetchTransactions(
+    std::vector<ripple::uint256> const& hashes) const
+{
+    auto start = std::chrono::system_clock::now();
+    auto results = waitFor<std::vector<TransactionAndMetadata>>(
+        [&](auto handler) { doFetchTransactionsAsync(hashes, handler); });
+    auto end = std::chrono::system_clock::now();
+
     BOOST_LOG_TRIVIAL(debug)
-        << "Fetched " << numHashes << " transactions from Cassandra in "
+        << "Fetched " << hashes.size() << " transactions from Cassandra in "
         << std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
                .count()
         << " milliseconds";
     return results;
 }
+
+void
+CassandraBackend::doFetchTransactionsAsync(
+    std::vector<ripple::uint256> const& hashes,
+    ReadHandler<std::vector<TransactionAndMetadata>> handler) const
+{
+    executeKeyedReads<TransactionAndMetadata>(
+        hashes,
+        selectTransaction_,
+        selectTransactions_,
+        {},
+        [this](TransactionAndMetadata& txn, CassandraResult& result) {
+            txn = {
+                codec_.decode(BlobTable::transactions, result.getBytes()),
+                codec_.decode(BlobTable::metadata, result.getBytes()),
+                result.getUInt32(),
+                result.getUInt32()};
+        },
+        std::move(handler));
+}
+
 std::vector<ripple::uint256>
 CassandraBackend::fetchAllTransactionHashesInLedger(
     uint32_t ledgerSequence) const
@@ -461,8 +693,8 @@ CassandraBackend::fetchAllTransactionHashesInLedger(
     return hashes;
 }
 
-AccountTransactions
-CassandraBackend::fetchAccountTransactions(
+AccountTransactionHashes
+CassandraBackend::fetchAccountTransactionHashes(
     ripple::AccountID const& account,
     std::uint32_t limit,
     bool forward,
@@ -472,6 +704,13 @@ CassandraBackend::fetchAccountTransactions(
     if (!rng)
         return {{}, {}};
 
+    if (auto page = accountTxCache_.get(
+            account, limit, forward, cursorIn, rng->maxSequence))
+    {
+        BOOST_LOG_TRIVIAL(debug) << __func__ << " - served from cache";
+        return {page->hashes, page->cursor};
+    }
+
     auto keylet = ripple::keylet::account(account);
     auto cursor = cursorIn;
 
@@ -507,35 +746,42 @@ CassandraBackend::fetchAccountTransactions(
     if (!result.hasResult())
     {
         BOOST_LOG_TRIVIAL(debug) << __func__ << " - no rows returned";
+        if (!forward)
+            accountTxCache_.insert(
+                account, rng->maxSequence, cursorIn, {}, limit);
         return {};
     }
 
     std::vector<ripple::uint256> hashes = {};
+    std::vector<AccountTxCache::Row> rows;
     auto numRows = result.numRows();
     BOOST_LOG_TRIVIAL(info) << "num_rows = " << std::to_string(numRows);
     do
     {
-        hashes.push_back(result.getUInt256());
+        auto hash = result.getUInt256();
+        auto [lgrSeq, txnIdx] = result.getInt64Tuple();
+        hashes.push_back(hash);
+        rows.push_back({(uint32_t)lgrSeq, (uint32_t)txnIdx, hash});
         if (--numRows == 0)
         {
             BOOST_LOG_TRIVIAL(debug) << __func__ << " setting cursor";
-            auto [lgrSeq, txnIdx] = result.getInt64Tuple();
             cursor = {(uint32_t)lgrSeq, (uint32_t)txnIdx};
             if (forward)
                 ++cursor->transactionIndex;
         }
     } while (result.nextRow());
+    // newest rows, and the pages that continue them, are cached
+    if (!forward)
+        accountTxCache_.insert(
+            account, rng->maxSequence, cursorIn, rows, limit);
 
-    auto txns = fetchTransactions(hashes);
-    BOOST_LOG_TRIVIAL(debug) << __func__ << "txns = " << txns.size();
-
-    if (txns.size() == limit)
+    if (hashes.size() == limit)
     {
         BOOST_LOG_TRIVIAL(debug) << __func__ << " returning cursor";
-        return {txns, cursor};
+        return {hashes, cursor};
     }
 
-    return {txns, {}};
+    return {hashes, {}};
 }
 std::optional<ripple::uint256>
 CassandraBackend::doFetchSuccessorKey(
@@ -572,7 +818,7 @@ CassandraBackend::doFetchLedgerObject(
         BOOST_LOG_TRIVIAL(debug) << __func__ << " - no rows";
         return {};
     }
-    auto res = result.getBytes();
+    auto res = codec_.decode(BlobTable::objects, result.getBytes());
     if (res.size())
         return res;
     return {};
@@ -583,41 +829,52 @@ CassandraBackend::doFetchLedgerObjects(
     std::vector<ripple::uint256> const& keys,
     uint32_t sequence) const
 {
-    std::size_t const numKeys = keys.size();
     BOOST_LOG_TRIVIAL(trace)
-        << "Fetching " << numKeys << " records from Cassandra";
-    std::atomic_int numOutstanding = numKeys;
-    std::condition_variable cv;
-    std::mutex mtx;
-    std::vector<Blob> results{numKeys};
-    std::vector<std::shared_ptr<ReadCallbackData>> cbs;
-    cbs.reserve(numKeys);
-    for (std::size_t i = 0; i < keys.size(); ++i)
-    {
-        cbs.push_back(std::make_shared<ReadCallbackData>(
-            numOutstanding, mtx, cv, [i, &results](auto& result) {
-                if (result.hasResult())
-                    results[i] = result.getBytes();
-            }));
-        CassandraStatement statement{selectObject_};
-        statement.bindNextBytes(keys[i]);
-        statement.bindNextInt(sequence);
-        executeAsyncRead(statement, processAsyncRead, *cbs[i]);
-    }
-    assert(results.size() == cbs.size());
-
-    std::unique_lock<std::mutex> lck(mtx);
-    cv.wait(lck, [&numOutstanding]() { return numOutstanding == 0; });
-    for (auto const& cb : cbs)
-    {
-        if (cb->errored)
-            throw DatabaseTimeout();
-    }
-
+        << "Fetching " << keys.size() << " records from Cassandra";
+    auto results = waitFor<std::vector<Blob>>([&](auto handler) {
+        doFetchLedgerObjectsAsync(keys, sequence, handler);
+    });
     BOOST_LOG_TRIVIAL(trace)
-        << "Fetched " << numKeys << " records from Cassandra";
+        << "Fetched " << keys.size() << " records from Cassandra";
     return results;
 }
+
+void
+CassandraBackend::doFetchLedgerObjectsAsync(
+    std::vector<ripple::uint256> const& keys,
+    uint32_t sequence,
+    ReadHandler<std::vector<Blob>> handler) const
+{
+    executeKeyedReads<Blob>(
+        keys,
+        selectObject_,
+        selectObjects_,
+        sequence,
+        [this](Blob& blob, CassandraResult& result) {
+            blob = codec_.decode(BlobTable::objects, result.getBytes());
+        },
+        std::move(handler));
+}
+
+void
+CassandraBackend::fetchLedgerBySequenceAsync(
+    uint32_t sequence,
+    ReadHandler<std::optional<ripple::LedgerInfo>> handler) const
+{
+    CassandraStatement statement{selectLedgerBySeq_};
+    statement.bindNextInt(sequence);
+    executeAsyncRead(
+        std::move(statement),
+        [handler = std::move(handler)](CassError rc, CassandraResult& result) {
+            if (rc != CASS_OK)
+                return handler(boost::asio::error::timed_out, {});
+            if (!result)
+                return handler({}, {});
+            std::vector<unsigned char> header = result.getBytes();
+            handler({}, deserializeHeader(ripple::makeSlice(header)));
+        });
+}
+
 std::vector<LedgerObject>
 CassandraBackend::fetchLedgerDiff(uint32_t ledgerSequence) const
 {
@@ -656,6 +913,130 @@ CassandraBackend::fetchLedgerDiff(uint32_t ledgerSequence) const
     return results;
 }
 
+void
+CassandraBackend::scanTokenRange(
+    int64_t first,
+    int64_t last,
+    uint32_t ledgerSequence,
+    std::function<void(std::vector<LedgerObject>&&)> const& handler) const
+{
+    while (true)
+    {
+        CassandraStatement statement{selectLedgerPage_};
+        statement.bindNextInt(first);
+        statement.bindNextInt(last);
+        statement.bindNextInt(ledgerSequence);
+        statement.bindNextUInt(scanPageSize);
+        CassandraResult result;
+        try
+        {
+            result = executeSyncRead(statement);
+        }
+        catch (DatabaseTimeout const&)
+        {
+            BOOST_LOG_TRIVIAL(warning)
+                << __func__ << " - database timeout scanning from token "
+                << first;
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+        if (!result)
+            return;
+
+        std::vector<LedgerObject> objects;
+        std::vector<int64_t> tokens;
+        do
+        {
+            auto key = result.getUInt256();
+            auto object = codec_.decode(BlobTable::objects, result.getBytes());
+            tokens.push_back(result.getInt64());
+            objects.push_back({key, std::move(object)});
+        } while (result.nextRow());
+
+        bool const full = objects.size() >= scanPageSize;
+        int64_t const lastToken = tokens.back();
+        // keys can share a token, so a full page may end in the middle of
+        // a token. Its keys are read again with the next page
+        if (full && tokens.front() != lastToken)
+        {
+            while (tokens.back() == lastToken)
+            {
+                tokens.pop_back();
+                objects.pop_back();
+            }
+            first = lastToken;
+        }
+        else if (full && lastToken != last)
+            first = lastToken + 1;
+        // objects deleted as of ledgerSequence are empty
+        objects.erase(
+            std::remove_if(
+                objects.begin(),
+                objects.end(),
+                [](auto const& obj) { return obj.blob.empty(); }),
+            objects.end());
+        handler(std::move(objects));
+        if (!full || lastToken == last)
+            return;
+    }
+}
+
+void
+CassandraBackend::scanLedger(
+    uint32_t ledgerSequence,
+    std::function<void(std::vector<LedgerObject>&&)> const& handler,
+    std::uint32_t concurrency) const
+{
+    concurrency = std::max(concurrency, 1u);
+    // the Murmur3 token ring, split into ranges of equal width
+    uint32_t const numRanges = concurrency * scanRangesPerThread;
+    uint64_t const width = std::numeric_limits<uint64_t>::max() / numRanges;
+    auto bound = [width](uint32_t i) {
+        return static_cast<int64_t>(
+            static_cast<uint64_t>(std::numeric_limits<int64_t>::min()) +
+            i * width);
+    };
+
+    std::atomic_uint32_t next = 0;
+    std::atomic_bool failed = false;
+    std::exception_ptr error;
+    std::mutex errorMtx;
+    auto scan = [&]() {
+        try
+        {
+            for (uint32_t i = next++; i < numRanges && !failed; i = next++)
+            {
+                auto last = i + 1 == numRanges
+                    ? std::numeric_limits<int64_t>::max()
+                    : bound(i + 1) - 1;
+                scanTokenRange(bound(i), last, ledgerSequence, handler);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard lck{errorMtx};
+            if (!failed.exchange(true))
+                error = std::current_exception();
+        }
+    };
+
+    auto start = std::chrono::system_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < concurrency; ++i)
+        threads.emplace_back(scan);
+    scan();
+    for (auto& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " - scanned ledger " << ledgerSequence << " in "
+        << std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now() - start)
+               .count()
+        << " seconds with " << concurrency << " threads";
+}
+
 bool
 CassandraBackend::doOnlineDelete(uint32_t numLedgersToKeep) const
 {
@@ -669,6 +1050,8 @@ CassandraBackend::doOnlineDelete(uint32_t numLedgersToKeep) const
     uint32_t minLedger = rng->maxSequence - numLedgersToKeep;
     if (minLedger <= rng->minSequence)
         return false;
+    if (rangeDelete_)
+        return doRangeDelete(*rng, minLedger);
     auto bind = [this](auto& params) {
         auto& [key, seq, obj] = params.data;
         CassandraStatement statement{insertObject_};
@@ -683,65 +1066,228 @@ CassandraBackend::doOnlineDelete(uint32_t numLedgersToKeep) const
         std::tuple<ripple::uint256, uint32_t, Blob>,
         typename std::remove_reference<decltype(bind)>::type>>>
         cbs;
-    uint32_t concurrentLimit = 10;
+    uint32_t concurrentLimit = 10 * onlineDeleteScanThreads_;
     std::atomic_int numOutstanding = 0;
 
     // iterate through latest ledger, updating TTL
-    std::optional<ripple::uint256> cursor;
-    while (true)
-    {
-        try
-        {
-            auto [objects, curCursor, warning] =
-                fetchLedgerPage(cursor, minLedger, 256);
-            if (warning)
-            {
-                BOOST_LOG_TRIVIAL(warning)
-                    << __func__
-                    << " online delete running but flag ledger is not complete";
-                std::this_thread::sleep_for(std::chrono::seconds(10));
-                continue;
-            }
-
+    scanLedger(
+        minLedger,
+        [&](std::vector<LedgerObject>&& objects) {
             for (auto& obj : objects)
             {
+                // the scan decompressed the objects
+                codec_.encode(BlobTable::objects, obj.blob);
                 ++numOutstanding;
-                cbs.push_back(makeAndExecuteBulkAsyncWrite(
+                auto cb = makeAndExecuteBulkAsyncWrite(
                     this,
                     std::make_tuple(
                         std::move(obj.key), minLedger, std::move(obj.blob)),
                     bind,
                     numOutstanding,
                     mtx,
-                    cv));
+                    cv);
 
                 std::unique_lock<std::mutex> lck(mtx);
                 BOOST_LOG_TRIVIAL(trace) << __func__ << "Got the mutex";
+                cbs.push_back(std::move(cb));
                 cv.wait(lck, [&numOutstanding, concurrentLimit]() {
                     return numOutstanding < concurrentLimit;
                 });
             }
             BOOST_LOG_TRIVIAL(debug) << __func__ << " fetched a page";
-            cursor = curCursor;
-            if (!cursor)
-                break;
-        }
-        catch (DatabaseTimeout const& e)
-        {
-            BOOST_LOG_TRIVIAL(warning)
-                << __func__ << " Database timeout fetching keys";
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-        }
-    }
+        },
+        onlineDeleteScanThreads_);
     std::unique_lock<std::mutex> lck(mtx);
     cv.wait(lck, [&numOutstanding]() { return numOutstanding == 0; });
     CassandraStatement statement{deleteLedgerRange_};
     statement.bindNextInt(minLedger);
     executeSyncWrite(statement);
     // update ledger_range
+    range->minSequence = minLedger;
+    return true;
+}
+
+bool
+CassandraBackend::doRangeDelete(LedgerRange const& rng, uint32_t minLedger)
+    const
+{
+    // the ledgers leave the range before anything is deleted, so no reader
+    // sees a ledger with some of its data gone
+    {
+        CassandraStatement statement{deleteLedgerRange_};
+        statement.bindNextInt(minLedger);
+        executeSyncWrite(statement);
+    }
+    auto retry = [](auto&& read) {
+        while (true)
+        {
+            try
+            {
+                return read();
+            }
+            catch (DatabaseTimeout const& e)
+            {
+                BOOST_LOG_TRIVIAL(warning)
+                    << __func__ << " Database timeout reading deleted ledger";
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+            }
+        }
+    };
+    auto journal = ripple::debugLog();
+    // accounts with transactions in the deleted ledgers. Their old
+    // transactions are deleted with one range delete each, at the end
+    std::unordered_set<ripple::AccountID, ripple::hardened_hash<>> accounts;
+    size_t numObjects = 0;
+    size_t numTransactions = 0;
+    for (uint32_t seq = rng.minSequence; seq <= minLedger; ++seq)
+    {
+        // the versions of the keys modified by seq that are older than seq
+        // are only read by ledgers before seq. The diff of the first ledger
+        // of the range was already handled by the previous online delete
+        if (seq > rng.minSequence)
+        {
+            auto keys = retry([this, seq]() {
+                CassandraStatement statement{selectDiff_};
+                statement.bindNextInt(seq);
+                CassandraResult result = executeSyncRead(statement);
+                std::vector<ripple::uint256> keys;
+                if (!result)
+                    return keys;
+                do
+                {
+                    keys.push_back(result.getUInt256());
+                } while (result.nextRow());
+                return keys;
+            });
+            for (auto const& key : keys)
+            {
+                CassandraStatement statement{deleteObjectVersions_};
+                statement.bindNextBytes(key);
+                statement.bindNextInt(seq);
+                executeAsyncDelete(std::move(statement));
+            }
+            numObjects += keys.size();
+        }
+        if (seq == minLedger)
+            break;
+
+        auto hashes = retry([this, seq]() {
+            return fetchAllTransactionHashesInLedger(seq);
+        });
+        auto txns =
+            retry([this, &hashes]() { return doFetchTransactions(hashes); });
+        for (size_t i = 0; i < hashes.size(); ++i)
+        {
+            CassandraStatement statement{deleteTransaction_};
+            statement.bindNextBytes(hashes[i]);
+            executeAsyncDelete(std::move(statement));
+            if (txns[i].metadata.empty())
+                continue;
+            ripple::TxMeta meta{hashes[i], seq, txns[i].metadata};
+            for (auto const& account : meta.getAffectedAccounts(journal))
+                accounts.insert(account);
+        }
+        numTransactions += hashes.size();
+
+        if (auto header =
+                retry([this, seq]() { return fetchLedgerBySequence(seq); }))
+        {
+            CassandraStatement statement{deleteLedgerHash_};
+            statement.bindNextBytes(header->hash);
+            executeAsyncDelete(std::move(statement));
+        }
+        // the rest are whole partitions of seq
+        for (auto const* prepared :
+             {&deleteLedgerHeader_, &deleteLedgerTransactions_, &deleteDiff_})
+        {
+            CassandraStatement statement{*prepared};
+            statement.bindNextInt(seq);
+            executeAsyncDelete(std::move(statement));
+        }
+    }
+    for (auto const& account : accounts)
+    {
+        CassandraStatement statement{deleteAccountTx_};
+        statement.bindNextBytes(account);
+        statement.bindNextIntTuple(minLedger, 0);
+        executeAsyncDelete(std::move(statement));
+    }
+    syncDeletes();
+    range->minSequence = minLedger;
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " deleted ledgers " << rng.minSequence << " through "
+        << minLedger - 1 << ". modified objects = " << numObjects
+        << " transactions = " << numTransactions
+        << " accounts = " << accounts.size();
     return true;
 }
 
+void
+CassandraBackend::executeAsyncDelete(CassandraStatement statement) const
+{
+    struct Delete
+    {
+        CassandraBackend const& backend;
+        CassandraStatement statement;
+        ConcurrencyLimiter::clock::time_point start;
+        uint32_t retries = 0;
+
+        void
+        execute()
+        {
+            CassFuture* fut =
+                cass_session_execute(backend.session_.get(), statement.get());
+            cass_future_set_callback(fut, &Delete::complete, this);
+            cass_future_free(fut);
+        }
+
+        static void
+        complete(CassFuture* fut, void* data)
+        {
+            auto del = static_cast<Delete*>(data);
+            auto const& backend = del->backend;
+            CassError rc = cass_future_error_code(fut);
+            if (rc != CASS_OK)
+            {
+                // same backoff as writes
+                auto wait = std::chrono::milliseconds(
+                    lround(std::pow(2, std::min(10u, del->retries))));
+                BOOST_LOG_TRIVIAL(error)
+                    << "Cassandra delete error: " << rc << ", "
+                    << cass_error_desc(rc) << ", retrying in " << wait.count()
+                    << " milliseconds";
+                ++del->retries;
+                backend.deleteLimiter_->failed();
+                auto timer = std::make_shared<boost::asio::steady_timer>(
+                    backend.getIOContext(),
+                    std::chrono::steady_clock::now() + wait);
+                timer->async_wait(
+                    [timer, del](boost::system::error_code const&) {
+                        del->execute();
+                    });
+                return;
+            }
+            backend.deleteLimiter_->release(del->start);
+            delete del;
+            if (--backend.numDeletesOutstanding_ == 0)
+            {
+                std::lock_guard lck(backend.deleteMutex_);
+                backend.deleteCv_.notify_all();
+            }
+        }
+    };
+    auto start = deleteLimiter_->acquire();
+    ++numDeletesOutstanding_;
+    (new Delete{*this, std::move(statement), start})->execute();
+}
+
+void
+CassandraBackend::syncDeletes() const
+{
+    std::unique_lock lck(deleteMutex_);
+    deleteCv_.wait(lck, [this]() { return numDeletesOutstanding_ == 0; });
+}
+
 void
 CassandraBackend::open(bool readOnly)
 {
@@ -858,13 +1404,51 @@ CassandraBackend::open(bool readOnly)
     }
     if (getInt("max_requests_outstanding"))
         maxRequestsOutstanding = *getInt("max_requests_outstanding");
+    maxReadRequestsOutstanding = getInt("max_read_requests_outstanding")
+        ? *getInt("max_read_requests_outstanding")
+        : maxRequestsOutstanding;
+    // start well below the maximum, and let the windows grow with the
+    // capacity the database shows
+    writeLimiter_ = std::make_unique<ConcurrencyLimiter>(
+        maxRequestsOutstanding / 4,
+        minRequestsOutstanding,
+        maxRequestsOutstanding,
+        &ioContext_);
+    readLimiter_ = std::make_unique<ConcurrencyLimiter>(
+        maxReadRequestsOutstanding / 4,
+        minRequestsOutstanding,
+        maxReadRequestsOutstanding,
+        &ioContext_);
+
+    rangeDelete_ = getString("online_delete_mode") == "range";
+    if (getInt("online_delete_max_requests_outstanding"))
+        maxDeleteRequestsOutstanding =
+            *getInt("online_delete_max_requests_outstanding");
+    deleteLimiter_ = std::make_unique<ConcurrencyLimiter>(
+        maxDeleteRequestsOutstanding / 4,
+        std::min(minRequestsOutstanding, maxDeleteRequestsOutstanding),
+        maxDeleteRequestsOutstanding,
+        &ioContext_);
 
     cass_cluster_set_request_timeout(cluster, 10000);
 
+    if (auto threads = getInt("online_delete_scan_threads"))
+        onlineDeleteScanThreads_ = std::clamp(*threads, 1, 64);
+    if (getInt("read_batch_size"))
+        readBatchSize_ = std::max(*getInt("read_batch_size"), 1);
+    if (auto window = getInt("write_window"))
+        writeWindow_ = std::clamp<uint32_t>(*window, 1, maxWriteWindow);
+    // reads running this long are sent to a second replica. Only reads are
+    // marked idempotent, so writes are never sent twice
+    if (auto delay = getInt("speculative_retry_ms"))
+        cass_cluster_set_constant_speculative_execution_policy(
+            cluster, *delay, 1);
+
     rc = cass_cluster_set_queue_size_io(
         cluster,
-        maxRequestsOutstanding);  // This number needs to scale w/ the
-                                  // number of request per sec
+        maxRequestsOutstanding + maxReadRequestsOutstanding +
+            maxDeleteRequestsOutstanding);  // This number needs to scale w/
+                                            // the number of request per sec
     if (rc != CASS_OK)
     {
         std::stringstream ss;
@@ -929,7 +1513,8 @@ CassandraBackend::open(bool readOnly)
 
     cass_cluster_set_connect_timeout(cluster, 10000);
 
-    int ttl = getInt("ttl") ? *getInt("ttl") * 2 : 0;
+    // old ledgers are deleted explicitly in range mode
+    int ttl = getInt("ttl") && !rangeDelete_ ? *getInt("ttl") * 2 : 0;
     BOOST_LOG_TRIVIAL(info)
         << __func__ << " setting ttl to " << std::to_string(ttl);
 
@@ -1184,6 +1769,12 @@ CassandraBackend::open(bool readOnly)
         if (!selectObject_.prepareStatement(query, session_.get()))
             continue;
 
+        query.str("");
+        query << "SELECT key, object FROM " << tablePrefix << "objects"
+              << " WHERE key IN ? AND sequence <= ? PER PARTITION LIMIT 1";
+        if (!selectObjects_.prepareStatement(query, session_.get()))
+            continue;
+
         query.str("");
         query << "SELECT transaction, metadata, ledger_sequence, date FROM "
               << tablePrefix << "transactions"
@@ -1191,6 +1782,13 @@ CassandraBackend::open(bool readOnly)
         if (!selectTransaction_.prepareStatement(query, session_.get()))
             continue;
 
+        query.str("");
+        query << "SELECT hash, transaction, metadata, ledger_sequence, date "
+              << "FROM " << tablePrefix << "transactions"
+              << " WHERE hash IN ?";
+        if (!selectTransactions_.prepareStatement(query, session_.get()))
+            continue;
+
         query.str("");
         query << "SELECT hash FROM " << tablePrefix << "ledger_transactions"
               << " WHERE ledger_sequence = ?";
@@ -1207,8 +1805,9 @@ CassandraBackend::open(bool readOnly)
             continue;
 
         query.str("");
-        query << "SELECT object,key FROM " << tablePrefix << "objects "
-              << " WHERE TOKEN(key) >= ? and sequence <= ? "
+        query << "SELECT key, object, TOKEN(key) FROM " << tablePrefix
+              << "objects "
+              << " WHERE TOKEN(key) >= ? and TOKEN(key) <= ? and sequence <= ? "
               << " PER PARTITION LIMIT 1 LIMIT ? ALLOW FILTERING";
 
         if (!selectLedgerPage_.prepareStatement(query, session_.get()))
@@ -1288,6 +1887,47 @@ CassandraBackend::open(bool readOnly)
         query << " SELECT sequence FROM " << tablePrefix << "ledger_range";
         if (!selectLedgerRange_.prepareStatement(query, session_.get()))
             continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "objects"
+              << " WHERE key = ? AND sequence < ?";
+        if (!deleteObjectVersions_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "diff WHERE seq = ?";
+        if (!deleteDiff_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "ledger_transactions"
+              << " WHERE ledger_sequence = ?";
+        if (!deleteLedgerTransactions_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "transactions"
+              << " WHERE hash = ?";
+        if (!deleteTransaction_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "ledgers"
+              << " WHERE sequence = ?";
+        if (!deleteLedgerHeader_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "ledger_hashes"
+              << " WHERE hash = ?";
+        if (!deleteLedgerHash_.prepareStatement(query, session_.get()))
+            continue;
+
+        query.str("");
+        query << "DELETE FROM " << tablePrefix << "account_tx"
+              << " WHERE account = ? AND seq_idx < ?";
+        if (!deleteAccountTx_.prepareStatement(query, session_.get()))
+            continue;
         setupPreparedStatements = true;
     }
 
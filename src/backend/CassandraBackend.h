@@ -6,15 +6,22 @@
 #include <boost/filesystem.hpp>
 #include <boost/json.hpp>
 #include <boost/log/trivial.hpp>
+#include <array>
 #include <atomic>
 #include <backend/BackendInterface.h>
+#include <backend/ConcurrencyLimiter.h>
 #include <backend/DBHelpers.h>
 #include <cassandra.h>
+#include <log/Trace.h>
 #include <cstddef>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace Backend {
 
@@ -23,6 +30,24 @@ class CassandraPreparedStatement
 private:
     CassPrepared const* prepared_ = nullptr;
 
+    // statements bound from this one whose requests have completed, with
+    // the number of values bound to them. Binding reuses them, instead of
+    // allocating a new statement
+    mutable std::mutex poolMutex_;
+    mutable std::vector<std::pair<CassStatement*, size_t>> pool_;
+    mutable std::atomic_uint64_t numBound_ = 0;
+    mutable std::atomic_uint64_t numReused_ = 0;
+    static constexpr size_t maxPooled = 1024;
+
+    void
+    clearPool()
+    {
+        std::lock_guard lck(poolMutex_);
+        for (auto& [statement, numParams] : pool_)
+            cass_statement_free(statement);
+        pool_.clear();
+    }
+
 public:
     CassPrepared const*
     get() const
@@ -30,6 +55,55 @@ public:
         return prepared_;
     }
 
+    // a statement to bind values to, from the pool if it has one
+    CassStatement*
+    bind() const
+    {
+        ++numBound_;
+        std::pair<CassStatement*, size_t> pooled{nullptr, 0};
+        {
+            std::lock_guard lck(poolMutex_);
+            if (!pool_.empty())
+            {
+                pooled = pool_.back();
+                pool_.pop_back();
+            }
+        }
+        if (auto [statement, numParams] = pooled; statement)
+        {
+            ++numReused_;
+            cass_statement_reset_parameters(statement, numParams);
+            return statement;
+        }
+        CassStatement* statement = cass_prepared_bind(prepared_);
+        cass_statement_set_consistency(statement, CASS_CONSISTENCY_QUORUM);
+        return statement;
+    }
+
+    // Give back a statement returned by bind(), to be bound again. The
+    // driver reads the statement until its request completes, so only
+    // statements of completed requests can be recycled
+    void
+    recycle(CassStatement* statement, size_t numParams) const
+    {
+        {
+            std::lock_guard lck(poolMutex_);
+            if (pool_.size() < maxPooled)
+            {
+                pool_.emplace_back(statement, numParams);
+                return;
+            }
+        }
+        cass_statement_free(statement);
+    }
+
+    // statements bound, and how many of them were reused
+    std::pair<uint64_t, uint64_t>
+    poolStats() const
+    {
+        return {numBound_, numReused_};
+    }
+
     bool
     prepareStatement(std::stringstream const& query, CassSession* session)
     {
@@ -54,6 +128,8 @@ public:
         CassError rc = cass_future_error_code(prepareFuture);
         if (rc == CASS_OK)
         {
+            // pooled statements are bound from the previous prepared_
+            clearPool();
             prepared_ = cass_future_get_prepared(prepareFuture);
         }
         else
@@ -70,6 +146,7 @@ public:
     ~CassandraPreparedStatement()
     {
         BOOST_LOG_TRIVIAL(trace) << __func__;
+        clearPool();
         if (prepared_)
         {
             cass_prepared_free(prepared_);
@@ -82,12 +159,13 @@ class CassandraStatement
 {
     CassStatement* statement_ = nullptr;
     size_t curBindingIndex_ = 0;
+    CassandraPreparedStatement const* prepared_ = nullptr;
 
 public:
     CassandraStatement(CassandraPreparedStatement const& prepared)
+        : prepared_(&prepared)
     {
-        statement_ = cass_prepared_bind(prepared.get());
-        cass_statement_set_consistency(statement_, CASS_CONSISTENCY_QUORUM);
+        statement_ = prepared.bind();
     }
 
     CassandraStatement(CassandraStatement&& other)
@@ -96,9 +174,20 @@ public:
         other.statement_ = nullptr;
         curBindingIndex_ = other.curBindingIndex_;
         other.curBindingIndex_ = 0;
+        prepared_ = other.prepared_;
     }
     CassandraStatement(CassandraStatement const& other) = delete;
 
+    // Give the statement back to the prepared statement it was bound from,
+    // to be reused. Only once the request executing it has completed
+    void
+    recycle()
+    {
+        if (statement_ && prepared_)
+            prepared_->recycle(statement_, curBindingIndex_);
+        statement_ = nullptr;
+    }
+
     CassStatement*
     get() const
     {
@@ -226,6 +315,44 @@ public:
         curBindingIndex_++;
     }
 
+    void
+    bindNextBytesList(std::vector<ripple::uint256> const& values)
+    {
+        if (!statement_)
+            throw std::runtime_error(
+                "CassandraStatement::bindNextBytesList - statement_ is null");
+        CassCollection* list =
+            cass_collection_new(CASS_COLLECTION_TYPE_LIST, values.size());
+        for (auto const& value : values)
+        {
+            CassError rc = cass_collection_append_bytes(
+                list,
+                static_cast<cass_byte_t const*>(value.data()),
+                value.size());
+            if (rc != CASS_OK)
+            {
+                cass_collection_free(list);
+                std::stringstream ss;
+                ss << "Error appending bytes to list: " << rc << ", "
+                   << cass_error_desc(rc);
+                BOOST_LOG_TRIVIAL(error) << __func__ << " : " << ss.str();
+                throw std::runtime_error(ss.str());
+            }
+        }
+        CassError rc =
+            cass_statement_bind_collection(statement_, curBindingIndex_, list);
+        cass_collection_free(list);
+        if (rc != CASS_OK)
+        {
+            std::stringstream ss;
+            ss << "Error binding list to statement: " << rc << ", "
+               << cass_error_desc(rc);
+            BOOST_LOG_TRIVIAL(error) << __func__ << " : " << ss.str();
+            throw std::runtime_error(ss.str());
+        }
+        curBindingIndex_++;
+    }
+
     void
     bindNextIntTuple(uint32_t first, uint32_t second)
     {
@@ -268,6 +395,62 @@ public:
     }
 };
 
+// Statements executed together as one unlogged batch. Used for statements
+// writing to the same partition, which the cluster applies as one mutation
+class CassandraBatch
+{
+    CassBatch* batch_ = nullptr;
+    std::vector<CassandraStatement> statements_;
+
+public:
+    CassandraBatch() : batch_(cass_batch_new(CASS_BATCH_TYPE_UNLOGGED))
+    {
+        cass_batch_set_consistency(batch_, CASS_CONSISTENCY_QUORUM);
+    }
+
+    CassandraBatch(CassandraBatch&& other)
+        : batch_(other.batch_), statements_(std::move(other.statements_))
+    {
+        other.batch_ = nullptr;
+    }
+    CassandraBatch(CassandraBatch const& other) = delete;
+
+    void
+    add(CassandraStatement&& statement)
+    {
+        CassError rc = cass_batch_add_statement(batch_, statement.get());
+        if (rc != CASS_OK)
+        {
+            std::stringstream ss;
+            ss << "Error adding statement to batch: " << rc << ", "
+               << cass_error_desc(rc);
+            throw std::runtime_error(ss.str());
+        }
+        statements_.push_back(std::move(statement));
+    }
+
+    // Recycle the statements of the batch, once it has completed
+    void
+    recycle()
+    {
+        for (auto& statement : statements_)
+            statement.recycle();
+        statements_.clear();
+    }
+
+    CassBatch*
+    get() const
+    {
+        return batch_;
+    }
+
+    ~CassandraBatch()
+    {
+        if (batch_)
+            cass_batch_free(batch_);
+    }
+};
+
 class CassandraResult
 {
     CassResult const* result_ = nullptr;
@@ -548,8 +731,10 @@ private:
     CassandraPreparedStatement insertTransaction_;
     CassandraPreparedStatement insertLedgerTransaction_;
     CassandraPreparedStatement selectTransaction_;
+    CassandraPreparedStatement selectTransactions_;
     CassandraPreparedStatement selectAllTransactionHashesInLedger_;
     CassandraPreparedStatement selectObject_;
+    CassandraPreparedStatement selectObjects_;
     CassandraPreparedStatement selectLedgerPageKeys_;
     CassandraPreparedStatement selectLedgerPage_;
     CassandraPreparedStatement upperBound2_;
@@ -570,24 +755,60 @@ private:
     CassandraPreparedStatement selectLedgerByHash_;
     CassandraPreparedStatement selectLatestLedger_;
     CassandraPreparedStatement selectLedgerRange_;
+    CassandraPreparedStatement deleteObjectVersions_;
+    CassandraPreparedStatement deleteDiff_;
+    CassandraPreparedStatement deleteLedgerTransactions_;
+    CassandraPreparedStatement deleteTransaction_;
+    CassandraPreparedStatement deleteLedgerHeader_;
+    CassandraPreparedStatement deleteLedgerHash_;
+    CassandraPreparedStatement deleteAccountTx_;
 
     // io_context used for exponential backoff for write retries
     mutable boost::asio::io_context ioContext_;
     std::optional<boost::asio::io_context::work> work_;
     std::thread ioThread_;
 
-    // maximum number of concurrent in flight requests. New requests will wait
-    // for earlier requests to finish if this limit is exceeded
+    // maximum number of concurrent in flight writes and reads. The number
+    // actually allowed adapts to the latency of the database, up to these
     uint32_t maxRequestsOutstanding = 10000;
-    // we keep this small because the indexer runs in the background, and we
-    // don't want the database to be swamped when the indexer is running
-    uint32_t indexerMaxRequestsOutstanding = 10;
+    uint32_t maxReadRequestsOutstanding = 10000;
+    static constexpr uint32_t minRequestsOutstanding = 16;
+    // New writes wait for earlier writes to finish while the window of
+    // writeLimiter_ is full. Reads are queued by readLimiter_ instead, so
+    // the threads issuing them are never blocked. Created by open()
+    std::unique_ptr<ConcurrencyLimiter> writeLimiter_;
+    std::unique_ptr<ConcurrencyLimiter> readLimiter_;
     mutable std::atomic_uint32_t numRequestsOutstanding_ = 0;
-
-    // mutex and condition_variable to limit the number of concurrent in flight
-    // requests
-    mutable std::mutex throttleMutex_;
-    mutable std::condition_variable throttleCv_;
+    // writes outstanding per ledger, by sequence modulo maxWriteWindow, so a
+    // ledger can be committed while the writes of the ledgers after it are
+    // still in flight
+    static constexpr uint32_t maxWriteWindow = 8;
+    uint32_t writeWindow_ = 4;
+    mutable std::array<std::atomic_uint32_t, maxWriteWindow>
+        ledgerWritesOutstanding_{};
+
+    // online delete removes old ledgers with range and partition deletes,
+    // instead of rewriting the latest ledger with a new TTL. Tables are then
+    // created without a TTL. The deletes have their own window, so they only
+    // use the capacity that ETL leaves over
+    bool rangeDelete_ = false;
+    uint32_t maxDeleteRequestsOutstanding = 64;
+    std::unique_ptr<ConcurrencyLimiter> deleteLimiter_;
+    mutable std::atomic_uint32_t numDeletesOutstanding_ = 0;
+    mutable std::mutex deleteMutex_;
+    mutable std::condition_variable deleteCv_;
+
+    // keys read by one statement in multi-key reads. Keys are grouped by their
+    // position on the token ring. 1 reads every key with its own statement
+    uint32_t readBatchSize_ = 32;
+
+    // ledger scans split the token ring into this many ranges per thread,
+    // so threads that draw sparse ranges pick up more of them
+    static constexpr uint32_t scanRangesPerThread = 16;
+    // rows read by one statement of a ledger scan
+    static constexpr uint32_t scanPageSize = 1024;
+    // threads scanning the ledger kept by online delete
+    uint32_t onlineDeleteScanThreads_ = 8;
 
     // writes are asynchronous. This mutex and condition_variable is used to
     // wait for all writes to finish
@@ -596,7 +817,9 @@ private:
 
     boost::json::object config_;
 
-    mutable uint32_t ledgerSequence_ = 0;
+    // ledger being written, set by writeLedger(). Backfill writes ledgers
+    // from several threads, and only waits for all writes
+    mutable std::atomic_uint32_t ledgerSequence_ = 0;
 
 public:
     CassandraBackend(boost::json::object const& config)
@@ -634,40 +857,89 @@ public:
         open_ = false;
     }
 
-    AccountTransactions
-    fetchAccountTransactions(
+    AccountTransactionHashes
+    fetchAccountTransactionHashes(
         ripple::AccountID const& account,
         std::uint32_t limit,
         bool forward,
         std::optional<AccountTransactionsCursor> const& cursor) const override;
 
     bool
-    doFinishWrites() override
+    doFinishWrites(uint32_t ledgerSequence) override
     {
-        // wait for all other writes to finish
-        sync();
+        // wait for the writes of this ledger to finish. Writes of the
+        // ledgers after it may still be in flight
+        syncLedger(ledgerSequence);
         // write range
         if (!range)
         {
             CassandraStatement statement{updateLedgerRange_};
-            statement.bindNextInt(ledgerSequence_);
+            statement.bindNextInt(ledgerSequence);
             statement.bindNextBoolean(false);
-            statement.bindNextInt(ledgerSequence_);
+            statement.bindNextInt(ledgerSequence);
             executeSyncWrite(statement);
         }
         CassandraStatement statement{updateLedgerRange_};
-        statement.bindNextInt(ledgerSequence_);
+        statement.bindNextInt(ledgerSequence);
         statement.bindNextBoolean(true);
-        statement.bindNextInt(ledgerSequence_ - 1);
+        statement.bindNextInt(ledgerSequence - 1);
         if (!executeSyncUpdate(statement))
         {
             BOOST_LOG_TRIVIAL(warning)
                 << __func__ << " Update failed for ledger "
-                << std::to_string(ledgerSequence_) << ". Returning";
+                << std::to_string(ledgerSequence) << ". Returning";
             return false;
         }
         BOOST_LOG_TRIVIAL(debug) << __func__ << " Committed ledger "
-                                 << std::to_string(ledgerSequence_);
+                                 << std::to_string(ledgerSequence);
+        return true;
+    }
+
+    uint32_t
+    writeWindow() const override
+    {
+        return writeWindow_;
+    }
+
+    bool
+    supportsConcurrentWrites() const override
+    {
+        return true;
+    }
+
+    bool
+    supportsBackfill() const override
+    {
+        return true;
+    }
+
+    void
+    waitForWrites() override
+    {
+        sync();
+    }
+
+    bool
+    doFinishBackfill(uint32_t ledgerSequence) override
+    {
+        sync();
+        if (!range)
+            return false;
+        // moves the end of the range past every backfilled ledger at once
+        CassandraStatement statement{updateLedgerRange_};
+        statement.bindNextInt(ledgerSequence);
+        statement.bindNextBoolean(true);
+        statement.bindNextInt(range->maxSequence);
+        if (!executeSyncUpdate(statement))
+        {
+            BOOST_LOG_TRIVIAL(warning)
+                << __func__ << " Update failed for ledgers "
+                << range->maxSequence + 1 << " - " << ledgerSequence;
+            return false;
+        }
+        BOOST_LOG_TRIVIAL(info) << __func__ << " Committed ledgers "
+                                << range->maxSequence + 1 << " - "
+                                << ledgerSequence;
         return true;
     }
     void
@@ -690,7 +962,7 @@ public:
     }
 
     std::optional<ripple::LedgerInfo>
-    fetchLedgerBySequence(uint32_t sequence) const override
+    doFetchLedgerBySequence(uint32_t sequence) const override
     {
         BOOST_LOG_TRIVIAL(trace) << __func__;
         CassandraStatement statement{selectLedgerBySeq_};
@@ -707,7 +979,7 @@ public:
     }
 
     std::optional<ripple::LedgerInfo>
-    fetchLedgerByHash(ripple::uint256 const& hash) const override
+    doFetchLedgerByHash(ripple::uint256 const& hash) const override
     {
         CassandraStatement statement{selectLedgerByHash_};
 
@@ -760,7 +1032,7 @@ public:
     }
 
     std::optional<TransactionAndMetadata>
-    fetchTransaction(ripple::uint256 const& hash) const override
+    doFetchTransaction(ripple::uint256 const& hash) const override
     {
         BOOST_LOG_TRIVIAL(trace) << __func__;
         CassandraStatement statement{selectTransaction_};
@@ -772,8 +1044,8 @@ public:
             return {};
         }
         return {
-            {result.getBytes(),
-             result.getBytes(),
+            {codec_.decode(BlobTable::transactions, result.getBytes()),
+             codec_.decode(BlobTable::metadata, result.getBytes()),
              result.getUInt32(),
              result.getUInt32()}};
     }
@@ -782,7 +1054,7 @@ public:
         const override;
 
     std::vector<TransactionAndMetadata>
-    fetchTransactions(
+    doFetchTransactions(
         std::vector<ripple::uint256> const& hashes) const override;
 
     std::vector<Blob>
@@ -790,6 +1062,23 @@ public:
         std::vector<ripple::uint256> const& keys,
         uint32_t sequence) const override;
 
+    void
+    doFetchLedgerObjectsAsync(
+        std::vector<ripple::uint256> const& keys,
+        uint32_t sequence,
+        ReadHandler<std::vector<Blob>> handler) const override;
+
+    void
+    fetchLedgerBySequenceAsync(
+        uint32_t sequence,
+        ReadHandler<std::optional<ripple::LedgerInfo>> handler) const override;
+
+    void
+    doFetchTransactionsAsync(
+        std::vector<ripple::uint256> const& hashes,
+        ReadHandler<std::vector<TransactionAndMetadata>> handler)
+        const override;
+
     std::vector<LedgerObject>
     fetchLedgerDiff(uint32_t ledgerSequence) const override;
 
@@ -825,34 +1114,107 @@ public:
 
         syncCv_.wait(lck, [this]() { return finishedAllRequests(); });
     }
+
+    // wait for the writes of ledger seq to finish
+    void
+    syncLedger(uint32_t seq) const
+    {
+        auto& outstanding = ledgerWritesOutstanding_[seq % maxWriteWindow];
+        std::unique_lock<std::mutex> lck(syncMutex_);
+
+        syncCv_.wait(lck, [&outstanding]() { return outstanding == 0; });
+    }
+
+    // ledger that writes issued now belong to
+    uint32_t
+    writingLedger() const
+    {
+        return ledgerSequence_;
+    }
     bool
     doOnlineDelete(uint32_t numLedgersToKeep) const override;
 
+    // Scans ranges of the token ring in parallel, paging through each by
+    // token
+    void
+    scanLedger(
+        uint32_t ledgerSequence,
+        std::function<void(std::vector<LedgerObject>&&)> const& handler,
+        std::uint32_t concurrency) const override;
+
+    boost::json::object
+    stats() const override
+    {
+        if (!writeLimiter_)
+            return {};
+        boost::json::object stats{
+            {"write_limiter", writeLimiter_->report()},
+            {"read_limiter", readLimiter_->report()}};
+        if (rangeDelete_)
+            stats["delete_limiter"] = deleteLimiter_->report();
+        uint64_t bound = 0;
+        uint64_t reused = 0;
+        for (auto const* prepared :
+             {&insertObject_,
+              &insertDiff_,
+              &insertSuccessor_,
+              &insertTransaction_,
+              &insertLedgerTransaction_,
+              &insertAccountTx_})
+        {
+            auto [b, r] = prepared->poolStats();
+            bound += b;
+            reused += r;
+        }
+        stats["write_statements"] =
+            boost::json::object{{"bound", bound}, {"reused", reused}};
+        return stats;
+    }
+
+private:
+    // pass the objects of ledger ledgerSequence whose token is in
+    // [first, last] to handler, a page at a time
+    void
+    scanTokenRange(
+        int64_t first,
+        int64_t last,
+        uint32_t ledgerSequence,
+        std::function<void(std::vector<LedgerObject>&&)> const& handler) const;
+
+    // online delete of the ledgers in [rng.minSequence, minLedger)
+    bool
+    doRangeDelete(LedgerRange const& rng, uint32_t minLedger) const;
+
+    // Execute a delete of online delete, once the window of deleteLimiter_
+    // has room. Failed deletes are retried with backoff
+    void
+    executeAsyncDelete(CassandraStatement statement) const;
+
+    // wait for every delete to finish
+    void
+    syncDeletes() const;
+
+public:
+
     boost::asio::io_context&
     getIOContext() const
     {
         return ioContext_;
     }
 
-    inline void
-    incremementOutstandingRequestCount() const
+    inline ConcurrencyLimiter::clock::time_point
+    incremementOutstandingRequestCount(uint32_t ledger) const
     {
-        {
-            std::unique_lock<std::mutex> lck(throttleMutex_);
-            if (!canAddRequest())
-            {
-                BOOST_LOG_TRIVIAL(trace)
-                    << __func__ << " : "
-                    << "Max outstanding requests reached. "
-                    << "Waiting for other requests to finish";
-                throttleCv_.wait(lck, [this]() { return canAddRequest(); });
-            }
-        }
+        auto start = writeLimiter_->acquire();
         ++numRequestsOutstanding_;
+        ++ledgerWritesOutstanding_[ledger % maxWriteWindow];
+        return start;
     }
 
     inline void
-    decrementOutstandingRequestCount() const
+    decrementOutstandingRequestCount(
+        ConcurrencyLimiter::clock::time_point start,
+        uint32_t ledger) const
     {
         // sanity check
         if (numRequestsOutstanding_ == 0)
@@ -860,27 +1222,18 @@ public:
             assert(false);
             throw std::runtime_error("decrementing num outstanding below 0");
         }
+        writeLimiter_->release(start);
+        size_t ledgerCur = --ledgerWritesOutstanding_[ledger % maxWriteWindow];
         size_t cur = (--numRequestsOutstanding_);
+        if (cur == 0 || ledgerCur == 0)
         {
             // mutex lock required to prevent race condition around spurious
-            // wakeup
-            std::lock_guard lck(throttleMutex_);
-            throttleCv_.notify_one();
-        }
-        if (cur == 0)
-        {
-            // mutex lock required to prevent race condition around spurious
-            // wakeup
+            // wakeup. sync() and syncLedger() may both be waiting
             std::lock_guard lck(syncMutex_);
-            syncCv_.notify_one();
+            syncCv_.notify_all();
         }
     }
 
-    inline bool
-    canAddRequest() const
-    {
-        return numRequestsOutstanding_ < maxRequestsOutstanding;
-    }
     inline bool
     finishedAllRequests() const
     {
@@ -888,9 +1241,18 @@ public:
     }
 
     void
-    finishAsyncWrite() const
+    finishAsyncWrite(
+        ConcurrencyLimiter::clock::time_point start,
+        uint32_t ledger) const
+    {
+        decrementOutstandingRequestCount(start, ledger);
+    }
+
+    // a write failed and is about to be retried
+    void
+    failedAsyncWrite() const
     {
-        decrementOutstandingRequestCount();
+        writeLimiter_->failed();
     }
 
     template <class T, class S>
@@ -908,24 +1270,248 @@ public:
     }
     template <class T, class S>
     void
+    executeAsyncHelper(
+        CassandraBatch const& batch,
+        T callback,
+        S& callbackData) const
+    {
+        CassFuture* fut =
+            cass_session_execute_batch(session_.get(), batch.get());
+
+        cass_future_set_callback(
+            fut, callback, static_cast<void*>(&callbackData));
+        cass_future_free(fut);
+    }
+    // statement is a CassandraStatement or a CassandraBatch
+    template <class Q, class T, class S>
+    void
     executeAsyncWrite(
-        CassandraStatement const& statement,
+        Q const& statement,
         T callback,
         S& callbackData,
         bool isRetry) const
     {
         if (!isRetry)
-            incremementOutstandingRequestCount();
+            callbackData.start =
+                incremementOutstandingRequestCount(callbackData.ledger);
         executeAsyncHelper(statement, callback, callbackData);
     }
-    template <class T, class S>
+    using ReadCallback = std::function<void(CassError, CassandraResult&)>;
+
+    // Execute statement without blocking. callback is called from a driver
+    // thread once the read completes. The result is only valid if the error
+    // is CASS_OK
     void
-    executeAsyncRead(
-        CassandraStatement const& statement,
-        T callback,
-        S& callbackData) const
+    executeAsyncRead(CassandraStatement statement, ReadCallback callback) const
     {
-        executeAsyncHelper(statement, callback, callbackData);
+        struct Read
+        {
+            ConcurrencyLimiter& limiter;
+            ReadCallback callback;
+            ConcurrencyLimiter::clock::time_point start;
+            // the callback runs on a driver thread, outside of any span
+            Trace::Parent parent;
+            Trace::clock::time_point submitted;
+        };
+        auto read = new Read{
+            *readLimiter_, std::move(callback), {}, Trace::current(), {}};
+        if (read->parent)
+            read->submitted = Trace::clock::now();
+        cass_statement_set_is_idempotent(statement.get(), cass_true);
+        readLimiter_->submit([this, read, statement = std::move(statement)]() {
+            read->start = ConcurrencyLimiter::clock::now();
+            CassFuture* fut =
+                cass_session_execute(session_.get(), statement.get());
+            cass_future_set_callback(
+                fut,
+                [](CassFuture* fut, void* data) {
+                    std::unique_ptr<Read> read{static_cast<Read*>(data)};
+                    CassError rc = cass_future_error_code(fut);
+                    read->limiter.release(read->start, isTimeout(rc));
+                    if (read->parent)
+                        Trace::record(
+                            read->parent,
+                            "cassandra.read",
+                            read->submitted,
+                            Trace::clock::now(),
+                            rc == CASS_OK
+                                ? boost::json::object{}
+                                : boost::json::object{
+                                      {"error", cass_error_desc(rc)}});
+                    if (rc != CASS_OK)
+                    {
+                        BOOST_LOG_TRIVIAL(error)
+                            << "Cassandra executeAsyncRead error: "
+                            << cass_error_desc(rc);
+                        CassandraResult empty;
+                        read->callback(rc, empty);
+                        return;
+                    }
+                    CassandraResult result{cass_future_get_result(fut)};
+                    read->callback(rc, result);
+                },
+                static_cast<void*>(read));
+            cass_future_free(fut);
+        });
+    }
+
+    // Execute numReads statements, made by makeStatement(i), without
+    // blocking. onResult(results, i, result) extracts the result of read i
+    // into results, which has numResults elements. handler is called once,
+    // after the last read completes, with every result, or with an error if
+    // any read failed. The callback data of all reads is allocated at once.
+    // If makeStatement throws, it does so before any read is submitted
+    template <class T, class MakeStatement, class OnResult>
+    void
+    executeAsyncReads(
+        size_t numResults,
+        size_t numReads,
+        MakeStatement&& makeStatement,
+        OnResult onResult,
+        ReadHandler<std::vector<T>> handler) const
+    {
+        if (!numReads)
+            return handler({}, std::vector<T>(numResults));
+        struct State;
+        struct Read
+        {
+            State* state;
+            size_t index;
+            ConcurrencyLimiter::clock::time_point start;
+        };
+        struct State
+        {
+            std::vector<T> results;
+            std::vector<Read> reads;
+            std::atomic_size_t numOutstanding;
+            std::atomic_bool errored = false;
+            ConcurrencyLimiter* limiter = nullptr;
+            Trace::Parent parent;
+            Trace::clock::time_point submitted;
+            OnResult onResult;
+            ReadHandler<std::vector<T>> handler;
+            // released by the last read to complete
+            std::shared_ptr<State> self;
+
+            State(OnResult&& onResult, ReadHandler<std::vector<T>>&& handler)
+                : onResult(std::move(onResult)), handler(std::move(handler))
+            {
+            }
+        };
+        CassFutureCallback completeRead = [](CassFuture* fut, void* data) {
+            auto& read = *static_cast<Read*>(data);
+            auto& state = *read.state;
+            CassError rc = cass_future_error_code(fut);
+            state.limiter->release(read.start, isTimeout(rc));
+            if (rc != CASS_OK)
+            {
+                BOOST_LOG_TRIVIAL(error)
+                    << "Cassandra executeAsyncReads error: "
+                    << cass_error_desc(rc);
+                state.errored = true;
+            }
+            else
+            {
+                try
+                {
+                    CassandraResult result{cass_future_get_result(fut)};
+                    state.onResult(state.results, read.index, result);
+                }
+                catch (std::exception const& e)
+                {
+                    BOOST_LOG_TRIVIAL(error)
+                        << "Cassandra executeAsyncReads error: " << e.what();
+                    state.errored = true;
+                }
+            }
+            if (--state.numOutstanding)
+                return;
+            auto self = std::move(state.self);
+            if (state.parent)
+                Trace::record(
+                    state.parent,
+                    "cassandra.reads",
+                    state.submitted,
+                    Trace::clock::now(),
+                    {{"reads", state.reads.size()},
+                     {"errored", state.errored.load()}});
+            if (state.errored)
+                state.handler(boost::asio::error::timed_out, {});
+            else
+                state.handler({}, std::move(state.results));
+        };
+        // once a read is submitted, the handler is only called after the
+        // last one completes
+        std::vector<CassandraStatement> statements;
+        statements.reserve(numReads);
+        for (size_t i = 0; i < numReads; ++i)
+        {
+            statements.push_back(makeStatement(i));
+            cass_statement_set_is_idempotent(
+                statements.back().get(), cass_true);
+        }
+
+        auto state =
+            std::make_shared<State>(std::move(onResult), std::move(handler));
+        state->results.resize(numResults);
+        state->reads.reserve(numReads);
+        for (size_t i = 0; i < numReads; ++i)
+            state->reads.push_back({state.get(), i, {}});
+        state->numOutstanding = numReads;
+        state->limiter = readLimiter_.get();
+        state->parent = Trace::current();
+        if (state->parent)
+            state->submitted = Trace::clock::now();
+        state->self = state;
+
+        for (size_t i = 0; i < numReads; ++i)
+        {
+            auto& read = state->reads[i];
+            readLimiter_->submit([this,
+                                  &read,
+                                  completeRead,
+                                  statement = std::move(statements[i])]() {
+                read.start = ConcurrencyLimiter::clock::now();
+                CassFuture* fut =
+                    cass_session_execute(session_.get(), statement.get());
+                cass_future_set_callback(
+                    fut, completeRead, static_cast<void*>(&read));
+                cass_future_free(fut);
+            });
+        }
+    }
+
+    // Read the rows of keys with select, which is bound to a key and then
+    // sequence, if set. With more than one key, keys are read in groups of
+    // readBatchSize_ with selectBatch, which is bound to a list of keys and
+    // returns the key as its first column. onRow(results[i], result) reads the
+    // remaining columns of the row of keys[i]. Keys without a row are left
+    // default constructed
+    template <class T, class OnRow>
+    void
+    executeKeyedReads(
+        std::vector<ripple::uint256> const& keys,
+        CassandraPreparedStatement const& select,
+        CassandraPreparedStatement const& selectBatch,
+        std::optional<uint32_t> sequence,
+        OnRow onRow,
+        ReadHandler<std::vector<T>> handler) const;
+
+    // Block until the asynchronous read started by initiate completes
+    template <class T, class Initiate>
+    static T
+    waitFor(Initiate&& initiate)
+    {
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        initiate([&promise](boost::system::error_code ec, T result) {
+            if (ec)
+                promise.set_exception(
+                    std::make_exception_ptr(DatabaseTimeout()));
+            else
+                promise.set_value(std::move(result));
+        });
+        return future.get();
     }
     void
     executeSyncWrite(CassandraStatement const& statement) const
@@ -1005,12 +1591,15 @@ public:
     CassandraResult
     executeSyncRead(CassandraStatement const& statement) const
     {
+        Trace::Span span{"cassandra.read"};
         CassFuture* fut;
         CassError rc;
         do
         {
+            auto start = readLimiter_->acquire();
             fut = cass_session_execute(session_.get(), statement.get());
             rc = cass_future_error_code(fut);
+            readLimiter_->release(start, isTimeout(rc));
             if (rc != CASS_OK)
             {
                 std::stringstream ss;
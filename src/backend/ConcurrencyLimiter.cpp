@@ -0,0 +1,176 @@
+#include <backend/ConcurrencyLimiter.h>
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+namespace Backend {
+
+namespace {
+// timeouts within this long of a decrease are part of the same overload
+constexpr auto decreaseInterval = std::chrono::milliseconds(50);
+constexpr double decreaseFactor = 0.75;
+}  // namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(
+    uint32_t initialWindow,
+    uint32_t minWindow,
+    uint32_t maxWindow,
+    boost::asio::io_context* ioContext)
+    : minWindow_(std::max(minWindow, 1u))
+    , maxWindow_(std::max(maxWindow, minWindow_))
+    , window_(std::clamp(initialWindow, minWindow_, maxWindow_))
+    , ioContext_(ioContext)
+{
+    samples_.reserve(maxSamples);
+}
+
+ConcurrencyLimiter::clock::time_point
+ConcurrencyLimiter::acquire()
+{
+    std::unique_lock lck{mtx_};
+    cv_.wait(lck, [this]() { return hasRoom(); });
+    ++inFlight_;
+    return clock::now();
+}
+
+void
+ConcurrencyLimiter::release(clock::time_point start, bool timedOut)
+{
+    auto latency = clock::now() - start;
+    // the window may have grown by more than the request that completed
+    std::vector<std::function<void()>> next;
+    bool room;
+    {
+        std::unique_lock lck{mtx_};
+        assert(inFlight_ > 0);
+        --inFlight_;
+        adjust(latency, timedOut);
+        while (!queue_.empty() && hasRoom())
+        {
+            next.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+            ++inFlight_;
+        }
+        room = hasRoom();
+    }
+    for (auto& f : next)
+    {
+        if (ioContext_)
+            boost::asio::post(*ioContext_, std::move(f));
+        else
+            f();
+    }
+    if (room)
+        cv_.notify_all();
+}
+
+void
+ConcurrencyLimiter::failed()
+{
+    std::unique_lock lck{mtx_};
+    adjust({}, true);
+}
+
+void
+ConcurrencyLimiter::adjust(clock::duration latency, bool timedOut)
+{
+    if (timedOut)
+    {
+        ++timeouts_;
+        auto now = clock::now();
+        if (now - lastDecrease_ >= decreaseInterval)
+        {
+            window_ = std::max<double>(minWindow_, window_ * decreaseFactor);
+            lastDecrease_ = now;
+        }
+        return;
+    }
+
+    ++completed_;
+    auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    if (samples_.size() < maxSamples)
+        samples_.push_back(micros);
+    else
+        samples_[nextSample_] = micros;
+    nextSample_ = (nextSample_ + 1) % maxSamples;
+
+    minLatency_ = std::min(minLatency_, latency);
+    probeMinLatency_ = std::min(probeMinLatency_, latency);
+    if (++probeCount_ == probeSamples)
+    {
+        minLatency_ = probeMinLatency_;
+        probeMinLatency_ = clock::duration::max();
+        probeCount_ = 0;
+    }
+
+    // number of requests queued at the database, as estimated from the
+    // latency this request spent above the unloaded latency
+    double const queued = window_ *
+        (1.0 -
+         static_cast<double>(minLatency_.count()) /
+             std::max<double>(latency.count(), 1));
+    double const step = std::max(1.0, std::log10(window_));
+    // steps are divided by the window, so the window changes by step about
+    // once per window of completed requests
+    if (queued <= 3 * step)
+    {
+        // a window that is mostly unused says nothing about its size
+        if (inFlight_ + 1 >= window_ / 2)
+            window_ += 6 * step / window_;
+    }
+    else if (queued > 6 * step)
+    {
+        window_ -= step / window_;
+    }
+    window_ = std::clamp<double>(window_, minWindow_, maxWindow_);
+}
+
+uint32_t
+ConcurrencyLimiter::window() const
+{
+    std::unique_lock lck{mtx_};
+    return static_cast<uint32_t>(window_);
+}
+
+uint32_t
+ConcurrencyLimiter::inFlight() const
+{
+    std::unique_lock lck{mtx_};
+    return inFlight_;
+}
+
+boost::json::object
+ConcurrencyLimiter::report() const
+{
+    std::vector<uint32_t> samples;
+    boost::json::object report;
+    {
+        std::unique_lock lck{mtx_};
+        samples = samples_;
+        report["window"] = static_cast<uint32_t>(window_);
+        report["in_flight"] = inFlight_;
+        report["queued"] = queue_.size();
+        report["completed"] = completed_;
+        report["timeouts"] = timeouts_;
+        if (minLatency_ != clock::duration::max())
+            report["min_latency_us"] =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    minLatency_)
+                    .count();
+    }
+    if (samples.empty())
+        return report;
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        return samples[std::min(
+            samples.size() - 1,
+            static_cast<size_t>(p * samples.size()))];
+    };
+    report["p50_latency_us"] = percentile(0.50);
+    report["p90_latency_us"] = percentile(0.90);
+    report["p99_latency_us"] = percentile(0.99);
+    return report;
+}
+
+}  // namespace Backend
@@ -0,0 +1,124 @@
+#ifndef CLIO_CONCURRENCYLIMITER_H_INCLUDED
+#define CLIO_CONCURRENCYLIMITER_H_INCLUDED
+
+#include <boost/asio/io_context.hpp>
+#include <boost/json.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+namespace Backend {
+// Limits the number of requests in flight to a database, with a window that
+// adapts to the observed latency, in the manner of TCP Vegas.
+//
+// The lowest recent latency is taken as the latency of an unloaded database.
+// The excess of a request's latency over it estimates how many requests are
+// queued at the database. The window grows while that queue is short, and
+// shrinks when it grows long or requests time out. So the window settles
+// where the database is busy but not saturated, whatever its capacity.
+class ConcurrencyLimiter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    uint32_t const minWindow_;
+    uint32_t const maxWindow_;
+    double window_;
+    uint32_t inFlight_ = 0;
+    // requests given to submit() while the window was full
+    std::deque<std::function<void()>> queue_;
+    // where queued requests are started, if set
+    boost::asio::io_context* ioContext_;
+
+    clock::duration minLatency_ = clock::duration::max();
+    // the minimum is measured again every probeSamples samples, so it
+    // follows the database when it becomes slower
+    clock::duration probeMinLatency_ = clock::duration::max();
+    uint32_t probeCount_ = 0;
+    clock::time_point lastDecrease_;
+
+    uint64_t completed_ = 0;
+    uint64_t timeouts_ = 0;
+    // latest latencies in microseconds, for percentiles
+    std::vector<uint32_t> samples_;
+    size_t nextSample_ = 0;
+
+    static constexpr uint32_t probeSamples = 1000;
+    static constexpr size_t maxSamples = 1024;
+
+    bool
+    hasRoom() const
+    {
+        return inFlight_ < static_cast<uint32_t>(window_);
+    }
+
+    void
+    adjust(clock::duration latency, bool timedOut);
+
+public:
+    // queued requests are posted to ioContext once there is room, if it is
+    // set, rather than started by the thread that calls release(). That is
+    // usually a database driver thread, and a request that completes right
+    // away would otherwise release the next one on the same stack
+    ConcurrencyLimiter(
+        uint32_t initialWindow,
+        uint32_t minWindow,
+        uint32_t maxWindow,
+        boost::asio::io_context* ioContext = nullptr);
+
+    // Block until the window has room for a request. returns the start time
+    // to pass to release()
+    clock::time_point
+    acquire();
+
+    // Call f once the window has room for a request, which is right away if
+    // it has. Otherwise f is queued, and started once a release() frees up
+    // room. f must eventually be followed by a call to release()
+    template <class F>
+    void
+    submit(F&& f)
+    {
+        {
+            std::unique_lock lck{mtx_};
+            if (!hasRoom())
+            {
+                auto shared = std::make_shared<std::decay_t<F>>(
+                    std::forward<F>(f));
+                queue_.push_back([shared]() { (*shared)(); });
+                return;
+            }
+            ++inFlight_;
+        }
+        f();
+    }
+
+    // Record the completion of a request started at start, and adapt the
+    // window. timedOut is set if the request failed or timed out
+    void
+    release(clock::time_point start, bool timedOut = false);
+
+    // Record a failed attempt of a request that is retried, and so is still
+    // in flight. Shrinks the window like a timeout
+    void
+    failed();
+
+    uint32_t
+    window() const;
+
+    uint32_t
+    inFlight() const;
+
+    // window, requests in flight and queued, and latency percentiles
+    boost::json::object
+    report() const;
+};
+
+}  // namespace Backend
+#endif
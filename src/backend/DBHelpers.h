@@ -8,6 +8,9 @@
 #include <boost/container/flat_set.hpp>
 #include <backend/Pg.h>
 #include <backend/Types.h>
+#include <algorithm>
+#include <tuple>
+#include <vector>
 
 /// Struct used to keep track of what to write to transactions and
 /// account_transactions tables in Postgres
@@ -32,6 +35,45 @@ struct AccountTransactionsData
     AccountTransactionsData() = default;
 };
 
+/// Rows of account_transactions of one account in one ledger. These share a
+/// partition in Cassandra
+struct AccountLedgerTransactions
+{
+    ripple::AccountID account;
+    uint32_t ledgerSequence;
+    /// transaction index and hash of each row, in order of transaction index
+    std::vector<std::pair<uint32_t, ripple::uint256>> transactions;
+};
+
+/// Group the rows of data by account and ledger, so that an account affected
+/// by many transactions of a ledger is written once rather than once per
+/// transaction
+inline std::vector<AccountLedgerTransactions>
+groupAccountTransactions(std::vector<AccountTransactionsData> const& data)
+{
+    using Row = std::tuple<ripple::AccountID, uint32_t, uint32_t>;
+    std::vector<std::pair<Row, ripple::uint256 const*>> rows;
+    for (auto const& record : data)
+        for (auto const& account : record.accounts)
+            rows.emplace_back(
+                Row{account, record.ledgerSequence, record.transactionIndex},
+                &record.txHash);
+    std::sort(rows.begin(), rows.end(), [](auto const& a, auto const& b) {
+        return a.first < b.first;
+    });
+
+    std::vector<AccountLedgerTransactions> groups;
+    for (auto const& [row, hash] : rows)
+    {
+        auto const& [account, seq, index] = row;
+        if (groups.empty() || groups.back().account != account ||
+            groups.back().ledgerSequence != seq)
+            groups.push_back({account, seq, {}});
+        groups.back().transactions.emplace_back(index, *hash);
+    }
+    return groups;
+}
+
 template <class T>
 inline bool
 isOffer(T const& object)
@@ -0,0 +1,87 @@
+#include <backend/LedgerHeaderCache.h>
+#include <mutex>
+namespace Backend {
+
+LedgerHeaderCache::Entry const*
+LedgerHeaderCache::find(uint32_t seq) const
+{
+    if (ring_.empty())
+        return nullptr;
+    auto const& entry = ring_[seq % ring_.size()];
+    if (!entry.valid || entry.info.seq != seq)
+        return nullptr;
+    return &entry;
+}
+
+void
+LedgerHeaderCache::put(ripple::LedgerInfo const& info, ripple::Fees const& fees)
+{
+    if (ring_.empty())
+        return;
+    std::unique_lock lck{mtx_};
+    auto& entry = ring_[info.seq % ring_.size()];
+    // a ledger older than the one in its place is not recent anymore
+    if (entry.valid && entry.info.seq > info.seq)
+        return;
+    if (entry.valid)
+        sequences_.erase(entry.info.hash);
+    entry = Entry{info, fees, true};
+    sequences_[info.hash] = info.seq;
+}
+
+std::optional<ripple::LedgerInfo>
+LedgerHeaderCache::get(uint32_t seq) const
+{
+    std::shared_lock lck{mtx_};
+    if (auto entry = find(seq))
+    {
+        ++hits_;
+        return entry->info;
+    }
+    ++misses_;
+    return {};
+}
+
+std::optional<ripple::LedgerInfo>
+LedgerHeaderCache::get(ripple::uint256 const& hash) const
+{
+    std::shared_lock lck{mtx_};
+    if (auto it = sequences_.find(hash); it != sequences_.end())
+    {
+        if (auto entry = find(it->second))
+        {
+            ++hits_;
+            return entry->info;
+        }
+    }
+    ++misses_;
+    return {};
+}
+
+std::optional<ripple::Fees>
+LedgerHeaderCache::fees(uint32_t seq) const
+{
+    std::shared_lock lck{mtx_};
+    if (auto entry = find(seq))
+    {
+        ++hits_;
+        return entry->fees;
+    }
+    ++misses_;
+    return {};
+}
+
+boost::json::object
+LedgerHeaderCache::report() const
+{
+    boost::json::object report;
+    {
+        std::shared_lock lck{mtx_};
+        report["size"] = sequences_.size();
+    }
+    report["hits"] = hits_.load();
+    report["misses"] = misses_.load();
+    return report;
+}
+
+}  // namespace Backend
@@ -0,0 +1,61 @@
+#ifndef CLIO_LEDGERHEADERCACHE_H_INCLUDED
+#define CLIO_LEDGERHEADERCACHE_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <ripple/ledger/ReadView.h>
+#include <boost/json.hpp>
+#include <atomic>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+namespace Backend {
+// Headers and fees of the most recent ledgers, by sequence and by hash.
+//
+// The ETL adds every ledger it publishes, so resolving the ledger of a
+// request for a recent ledger does not read the database. Headers are kept in
+// a ring indexed by sequence, so a ledger replaces the one size ledgers older.
+class LedgerHeaderCache
+{
+    struct Entry
+    {
+        ripple::LedgerInfo info;
+        ripple::Fees fees;
+        bool valid = false;
+    };
+
+    mutable std::shared_mutex mtx_;
+    std::vector<Entry> ring_;
+    std::unordered_map<ripple::uint256, uint32_t, ripple::hardened_hash<>>
+        sequences_;
+    mutable std::atomic_uint64_t hits_ = 0;
+    mutable std::atomic_uint64_t misses_ = 0;
+
+    // the entry of seq, if it holds seq. Requires mtx_
+    Entry const*
+    find(uint32_t seq) const;
+
+public:
+    explicit LedgerHeaderCache(size_t size) : ring_(size)
+    {
+    }
+
+    void
+    put(ripple::LedgerInfo const& info, ripple::Fees const& fees);
+
+    std::optional<ripple::LedgerInfo>
+    get(uint32_t seq) const;
+
+    std::optional<ripple::LedgerInfo>
+    get(ripple::uint256 const& hash) const;
+
+    std::optional<ripple::Fees>
+    fees(uint32_t seq) const;
+
+    boost::json::object
+    report() const;
+};
+
+}  // namespace Backend
+#endif
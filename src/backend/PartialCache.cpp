@@ -0,0 +1,285 @@
+#include <backend/PartialCache.h>
+namespace Backend {
+
+void
+PartialCache::evict(Shard& shard)
+{
+    // every slot is passed at most twice: once to clear it, once to evict it
+    while (true)
+    {
+        if (shard.hand >= shard.slots.size())
+            shard.hand = 0;
+        auto const index = shard.hand++;
+        auto& slot = shard.slots[index];
+        if (!slot.used)
+            continue;
+        if (slot.referenced.exchange(false, std::memory_order_relaxed))
+            continue;
+        shard.bytes -= bytes(slot);
+        shard.index.erase(slot.key);
+        slot.view = {};
+        slot.used = false;
+        shard.freeSlots.push_back(index);
+        ++evictions_;
+        return;
+    }
+}
+
+void
+PartialCache::set(
+    Shard& shard,
+    ripple::uint256 const& key,
+    uint32_t seq,
+    BlobView view,
+    bool insert)
+{
+    if (auto it = shard.index.find(key); it != shard.index.end())
+    {
+        auto& slot = shard.slots[it->second];
+        shard.bytes -= bytes(slot);
+        slot.view = std::move(view);
+        slot.seq = seq;
+        shard.bytes += bytes(slot);
+        return;
+    }
+    if (!insert || view.size + 128 > maxShardBytes_)
+        return;
+    while (shard.bytes + view.size + 128 > maxShardBytes_)
+        evict(shard);
+
+    size_t index;
+    if (shard.freeSlots.size())
+    {
+        index = shard.freeSlots.back();
+        shard.freeSlots.pop_back();
+    }
+    else
+    {
+        index = shard.slots.size();
+        shard.slots.emplace_back();
+    }
+    auto& slot = shard.slots[index];
+    slot.key = key;
+    slot.view = std::move(view);
+    slot.seq = seq;
+    slot.used = true;
+    slot.referenced.store(false, std::memory_order_relaxed);
+    shard.bytes += bytes(slot);
+    shard.index.emplace(key, index);
+}
+
+std::optional<BlobView>
+PartialCache::get(ripple::uint256 const& key, uint32_t seq) const
+{
+    if (!enabled())
+        return {};
+    auto const& shard = this->shard(key);
+    {
+        std::shared_lock lck{shard.mtx};
+        if (seq <= latest_)
+        {
+            if (auto it = shard.index.find(key); it != shard.index.end())
+            {
+                auto const& slot = shard.slots[it->second];
+                if (slot.seq <= seq)
+                {
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                    hits_.fetch_add(1, std::memory_order_relaxed);
+                    return slot.view;
+                }
+            }
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return {};
+}
+
+void
+PartialCache::put(ripple::uint256 const& key, uint32_t seq, BlobView view)
+{
+    if (!enabled())
+        return;
+    auto& shard = this->shard(key);
+    std::unique_lock lck{shard.mtx};
+    // a newer ledger is applied, which may have modified the object
+    if (!accepting(seq))
+        return;
+    set(shard, key, seq, std::move(view), true);
+}
+
+std::optional<ripple::uint256>
+PartialCache::successor(ripple::uint256 const& key, uint32_t seq) const
+{
+    if (!enabled())
+        return {};
+    std::lock_guard lck{rangeMtx_};
+    if (seq == latest_)
+    {
+        auto it = ranges_.upper_bound(key);
+        if (it != ranges_.begin())
+        {
+            --it;
+            auto const& range = it->second;
+            if (key < range.last)
+            {
+                if (auto succ = range.keys.upper_bound(key);
+                    succ != range.keys.end())
+                {
+                    rangeLru_.splice(rangeLru_.begin(), rangeLru_, range.lru);
+                    successorHits_.fetch_add(1, std::memory_order_relaxed);
+                    return *succ;
+                }
+            }
+        }
+    }
+    successorMisses_.fetch_add(1, std::memory_order_relaxed);
+    return {};
+}
+
+void
+PartialCache::eraseRange(std::map<ripple::uint256, Range>::iterator it)
+{
+    rangeBytes_ -= bytes(it->second);
+    rangeLru_.erase(it->second.lru);
+    ranges_.erase(it);
+}
+
+void
+PartialCache::putSuccessors(
+    ripple::uint256 const& first,
+    uint32_t seq,
+    std::vector<ripple::uint256> const& keys)
+{
+    if (!enabled() || keys.empty())
+        return;
+    std::lock_guard lck{rangeMtx_};
+    if (!accepting(seq))
+        return;
+
+    Range range;
+    range.last = keys.back();
+    range.keys.insert(keys.begin(), keys.end());
+    ripple::uint256 begin = first;
+
+    // merge the ranges that overlap or touch this one
+    auto it = ranges_.lower_bound(first);
+    if (it != ranges_.begin() && std::prev(it)->second.last >= first)
+        --it;
+    while (it != ranges_.end() && it->first <= range.last)
+    {
+        begin = std::min(begin, it->first);
+        range.last = std::max(range.last, it->second.last);
+        range.keys.merge(it->second.keys);
+        auto next = std::next(it);
+        eraseRange(it);
+        it = next;
+    }
+
+    if (bytes(range) > maxRangeBytes_)
+        return;
+    rangeBytes_ += bytes(range);
+    rangeLru_.push_front(begin);
+    range.lru = rangeLru_.begin();
+    ranges_.emplace(begin, std::move(range));
+    while (rangeBytes_ > maxRangeBytes_)
+    {
+        ++evictions_;
+        eraseRange(ranges_.find(rangeLru_.back()));
+    }
+}
+
+void
+PartialCache::update(std::vector<LedgerObject> const& objs, uint32_t seq)
+{
+    if (!enabled() || seq <= latest_)
+        return;
+    applying_ = seq;
+    bool const skipped = latest_ != 0 && seq != latest_ + 1;
+    for (auto& shard : shards_)
+    {
+        std::unique_lock lck{shard.mtx};
+        if (skipped)
+        {
+            shard.slots.clear();
+            shard.freeSlots.clear();
+            shard.index.clear();
+            shard.hand = 0;
+            shard.bytes = 0;
+        }
+    }
+    if (!skipped)
+    {
+        for (auto const& obj : objs)
+        {
+            auto& shard = this->shard(obj.key);
+            std::unique_lock lck{shard.mtx};
+            set(shard,
+                obj.key,
+                seq,
+                obj.blob.empty() ? BlobView{} : BlobView{Blob{obj.blob}},
+                false);
+        }
+    }
+
+    std::lock_guard lck{rangeMtx_};
+    if (skipped)
+    {
+        ranges_.clear();
+        rangeLru_.clear();
+        rangeBytes_ = 0;
+    }
+    for (auto const& obj : objs)
+    {
+        auto it = ranges_.lower_bound(obj.key);
+        if (it == ranges_.begin())
+            continue;
+        --it;
+        auto& range = it->second;
+        if (obj.key > range.last)
+            continue;
+        rangeBytes_ -= bytes(range);
+        if (obj.blob.empty())
+            range.keys.erase(obj.key);
+        else
+            range.keys.insert(obj.key);
+        rangeBytes_ += bytes(range);
+    }
+    // published under the lock, so that successors are never read at the
+    // previous ledger from ranges already at this one
+    latest_ = seq;
+}
+
+boost::json::object
+PartialCache::report() const
+{
+    size_t objects = 0;
+    size_t bytes = 0;
+    for (auto const& shard : shards_)
+    {
+        std::shared_lock lck{shard.mtx};
+        objects += shard.index.size();
+        bytes += shard.bytes;
+    }
+    boost::json::object report;
+    report["objects"] = objects;
+    report["object_bytes"] = bytes;
+    {
+        std::lock_guard lck{rangeMtx_};
+        size_t keys = 0;
+        for (auto const& [first, range] : ranges_)
+            keys += range.keys.size();
+        report["ranges"] = ranges_.size();
+        report["range_keys"] = keys;
+        report["range_bytes"] = rangeBytes_;
+    }
+    report["max_bytes"] = maxShardBytes_ * numShards + maxRangeBytes_;
+    report["latest_sequence"] = latest_.load();
+    report["hits"] = hits_.load();
+    report["misses"] = misses_.load();
+    report["successor_hits"] = successorHits_.load();
+    report["successor_misses"] = successorMisses_.load();
+    report["evictions"] = evictions_.load();
+    return report;
+}
+
+}  // namespace Backend
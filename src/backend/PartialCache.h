@@ -0,0 +1,188 @@
+#ifndef CLIO_PARTIALCACHE_H_INCLUDED
+#define CLIO_PARTIALCACHE_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <boost/json.hpp>
+#include <backend/Types.h>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+namespace Backend {
+// Bounded cache of ledger state, for read-only nodes that cannot hold the
+// whole state in SimpleCache, but whose requests keep reading the same
+// accounts and books.
+//
+// Objects are added as they are read from the database at the most recent
+// ledger, and evicted by CLOCK once the memory budget is spent. Ranges of
+// keys are added as successors are read from the database: a range holds
+// every key following its first one, up to its last one, so successors
+// within it are answered without the database. Ranges are evicted least
+// recently used first, as a whole, once they exceed their share of the
+// budget.
+//
+// Every ledger the ETL publishes updates the cached objects it modified and
+// the ranges its created or deleted objects fall into, so everything in the
+// cache stays current. Only reads of the most recent ledger are answered,
+// and objects from the ledger they were read at on.
+class PartialCache
+{
+    struct Slot
+    {
+        ripple::uint256 key;
+        // empty if the object does not exist
+        BlobView view;
+        // the object is this version from this ledger through the most
+        // recent one
+        uint32_t seq = 0;
+        bool used = false;
+        // set by reads, cleared as the clock hand passes
+        mutable std::atomic_bool referenced = false;
+    };
+
+    struct Shard
+    {
+        mutable std::shared_mutex mtx;
+        std::deque<Slot> slots;
+        std::vector<size_t> freeSlots;
+        std::unordered_map<ripple::uint256, size_t, ripple::hardened_hash<>>
+            index;
+        size_t hand = 0;
+        size_t bytes = 0;
+    };
+
+    struct Range
+    {
+        // the keys after the first key of the range, through last
+        ripple::uint256 last;
+        std::set<ripple::uint256> keys;
+        std::list<ripple::uint256>::iterator lru;
+    };
+
+    static constexpr size_t numShards = 16;
+    // share of the budget held by ranges
+    static constexpr size_t rangeShare = 4;
+
+    std::array<Shard, numShards> shards_;
+    size_t const maxShardBytes_;
+
+    mutable std::mutex rangeMtx_;
+    // by first key
+    std::map<ripple::uint256, Range> ranges_;
+    // first keys, most recently used first
+    mutable std::list<ripple::uint256> rangeLru_;
+    size_t rangeBytes_ = 0;
+    size_t const maxRangeBytes_;
+
+    // the ledger being applied, and the most recent ledger applied. objects
+    // and ranges are only added while they are the same
+    std::atomic_uint32_t applying_ = 0;
+    std::atomic_uint32_t latest_ = 0;
+
+    mutable std::atomic_uint64_t hits_ = 0;
+    mutable std::atomic_uint64_t misses_ = 0;
+    mutable std::atomic_uint64_t successorHits_ = 0;
+    mutable std::atomic_uint64_t successorMisses_ = 0;
+    std::atomic_uint64_t evictions_ = 0;
+
+    Shard&
+    shard(ripple::uint256 const& key)
+    {
+        return shards_[*key.data() % numShards];
+    }
+
+    Shard const&
+    shard(ripple::uint256 const& key) const
+    {
+        return shards_[*key.data() % numShards];
+    }
+
+    static size_t
+    bytes(Slot const& slot)
+    {
+        return slot.view.size + 128;
+    }
+
+    static size_t
+    bytes(Range const& range)
+    {
+        return 64 * range.keys.size() + 128;
+    }
+
+    // Requires the lock of shard
+    void
+    set(Shard& shard,
+        ripple::uint256 const& key,
+        uint32_t seq,
+        BlobView view,
+        bool insert);
+
+    // Requires the lock of shard
+    void
+    evict(Shard& shard);
+
+    // Requires rangeMtx_
+    void
+    eraseRange(std::map<ripple::uint256, Range>::iterator it);
+
+    bool
+    accepting(uint32_t seq) const
+    {
+        return seq == latest_ && seq == applying_;
+    }
+
+public:
+    // maxBytes is the memory budget. 0 disables the cache
+    explicit PartialCache(size_t maxBytes)
+        : maxShardBytes_((maxBytes - maxBytes / rangeShare) / numShards)
+        , maxRangeBytes_(maxBytes / rangeShare)
+    {
+    }
+
+    bool
+    enabled() const
+    {
+        return maxRangeBytes_ != 0;
+    }
+
+    // The object key at ledger seq. An empty view if it does not exist,
+    // empty optional on a miss
+    std::optional<BlobView>
+    get(ripple::uint256 const& key, uint32_t seq) const;
+
+    // Add key, read from the database at ledger seq. view is empty if the
+    // object does not exist
+    void
+    put(ripple::uint256 const& key, uint32_t seq, BlobView view);
+
+    // the key following key at ledger seq, if it is in a range
+    std::optional<ripple::uint256>
+    successor(ripple::uint256 const& key, uint32_t seq) const;
+
+    // Add the range read from the database at ledger seq: keys are the
+    // successor of first, its successor, and so on
+    void
+    putSuccessors(
+        ripple::uint256 const& first,
+        uint32_t seq,
+        std::vector<ripple::uint256> const& keys);
+
+    // Apply the objects ledger seq created, modified and deleted (empty
+    // blobs). Everything is dropped if a ledger was skipped
+    void
+    update(std::vector<LedgerObject> const& objs, uint32_t seq);
+
+    boost::json::object
+    report() const;
+};
+
+}  // namespace Backend
+#endif
@@ -5,6 +5,7 @@
 #else
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #endif
@@ -16,6 +17,7 @@
 #include <array>
 #include <backend/Pg.h>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
@@ -70,6 +72,7 @@ Pg::connect()
             return;
         /* Try resetting connection. */
         PQreset(conn_.get());
+        copyTable_.clear();
     }
     else  // Make new connection.
     {
@@ -98,16 +101,16 @@ Pg::connect()
 PgResult
 Pg::query(char const* command, std::size_t nParams, char const* const* values)
 {
+    // A COPY in progress ends at the next command.
+    if (!copyTable_.empty())
+        endCopy();
     // The result object must be freed using the libpq API PQclear() call.
     pg_result_type ret{nullptr, [](PGresult* result) { PQclear(result); }};
     // Connect then submit query.
     while (true)
     {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (stop_)
-                return PgResult();
-        }
+        if (stop_)
+            return PgResult();
         try
         {
             connect();
@@ -218,6 +221,104 @@ Pg::query(pg_params const& dbParams)
             : nullptr);
 }
 
+std::vector<PgResult>
+Pg::pipeline(std::vector<pg_params> const& batch)
+{
+    std::vector<PgResult> results;
+    results.reserve(batch.size());
+#ifdef LIBPQ_HAS_PIPELINING
+    // https://www.postgresql.org/docs/14/libpq-pipeline-mode.html
+    // The connection is blocking, so the client and server could both block
+    // writing, waiting for the other to read. Syncing every few queries
+    // keeps what either side has to buffer small.
+    constexpr std::size_t maxPipelined = 128;
+    if (!copyTable_.empty())
+        endCopy();
+    std::size_t next = 0;
+    while (next < batch.size())
+    {
+        if (stop_)
+            break;
+        try
+        {
+            connect();
+        }
+        catch (std::exception const& e)
+        {
+            // query() reconnects, and retries until successful
+            BOOST_LOG_TRIVIAL(error)
+                << __func__ << " database error: " << e.what();
+            results.push_back(query(batch[next++]));
+            continue;
+        }
+        if (PQenterPipelineMode(conn_.get()) != 1)
+        {
+            results.push_back(query(batch[next++]));
+            continue;
+        }
+        auto end = std::min(batch.size(), next + maxPipelined);
+        std::size_t numSent = 0;
+        for (auto i = next; i < end; ++i)
+        {
+            auto const values = formatParams(batch[i]);
+            if (!PQsendQueryParams(
+                    conn_.get(),
+                    batch[i].first,
+                    values.size(),
+                    nullptr,
+                    values.data(),
+                    nullptr,
+                    nullptr,
+                    0))
+                break;
+            ++numSent;
+        }
+        PQpipelineSync(conn_.get());
+        for (std::size_t i = 0; i < numSent; ++i)
+        {
+            pg_result_type ret{
+                nullptr, [](PGresult* result) { PQclear(result); }};
+            ret.reset(PQgetResult(conn_.get()));
+            // each query ends with a null result
+            while (auto* result = PQgetResult(conn_.get()))
+                PQclear(result);
+            switch (PQresultStatus(ret.get()))
+            {
+                case PGRES_TUPLES_OK:
+                case PGRES_COMMAND_OK:
+                    results.emplace_back(std::move(ret));
+                    break;
+                default:
+                    // queries after a failed query are aborted
+                    results.emplace_back(ret.get(), conn_.get());
+            }
+        }
+        // consume the result of the sync
+        while (auto* result = PQgetResult(conn_.get()))
+        {
+            bool const synced =
+                PQresultStatus(result) == PGRES_PIPELINE_SYNC;
+            PQclear(result);
+            if (synced)
+                break;
+        }
+        if (PQexitPipelineMode(conn_.get()) != 1)
+            disconnect();
+        // a query that could not be sent is executed without the pipeline,
+        // which retries it until successful
+        bool const sentAll = next + numSent == end;
+        next += numSent;
+        if (!sentAll)
+            results.push_back(query(batch[next++]));
+    }
+    results.resize(batch.size());
+#else
+    for (auto const& dbParams : batch)
+        results.push_back(query(dbParams));
+#endif
+    return results;
+}
+
 void
 Pg::bulkInsert(char const* table, std::string const& records)
 {
@@ -275,11 +376,93 @@ Pg::bulkInsert(char const* table, std::string const& records)
     }
 }
 
+void
+Pg::copy(PgCopyBuffer& buffer)
+{
+    // https://www.postgresql.org/docs/12/sql-copy.html#id-1.9.3.55.9.4
+    assert(conn_.get());
+    auto putCopyData = [this, &buffer](char const* data, std::size_t size) {
+        if (PQputCopyData(conn_.get(), data, size) == -1)
+        {
+            std::stringstream ss;
+            ss << "copy to " << buffer.table()
+               << ". PQputCopyData error: " << PQerrorMessage(conn_.get());
+            disconnect();
+            BOOST_LOG_TRIVIAL(error) << __func__ << " " << ss.str();
+            throw std::runtime_error(ss.str());
+        }
+    };
+    if (copyTable_ != buffer.table())
+    {
+        auto copyCmd = boost::format(R"(COPY %s FROM stdin (FORMAT binary))");
+        auto formattedCmd = boost::str(copyCmd % buffer.table());
+        BOOST_LOG_TRIVIAL(debug) << __func__ << " " << formattedCmd;
+        // ends the COPY into any other table
+        auto res = query(formattedCmd.c_str());
+        if (!res || res.status() != PGRES_COPY_IN)
+        {
+            std::stringstream ss;
+            ss << "copy to " << buffer.table()
+               << ". Postgres insert error: " << res.msg();
+            if (res)
+                ss << ". Query status not PGRES_COPY_IN: " << res.status();
+            BOOST_LOG_TRIVIAL(error) << __func__ << " " << ss.str();
+            throw std::runtime_error(ss.str());
+        }
+        copyTable_ = buffer.table();
+        putCopyData(PgCopyBuffer::header, sizeof(PgCopyBuffer::header));
+    }
+    putCopyData(buffer.data().data(), buffer.size());
+    buffer.clear();
+}
+
+void
+Pg::endCopy()
+{
+    if (copyTable_.empty())
+        return;
+    std::string table;
+    std::swap(table, copyTable_);
+    auto const* trailer = PgCopyBuffer::trailer;
+    if (PQputCopyData(conn_.get(), trailer, sizeof(PgCopyBuffer::trailer)) ==
+            -1 ||
+        PQputCopyEnd(conn_.get(), nullptr) == -1)
+    {
+        std::stringstream ss;
+        ss << "copy to " << table
+           << ". PQputCopyEnd error: " << PQerrorMessage(conn_.get());
+        disconnect();
+        BOOST_LOG_TRIVIAL(error) << __func__ << " " << ss.str();
+        throw std::runtime_error(ss.str());
+    }
+
+    // The result object must be freed using the libpq API PQclear() call.
+    pg_result_type copyEndResult{
+        nullptr, [](PGresult* result) { PQclear(result); }};
+    copyEndResult.reset(PQgetResult(conn_.get()));
+    ExecStatusType status = PQresultStatus(copyEndResult.get());
+    if (status != PGRES_COMMAND_OK)
+    {
+        std::stringstream ss;
+        ss << "copy to " << table
+           << ". PQputCopyEnd status not PGRES_COMMAND_OK: " << status
+           << " message = " << PQerrorMessage(conn_.get());
+        disconnect();
+        BOOST_LOG_TRIVIAL(error) << __func__ << " " << ss.str();
+        throw std::runtime_error(ss.str());
+    }
+    // consume the null result that ends the command
+    while (auto* result = PQgetResult(conn_.get()))
+        PQclear(result);
+}
+
 bool
 Pg::clear()
 {
     if (!conn_)
         return false;
+    // a COPY in progress is ended below, by PQputCopyEnd
+    copyTable_.clear();
 
     // The result object must be freed using the libpq API PQclear() call.
     pg_result_type res{nullptr, [](PGresult* result) { PQclear(result); }};
@@ -482,6 +665,11 @@ PgPool::PgPool(boost::json::object const& config)
     if (config.contains("timeout"))
         config_.timeout =
             std::chrono::seconds(config.at("timeout").as_uint64());
+
+    numShared_ = std::min(config_.max_connections, maxShared);
+    shared_ = std::make_unique<Slot[]>(numShared_);
+    for (std::size_t i = 0; i < numShared_; ++i)
+        shared_[i] = nullptr;
 }
 
 void
@@ -504,36 +692,178 @@ PgPool::setup()
         }
         BOOST_LOG_TRIVIAL(debug) << ss.str();
     }
+
+    sweeper_ = std::thread{[this]() {
+        // sweep a few times per timeout, so connections are destroyed soon
+        // after timing out
+        auto interval = config_.timeout == std::chrono::seconds(0)
+            ? std::chrono::seconds(60)
+            : std::max(config_.timeout / 4, std::chrono::seconds(1));
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto stopped = [this]() { return stop_.load(); };
+        while (!cond_.wait_for(lock, interval, stopped))
+        {
+            lock.unlock();
+            idleSweeper();
+            lock.lock();
+        }
+    }};
 }
 
 void
 PgPool::onStop()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    stop_ = true;
-    cond_.notify_all();
-    idle_.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        cond_.notify_all();
+    }
+    if (sweeper_.joinable())
+        sweeper_.join();
+    auto drain = [this](Slot& slot) {
+        if (std::unique_ptr<Pg> pg{slot.exchange(nullptr)})
+            --connections_;
+    };
+    for (auto& local : local_)
+    {
+        for (auto& slot : local.slots)
+            drain(slot);
+    }
+    for (std::size_t i = 0; i < numShared_; ++i)
+        drain(shared_[i]);
+    numSharedIdle_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(listenerMutex_);
+        listener_.reset();
+    }
     BOOST_LOG_TRIVIAL(info) << "stopped";
 }
 
-void
-PgPool::idleSweeper()
+namespace {
+// threads that use connections with the same index share their slots
+std::size_t
+threadIndex()
+{
+    static std::atomic_size_t next{0};
+    thread_local std::size_t const index = next++;
+    return index;
+}
+}  // namespace
+
+std::unique_ptr<Pg>
+PgPool::takeIdle(bool anyThread)
 {
-    std::size_t before, after;
+    auto const own = threadIndex() % numLocal;
+    for (auto& slot : local_[own].slots)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        before = idle_.size();
-        if (config_.timeout != std::chrono::seconds(0))
+        if (Pg* pg = slot.exchange(nullptr))
+            return std::unique_ptr<Pg>{pg};
+    }
+    if (numSharedIdle_ != 0)
+    {
+        // start where other threads are unlikely to, so they don't all
+        // contend for the first slots
+        auto start = threadIndex() * 7;
+        for (std::size_t i = 0; i < numShared_; ++i)
         {
-            auto const found =
-                idle_.upper_bound(clock_type::now() - config_.timeout);
-            for (auto it = idle_.begin(); it != found;)
+            if (Pg* pg = shared_[(start + i) % numShared_].exchange(nullptr))
             {
-                it = idle_.erase(it);
-                --connections_;
+                --numSharedIdle_;
+                return std::unique_ptr<Pg>{pg};
             }
         }
-        after = idle_.size();
+    }
+    if (!anyThread)
+        return {};
+    for (std::size_t i = 1; i < numLocal; ++i)
+    {
+        for (auto& slot : local_[(own + i) % numLocal].slots)
+        {
+            if (Pg* pg = slot.exchange(nullptr))
+                return std::unique_ptr<Pg>{pg};
+        }
+    }
+    return {};
+}
+
+bool
+PgPool::putIdle(Pg* pg)
+{
+    // while checkouts wait, connections go to the shared slots, which
+    // waiters scan before the slots of other threads
+    if (!waiting_)
+    {
+        for (auto& slot : local_[threadIndex() % numLocal].slots)
+        {
+            Pg* empty = nullptr;
+            if (slot.compare_exchange_strong(empty, pg))
+                return true;
+        }
+    }
+    // counted before it is published, so that a takeIdle that takes it
+    // never decrements the count below zero
+    ++numSharedIdle_;
+    auto start = threadIndex() * 7;
+    for (std::size_t i = 0; i < numShared_; ++i)
+    {
+        Pg* empty = nullptr;
+        if (shared_[(start + i) % numShared_].compare_exchange_strong(
+                empty, pg))
+            return true;
+    }
+    --numSharedIdle_;
+    for (auto& slot : local_[threadIndex() % numLocal].slots)
+    {
+        Pg* empty = nullptr;
+        if (slot.compare_exchange_strong(empty, pg))
+            return true;
+    }
+    return false;
+}
+
+void
+PgPool::idleSweeper()
+{
+    auto const now = clock_type::now();
+    std::size_t before = 0, after = 0, destroyed = 0;
+    // returns whether the connection in slot was destroyed
+    auto sweep = [&](Slot& slot) {
+        Pg* pg = slot.exchange(nullptr);
+        if (!pg)
+            return false;
+        ++before;
+        bool const timedOut = config_.timeout != std::chrono::seconds(0) &&
+            now - pg->idleSince_ > config_.timeout;
+        bool const bad =
+            pg->conn_ && PQstatus(pg->conn_.get()) != CONNECTION_OK;
+        // the slot may have been filled by a checkin in the meantime
+        Pg* empty = nullptr;
+        if (!timedOut && !bad && slot.compare_exchange_strong(empty, pg))
+        {
+            ++after;
+            return false;
+        }
+        delete pg;
+        --connections_;
+        ++destroyed;
+        return true;
+    };
+    for (auto& local : local_)
+    {
+        for (auto& slot : local.slots)
+            sweep(slot);
+    }
+    for (std::size_t i = 0; i < numShared_; ++i)
+    {
+        if (sweep(shared_[i]))
+            --numSharedIdle_;
+    }
+    // checkouts waiting at max_connections can open connections in place of
+    // those destroyed
+    if (destroyed)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all();
     }
 
     BOOST_LOG_TRIVIAL(info)
@@ -545,35 +875,55 @@ PgPool::idleSweeper()
 std::unique_ptr<Pg>
 PgPool::checkout()
 {
-    std::unique_ptr<Pg> ret;
-    std::unique_lock<std::mutex> lock(mutex_);
-    do
-    {
-        if (stop_)
-            return {};
-
-        // If there is a connection in the pool, return the most recent.
-        if (idle_.size())
-        {
-            auto entry = idle_.rbegin();
-            ret = std::move(entry->second);
-            idle_.erase(std::next(entry).base());
-        }
-        // Otherwise, return a new connection unless over threshold.
-        else if (connections_ < config_.max_connections)
-        {
-            ++connections_;
-            ret = std::make_unique<Pg>(config_, stop_, mutex_);
-        }
-        // Otherwise, wait until a connection becomes available or we stop.
-        else
+    if (stop_)
+        return {};
+    ++checkouts_;
+    if (auto pg = takeIdle())
+        return pg;
+
+    // Otherwise, return a new connection unless over threshold.
+    auto newConnection = [this]() -> std::unique_ptr<Pg> {
+        auto n = connections_.load();
+        while (n < config_.max_connections)
         {
-            BOOST_LOG_TRIVIAL(error) << "No database connections available.";
-            cond_.wait(lock);
+            if (connections_.compare_exchange_weak(n, n + 1))
+                return std::make_unique<Pg>(config_, stop_);
         }
-    } while (!ret && !stop_);
-    lock.unlock();
+        return {};
+    };
+    if (auto pg = newConnection())
+        return pg;
 
+    // Otherwise, wait until a connection becomes available or we stop.
+    BOOST_LOG_TRIVIAL(error) << "No database connections available.";
+    auto const start = clock_type::now();
+    std::unique_ptr<Pg> ret;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++waiting_;
+        // checkin() notifies waiters after making its connection idle, so
+        // a connection checked in after this check wakes the wait below
+        cond_.wait(lock, [this, &ret, &newConnection]() {
+            if (stop_)
+                return true;
+            // a connection checked in before this waiter was counted may
+            // sit in the slots of the thread that checked it in
+            ret = takeIdle(true);
+            if (!ret)
+                ret = newConnection();
+            return ret != nullptr;
+        });
+        --waiting_;
+    }
+    auto const waited = std::chrono::duration_cast<std::chrono::microseconds>(
+                            clock_type::now() - start)
+                            .count();
+    ++waits_;
+    waitMicros_ += waited;
+    auto max = maxWaitMicros_.load();
+    while (static_cast<std::uint64_t>(waited) > max &&
+           !maxWaitMicros_.compare_exchange_weak(max, waited))
+        ;
     return ret;
 }
 
@@ -582,19 +932,43 @@ PgPool::checkin(std::unique_ptr<Pg>& pg)
 {
     if (pg)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         if (!stop_ && pg->clear())
         {
-            idle_.emplace(clock_type::now(), std::move(pg));
+            pg->idleSince_ = clock_type::now();
+            if (putIdle(pg.get()))
+                pg.release();
         }
-        else
+        if (pg)
         {
             --connections_;
             pg.reset();
         }
     }
 
-    cond_.notify_all();
+    if (waiting_)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+}
+
+boost::json::object
+PgPool::stats() const
+{
+    std::size_t idle = numSharedIdle_;
+    for (auto const& local : local_)
+    {
+        for (auto const& slot : local.slots)
+            idle += slot.load() != nullptr;
+    }
+    boost::json::object stats;
+    stats["connections"] = connections_.load();
+    stats["idle"] = idle;
+    stats["checkouts"] = checkouts_.load();
+    stats["waits"] = waits_.load();
+    stats["wait_us"] = waitMicros_.load();
+    stats["max_wait_us"] = maxWaitMicros_.load();
+    return stats;
 }
 
 //-----------------------------------------------------------------------------
@@ -1517,3 +1891,54 @@ getLedger(
 
     return info;
 }
+
+std::optional<std::string>
+PgPool::waitForNotification(
+    std::string const& channel,
+    std::chrono::milliseconds timeout)
+{
+    auto const deadline = clock_type::now() + timeout;
+    std::lock_guard<std::mutex> lock(listenerMutex_);
+    try
+    {
+        if (!listener_ || PQstatus(listener_->conn_.get()) != CONNECTION_OK)
+        {
+            listener_ = std::make_unique<Pg>(config_, stop_);
+            auto res = listener_->query(("LISTEN " + channel).c_str());
+            if (!res || res.status() != PGRES_COMMAND_OK)
+                throw std::runtime_error("LISTEN failed: " + res.msg());
+            return {};
+        }
+
+        PGconn* conn = listener_->conn_.get();
+        std::optional<std::string> payload;
+        while (!stop_)
+        {
+            if (!PQconsumeInput(conn))
+                throw std::runtime_error(PQerrorMessage(conn));
+            while (PGnotify* notify = PQnotifies(conn))
+            {
+                payload = notify->extra;
+                PQfreemem(notify);
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - clock_type::now());
+            if (payload || left.count() <= 0)
+                return payload;
+
+            pollfd fd{PQsocket(conn), POLLIN, 0};
+            if (::poll(&fd, 1, left.count()) < 0 && errno != EINTR)
+                throw std::runtime_error(std::strerror(errno));
+        }
+        return {};
+    }
+    catch (std::exception const& e)
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " : listening on " << channel
+            << " failed: " << e.what();
+        listener_.reset();
+    }
+    std::this_thread::sleep_until(deadline);
+    return {};
+}
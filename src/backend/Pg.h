@@ -8,6 +8,7 @@
 #include <boost/json.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/log/trivial.hpp>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -18,6 +19,7 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -248,6 +250,99 @@ public:
     }
 };
 
+//-----------------------------------------------------------------------------
+
+/** Records for a binary COPY into one table.
+ *
+ * Fields are appended in the order of the columns of the table, in the
+ * binary format of the type of the column. Only bigint and bytea columns
+ * are supported. Clearing the buffer keeps its capacity, so a buffer that is
+ * flushed whenever it fills is allocated once and reused.
+ */
+class PgCopyBuffer
+{
+    char const* table_;
+    std::string data_;
+
+    template <class T>
+    void
+    put(T value)
+    {
+        // network byte order
+        char bytes[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); ++i)
+            bytes[i] = static_cast<char>(value >> (8 * (sizeof(T) - 1 - i)));
+        data_.append(bytes, sizeof(T));
+    }
+
+public:
+    /** Signature, flags and header extension length of the binary format. */
+    static constexpr char header[] = {
+        'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0',
+        0,   0,   0,   0,   0,   0,   0,    0};
+    /** Marks the end of the records. */
+    static constexpr char trailer[] = {'\377', '\377'};
+
+    explicit PgCopyBuffer(char const* table) : table_(table)
+    {
+    }
+
+    char const*
+    table() const
+    {
+        return table_;
+    }
+
+    std::string const&
+    data() const
+    {
+        return data_;
+    }
+
+    std::size_t
+    size() const
+    {
+        return data_.size();
+    }
+
+    void
+    clear()
+    {
+        data_.clear();
+    }
+
+    /** Start a record with numFields fields. */
+    PgCopyBuffer&
+    row(std::int16_t numFields)
+    {
+        put(static_cast<std::uint16_t>(numFields));
+        return *this;
+    }
+
+    PgCopyBuffer&
+    bigint(std::int64_t value)
+    {
+        put(static_cast<std::uint32_t>(sizeof(value)));
+        put(static_cast<std::uint64_t>(value));
+        return *this;
+    }
+
+    PgCopyBuffer&
+    bytea(void const* data, std::size_t size)
+    {
+        put(static_cast<std::uint32_t>(size));
+        data_.append(static_cast<char const*>(data), size);
+        return *this;
+    }
+
+    template <class T>
+    PgCopyBuffer&
+    bytea(T const& bytes)
+    {
+        return bytea(bytes.data(), bytes.size());
+    }
+};
+
 /* Class that contains and operates upon a postgres connection. */
 class Pg
 {
@@ -255,8 +350,11 @@ class Pg
     friend class PgQuery;
 
     PgConfig const& config_;
-    bool& stop_;
-    std::mutex& mutex_;
+    std::atomic_bool const& stop_;
+    // table of the COPY in progress on the connection. Empty if none
+    std::string copyTable_;
+    // when the connection was last checked in to the pool
+    std::chrono::steady_clock::time_point idleSince_;
 
     // The connection object must be freed using the libpq API PQfinish() call.
     pg_connection_type conn_{nullptr, [](PGconn* conn) { PQfinish(conn); }};
@@ -287,6 +385,7 @@ class Pg
     disconnect()
     {
         conn_.reset();
+        copyTable_.clear();
     }
 
     /** Execute postgres query.
@@ -323,6 +422,20 @@ class Pg
     PgResult
     query(pg_params const& dbParams);
 
+    /** Execute a batch of postgres queries with parameters, pipelined.
+     *
+     * Queries are sent without waiting for the results of earlier ones, so
+     * the batch takes about one round trip rather than one per query. Each
+     * query is executed in its own implicit transaction. Without pipeline
+     * support in libpq (before version 14), the queries are executed one
+     * after another.
+     *
+     * @param batch Database commands with parameters.
+     * @return Result of each query, in order, including errors.
+     */
+    std::vector<PgResult>
+    pipeline(std::vector<pg_params> const& batch);
+
     /** Insert multiple records into a table using Postgres' bulk COPY.
      *
      * Throws upon error.
@@ -333,16 +446,33 @@ class Pg
     void
     bulkInsert(char const* table, std::string const& records);
 
+    /** Stream records into a table using a binary COPY.
+     *
+     * Starts a COPY into the table of buffer, first ending any COPY into
+     * another table. The COPY stays open for the next records of the same
+     * table, until endCopy() is called or another query is executed.
+     * Throws upon error.
+     *
+     * @param buffer Records to send. Cleared once sent.
+     */
+    void
+    copy(PgCopyBuffer& buffer);
+
+    /** End the COPY in progress, if any.
+     *
+     * Throws upon error.
+     */
+    void
+    endCopy();
+
 public:
     /** Constructor for Pg class.
      *
      * @param config Config parameters.
-     * @param j Logger object.
      * @param stop Reference to connection pool's stop flag.
-     * @param mutex Reference to connection pool's mutex.
      */
-    Pg(PgConfig const& config, bool& stop, std::mutex& mutex)
-        : config_(config), stop_(stop), mutex_(mutex)
+    Pg(PgConfig const& config, std::atomic_bool const& stop)
+        : config_(config), stop_(stop)
     {
     }
 };
@@ -353,11 +483,14 @@ public:
  *
  * Allow re-use of postgres connections. Postgres connections are created
  * as needed until configurable limit is reached. After use, each connection
- * is placed in a container ordered by time of use. Each request for
- * a connection grabs the most recently used connection from the container.
- * If none are available, a new connection is used (up to configured limit).
- * Idle connections are destroyed periodically after configurable
- * timeout duration.
+ * is kept for the next checkout by the same thread, in a few slots per
+ * thread, or else in slots shared by all threads. Checking connections out
+ * and in only exchanges pointers in those slots, so it takes no lock. Only
+ * a checkout that finds no connection while at the limit waits on a
+ * condition variable.
+ *
+ * A sweeper thread destroys connections that have been idle for
+ * longer than the configured timeout, or whose connection went bad.
  *
  * This should be stored as a shared pointer so PgQuery objects can safely
  * outlive it.
@@ -368,21 +501,64 @@ class PgPool
 
     using clock_type = std::chrono::steady_clock;
 
+    // idle connections. nullptr if empty
+    using Slot = std::atomic<Pg*>;
+
+    // slots of the threads with the same index modulo numLocal
+    struct alignas(64) LocalSlots
+    {
+        std::array<Slot, 2> slots{};
+    };
+
+    static constexpr std::size_t numLocal = 64;
+    static constexpr std::size_t maxShared = 1024;
+
     PgConfig config_;
     std::mutex mutex_;
     std::condition_variable cond_;
-    std::size_t connections_{};
-    bool stop_{false};
+    std::atomic_size_t connections_{0};
+    std::atomic_bool stop_{false};
+
+    std::array<LocalSlots, numLocal> local_;
+    std::unique_ptr<Slot[]> shared_;
+    std::size_t numShared_ = 0;
+    // number of non-empty shared slots, so checkouts skip a scan of the
+    // shared slots when there are none
+    std::atomic_size_t numSharedIdle_{0};
+    // checkouts waiting for a connection to be checked in
+    std::atomic_size_t waiting_{0};
 
-    /** Idle database connections ordered by timestamp to allow timing out. */
-    std::multimap<std::chrono::time_point<clock_type>, std::unique_ptr<Pg>>
-        idle_;
+    std::atomic_uint64_t checkouts_{0};
+    std::atomic_uint64_t waits_{0};
+    std::atomic_uint64_t waitMicros_{0};
+    std::atomic_uint64_t maxWaitMicros_{0};
+
+    std::thread sweeper_;
+
+    // connection kept open to receive notifications, apart from the pool
+    std::mutex listenerMutex_;
+    std::unique_ptr<Pg> listener_;
+
+    /** Take an idle connection, preferring those of the calling thread.
+     *
+     * @param anyThread also take connections from the slots of other
+     *        threads, rather than only the shared ones.
+     */
+    std::unique_ptr<Pg>
+    takeIdle(bool anyThread = false);
+
+    /** Make an idle connection available to checkout().
+     *
+     * @return false if every slot is full.
+     */
+    bool
+    putIdle(Pg* pg);
 
     /** Get a postgres connection object.
      *
-     * Return the most recent idle connection in the pool, if available.
-     * Otherwise, return a new connection unless we're at the threshold.
-     * If so, then wait until a connection becomes available.
+     * Return an idle connection, preferably one last used by this thread, if
+     * available. Otherwise, return a new connection unless we're at the
+     * threshold. If so, then wait until a connection becomes available.
      *
      * @return Postgres object.
      */
@@ -403,8 +579,6 @@ public:
     /** Connection pool constructor.
      *
      * @param pgConfig Postgres config.
-     * @param j Logger object.
-     * @param parent Stoppable parent.
      */
     PgPool(boost::json::object const& config);
 
@@ -413,7 +587,7 @@ public:
         onStop();
     }
 
-    /** Initiate idle connection timer.
+    /** Start the sweeper of idle connections.
      *
      * The PgPool object needs to be fully constructed to support asynchronous
      * operations.
@@ -428,6 +602,30 @@ public:
     /** Disconnect idle postgres connections. */
     void
     idleSweeper();
+
+    /** Connections, checkouts, and the time checkouts waited for a
+     * connection.
+     */
+    boost::json::object
+    stats() const;
+
+    /** Wait for a notification on a channel, sent with NOTIFY.
+     *
+     * Listens on a dedicated connection, which is opened by the first call
+     * and kept open, so that notifications sent between calls are queued
+     * for the next call. A call that opens the connection returns right
+     * away, since notifications sent before it were missed. If the
+     * connection fails, waits for the whole timeout, so that callers can
+     * keep polling at the same rate.
+     *
+     * @param channel Name of the channel. Must be the same for every call.
+     * @param timeout Longest time to wait.
+     * @return Payload of the most recent notification received, if any.
+     */
+    std::optional<std::string>
+    waitForNotification(
+        std::string const& channel,
+        std::chrono::milliseconds timeout);
 };
 
 //-----------------------------------------------------------------------------
@@ -485,6 +683,19 @@ public:
         return operator()(pg_params{command, {}});
     }
 
+    /** Execute a batch of postgres queries with parameters, pipelined.
+     *
+     * @param batch Database commands with parameters.
+     * @return Result of each query, in order, including errors.
+     */
+    std::vector<PgResult>
+    pipeline(std::vector<pg_params> const& batch)
+    {
+        if (!pg_)  // It means we're stopping. Return empty results.
+            return std::vector<PgResult>(batch.size());
+        return pg_->pipeline(batch);
+    }
+
     /** Insert multiple records into a table using Postgres' bulk COPY.
      *
      * Throws upon error.
@@ -497,6 +708,28 @@ public:
     {
         pg_->bulkInsert(table, records);
     }
+
+    /** Stream records into a table using a binary COPY.
+     *
+     * Throws upon error.
+     *
+     * @param buffer Records to send. Cleared once sent.
+     */
+    void
+    copy(PgCopyBuffer& buffer)
+    {
+        pg_->copy(buffer);
+    }
+
+    /** End the COPY in progress, if any.
+     *
+     * Throws upon error.
+     */
+    void
+    endCopy()
+    {
+        pg_->endCopy();
+    }
 };
 
 //-----------------------------------------------------------------------------
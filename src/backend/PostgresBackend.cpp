@@ -4,17 +4,32 @@
 #include <thread>
 namespace Backend {
 
+namespace {
+// channel the sequence of every committed ledger is sent to
+constexpr char const* commitChannel = "clio_ledger_committed";
+}  // namespace
+
 PostgresBackend::PostgresBackend(boost::json::object const& config)
     : BackendInterface(config)
     , pgPool_(make_PgPool(config))
     , writeConnection_(pgPool_)
 {
-    if (config.contains("write_interval"))
+    if (config.contains("copy_flush_size"))
     {
-        writeInterval_ = config.at("write_interval").as_int64();
+        copyFlushSize_ = config.at("copy_flush_size").as_int64();
     }
 }
 void
+PostgresBackend::flushIfFull(PgCopyBuffer& buffer) const
+{
+    if (buffer.size() < copyFlushSize_)
+        return;
+    BOOST_LOG_TRIVIAL(trace)
+        << __func__ << " Flushing " << buffer.table()
+        << ". size = " << buffer.size();
+    writeConnection_.copy(buffer);
+}
+void
 PostgresBackend::writeLedger(
     ripple::LedgerInfo const& ledgerInfo,
     std::string&& ledgerHeader)
@@ -43,17 +58,16 @@ PostgresBackend::writeAccountTransactions(
 {
     if (abortWrite_)
         return;
-    PgQuery pg(pgPool_);
     for (auto const& record : data)
     {
         for (auto const& a : record.accounts)
         {
-            std::string acct = ripple::strHex(a);
-            accountTxBuffer_ << "\\\\x" << acct << '\t'
-                             << std::to_string(record.ledgerSequence) << '\t'
-                             << std::to_string(record.transactionIndex) << '\t'
-                             << "\\\\x" << ripple::strHex(record.txHash)
-                             << '\n';
+            accountTxBuffer_.row(4)
+                .bytea(a)
+                .bigint(record.ledgerSequence)
+                .bigint(record.transactionIndex)
+                .bytea(record.txHash);
+            flushIfFull(accountTxBuffer_);
         }
     }
 }
@@ -65,21 +79,10 @@ PostgresBackend::doWriteLedgerObject(
 {
     if (abortWrite_)
         return;
-    objectsBuffer_ << "\\\\x" << ripple::strHex(key) << '\t'
-                   << std::to_string(seq) << '\t' << "\\\\x"
-                   << ripple::strHex(blob) << '\n';
+    codec_.encode(BlobTable::objects, blob);
+    objectsBuffer_.row(3).bytea(key).bigint(seq).bytea(blob);
     numRowsInObjectsBuffer_++;
-    // If the buffer gets too large, the insert fails. Not sure why. So we
-    // insert after 1 million records
-    if (numRowsInObjectsBuffer_ % writeInterval_ == 0)
-    {
-        BOOST_LOG_TRIVIAL(info)
-            << __func__ << " Flushing large buffer. num objects = "
-            << numRowsInObjectsBuffer_;
-        writeConnection_.bulkInsert("objects", objectsBuffer_.str());
-        BOOST_LOG_TRIVIAL(info) << __func__ << " Flushed large buffer";
-        objectsBuffer_.str("");
-    }
+    flushIfFull(objectsBuffer_);
 }
 
 void
@@ -88,27 +91,19 @@ PostgresBackend::writeSuccessor(
     uint32_t seq,
     std::string&& successor)
 {
+    if (abortWrite_)
+        return;
     if (range)
     {
         if (successors_.count(key) > 0)
             return;
         successors_.insert(key);
     }
-    successorBuffer_ << "\\\\x" << ripple::strHex(key) << '\t'
-                     << std::to_string(seq) << '\t' << "\\\\x"
-                     << ripple::strHex(successor) << '\n';
+    successorBuffer_.row(3).bytea(key).bigint(seq).bytea(successor);
     BOOST_LOG_TRIVIAL(trace)
         << __func__ << ripple::strHex(key) << " - " << std::to_string(seq);
     numRowsInSuccessorBuffer_++;
-    if (numRowsInSuccessorBuffer_ % writeInterval_ == 0)
-    {
-        BOOST_LOG_TRIVIAL(info)
-            << __func__ << " Flushing large buffer. num successors = "
-            << numRowsInSuccessorBuffer_;
-        writeConnection_.bulkInsert("successor", successorBuffer_.str());
-        BOOST_LOG_TRIVIAL(info) << __func__ << " Flushed large buffer";
-        successorBuffer_.str("");
-    }
+    flushIfFull(successorBuffer_);
 }
 
 void
@@ -121,10 +116,15 @@ PostgresBackend::writeTransaction(
 {
     if (abortWrite_)
         return;
-    transactionsBuffer_ << "\\\\x" << ripple::strHex(hash) << '\t'
-                        << std::to_string(seq) << '\t' << std::to_string(date)
-                        << '\t' << "\\\\x" << ripple::strHex(transaction)
-                        << '\t' << "\\\\x" << ripple::strHex(metadata) << '\n';
+    codec_.encode(BlobTable::transactions, transaction);
+    codec_.encode(BlobTable::metadata, metadata);
+    transactionsBuffer_.row(5)
+        .bytea(hash)
+        .bigint(seq)
+        .bigint(date)
+        .bytea(transaction)
+        .bytea(metadata);
+    flushIfFull(transactionsBuffer_);
 }
 
 uint32_t
@@ -214,7 +214,7 @@ PostgresBackend::fetchLatestLedgerSequence() const
 }
 
 std::optional<ripple::LedgerInfo>
-PostgresBackend::fetchLedgerBySequence(uint32_t sequence) const
+PostgresBackend::doFetchLedgerBySequence(uint32_t sequence) const
 {
     PgQuery pgQuery(pgPool_);
     pgQuery("SET statement_timeout TO 10000");
@@ -228,7 +228,7 @@ PostgresBackend::fetchLedgerBySequence(uint32_t sequence) const
 }
 
 std::optional<ripple::LedgerInfo>
-PostgresBackend::fetchLedgerByHash(ripple::uint256 const& hash) const
+PostgresBackend::doFetchLedgerByHash(ripple::uint256 const& hash) const
 {
     PgQuery pgQuery(pgPool_);
     pgQuery("SET statement_timeout TO 10000");
@@ -241,6 +241,33 @@ PostgresBackend::fetchLedgerByHash(ripple::uint256 const& hash) const
     return {};
 }
 
+void
+PostgresBackend::waitForCommit(
+    uint32_t ledgerSequence,
+    std::chrono::milliseconds timeout) const
+{
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0)
+            return;
+        auto payload = pgPool_->waitForNotification(commitChannel, left);
+        if (!payload)
+            return;
+        try
+        {
+            if (std::stoul(*payload) >= ledgerSequence)
+                return;
+        }
+        catch (std::exception const&)
+        {
+            return;
+        }
+    }
+}
+
 std::optional<LedgerRange>
 PostgresBackend::hardFetchLedgerRange() const
 {
@@ -291,7 +318,7 @@ PostgresBackend::doFetchLedgerObject(
     auto res = pgQuery(sql.str().data());
     if (checkResult(res, 1))
     {
-        auto blob = res.asUnHexedBlob(0, 0);
+        auto blob = codec_.decode(BlobTable::objects, res.asUnHexedBlob(0, 0));
         if (blob.size())
             return blob;
     }
@@ -301,7 +328,7 @@ PostgresBackend::doFetchLedgerObject(
 
 // returns a transaction, metadata pair
 std::optional<TransactionAndMetadata>
-PostgresBackend::fetchTransaction(ripple::uint256 const& hash) const
+PostgresBackend::doFetchTransaction(ripple::uint256 const& hash) const
 {
     PgQuery pgQuery(pgPool_);
     pgQuery("SET statement_timeout TO 10000");
@@ -313,8 +340,8 @@ PostgresBackend::fetchTransaction(ripple::uint256 const& hash) const
     if (checkResult(res, 4))
     {
         return {
-            {res.asUnHexedBlob(0, 0),
-             res.asUnHexedBlob(0, 1),
+            {codec_.decode(BlobTable::transactions, res.asUnHexedBlob(0, 0)),
+             codec_.decode(BlobTable::metadata, res.asUnHexedBlob(0, 1)),
              res.asBigInt(0, 2),
              res.asBigInt(0, 3)}};
     }
@@ -337,8 +364,9 @@ PostgresBackend::fetchAllTransactionsInLedger(uint32_t ledgerSequence) const
         for (size_t i = 0; i < numRows; ++i)
         {
             txns.push_back(
-                {res.asUnHexedBlob(i, 0),
-                 res.asUnHexedBlob(i, 1),
+                {codec_.decode(
+                     BlobTable::transactions, res.asUnHexedBlob(i, 0)),
+                 codec_.decode(BlobTable::metadata, res.asUnHexedBlob(i, 1)),
                  res.asBigInt(i, 2),
                  res.asBigInt(i, 3)});
         }
@@ -391,91 +419,74 @@ PostgresBackend::doFetchSuccessorKey(
     return {};
 }
 
-std::vector<TransactionAndMetadata>
-PostgresBackend::fetchTransactions(
-    std::vector<ripple::uint256> const& hashes) const
+std::vector<ripple::uint256>
+PostgresBackend::doFetchSuccessorKeys(
+    ripple::uint256 key,
+    uint32_t ledgerSequence,
+    std::uint32_t count) const
 {
-    std::vector<TransactionAndMetadata> results;
-    constexpr bool doAsync = true;
-    if (doAsync)
+    if (!count)
+        return {};
+    // follow the successor chain server side, so the whole chain costs one
+    // round trip
+    auto const seq = std::to_string(ledgerSequence);
+    auto const last = "\'\\x" + ripple::strHex(lastKey) + "\'";
+    PgQuery pgQuery(pgPool_);
+    pgQuery("SET statement_timeout TO 10000");
+    std::stringstream sql;
+    sql << "WITH RECURSIVE chain(key, depth) AS ("
+        << "SELECT (SELECT next FROM successor WHERE key = "
+        << "\'\\x" << ripple::strHex(key) << "\'"
+        << " AND ledger_seq <= " << seq
+        << " ORDER BY ledger_seq DESC LIMIT 1), 1"
+        << " UNION ALL SELECT (SELECT next FROM successor s"
+        << " WHERE s.key = chain.key AND s.ledger_seq <= " << seq
+        << " ORDER BY s.ledger_seq DESC LIMIT 1), chain.depth + 1"
+        << " FROM chain WHERE chain.depth < " << std::to_string(count)
+        << " AND chain.key IS NOT NULL AND chain.key != " << last << ")"
+        << " SELECT key FROM chain WHERE key IS NOT NULL AND key != " << last
+        << " ORDER BY depth";
+    auto res = pgQuery(sql.str().data());
+    std::vector<ripple::uint256> keys;
+    if (size_t numRows = checkResult(res, 1))
     {
-        auto start = std::chrono::system_clock::now();
-        auto end = std::chrono::system_clock::now();
-        auto duration = ((end - start).count()) / 1000000000.0;
-        results.resize(hashes.size());
-        std::condition_variable cv;
-        std::mutex mtx;
-        std::atomic_uint numRemaining = hashes.size();
-        for (size_t i = 0; i < hashes.size(); ++i)
-        {
-            auto const& hash = hashes[i];
-            boost::asio::post(
-                pool_, [this, &hash, &results, &numRemaining, &cv, &mtx, i]() {
-                    BOOST_LOG_TRIVIAL(debug)
-                        << __func__ << " getting txn = " << i;
-                    PgQuery pgQuery(pgPool_);
-                    std::stringstream sql;
-                    sql << "SELECT transaction,metadata,ledger_seq,date FROM "
-                           "transactions "
-                           "WHERE HASH = \'\\x"
-                        << ripple::strHex(hash) << "\'";
-
-                    auto res = pgQuery(sql.str().data());
-                    if (size_t numRows = checkResult(res, 4))
-                    {
-                        results[i] = {
-                            res.asUnHexedBlob(0, 0),
-                            res.asUnHexedBlob(0, 1),
-                            res.asBigInt(0, 2),
-                            res.asBigInt(0, 3)};
-                    }
-                    if (--numRemaining == 0)
-                    {
-                        std::unique_lock lck(mtx);
-                        cv.notify_one();
-                    }
-                });
-        }
-        std::unique_lock lck(mtx);
-        cv.wait(lck, [&numRemaining]() { return numRemaining == 0; });
-        auto end2 = std::chrono::system_clock::now();
-        duration = ((end2 - end).count()) / 1000000000.0;
-        BOOST_LOG_TRIVIAL(info)
-            << __func__ << " fetched " << std::to_string(hashes.size())
-            << " transactions with threadpool. took "
-            << std::to_string(duration);
+        for (size_t i = 0; i < numRows; ++i)
+            keys.push_back(res.asUInt256(i, 0));
     }
-    else
+    return keys;
+}
+
+std::vector<TransactionAndMetadata>
+PostgresBackend::doFetchTransactions(
+    std::vector<ripple::uint256> const& hashes) const
+{
+    PgQuery pgQuery(pgPool_);
+    pgQuery("SET statement_timeout TO 10000");
+    std::vector<pg_params> batch;
+    batch.reserve(hashes.size());
+    for (auto const& hash : hashes)
+        batch.push_back(
+            {"SELECT transaction,metadata,ledger_seq,date FROM transactions "
+             "WHERE hash = $1",
+             {"\\x" + ripple::strHex(hash)}});
+    auto start = std::chrono::system_clock::now();
+    auto res = pgQuery.pipeline(batch);
+    auto end = std::chrono::system_clock::now();
+    auto duration = ((end - start).count()) / 1000000000.0;
+    BOOST_LOG_TRIVIAL(debug)
+        << __func__ << " fetched " << std::to_string(hashes.size())
+        << " transactions with pipeline. took " << std::to_string(duration);
+    std::vector<TransactionAndMetadata> results(hashes.size());
+    for (size_t i = 0; i < res.size(); ++i)
     {
-        PgQuery pgQuery(pgPool_);
-        pgQuery("SET statement_timeout TO 10000");
-        std::stringstream sql;
-        for (size_t i = 0; i < hashes.size(); ++i)
-        {
-            auto const& hash = hashes[i];
-            sql << "SELECT transaction,metadata,ledger_seq,date FROM "
-                   "transactions "
-                   "WHERE HASH = \'\\x"
-                << ripple::strHex(hash) << "\'";
-            if (i + 1 < hashes.size())
-                sql << " UNION ALL ";
-        }
-        auto start = std::chrono::system_clock::now();
-        auto res = pgQuery(sql.str().data());
-        auto end = std::chrono::system_clock::now();
-        auto duration = ((end - start).count()) / 1000000000.0;
-        BOOST_LOG_TRIVIAL(info)
-            << __func__ << " fetched " << std::to_string(hashes.size())
-            << " transactions with union all. took "
-            << std::to_string(duration);
-        if (size_t numRows = checkResult(res, 3))
+        if (size_t numRows = checkResult(res[i], 4))
         {
-            for (size_t i = 0; i < numRows; ++i)
-                results.push_back(
-                    {res.asUnHexedBlob(i, 0),
-                     res.asUnHexedBlob(i, 1),
-                     res.asBigInt(i, 2),
-                     res.asBigInt(i, 3)});
+            results[i] = {
+                codec_.decode(
+                    BlobTable::transactions, res[i].asUnHexedBlob(0, 0)),
+                codec_.decode(BlobTable::metadata, res[i].asUnHexedBlob(0, 1)),
+                res[i].asBigInt(0, 2),
+                res[i].asBigInt(0, 3)};
         }
     }
     return results;
@@ -488,46 +499,28 @@ PostgresBackend::doFetchLedgerObjects(
 {
     PgQuery pgQuery(pgPool_);
     pgQuery("SET statement_timeout TO 10000");
-    std::vector<Blob> results;
-    results.resize(keys.size());
-    std::condition_variable cv;
-    std::mutex mtx;
-    std::atomic_uint numRemaining = keys.size();
+    std::vector<pg_params> batch;
+    batch.reserve(keys.size());
+    auto const seq = std::to_string(sequence);
+    for (auto const& key : keys)
+        batch.push_back(
+            {"SELECT object FROM objects WHERE key = $1 AND ledger_seq <= $2 "
+             "ORDER BY ledger_seq DESC LIMIT 1",
+             {"\\x" + ripple::strHex(key), seq}});
     auto start = std::chrono::system_clock::now();
-    for (size_t i = 0; i < keys.size(); ++i)
-    {
-        auto const& key = keys[i];
-        boost::asio::post(
-            pool_,
-            [this, &key, &results, &numRemaining, &cv, &mtx, i, sequence]() {
-                PgQuery pgQuery(pgPool_);
-                std::stringstream sql;
-                sql << "SELECT object FROM "
-                       "objects "
-                       "WHERE key = \'\\x"
-                    << ripple::strHex(key) << "\'"
-                    << " AND ledger_seq <= " << std::to_string(sequence)
-                    << " ORDER BY ledger_seq DESC LIMIT 1";
-
-                auto res = pgQuery(sql.str().data());
-                if (size_t numRows = checkResult(res, 1))
-                {
-                    results[i] = res.asUnHexedBlob();
-                }
-                if (--numRemaining == 0)
-                {
-                    std::unique_lock lck(mtx);
-                    cv.notify_one();
-                }
-            });
-    }
-    std::unique_lock lck(mtx);
-    cv.wait(lck, [&numRemaining]() { return numRemaining == 0; });
+    auto res = pgQuery.pipeline(batch);
     auto end = std::chrono::system_clock::now();
     auto duration = ((end - start).count()) / 1000000000.0;
-    BOOST_LOG_TRIVIAL(info)
+    BOOST_LOG_TRIVIAL(debug)
         << __func__ << " fetched " << std::to_string(keys.size())
-        << " objects with threadpool. took " << std::to_string(duration);
+        << " objects with pipeline. took " << std::to_string(duration);
+    std::vector<Blob> results(keys.size());
+    for (size_t i = 0; i < res.size(); ++i)
+    {
+        if (size_t numRows = checkResult(res[i], 1))
+            results[i] =
+                codec_.decode(BlobTable::objects, res[i].asUnHexedBlob());
+    }
     return results;
 }
 std::vector<LedgerObject>
@@ -545,15 +538,17 @@ PostgresBackend::fetchLedgerDiff(uint32_t ledgerSequence) const
         std::vector<LedgerObject> objects;
         for (size_t i = 0; i < numRows; ++i)
         {
-            objects.push_back({res.asUInt256(i, 0), res.asUnHexedBlob(i, 1)});
+            objects.push_back(
+                {res.asUInt256(i, 0),
+                 codec_.decode(BlobTable::objects, res.asUnHexedBlob(i, 1))});
         }
         return objects;
     }
     return {};
 }
 
-AccountTransactions
-PostgresBackend::fetchAccountTransactions(
+AccountTransactionHashes
+PostgresBackend::fetchAccountTransactionHashes(
     ripple::AccountID const& account,
     std::uint32_t limit,
     bool forward,
@@ -618,13 +613,13 @@ PostgresBackend::fetchAccountTransactions(
         if (responseObj.contains("cursor"))
         {
             return {
-                fetchTransactions(hashes),
+                hashes,
                 {{responseObj.at("cursor").at("ledger_sequence").as_int64(),
                   responseObj.at("cursor")
                       .at("transaction_index")
                       .as_int64()}}};
         }
-        return {fetchTransactions(hashes), {}};
+        return {hashes, {}};
     }
     return {{}, {}};
 }  // namespace Backend
@@ -657,23 +652,24 @@ PostgresBackend::startWrites()
 }
 
 bool
-PostgresBackend::doFinishWrites()
+PostgresBackend::doFinishWrites(uint32_t ledgerSequence)
 {
     if (!abortWrite_)
     {
-        std::string txStr = transactionsBuffer_.str();
-        writeConnection_.bulkInsert("transactions", txStr);
-        writeConnection_.bulkInsert(
-            "account_transactions", accountTxBuffer_.str());
-        std::string objectsStr = objectsBuffer_.str();
-        if (objectsStr.size())
-            writeConnection_.bulkInsert("objects", objectsStr);
+        // the rest of the records. Full buffers were streamed already
+        for (auto* buffer :
+             {&transactionsBuffer_,
+              &accountTxBuffer_,
+              &objectsBuffer_,
+              &successorBuffer_})
+        {
+            if (buffer->size())
+                writeConnection_.copy(*buffer);
+        }
+        writeConnection_.endCopy();
         BOOST_LOG_TRIVIAL(debug)
-            << __func__ << " objects size = " << objectsStr.size()
-            << " txns size = " << txStr.size();
-        std::string successorStr = successorBuffer_.str();
-        if (successorStr.size())
-            writeConnection_.bulkInsert("successor", successorStr);
+            << __func__ << " objects = " << numRowsInObjectsBuffer_
+            << " successors = " << numRowsInSuccessorBuffer_;
         successors_.clear();
         if (!range)
         {
@@ -682,9 +678,15 @@ PostgresBackend::doFinishWrites()
                 << "CREATE INDEX diff ON objects USING hash(ledger_seq) "
                    "WHERE NOT "
                    "ledger_seq = "
-                << std::to_string(inProcessLedger);
+                << std::to_string(ledgerSequence);
             writeConnection_(indexCreate.str().data());
         }
+        // delivered to readers when the transaction commits, and only if it
+        // does
+        std::stringstream notify;
+        notify << "NOTIFY " << commitChannel << ", '" << ledgerSequence
+               << "'";
+        writeConnection_(notify.str().data());
     }
     auto res = writeConnection_("COMMIT");
     if (!res || res.status() != PGRES_COMMAND_OK)
@@ -693,15 +695,12 @@ PostgresBackend::doFinishWrites()
         msg << "Postgres error committing transaction: " << res.msg();
         throw std::runtime_error(msg.str());
     }
-    transactionsBuffer_.str("");
     transactionsBuffer_.clear();
-    objectsBuffer_.str("");
     objectsBuffer_.clear();
-    successorBuffer_.str("");
     successorBuffer_.clear();
-    accountTxBuffer_.str("");
     accountTxBuffer_.clear();
     numRowsInObjectsBuffer_ = 0;
+    numRowsInSuccessorBuffer_ = 0;
     return !abortWrite_;
 }
 
@@ -733,15 +732,12 @@ PostgresBackend::doOnlineDelete(uint32_t numLedgersToKeep) const
                 continue;
             }
             BOOST_LOG_TRIVIAL(debug) << __func__ << " fetched a page";
-            std::stringstream objectsBuffer;
-
+            PgCopyBuffer objectsBuffer{"objects"};
             for (auto& obj : objects)
-            {
-                objectsBuffer << "\\\\x" << ripple::strHex(obj.key) << '\t'
-                              << std::to_string(minLedger) << '\t' << "\\\\x"
-                              << ripple::strHex(obj.blob) << '\n';
-            }
-            pgQuery.bulkInsert("objects", objectsBuffer.str());
+                objectsBuffer.row(3).bytea(obj.key).bigint(minLedger).bytea(
+                    obj.blob);
+            pgQuery.copy(objectsBuffer);
+            pgQuery.endCopy();
             cursor = curCursor;
             if (!cursor)
                 break;
@@ -8,19 +8,24 @@ class PostgresBackend : public BackendInterface
 {
 private:
     mutable size_t numRowsInObjectsBuffer_ = 0;
-    mutable std::stringstream objectsBuffer_;
+    mutable PgCopyBuffer objectsBuffer_{"objects"};
     mutable size_t numRowsInSuccessorBuffer_ = 0;
-    mutable std::stringstream successorBuffer_;
-    mutable std::stringstream transactionsBuffer_;
-    mutable std::stringstream accountTxBuffer_;
+    mutable PgCopyBuffer successorBuffer_{"successor"};
+    mutable PgCopyBuffer transactionsBuffer_{"transactions"};
+    mutable PgCopyBuffer accountTxBuffer_{"account_transactions"};
     std::shared_ptr<PgPool> pgPool_;
     mutable PgQuery writeConnection_;
     mutable bool abortWrite_ = false;
-    mutable boost::asio::thread_pool pool_{16};
-    uint32_t writeInterval_ = 1000000;
+    // buffers are streamed to the database whenever they hold this many
+    // bytes, so a ledger is never held in memory whole
+    size_t copyFlushSize_ = 1 << 20;
     uint32_t inProcessLedger = 0;
     std::unordered_set<std::string> successors_;
 
+    // stream buffer to the database if it is full
+    void
+    flushIfFull(PgCopyBuffer& buffer) const;
+
 public:
     PostgresBackend(boost::json::object const& config);
 
@@ -28,10 +33,10 @@ public:
     fetchLatestLedgerSequence() const override;
 
     std::optional<ripple::LedgerInfo>
-    fetchLedgerBySequence(uint32_t sequence) const override;
+    doFetchLedgerBySequence(uint32_t sequence) const override;
 
     std::optional<ripple::LedgerInfo>
-    fetchLedgerByHash(ripple::uint256 const& hash) const override;
+    doFetchLedgerByHash(ripple::uint256 const& hash) const override;
 
     std::optional<Blob>
     doFetchLedgerObject(ripple::uint256 const& key, uint32_t sequence)
@@ -39,7 +44,7 @@ public:
 
     // returns a transaction, metadata pair
     std::optional<TransactionAndMetadata>
-    fetchTransaction(ripple::uint256 const& hash) const override;
+    doFetchTransaction(ripple::uint256 const& hash) const override;
 
     std::vector<TransactionAndMetadata>
     fetchAllTransactionsInLedger(uint32_t ledgerSequence) const override;
@@ -53,12 +58,23 @@ public:
     std::optional<LedgerRange>
     hardFetchLedgerRange() const override;
 
+    // Listens for the notification the writer sends with every commit
+    void
+    waitForCommit(uint32_t ledgerSequence, std::chrono::milliseconds timeout)
+        const override;
+
     std::optional<ripple::uint256>
     doFetchSuccessorKey(ripple::uint256 key, uint32_t ledgerSequence)
         const override;
 
+    std::vector<ripple::uint256>
+    doFetchSuccessorKeys(
+        ripple::uint256 key,
+        uint32_t ledgerSequence,
+        std::uint32_t count) const override;
+
     std::vector<TransactionAndMetadata>
-    fetchTransactions(
+    doFetchTransactions(
         std::vector<ripple::uint256> const& hashes) const override;
 
     std::vector<Blob>
@@ -66,8 +82,8 @@ public:
         std::vector<ripple::uint256> const& keys,
         uint32_t sequence) const override;
 
-    AccountTransactions
-    fetchAccountTransactions(
+    AccountTransactionHashes
+    fetchAccountTransactionHashes(
         ripple::AccountID const& account,
         std::uint32_t limit,
         bool forward,
@@ -108,10 +124,16 @@ public:
     startWrites() override;
 
     bool
-    doFinishWrites() override;
+    doFinishWrites(uint32_t ledgerSequence) override;
 
     bool
     doOnlineDelete(uint32_t numLedgersToKeep) const override;
+
+    boost::json::object
+    stats() const override
+    {
+        return {{"pg_pool", pgPool_->stats()}};
+    }
 };
 }  // namespace Backend
 #endif
@@ -1,36 +1,388 @@
+#include <boost/log/trivial.hpp>
+#include <backend/CacheSnapshot.h>
 #include <backend/SimpleCache.h>
+#include <algorithm>
+#include <cassert>
+#include <iterator>
 namespace Backend {
 
+namespace {
+template <class Vector>
+auto
+lowerBound(Vector& entries, ripple::uint256 const& key)
+{
+    return std::lower_bound(
+        entries.begin(), entries.end(), key, [](auto const& e, auto const& k) {
+            return e.first < k;
+        });
+}
+template <class Vector>
+auto
+upperBound(Vector& entries, ripple::uint256 const& key)
+{
+    return std::upper_bound(
+        entries.begin(), entries.end(), key, [](auto const& k, auto const& e) {
+            return k < e.first;
+        });
+}
+
+}  // namespace
+
+SimpleCache::CacheEntry const*
+SimpleCache::Shard::find(ripple::uint256 const& key) const
+{
+    if (auto d = delta_.find(key); d != delta_.end())
+        return d->second ? &*d->second : nullptr;
+    auto b = lowerBound(base_, key);
+    if (b == base_.end() || b->first != key)
+        return nullptr;
+    return &b->second;
+}
+
+SimpleCache::OldVersion const*
+SimpleCache::Shard::findOld(ripple::uint256 const& key, uint32_t seq) const
+{
+    auto h = history_.find(key);
+    if (h == history_.end())
+        return nullptr;
+    for (auto v = h->second.rbegin(); v != h->second.rend(); ++v)
+    {
+        if (seq >= v->replacedSeq)
+            return nullptr;
+        if (seq >= v->seq)
+            return &*v;
+    }
+    return nullptr;
+}
+
+void
+SimpleCache::Shard::retire(
+    ripple::uint256 const& key,
+    CacheEntry const& entry,
+    uint32_t seq)
+{
+    history_[key].push_back({entry.seq, seq, entry.blob});
+    expiry_.emplace_back(seq, key);
+}
+
+void
+SimpleCache::Shard::expire(uint32_t oldestSeq)
+{
+    while (expiry_.size() && expiry_.front().first <= oldestSeq)
+    {
+        // a key replaced several times may already have been cleaned up
+        // while handling an earlier entry
+        if (auto h = history_.find(expiry_.front().second);
+            h != history_.end())
+        {
+            auto& versions = h->second;
+            auto end = std::find_if(
+                versions.begin(), versions.end(), [&](auto const& v) {
+                    return v.replacedSeq > oldestSeq;
+                });
+            for (auto v = versions.begin(); v != end; ++v)
+                arena_.release(v->blob);
+            versions.erase(versions.begin(), end);
+            if (versions.empty())
+                history_.erase(h);
+        }
+        expiry_.pop_front();
+    }
+}
+
+void
+SimpleCache::Shard::upsert(
+    ripple::uint256 const& key,
+    uint32_t seq,
+    unsigned char const* data,
+    size_t size,
+    bool keepHistory)
+{
+    if (auto d = delta_.find(key); d != delta_.end())
+    {
+        if (!d->second)
+        {
+            d->second = CacheEntry{seq, arena_.store(data, size)};
+            ++size_;
+        }
+        else if (seq > d->second->seq)
+        {
+            replace(key, *d->second, seq, keepHistory);
+            *d->second = {seq, arena_.store(data, size)};
+        }
+        return;
+    }
+    auto b = lowerBound(base_, key);
+    if (b != base_.end() && b->first == key)
+    {
+        // modifications of existing objects are applied in place, so only
+        // creations and deletions grow delta_
+        if (seq > b->second.seq)
+        {
+            replace(key, b->second, seq, keepHistory);
+            b->second = {seq, arena_.store(data, size)};
+        }
+    }
+    else
+    {
+        delta_.emplace(key, CacheEntry{seq, arena_.store(data, size)});
+        ++size_;
+    }
+}
+
+void
+SimpleCache::Shard::erase(
+    ripple::uint256 const& key,
+    uint32_t seq,
+    bool keepHistory)
+{
+    auto d = delta_.find(key);
+    auto b = lowerBound(base_, key);
+    if (b != base_.end() && b->first == key)
+    {
+        if (d == delta_.end())
+        {
+            replace(key, b->second, seq, keepHistory);
+            delta_.emplace(key, std::nullopt);
+            --size_;
+        }
+        else if (d->second)
+        {
+            replace(key, *d->second, seq, keepHistory);
+            d->second.reset();
+            --size_;
+        }
+    }
+    else if (d != delta_.end())
+    {
+        replace(key, *d->second, seq, keepHistory);
+        delta_.erase(d);
+        --size_;
+    }
+}
+
+void
+SimpleCache::Shard::replace(
+    ripple::uint256 const& key,
+    CacheEntry const& entry,
+    uint32_t seq,
+    bool keepHistory)
+{
+    if (keepHistory)
+        retire(key, entry, seq);
+    else
+        arena_.release(entry.blob);
+}
+
+void
+SimpleCache::Shard::maybeCompact()
+{
+    if (delta_.size() > std::max(minDeltaSize, base_.size() / deltaRatio))
+        compact();
+    if (arena_.needsReclaim())
+    {
+        arena_.reclaim([this](auto&& relocate) {
+            for (auto& entry : base_)
+                relocate(entry.second.blob);
+            for (auto& [key, entry] : delta_)
+            {
+                if (entry)
+                    relocate(entry->blob);
+            }
+            for (auto& [key, versions] : history_)
+            {
+                for (auto& v : versions)
+                    relocate(v.blob);
+            }
+        });
+    }
+}
+
+void
+SimpleCache::Shard::compact()
+{
+    std::vector<Entry> merged;
+    merged.reserve(size_);
+    auto b = base_.begin();
+    for (auto& [key, entry] : delta_)
+    {
+        while (b != base_.end() && b->first < key)
+            merged.push_back(std::move(*b++));
+        // delta_ always shadows base_
+        if (b != base_.end() && b->first == key)
+            ++b;
+        if (entry)
+            merged.emplace_back(key, std::move(*entry));
+    }
+    std::move(b, base_.end(), std::back_inserter(merged));
+    assert(merged.size() == size_);
+    base_ = std::move(merged);
+    delta_.clear();
+}
+
+std::optional<LedgerObject>
+SimpleCache::Shard::successor(ripple::uint256 const& key) const
+{
+    auto d = delta_.upper_bound(key);
+    auto b = upperBound(base_, key);
+    while (d != delta_.end())
+    {
+        if (b != base_.end() && b->first < d->first)
+            return {{b->first, load(b->second.blob)}};
+        if (b != base_.end() && b->first == d->first)
+            ++b;
+        if (d->second)
+            return {{d->first, load(d->second->blob)}};
+        ++d;
+    }
+    if (b == base_.end())
+        return {};
+    return {{b->first, load(b->second.blob)}};
+}
+
+std::optional<LedgerObject>
+SimpleCache::Shard::predecessor(ripple::uint256 const& key) const
+{
+    auto d = std::make_reverse_iterator(delta_.lower_bound(key));
+    auto b = std::make_reverse_iterator(lowerBound(base_, key));
+    while (d != delta_.rend())
+    {
+        if (b != base_.rend() && b->first > d->first)
+            return {{b->first, load(b->second.blob)}};
+        if (b != base_.rend() && b->first == d->first)
+            ++b;
+        if (d->second)
+            return {{d->first, load(d->second->blob)}};
+        ++d;
+    }
+    if (b == base_.rend())
+        return {};
+    return {{b->first, load(b->second.blob)}};
+}
+
+size_t
+SimpleCache::Shard::snapshot(uint32_t seq, std::string& out) const
+{
+    struct Object
+    {
+        ripple::uint256 key;
+        uint32_t seq;
+        BlobRef blob;
+    };
+    std::vector<Object> objects;
+    objects.reserve(size_);
+    auto add = [&](ripple::uint256 const& key, CacheEntry const& entry) {
+        if (seq >= entry.seq)
+            objects.push_back({key, entry.seq, entry.blob});
+        else if (auto v = findOld(key, seq))
+            objects.push_back({key, v->seq, v->blob});
+    };
+    auto b = base_.begin();
+    for (auto& [key, entry] : delta_)
+    {
+        for (; b != base_.end() && b->first < key; ++b)
+            add(b->first, b->second);
+        if (b != base_.end() && b->first == key)
+            ++b;
+        if (entry)
+            add(key, *entry);
+    }
+    for (; b != base_.end(); ++b)
+        add(b->first, b->second);
+
+    // objects deleted after seq only remain in history_
+    auto numLive = objects.size();
+    for (auto& [key, versions] : history_)
+    {
+        if (find(key))
+            continue;
+        if (auto v = findOld(key, seq))
+            objects.push_back({key, v->seq, v->blob});
+    }
+    auto keyLess = [](auto const& a, auto const& b) { return a.key < b.key; };
+    std::sort(objects.begin() + numLive, objects.end(), keyLess);
+    std::inplace_merge(
+        objects.begin(), objects.begin() + numLive, objects.end(), keyLess);
+
+    for (auto const& obj : objects)
+    {
+        CacheSnapshot::Writer::encode(
+            out, {obj.key, obj.seq, arena_.data(obj.blob), obj.blob.size});
+    }
+    return objects.size();
+}
+
+SimpleCache::SimpleCache(uint32_t numVersions)
+    : numVersions_{std::max(numVersions, 1u)}
+{
+}
+
 void
 SimpleCache::update(
     std::vector<LedgerObject> const& objs,
     uint32_t seq,
     bool isBackground)
 {
-    std::unique_lock lck{mtx_};
-    if (seq > latestSeq_)
-    {
-        assert(seq == latestSeq_ + 1 || latestSeq_ == 0);
-        latestSeq_ = seq;
-    }
+    std::array<std::vector<LedgerObject const*>, numShards> byShard;
     for (auto const& obj : objs)
+        byShard[shardIndex(obj.key)].push_back(&obj);
+
+    // versions replaced by background writes are older than anything we
+    // serve, so history is only kept for the ledgers being applied by ETL
+    bool keepHistory = numVersions_ > 1 && !isBackground;
+    // replaced versions only valid before this ledger are no longer needed
+    uint32_t oldestSeq = seq >= numVersions_ ? seq - numVersions_ + 1 : 0;
+
+    ++generation_;
+    for (size_t i = 0; i < numShards; ++i)
     {
-        if (obj.blob.size())
+        if (byShard[i].empty())
+            continue;
+        auto& shard = shards_[i];
+        std::unique_lock lck{shard.mtx};
+        for (auto const* obj : byShard[i])
         {
-            if (isBackground && deletes_.count(obj.key))
-                continue;
-            auto& e = map_[obj.key];
-            if (seq > e.seq)
+            if (obj->blob.size())
             {
-                e = {seq, obj.blob};
+                if (isBackground && shard.deletes.count(obj->key))
+                    continue;
+                shard.upsert(
+                    obj->key,
+                    seq,
+                    obj->blob.data(),
+                    obj->blob.size(),
+                    keepHistory);
+            }
+            else
+            {
+                // a background delete must not remove a newer version
+                if (auto e = shard.find(obj->key);
+                    isBackground && e && e->seq > seq)
+                    continue;
+                shard.erase(obj->key, seq, keepHistory);
+                if (!full_ && !isBackground)
+                    shard.deletes.insert(obj->key);
             }
         }
-        else
-        {
-            map_.erase(obj.key);
-            if (!full_ && !isBackground)
-                deletes_.insert(obj.key);
-        }
+        if (keepHistory)
+            shard.expire(oldestSeq);
+        shard.maybeCompact();
+    }
+    // only publish the new sequence once every shard reflects it
+    advanceLatest(seq);
+    ++generation_;
+}
+
+void
+SimpleCache::advanceLatest(uint32_t seq)
+{
+    auto latest = latestSeq_.load();
+    while (seq > latest)
+    {
+        // until the cache is full, background writes may run ahead
+        assert(seq == latest + 1 || latest == 0 || !full_);
+        if (latestSeq_.compare_exchange_weak(latest, seq))
+            break;
     }
 }
 std::optional<LedgerObject>
@@ -38,48 +390,80 @@ SimpleCache::getSuccessor(ripple::uint256 const& key, uint32_t seq) const
 {
     if (!full_)
         return {};
-    std::shared_lock{mtx_};
-    if (seq != latestSeq_)
+    // once the cache is full, updates only come from the ETL thread, so an
+    // odd or changed generation means we raced with an update
+    auto generation = generation_.load();
+    if (generation % 2 || seq != latestSeq_)
         return {};
-    auto e = map_.upper_bound(key);
-    if (e == map_.end())
+    std::optional<LedgerObject> succ;
+    for (auto i = shardIndex(key); i < numShards && !succ; ++i)
+    {
+        auto& shard = shards_[i];
+        std::shared_lock lck{shard.mtx};
+        succ = shard.successor(i == shardIndex(key) ? key : firstKey);
+    }
+    if (generation != generation_)
         return {};
-    return {{e->first, e->second.blob}};
+    return succ;
 }
 std::optional<LedgerObject>
 SimpleCache::getPredecessor(ripple::uint256 const& key, uint32_t seq) const
 {
     if (!full_)
         return {};
-    std::shared_lock lck{mtx_};
-    if (seq != latestSeq_)
+    auto generation = generation_.load();
+    if (generation % 2 || seq != latestSeq_)
         return {};
-    auto e = map_.lower_bound(key);
-    if (e == map_.begin())
+    std::optional<LedgerObject> pred;
+    for (auto i = shardIndex(key) + 1; i-- > 0 && !pred;)
+    {
+        auto& shard = shards_[i];
+        std::shared_lock lck{shard.mtx};
+        pred = shard.predecessor(i == shardIndex(key) ? key : lastKey);
+    }
+    if (generation != generation_)
         return {};
-    --e;
-    return {{e->first, e->second.blob}};
+    return pred;
+}
+std::optional<BlobView>
+SimpleCache::getView(ripple::uint256 const& key, uint32_t seq) const
+{
+    auto latest = latestSeq_.load();
+    if (seq > latest)
+        return {};
+    auto lag = std::min<size_t>(latest - seq, maxTrackedLag);
+    auto& shard = shards_[shardIndex(key)];
+    std::optional<BlobView> view;
+    {
+        std::shared_lock lck{shard.mtx};
+        if (auto e = shard.find(key); e && seq >= e->seq)
+            view = shard.arena().view(e->blob);
+        else if (auto v = shard.findOld(key, seq))
+            view = shard.arena().view(v->blob);
+    }
+    if (view)
+        shard.hits[lag].fetch_add(1, std::memory_order_relaxed);
+    else
+        shard.misses[lag].fetch_add(1, std::memory_order_relaxed);
+    return view;
 }
 std::optional<Blob>
 SimpleCache::get(ripple::uint256 const& key, uint32_t seq) const
 {
-    if (seq > latestSeq_)
-        return {};
-    std::shared_lock lck{mtx_};
-    auto e = map_.find(key);
-    if (e == map_.end())
-        return {};
-    if (seq < e->second.seq)
-        return {};
-    return {e->second.blob};
+    if (auto view = getView(key, seq))
+        return view->toBlob();
+    return {};
 }
 
 void
 SimpleCache::setFull()
 {
     full_ = true;
-    std::unique_lock lck{mtx_};
-    deletes_.clear();
+    for (auto& shard : shards_)
+    {
+        std::unique_lock lck{shard.mtx};
+        shard.deletes.clear();
+    }
 }
 
 bool
@@ -90,7 +474,173 @@ SimpleCache::isFull()
 size_t
 SimpleCache::size()
 {
-    std::shared_lock lck{mtx_};
-    return map_.size();
+    size_t sz = 0;
+    for (auto& shard : shards_)
+    {
+        std::shared_lock lck{shard.mtx};
+        sz += shard.size();
+    }
+    return sz;
+}
+
+boost::json::object
+SimpleCache::report() const
+{
+    boost::json::object report;
+    size_t sz = 0;
+    size_t numOldVersions = 0;
+    uint64_t blobBytes = 0;
+    uint64_t arenaBytes = 0;
+    std::array<uint64_t, maxTrackedLag + 1> hits = {};
+    std::array<uint64_t, maxTrackedLag + 1> misses = {};
+    for (auto& shard : shards_)
+    {
+        {
+            std::shared_lock lck{shard.mtx};
+            sz += shard.size();
+            numOldVersions += shard.numOldVersions();
+            blobBytes += shard.arena().liveBytes();
+            arenaBytes += shard.arena().allocatedBytes();
+        }
+        for (size_t lag = 0; lag <= maxTrackedLag; ++lag)
+        {
+            hits[lag] += shard.hits[lag].load(std::memory_order_relaxed);
+            misses[lag] += shard.misses[lag].load(std::memory_order_relaxed);
+        }
+    }
+    report["size"] = sz;
+    report["is_full"] = full_.load();
+    report["latest_sequence"] = latestSeq_.load();
+    report["num_versions"] = numVersions_;
+    report["old_versions"] = numOldVersions;
+    report["blob_bytes"] = blobBytes;
+    report["arena_bytes"] = arenaBytes;
+
+    boost::json::array lags;
+    for (size_t lag = 0; lag <= maxTrackedLag; ++lag)
+    {
+        auto total = hits[lag] + misses[lag];
+        if (!total)
+            continue;
+        boost::json::object entry;
+        if (lag == maxTrackedLag)
+            entry["lag"] = std::to_string(maxTrackedLag) + "+";
+        else
+            entry["lag"] = lag;
+        entry["hits"] = hits[lag];
+        entry["misses"] = misses[lag];
+        entry["hit_rate"] = static_cast<double>(hits[lag]) / total;
+        lags.push_back(std::move(entry));
+    }
+    report["lags"] = std::move(lags);
+    return report;
+}
+
+bool
+SimpleCache::save(
+    std::string const& path,
+    uint32_t seq,
+    ripple::uint256 const& ledgerHash) const
+{
+    if (!full_)
+        return false;
+    // an update that is in progress when we start counts as applied
+    auto generation = generation_.load() & ~uint64_t{1};
+    auto latest = latestSeq_.load();
+    if (seq > latest || latest - seq >= numVersions_)
+        return false;
+
+    CacheSnapshot::Writer writer{path, seq, ledgerHash};
+    // records are encoded under the shard lock, then written without it
+    std::string records;
+    for (auto& shard : shards_)
+    {
+        records.clear();
+        size_t numRecords = 0;
+        {
+            std::shared_lock lck{shard.mtx};
+            numRecords = shard.snapshot(seq, records);
+        }
+        writer.write(records, numRecords);
+    }
+
+    // versions valid in seq are kept until numVersions ledgers after it
+    auto numApplied = latest - seq + (generation_.load() - generation + 1) / 2;
+    if (numApplied >= numVersions_)
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " too many ledgers applied while writing cache "
+            << "snapshot of ledger " << seq << ". ledgers = " << numApplied;
+        return false;
+    }
+    if (!writer.commit())
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " failed to write cache snapshot to " << path;
+        return false;
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " wrote cache snapshot of ledger " << seq << " to "
+        << path;
+    return true;
+}
+
+bool
+SimpleCache::load(
+    std::string const& path,
+    std::unordered_set<ripple::uint256, ripple::hardened_hash<>> const& skip)
+{
+    CacheSnapshot snapshot{path};
+    auto const& header = snapshot.header();
+    if (!header)
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " invalid cache snapshot at " << path;
+        return false;
+    }
+
+    // records are in key order, so runs of them go to the same shard. the
+    // shard lock is released every batchSize records to let readers and
+    // the ETL thread in
+    constexpr size_t batchSize = 1 << 12;
+    size_t current = numShards;
+    size_t numInBatch = 0;
+    std::unique_lock<std::shared_mutex> lck;
+    snapshot.forEachRecord([&](CacheSnapshot::Record const& record) {
+        auto idx = shardIndex(record.key);
+        auto& shard = shards_[idx];
+        if (idx != current || numInBatch == batchSize)
+        {
+            if (lck)
+            {
+                shards_[current].maybeCompact();
+                lck.unlock();
+            }
+            lck = std::unique_lock{shard.mtx};
+            current = idx;
+            numInBatch = 0;
+        }
+        ++numInBatch;
+        if (skip.count(record.key) || shard.deletes.count(record.key))
+            return;
+        shard.upsert(record.key, record.seq, record.data, record.size, false);
+    });
+    if (lck)
+    {
+        shards_[current].maybeCompact();
+        lck.unlock();
+    }
+    advanceLatest(header->seq);
+
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " loaded " << header->numObjects
+        << " objects of ledger " << header->seq << " from " << path;
+    return true;
+}
+
+uint32_t
+SimpleCache::latestSequence() const
+{
+    return latestSeq_;
 }
 }  // namespace Backend
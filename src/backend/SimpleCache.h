@@ -3,29 +3,217 @@
 
 #include <ripple/basics/base_uint.h>
 #include <ripple/basics/hardened_hash.h>
+#include <boost/json.hpp>
+#include <backend/BlobArena.h>
 #include <backend/Types.h>
+#include <array>
+#include <atomic>
+#include <deque>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 namespace Backend {
+// Ordered in-memory index of ledger state.
+//
+// The key space is split into contiguous ranges (shards) by the leading bits
+// of the key, each with its own lock, so readers only contend with an update
+// that touches the same shard. Since shards are ranges, successor and
+// predecessor lookups continue into the neighbouring shards.
+//
+// Within a shard, entries are kept in a sorted, contiguous vector (base) that
+// is only rebuilt when the small ordered buffer of recent changes (delta)
+// grows past a fraction of its size. Lookups and successor walks are binary
+// searches over contiguous memory plus a probe of the delta buffer, instead
+// of pointer chasing through one heap allocated node per object.
+//
+// Besides the most recent version of every object, the cache can keep the
+// versions replaced during the last few ledgers, so reads pinned to a ledger
+// slightly behind the tip are still served from memory. Older versions live
+// in a small per shard side table, since only the fraction of objects
+// touched by recent ledgers has any.
+//
+// Blobs are not stored in the entries themselves, but in an arena per shard
+// that packs them into large slabs.
 class SimpleCache
 {
     struct CacheEntry
     {
         uint32_t seq = 0;
-        Blob blob;
+        BlobRef blob;
     };
-    std::map<ripple::uint256, CacheEntry> map_;
-    mutable std::shared_mutex mtx_;
-    uint32_t latestSeq_ = 0;
+    using Entry = std::pair<ripple::uint256, CacheEntry>;
+
+    // a version that was modified or deleted in ledger replacedSeq. valid
+    // for ledgers in [seq, replacedSeq)
+    struct OldVersion
+    {
+        uint32_t seq = 0;
+        uint32_t replacedSeq = 0;
+        BlobRef blob;
+    };
+
+    // hits and misses of get() are tracked per distance from the most recent
+    // ledger. the last bucket counts everything at least maxTrackedLag behind
+    static constexpr size_t maxTrackedLag = 32;
+
+    class Shard
+    {
+        // sorted by key. entries are only added or removed by compaction
+        std::vector<Entry> base_;
+        // inserts, updates and deletes (empty optional) not yet merged into
+        // base_
+        std::map<ripple::uint256, std::optional<CacheEntry>> delta_;
+        // number of live objects across base_ and delta_
+        size_t size_ = 0;
+
+        // replaced versions, newest last
+        std::unordered_map<
+            ripple::uint256,
+            std::vector<OldVersion>,
+            ripple::hardened_hash<>>
+            history_;
+        // (replacedSeq, key) of every entry in history_, oldest first
+        std::deque<std::pair<uint32_t, ripple::uint256>> expiry_;
+
+        // blobs of every entry in base_, delta_ and history_
+        BlobArena arena_;
+
+        // move entry to history_
+        void
+        retire(
+            ripple::uint256 const& key,
+            CacheEntry const& entry,
+            uint32_t seq);
+
+        // retire or release entry, which is being replaced in ledger seq
+        void
+        replace(
+            ripple::uint256 const& key,
+            CacheEntry const& entry,
+            uint32_t seq,
+            bool keepHistory);
+
+        // delta_ is merged into base_ once it holds more than
+        // max(minDeltaSize, base_.size() / deltaRatio) entries
+        static constexpr size_t minDeltaSize = 1 << 12;
+        static constexpr size_t deltaRatio = 8;
+
+        void
+        compact();
+
+    public:
+        mutable std::shared_mutex mtx;
+        // temporary set to prevent background thread from writing already
+        // deleted data. not used when cache is full
+        std::unordered_set<ripple::uint256, ripple::hardened_hash<>> deletes;
+
+        mutable std::array<std::atomic_uint64_t, maxTrackedLag + 1> hits = {};
+        mutable std::array<std::atomic_uint64_t, maxTrackedLag + 1> misses =
+            {};
+
+        // the methods below expect the caller to hold mtx
+        // returns nullptr if key is not in the shard
+        CacheEntry const*
+        find(ripple::uint256 const& key) const;
+
+        // returns the replaced version of key that was valid in ledger seq
+        OldVersion const*
+        findOld(ripple::uint256 const& key, uint32_t seq) const;
+
+        // set keepHistory to retain the replaced version, if any
+        void
+        upsert(
+            ripple::uint256 const& key,
+            uint32_t seq,
+            unsigned char const* data,
+            size_t size,
+            bool keepHistory);
+
+        void
+        erase(ripple::uint256 const& key, uint32_t seq, bool keepHistory);
+
+        // drop replaced versions that are not valid in any ledger at or
+        // after oldestSeq
+        void
+        expire(uint32_t oldestSeq);
+
+        // merge delta_ into base_ if it has grown too large, and reclaim
+        // arena space if enough blobs have been released
+        void
+        maybeCompact();
+
+        Blob
+        load(BlobRef const& ref) const
+        {
+            return arena_.load(ref);
+        }
+
+        std::optional<LedgerObject>
+        successor(ripple::uint256 const& key) const;
+
+        std::optional<LedgerObject>
+        predecessor(ripple::uint256 const& key) const;
+
+        size_t
+        size() const
+        {
+            return size_;
+        }
+
+        size_t
+        numOldVersions() const
+        {
+            return expiry_.size();
+        }
+
+        BlobArena const&
+        arena() const
+        {
+            return arena_;
+        }
+
+        // append the version of every object that is valid in ledger seq to
+        // out, in key order, as snapshot records. returns the number of
+        // objects written
+        size_t
+        snapshot(uint32_t seq, std::string& out) const;
+    };
+
+    // shards are selected by the leading shardBits bits of the key
+    static constexpr size_t shardBits = 6;
+    static constexpr size_t numShards = 1 << shardBits;
+    std::array<Shard, numShards> shards_;
+
+    // number of most recent ledgers get() can answer for any object
+    uint32_t const numVersions_;
+    std::atomic_uint32_t latestSeq_ = 0;
+    // incremented before and after every update, so it is odd while an
+    // update is in progress. lets successor and predecessor lookups, which
+    // may span shards, detect that they raced with an update
+    std::atomic_uint64_t generation_ = 0;
     std::atomic_bool full_ = false;
-    // temporary set to prevent background thread from writing already deleted
-    // data. not used when cache is full
-    std::unordered_set<ripple::uint256, ripple::hardened_hash<>> deletes_;
+
+    static size_t
+    shardIndex(ripple::uint256 const& key)
+    {
+        return *key.data() >> (8 - shardBits);
+    }
+
+    // publish seq as the most recent ledger, if it is newer
+    void
+    advanceLatest(uint32_t seq);
 
 public:
+    // numVersions is the number of most recent ledgers for which every object
+    // in the cache can be read. 1 only keeps the latest version
+    explicit SimpleCache(uint32_t numVersions = 1);
+
     // Update the cache with new ledger objects
     // set isBackground to true when writing old data from a background thread
     void
@@ -37,6 +225,11 @@ public:
     std::optional<Blob>
     get(ripple::uint256 const& key, uint32_t seq) const;
 
+    // same as get(), without copying the blob. the view remains valid after
+    // the object is modified or deleted, or the cache reclaims its memory
+    std::optional<BlobView>
+    getView(ripple::uint256 const& key, uint32_t seq) const;
+
     // always returns empty optional if isFull() is false
     std::optional<LedgerObject>
     getSuccessor(ripple::uint256 const& key, uint32_t seq) const;
@@ -54,6 +247,32 @@ public:
 
     size_t
     size();
+
+    // size, configuration and hit rates by lag behind the most recent ledger
+    boost::json::object
+    report() const;
+
+    // most recent ledger the cache has been updated to
+    uint32_t
+    latestSequence() const;
+
+    // Write every object of ledger seq, whose hash is ledgerHash, to a
+    // CacheSnapshot at path. seq has to be one of the last numVersions
+    // ledgers, and stay so until the snapshot is written. Requires isFull()
+    bool
+    save(
+        std::string const& path,
+        uint32_t seq,
+        ripple::uint256 const& ledgerHash) const;
+
+    // Load the CacheSnapshot at path as background writes, skipping the
+    // objects in skip. The file is validated before anything is loaded.
+    // returns false if it is missing or corrupt
+    bool
+    load(
+        std::string const& path,
+        std::unordered_set<ripple::uint256, ripple::hardened_hash<>> const&
+            skip = {});
 };
 
 }  // namespace Backend
@@ -0,0 +1,108 @@
+#ifndef CLIO_SINGLEFLIGHT_H_INCLUDED
+#define CLIO_SINGLEFLIGHT_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <boost/json.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+namespace Backend {
+// A key and the ledger it is read at
+using KeyAndSeq = std::pair<ripple::uint256, uint32_t>;
+
+struct KeyAndSeqHash
+{
+    size_t
+    operator()(KeyAndSeq const& keyAndSeq) const
+    {
+        return ripple::hardened_hash<>{}(keyAndSeq.first) ^
+            std::hash<uint32_t>{}(keyAndSeq.second);
+    }
+};
+
+// Coalesces concurrent reads of the same thing. The first thread to read a
+// key runs the read, and threads that ask for the key while it is running
+// wait for it and share its result, or its exception, instead of sending the
+// same query again. Once the read completes, the next one runs a new read.
+//
+// Only for reads whose result never changes, such as an object at a given
+// ledger, so a result shared by a read that started earlier is as good as
+// a new one. Flights are sharded by key, each shard with its own lock.
+template <class Key, class Value, class Hash = std::hash<Key>>
+class SingleFlight
+{
+    struct alignas(64) Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<Key, std::shared_future<Value>, Hash> flights;
+    };
+
+    static constexpr size_t numShards = 16;
+
+    std::array<Shard, numShards> shards_;
+    // reads run, and reads that waited for one running already
+    std::atomic_uint64_t reads_{0};
+    std::atomic_uint64_t shared_{0};
+
+public:
+    // The result of read(), which is only called if no read of key is
+    // running already. Otherwise waits for that read and returns its result
+    template <class F>
+    Value
+    run(Key const& key, F&& read)
+    {
+        auto& shard = shards_[Hash{}(key) % numShards];
+        std::promise<Value> promise;
+        std::shared_future<Value> running;
+        {
+            std::lock_guard lck(shard.mtx);
+            auto [it, inserted] = shard.flights.try_emplace(key);
+            if (inserted)
+                it->second = promise.get_future().share();
+            else
+                running = it->second;
+        }
+        if (running.valid())
+        {
+            ++shared_;
+            return running.get();
+        }
+
+        ++reads_;
+        auto land = [&shard, &key]() {
+            std::lock_guard lck(shard.mtx);
+            shard.flights.erase(key);
+        };
+        try
+        {
+            Value value = read();
+            promise.set_value(value);
+            land();
+            return value;
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+            land();
+            throw;
+        }
+    }
+
+    boost::json::object
+    report() const
+    {
+        boost::json::object report;
+        report["reads"] = reads_.load();
+        report["shared"] = shared_.load();
+        return report;
+    }
+};
+
+}  // namespace Backend
+#endif
@@ -0,0 +1,69 @@
+#include <backend/TransactionCache.h>
+namespace Backend {
+
+std::optional<TransactionAndMetadata>
+TransactionCache::get(ripple::uint256 const& hash)
+{
+    auto& shard = this->shard(hash);
+    std::lock_guard lck{shard.mtx};
+    auto it = shard.entries.find(hash);
+    if (it == shard.entries.end())
+    {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return {};
+    }
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->second;
+}
+
+void
+TransactionCache::put(ripple::uint256 const& hash, TransactionAndMetadata txn)
+{
+    size_t const size = bytes(txn);
+    if (size > maxShardBytes_)
+        return;
+    auto& shard = this->shard(hash);
+    std::lock_guard lck{shard.mtx};
+    if (auto it = shard.entries.find(hash); it != shard.entries.end())
+    {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    while (shard.bytes + size > maxShardBytes_)
+    {
+        auto& oldest = shard.lru.back();
+        shard.bytes -= bytes(oldest.second);
+        shard.entries.erase(oldest.first);
+        shard.lru.pop_back();
+    }
+    shard.lru.emplace_front(hash, std::move(txn));
+    shard.entries.emplace(hash, shard.lru.begin());
+    shard.bytes += size;
+}
+
+boost::json::object
+TransactionCache::report()
+{
+    size_t size = 0;
+    size_t bytes = 0;
+    for (auto& shard : shards_)
+    {
+        std::lock_guard lck{shard.mtx};
+        size += shard.entries.size();
+        bytes += shard.bytes;
+    }
+    uint64_t const hits = hits_.load();
+    uint64_t const misses = misses_.load();
+    boost::json::object report;
+    report["size"] = size;
+    report["bytes"] = bytes;
+    report["max_bytes"] = maxShardBytes_ * numShards;
+    report["hits"] = hits;
+    report["misses"] = misses;
+    if (hits + misses)
+        report["hit_ratio"] = static_cast<double>(hits) / (hits + misses);
+    return report;
+}
+
+}  // namespace Backend
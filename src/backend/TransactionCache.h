@@ -0,0 +1,75 @@
+#ifndef CLIO_TRANSACTIONCACHE_H_INCLUDED
+#define CLIO_TRANSACTIONCACHE_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <boost/json.hpp>
+#include <backend/Types.h>
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+namespace Backend {
+// Transactions and their metadata by hash, up to a total size in bytes.
+//
+// The ETL inserts the transactions of every ledger it publishes, and reads
+// insert what they fetch, so the recent transactions most requests ask for
+// are served without reading the database. Transactions are immutable, so
+// entries never go stale; the least recently used ones are evicted once the
+// cache is full. Hashes are split over shards by their first byte, each with
+// its own lock and its own share of the size.
+class TransactionCache
+{
+    struct Shard
+    {
+        std::mutex mtx;
+        // most recently used first
+        std::list<std::pair<ripple::uint256, TransactionAndMetadata>> lru;
+        std::unordered_map<
+            ripple::uint256,
+            decltype(lru)::iterator,
+            ripple::hardened_hash<>>
+            entries;
+        size_t bytes = 0;
+    };
+
+    static constexpr size_t numShards = 16;
+    std::array<Shard, numShards> shards_;
+    size_t const maxShardBytes_;
+    std::atomic_uint64_t hits_ = 0;
+    std::atomic_uint64_t misses_ = 0;
+
+    Shard&
+    shard(ripple::uint256 const& hash)
+    {
+        return shards_[*hash.data() % numShards];
+    }
+
+    // memory held by an entry, including the list node and the map entry
+    static size_t
+    bytes(TransactionAndMetadata const& txn)
+    {
+        return txn.transaction.size() + txn.metadata.size() + 128;
+    }
+
+public:
+    explicit TransactionCache(size_t maxBytes)
+        : maxShardBytes_(maxBytes / numShards)
+    {
+    }
+
+    std::optional<TransactionAndMetadata>
+    get(ripple::uint256 const& hash);
+
+    void
+    put(ripple::uint256 const& hash, TransactionAndMetadata txn);
+
+    boost::json::object
+    report();
+};
+
+}  // namespace Backend
+#endif
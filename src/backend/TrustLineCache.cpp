@@ -0,0 +1,175 @@
+#include <ripple/protocol/LedgerFormats.h>
+#include <ripple/protocol/STLedgerEntry.h>
+#include <ripple/protocol/Serializer.h>
+#include <backend/TrustLineCache.h>
+namespace Backend {
+
+std::optional<TrustLine>
+TrustLine::parse(
+    ripple::uint256 const& key,
+    unsigned char const* data,
+    size_t size)
+{
+    TrustLine line;
+    line.key = key;
+    ripple::SerialIter it{data, size};
+    while (!it.empty())
+    {
+        int type;
+        int field;
+        it.getFieldID(type, field);
+        switch (type)
+        {
+            case ripple::STI_UINT8:
+                it.get8();
+                break;
+            case ripple::STI_UINT16:
+                if (auto value = it.get16();
+                    field == ripple::sfLedgerEntryType.fieldValue &&
+                    value != ripple::ltRIPPLE_STATE)
+                    return {};
+                break;
+            case ripple::STI_UINT32:
+                if (auto value = it.get32();
+                    field == ripple::sfFlags.fieldValue)
+                    line.flags = value;
+                break;
+            case ripple::STI_UINT64:
+                it.get64();
+                break;
+            case ripple::STI_HASH128:
+                it.skip(16);
+                break;
+            case ripple::STI_HASH160:
+                it.skip(20);
+                break;
+            case ripple::STI_HASH256:
+                it.skip(32);
+                break;
+            case ripple::STI_AMOUNT: {
+                ripple::STAmount amount{it, ripple::sfGeneric};
+                if (field == ripple::sfBalance.fieldValue)
+                    line.balance = amount;
+                else if (field == ripple::sfLowLimit.fieldValue)
+                    line.lowLimit = amount;
+                else if (field == ripple::sfHighLimit.fieldValue)
+                    line.highLimit = amount;
+                break;
+            }
+            case ripple::STI_VL:
+            case ripple::STI_ACCOUNT:
+                it.skip(it.getVLDataLength());
+                break;
+            default: {
+                // not a field of a trust line, as of this writing
+                ripple::SLE sle{ripple::SerialIter{data, size}, key};
+                if (sle.getType() != ripple::ltRIPPLE_STATE)
+                    return {};
+                line.flags = sle.getFieldU32(ripple::sfFlags);
+                line.balance = sle.getFieldAmount(ripple::sfBalance);
+                line.lowLimit = sle.getFieldAmount(ripple::sfLowLimit);
+                line.highLimit = sle.getFieldAmount(ripple::sfHighLimit);
+                return line;
+            }
+        }
+    }
+    return line;
+}
+
+void
+TrustLineCache::erase(decltype(entries_)::iterator it)
+{
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+TrustLineCache::Lines
+TrustLineCache::get(ripple::AccountID const& account, uint32_t seq)
+{
+    std::lock_guard lck{mtx_};
+    auto it = entries_.find(account);
+    if (it == entries_.end() || seq < it->second.from ||
+        seq > it->second.through)
+    {
+        ++misses_;
+        return {};
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return it->second.lines;
+}
+
+void
+TrustLineCache::insert(
+    ripple::AccountID const& account,
+    uint32_t seq,
+    Lines lines)
+{
+    std::lock_guard lck{mtx_};
+    // a ledger was applied since the read, which may have changed the lines
+    if (seq < latestSeq_ || maxAccounts_ == 0)
+        return;
+    if (auto it = entries_.find(account); it != entries_.end())
+        erase(it);
+    else if (entries_.size() >= maxAccounts_)
+        erase(entries_.find(lru_.back()));
+
+    lru_.push_front(account);
+    entries_.emplace(account, Entry{std::move(lines), seq, seq, lru_.begin()});
+}
+
+void
+TrustLineCache::update(
+    std::vector<AccountTransactionsData> const& data,
+    uint32_t seq)
+{
+    std::lock_guard lck{mtx_};
+    if (seq <= latestSeq_)
+        return;
+    latestSeq_ = seq;
+    if (entries_.empty())
+        return;
+
+    for (auto const& tx : data)
+    {
+        for (auto const& account : tx.accounts)
+        {
+            if (auto it = entries_.find(account);
+                it != entries_.end() && it->second.through < seq)
+                erase(it);
+        }
+    }
+    for (auto it = entries_.begin(); it != entries_.end();)
+    {
+        auto& entry = it->second;
+        // cached after the ledger was applied to the database
+        if (entry.through >= seq)
+            ++it;
+        else if (entry.through + 1 == seq)
+        {
+            entry.through = seq;
+            ++it;
+        }
+        else
+        {
+            lru_.erase(entry.lru);
+            it = entries_.erase(it);
+        }
+    }
+}
+
+size_t
+TrustLineCache::size()
+{
+    std::lock_guard lck{mtx_};
+    return entries_.size();
+}
+
+std::pair<uint64_t, uint64_t>
+TrustLineCache::stats()
+{
+    std::lock_guard lck{mtx_};
+    return {hits_, misses_};
+}
+
+}  // namespace Backend
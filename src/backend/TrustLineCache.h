@@ -0,0 +1,94 @@
+#ifndef CLIO_TRUSTLINECACHE_H_INCLUDED
+#define CLIO_TRUSTLINECACHE_H_INCLUDED
+
+#include <ripple/basics/base_uint.h>
+#include <ripple/basics/hardened_hash.h>
+#include <ripple/protocol/STAmount.h>
+#include <backend/DBHelpers.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+namespace Backend {
+// The fields of a trust line that handlers scanning every line of an account
+// read
+struct TrustLine
+{
+    ripple::uint256 key;
+    std::uint32_t flags = 0;
+    ripple::STAmount balance;
+    ripple::STAmount lowLimit;
+    ripple::STAmount highLimit;
+
+    // Read the fields from blob, a serialized ledger object, without building
+    // the whole object. empty optional if the object is not a trust line
+    static std::optional<TrustLine>
+    parse(ripple::uint256 const& key, unsigned char const* data, size_t size);
+};
+
+// Trust lines of recently requested accounts, as of the most recent ledger.
+//
+// An account is cached when all of its lines are read at the most recent
+// ledger, and stays cached for as long as no transaction affects it. The
+// lines of an account only change in a ledger with a transaction affecting
+// the account, so those drop it from the cache.
+class TrustLineCache
+{
+public:
+    using Lines = std::shared_ptr<std::vector<TrustLine> const>;
+
+private:
+    struct Entry
+    {
+        Lines lines;
+        // lines are the lines of the account from this ledger
+        uint32_t from;
+        // through this one
+        uint32_t through;
+        std::list<ripple::AccountID>::iterator lru;
+    };
+
+    std::mutex mtx_;
+    std::unordered_map<ripple::AccountID, Entry, ripple::hardened_hash<>>
+        entries_;
+    // most recently used first
+    std::list<ripple::AccountID> lru_;
+    uint32_t latestSeq_ = 0;
+    size_t const maxAccounts_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    void
+    erase(decltype(entries_)::iterator it);
+
+public:
+    explicit TrustLineCache(size_t maxAccounts) : maxAccounts_(maxAccounts)
+    {
+    }
+
+    // the lines of account at ledger seq. nullptr on a miss
+    Lines
+    get(ripple::AccountID const& account, uint32_t seq);
+
+    // Add lines, every line of account at ledger seq. Ignored if a newer
+    // ledger was applied since
+    void
+    insert(ripple::AccountID const& account, uint32_t seq, Lines lines);
+
+    // Apply ledger seq, given the accounts its transactions affected.
+    // Accounts not up to date with the previous ledger are dropped too
+    void
+    update(std::vector<AccountTransactionsData> const& data, uint32_t seq);
+
+    size_t
+    size();
+
+    // hits and misses of get()
+    std::pair<uint64_t, uint64_t>
+    stats();
+};
+
+}  // namespace Backend
+#endif
@@ -1,6 +1,7 @@
 #ifndef CLIO_TYPES_H_INCLUDED
 #define CLIO_TYPES_H_INCLUDED
 #include <ripple/basics/base_uint.h>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -11,6 +12,47 @@ namespace Backend {
 
 using Blob = std::vector<unsigned char>;
 
+// Read only view of a blob that keeps the memory it points to alive, so it
+// stays valid while the cache is updated concurrently. Copying a view does
+// not copy the blob.
+struct BlobView
+{
+    std::shared_ptr<void const> owner;
+    unsigned char const* data = nullptr;
+    size_t size = 0;
+
+    BlobView() = default;
+
+    BlobView(
+        std::shared_ptr<void const> owner,
+        unsigned char const* data,
+        size_t size)
+        : owner{std::move(owner)}, data{data}, size{size}
+    {
+    }
+
+    // take ownership of blob
+    explicit BlobView(Blob&& blob)
+    {
+        auto owned = std::make_shared<Blob const>(std::move(blob));
+        data = owned->data();
+        size = owned->size();
+        owner = std::move(owned);
+    }
+
+    bool
+    empty() const
+    {
+        return size == 0;
+    }
+
+    Blob
+    toBlob() const
+    {
+        return {data, data + size};
+    }
+};
+
 struct LedgerObject
 {
     ripple::uint256 key;
@@ -60,6 +102,12 @@ struct AccountTransactions
     std::optional<AccountTransactionsCursor> cursor;
 };
 
+struct AccountTransactionHashes
+{
+    std::vector<ripple::uint256> hashes;
+    std::optional<AccountTransactionsCursor> cursor;
+};
+
 struct LedgerRange
 {
     uint32_t minSequence;
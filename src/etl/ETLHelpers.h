@@ -1,11 +1,22 @@
 #ifndef RIPPLE_APP_REPORTING_ETLHELPERS_H_INCLUDED
 #define RIPPLE_APP_REPORTING_ETLHELPERS_H_INCLUDED
 #include <ripple/basics/base_uint.h>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
 #include <sstream>
+#include <vector>
 
 /// This datastructure is used to keep track of the sequence of the most recent
 /// ledger validated by the network. There are two methods that will wait until
@@ -159,6 +170,199 @@ public:
     }
 };
 
+/// Bounded queue between one producer thread and one consumer thread.
+/// Pushing and popping are lock free while the queue is neither full nor
+/// empty. Only a thread that has to wait takes the mutex, and the other
+/// thread only wakes it when it is waiting, so handing over an element to a
+/// busy consumer costs no system call.
+/// @tparam T must be default constructible and move assignable
+template <class T>
+class SpscQueue
+{
+    std::vector<T> slots_;
+    // total number of elements popped and pushed. Each is written by one
+    // thread only
+    alignas(64) std::atomic_size_t head_ = 0;
+    alignas(64) std::atomic_size_t tail_ = 0;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::atomic_uint32_t waiters_ = 0;
+
+    template <class Pred>
+    void
+    waitFor(Pred ready)
+    {
+        if (ready())
+            return;
+        std::unique_lock lck{mtx_};
+        // the other thread checks waiters_ after it moved its index, so
+        // either it sees the increment or ready() sees the new index
+        ++waiters_;
+        cv_.wait(lck, ready);
+        --waiters_;
+    }
+
+    void
+    wake()
+    {
+        if (waiters_ == 0)
+            return;
+        // the waiter either has not checked ready() yet, or is waiting
+        {
+            std::lock_guard lck{mtx_};
+        }
+        cv_.notify_all();
+    }
+
+public:
+    /// @param maxSize maximum number of elements. Pushing to a full queue
+    /// blocks until an element is popped
+    explicit SpscQueue(size_t maxSize) : slots_(std::max<size_t>(maxSize, 1))
+    {
+    }
+
+    /// Push elt, blocking while the queue is full. Producer only
+    void
+    push(T&& elt)
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+        waitFor([this, tail]() { return tail - head_ < slots_.size(); });
+        slots_[tail % slots_.size()] = std::move(elt);
+        tail_ = tail + 1;
+        wake();
+    }
+
+    /// @return element popped from queue. Blocks until the queue is not
+    /// empty. Consumer only
+    T
+    pop()
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+        waitFor([this, head]() { return tail_ != head; });
+        T ret = std::move(slots_[head % slots_.size()]);
+        head_ = head + 1;
+        wake();
+        return ret;
+    }
+
+    /// @return element popped from queue, or empty if there is none.
+    /// Consumer only
+    std::optional<T>
+    tryPop()
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+        if (tail_ == head)
+            return {};
+        T ret = std::move(slots_[head % slots_.size()]);
+        head_ = head + 1;
+        wake();
+        return ret;
+    }
+};
+
+/// Elements handed by sequence from any number of producers to one consumer,
+/// which takes them in order. Producers claim sequences elsewhere, and each
+/// puts the element of the sequence it claimed into the slot of that
+/// sequence, without a lock. Only the consumer ever waits, and a producer
+/// only wakes it when it fills the slot the consumer is waiting for.
+/// @tparam T must be default constructible and move assignable
+template <class T>
+class ReadAheadRing
+{
+    struct Slot
+    {
+        std::atomic_bool ready = false;
+        T value;
+    };
+
+    static constexpr std::uint64_t none =
+        std::numeric_limits<std::uint64_t>::max();
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t const size_;
+    // the sequence the consumer waits for, if it waits
+    std::atomic_uint64_t waitingFor_ = none;
+    // no sequence from this one on is put
+    std::atomic_uint64_t end_ = none;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+
+    void
+    wake(std::uint64_t seq)
+    {
+        // the consumer stores waitingFor_ before it checks its slot, and
+        // producers load it after they fill theirs, so either the consumer
+        // sees the slot filled or the producer sees it waiting
+        if (waitingFor_ != seq)
+            return;
+        {
+            std::lock_guard lck{mtx_};
+        }
+        cv_.notify_one();
+    }
+
+public:
+    /// @param size number of slots. seq may only be put once the consumer
+    /// took seq - size
+    explicit ReadAheadRing(size_t size)
+        : slots_(new Slot[std::max<size_t>(size, 1)])
+        , size_(std::max<size_t>(size, 1))
+    {
+    }
+
+    size_t
+    size() const
+    {
+        return size_;
+    }
+
+    /// Put the element of seq. Producers only
+    void
+    put(std::uint64_t seq, T&& elt)
+    {
+        auto& slot = slots_[seq % size_];
+        slot.value = std::move(elt);
+        slot.ready = true;
+        wake(seq);
+    }
+
+    /// No element is put at seq or after it. The consumer takes a default
+    /// constructed element there
+    void
+    close(std::uint64_t seq)
+    {
+        std::uint64_t end = end_;
+        while (seq < end && !end_.compare_exchange_weak(end, seq))
+            ;
+        std::uint64_t const waiting = waitingFor_;
+        if (waiting != none && waiting >= seq)
+            wake(waiting);
+    }
+
+    /// @return element of seq, once it is put. Consumer only
+    T
+    take(std::uint64_t seq)
+    {
+        auto& slot = slots_[seq % size_];
+        auto ready = [&slot, seq, this]() { return slot.ready || seq >= end_; };
+        if (!ready())
+        {
+            std::unique_lock lck{mtx_};
+            waitingFor_ = seq;
+            cv_.wait(lck, ready);
+            waitingFor_ = none;
+        }
+        if (!slot.ready)
+            return T{};
+        T ret = std::move(slot.value);
+        slot.value = T{};
+        slot.ready = false;
+        return ret;
+    }
+};
+
 /// Parititions the uint256 keyspace into numMarkers partitions, each of equal
 /// size.
 inline std::vector<ripple::uint256>
@@ -179,4 +383,303 @@ getMarkers(size_t numMarkers)
     return markers;
 }
 
+/// Key halfway between a and b, rounded down. Used to split a marker range
+/// that is lagging behind the others in two
+inline ripple::uint256
+midpoint(ripple::uint256 const& a, ripple::uint256 const& b)
+{
+    // keys are big endian, so add from the last byte, then halve from the
+    // first byte, carrying the bit that overflowed the addition
+    ripple::uint256 sum;
+    unsigned carry = 0;
+    for (size_t i = sum.size(); i-- > 0;)
+    {
+        unsigned byte = a.data()[i] + b.data()[i] + carry;
+        sum.data()[i] = byte & 0xff;
+        carry = byte >> 8;
+    }
+    for (size_t i = 0; i < sum.size(); ++i)
+    {
+        unsigned byte = (carry << 8) | sum.data()[i];
+        sum.data()[i] = byte >> 1;
+        carry = byte & 1;
+    }
+    return sum;
+}
+
+/// Latency of one stage of the ETL pipeline, over every ledger that went
+/// through it. Safe to update from one thread while others report it
+class StageTimer
+{
+    std::atomic_uint64_t count_ = 0;
+    std::atomic_uint64_t totalMicros_ = 0;
+    std::atomic_uint64_t maxMicros_ = 0;
+    std::atomic_uint64_t lastMicros_ = 0;
+
+public:
+    void
+    add(std::chrono::steady_clock::duration duration)
+    {
+        uint64_t micros =
+            std::chrono::duration_cast<std::chrono::microseconds>(duration)
+                .count();
+        ++count_;
+        totalMicros_ += micros;
+        lastMicros_ = micros;
+        auto max = maxMicros_.load();
+        while (micros > max && !maxMicros_.compare_exchange_weak(max, micros))
+            ;
+    }
+
+    uint64_t
+    totalMicros() const
+    {
+        return totalMicros_;
+    }
+
+    boost::json::object
+    report() const
+    {
+        boost::json::object report;
+        auto count = count_.load();
+        report["count"] = count;
+        report["last_us"] = lastMicros_.load();
+        report["max_us"] = maxMicros_.load();
+        report["avg_us"] = count ? totalMicros_.load() / count : 0;
+        return report;
+    }
+};
+
+/// Remembers recently seen 64 bit fingerprints, to drop messages received
+/// more than once. Lock free. A fingerprint is forgotten once others took its
+/// place, which takes at least about as many insertions as there are buckets
+class RecentFilter
+{
+    static constexpr size_t bucketSize = 4;
+
+    std::vector<std::atomic_uint64_t> slots_;
+    size_t mask_ = 0;
+
+public:
+    /// @param numBuckets rounded up to a power of two
+    explicit RecentFilter(size_t numBuckets = 1 << 14)
+    {
+        size_t buckets = 1;
+        while (buckets < numBuckets)
+            buckets *= 2;
+        slots_ = std::vector<std::atomic_uint64_t>(buckets * bucketSize);
+        mask_ = buckets - 1;
+    }
+
+    /// Insert fingerprint. Concurrent insertions of the same fingerprint
+    /// race for the same slot, so only one of them is new
+    /// @return true if fingerprint was not seen recently
+    bool
+    insert(uint64_t fingerprint)
+    {
+        // 0 marks an empty slot
+        fingerprint = std::max<uint64_t>(fingerprint, 1);
+        std::atomic_uint64_t* bucket =
+            &slots_[(fingerprint & mask_) * bucketSize];
+        for (size_t i = 0; i < bucketSize; ++i)
+        {
+            uint64_t current = bucket[i].load();
+            if (current == 0 && bucket[i].compare_exchange_strong(
+                                    current, fingerprint))
+                return true;
+            if (current == fingerprint)
+                return false;
+        }
+        // the bucket is full. the slot to replace is picked by bits of the
+        // fingerprint not used by the bucket index, so it is the same for
+        // every insertion of this fingerprint
+        auto& slot = bucket[(fingerprint >> 32) % bucketSize];
+        uint64_t current = slot.load();
+        while (current != fingerprint)
+        {
+            if (slot.compare_exchange_weak(current, fingerprint))
+                return true;
+        }
+        return false;
+    }
+};
+
+/// Moving averages of the latency and error rate of the requests made to one
+/// ETL source, used to prefer fast and healthy sources
+class SourceScore
+{
+    mutable std::mutex mtx_;
+    // in microseconds, over successful requests only. Failures are often
+    // fast, such as a refused connection, and say nothing about latency
+    double latency_ = 0;
+    double errorRate_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t failures_ = 0;
+    uint64_t hedges_ = 0;
+    // latest latencies in microseconds, for percentiles
+    std::vector<uint32_t> samples_;
+    size_t nextSample_ = 0;
+
+    static constexpr double alpha = 0.125;
+    static constexpr size_t maxSamples = 128;
+    // a percentile is not trusted before this many samples
+    static constexpr size_t minSamples = 16;
+    // cost of a failure, as latency
+    static constexpr double failureMicros = 1'000'000;
+
+public:
+    void
+    record(std::chrono::steady_clock::duration duration, bool success)
+    {
+        std::lock_guard lck{mtx_};
+        ++requests_;
+        double const failed = success ? 0 : 1;
+        errorRate_ = requests_ == 1
+            ? failed
+            : errorRate_ + alpha * (failed - errorRate_);
+        if (!success)
+        {
+            ++failures_;
+            return;
+        }
+        auto micros =
+            std::chrono::duration_cast<std::chrono::microseconds>(duration)
+                .count();
+        latency_ = requests_ - failures_ == 1
+            ? micros
+            : latency_ + alpha * (micros - latency_);
+        if (samples_.size() < maxSamples)
+            samples_.push_back(micros);
+        else
+            samples_[nextSample_] = micros;
+        nextSample_ = (nextSample_ + 1) % maxSamples;
+    }
+
+    /// Record that a request to this source was hedged, because it took
+    /// longer than usual
+    void
+    hedged()
+    {
+        std::lock_guard lck{mtx_};
+        ++hedges_;
+    }
+
+    /// @return expected cost of a request, in microseconds. Lower is better.
+    /// Zero for a source that was not tried yet, so that every source gets
+    /// tried
+    double
+    cost() const
+    {
+        std::lock_guard lck{mtx_};
+        return latency_ + errorRate_ * failureMicros;
+    }
+
+    /// @return 95th percentile of the latency. empty until enough requests
+    /// succeeded
+    std::optional<std::chrono::microseconds>
+    p95() const
+    {
+        std::vector<uint32_t> samples;
+        {
+            std::lock_guard lck{mtx_};
+            if (samples_.size() < minSamples)
+                return {};
+            samples = samples_;
+        }
+        auto nth = samples.begin() + samples.size() * 95 / 100;
+        std::nth_element(samples.begin(), nth, samples.end());
+        return std::chrono::microseconds{*nth};
+    }
+
+    boost::json::object
+    report() const
+    {
+        boost::json::object report;
+        {
+            std::lock_guard lck{mtx_};
+            report["latency_us"] = static_cast<uint64_t>(latency_);
+            report["error_rate"] = errorRate_;
+            report["requests"] = requests_;
+            report["failures"] = failures_;
+            report["hedges"] = hedges_;
+        }
+        report["cost"] = cost();
+        if (auto p = p95())
+            report["p95_latency_us"] = p->count();
+        return report;
+    }
+};
+
+/// Calls f(i) for every i in [0, n) on a thread pool, split into at most
+/// maxChunks contiguous chunks of at least minChunk indexes. The calls of one
+/// chunk are made in order, but chunks run concurrently with each other and
+/// with the caller. The destructor waits for every chunk, so f may refer to
+/// locals of the caller, though f itself is copied
+class ParallelFor
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    std::vector<std::future<clock::time_point>> chunks_;
+
+public:
+    template <class F>
+    ParallelFor(
+        boost::asio::thread_pool& pool,
+        size_t n,
+        size_t maxChunks,
+        size_t minChunk,
+        F const& f)
+    {
+        size_t numChunks = std::min(
+            std::max<size_t>(maxChunks, 1),
+            (n + std::max<size_t>(minChunk, 1) - 1) /
+                std::max<size_t>(minChunk, 1));
+        chunks_.reserve(numChunks);
+        auto shared = std::make_shared<F>(f);
+        for (size_t i = 0; i < numChunks; ++i)
+        {
+            size_t begin = n * i / numChunks;
+            size_t end = n * (i + 1) / numChunks;
+            std::packaged_task<clock::time_point()> task{
+                [shared, begin, end]() {
+                    for (size_t j = begin; j < end; ++j)
+                        (*shared)(j);
+                    return clock::now();
+                }};
+            chunks_.push_back(task.get_future());
+            boost::asio::post(pool, std::move(task));
+        }
+    }
+
+    ParallelFor(ParallelFor&&) = default;
+
+    /// Wait for every chunk, and rethrow the first exception thrown by f
+    /// @return the time the last chunk finished
+    clock::time_point
+    wait()
+    {
+        clock::time_point last = clock::now();
+        if (!chunks_.empty())
+            last = {};
+        for (auto& chunk : chunks_)
+        {
+            if (chunk.valid())
+                last = std::max(last, chunk.get());
+        }
+        chunks_.clear();
+        return last;
+    }
+
+    ~ParallelFor()
+    {
+        for (auto& chunk : chunks_)
+        {
+            if (chunk.valid())
+                chunk.wait();
+        }
+    }
+};
+
 #endif
@@ -9,6 +9,8 @@
 #include <backend/DBHelpers.h>
 #include <etl/ETLSource.h>
 #include <etl/ReportingETL.h>
+#include <etl/StreamMessage.h>
+#include <cstring>
 #include <thread>
 
 // Create ETL source without grpc endpoint
@@ -40,6 +42,7 @@ ETLSourceImpl<Derived>::ETLSourceImpl(
         auto portjs = config.at("ws_port").as_string();
         wsPort_ = {portjs.c_str(), portjs.size()};
     }
+    forwardPool_ = std::make_unique<ForwardPool>(ioc_, ip_, wsPort_);
     if (config.contains("grpc_port"))
     {
         auto portjs = config.at("grpc_port").as_string();
@@ -69,6 +72,8 @@ void
 ETLSourceImpl<Derived>::reconnect(boost::beast::error_code ec)
 {
     connected_ = false;
+    // connections that forward requests are most likely broken as well
+    forwardPool_->clear();
     // These are somewhat normal errors. operation_aborted occurs on shutdown,
     // when the timer is cancelled. connection_refused will occur repeatedly
     std::string err = ec.message();
@@ -403,81 +408,74 @@ ETLSourceImpl<Derived>::handleMessage()
     connected_ = true;
     try
     {
-        std::string msg{
+        // the only copy of the message. Messages that are relayed to clients
+        // are published as they are
+        auto msg = std::make_shared<std::string const>(
             static_cast<char const*>(readBuffer_.data().data()),
-            readBuffer_.size()};
-        BOOST_LOG_TRIVIAL(trace) << __func__ << msg;
-        boost::json::value raw = boost::json::parse(msg);
-        BOOST_LOG_TRIVIAL(trace) << __func__ << " parsed";
-        boost::json::object response = raw.as_object();
+            readBuffer_.size());
+        BOOST_LOG_TRIVIAL(trace) << __func__ << *msg;
+        auto response = scanStreamMessage(*msg);
+        if (!response)
+            throw std::runtime_error("malformed message");
+        BOOST_LOG_TRIVIAL(trace) << __func__ << " scanned";
 
         uint32_t ledgerIndex = 0;
-        if (response.contains("result"))
+        if (!response->result.empty())
         {
-            boost::json::object result = response["result"].as_object();
-            if (result.contains("ledger_index"))
+            auto result = scanStreamMessage(response->result);
+            if (!result)
+                throw std::runtime_error("malformed result");
+            if (result->ledgerIndex)
             {
-                ledgerIndex = result["ledger_index"].as_int64();
+                ledgerIndex = *result->ledgerIndex;
             }
-            if (result.contains("validated_ledgers"))
+            if (!result->validatedLedgers.empty())
             {
-                boost::json::string const& validatedLedgers =
-                    result["validated_ledgers"].as_string();
-
-                setValidatedRange(
-                    {validatedLedgers.c_str(), validatedLedgers.size()});
+                setValidatedRange(std::string{result->validatedLedgers});
             }
             BOOST_LOG_TRIVIAL(debug)
                 << __func__ << " : "
                 << "Received a message on ledger "
-                << " subscription stream. Message : " << response << " - "
+                << " subscription stream. Message : " << *msg << " - "
                 << toString();
         }
-        else if (
-            response.contains("type") && response["type"] == "ledgerClosed")
+        else if (response->type == "ledgerClosed")
         {
             BOOST_LOG_TRIVIAL(debug)
                 << __func__ << " : "
                 << "Received a message on ledger "
-                << " subscription stream. Message : " << response << " - "
+                << " subscription stream. Message : " << *msg << " - "
                 << toString();
-            if (response.contains("ledger_index"))
+            if (response->ledgerIndex)
             {
-                ledgerIndex = response["ledger_index"].as_int64();
+                ledgerIndex = *response->ledgerIndex;
             }
-            if (response.contains("validated_ledgers"))
+            if (!response->validatedLedgers.empty())
             {
-                boost::json::string const& validatedLedgers =
-                    response["validated_ledgers"].as_string();
-                setValidatedRange(
-                    {validatedLedgers.c_str(), validatedLedgers.size()});
+                setValidatedRange(std::string{response->validatedLedgers});
             }
         }
-        else
+        else if (!response->transaction.empty())
         {
-            if (balancer_.shouldPropagateTxnStream(this))
+            auto transaction = scanStreamMessage(response->transaction);
+            if (transaction &&
+                balancer_.isFirstArrival(
+                    transaction->hash, response->validated))
             {
-                if (response.contains("transaction"))
-                {
-                    // std::cout << "FORWARDING TX" << std::endl;
-                    subscriptions_->forwardProposedTransaction(response);
-                }
-                else if (
-                    response.contains("type") &&
-                    response["type"] == "validationReceived")
-                {
-                    // std::cout << "FORWARDING VAL" << std::endl;
-                    subscriptions_->forwardValidation(response);
-                }
-                else if (
-                    response.contains("type") &&
-                    response["type"] == "manifestReceived")
-                {
-                    // std::cout << "FORWARDING MAN" << std::endl;
-                    subscriptions_->forwardManifest(response);
-                }
+                subscriptions_->forwardProposedTransaction(
+                    msg, response->transaction);
             }
         }
+        else if (response->type == "validationReceived")
+        {
+            if (balancer_.isFirstArrival(response->signature))
+                subscriptions_->forwardValidation(msg);
+        }
+        else if (response->type == "manifestReceived")
+        {
+            if (balancer_.isFirstArrival(response->signature))
+                subscriptions_->forwardManifest(msg);
+        }
 
         if (ledgerIndex != 0)
         {
@@ -496,60 +494,302 @@ ETLSourceImpl<Derived>::handleMessage()
     }
 }
 
+namespace {
+// position of a key in the keyspace, as a fraction in [0, 1)
+double
+keyPosition(unsigned char const* key, size_t size)
+{
+    double pos = 0;
+    double scale = 1;
+    for (size_t i = 0; i < std::min<size_t>(size, 8); ++i)
+    {
+        scale /= 256;
+        pos += key[i] * scale;
+    }
+    return pos;
+}
+
+double
+rangeBegin(LedgerDownload::Range const& range)
+{
+    return keyPosition(range.start.data(), range.start.size());
+}
+
+double
+rangeEnd(LedgerDownload::Range const& range)
+{
+    if (!range.next)
+        return 1;
+    return keyPosition(range.next->data(), range.next->size());
+}
+
+// first key of range that is not fetched yet
+ripple::uint256
+resumeKey(LedgerDownload::Range const& range)
+{
+    if (auto cursor = ripple::uint256::fromVoidChecked(range.cursor))
+        return *cursor;
+    return range.start;
+}
+
+void
+updateWritten(LedgerDownload::Range& range)
+{
+    if (range.done)
+    {
+        range.written = 1;
+    }
+    else if (range.cursor.size())
+    {
+        double begin = rangeBegin(range);
+        double end = rangeEnd(range);
+        double cur = keyPosition(
+            reinterpret_cast<unsigned char const*>(range.cursor.data()),
+            range.cursor.size());
+        range.written = std::clamp((cur - begin) / (end - begin), 0.0, 1.0);
+    }
+}
+
+// whether key, of an object or a marker, is before end, the end of a range
+bool
+beforeEnd(std::string const& key, std::optional<ripple::uint256> const& end)
+{
+    return !end ||
+        (key.size() == end->size() &&
+         std::memcmp(key.data(), end->data(), key.size()) < 0);
+}
+}  // namespace
+
+size_t
+LedgerDownload::countFinished() const
+{
+    return std::count_if(ranges_.begin(), ranges_.end(), [](auto& r) {
+        return r.done.load();
+    });
+}
+
+LedgerDownload::Range*
+LedgerDownload::claim()
+{
+    std::lock_guard lck{mtx_};
+    for (auto& range : ranges_)
+    {
+        if (!range.claimed && !range.done)
+        {
+            range.claimed = true;
+            return &range;
+        }
+    }
+
+    Range* widest = nullptr;
+    double widestLeft = minSplitWidth;
+    for (auto& range : ranges_)
+    {
+        if (range.fetched)
+            continue;
+        auto from = resumeKey(range);
+        double left = rangeEnd(range) - keyPosition(from.data(), from.size());
+        if (left > widestLeft)
+        {
+            widest = &range;
+            widestLeft = left;
+        }
+    }
+    if (!widest)
+        return nullptr;
+
+    // the stream fetching widest skips any object it receives past the new
+    // end, so only keys after its cursor are handed over
+    auto mid = midpoint(
+        resumeKey(*widest), widest->next.value_or(Backend::lastKey));
+    auto& half = ranges_.emplace_back();
+    half.start = mid;
+    half.next = widest->next;
+    half.claimed = true;
+    widest->next = mid;
+    updateWritten(*widest);
+    ++numSplits_;
+    BOOST_LOG_TRIVIAL(debug)
+        << __func__ << " - split range at " << ripple::strHex(mid)
+        << ". keyspace left = " << widestLeft
+        << ". ranges = " << ranges_.size();
+    return &half;
+}
+
+void
+LedgerDownload::release(Range& range)
+{
+    std::lock_guard lck{mtx_};
+    range.claimed = false;
+}
+
+bool
+LedgerDownload::advance(
+    Range& range,
+    std::string const& marker,
+    std::optional<ripple::uint256>& end)
+{
+    std::lock_guard lck{mtx_};
+    end = range.next;
+    // if no marker returned, or the marker is past our end, we are done
+    if (marker.size() && beforeEnd(marker, range.next))
+        range.cursor = marker;
+    else
+        range.fetched = true;
+    return !range.fetched;
+}
+
+uint64_t
+LedgerDownload::addPage(Range& range, uint64_t count, bool last)
+{
+    std::lock_guard lck{mtx_};
+    if (last)
+        range.done = true;
+    updateWritten(range);
+    return numObjects_ += count;
+}
+
+bool
+LedgerDownload::finish()
+{
+    std::lock_guard lck{mtx_};
+    if (finished_ || countFinished() < ranges_.size())
+        return false;
+    finished_ = true;
+    return true;
+}
+
+double
+LedgerDownload::progress() const
+{
+    std::lock_guard lck{mtx_};
+    double total = 0;
+    for (auto const& range : ranges_)
+        total += range.written * (rangeEnd(range) - rangeBegin(range));
+    return std::clamp(total, 0.0, 1.0);
+}
+
+boost::json::object
+LedgerDownload::stagesJson() const
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    auto objects = numObjects_.load();
+    auto rate = [objects](uint64_t micros) {
+        return micros ? objects * 1000000 / micros : 0;
+    };
+
+    boost::json::object ret;
+    ret["objects"] = objects;
+    ret["megabytes"] = numBytes_ / 1000000;
+    ret["elapsed_seconds"] = elapsed / 1000000;
+    ret["objects_per_second"] = rate(elapsed);
+    auto add = [&](char const* name, StageTimer const& stage) {
+        auto report = stage.report();
+        report["seconds"] = stage.totalMicros() / 1000000;
+        report["objects_per_second"] = rate(stage.totalMicros());
+        ret[name] = std::move(report);
+    };
+    add("receive", stages_.receive);
+    add("handoff", stages_.handoff);
+    add("parse", stages_.parse);
+    add("write", stages_.write);
+    add("cache", stages_.cache);
+    return ret;
+}
+
+boost::json::object
+LedgerDownload::toJson() const
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    double done = progress();
+
+    std::lock_guard lck{mtx_};
+    auto finished = countFinished();
+    boost::json::object ret;
+    ret["sequence"] = sequence_;
+    ret["objects"] = numObjects_.load();
+    ret["markers"] = ranges_.size();
+    ret["markers_finished"] = finished;
+    ret["markers_split"] = numSplits_.load();
+    ret["percent"] = done * 100;
+    ret["elapsed_seconds"] = elapsed;
+    if (done > 0 && finished < ranges_.size())
+        ret["eta_seconds"] = static_cast<int64_t>(elapsed * (1 - done) / done);
+    return ret;
+}
+
 class AsyncCallData
 {
-    std::unique_ptr<org::xrpl::rpc::v1::GetLedgerDataResponse> cur_;
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// A page received for a range, to be written by the write stage
+    struct Page
+    {
+        AsyncCallData* call;
+        std::unique_ptr<org::xrpl::rpc::v1::GetLedgerDataResponse> response;
+        // end of the range when the page was received
+        std::optional<ripple::uint256> end;
+        bool last;
+    };
+
+private:
     std::unique_ptr<org::xrpl::rpc::v1::GetLedgerDataResponse> next_;
 
     org::xrpl::rpc::v1::GetLedgerDataRequest request_;
     std::unique_ptr<grpc::ClientContext> context_;
 
     grpc::Status status_;
-    unsigned char nextPrefix_;
 
-    std::string lastKey_;
+    std::reference_wrapper<LedgerDownload> download_;
+    std::reference_wrapper<LedgerDownload::Range> range_;
 
 public:
-    AsyncCallData(
-        uint32_t seq,
-        ripple::uint256 const& marker,
-        std::optional<ripple::uint256> const& nextMarker)
+    AsyncCallData(LedgerDownload& download, LedgerDownload::Range& range)
+        : download_(download), range_(range)
     {
-        request_.mutable_ledger()->set_sequence(seq);
-        if (marker.isNonZero())
+        request_.mutable_ledger()->set_sequence(download.sequence());
+        // resume from where a previous attempt stopped, if any
+        if (range.cursor.size())
+        {
+            request_.set_marker(range.cursor);
+        }
+        else if (range.start.isNonZero())
         {
-            request_.set_marker(marker.data(), marker.size());
+            request_.set_marker(range.start.data(), range.start.size());
         }
         request_.set_user("ETL");
-        nextPrefix_ = 0x00;
-        if (nextMarker)
-            nextPrefix_ = nextMarker->data()[0];
-
-        unsigned char prefix = marker.data()[0];
 
         BOOST_LOG_TRIVIAL(debug)
-            << "Setting up AsyncCallData. marker = " << ripple::strHex(marker)
-            << " . prefix = " << ripple::strHex(std::string(1, prefix))
-            << " . nextPrefix_ = "
-            << ripple::strHex(std::string(1, nextPrefix_));
-
-        assert(nextPrefix_ > prefix || nextPrefix_ == 0x00);
-
-        cur_ = std::make_unique<org::xrpl::rpc::v1::GetLedgerDataResponse>();
+            << "Setting up AsyncCallData. marker = "
+            << ripple::strHex(request_.marker()) << " . end = "
+            << (range.next ? ripple::strHex(*range.next) : "none");
 
         next_ = std::make_unique<org::xrpl::rpc::v1::GetLedgerDataResponse>();
 
         context_ = std::make_unique<grpc::ClientContext>();
     }
 
+    LedgerDownload::Range&
+    range()
+    {
+        return range_;
+    }
+
     enum class CallStatus { MORE, DONE, ERRORED };
+
+    /// Take the page that was received, and request the next one if the
+    /// range has more. The page is left in page, for write() to process
     CallStatus
     process(
         std::unique_ptr<org::xrpl::rpc::v1::XRPLedgerAPIService::Stub>& stub,
         grpc::CompletionQueue& cq,
-        BackendInterface& backend,
         bool abort,
-        bool cacheOnly = false)
+        Page& page)
     {
         BOOST_LOG_TRIVIAL(trace) << "Processing response. "
                                  << "Marker prefix = " << getMarkerPrefix();
@@ -573,59 +813,80 @@ public:
                    "secure_gateway is set correctly at the ETL source";
         }
 
-        std::swap(cur_, next_);
-
-        bool more = true;
-
-        // if no marker returned, we are done
-        if (cur_->marker().size() == 0)
-            more = false;
+        page.call = this;
+        page.response = std::move(next_);
+        next_ = std::make_unique<org::xrpl::rpc::v1::GetLedgerDataResponse>();
 
-        // if returned marker is greater than our end, we are done
-        unsigned char prefix = cur_->marker()[0];
-        if (nextPrefix_ != 0x00 && prefix >= nextPrefix_)
-            more = false;
+        // the end is read again for every page, since the range may have
+        // been split by another stream since the page was requested
+        auto const& marker = page.response->marker();
+        bool more = download_.get().advance(range_, marker, page.end);
+        page.last = !more;
 
         // if we are not done, make the next async call
         if (more)
         {
-            request_.set_marker(std::move(cur_->marker()));
+            request_.set_marker(marker);
             call(stub, cq);
         }
 
-        BOOST_LOG_TRIVIAL(trace) << "Writing objects";
+        return more ? CallStatus::MORE : CallStatus::DONE;
+    }
+
+    /// Write the objects of page, which was received for this call. The
+    /// pages of a call must be written in order, from one thread
+    void
+    write(Page& page, BackendInterface& backend, bool cacheOnly)
+    {
+        auto& download = download_.get();
+        auto& stages = download.stages();
+        auto& range = range_.get();
+        auto sequence = request_.ledger().sequence();
+        auto& objects = *page.response->mutable_ledger_objects();
+
+        auto start = clock::now();
         std::vector<Backend::LedgerObject> cacheUpdates;
-        cacheUpdates.reserve(cur_->ledger_objects().objects_size());
-        for (int i = 0; i < cur_->ledger_objects().objects_size(); ++i)
+        cacheUpdates.reserve(objects.objects_size());
+        for (auto const& obj : objects.objects())
         {
-            auto& obj = *(cur_->mutable_ledger_objects()->mutable_objects(i));
-            if (!more && nextPrefix_ != 0x00)
-            {
-                if (((unsigned char)obj.key()[0]) >= nextPrefix_)
-                    continue;
-            }
+            // objects are sorted by key
+            if (!beforeEnd(obj.key(), page.end))
+                break;
             cacheUpdates.push_back(
                 {*ripple::uint256::fromVoidChecked(obj.key()),
-                 {obj.mutable_data()->begin(), obj.mutable_data()->end()}});
-            if (!cacheOnly)
+                 {obj.data().begin(), obj.data().end()}});
+            download.addBytes(obj.key().size() + obj.data().size());
+        }
+        auto parsed = clock::now();
+        stages.parse.add(parsed - start);
+
+        BOOST_LOG_TRIVIAL(trace) << "Writing objects";
+        if (!cacheOnly)
+        {
+            for (size_t i = 0; i < cacheUpdates.size(); ++i)
             {
-                if (lastKey_.size())
+                auto& obj = *objects.mutable_objects(i);
+                if (range.lastKey.size())
                     backend.writeSuccessor(
-                        std::move(lastKey_),
-                        request_.ledger().sequence(),
+                        std::move(range.lastKey),
+                        sequence,
                         std::string{obj.key()});
-                lastKey_ = obj.key();
+                range.lastKey = obj.key();
                 backend.writeLedgerObject(
                     std::move(*obj.mutable_key()),
-                    request_.ledger().sequence(),
+                    sequence,
                     std::move(*obj.mutable_data()));
             }
         }
-        backend.cache().update(
-            cacheUpdates, request_.ledger().sequence(), cacheOnly);
+        auto written = clock::now();
+        stages.write.add(written - parsed);
+
+        auto numObjects = cacheUpdates.size();
+        backend.cache().update(cacheUpdates, sequence, cacheOnly);
+        stages.cache.add(clock::now() - written);
         BOOST_LOG_TRIVIAL(trace) << "Wrote objects";
 
-        return more ? CallStatus::MORE : CallStatus::DONE;
+        download.addPage(range, numObjects, page.last);
     }
 
     void
@@ -652,167 +913,240 @@ public:
         else
             return ripple::strHex(std::string{next_->marker().data()[0]});
     }
-
-    std::string
-    getLastKey()
-    {
-        return lastKey_;
-    }
 };
 
 template <class Derived>
 bool
 ETLSourceImpl<Derived>::loadInitialLedger(
-    uint32_t sequence,
-    uint32_t numMarkers,
-    bool cacheOnly)
+    LedgerDownload& download,
+    bool cacheOnly,
+    uint32_t numThreads,
+    uint32_t numStreams)
 {
     if (!stub_)
         return false;
 
-    grpc::CompletionQueue cq;
-
-    void* tag;
+    auto sequence = download.sequence();
 
-    bool ok = false;
+    numStreams = std::max<uint32_t>(numStreams, 1);
+    numThreads = std::clamp<uint32_t>(numThreads, 1, numStreams);
 
-    std::vector<AsyncCallData> calls;
-    auto markers = getMarkers(numMarkers);
+    BOOST_LOG_TRIVIAL(debug) << "Starting data download for ledger " << sequence
+                             << ". Using source = " << toString()
+                             << ". Finished markers = "
+                             << download.numFinished() << "/"
+                             << download.numRanges()
+                             << ". Streams = " << numStreams
+                             << ". Threads = " << numThreads;
+
+    std::atomic_bool abort = false;
+    uint64_t incr = 500000;
+    std::atomic_uint64_t progress = incr;
+
+    // each thread drives its own completion queue, with a share of the
+    // streams. A stream that finishes its range claims another one from the
+    // download, which may be the unfetched half of a lagging range. The
+    // pages are written by a separate thread per queue, so that the queue
+    // keeps requesting pages while the previous ones are written
+    auto work = [&](size_t worker) {
+        using clock = AsyncCallData::clock;
+        auto& stages = download.stages();
+
+        grpc::CompletionQueue cq;
+
+        void* tag;
+
+        bool ok = false;
+
+        std::vector<std::unique_ptr<AsyncCallData>> calls;
+        // ranges whose stream failed. They are released once everything
+        // received for them is written
+        std::vector<LedgerDownload::Range*> failed;
+        auto startCall = [&]() {
+            if (abort)
+                return false;
+            auto range = download.claim();
+            if (!range)
+                return false;
+            calls.push_back(std::make_unique<AsyncCallData>(download, *range));
+            calls.back()->call(stub_, cq);
+            return true;
+        };
+
+        size_t numSlots = numStreams / numThreads +
+            (worker < numStreams % numThreads ? 1 : 0);
+
+        // pages are written in the order they are received, which is the
+        // order of each range. empty marks the end
+        SpscQueue<std::optional<AsyncCallData::Page>> pages(2 * numSlots);
+        std::thread writer{[&]() {
+            while (auto page = pages.pop())
+            {
+                page->call->write(*page, *backend_, cacheOnly);
+                auto target = progress.load();
+                if (download.numObjects() > target &&
+                    progress.compare_exchange_strong(target, target + incr))
+                {
+                    BOOST_LOG_TRIVIAL(info)
+                        << "Downloaded " << download.numObjects()
+                        << " records from rippled. " << download.toJson();
+                }
+            }
+        }};
 
-    for (size_t i = 0; i < markers.size(); ++i)
-    {
-        std::optional<ripple::uint256> nextMarker;
-        if (i + 1 < markers.size())
-            nextMarker = markers[i + 1];
-        calls.emplace_back(sequence, markers[i], nextMarker);
-    }
+        size_t numActive = 0;
+        while (numActive < numSlots && startCall())
+            ++numActive;
 
-    BOOST_LOG_TRIVIAL(debug) << "Starting data download for ledger " << sequence
-                             << ". Using source = " << toString();
+        auto waitStart = clock::now();
+        while (numActive && cq.Next(&tag, &ok))
+        {
+            auto received = clock::now();
+            stages.receive.add(received - waitStart);
 
-    for (auto& c : calls)
-        c.call(stub_, cq);
+            assert(tag);
 
-    size_t numFinished = 0;
-    bool abort = false;
-    size_t incr = 500000;
-    size_t progress = incr;
-    std::vector<std::string> edgeKeys;
-    while (numFinished < calls.size() && cq.Next(&tag, &ok))
-    {
-        assert(tag);
+            auto ptr = static_cast<AsyncCallData*>(tag);
 
-        auto ptr = static_cast<AsyncCallData*>(tag);
+            if (!ok)
+            {
+                BOOST_LOG_TRIVIAL(error) << "loadInitialLedger - ok is false";
+                abort = true;
+                failed.push_back(&ptr->range());
+                --numActive;
+                waitStart = clock::now();
+                continue;
+            }
 
-        if (!ok)
-        {
-            BOOST_LOG_TRIVIAL(error) << "loadInitialLedger - ok is false";
-            return false;
-            // handle cancelled
-        }
-        else
-        {
             BOOST_LOG_TRIVIAL(trace)
                 << "Marker prefix = " << ptr->getMarkerPrefix();
-            auto result = ptr->process(stub_, cq, *backend_, abort, cacheOnly);
-            if (result != AsyncCallData::CallStatus::MORE)
+            AsyncCallData::Page page;
+            auto result = ptr->process(stub_, cq, abort, page);
+            if (result != AsyncCallData::CallStatus::ERRORED)
+            {
+                auto handoff = clock::now();
+                pages.push(std::move(page));
+                stages.handoff.add(clock::now() - handoff);
+            }
+            if (result == AsyncCallData::CallStatus::DONE)
             {
-                numFinished++;
                 BOOST_LOG_TRIVIAL(debug)
-                    << "Finished a marker. "
-                    << "Current number of finished = " << numFinished;
-                std::string lastKey = ptr->getLastKey();
-                if (lastKey.size())
-                    edgeKeys.push_back(ptr->getLastKey());
+                    << "Received the last page of a marker. "
+                    << "Current number of finished = "
+                    << download.numFinished();
+                if (!startCall())
+                    --numActive;
             }
             if (result == AsyncCallData::CallStatus::ERRORED)
             {
                 abort = true;
+                failed.push_back(&ptr->range());
+                --numActive;
             }
-            if (backend_->cache().size() > progress)
-            {
-                BOOST_LOG_TRIVIAL(info)
-                    << "Downloaded " << backend_->cache().size()
-                    << " records from rippled";
-                progress += incr;
-            }
+            waitStart = clock::now();
         }
+
+        pages.push({});
+        writer.join();
+        for (auto range : failed)
+            download.release(*range);
+    };
+
+    if (numThreads == 1)
+    {
+        work(0);
     }
+    else
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < numThreads; ++i)
+            threads.emplace_back(work, i);
+        for (auto& t : threads)
+            t.join();
+    }
+
     BOOST_LOG_TRIVIAL(info)
-        << __func__ << " - finished loadInitialLedger. cache size = "
-        << backend_->cache().size();
+        << __func__ << " - finished loadInitialLedger. source = " << toString()
+        << ". cache size = " << backend_->cache().size() << ". "
+        << download.toJson();
+    // other sources may still be fetching. Whichever finishes the last range
+    // writes the edge successors
+    if (abort || !download.finish())
+        return !abort;
+    BOOST_LOG_TRIVIAL(info) << __func__ << " - downloaded every marker. "
+                            << "Stages = " << download.stagesJson();
+    backend_->cache().setFull();
     size_t numWrites = 0;
-    if (!abort)
+    if (!cacheOnly)
     {
-        backend_->cache().setFull();
-        if (!cacheOnly)
+        auto start = std::chrono::system_clock::now();
+        for (auto& range : download.ranges())
         {
-            auto start = std::chrono::system_clock::now();
-            for (auto& key : edgeKeys)
-            {
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__
-                    << " writing edge key = " << ripple::strHex(key);
-                auto succ = backend_->cache().getSuccessor(
-                    *ripple::uint256::fromVoidChecked(key), sequence);
-                if (succ)
-                    backend_->writeSuccessor(
-                        std::move(key), sequence, uint256ToString(succ->key));
-            }
-            ripple::uint256 prev = Backend::firstKey;
-            while (auto cur = backend_->cache().getSuccessor(prev, sequence))
+            if (!range.lastKey.size())
+                continue;
+            auto& key = range.lastKey;
+            BOOST_LOG_TRIVIAL(debug)
+                << __func__
+                << " writing edge key = " << ripple::strHex(key);
+            auto succ = backend_->cache().getSuccessor(
+                *ripple::uint256::fromVoidChecked(key), sequence);
+            if (succ)
+                backend_->writeSuccessor(
+                    std::move(key), sequence, uint256ToString(succ->key));
+        }
+        ripple::uint256 prev = Backend::firstKey;
+        while (auto cur = backend_->cache().getSuccessor(prev, sequence))
+        {
+            assert(cur);
+            if (prev == Backend::firstKey)
+                backend_->writeSuccessor(
+                    uint256ToString(prev),
+                    sequence,
+                    uint256ToString(cur->key));
+            if (isBookDir(cur->key, cur->blob))
             {
-                assert(cur);
-                if (prev == Backend::firstKey)
-                    backend_->writeSuccessor(
-                        uint256ToString(prev),
-                        sequence,
-                        uint256ToString(cur->key));
-                if (isBookDir(cur->key, cur->blob))
+                auto base = getBookBase(cur->key);
+                // make sure the base is not an actual object
+                if (!backend_->cache().get(cur->key, sequence))
                 {
-                    auto base = getBookBase(cur->key);
-                    // make sure the base is not an actual object
-                    if (!backend_->cache().get(cur->key, sequence))
+                    auto succ =
+                        backend_->cache().getSuccessor(base, sequence);
+                    assert(succ);
+                    if (succ->key == cur->key)
                     {
-                        auto succ =
-                            backend_->cache().getSuccessor(base, sequence);
-                        assert(succ);
-                        if (succ->key == cur->key)
-                        {
-                            BOOST_LOG_TRIVIAL(debug)
-                                << __func__ << " Writing book successor = "
-                                << ripple::strHex(base) << " - "
-                                << ripple::strHex(cur->key);
-                            backend_->writeSuccessor(
-                                uint256ToString(base),
-                                sequence,
-                                uint256ToString(cur->key));
-                        }
+                        BOOST_LOG_TRIVIAL(debug)
+                            << __func__ << " Writing book successor = "
+                            << ripple::strHex(base) << " - "
+                            << ripple::strHex(cur->key);
+                        backend_->writeSuccessor(
+                            uint256ToString(base),
+                            sequence,
+                            uint256ToString(cur->key));
                     }
-                    ++numWrites;
                 }
-                prev = std::move(cur->key);
-                if (numWrites % 100000 == 0 && numWrites != 0)
-                    BOOST_LOG_TRIVIAL(info) << __func__ << " Wrote "
-                                            << numWrites << " book successors";
+                ++numWrites;
             }
-            backend_->writeSuccessor(
-                uint256ToString(prev),
-                sequence,
-                uint256ToString(Backend::lastKey));
-            ++numWrites;
-            auto end = std::chrono::system_clock::now();
-            auto seconds =
-                std::chrono::duration_cast<std::chrono::seconds>(end - start)
-                    .count();
-            BOOST_LOG_TRIVIAL(info)
-                << __func__
-                << " - Looping through cache and submitting all writes took "
-                << seconds
-                << " seconds. numWrites = " << std::to_string(numWrites);
+            prev = std::move(cur->key);
+            if (numWrites % 100000 == 0 && numWrites != 0)
+                BOOST_LOG_TRIVIAL(info) << __func__ << " Wrote "
+                                        << numWrites << " book successors";
         }
+        backend_->writeSuccessor(
+            uint256ToString(prev),
+            sequence,
+            uint256ToString(Backend::lastKey));
+        ++numWrites;
+        auto end = std::chrono::system_clock::now();
+        auto seconds =
+            std::chrono::duration_cast<std::chrono::seconds>(end - start)
+                .count();
+        BOOST_LOG_TRIVIAL(info)
+            << __func__
+            << " - Looping through cache and submitting all writes took "
+            << seconds
+            << " seconds. numWrites = " << std::to_string(numWrites);
     }
-    return !abort;
+    return true;
 }
 
 template <class Derived>
@@ -820,7 +1154,8 @@ std::pair<grpc::Status, org::xrpl::rpc::v1::GetLedgerResponse>
 ETLSourceImpl<Derived>::fetchLedger(
     uint32_t ledgerSequence,
     bool getObjects,
-    bool getObjectNeighbors)
+    bool getObjectNeighbors,
+    grpc::ClientContext* context)
 {
     org::xrpl::rpc::v1::GetLedgerResponse response;
     if (!stub_)
@@ -828,14 +1163,16 @@ ETLSourceImpl<Derived>::fetchLedger(
 
     // ledger header with txns and metadata
     org::xrpl::rpc::v1::GetLedgerRequest request;
-    grpc::ClientContext context;
+    grpc::ClientContext localContext;
+    if (!context)
+        context = &localContext;
     request.mutable_ledger()->set_sequence(ledgerSequence);
     request.set_transactions(true);
     request.set_expand(true);
     request.set_get_objects(getObjects);
     request.set_get_object_neighbors(getObjectNeighbors);
     request.set_user("ETL");
-    grpc::Status status = stub_->GetLedger(&context, request, &response);
+    grpc::Status status = stub_->GetLedger(context, request, &response);
     if (status.ok() && !response.is_unlimited())
     {
         BOOST_LOG_TRIVIAL(warning)
@@ -856,6 +1193,7 @@ ETLLoadBalancer::ETLLoadBalancer(
     std::shared_ptr<BackendInterface> backend,
     std::shared_ptr<SubscriptionManager> subscriptions,
     std::shared_ptr<NetworkValidatedLedgers> nwvl)
+    : concurrentWrites_(backend->supportsConcurrentWrites())
 {
     if (config.contains("num_markers") && config.at("num_markers").is_int64())
     {
@@ -868,6 +1206,30 @@ ETLLoadBalancer::ETLLoadBalancer(
         downloadRanges_ = 4;
     }
 
+    if (config.contains("cache") && config.at("cache").is_object())
+    {
+        auto const& cache = config.at("cache").as_object();
+        if (cache.contains("num_markers") &&
+            cache.at("num_markers").is_int64())
+        {
+            cacheDownloadRanges_ = cache.at("num_markers").as_int64();
+
+            cacheDownloadRanges_ =
+                std::clamp(cacheDownloadRanges_, {1}, {256});
+        }
+        if (cache.contains("load_threads") &&
+            cache.at("load_threads").is_int64())
+        {
+            cacheLoadThreads_ = cache.at("load_threads").as_int64();
+
+            cacheLoadThreads_ = std::clamp(cacheLoadThreads_, {1}, {256});
+        }
+    }
+
+    if (config.contains("hedge_fetches") &&
+        config.at("hedge_fetches").is_bool())
+        hedgeFetches_ = config.at("hedge_fetches").as_bool();
+
     for (auto& entry : config.at("etl_sources").as_array())
     {
         std::unique_ptr<ETLSource> source = ETL::make_ETLSource(
@@ -880,6 +1242,7 @@ ETLLoadBalancer::ETLLoadBalancer(
             *this);
 
         sources_.push_back(std::move(source));
+        scores_.push_back(std::make_unique<SourceScore>());
         BOOST_LOG_TRIVIAL(info) << __func__ << " : added etl source - "
                                 << sources_.back()->toString();
     }
@@ -888,17 +1251,64 @@ ETLLoadBalancer::ETLLoadBalancer(
 void
 ETLLoadBalancer::loadInitialLedger(uint32_t sequence, bool cacheOnly)
 {
+    // the download state is shared by all attempts, so that a retry only
+    // fetches the ranges that are not yet finished
+    auto download = std::make_shared<LedgerDownload>(
+        sequence, cacheOnly ? cacheDownloadRanges_ : downloadRanges_);
+    {
+        std::lock_guard lck{downloadMtx_};
+        download_ = download;
+    }
+    auto numStreams = cacheOnly ? cacheDownloadRanges_ : downloadRanges_;
+    auto numThreads = cacheOnly ? cacheLoadThreads_ : 1;
+
+    // spread the streams over every source that has the ledger. Ranges a
+    // source fails to fetch are released, and picked up by the other sources
+    // or by the retries below
+    std::vector<ETLSource*> sources;
+    if (cacheOnly || concurrentWrites_)
+    {
+        for (auto& source : sources_)
+        {
+            if (source->isConnected() && source->hasLedger(sequence))
+                sources.push_back(source.get());
+        }
+    }
+    if (sources.size() > 1)
+    {
+        uint32_t share = (numStreams + sources.size() - 1) / sources.size();
+        std::vector<std::thread> threads;
+        for (auto source : sources)
+        {
+            threads.emplace_back(
+                [source, &download, cacheOnly, numThreads, share]() {
+                    if (!source->loadInitialLedger(
+                            *download, cacheOnly, numThreads, share))
+                        BOOST_LOG_TRIVIAL(warning)
+                            << "Failed to download part of initial ledger."
+                            << " source = " << source->toString();
+                });
+        }
+        for (auto& t : threads)
+            t.join();
+        if (download->finished())
+            return;
+    }
+
     execute(
-        [this, &sequence, cacheOnly](auto& source) {
-            bool res =
-                source->loadInitialLedger(sequence, downloadRanges_, cacheOnly);
+        [this, &sequence, &download, cacheOnly, numThreads, numStreams](
+            auto& source, auto&) {
+            bool res = source->loadInitialLedger(
+                *download, cacheOnly, numThreads, numStreams);
             if (!res)
             {
-                BOOST_LOG_TRIVIAL(error) << "Failed to download initial ledger."
-                                         << " Sequence = " << sequence
-                                         << " source = " << source->toString();
+                BOOST_LOG_TRIVIAL(error)
+                    << "Failed to download initial ledger."
+                    << " Sequence = " << sequence
+                    << " source = " << source->toString()
+                    << " markers finished = " << download->numFinished();
             }
-            return res;
+            return res && download->finished();
         },
         sequence);
 }
@@ -910,31 +1320,43 @@ ETLLoadBalancer::fetchLedger(
     bool getObjectNeighbors)
 {
     org::xrpl::rpc::v1::GetLedgerResponse response;
+    // a hedged fetch may succeed at two sources. only the first response
+    // is kept
+    std::mutex responseMtx;
+    bool haveResponse = false;
     bool success = execute(
-        [&response, ledgerSequence, getObjects, getObjectNeighbors, this](
-            auto& source) {
+        [&response,
+         &responseMtx,
+         &haveResponse,
+         ledgerSequence,
+         getObjects,
+         getObjectNeighbors](auto& source, auto& context) {
             auto [status, data] = source->fetchLedger(
-                ledgerSequence, getObjects, getObjectNeighbors);
-            response = std::move(data);
-            if (status.ok() && (response.validated() || true))
+                ledgerSequence, getObjects, getObjectNeighbors, &context);
+            if (status.ok() && (data.validated() || true))
             {
                 BOOST_LOG_TRIVIAL(info)
                     << "Successfully fetched ledger = " << ledgerSequence
                     << " from source = " << source->toString();
+                std::lock_guard lck{responseMtx};
+                if (!haveResponse)
+                    response = std::move(data);
+                haveResponse = true;
                 return true;
             }
             else
             {
                 BOOST_LOG_TRIVIAL(warning)
                     << "Error getting ledger = " << ledgerSequence
-                    << " Reply : " << response.DebugString()
+                    << " Reply : " << data.DebugString()
                     << " error_code : " << status.error_code()
                     << " error_msg : " << status.error_message()
                     << " source = " << source->toString();
                 return false;
             }
         },
-        ledgerSequence);
+        ledgerSequence,
+        true);
     if (success)
         return response;
     else
@@ -944,18 +1366,28 @@ ETLLoadBalancer::fetchLedger(
 std::optional<boost::json::object>
 ETLLoadBalancer::forwardToRippled(
     boost::json::object const& request,
-    std::string const& clientIp) const
+    std::string const& clientIp,
+    ForwardTiming* timing) const
 {
-    srand((unsigned)time(0));
-    auto sourceIdx = rand() % sources_.size();
-    auto numAttempts = 0;
-    while (numAttempts < sources_.size())
+    // connected sources first, then the fastest to answer. Sources that have
+    // not answered yet count as fastest, so each of them gets tried
+    std::vector<std::pair<bool, std::chrono::microseconds>> keys;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < sources_.size(); ++i)
     {
-        if (auto res = sources_[sourceIdx]->forwardToRippled(request, clientIp))
-            return res;
+        keys.emplace_back(
+            !sources_[i]->isConnected(), sources_[i]->forwardLatency());
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&keys](auto a, auto b) {
+        return keys[a] < keys[b];
+    });
 
-        sourceIdx = (sourceIdx + 1) % sources_.size();
-        ++numAttempts;
+    for (auto sourceIdx : order)
+    {
+        auto& source = sources_[sourceIdx];
+        if (auto res = source->forwardToRippled(request, clientIp, timing))
+            return res;
     }
     return {};
 }
@@ -964,146 +1396,194 @@ template <class Derived>
 std::optional<boost::json::object>
 ETLSourceImpl<Derived>::forwardToRippled(
     boost::json::object const& request,
-    std::string const& clientIp) const
+    std::string const& clientIp,
+    ForwardTiming* timing) const
 {
     BOOST_LOG_TRIVIAL(debug) << "Attempting to forward request to tx. "
                              << "request = " << boost::json::serialize(request);
 
-    boost::json::object response;
     if (!connected_)
     {
         BOOST_LOG_TRIVIAL(error)
             << "Attempted to proxy but failed to connect to tx";
         return {};
     }
-    namespace beast = boost::beast;          // from <boost/beast.hpp>
-    namespace http = beast::http;            // from <boost/beast/http.hpp>
-    namespace websocket = beast::websocket;  // from
-    namespace net = boost::asio;             // from
-    using tcp = boost::asio::ip::tcp;        // from
-    try
-    {
-        // The io_context is required for all I/O
-        net::io_context ioc;
-
-        // These objects perform our I/O
-        tcp::resolver resolver{ioc};
-
-        BOOST_LOG_TRIVIAL(debug) << "Creating websocket";
-        auto ws = std::make_unique<websocket::stream<tcp::socket>>(ioc);
 
-        // Look up the domain name
-        auto const results = resolver.resolve(ip_, wsPort_);
-
-        BOOST_LOG_TRIVIAL(debug) << "Connecting websocket";
-        // Make the connection on the IP address we get from a lookup
-        net::connect(ws->next_layer(), results.begin(), results.end());
-
-        // Set a decorator to change the User-Agent of the handshake
-        // and to tell rippled to charge the client IP for RPC
-        // resources. See "secure_gateway" in
-        //
-        // https://github.com/ripple/rippled/blob/develop/cfg/rippled-example.cfg
-        ws->set_option(websocket::stream_base::decorator(
-            [&request, &clientIp](websocket::request_type& req) {
-                req.set(
-                    http::field::user_agent,
-                    std::string(BOOST_BEAST_VERSION_STRING) +
-                        " websocket-client-coro");
-                req.set(http::field::forwarded, "for=" + clientIp);
-            }));
-        BOOST_LOG_TRIVIAL(debug) << "client ip: " << clientIp;
-
-        BOOST_LOG_TRIVIAL(debug) << "Performing websocket handshake";
-        // Perform the websocket handshake
-        ws->handshake(ip_, "/");
-
-        BOOST_LOG_TRIVIAL(debug) << "Sending request";
-        // Send the message
-        ws->write(net::buffer(boost::json::serialize(request)));
-
-        beast::flat_buffer buffer;
-        ws->read(buffer);
-
-        auto begin = static_cast<char const*>(buffer.data().data());
-        auto end = begin + buffer.data().size();
-        auto parsed = boost::json::parse(std::string(begin, end));
-
-        if (!parsed.is_object())
-        {
-            BOOST_LOG_TRIVIAL(error)
-                << "Error parsing response: " << std::string{begin, end};
-            return {};
-        }
-        BOOST_LOG_TRIVIAL(debug) << "Successfully forward request";
+    ForwardTiming local;
+    auto response =
+        forwardPool_->forward(request, clientIp, timing ? *timing : local);
+    if (!response)
+        return {};
+    BOOST_LOG_TRIVIAL(debug) << "Successfully forward request";
 
-        response = parsed.as_object();
+    (*response)["forwarded"] = true;
+    return response;
+}
 
-        response["forwarded"] = true;
-        return response;
+std::vector<size_t>
+ETLLoadBalancer::rankSources(uint32_t ledgerSequence) const
+{
+    std::vector<size_t> order;
+    for (size_t i = 0; i < sources_.size(); ++i)
+    {
+        if (sources_[i]->hasLedger(ledgerSequence))
+            order.push_back(i);
     }
-    catch (std::exception const& e)
+    // a source learns about new ledgers from its ledgers stream, which may
+    // lag behind. If no source claims the ledger, any of them might have it
+    if (order.empty())
     {
-        BOOST_LOG_TRIVIAL(error) << "Encountered exception : " << e.what();
-        return {};
+        for (size_t i = 0; i < sources_.size(); ++i)
+            order.push_back(i);
     }
+
+    std::vector<double> costs;
+    for (auto& score : scores_)
+        costs.push_back(score->cost());
+    std::stable_sort(order.begin(), order.end(), [&costs](auto a, auto b) {
+        return costs[a] < costs[b];
+    });
+
+    // consecutive ledgers start at consecutive sources among those about as
+    // good as the best, so ledgers extracted in parallel are spread over them
+    double const cutoff = costs[order.front()] * 1.5 + 1000;
+    size_t numBest = 0;
+    while (numBest < order.size() && costs[order[numBest]] <= cutoff)
+        ++numBest;
+    std::rotate(
+        order.begin(),
+        order.begin() + ledgerSequence % numBest,
+        order.begin() + numBest);
+    return order;
 }
 
 template <class Func>
 bool
-ETLLoadBalancer::execute(Func f, uint32_t ledgerSequence)
+ETLLoadBalancer::execute(Func f, uint32_t ledgerSequence, bool hedge)
 {
-    srand((unsigned)time(0));
-    auto sourceIdx = rand() % sources_.size();
-    auto numAttempts = 0;
-
+    using clock = std::chrono::steady_clock;
+    // won is set by the winning call of a hedged fetch, before the other
+    // call is cancelled. That call failing is no failure of its source
+    auto attempt = [this, &f, hedge](
+                       size_t idx,
+                       grpc::ClientContext& context,
+                       std::atomic_bool* won = nullptr) {
+        auto start = clock::now();
+        bool res = f(sources_[idx], context);
+        bool const cancelled = !res && won && *won;
+        if (res && won)
+            *won = true;
+        if (hedge && !cancelled)
+            scores_[idx]->record(clock::now() - start, res);
+        return res;
+    };
+
+    // after every source failed, wait before trying them again. The wait
+    // doubles after each round
+    auto backoff = std::chrono::milliseconds(50);
     while (true)
     {
-        auto& source = sources_[sourceIdx];
-
-        BOOST_LOG_TRIVIAL(debug)
-            << __func__ << " : "
-            << "Attempting to execute func. ledger sequence = "
-            << ledgerSequence << " - source = " << source->toString();
-        if (source->hasLedger(ledgerSequence) || true)
+        auto order = rankSources(ledgerSequence);
+        for (size_t i = 0; i < order.size(); ++i)
         {
-            bool res = f(source);
-            if (res)
+            auto& source = sources_[order[i]];
+
+            BOOST_LOG_TRIVIAL(debug)
+                << __func__ << " : "
+                << "Attempting to execute func. ledger sequence = "
+                << ledgerSequence << " - source = " << source->toString();
+
+            std::optional<std::chrono::microseconds> delay;
+            if (hedge && hedgeFetches_ && i + 1 < order.size())
+                delay = scores_[order[i]]->p95();
+
+            bool res = false;
+            if (!delay)
             {
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__ << " : "
-                    << "Successfully executed func at source = "
-                    << source->toString()
-                    << " - ledger sequence = " << ledgerSequence;
-                break;
+                grpc::ClientContext context;
+                res = attempt(order[i], context);
             }
             else
             {
-                BOOST_LOG_TRIVIAL(warning)
+                // give the source as long as it takes for 95% of its
+                // requests, then ask the next best source as well
+                auto backupIdx = order[i + 1];
+                grpc::ClientContext context;
+                grpc::ClientContext backupContext;
+                std::mutex mtx;
+                std::condition_variable cv;
+                bool done = false;
+                bool backupStarted = false;
+                // set once the timer handler returns, as it uses the locals
+                bool backupDone = false;
+                std::atomic_bool backupRes = false;
+                std::atomic_bool won = false;
+                boost::asio::steady_timer timer{hedgePool_, *delay};
+                timer.async_wait([&](boost::system::error_code ec) {
+                    {
+                        std::lock_guard lck{mtx};
+                        // the fetch finished before the timer, which may
+                        // have expired anyway
+                        backupStarted = !ec && !done;
+                    }
+                    if (backupStarted)
+                    {
+                        scores_[order[i]]->hedged();
+                        BOOST_LOG_TRIVIAL(info)
+                            << __func__ << " : "
+                            << "Hedging slow fetch of ledger sequence = "
+                            << ledgerSequence << " - source = "
+                            << sources_[backupIdx]->toString();
+                        backupRes = attempt(backupIdx, backupContext, &won);
+                        if (backupRes)
+                            context.TryCancel();
+                    }
+                    {
+                        std::lock_guard lck{mtx};
+                        backupDone = true;
+                    }
+                    cv.notify_one();
+                });
+                res = attempt(order[i], context, &won);
+                {
+                    std::lock_guard lck{mtx};
+                    done = true;
+                }
+                timer.cancel();
+                if (res)
+                    backupContext.TryCancel();
+                {
+                    std::unique_lock lck{mtx};
+                    cv.wait(lck, [&backupDone]() { return backupDone; });
+                }
+                res = res || backupRes;
+                // the backup was tried already
+                if (!res && backupStarted)
+                    ++i;
+            }
+
+            if (res)
+            {
+                BOOST_LOG_TRIVIAL(debug)
                     << __func__ << " : "
-                    << "Failed to execute func at source = "
+                    << "Successfully executed func at source = "
                     << source->toString()
                     << " - ledger sequence = " << ledgerSequence;
+                return true;
             }
-        }
-        else
-        {
             BOOST_LOG_TRIVIAL(warning)
                 << __func__ << " : "
-                << "Ledger not present at source = " << source->toString()
+                << "Failed to execute func at source = " << source->toString()
                 << " - ledger sequence = " << ledgerSequence;
         }
-        sourceIdx = (sourceIdx + 1) % sources_.size();
-        numAttempts++;
-        if (numAttempts % sources_.size() == 0)
-        {
-            BOOST_LOG_TRIVIAL(error)
-                << __func__ << " : "
-                << "Error executing function "
-                << " - ledger sequence = " << ledgerSequence
-                << " - Tried all sources. Sleeping and trying again";
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-        }
+        BOOST_LOG_TRIVIAL(error)
+            << __func__ << " : "
+            << "Error executing function "
+            << " - ledger sequence = " << ledgerSequence
+            << " - Tried all sources. Sleeping " << backoff.count()
+            << " ms and trying again";
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(2000));
     }
     return true;
 }
@@ -12,11 +12,205 @@
 
 #include "org/xrpl/rpc/v1/xrp_ledger.grpc.pb.h"
 #include <etl/ETLHelpers.h>
+#include <etl/ForwardPool.h>
 #include <grpcpp/grpcpp.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string_view>
+
 class ETLLoadBalancer;
 class SubscriptionManager;
 
+/// Tracks the download of a full ledger, which is split into marker ranges
+/// that are fetched concurrently. The state of each range outlives a single
+/// attempt, so that after a failure the download can be resumed, possibly
+/// from a different ETL source, without fetching finished ranges again.
+///
+/// Ledger keys are not spread evenly over the initial ranges, so some ranges
+/// take much longer than others. A stream that finishes its range claims
+/// another one, and once every range is claimed it splits the range with the
+/// most keyspace left in two and takes the second half. So streams on any
+/// source stay busy until the end of the download.
+class LedgerDownload
+{
+public:
+    /// Time spent by every page in each stage of the download
+    struct Stages
+    {
+        // waiting for the page on the completion queue
+        StageTimer receive;
+        // waiting for room in the queue to the write stage
+        StageTimer handoff;
+        // extracting the objects of the page
+        StageTimer parse;
+        // submitting the objects and successors to the backend
+        StageTimer write;
+        // updating the cache
+        StageTimer cache;
+    };
+
+    struct Range
+    {
+        ripple::uint256 start;
+        // first key of the next range. empty for the last range. Lowered
+        // when the range is split
+        std::optional<ripple::uint256> next;
+        // marker of the next page to fetch. empty if no page was fetched yet
+        std::string cursor;
+        // last key written in this range. Used to write edge successors
+        std::string lastKey;
+        // whether a stream is fetching this range
+        bool claimed = false;
+        // whether every page was received. The range may still be writing
+        bool fetched = false;
+        std::atomic_bool done = false;
+        // fraction of the range's keyspace that has been written
+        std::atomic<double> written = 0;
+    };
+
+private:
+    uint32_t const sequence_;
+    mutable std::mutex mtx_;
+    // a deque, so that splitting a range does not move the others
+    std::deque<Range> ranges_;
+    std::atomic_uint64_t numObjects_ = 0;
+    std::atomic_uint32_t numSplits_ = 0;
+    std::atomic_uint64_t numBytes_ = 0;
+    Stages stages_;
+    bool finished_ = false;
+    std::chrono::steady_clock::time_point const start_ =
+        std::chrono::steady_clock::now();
+
+    size_t
+    countFinished() const;
+
+public:
+    // ranges narrower than this fraction of the keyspace are not split, as
+    // they hold too few objects to be worth another stream
+    static constexpr double minSplitWidth = 1.0 / 4096;
+
+    LedgerDownload(uint32_t sequence, uint32_t numMarkers)
+        : sequence_(sequence), ranges_(numMarkers)
+    {
+        auto markers = getMarkers(numMarkers);
+        for (size_t i = 0; i < markers.size(); ++i)
+        {
+            ranges_[i].start = markers[i];
+            if (i + 1 < markers.size())
+                ranges_[i].next = markers[i + 1];
+        }
+    }
+
+    uint32_t
+    sequence() const
+    {
+        return sequence_;
+    }
+
+    /// Every range, including the ones created by splits. Only safe to use
+    /// while no stream is fetching
+    std::deque<Range>&
+    ranges()
+    {
+        return ranges_;
+    }
+
+    /// Claim a range for a stream to fetch: a range that no stream is
+    /// fetching, or else the second half of the claimed range with the most
+    /// keyspace left
+    /// @return the claimed range. nullptr if no range is left to fetch
+    Range*
+    claim();
+
+    /// Give up a claimed range that was not finished, so that another stream
+    /// may resume it
+    void
+    release(Range& range);
+
+    /// Record that a page was received for range
+    /// @param range the range the page belongs to
+    /// @param marker the marker returned with the page. empty if last page
+    /// @param end set to the end of the range. Objects of the page at or
+    /// after the end belong to another range
+    /// @return whether the range has more pages to fetch
+    bool
+    advance(
+        Range& range,
+        std::string const& marker,
+        std::optional<ripple::uint256>& end);
+
+    /// Record that a page of objects was written for range
+    /// @param range the range the page belongs to
+    /// @param count number of objects in the page
+    /// @param last whether this was the last page of the range
+    /// @return total number of objects written so far
+    uint64_t
+    addPage(Range& range, uint64_t count, bool last);
+
+    uint64_t
+    numObjects() const
+    {
+        return numObjects_;
+    }
+
+    size_t
+    numFinished() const
+    {
+        std::lock_guard lck{mtx_};
+        return countFinished();
+    }
+
+    size_t
+    numRanges() const
+    {
+        std::lock_guard lck{mtx_};
+        return ranges_.size();
+    }
+
+    /// @return true exactly once, to the first caller after every range is
+    /// done. That caller writes the edge successors of the ranges
+    bool
+    finish();
+
+    Stages&
+    stages()
+    {
+        return stages_;
+    }
+
+    void
+    addBytes(uint64_t bytes)
+    {
+        numBytes_ += bytes;
+    }
+
+    /// Time spent in each stage, summed over every stream, and the rate of
+    /// objects each stage would sustain on its own
+    boost::json::object
+    stagesJson() const;
+
+    /// @return whether finish() returned true
+    bool
+    finished() const
+    {
+        std::lock_guard lck{mtx_};
+        return finished_;
+    }
+
+    /// Estimate of the fraction of the ledger that has been downloaded.
+    /// Ledger keys are hashes, so objects are spread uniformly over the
+    /// keyspace and the covered keyspace is a good proxy for progress
+    double
+    progress() const;
+
+    boost::json::object
+    toJson() const;
+};
+
 /// This class manages a connection to a single ETL source. This is almost
 /// always a rippled node, but really could be another reporting node. This
 /// class subscribes to the ledgers and transactions_proposed streams of the
@@ -43,22 +237,34 @@ public:
     virtual bool
     hasLedger(uint32_t sequence) const = 0;
 
+    /// @param context context of the call, to cancel it from another thread.
+    /// A local one is used if null
     virtual std::pair<grpc::Status, org::xrpl::rpc::v1::GetLedgerResponse>
     fetchLedger(
         uint32_t ledgerSequence,
         bool getObjects = true,
-        bool getObjectNeighbors = false) = 0;
+        bool getObjectNeighbors = false,
+        grpc::ClientContext* context = nullptr) = 0;
 
     virtual bool
     loadInitialLedger(
-        uint32_t sequence,
-        std::uint32_t numMarkers,
-        bool cacheOnly = false) = 0;
+        LedgerDownload& download,
+        bool cacheOnly = false,
+        std::uint32_t numThreads = 1,
+        std::uint32_t numStreams = 16) = 0;
 
+    /// @param timing if not null, set to the time spent connecting and
+    /// waiting for rippled
     virtual std::optional<boost::json::object>
     forwardToRippled(
         boost::json::object const& request,
-        std::string const& clientIp) const = 0;
+        std::string const& clientIp,
+        ForwardTiming* timing = nullptr) const = 0;
+
+    /// @return moving average of the time rippled takes to answer forwarded
+    /// requests. zero if none was forwarded yet
+    virtual std::chrono::microseconds
+    forwardLatency() const = 0;
 
     virtual ~ETLSource()
     {
@@ -90,12 +296,6 @@ class ETLSourceImpl : public ETLSource
 
     std::atomic_bool connected_{false};
 
-    // true if this ETL source is forwarding transactions received on the
-    // transactions_proposed stream. There are usually multiple ETL sources,
-    // so to avoid forwarding the same transaction multiple times, we only
-    // forward from one particular ETL source at a time.
-    std::atomic_bool forwardingStream_{false};
-
     // The last time a message was received on the ledgers stream
     std::chrono::system_clock::time_point lastMsgTime_;
     mutable std::mutex lastMsgTimeMtx_;
@@ -104,6 +304,10 @@ class ETLSourceImpl : public ETLSource
     std::shared_ptr<SubscriptionManager> subscriptions_;
     ETLLoadBalancer& balancer_;
 
+    // connections to forward requests over. Created once ip_ and wsPort_
+    // are known
+    std::unique_ptr<ForwardPool> forwardPool_;
+
 protected:
     Derived&
     derived()
@@ -247,12 +451,15 @@ public:
     /// @param ledgerSequence sequence of the ledger to fetch
     /// @getObjects whether to get the account state diff between this ledger
     /// and the prior one
+    /// @param context context of the call, to cancel it from another thread.
+    /// A local one is used if null
     /// @return the extracted data and the result status
     std::pair<grpc::Status, org::xrpl::rpc::v1::GetLedgerResponse>
     fetchLedger(
         uint32_t ledgerSequence,
         bool getObjects = true,
-        bool getObjectNeighbors = false) override;
+        bool getObjectNeighbors = false,
+        grpc::ClientContext* context = nullptr) override;
 
     std::string
     toString() const override
@@ -271,6 +478,7 @@ public:
         res["ip"] = ip_;
         res["ws_port"] = wsPort_;
         res["grpc_port"] = grpcPort_;
+        res["forward"] = forwardPool_->report();
         auto last = getLastMsgTime();
         if (last.time_since_epoch().count() != 0)
             res["last_msg_arrival_time"] = std::to_string(
@@ -280,15 +488,23 @@ public:
         return res;
     }
 
-    /// Download a ledger in full
-    /// @param ledgerSequence sequence of the ledger to download
-    /// @param writeQueue queue to push downloaded ledger objects
-    /// @return true if the download was successful
+    /// Download a ledger in full, or the parts of it that were not
+    /// downloaded by a previous attempt
+    /// @param download state of the download. Updated as pages are written
+    /// @param cacheOnly if true, only populate the cache
+    /// @param numThreads number of threads, each with their own completion
+    /// queue, to process the marker ranges with. Must be 1 unless
+    /// cacheOnly is true, since backend writes are not thread safe
+    /// @param numStreams number of ranges to fetch at once. Other sources
+    /// may fetch ranges of the same download at the same time
+    /// @return true if no fetch failed. The download may still be
+    /// unfinished, if ranges were left to other sources
     bool
     loadInitialLedger(
-        std::uint32_t ledgerSequence,
-        std::uint32_t numMarkers,
-        bool cacheOnly = false) override;
+        LedgerDownload& download,
+        bool cacheOnly = false,
+        std::uint32_t numThreads = 1,
+        std::uint32_t numStreams = 16) override;
 
     /// Attempt to reconnect to the ETL source
     void
@@ -327,7 +543,14 @@ public:
     std::optional<boost::json::object>
     forwardToRippled(
         boost::json::object const& request,
-        std::string const& clientIp) const override;
+        std::string const& clientIp,
+        ForwardTiming* timing = nullptr) const override;
+
+    std::chrono::microseconds
+    forwardLatency() const override
+    {
+        return forwardPool_->latency();
+    }
 };
 
 class PlainETLSource : public ETLSourceImpl<PlainETLSource>
@@ -468,9 +691,33 @@ class ETLLoadBalancer
 {
 private:
     std::vector<std::unique_ptr<ETLSource>> sources_;
+    // latency and error rate of ledger fetches, one per source
+    std::vector<std::unique_ptr<SourceScore>> scores_;
+
+    // whether a fetch that takes longer than the 95th percentile of its
+    // source is raced against a fetch from the next best source
+    bool hedgeFetches_ = true;
+    // runs the timers of hedged fetches, and the backup fetches they start.
+    // A few threads suffice, as only about one fetch in twenty is hedged
+    static constexpr std::size_t hedgeThreads = 4;
+    boost::asio::thread_pool hedgePool_{hedgeThreads};
 
     std::uint32_t downloadRanges_ = 16;
 
+    // number of marker ranges and threads used when only loading the cache
+    std::uint32_t cacheDownloadRanges_ = 16;
+    std::uint32_t cacheLoadThreads_ = 4;
+
+    // whether the streams of a download may be spread over every source
+    // even when writing to the database
+    bool concurrentWrites_ = false;
+
+    mutable std::mutex downloadMtx_;
+    std::shared_ptr<LedgerDownload> download_;
+
+    // ids of messages recently relayed from the streams of the sources
+    RecentFilter recentMessages_;
+
 public:
     ETLLoadBalancer(
         boost::json::object const& config,
@@ -518,66 +765,82 @@ public:
         bool getObjects,
         bool getObjectNeighbors);
 
-    /// Determine whether messages received on the transactions_proposed stream
-    /// should be forwarded to subscribing clients. The server subscribes to
-    /// transactions_proposed on multiple ETLSources, yet only forwards messages
-    /// from one source at any given time (to avoid sending duplicate messages
-    /// to clients).
-    /// @param in ETLSource in question
-    /// @return true if messages should be forwarded
+    /// The transactions_proposed, validations and manifests streams of every
+    /// source are relayed to clients, so that they get the first copy of a
+    /// message to arrive from any source. Later copies are dropped here.
+    /// @param id identifies the message, such as the hash of a transaction
+    /// @param validated for transactions, whether this is the validated
+    /// copy, which is relayed after the proposed one
+    /// @return true if the message should be relayed. Messages without an id
+    /// always are
     bool
-    shouldPropagateTxnStream(ETLSource* in) const
+    isFirstArrival(std::string_view id, bool validated = false)
     {
-        for (auto& src : sources_)
-        {
-            assert(src);
-            // We pick the first ETLSource encountered that is connected
-            if (src->isConnected())
-            {
-                if (src.get() == in)
-                    return true;
-                else
-                    return false;
-            }
-        }
-
-        // If no sources connected, then this stream has not been forwarded
-        return true;
+        if (id.empty())
+            return true;
+        return recentMessages_.insert(
+            std::hash<std::string_view>{}(id) + validated);
     }
 
     boost::json::value
     toJson() const
     {
         boost::json::array ret;
-        for (auto& src : sources_)
+        for (size_t i = 0; i < sources_.size(); ++i)
         {
-            ret.push_back(src->toJson());
+            auto src = sources_[i]->toJson();
+            src["score"] = scores_[i]->report();
+            ret.push_back(std::move(src));
         }
         return ret;
     }
 
-    /// Forward a JSON RPC request to a randomly selected rippled node
+    /// @return progress of the most recent full ledger download, if any
+    std::optional<boost::json::object>
+    loadProgress() const
+    {
+        std::lock_guard lck{downloadMtx_};
+        if (!download_)
+            return {};
+        return download_->toJson();
+    }
+
+    /// Forward a JSON RPC request to a rippled node. Nodes that answered
+    /// forwarded requests fastest are tried first
     /// @param request JSON-RPC request
+    /// @param timing if not null, set to the time spent connecting and
+    /// waiting for rippled
     /// @return response received from rippled node
     std::optional<boost::json::object>
     forwardToRippled(
         boost::json::object const& request,
-        std::string const& clientIp) const;
+        std::string const& clientIp,
+        ForwardTiming* timing = nullptr) const;
 
 private:
-    /// f is a function that takes an ETLSource as an argument and returns a
-    /// bool. Attempt to execute f for one randomly chosen ETLSource that has
-    /// the specified ledger. If f returns false, another randomly chosen
-    /// ETLSource is used. The process repeats until f returns true.
-    /// @param f function to execute. This function takes the ETL source as an
-    /// argument, and returns a bool.
+    /// @return indexes of the sources that have the ledger, cheapest first.
+    /// Every source if none claims to have it
+    std::vector<size_t>
+    rankSources(uint32_t ledgerSequence) const;
+
+    /// f is a function that takes an ETLSource and a grpc::ClientContext as
+    /// arguments and returns a bool. Attempt to execute f for the best
+    /// ETLSource that has the specified ledger. If f returns false, the next
+    /// best ETLSource is used. The process repeats until f returns true.
+    /// @param f function to execute. This function takes the ETL source and
+    /// the context to make its calls with, and returns a bool.
     /// @param ledgerSequence f is executed for each ETLSource that has this
     /// ledger
+    /// @param hedge if true, f is a single short call. Its latency is
+    /// recorded in the score of the source, and if hedgeFetches_ is set f
+    /// may run on two sources at once. The first call to return true wins,
+    /// and the other one is cancelled through its context. f must then make
+    /// its side effects thread safe
     /// @return true if f was eventually executed successfully. false if the
     /// ledger was found in the database or the server is shutting down
     template <class Func>
     bool
-    execute(Func f, uint32_t ledgerSequence);
+    execute(Func f, uint32_t ledgerSequence, bool hedge = false);
 };
 
 #endif
@@ -0,0 +1,385 @@
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/log/trivial.hpp>
+#include <etl/ForwardPool.h>
+
+namespace {
+std::chrono::microseconds
+since(ForwardConnection::clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        ForwardConnection::clock::now() - start);
+}
+
+std::optional<std::uint64_t>
+getId(boost::json::object const& response)
+{
+    auto it = response.find("id");
+    if (it == response.end())
+        return {};
+    if (it->value().is_uint64())
+        return it->value().as_uint64();
+    if (it->value().is_int64() && it->value().as_int64() >= 0)
+        return it->value().as_int64();
+    return {};
+}
+}  // namespace
+
+ForwardConnection::ForwardConnection(boost::asio::io_context& ioc)
+    : ws_(boost::asio::make_strand(ioc))
+{
+}
+
+bool
+ForwardConnection::connect(
+    std::string const& host,
+    std::string const& port,
+    std::string const& clientIp)
+{
+    namespace http = boost::beast::http;
+    namespace websocket = boost::beast::websocket;
+    try
+    {
+        boost::asio::ip::tcp::resolver resolver{ws_.get_executor()};
+        auto const results = resolver.resolve(host, port);
+        boost::beast::get_lowest_layer(ws_).connect(results);
+
+        // Set a decorator to change the User-Agent of the handshake
+        // and to tell rippled to charge the client IP for RPC
+        // resources. See "secure_gateway" in
+        //
+        // https://github.com/ripple/rippled/blob/develop/cfg/rippled-example.cfg
+        ws_.set_option(websocket::stream_base::decorator(
+            [clientIp](websocket::request_type& req) {
+                req.set(
+                    http::field::user_agent,
+                    std::string(BOOST_BEAST_VERSION_STRING) +
+                        " websocket-client-async");
+                req.set(http::field::forwarded, "for=" + clientIp);
+            }));
+        ws_.handshake(host, "/");
+    }
+    catch (std::exception const& e)
+    {
+        BOOST_LOG_TRIVIAL(error)
+            << __func__ << " failed to connect to " << host << ":" << port
+            << " : " << e.what();
+        failed_ = true;
+        return false;
+    }
+
+    boost::asio::post(ws_.get_executor(), [self = shared_from_this()]() {
+        self->doRead();
+    });
+    return true;
+}
+
+void
+ForwardConnection::doRead()
+{
+    ws_.async_read(buffer_, [self = shared_from_this()](auto ec, size_t) {
+        if (ec)
+            return self->fail(ec, "read");
+
+        std::string msg{
+            static_cast<char const*>(self->buffer_.data().data()),
+            self->buffer_.size()};
+        self->buffer_.consume(self->buffer_.size());
+        try
+        {
+            auto parsed = boost::json::parse(msg);
+            std::optional<std::uint64_t> id;
+            if (parsed.is_object())
+                id = getId(parsed.as_object());
+            // responses to requests that timed out, and the later updates of
+            // streaming commands such as path_find, have no request waiting
+            std::shared_ptr<Result> result;
+            if (id)
+            {
+                std::lock_guard lck{self->mtx_};
+                if (auto it = self->pending_.find(*id);
+                    it != self->pending_.end())
+                {
+                    result = std::move(it->second);
+                    self->pending_.erase(it);
+                }
+            }
+            if (result)
+                result->set_value(std::move(parsed.as_object()));
+        }
+        catch (std::exception const& e)
+        {
+            BOOST_LOG_TRIVIAL(error)
+                << __func__ << " error parsing response: " << e.what();
+        }
+        self->doRead();
+    });
+}
+
+void
+ForwardConnection::doWrite()
+{
+    ws_.async_write(
+        boost::asio::buffer(writes_.front()),
+        [self = shared_from_this()](auto ec, size_t) {
+            if (ec)
+                return self->fail(ec, "write");
+            self->writes_.pop_front();
+            if (!self->writes_.empty())
+                self->doWrite();
+            else if (self->closing_)
+                self->doClose();
+        });
+}
+
+void
+ForwardConnection::doClose()
+{
+    ws_.async_close(
+        boost::beast::websocket::close_code::normal,
+        [self = shared_from_this()](auto ec) {});
+}
+
+void
+ForwardConnection::fail(boost::beast::error_code ec, char const* what)
+{
+    if (!failed_.exchange(true))
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " " << what << " : " << ec.message();
+
+    std::unordered_map<std::uint64_t, std::shared_ptr<Result>> pending;
+    {
+        std::lock_guard lck{mtx_};
+        pending.swap(pending_);
+    }
+    for (auto& [id, result] : pending)
+        result->set_value({});
+}
+
+std::optional<boost::json::object>
+ForwardConnection::forward(
+    boost::json::object request,
+    std::chrono::milliseconds timeout)
+{
+    std::optional<boost::json::value> clientId;
+    if (auto it = request.find("id"); it != request.end())
+        clientId = it->value();
+
+    auto result = std::make_shared<Result>();
+    auto future = result->get_future();
+    std::uint64_t id;
+    {
+        std::lock_guard lck{mtx_};
+        // checked under the lock, so that fail() sees every pending request
+        if (failed_)
+            return {};
+        id = nextId_++;
+        pending_[id] = result;
+        lastUsed_ = clock::now();
+    }
+    request["id"] = id;
+
+    boost::asio::post(
+        ws_.get_executor(),
+        [self = shared_from_this(), msg = boost::json::serialize(request)]() {
+            // the request fails when the read is ended by the close
+            if (self->closing_)
+                return;
+            self->writes_.push_back(std::move(msg));
+            if (self->writes_.size() == 1)
+                self->doWrite();
+        });
+
+    bool ready = future.wait_for(timeout) == std::future_status::ready;
+    {
+        std::lock_guard lck{mtx_};
+        if (!ready)
+            pending_.erase(id);
+        lastUsed_ = clock::now();
+    }
+    if (!ready)
+    {
+        BOOST_LOG_TRIVIAL(warning) << __func__ << " timed out";
+        return {};
+    }
+
+    auto response = future.get();
+    if (!response)
+        return {};
+    if (clientId)
+        (*response)["id"] = *clientId;
+    else
+        response->erase("id");
+    return response;
+}
+
+void
+ForwardConnection::close()
+{
+    failed_ = true;
+    boost::asio::post(ws_.get_executor(), [self = shared_from_this()]() {
+        if (self->closing_)
+            return;
+        self->closing_ = true;
+        if (self->writes_.empty())
+            self->doClose();
+    });
+}
+
+bool
+ForwardConnection::idle() const
+{
+    std::lock_guard lck{mtx_};
+    return pending_.empty();
+}
+
+ForwardConnection::clock::time_point
+ForwardConnection::lastUsed() const
+{
+    std::lock_guard lck{mtx_};
+    return lastUsed_;
+}
+
+ForwardPool::ForwardPool(
+    boost::asio::io_context& ioc,
+    std::string host,
+    std::string port)
+    : ioc_(ioc), host_(std::move(host)), port_(std::move(port))
+{
+}
+
+ForwardPool::~ForwardPool()
+{
+    clear();
+}
+
+void
+ForwardPool::sweep()
+{
+    auto now = ForwardConnection::clock::now();
+    for (auto it = connections_.begin(); it != connections_.end();)
+    {
+        auto& conn = it->second;
+        if (conn->failed() ||
+            (conn->idle() && now - conn->lastUsed() > idleTimeout))
+        {
+            conn->close();
+            it = connections_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    while (connections_.size() >= maxConnections)
+    {
+        auto oldest = connections_.end();
+        for (auto it = connections_.begin(); it != connections_.end(); ++it)
+        {
+            if (it->second->idle() &&
+                (oldest == connections_.end() ||
+                 it->second->lastUsed() < oldest->second->lastUsed()))
+                oldest = it;
+        }
+        // every connection is busy. the pool grows past its size for now
+        if (oldest == connections_.end())
+            break;
+        oldest->second->close();
+        connections_.erase(oldest);
+    }
+}
+
+std::shared_ptr<ForwardConnection>
+ForwardPool::connection(std::string const& clientIp, ForwardTiming& timing)
+{
+    {
+        std::lock_guard lck{mtx_};
+        if (auto it = connections_.find(clientIp); it != connections_.end())
+        {
+            if (!it->second->failed())
+            {
+                ++reused_;
+                return it->second;
+            }
+            connections_.erase(it);
+        }
+    }
+
+    // connect without the lock, which would block requests of other clients
+    auto start = ForwardConnection::clock::now();
+    auto conn = std::make_shared<ForwardConnection>(ioc_);
+    bool connected = conn->connect(host_, port_, clientIp);
+    timing.connect = since(start);
+    ++connects_;
+    if (!connected)
+    {
+        ++failures_;
+        return nullptr;
+    }
+
+    std::lock_guard lck{mtx_};
+    sweep();
+    auto& slot = connections_[clientIp];
+    // another request of the same client connected in the meantime
+    if (slot && !slot->failed())
+    {
+        conn->close();
+        return slot;
+    }
+    slot = conn;
+    return conn;
+}
+
+std::optional<boost::json::object>
+ForwardPool::forward(
+    boost::json::object const& request,
+    std::string const& clientIp,
+    ForwardTiming& timing)
+{
+    auto conn = connection(clientIp, timing);
+    if (!conn)
+        return {};
+
+    auto start = ForwardConnection::clock::now();
+    auto response = conn->forward(
+        request,
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            responseTimeout));
+    timing.response = since(start);
+    if (!response)
+    {
+        ++failures_;
+        return {};
+    }
+
+    // average over about the last 16 responses
+    std::int64_t const micros = timing.response.count();
+    std::int64_t const prev = latency_.load();
+    latency_ = prev ? prev + (micros - prev) / 16 : micros;
+    return response;
+}
+
+void
+ForwardPool::clear()
+{
+    std::lock_guard lck{mtx_};
+    for (auto& [ip, conn] : connections_)
+        conn->close();
+    connections_.clear();
+}
+
+boost::json::object
+ForwardPool::report() const
+{
+    boost::json::object report;
+    {
+        std::lock_guard lck{mtx_};
+        report["connections"] = connections_.size();
+    }
+    report["connects"] = connects_.load();
+    report["reused"] = reused_.load();
+    report["failures"] = failures_.load();
+    report["latency_us"] = latency_.load();
+    return report;
+}
@@ -0,0 +1,175 @@
+#ifndef RIPPLE_APP_REPORTING_FORWARDPOOL_H_INCLUDED
+#define RIPPLE_APP_REPORTING_FORWARDPOOL_H_INCLUDED
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/// Time spent forwarding one request to rippled
+struct ForwardTiming
+{
+    /// connecting and handshaking. zero if an open connection was used
+    std::chrono::microseconds connect{0};
+    /// from sending the request to receiving the response
+    std::chrono::microseconds response{0};
+};
+
+/// A websocket connection to rippled that is kept open to forward requests.
+/// Requests are multiplexed by id, so any number of them may be in flight at
+/// once. The id of a forwarded request is replaced by one of the connection,
+/// and the id of the client is restored in the response
+class ForwardConnection
+    : public std::enable_shared_from_this<ForwardConnection>
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    using Result = std::promise<std::optional<boost::json::object>>;
+
+    boost::beast::websocket::stream<boost::beast::tcp_stream> ws_;
+    boost::beast::flat_buffer buffer_;
+    // messages to write. only accessed on the executor of ws_
+    std::deque<std::string> writes_;
+    // set by close(), on the executor of ws_. The connection is closed once
+    // writes_ is empty, and nothing more is written
+    bool closing_ = false;
+
+    mutable std::mutex mtx_;
+    std::unordered_map<std::uint64_t, std::shared_ptr<Result>> pending_;
+    std::uint64_t nextId_ = 1;
+    clock::time_point lastUsed_ = clock::now();
+    std::atomic_bool failed_{false};
+
+    void
+    doRead();
+
+    void
+    doWrite();
+
+    // start the websocket close. Beast allows no write alongside it, so it
+    // only runs once the last write completes
+    void
+    doClose();
+
+    // fail every request in flight. the connection is not used again
+    void
+    fail(boost::beast::error_code ec, char const* what);
+
+public:
+    explicit ForwardConnection(boost::asio::io_context& ioc);
+
+    /// Connect and handshake, blocking the caller
+    /// @param clientIp ip rippled charges for the requests of this connection
+    /// @return false on failure
+    bool
+    connect(
+        std::string const& host,
+        std::string const& port,
+        std::string const& clientIp);
+
+    /// Send request and wait for its response
+    /// @return the response. empty on error or after timeout
+    std::optional<boost::json::object>
+    forward(boost::json::object request, std::chrono::milliseconds timeout);
+
+    /// Close the connection once the pending writes are sent
+    void
+    close();
+
+    bool
+    failed() const
+    {
+        return failed_;
+    }
+
+    /// @return true if no request is in flight
+    bool
+    idle() const;
+
+    clock::time_point
+    lastUsed() const;
+};
+
+/// Open connections to one rippled, to forward requests.
+///
+/// rippled charges forwarded requests to the ip given in the handshake, so
+/// there is a connection per client ip. A client that forwards many requests
+/// reuses its connection, and pays for the handshake only once. Connections
+/// left idle are closed
+class ForwardPool
+{
+    boost::asio::io_context& ioc_;
+    std::string const host_;
+    std::string const port_;
+
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, std::shared_ptr<ForwardConnection>>
+        connections_;
+
+    std::atomic_uint64_t connects_{0};
+    std::atomic_uint64_t reused_{0};
+    std::atomic_uint64_t failures_{0};
+    // moving average of the response time, in microseconds. 0 until the
+    // first response
+    std::atomic_uint64_t latency_{0};
+
+    static constexpr std::size_t maxConnections = 256;
+    static constexpr auto idleTimeout = std::chrono::seconds(60);
+    static constexpr auto responseTimeout = std::chrono::seconds(30);
+
+    // close connections that failed or are idle for too long, and the least
+    // recently used idle one if there are too many. Must be called with mtx_
+    // held
+    void
+    sweep();
+
+    std::shared_ptr<ForwardConnection>
+    connection(std::string const& clientIp, ForwardTiming& timing);
+
+public:
+    ForwardPool(
+        boost::asio::io_context& ioc,
+        std::string host,
+        std::string port);
+
+    ~ForwardPool();
+
+    /// Forward request on behalf of clientIp
+    /// @param timing set to the time spent connecting and waiting for rippled
+    /// @return the response. empty on error
+    std::optional<boost::json::object>
+    forward(
+        boost::json::object const& request,
+        std::string const& clientIp,
+        ForwardTiming& timing);
+
+    /// Close every connection, for instance when rippled is unreachable
+    void
+    clear();
+
+    /// @return moving average of the response time of rippled. zero if no
+    /// request has been forwarded yet
+    std::chrono::microseconds
+    latency() const
+    {
+        return std::chrono::microseconds{latency_.load()};
+    }
+
+    boost::json::object
+    report() const;
+};
+
+#endif
@@ -1,17 +1,24 @@
 #include <ripple/basics/StringUtilities.h>
+#include <backend/CacheSnapshot.h>
 #include <backend/DBHelpers.h>
 #include <etl/ReportingETL.h>
 
 #include <ripple/beast/core/CurrentThreadName.h>
+#include <ripple/protocol/HashPrefix.h>
+#include <ripple/protocol/digest.h>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
+#include <algorithm>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <map>
 #include <string>
 #include <subscriptions/SubscriptionManager.h>
 #include <thread>
+#include <unordered_set>
 #include <variant>
 
 namespace detail {
@@ -26,45 +33,89 @@ toString(ripple::LedgerInfo const& info)
        << " ParentHash : " << strHex(info.parentHash) << " }";
     return ss.str();
 }
-}  // namespace detail
 
-std::vector<AccountTransactionsData>
-ReportingETL::insertTransactions(
-    ripple::LedgerInfo const& ledger,
-    org::xrpl::rpc::v1::GetLedgerResponse& data)
+/// Deserialize a transaction and its metadata, and compute its account_tx
+/// rows
+AccountTransactionsData
+parseTransaction(
+    org::xrpl::rpc::v1::TransactionAndMetadata const& txn,
+    uint32_t seq)
 {
-    std::vector<AccountTransactionsData> accountTxData;
-    for (auto& txn :
-         *(data.mutable_transactions_list()->mutable_transactions()))
-    {
-        std::string* raw = txn.mutable_transaction_blob();
-
-        ripple::SerialIter it{raw->data(), raw->size()};
-        ripple::STTx sttx{it};
+    auto const& raw = txn.transaction_blob();
+    ripple::SerialIter it{raw.data(), raw.size()};
+    ripple::STTx sttx{it};
+    ripple::TxMeta txMeta{sttx.getTransactionID(), seq, txn.metadata_blob()};
+    auto journal = ripple::debugLog();
+    return {txMeta, sttx.getTransactionID(), journal};
+}
 
-        auto txSerializer =
-            std::make_shared<ripple::Serializer>(sttx.getSerializer());
+AccountTransactionsData
+parseTransaction(Backend::TransactionAndMetadata const& txn, uint32_t seq)
+{
+    ripple::SerialIter it{txn.transaction.data(), txn.transaction.size()};
+    ripple::STTx sttx{it};
+    ripple::TxMeta txMeta{sttx.getTransactionID(), seq, txn.metadata};
+    auto journal = ripple::debugLog();
+    return {txMeta, sttx.getTransactionID(), journal};
+}
+}  // namespace detail
 
-        ripple::TxMeta txMeta{
-            sttx.getTransactionID(), ledger.seq, txn.metadata_blob()};
+ParallelFor
+ReportingETL::parseTransactions(
+    ripple::LedgerInfo const& ledger,
+    org::xrpl::rpc::v1::GetLedgerResponse const& data,
+    std::vector<AccountTransactionsData>& accountTxData)
+{
+    auto const& txns = data.transactions_list().transactions();
+    accountTxData.resize(txns.size());
+    // deserializing a transaction and its metadata takes tens of
+    // microseconds, so smaller chunks are not worth the handoff
+    constexpr size_t minChunk = 32;
+    return ParallelFor{
+        *transformPool_,
+        static_cast<size_t>(txns.size()),
+        transformThreads_,
+        minChunk,
+        [&txns, &accountTxData, &ledger](size_t i) {
+            accountTxData[i] = detail::parseTransaction(txns[i], ledger.seq);
+        }};
+}
 
-        auto metaSerializer = std::make_shared<ripple::Serializer>(
-            txMeta.getAsObject().getSerializer());
+void
+ReportingETL::writeTransactions(
+    ripple::LedgerInfo const& ledger,
+    org::xrpl::rpc::v1::GetLedgerResponse& data,
+    std::vector<AccountTransactionsData> const& accountTxData)
+{
+    auto& txns = *(data.mutable_transactions_list()->mutable_transactions());
+    assert(accountTxData.size() == static_cast<size_t>(txns.size()));
+    for (int i = 0; i < txns.size(); ++i)
+    {
+        auto& txn = txns[i];
+        auto const& hash = accountTxData[i].txHash;
+        BOOST_LOG_TRIVIAL(trace) << __func__ << " : "
+                                 << "Inserting transaction = " << hash;
 
-        BOOST_LOG_TRIVIAL(trace)
-            << __func__ << " : "
-            << "Inserting transaction = " << sttx.getTransactionID();
+        uint32_t const date = ledger.closeTime.time_since_epoch().count();
 
-        auto journal = ripple::debugLog();
-        accountTxData.emplace_back(txMeta, sttx.getTransactionID(), journal);
-        std::string keyStr{(const char*)sttx.getTransactionID().data(), 32};
+        std::string keyStr{(const char*)hash.data(), 32};
         backend_->writeTransaction(
             std::move(keyStr),
             ledger.seq,
-            ledger.closeTime.time_since_epoch().count(),
-            std::move(*raw),
+            date,
+            std::move(*txn.mutable_transaction_blob()),
             std::move(*txn.mutable_metadata_blob()));
     }
+}
+
+std::vector<AccountTransactionsData>
+ReportingETL::insertTransactions(
+    ripple::LedgerInfo const& ledger,
+    org::xrpl::rpc::v1::GetLedgerResponse& data)
+{
+    std::vector<AccountTransactionsData> accountTxData;
+    parseTransactions(ledger, data, accountTxData).wait();
+    writeTransactions(ledger, data, accountTxData);
     return accountTxData;
 }
 
@@ -131,11 +182,20 @@ ReportingETL::publishLedger(ripple::LedgerInfo const& lgrInfo)
 {
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " - Publishing ledger " << std::to_string(lgrInfo.seq);
-    if (!writing_)
+    // after a write conflict, the cache already holds the ledgers this
+    // process built but did not commit. They are the same ledgers, since
+    // only validated ledgers are built
+    if (backend_->partialCache().enabled())
+    {
+        auto diff = backend_->fetchLedgerDiff(lgrInfo.seq);
+        backend_->partialCache().update(diff, lgrInfo.seq);
+    }
+    else if (!writing_ && lgrInfo.seq > backend_->cache().latestSequence())
     {
         BOOST_LOG_TRIVIAL(debug) << __func__ << " - Updating cache";
         auto diff = backend_->fetchLedgerDiff(lgrInfo.seq);
         backend_->cache().update(diff, lgrInfo.seq);
+        backend_->bookIndex().update(diff, lgrInfo.seq);
     }
     backend_->updateRange(lgrInfo.seq);
     auto ledgerRange = backend_->fetchLedgerRange();
@@ -162,14 +222,46 @@ ReportingETL::publishLedger(ripple::LedgerInfo const& lgrInfo)
             << __func__ << " - could not fetch from database";
         return;
     }
+    backend_->headerCache().put(lgrInfo, *fees);
+    // recent transactions are the ones most requested. They are only cached
+    // once the ledger is committed, so they are never served before it is
+    // in the range
+    for (auto const& txn : transactions)
+    {
+        backend_->transactionCache().put(
+            ripple::sha512Half(
+                ripple::HashPrefix::transactionID,
+                ripple::makeSlice(txn.transaction)),
+            txn);
+    }
+
+    // the accounts of the transactions are only needed to update cached
+    // accounts
+    std::vector<AccountTransactionsData> accountTxData;
+    if (backend_->accountTxCache().size() || backend_->trustLineCache().size())
+    {
+        accountTxData.resize(transactions.size());
+        ParallelFor work{
+            *transformPool_,
+            transactions.size(),
+            transformThreads_,
+            32,
+            [&transactions, &accountTxData, &lgrInfo](size_t i) {
+                accountTxData[i] =
+                    detail::parseTransaction(transactions[i], lgrInfo.seq);
+            }};
+        work.wait();
+    }
+    backend_->accountTxCache().update(accountTxData, lgrInfo.seq);
+    backend_->trustLineCache().update(accountTxData, lgrInfo.seq);
 
     std::string range = std::to_string(ledgerRange->minSequence) + "-" +
         std::to_string(ledgerRange->maxSequence);
 
     subscriptions_->pubLedger(lgrInfo, *fees, range, transactions.size());
 
-    for (auto& txAndMeta : transactions)
-        subscriptions_->pubTransaction(txAndMeta, lgrInfo);
+    subscriptions_->pubTransactions(
+        transactions, lgrInfo, *transformPool_, transformThreads_);
 
     setLastPublish();
     BOOST_LOG_TRIVIAL(debug)
@@ -197,8 +289,9 @@ ReportingETL::publishLedger(
                                          << "Trying to publish. Could not find "
                                             "ledger with sequence = "
                                          << ledgerSequence;
-                // We try maxAttempts times to publish the ledger, waiting one
-                // second in between each attempt.
+                // We try maxAttempts times to publish the ledger, waiting up
+                // to one second in between each attempt. The wait ends early
+                // if the backend is notified that the writer committed it.
                 if (maxAttempts && numAttempts >= maxAttempts)
                 {
                     BOOST_LOG_TRIVIAL(debug)
@@ -207,7 +300,8 @@ ReportingETL::publishLedger(
                         << " attempts.";
                     return false;
                 }
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+                backend_->waitForCommit(
+                    ledgerSequence, std::chrono::seconds(1));
                 ++numAttempts;
                 continue;
             }
@@ -256,9 +350,176 @@ ReportingETL::fetchLedgerDataAndDiff(uint32_t idx)
     return response;
 }
 
-std::pair<ripple::LedgerInfo, bool>
+void
+ReportingETL::writeSourceSuccessors(
+    org::xrpl::rpc::v1::GetLedgerResponse& data,
+    uint32_t seq)
+{
+    BOOST_LOG_TRIVIAL(debug) << __func__ << " object neighbors included";
+    for (auto& obj : *(data.mutable_book_successors()))
+    {
+        auto firstBook = std::move(*obj.mutable_first_book());
+        if (!firstBook.size())
+            firstBook = uint256ToString(Backend::lastKey);
+        backend_->writeSuccessor(
+            std::move(*obj.mutable_book_base()), seq, std::move(firstBook));
+        BOOST_LOG_TRIVIAL(debug) << __func__ << " writing book successor "
+                                 << ripple::strHex(obj.book_base()) << " - "
+                                 << ripple::strHex(firstBook);
+    }
+    for (auto& obj : *(data.mutable_ledger_objects()->mutable_objects()))
+    {
+        if (obj.mod_type() != org::xrpl::rpc::v1::RawLedgerObject::MODIFIED)
+        {
+            std::string* predPtr = obj.mutable_predecessor();
+            if (!predPtr->size())
+                *predPtr = uint256ToString(Backend::firstKey);
+            std::string* succPtr = obj.mutable_successor();
+            if (!succPtr->size())
+                *succPtr = uint256ToString(Backend::lastKey);
+
+            if (obj.mod_type() ==
+                org::xrpl::rpc::v1::RawLedgerObject::DELETED)
+            {
+                BOOST_LOG_TRIVIAL(debug)
+                    << __func__ << " modifying successors for deleted object "
+                    << ripple::strHex(obj.key()) << " - "
+                    << ripple::strHex(*predPtr) << " - "
+                    << ripple::strHex(*succPtr);
+                backend_->writeSuccessor(
+                    std::move(*predPtr), seq, std::move(*succPtr));
+            }
+            else
+            {
+                BOOST_LOG_TRIVIAL(debug)
+                    << __func__ << " adding successor for new object "
+                    << ripple::strHex(obj.key()) << " - "
+                    << ripple::strHex(*predPtr) << " - "
+                    << ripple::strHex(*succPtr);
+                backend_->writeSuccessor(
+                    std::move(*predPtr), seq, std::string{obj.key()});
+                backend_->writeSuccessor(
+                    std::string{obj.key()}, seq, std::move(*succPtr));
+            }
+        }
+        else
+            BOOST_LOG_TRIVIAL(debug) << __func__ << " object modified "
+                                     << ripple::strHex(obj.key());
+    }
+}
+
+std::optional<ripple::uint256>
+ReportingETL::bookSuccessorToUpdate(
+    ripple::uint256 const& key,
+    ripple::Slice blob,
+    uint32_t seq)
+{
+    bool checkBookBase = false;
+    bool isDeleted = (blob.size() == 0);
+    if (isDeleted)
+    {
+        auto old = backend_->cache().get(key, seq - 1);
+        assert(old);
+        checkBookBase = isBookDir(key, *old);
+    }
+    else
+        checkBookBase = isBookDir(key, blob);
+    if (!checkBookBase)
+        return {};
+    BOOST_LOG_TRIVIAL(debug)
+        << __func__ << " is book dir. key = " << ripple::strHex(key);
+    auto bookBase = getBookBase(key);
+    auto oldFirstDir = backend_->cache().getSuccessor(bookBase, seq - 1);
+    assert(oldFirstDir);
+    // We deleted the first directory, or we added a directory prior
+    // to the old first directory
+    if ((isDeleted && key == oldFirstDir->key) ||
+        (!isDeleted && key < oldFirstDir->key))
+    {
+        BOOST_LOG_TRIVIAL(debug)
+            << __func__ << " Need to recalculate book base successor. base = "
+            << ripple::strHex(bookBase) << " - key = " << ripple::strHex(key)
+            << " - isDeleted = " << isDeleted << " - seq = " << seq;
+        return bookBase;
+    }
+    return {};
+}
+
+void
+ReportingETL::writeCacheSuccessors(
+    std::vector<Backend::LedgerObject> const& cacheUpdates,
+    std::set<ripple::uint256> const& modified,
+    std::set<ripple::uint256> const& bookSuccessorsToCalculate,
+    uint32_t seq)
+{
+    assert(backend_->cache().isFull());
+    // the neighbors of every created or deleted object are looked up in
+    // parallel, and then written in the order of the objects, so that
+    // the writes are the same whatever the number of threads
+    std::vector<std::pair<ripple::uint256, ripple::uint256>> neighbors(
+        cacheUpdates.size());
+    {
+        constexpr size_t minChunk = 256;
+        ParallelFor lookups{
+            *transformPool_,
+            cacheUpdates.size(),
+            transformThreads_,
+            minChunk,
+            [this, &cacheUpdates, &modified, &neighbors, seq](size_t i) {
+                auto const& obj = cacheUpdates[i];
+                if (modified.count(obj.key))
+                    return;
+                auto lb = backend_->cache().getPredecessor(obj.key, seq);
+                auto ub = backend_->cache().getSuccessor(obj.key, seq);
+                neighbors[i] = {
+                    lb ? lb->key : Backend::firstKey,
+                    ub ? ub->key : Backend::lastKey};
+            }};
+        lookups.wait();
+    }
+    for (size_t i = 0; i < cacheUpdates.size(); ++i)
+    {
+        auto const& obj = cacheUpdates[i];
+        if (modified.count(obj.key))
+            continue;
+        auto const& [lb, ub] = neighbors[i];
+        if (obj.blob.size() == 0)
+        {
+            BOOST_LOG_TRIVIAL(debug)
+                << __func__ << " writing successor for deleted object "
+                << ripple::strHex(obj.key) << " - " << ripple::strHex(lb)
+                << " - " << ripple::strHex(ub);
+            backend_->writeSuccessor(
+                uint256ToString(lb), seq, uint256ToString(ub));
+        }
+        else
+        {
+            backend_->writeSuccessor(
+                uint256ToString(lb), seq, uint256ToString(obj.key));
+            backend_->writeSuccessor(
+                uint256ToString(obj.key), seq, uint256ToString(ub));
+            BOOST_LOG_TRIVIAL(debug)
+                << __func__ << " writing successor for new object "
+                << ripple::strHex(lb) << " - " << ripple::strHex(obj.key)
+                << " - " << ripple::strHex(ub);
+        }
+    }
+    for (auto const& base : bookSuccessorsToCalculate)
+    {
+        auto succ = backend_->cache().getSuccessor(base, seq);
+        auto first = succ ? succ->key : Backend::lastKey;
+        backend_->writeSuccessor(
+            uint256ToString(base), seq, uint256ToString(first));
+        BOOST_LOG_TRIVIAL(debug)
+            << __func__ << " Updating book successor " << ripple::strHex(base)
+            << " - " << ripple::strHex(first);
+    }
+}
+
+ripple::LedgerInfo
 ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
 {
+    using clock = std::chrono::steady_clock;
     BOOST_LOG_TRIVIAL(debug) << __func__ << " : "
                              << "Beginning ledger update";
 
@@ -268,6 +529,13 @@ ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " : "
         << "Deserialized ledger header. " << detail::toString(lgrInfo);
+
+    // transactions are deserialized in the background while the objects are
+    // processed below. Nothing but the transactions list is read by it
+    auto const transactionsStart = clock::now();
+    std::vector<AccountTransactionsData> accountTxData;
+    auto parsing = parseTransactions(lgrInfo, rawData, accountTxData);
+
     backend_->startWrites();
 
     BOOST_LOG_TRIVIAL(debug) << __func__ << " : "
@@ -276,68 +544,13 @@ ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
     BOOST_LOG_TRIVIAL(debug) << __func__ << " : "
                              << "wrote ledger header";
 
+    auto successorsStart = clock::now();
     // Write successor info, if included from rippled
     if (rawData.object_neighbors_included())
-    {
-        BOOST_LOG_TRIVIAL(debug) << __func__ << " object neighbors included";
-        for (auto& obj : *(rawData.mutable_book_successors()))
-        {
-            auto firstBook = std::move(*obj.mutable_first_book());
-            if (!firstBook.size())
-                firstBook = uint256ToString(Backend::lastKey);
-            backend_->writeSuccessor(
-                std::move(*obj.mutable_book_base()),
-                lgrInfo.seq,
-                std::move(firstBook));
-            BOOST_LOG_TRIVIAL(debug) << __func__ << " writing book successor "
-                                     << ripple::strHex(obj.book_base()) << " - "
-                                     << ripple::strHex(firstBook);
-        }
-        for (auto& obj : *(rawData.mutable_ledger_objects()->mutable_objects()))
-        {
-            if (obj.mod_type() != org::xrpl::rpc::v1::RawLedgerObject::MODIFIED)
-            {
-                std::string* predPtr = obj.mutable_predecessor();
-                if (!predPtr->size())
-                    *predPtr = uint256ToString(Backend::firstKey);
-                std::string* succPtr = obj.mutable_successor();
-                if (!succPtr->size())
-                    *succPtr = uint256ToString(Backend::lastKey);
-
-                if (obj.mod_type() ==
-                    org::xrpl::rpc::v1::RawLedgerObject::DELETED)
-                {
-                    BOOST_LOG_TRIVIAL(debug)
-                        << __func__
-                        << " modifying successors for deleted object "
-                        << ripple::strHex(obj.key()) << " - "
-                        << ripple::strHex(*predPtr) << " - "
-                        << ripple::strHex(*succPtr);
-                    backend_->writeSuccessor(
-                        std::move(*predPtr), lgrInfo.seq, std::move(*succPtr));
-                }
-                else
-                {
-                    BOOST_LOG_TRIVIAL(debug)
-                        << __func__ << " adding successor for new object "
-                        << ripple::strHex(obj.key()) << " - "
-                        << ripple::strHex(*predPtr) << " - "
-                        << ripple::strHex(*succPtr);
-                    backend_->writeSuccessor(
-                        std::move(*predPtr),
-                        lgrInfo.seq,
-                        std::string{obj.key()});
-                    backend_->writeSuccessor(
-                        std::string{obj.key()},
-                        lgrInfo.seq,
-                        std::move(*succPtr));
-                }
-            }
-            else
-                BOOST_LOG_TRIVIAL(debug) << __func__ << " object modified "
-                                         << ripple::strHex(obj.key());
-        }
-    }
+        writeSourceSuccessors(rawData, lgrInfo.seq);
+    auto successorsTime = clock::now() - successorsStart;
+
+    auto const objectsStart = clock::now();
     std::vector<Backend::LedgerObject> cacheUpdates;
     cacheUpdates.reserve(rawData.ledger_objects().objects_size());
     // TODO change these to unordered_set
@@ -363,41 +576,9 @@ ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
                 throw std::runtime_error(
                     "Cache is not full, but object neighbors were not "
                     "included");
-            auto blob = obj.mutable_data();
-            bool checkBookBase = false;
-            bool isDeleted = (blob->size() == 0);
-            if (isDeleted)
-            {
-                auto old = backend_->cache().get(*key, lgrInfo.seq - 1);
-                assert(old);
-                checkBookBase = isBookDir(*key, *old);
-            }
-            else
-                checkBookBase = isBookDir(*key, *blob);
-            if (checkBookBase)
-            {
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__
-                    << " is book dir. key = " << ripple::strHex(*key);
-                auto bookBase = getBookBase(*key);
-                auto oldFirstDir =
-                    backend_->cache().getSuccessor(bookBase, lgrInfo.seq - 1);
-                assert(oldFirstDir);
-                // We deleted the first directory, or we added a directory prior
-                // to the old first directory
-                if ((isDeleted && key == oldFirstDir->key) ||
-                    (!isDeleted && key < oldFirstDir->key))
-                {
-                    BOOST_LOG_TRIVIAL(debug)
-                        << __func__
-                        << " Need to recalculate book base successor. base = "
-                        << ripple::strHex(bookBase)
-                        << " - key = " << ripple::strHex(*key)
-                        << " - isDeleted = " << isDeleted
-                        << " - seq = " << lgrInfo.seq;
-                    bookSuccessorsToCalculate.insert(bookBase);
-                }
-            }
+            if (auto base = bookSuccessorToUpdate(
+                    *key, ripple::makeSlice(obj.data()), lgrInfo.seq))
+                bookSuccessorsToCalculate.insert(*base);
         }
         if (obj.mod_type() == org::xrpl::rpc::v1::RawLedgerObject::MODIFIED)
             modified.insert(*key);
@@ -408,86 +589,28 @@ ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
             std::move(*obj.mutable_data()));
     }
     backend_->cache().update(cacheUpdates, lgrInfo.seq);
+    backend_->bookIndex().update(cacheUpdates, lgrInfo.seq);
+    objectsStage_.add(clock::now() - objectsStart);
+
+    successorsStart = clock::now();
     // rippled didn't send successor information, so use our cache
     if (!rawData.object_neighbors_included() || backend_->cache().isFull())
     {
         BOOST_LOG_TRIVIAL(debug)
             << __func__ << " object neighbors not included. using cache";
-        assert(backend_->cache().isFull());
-        size_t idx = 0;
-        for (auto const& obj : cacheUpdates)
-        {
-            if (modified.count(obj.key))
-                continue;
-            auto lb = backend_->cache().getPredecessor(obj.key, lgrInfo.seq);
-            if (!lb)
-                lb = {Backend::firstKey, {}};
-            auto ub = backend_->cache().getSuccessor(obj.key, lgrInfo.seq);
-            if (!ub)
-                ub = {Backend::lastKey, {}};
-            if (obj.blob.size() == 0)
-            {
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__ << " writing successor for deleted object "
-                    << ripple::strHex(obj.key) << " - "
-                    << ripple::strHex(lb->key) << " - "
-                    << ripple::strHex(ub->key);
-                backend_->writeSuccessor(
-                    uint256ToString(lb->key),
-                    lgrInfo.seq,
-                    uint256ToString(ub->key));
-            }
-            else
-            {
-                backend_->writeSuccessor(
-                    uint256ToString(lb->key),
-                    lgrInfo.seq,
-                    uint256ToString(obj.key));
-                backend_->writeSuccessor(
-                    uint256ToString(obj.key),
-                    lgrInfo.seq,
-                    uint256ToString(ub->key));
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__ << " writing successor for new object "
-                    << ripple::strHex(lb->key) << " - "
-                    << ripple::strHex(obj.key) << " - "
-                    << ripple::strHex(ub->key);
-            }
-        }
-        for (auto const& base : bookSuccessorsToCalculate)
-        {
-            auto succ = backend_->cache().getSuccessor(base, lgrInfo.seq);
-            if (succ)
-            {
-                backend_->writeSuccessor(
-                    uint256ToString(base),
-                    lgrInfo.seq,
-                    uint256ToString(succ->key));
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__ << " Updating book successor "
-                    << ripple::strHex(base) << " - "
-                    << ripple::strHex(succ->key);
-            }
-            else
-            {
-                backend_->writeSuccessor(
-                    uint256ToString(base),
-                    lgrInfo.seq,
-                    uint256ToString(Backend::lastKey));
-                BOOST_LOG_TRIVIAL(debug)
-                    << __func__ << " Updating book successor "
-                    << ripple::strHex(base) << " - "
-                    << ripple::strHex(Backend::lastKey);
-            }
-        }
+        writeCacheSuccessors(
+            cacheUpdates, modified, bookSuccessorsToCalculate, lgrInfo.seq);
     }
+    successorsStage_.add(successorsTime + (clock::now() - successorsStart));
 
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " : "
         << "Inserted/modified/deleted all objects. Number of objects = "
         << rawData.ledger_objects().objects_size();
-    std::vector<AccountTransactionsData> accountTxData{
-        insertTransactions(lgrInfo, rawData)};
+    transactionsStage_.add(parsing.wait() - transactionsStart);
+
+    auto const writeStart = clock::now();
+    writeTransactions(lgrInfo, rawData, accountTxData);
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " : "
         << "Inserted all transactions. Number of transactions  = "
@@ -495,18 +618,239 @@ ReportingETL::buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData)
     backend_->writeAccountTransactions(std::move(accountTxData));
     BOOST_LOG_TRIVIAL(debug) << __func__ << " : "
                              << "wrote account_tx";
-    auto start = std::chrono::system_clock::now();
-    bool success = backend_->finishWrites(lgrInfo.seq);
-    auto end = std::chrono::system_clock::now();
+    writeStage_.add(clock::now() - writeStart);
 
-    auto duration = ((end - start).count()) / 1000000000.0;
     BOOST_LOG_TRIVIAL(debug)
-        << __func__ << " finished writes. took " << std::to_string(duration);
+        << __func__ << " : "
+        << "Finished ledger update. " << detail::toString(lgrInfo);
+    return lgrInfo;
+}
+
+boost::json::object
+ReportingETL::BackfillProgress::report() const
+{
+    boost::json::object report;
+    auto numLedgers = ledgers.load();
+    auto numTxns = transactions.load();
+    report["ledgers"] = numLedgers;
+    report["transactions"] = numTxns;
+    report["objects"] = objects.load();
+    double seconds = elapsedMicros.load() / 1000000.0;
+    if (seconds > 0)
+    {
+        report["ledgers_per_second"] = numLedgers / seconds;
+        report["transactions_per_second"] = numTxns / seconds;
+    }
+    return report;
+}
 
+bool
+ReportingETL::writeBackfillLedger(org::xrpl::rpc::v1::GetLedgerResponse& data)
+{
+    ripple::LedgerInfo lgrInfo =
+        deserializeHeader(ripple::makeSlice(data.ledger_header()));
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " : "
-        << "Finished ledger update. " << detail::toString(lgrInfo);
-    return {lgrInfo, success};
+        << "Deserialized ledger header. " << detail::toString(lgrInfo);
+
+    backend_->writeLedger(lgrInfo, std::move(*data.mutable_ledger_header()));
+    bool const neighborsIncluded = data.object_neighbors_included();
+    if (neighborsIncluded)
+        writeSourceSuccessors(data, lgrInfo.seq);
+    for (auto& obj : *(data.mutable_ledger_objects()->mutable_objects()))
+    {
+        backend_->writeLedgerObject(
+            std::move(*obj.mutable_key()),
+            lgrInfo.seq,
+            std::move(*obj.mutable_data()));
+    }
+    // every worker is busy with a ledger of its own, so the transactions are
+    // parsed on this thread
+    std::vector<AccountTransactionsData> accountTxData;
+    accountTxData.reserve(data.transactions_list().transactions_size());
+    for (auto const& txn : data.transactions_list().transactions())
+        accountTxData.push_back(detail::parseTransaction(txn, lgrInfo.seq));
+    writeTransactions(lgrInfo, data, accountTxData);
+    backend_->writeAccountTransactions(std::move(accountTxData));
+    return neighborsIncluded;
+}
+
+bool
+ReportingETL::stitchBackfill(
+    uint32_t startSequence,
+    uint32_t finishSequence,
+    std::set<uint32_t> const& missingSuccessors)
+{
+    auto& cache = backend_->cache();
+    // diffs are read back this many ledgers at a time, in parallel, and
+    // applied in order
+    constexpr uint32_t batchSize = 64;
+    for (uint64_t first = startSequence + 1;
+         first <= finishSequence && !stopping_;
+         first += batchSize)
+    {
+        uint64_t last =
+            std::min<uint64_t>(finishSequence, first + batchSize - 1);
+        std::vector<std::vector<Backend::LedgerObject>> diffs(
+            last - first + 1);
+        ParallelFor fetches{
+            *transformPool_,
+            diffs.size(),
+            transformThreads_,
+            1,
+            [this, &diffs, first](size_t i) {
+                while (!stopping_)
+                {
+                    try
+                    {
+                        diffs[i] = backend_->fetchLedgerDiff(first + i);
+                        return;
+                    }
+                    catch (Backend::DatabaseTimeout const&)
+                    {
+                        BOOST_LOG_TRIVIAL(warning)
+                            << "stitchBackfill : read timeout fetching "
+                               "ledger diff";
+                    }
+                }
+            }};
+        fetches.wait();
+
+        for (size_t i = 0; i < diffs.size() && !stopping_; ++i)
+        {
+            uint32_t seq = first + i;
+            auto const& diff = diffs[i];
+            bool const writeSuccessors = missingSuccessors.count(seq);
+            // diffs hold no modification type. An object is created if the
+            // cache does not have it yet
+            std::set<ripple::uint256> modified;
+            std::set<ripple::uint256> bookSuccessorsToCalculate;
+            if (writeSuccessors)
+            {
+                for (auto const& obj : diff)
+                {
+                    if (obj.blob.size() && cache.get(obj.key, seq - 1))
+                    {
+                        modified.insert(obj.key);
+                        continue;
+                    }
+                    if (auto base = bookSuccessorToUpdate(
+                            obj.key, ripple::makeSlice(obj.blob), seq))
+                        bookSuccessorsToCalculate.insert(*base);
+                }
+            }
+            cache.update(diff, seq);
+            backend_->bookIndex().update(diff, seq);
+            if (writeSuccessors)
+                writeCacheSuccessors(
+                    diff, modified, bookSuccessorsToCalculate, seq);
+        }
+    }
+    return !stopping_;
+}
+
+std::optional<uint32_t>
+ReportingETL::backfill(uint32_t startSequence, uint32_t finishSequence)
+{
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " : "
+        << "Backfilling ledgers " << startSequence + 1 << " - "
+        << finishSequence << " with " << backfillWorkers_ << " workers";
+    writing_ = true;
+    auto const begin = std::chrono::steady_clock::now();
+
+    // ledgers are handed out in order, so that the ledgers being written at
+    // any time are close to each other. Sequences are spread over the ETL
+    // sources by the load balancer
+    std::atomic_uint64_t nextSequence = startSequence + 1;
+    std::atomic_bool aborted = false;
+    std::mutex missingMtx;
+    std::set<uint32_t> missingSuccessors;
+
+    auto work = [&, this](size_t i) {
+        beast::setCurrentThreadName("rippled: ReportingETL backfill");
+        auto& progress = backfillProgress_[i];
+        uint64_t next;
+        while (!isStopping() && (next = nextSequence++) <= finishSequence)
+        {
+            uint32_t const seq = next;
+            std::optional<org::xrpl::rpc::v1::GetLedgerResponse> data =
+                loadBalancer_->fetchLedger(seq, true, true);
+            // only empty if the server is shutting down
+            if (!data)
+            {
+                aborted = true;
+                break;
+            }
+            auto numTxns = data->transactions_list().transactions_size();
+            auto numObjects = data->ledger_objects().objects_size();
+            if (!writeBackfillLedger(*data))
+            {
+                std::lock_guard lck{missingMtx};
+                missingSuccessors.insert(seq);
+            }
+            ++progress.ledgers;
+            progress.transactions += numTxns;
+            progress.objects += numObjects;
+            progress.elapsedMicros =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - begin)
+                    .count();
+            if (progress.ledgers % 1000 == 0)
+                BOOST_LOG_TRIVIAL(info)
+                    << "Backfill worker " << i << " : "
+                    << boost::json::serialize(progress.report())
+                    << ". last seq = " << seq;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < backfillWorkers_; ++i)
+        workers.emplace_back(work, i);
+    for (auto& t : workers)
+        t.join();
+
+    for (size_t i = 0; i < backfillWorkers_; ++i)
+        BOOST_LOG_TRIVIAL(info)
+            << "Backfill worker " << i << " finished : "
+            << boost::json::serialize(backfillProgress_[i].report());
+
+    std::optional<uint32_t> committed;
+    if (aborted || isStopping())
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " : "
+            << "Backfill aborted. Nothing after ledger " << startSequence
+            << " is committed";
+    }
+    else if (!missingSuccessors.empty() && !backend_->cache().isFull())
+    {
+        BOOST_LOG_TRIVIAL(error)
+            << __func__ << " : " << missingSuccessors.size()
+            << " ledgers were extracted without successors, and the cache "
+               "is not full. Nothing after ledger "
+            << startSequence << " is committed";
+    }
+    else
+    {
+        // the diffs are read back from the database
+        backend_->waitForWrites();
+        BOOST_LOG_TRIVIAL(info)
+            << __func__ << " : "
+            << "Stitching successors. " << missingSuccessors.size()
+            << " ledgers were extracted without successors";
+        if (stitchBackfill(startSequence, finishSequence, missingSuccessors) &&
+            backend_->finishBackfill(finishSequence))
+            committed = finishSequence;
+    }
+    writing_ = false;
+    auto const end = std::chrono::steady_clock::now();
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " : "
+        << "Backfill finished in "
+        << std::chrono::duration_cast<std::chrono::seconds>(end - begin)
+               .count()
+        << " seconds. Committed = " << (committed ? "yes" : "no");
+    return committed;
 }
 
 // Database must be populated when this starts
@@ -517,13 +861,13 @@ ReportingETL::runETLPipeline(uint32_t startSequence, int numExtractors)
         return {};
 
     /*
-     * Behold, mortals! This function spawns three separate threads, which talk
-     * to each other via 2 different thread safe queues and 1 atomic variable.
-     * All threads and queues are function local. This function returns when all
-     *
+     * Behold, mortals! This function spawns extractor threads, a transformer
+     * thread and a committer thread, which talk to each other via a ring of
+     * fetched ledgers, a window of uncommitted ledgers and 1 atomic variable.
+     * All threads and containers are function local. This function returns when all
      * of the threads exit. There are two termination conditions: the first is
-     * if the load thread encounters a write conflict. In this case, the load
-     * thread sets writeConflict, an atomic bool, to true, which signals the
+     * if the committer encounters a write conflict. In this case, the
+     * committer sets writeConflict, an atomic bool, to true, which signals the
      * other threads to stop. The second termination condition is when the
      * entire server is shutting down, which is detected in one of three ways:
      * 1. isStopping() returns true if the server is shutting down
@@ -532,10 +876,10 @@ ReportingETL::runETLPipeline(uint32_t startSequence, int numExtractors)
      * 3. fetchLedgerDataAndDiff returns an empty optional, signaling the fetch
      * was aborted.
      * In all cases, the extract thread detects this condition,
-     * and pushes an empty optional onto the transform queue. The transform
-     * thread, upon popping an empty optional, pushes an empty optional onto the
-     * load queue, and then returns. The load thread, upon popping an empty
-     * optional, returns.
+     * and hands an empty optional to the transformer, or ends the ring. The
+     * transform thread, upon taking an empty optional, marks the window as
+     * done, and then returns. The committer, once it has committed every
+     * ledger in the window, returns.
      */
 
     BOOST_LOG_TRIVIAL(debug) << __func__ << " : "
@@ -552,100 +896,198 @@ ReportingETL::runETLPipeline(uint32_t startSequence, int numExtractors)
 
     std::atomic_bool writeConflict = false;
     std::optional<uint32_t> lastPublishedSequence;
-    uint32_t maxQueueSize = 1000 / numExtractors;
     auto begin = std::chrono::system_clock::now();
-    using QueueType =
-        ThreadSafeQueue<std::optional<org::xrpl::rpc::v1::GetLedgerResponse>>;
-    std::vector<std::shared_ptr<QueueType>> queues;
 
-    auto getNext = [&queues, &startSequence, &numExtractors](
-                       uint32_t sequence) -> std::shared_ptr<QueueType> {
-        return queues[(sequence - startSequence) % numExtractors];
+    // ledgers are claimed in order by the extractors, and handed to the
+    // transformer by sequence through fetched, without a lock. The
+    // extractors keep as many fetches in flight, and read as many ledgers
+    // ahead of the transformer, as there are validated ledgers it has yet to
+    // get to, within numExtractors and maxReadAhead. So the pipeline widens
+    // while catching up, and fetches a single ledger at a time at the tip
+    uint32_t const maxExtractors = std::max(numExtractors, 1);
+    uint32_t const maxReadAhead = 1000;
+    ReadAheadRing<std::optional<org::xrpl::rpc::v1::GetLedgerResponse>>
+        fetched{maxReadAhead};
+    // claims are made under claimMtx. An extractor that may not claim yet
+    // waits on claimCv, and is woken by the transformer when it takes a
+    // ledger, which lets one more ledger be read ahead
+    std::mutex claimMtx;
+    std::condition_variable claimCv;
+    std::atomic_uint32_t claimWaiters = 0;
+    uint32_t nextFetch = startSequence;
+    std::atomic_uint32_t nextTransform = startSequence;
+    uint32_t numFetching = 0;
+    // set once an extractor stopped. No more ledgers are claimed
+    bool extractDone = false;
+
+    // must be called with claimMtx held
+    auto mayClaim = [this,
+                     &nextFetch,
+                     &nextTransform,
+                     &numFetching,
+                     maxExtractors,
+                     maxReadAhead]() {
+        auto latest = networkValidatedLedgers_->getMostRecent();
+        uint32_t const transform = nextTransform;
+        uint32_t behind =
+            latest && *latest >= transform ? *latest - transform + 1 : 1;
+        return numFetching < std::min(behind, maxExtractors) &&
+            nextFetch - transform < std::min(behind, maxReadAhead);
     };
+
     std::vector<std::thread> extractors;
-    for (size_t i = 0; i < numExtractors; ++i)
+    for (size_t i = 0; i < maxExtractors; ++i)
     {
-        auto transformQueue = std::make_shared<QueueType>(maxQueueSize);
-        queues.push_back(transformQueue);
-
         extractors.emplace_back([this,
-                                 &startSequence,
                                  &writeConflict,
-                                 transformQueue,
-                                 i,
-                                 numExtractors]() {
+                                 &claimMtx,
+                                 &claimCv,
+                                 &claimWaiters,
+                                 &fetched,
+                                 &nextFetch,
+                                 &numFetching,
+                                 &extractDone,
+                                 &mayClaim,
+                                 i]() {
             beast::setCurrentThreadName("rippled: ReportingETL extract");
-            uint32_t currentSequence = startSequence + i;
 
             double totalTime = 0;
+            size_t numFetched = 0;
 
             // there are two stopping conditions here.
             // First, if there is a write conflict in the load thread, the
             // ETL mechanism should stop. The other stopping condition is if
             // the entire server is shutting down. This can be detected in a
             // variety of ways. See the comment at the top of the function
-            while ((!finishSequence_ || currentSequence <= *finishSequence_) &&
-                   networkValidatedLedgers_->waitUntilValidatedByNetwork(
-                       currentSequence) &&
-                   !writeConflict && !isStopping())
+            while (true)
             {
-                auto start = std::chrono::system_clock::now();
-                std::optional<org::xrpl::rpc::v1::GetLedgerResponse>
-                    fetchResponse{fetchLedgerDataAndDiff(currentSequence)};
-                auto end = std::chrono::system_clock::now();
-
-                auto time = ((end - start).count()) / 1000000000.0;
-                totalTime += time;
+                uint32_t currentSequence;
+                {
+                    std::unique_lock lck{claimMtx};
+                    auto ready = [&]() {
+                        return extractDone || writeConflict || isStopping() ||
+                            mayClaim();
+                    };
+                    if (!ready())
+                    {
+                        ++claimWaiters;
+                        claimCv.wait(lck, ready);
+                        --claimWaiters;
+                    }
+                    // the end of fetched tells the transformer to shut down
+                    if (extractDone || writeConflict || isStopping() ||
+                        (finishSequence_ && nextFetch > *finishSequence_))
+                    {
+                        fetched.close(nextFetch);
+                        extractDone = true;
+                        lck.unlock();
+                        claimCv.notify_all();
+                        break;
+                    }
+                    currentSequence = nextFetch++;
+                    ++numFetching;
+                    // while catching up, there is room for more than one
+                    // claim at a time
+                    if (claimWaiters && mayClaim())
+                        claimCv.notify_one();
+                }
 
-                auto tps =
-                    fetchResponse->transactions_list().transactions_size() /
-                    time;
+                std::optional<org::xrpl::rpc::v1::GetLedgerResponse>
+                    fetchResponse;
+                if (networkValidatedLedgers_->waitUntilValidatedByNetwork(
+                        currentSequence) &&
+                    !writeConflict && !isStopping())
+                {
+                    auto start = std::chrono::system_clock::now();
+                    fetchResponse = fetchLedgerDataAndDiff(currentSequence);
+                    auto end = std::chrono::system_clock::now();
+
+                    auto time = ((end - start).count()) / 1000000000.0;
+                    totalTime += time;
+                    ++numFetched;
+
+                    if (fetchResponse)
+                    {
+                        auto tps = fetchResponse->transactions_list()
+                                       .transactions_size() /
+                            time;
+
+                        BOOST_LOG_TRIVIAL(info)
+                            << "Extract phase time = " << time
+                            << " . Extract phase tps = " << tps
+                            << " . Avg extract time = "
+                            << totalTime / numFetched
+                            << " . thread num = " << i
+                            << " . seq = " << currentSequence;
+                    }
+                }
 
-                BOOST_LOG_TRIVIAL(info)
-                    << "Extract phase time = " << time
-                    << " . Extract phase tps = " << tps
-                    << " . Avg extract time = "
-                    << totalTime / (currentSequence - startSequence + 1)
-                    << " . thread num = " << i
-                    << " . seq = " << currentSequence;
                 // if the fetch is unsuccessful, stop. fetchLedger only
                 // returns false if the server is shutting down, or if the
                 // ledger was found in the database (which means another
                 // process already wrote the ledger that this process was
                 // trying to extract; this is a form of a write conflict).
                 // Otherwise, fetchLedgerDataAndDiff will keep trying to
-                // fetch the specified ledger until successful
-                if (!fetchResponse)
+                // fetch the specified ledger until successful. The empty
+                // optional tells the transformer to shut down
+                bool const stop = !fetchResponse;
+                fetched.put(currentSequence, std::move(fetchResponse));
                 {
-                    break;
+                    std::lock_guard lck{claimMtx};
+                    --numFetching;
+                    if (stop)
+                        extractDone = true;
                 }
-
-                transformQueue->push(std::move(fetchResponse));
-                currentSequence += numExtractors;
-                if (finishSequence_ && currentSequence > *finishSequence_)
+                if (stop)
+                {
+                    claimCv.notify_all();
                     break;
+                }
             }
-            // empty optional tells the transformer to shut down
-            transformQueue->push({});
         });
     }
 
+    // ledgers built by the transformer and not yet committed, oldest first,
+    // including the one being committed. The transformer builds a ledger only
+    // while fewer than writeWindow are uncommitted, so the writes of one
+    // ledger drain while the next ones are built. Ledgers are committed in
+    // order by the committer, which is the only thread to advance the range
+    uint32_t const writeWindow = std::max(backend_->writeWindow(), 1u);
+    std::mutex commitMtx;
+    std::condition_variable commitCv;
+    std::deque<ripple::LedgerInfo> uncommitted;
+    bool transformerDone = false;
+
     std::thread transformer{[this,
-                             &minSequence,
                              &writeConflict,
                              &startSequence,
-                             &getNext,
-                             &lastPublishedSequence]() {
+                             &claimMtx,
+                             &claimCv,
+                             &claimWaiters,
+                             &fetched,
+                             &nextTransform,
+                             &writeWindow,
+                             &commitMtx,
+                             &commitCv,
+                             &uncommitted,
+                             &transformerDone]() {
         beast::setCurrentThreadName("rippled: ReportingETL transform");
         uint32_t currentSequence = startSequence;
 
-        auto begin = std::chrono::system_clock::now();
-
         while (!writeConflict)
         {
-            std::optional<org::xrpl::rpc::v1::GetLedgerResponse> fetchResponse{
-                getNext(currentSequence)->pop()};
-            ++currentSequence;
+            auto fetchResponse = fetched.take(currentSequence);
+            nextTransform = ++currentSequence;
+            // a waiting extractor increments claimWaiters before it checks
+            // nextTransform, so either it sees the new value or this sees it
+            // waiting
+            if (claimWaiters)
+            {
+                {
+                    std::lock_guard lck{claimMtx};
+                }
+                claimCv.notify_one();
+            }
             // if fetchResponse is an empty optional, the extracter thread
             // has stopped and the transformer should stop as well
             if (!fetchResponse)
@@ -655,35 +1097,99 @@ ReportingETL::runETLPipeline(uint32_t startSequence, int numExtractors)
             if (isStopping())
                 continue;
 
+            {
+                std::unique_lock lck{commitMtx};
+                commitCv.wait(lck, [&]() {
+                    return uncommitted.size() < writeWindow || writeConflict;
+                });
+            }
+            if (writeConflict)
+                break;
+
             auto numTxns =
                 fetchResponse->transactions_list().transactions_size();
             auto numObjects = fetchResponse->ledger_objects().objects_size();
             auto start = std::chrono::system_clock::now();
-            auto [lgrInfo, success] = buildNextLedger(*fetchResponse);
+            auto lgrInfo = buildNextLedger(*fetchResponse);
             auto end = std::chrono::system_clock::now();
 
             auto duration = ((end - start).count()) / 1000000000.0;
-            if (success)
-                BOOST_LOG_TRIVIAL(info)
-                    << "Load phase of etl : "
-                    << "Successfully wrote ledger! Ledger info: "
-                    << detail::toString(lgrInfo) << ". txn count = " << numTxns
-                    << ". object count = " << numObjects
-                    << ". load time = " << duration
-                    << ". load txns per second = " << numTxns / duration
-                    << ". load objs per second = " << numObjects / duration;
-            else
-                BOOST_LOG_TRIVIAL(error)
-                    << "Error writing ledger. " << detail::toString(lgrInfo);
-            // success is false if the ledger was already written
-            if (success)
+            BOOST_LOG_TRIVIAL(info)
+                << "Transform phase of etl : "
+                << "Built ledger. Ledger info: " << detail::toString(lgrInfo)
+                << ". txn count = " << numTxns
+                << ". object count = " << numObjects
+                << ". transform time = " << duration
+                << ". transform txns per second = " << numTxns / duration
+                << ". transform objs per second = " << numObjects / duration;
             {
-                boost::asio::post(publishStrand_, [this, lgrInfo = lgrInfo]() {
-                    publishLedger(lgrInfo);
+                std::lock_guard lck{commitMtx};
+                uncommitted.push_back(lgrInfo);
+            }
+            commitCv.notify_all();
+        }
+        {
+            std::lock_guard lck{commitMtx};
+            transformerDone = true;
+        }
+        commitCv.notify_all();
+    }};
+
+    std::thread committer{[this,
+                           &minSequence,
+                           &writeConflict,
+                           &lastPublishedSequence,
+                           &commitMtx,
+                           &commitCv,
+                           &uncommitted,
+                           &transformerDone]() {
+        beast::setCurrentThreadName("rippled: ReportingETL commit");
+        while (true)
+        {
+            ripple::LedgerInfo lgrInfo;
+            {
+                std::unique_lock lck{commitMtx};
+                commitCv.wait(lck, [&]() {
+                    return !uncommitted.empty() || transformerDone;
                 });
-                lastPublishedSequence = lgrInfo.seq;
+                if (uncommitted.empty())
+                    break;
+                lgrInfo = uncommitted.front();
             }
-            writeConflict = !success;
+            // after a write conflict, the ledgers built after the one that
+            // failed are dropped. Another process is writing them
+            if (!writeConflict)
+            {
+                auto start = std::chrono::steady_clock::now();
+                bool success = backend_->finishWrites(lgrInfo.seq);
+                commitStage_.add(std::chrono::steady_clock::now() - start);
+                // success is false if the ledger was already written
+                if (success)
+                {
+                    BOOST_LOG_TRIVIAL(info)
+                        << "Load phase of etl : "
+                        << "Successfully wrote ledger! Ledger info: "
+                        << detail::toString(lgrInfo);
+                    boost::asio::post(
+                        publishStrand_, [this, lgrInfo = lgrInfo]() {
+                            publishLedger(lgrInfo);
+                        });
+                    lastPublishedSequence = lgrInfo.seq;
+                }
+                else
+                {
+                    BOOST_LOG_TRIVIAL(error) << "Error writing ledger. "
+                                             << detail::toString(lgrInfo);
+                    writeConflict = true;
+                }
+            }
+            {
+                std::lock_guard lck{commitMtx};
+                uncommitted.pop_front();
+            }
+            commitCv.notify_all();
+            if (writeConflict)
+                continue;
             // TODO move online delete logic to an admin RPC call
             if (onlineDeleteInterval_ && !deleting_ &&
                 lgrInfo.seq - minSequence > *onlineDeleteInterval_)
@@ -702,11 +1208,13 @@ ReportingETL::runETLPipeline(uint32_t startSequence, int numExtractors)
     }};
 
     transformer.join();
-    for (size_t i = 0; i < numExtractors; ++i)
+    committer.join();
     {
-        // pop from each queue that might be blocked on a push
-        getNext(i)->tryPop();
+        // stop the extractors waiting to claim a ledger
+        std::lock_guard lck{claimMtx};
+        extractDone = true;
     }
+    claimCv.notify_all();
     // wait for all of the extractors to stop
     for (auto& t : extractors)
         t.join();
@@ -778,6 +1286,17 @@ ReportingETL::monitor()
         }
         if (ledger)
             latestSequence = ledger->seq;
+        if (ledger && startSequence_ && finishSequence_ &&
+            *finishSequence_ > ledger->seq && backfillWorkers_)
+        {
+            if (!backend_->supportsBackfill())
+                BOOST_LOG_TRIVIAL(warning)
+                    << __func__ << " : "
+                    << "The database does not support backfill. Ledgers "
+                       "will be written one at a time";
+            else if (auto last = backfill(ledger->seq, *finishSequence_))
+                latestSequence = *last;
+        }
     }
     else
     {
@@ -806,6 +1325,7 @@ ReportingETL::monitor()
         << __func__ << " : "
         << "Database is populated. "
         << "Starting monitor loop. sequence = " << nextSequence;
+    loadCache(*latestSequence);
     while (!stopping_ &&
            networkValidatedLedgers_->waitUntilValidatedByNetwork(nextSequence))
     {
@@ -813,15 +1333,6 @@ ReportingETL::monitor()
                                 << "Ledger with sequence = " << nextSequence
                                 << " has been validated by the network. "
                                 << "Attempting to find in database and publish";
-        if (!backend_->cache().isFull())
-        {
-            std::thread t{[this, latestSequence]() {
-                BOOST_LOG_TRIVIAL(info) << "Loading cache";
-                loadBalancer_->loadInitialLedger(*latestSequence, true);
-                backend_->cache().setFull();
-            }};
-            t.detach();
-        }
         // Attempt to take over responsibility of ETL writer after 2 failed
         // attempts to publish the ledger. publishLedger() fails if the
         // ledger that has been validated by the network is not found in the
@@ -871,11 +1382,7 @@ ReportingETL::monitorReadOnly()
     if (!mostRecent)
         return;
     uint32_t sequence = *mostRecent;
-    std::thread t{[this, sequence]() {
-        BOOST_LOG_TRIVIAL(info) << "Loading cache";
-        loadBalancer_->loadInitialLedger(sequence, true);
-    }};
-    t.detach();
+    loadCache(sequence);
     while (!stopping_ &&
            networkValidatedLedgers_->waitUntilValidatedByNetwork(sequence))
     {
@@ -884,6 +1391,130 @@ ReportingETL::monitorReadOnly()
     }
 }
 
+void
+ReportingETL::loadCache(uint32_t sequence)
+{
+    // the partial cache fills as objects are read
+    if (backend_->cache().isFull() || backend_->partialCache().enabled())
+        return;
+    std::thread t{[this, sequence]() {
+        if (cacheSnapshotPath_ && loadCacheSnapshot(sequence))
+        {
+            backend_->cache().setFull();
+            return;
+        }
+        if (cacheLoadFromDatabase_)
+        {
+            BOOST_LOG_TRIVIAL(info) << "Loading cache from the database";
+            backend_->scanLedger(
+                sequence,
+                [this, sequence](std::vector<Backend::LedgerObject>&& objs) {
+                    backend_->cache().update(objs, sequence, true);
+                },
+                cacheLoadThreads_);
+        }
+        else
+        {
+            BOOST_LOG_TRIVIAL(info) << "Loading cache";
+            loadBalancer_->loadInitialLedger(sequence, true);
+        }
+        backend_->cache().setFull();
+    }};
+    t.detach();
+}
+
+bool
+ReportingETL::loadCacheSnapshot(uint32_t sequence)
+{
+    auto& cache = backend_->cache();
+    auto header = Backend::CacheSnapshot::readHeader(*cacheSnapshotPath_);
+    auto range = backend_->hardFetchLedgerRangeNoThrow();
+    if (!header || !range || header->seq > sequence ||
+        header->seq < range->minSequence)
+    {
+        BOOST_LOG_TRIVIAL(info)
+            << __func__ << " : no usable cache snapshot at "
+            << *cacheSnapshotPath_;
+        return false;
+    }
+
+    // make sure the snapshot belongs to the ledgers in the database, and not
+    // to another network or a database that has since been wiped
+    std::optional<ripple::LedgerInfo> lgrInfo;
+    try
+    {
+        lgrInfo = backend_->fetchLedgerBySequence(header->seq);
+    }
+    catch (Backend::DatabaseTimeout const&)
+    {
+        BOOST_LOG_TRIVIAL(warning) << __func__ << " : read timeout";
+    }
+    if (!lgrInfo || lgrInfo->hash != header->ledgerHash)
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " : cache snapshot of ledger " << header->seq
+            << " does not match the database";
+        return false;
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " : loading cache snapshot of ledger " << header->seq
+        << ". Catching up to ledger " << sequence;
+
+    // apply the ledgers written since the snapshot first, and skip the
+    // objects they touched when loading the snapshot, so that no stale
+    // version is ever visible
+    std::unordered_set<ripple::uint256, ripple::hardened_hash<>> modified;
+    for (auto seq = header->seq + 1; seq <= sequence && !stopping_; ++seq)
+    {
+        // in read-only mode, sequence is the most recent ledger validated by
+        // the network, which may not be written yet
+        while (!stopping_ && (!range || range->maxSequence < seq))
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            range = backend_->hardFetchLedgerRangeNoThrow();
+        }
+        std::vector<Backend::LedgerObject> diff;
+        while (!stopping_)
+        {
+            try
+            {
+                diff = backend_->fetchLedgerDiff(seq);
+                break;
+            }
+            catch (Backend::DatabaseTimeout const&)
+            {
+                BOOST_LOG_TRIVIAL(warning)
+                    << __func__ << " : read timeout fetching ledger diff";
+            }
+        }
+        for (auto const& obj : diff)
+            modified.insert(obj.key);
+        cache.update(diff, seq, true);
+    }
+    // if the snapshot turns out to be corrupt, the diffs applied above are
+    // still correct, and the full download that follows overwrites the rest
+    return !stopping_ && cache.load(*cacheSnapshotPath_, modified);
+}
+
+void
+ReportingETL::saveCacheSnapshot()
+{
+    auto& cache = backend_->cache();
+    if (!cache.isFull())
+        return;
+    auto seq = cache.latestSequence();
+    try
+    {
+        // the ledger may not be committed yet while ETL is writing it
+        if (auto lgrInfo = backend_->fetchLedgerBySequence(seq))
+            cache.save(*cacheSnapshotPath_, seq, lgrInfo->hash);
+    }
+    catch (Backend::DatabaseTimeout const&)
+    {
+        BOOST_LOG_TRIVIAL(warning) << __func__ << " : read timeout";
+    }
+}
+
 void
 ReportingETL::doWork()
 {
@@ -896,6 +1527,25 @@ ReportingETL::doWork()
     });
 }
 
+void
+ReportingETL::startCacheSnapshotWriter()
+{
+    if (!cacheSnapshotPath_)
+        return;
+    cacheSnapshotWriter_ = std::thread([this]() {
+        beast::setCurrentThreadName("rippled: cache snapshot writer");
+        std::unique_lock lck{stopMtx_};
+        while (!stopCv_.wait_for(lck, cacheSnapshotInterval_, [this]() {
+            return stopping_.load();
+        }))
+        {
+            lck.unlock();
+            saveCacheSnapshot();
+            lck.lock();
+        }
+    });
+}
+
 ReportingETL::ReportingETL(
     boost::json::object const& config,
     boost::asio::io_context& ioc,
@@ -932,6 +1582,31 @@ ReportingETL::ReportingETL(
     }
     if (config.contains("extractor_threads"))
         extractorThreads_ = config.at("extractor_threads").as_int64();
+    if (config.contains("transform_threads"))
+        transformThreads_ = std::max<int64_t>(
+            config.at("transform_threads").as_int64(), 1);
+    transformPool_ =
+        std::make_unique<boost::asio::thread_pool>(transformThreads_);
+    if (config.contains("backfill_workers"))
+        backfillWorkers_ = config.at("backfill_workers").as_int64();
+    if (backfillWorkers_)
+        backfillProgress_ =
+            std::make_unique<BackfillProgress[]>(backfillWorkers_);
     if (config.contains("txn_threshold"))
         txnThreshold_ = config.at("txn_threshold").as_int64();
+    if (config.contains("cache") && config.at("cache").is_object())
+    {
+        auto const& cache = config.at("cache").as_object();
+        if (cache.contains("snapshot_path"))
+            cacheSnapshotPath_ = cache.at("snapshot_path").as_string().c_str();
+        if (cache.contains("snapshot_interval"))
+            cacheSnapshotInterval_ = std::chrono::seconds{
+                cache.at("snapshot_interval").as_int64()};
+        if (cache.contains("load_from"))
+            cacheLoadFromDatabase_ =
+                cache.at("load_from").as_string() == "database";
+        if (cache.contains("load_threads"))
+            cacheLoadThreads_ = std::clamp<int64_t>(
+                cache.at("load_threads").as_int64(), 1, 256);
+    }
 }
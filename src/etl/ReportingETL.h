@@ -13,9 +13,11 @@
 #include "org/xrpl/rpc/v1/xrp_ledger.grpc.pb.h"
 #include <grpcpp/grpcpp.h>
 
+#include <boost/asio/thread_pool.hpp>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <set>
 
 #include <chrono>
 
@@ -44,7 +46,9 @@ private:
     std::shared_ptr<SubscriptionManager> subscriptions_;
     std::shared_ptr<ETLLoadBalancer> loadBalancer_;
     std::optional<uint32_t> onlineDeleteInterval_;
-    uint32_t extractorThreads_ = 1;
+    // most ledgers fetched at once while catching up. At the tip, ledgers
+    // are fetched one at a time whatever this is
+    uint32_t extractorThreads_ = 8;
 
     std::thread worker_;
     boost::asio::io_context& ioContext_;
@@ -115,6 +119,57 @@ private:
     std::optional<uint32_t> startSequence_;
     std::optional<uint32_t> finishSequence_;
 
+    /// Where to periodically write the cache to, and to load it from on
+    /// startup instead of downloading a full ledger from the ETL sources
+    std::optional<std::string> cacheSnapshotPath_;
+    std::chrono::seconds cacheSnapshotInterval_{600};
+    std::thread cacheSnapshotWriter_;
+
+    /// Whether to load the cache by scanning the database, instead of
+    /// downloading the ledger from the ETL sources, and with how many threads
+    bool cacheLoadFromDatabase_ = false;
+    uint32_t cacheLoadThreads_ = 4;
+
+    /// Used to wake up the cache snapshot writer when stopping
+    std::mutex stopMtx_;
+    std::condition_variable stopCv_;
+
+    /// Number of threads that transform the transactions and objects of a
+    /// ledger in parallel. Whatever the number, ledgers are transformed one
+    /// at a time and in order
+    uint32_t transformThreads_ = 4;
+    std::unique_ptr<boost::asio::thread_pool> transformPool_;
+
+    /// Latency of each stage of buildNextLedger(). Transactions are
+    /// deserialized and their account_tx rows computed while objects are
+    /// written and the cache updated, after which the successors are computed
+    /// from the cache, and then the remaining writes issued. The ledger is
+    /// committed once its writes finish, while the next ledgers are built
+    StageTimer transactionsStage_;
+    StageTimer objectsStage_;
+    StageTimer successorsStage_;
+    StageTimer writeStage_;
+    StageTimer commitStage_;
+
+    /// Number of threads that extract and write ledgers in parallel, when
+    /// the database is empty and both start_sequence and finish_sequence are
+    /// set. 0 writes the range one ledger at a time, with runETLPipeline()
+    uint32_t backfillWorkers_ = 0;
+
+    /// Progress of one backfill worker. Used by server_info
+    struct BackfillProgress
+    {
+        std::atomic_uint64_t ledgers = 0;
+        std::atomic_uint64_t transactions = 0;
+        std::atomic_uint64_t objects = 0;
+        /// time since the backfill started, as of the last ledger written
+        std::atomic_uint64_t elapsedMicros = 0;
+
+        boost::json::object
+        report() const;
+    };
+    std::unique_ptr<BackfillProgress[]> backfillProgress_;
+
     size_t accumTxns_ = 0;
     size_t txnThreshold_ = 0;
 
@@ -147,13 +202,68 @@ private:
     std::optional<ripple::LedgerInfo>
     loadInitialLedger(uint32_t sequence);
 
+    /// Populate the cache with the ledger with the specified sequence, from
+    /// a background thread. Uses the cache snapshot, if one is configured
+    /// and recent enough, and otherwise downloads the ledger from the ETL
+    /// sources. Does nothing if the cache is already full
+    /// @param sequence sequence of a ledger that is in the database
+    void
+    loadCache(uint32_t sequence);
+
+    /// Load the cache snapshot and bring it up to date by applying the
+    /// ledger diffs written since the snapshot was taken
+    /// @param sequence sequence of the ledger to bring the cache up to
+    /// @return true if the cache now holds the full ledger
+    bool
+    loadCacheSnapshot(uint32_t sequence);
+
+    /// Write a snapshot of the cache, if it is full
+    void
+    saveCacheSnapshot();
+
+    /// Spawn a thread that writes a snapshot of the cache every
+    /// cacheSnapshotInterval_, if a snapshot path is configured
+    void
+    startCacheSnapshotWriter();
+
+    /// Write the ledgers (startSequence, finishSequence] with
+    /// backfillWorkers_ threads, which each extract and write whole ledgers,
+    /// in any order. Successors not sent by rippled, and the cache, are then
+    /// brought up to date by stitchBackfill(), and every ledger committed at
+    /// once
+    /// @note the database must hold ledger startSequence, and nothing after
+    /// @return the last ledger committed, which is finishSequence unless the
+    /// server is shutting down
+    std::optional<uint32_t>
+    backfill(uint32_t startSequence, uint32_t finishSequence);
+
+    /// Write a ledger extracted by a backfill worker, without the cache
+    /// @param data data extracted from an ETL source
+    /// @return false if the successors of the ledger were not sent by
+    /// rippled, and are left to stitchBackfill()
+    bool
+    writeBackfillLedger(org::xrpl::rpc::v1::GetLedgerResponse& data);
+
+    /// Apply the diffs of the backfilled ledgers (startSequence,
+    /// finishSequence] to the cache in order, writing the successors of the
+    /// ledgers in missingSuccessors on the way
+    /// @note the cache must be full, and at startSequence
+    /// @return false if the server is shutting down
+    bool
+    stitchBackfill(
+        uint32_t startSequence,
+        uint32_t finishSequence,
+        std::set<uint32_t> const& missingSuccessors);
+
     /// Run ETL. Extracts ledgers and writes them to the database, until a write
     /// conflict occurs (or the server shuts down).
     /// @note database must already be populated when this function is called
     /// @param startSequence the first ledger to extract
+    /// @param numExtractors most ledgers to fetch at once, when far behind
+    /// the network
     /// @return the last ledger written to the database, if any
     std::optional<uint32_t>
-    runETLPipeline(uint32_t startSequence, int offset);
+    runETLPipeline(uint32_t startSequence, int numExtractors);
 
     /// Monitor the network for newly validated ledgers. Also monitor the
     /// database to see if any process is writing those ledgers. This function
@@ -204,22 +314,77 @@ private:
         ripple::LedgerInfo const& ledger,
         org::xrpl::rpc::v1::GetLedgerResponse& data);
 
-    // TODO update this documentation
-    /// Build the next ledger using the previous ledger and the extracted data.
-    /// This function calls insertTransactions()
+    /// Deserialize the extracted transactions and compute their account_tx
+    /// rows, on the transform threads
+    /// @param ledger ledger the transactions belong to
+    /// @param data data extracted from an ETL source. must outlive the result
+    /// @param accountTxData filled in with one entry per transaction, in the
+    /// order of the transactions. must outlive the result
+    /// @return the work in progress. Wait on it before reading accountTxData,
+    /// or before modifying the transactions of data
+    ParallelFor
+    parseTransactions(
+        ripple::LedgerInfo const& ledger,
+        org::xrpl::rpc::v1::GetLedgerResponse const& data,
+        std::vector<AccountTransactionsData>& accountTxData);
+
+    /// Write the extracted transactions, moving the blobs out of data
+    /// @param accountTxData the result of parseTransactions() for data
+    void
+    writeTransactions(
+        ripple::LedgerInfo const& ledger,
+        org::xrpl::rpc::v1::GetLedgerResponse& data,
+        std::vector<AccountTransactionsData> const& accountTxData);
+
+    /// Write the successors sent by rippled along with the ledger objects
+    /// @param data data extracted from an ETL source, with object neighbors
+    /// @param seq sequence of the ledger
+    void
+    writeSourceSuccessors(
+        org::xrpl::rpc::v1::GetLedgerResponse& data,
+        uint32_t seq);
+
+    /// Whether a created or deleted object changes the first directory of
+    /// its book. Requires the cache to be full, and at ledger seq - 1
+    /// @param key key of the object
+    /// @param blob new content of the object. empty if deleted
+    /// @param seq sequence of the ledger that created or deleted the object
+    /// @return the book base of the book whose successor to write, if any
+    std::optional<ripple::uint256>
+    bookSuccessorToUpdate(
+        ripple::uint256 const& key,
+        ripple::Slice blob,
+        uint32_t seq);
+
+    /// Write the successors of the created and deleted objects of ledger
+    /// seq, and the successors of the books whose first directory changed,
+    /// as found in the cache. Requires the cache to be full, and at seq
+    /// @param cacheUpdates every object of the ledger
+    /// @param modified keys of the objects that were modified, and so do not
+    /// change any successor
+    void
+    writeCacheSuccessors(
+        std::vector<Backend::LedgerObject> const& cacheUpdates,
+        std::set<ripple::uint256> const& modified,
+        std::set<ripple::uint256> const& bookSuccessorsToCalculate,
+        uint32_t seq);
+
+    /// Build the next ledger from the extracted data: update the cache, and
+    /// issue every write of the ledger. The writes are not waited for; the
+    /// caller commits the ledger with backend_->finishWrites()
     /// @note rawData should be data that corresponds to the ledger immediately
-    /// following parent
-    /// @param parent the previous ledger
+    /// following the last ledger built
     /// @param rawData data extracted from an ETL source
-    /// @return the newly built ledger and data to write to Postgres
-    std::pair<ripple::LedgerInfo, bool>
+    /// @return the header of the newly built ledger
+    ripple::LedgerInfo
     buildNextLedger(org::xrpl::rpc::v1::GetLedgerResponse& rawData);
 
     /// Attempt to read the specified ledger from the database, and then publish
     /// that ledger to the ledgers stream.
     /// @param ledgerSequence the sequence of the ledger to publish
     /// @param maxAttempts the number of times to attempt to read the ledger
-    /// from the database. 1 attempt per second
+    /// from the database. 1 attempt per second, or sooner when the backend
+    /// is notified of a commit
     /// @return whether the ledger was found in the database and published
     bool
     publishLedger(uint32_t ledgerSequence, std::optional<uint32_t> maxAttempts);
@@ -253,6 +418,20 @@ private:
         result["etl_sources"] = loadBalancer_->toJson();
         result["is_writer"] = writing_.load();
         result["read_only"] = readOnly_;
+        boost::json::object stages;
+        stages["transactions"] = transactionsStage_.report();
+        stages["objects"] = objectsStage_.report();
+        stages["successors"] = successorsStage_.report();
+        stages["write"] = writeStage_.report();
+        stages["commit"] = commitStage_.report();
+        result["transform_stages"] = std::move(stages);
+        if (backfillProgress_)
+        {
+            boost::json::array workers;
+            for (size_t i = 0; i < backfillWorkers_; ++i)
+                workers.push_back(backfillProgress_[i].report());
+            result["backfill_workers"] = std::move(workers);
+        }
         auto last = getLastPublish();
         if (last.time_since_epoch().count() != 0)
             result["last_publish_time"] = std::to_string(
@@ -271,6 +450,7 @@ private:
         stopping_ = false;
 
         doWork();
+        startCacheSnapshotWriter();
     }
 
     void
@@ -306,12 +486,22 @@ public:
     {
         BOOST_LOG_TRIVIAL(info) << "onStop called";
         BOOST_LOG_TRIVIAL(debug) << "Stopping Reporting ETL";
-        stopping_ = true;
+        {
+            std::lock_guard lck{stopMtx_};
+            stopping_ = true;
+        }
+        stopCv_.notify_all();
 
         if (worker_.joinable())
             worker_.join();
 
         BOOST_LOG_TRIVIAL(debug) << "Joined ReportingETL worker thread";
+
+        if (cacheSnapshotWriter_.joinable())
+        {
+            cacheSnapshotWriter_.join();
+            saveCacheSnapshot();
+        }
     }
 };
 
@@ -0,0 +1,171 @@
+#include <etl/StreamMessage.h>
+#include <charconv>
+
+namespace {
+class Scanner
+{
+    std::string_view const s_;
+    size_t pos_ = 0;
+
+public:
+    explicit Scanner(std::string_view s) : s_(s)
+    {
+    }
+
+    void
+    skipSpace()
+    {
+        while (pos_ < s_.size() &&
+               (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' ||
+                s_[pos_] == '\r'))
+            ++pos_;
+    }
+
+    bool
+    consume(char c)
+    {
+        skipSpace();
+        if (pos_ >= s_.size() || s_[pos_] != c)
+            return false;
+        ++pos_;
+        return true;
+    }
+
+    /// @return contents of the string at the current position, without the
+    /// quotes. empty if there is no string there
+    std::optional<std::string_view>
+    string()
+    {
+        if (!consume('"'))
+            return {};
+        auto start = pos_;
+        for (; pos_ < s_.size(); ++pos_)
+        {
+            if (s_[pos_] == '\\')
+                ++pos_;
+            else if (s_[pos_] == '"')
+                return s_.substr(start, pos_++ - start);
+        }
+        return {};
+    }
+
+    /// Skip the value at the current position
+    /// @return raw text of the value. empty if it is malformed
+    std::optional<std::string_view>
+    value()
+    {
+        skipSpace();
+        if (pos_ >= s_.size())
+            return {};
+        auto start = pos_;
+        char c = s_[pos_];
+        if (c == '"')
+        {
+            if (!string())
+                return {};
+        }
+        else if (c == '{' || c == '[')
+        {
+            size_t depth = 0;
+            while (pos_ < s_.size())
+            {
+                c = s_[pos_];
+                if (c == '"')
+                {
+                    if (!string())
+                        return {};
+                    continue;
+                }
+                ++pos_;
+                if (c == '{' || c == '[')
+                    ++depth;
+                else if ((c == '}' || c == ']') && --depth == 0)
+                    break;
+            }
+            if (depth != 0)
+                return {};
+        }
+        else
+        {
+            while (pos_ < s_.size() && s_[pos_] != ',' && s_[pos_] != '}' &&
+                   s_[pos_] != ']' && s_[pos_] != ' ' && s_[pos_] != '\n' &&
+                   s_[pos_] != '\r' && s_[pos_] != '\t')
+                ++pos_;
+            if (pos_ == start)
+                return {};
+        }
+        return s_.substr(start, pos_ - start);
+    }
+};
+
+std::string_view
+unquote(std::string_view value)
+{
+    if (value.size() >= 2 && value.front() == '"')
+        return value.substr(1, value.size() - 2);
+    return {};
+}
+
+}  // namespace
+
+std::optional<StreamMessage>
+scanStreamMessage(std::string_view msg)
+{
+    Scanner scanner{msg};
+    if (!scanner.consume('{'))
+        return {};
+
+    StreamMessage fields;
+    if (scanner.consume('}'))
+        return fields;
+    do
+    {
+        auto key = scanner.string();
+        if (!key || !scanner.consume(':'))
+            return {};
+        auto value = scanner.value();
+        if (!value)
+            return {};
+
+        if (*key == "type")
+        {
+            fields.type = unquote(*value);
+        }
+        else if (*key == "ledger_index")
+        {
+            uint32_t index = 0;
+            auto end = value->data() + value->size();
+            if (auto [ptr, ec] = std::from_chars(value->data(), end, index);
+                ec == std::errc{} && ptr == end)
+                fields.ledgerIndex = index;
+        }
+        else if (*key == "validated_ledgers")
+        {
+            fields.validatedLedgers = unquote(*value);
+        }
+        else if (*key == "hash")
+        {
+            fields.hash = unquote(*value);
+        }
+        else if (*key == "signature")
+        {
+            fields.signature = unquote(*value);
+        }
+        else if (*key == "validated")
+        {
+            fields.validated = *value == "true";
+        }
+        else if (*key == "result")
+        {
+            fields.result = *value;
+        }
+        else if (*key == "transaction")
+        {
+            fields.transaction = *value;
+        }
+    } while (scanner.consume(','));
+
+    if (!scanner.consume('}'))
+        return {};
+    return fields;
+}
@@ -0,0 +1,36 @@
+#ifndef RIPPLE_APP_REPORTING_STREAMMESSAGE_H_INCLUDED
+#define RIPPLE_APP_REPORTING_STREAMMESSAGE_H_INCLUDED
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/// Top level fields of a message received on a subscription stream of
+/// rippled. They are found by scanning the message, which skips over the
+/// other values without parsing them or allocating. The views point into
+/// the scanned message
+struct StreamMessage
+{
+    /// value of "type", without the quotes. Escapes are left as they are,
+    /// which is fine for the types rippled sends
+    std::string_view type;
+    std::optional<uint32_t> ledgerIndex;
+    /// value of "validated_ledgers", without the quotes
+    std::string_view validatedLedgers;
+    /// values of "hash" and "signature", without the quotes. These identify
+    /// transactions, validations and manifests
+    std::string_view hash;
+    std::string_view signature;
+    bool validated = false;
+    /// raw "result" and "transaction" values. empty if absent
+    std::string_view result;
+    std::string_view transaction;
+};
+
+/// Scan the top level object of msg. The values that are skipped are only
+/// checked to be balanced, so msg must be parsed to be validated
+/// @return the fields of msg. empty if msg is not a JSON object
+std::optional<StreamMessage>
+scanStreamMessage(std::string_view msg);
+
+#endif
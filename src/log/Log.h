@@ -0,0 +1,60 @@
+#ifndef CLIO_LOG_H_INCLUDED
+#define CLIO_LOG_H_INCLUDED
+
+#include <boost/log/trivial.hpp>
+#include <atomic>
+#include <cstdint>
+
+// Sampled logging, for messages logged by every request or every read, such
+// as cache hits and misses. A CLIO_LOG_SAMPLED call site logs one in every
+// log_sample_rate of its records, counted per thread, so debug logging can
+// stay on in production. Records below log_level are skipped before anything
+// is counted or formatted.
+namespace Log {
+
+using Severity = boost::log::trivial::severity_level;
+
+namespace detail {
+inline std::atomic<Severity> minSeverity{boost::log::trivial::info};
+inline std::atomic_uint32_t sampleRate{64};
+}  // namespace detail
+
+// Called by initLogging, from log_level and log_sample_rate
+inline void
+setMinSeverity(Severity severity)
+{
+    detail::minSeverity.store(severity, std::memory_order_relaxed);
+}
+
+inline void
+setSampleRate(std::uint32_t rate)
+{
+    detail::sampleRate.store(rate ? rate : 1, std::memory_order_relaxed);
+}
+
+inline bool
+enabled(Severity severity)
+{
+    return severity >= detail::minSeverity.load(std::memory_order_relaxed);
+}
+
+inline std::uint32_t
+sampleRate()
+{
+    return detail::sampleRate.load(std::memory_order_relaxed);
+}
+
+}  // namespace Log
+
+// BOOST_LOG_TRIVIAL(severity), for one in every Log::sampleRate() records of
+// the call site on this thread
+#define CLIO_LOG_SAMPLED(severity)                               \
+    if (static thread_local std::uint64_t clioLogSampled = 0;    \
+        !Log::enabled(boost::log::trivial::severity) ||          \
+        clioLogSampled++ % Log::sampleRate() != 0)               \
+    {                                                            \
+    }                                                            \
+    else                                                         \
+        BOOST_LOG_TRIVIAL(severity)
+
+#endif  // CLIO_LOG_H_INCLUDED
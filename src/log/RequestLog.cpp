@@ -0,0 +1,105 @@
+#include <boost/log/trivial.hpp>
+#include <log/RequestLog.h>
+#include <string_view>
+
+namespace Log {
+
+namespace {
+bool
+isDropped(std::string_view name)
+{
+    // the members that say who sent the request, or sign for an account
+    return name == "id" || name == "command" || name == "jsonrpc" ||
+        name == "secret" || name == "seed" || name == "seed_hex" ||
+        name == "passphrase" || name == "key_type";
+}
+}  // namespace
+
+void
+RequestLog::setup(boost::json::object const& config)
+{
+    if (!config.contains("request_log") ||
+        !config.at("request_log").is_object())
+        return;
+    auto const& logConfig = config.at("request_log").as_object();
+    if (!logConfig.contains("file"))
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " : request_log needs a file. Capture is off";
+        return;
+    }
+    std::uint32_t rate = 1;
+    if (logConfig.contains("sample_rate"))
+        rate = logConfig.at("sample_rate").as_int64();
+    if (!rate)
+        return;
+
+    auto const& path = logConfig.at("file").as_string();
+    file_.open(path.c_str(), std::ios_base::app);
+    if (!file_)
+    {
+        BOOST_LOG_TRIVIAL(error)
+            << __func__ << " : could not open " << path << ". Capture is off";
+        return;
+    }
+    sampleRate_ = rate;
+    BOOST_LOG_TRIVIAL(info) << __func__ << " : capturing one in " << rate
+                            << " requests to " << path;
+}
+
+void
+RequestLog::record(
+    char const* transport,
+    std::string const& method,
+    boost::json::object const& params)
+{
+    auto const rate = sampleRate_.load(std::memory_order_relaxed);
+    if (!rate)
+        return;
+    thread_local std::uint64_t requests = 0;
+    if (requests++ % rate != 0)
+        return;
+
+    boost::json::object line;
+    line["t_us"] = std::chrono::duration_cast<std::chrono::microseconds>(
+                       clock::now() - start_)
+                       .count();
+    line["transport"] = transport;
+    line["method"] = method;
+    line["params"] = anonymize(params);
+    auto str = boost::json::serialize(line);
+
+    std::lock_guard lck{mtx_};
+    file_ << str << '\n';
+    ++captured_;
+}
+
+boost::json::object
+RequestLog::anonymize(boost::json::object const& params)
+{
+    boost::json::object anonymized;
+    for (auto const& member : params)
+    {
+        if (!isDropped(member.key()))
+            anonymized[member.key()] = member.value();
+    }
+    return anonymized;
+}
+
+boost::json::object
+RequestLog::report() const
+{
+    boost::json::object report;
+    report["sample_rate"] = sampleRate_.load();
+    report["captured"] = captured_.load();
+    return report;
+}
+
+RequestLog&
+requestLog()
+{
+    static RequestLog log;
+    return log;
+}
+
+}  // namespace Log
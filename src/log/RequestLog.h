@@ -0,0 +1,67 @@
+#ifndef CLIO_REQUEST_LOG_H_INCLUDED
+#define CLIO_REQUEST_LOG_H_INCLUDED
+
+#include <boost/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+// Captures the requests a server handles, for clio_load to replay. One in
+// every request_log.sample_rate requests is appended to request_log.file,
+// one JSON object per line:
+//
+//     {"t_us":1234,"transport":"ws","method":"account_info","params":{...}}
+//
+// t_us is the time since the server started. Requests are anonymized: the
+// client address is never written, and neither are request ids or secrets.
+// Accounts and other ledger data are kept, so that a replay reads what the
+// captured traffic read. The requests of a batch are captured one by one.
+namespace Log {
+
+class RequestLog
+{
+    using clock = std::chrono::steady_clock;
+
+    std::atomic_uint32_t sampleRate_{0};
+    clock::time_point const start_ = clock::now();
+    std::mutex mtx_;
+    std::ofstream file_;
+    std::atomic_uint64_t captured_{0};
+
+public:
+    // from request_log.file and request_log.sample_rate, which defaults to
+    // 1. Capture is off unless file is set
+    void
+    setup(boost::json::object const& config);
+
+    bool
+    enabled() const
+    {
+        return sampleRate_.load(std::memory_order_relaxed) != 0;
+    }
+
+    // Capture a request of method, with params, received over transport, if
+    // it is sampled
+    void
+    record(
+        char const* transport,
+        std::string const& method,
+        boost::json::object const& params);
+
+    // params, without the members that identify the client or the request
+    static boost::json::object
+    anonymize(boost::json::object const& params);
+
+    boost::json::object
+    report() const;
+};
+
+RequestLog&
+requestLog();
+
+}  // namespace Log
+
+#endif  // CLIO_REQUEST_LOG_H_INCLUDED
@@ -0,0 +1,299 @@
+#include <boost/log/trivial.hpp>
+#include <log/Trace.h>
+#include <random>
+
+namespace Trace {
+
+namespace {
+std::mt19937_64&
+rng()
+{
+    thread_local std::mt19937_64 rng{std::random_device{}()};
+    return rng;
+}
+
+std::uint64_t
+newId()
+{
+    std::uint64_t id;
+    do
+    {
+        id = rng()();
+    } while (id == 0);
+    return id;
+}
+
+std::string
+toHex(unsigned char const* data, std::size_t size)
+{
+    static char const digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(2 * size);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+std::string
+toHex(std::uint64_t id)
+{
+    unsigned char bytes[8];
+    for (int i = 7; i >= 0; --i, id >>= 8)
+        bytes[i] = id & 0xff;
+    return toHex(bytes, sizeof(bytes));
+}
+
+// OTLP/JSON encodes 64 bit integers, such as times, as strings
+std::string
+toNanos(clock::time_point time)
+{
+    return std::to_string(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            time.time_since_epoch())
+            .count());
+}
+
+boost::json::object
+toAnyValue(boost::json::value const& value)
+{
+    boost::json::object any;
+    switch (value.kind())
+    {
+        case boost::json::kind::bool_:
+            any["boolValue"] = value.as_bool();
+            break;
+        case boost::json::kind::int64:
+            any["intValue"] = std::to_string(value.as_int64());
+            break;
+        case boost::json::kind::uint64:
+            any["intValue"] = std::to_string(value.as_uint64());
+            break;
+        case boost::json::kind::double_:
+            any["doubleValue"] = value.as_double();
+            break;
+        case boost::json::kind::string:
+            any["stringValue"] = value.as_string();
+            break;
+        default:
+            any["stringValue"] = boost::json::serialize(value);
+    }
+    return any;
+}
+
+boost::json::array
+toAttributes(boost::json::object const& attributes)
+{
+    boost::json::array array;
+    for (auto const& [key, value] : attributes)
+        array.push_back({{"key", key}, {"value", toAnyValue(value)}});
+    return array;
+}
+}  // namespace
+
+Trace::Trace() : id_([]() {
+    std::array<unsigned char, 16> id;
+    std::uint64_t halves[2] = {newId(), newId()};
+    for (std::size_t i = 0; i < id.size(); ++i)
+        id[i] = (halves[i / 8] >> (8 * (i % 8))) & 0xff;
+    return id;
+}())
+{
+}
+
+void
+Trace::add(SpanData&& span)
+{
+    std::lock_guard lck{mtx_};
+    if (!exported_)
+        spans_.push_back(std::move(span));
+}
+
+std::vector<SpanData>
+Trace::finish()
+{
+    std::lock_guard lck{mtx_};
+    exported_ = true;
+    return std::move(spans_);
+}
+
+Span::Span(char const* name, Parent const& parent)
+{
+    if (!parent)
+        return;
+    previous_ = detail::current;
+    trace_ = parent.trace;
+    data_.emplace();
+    data_->id = newId();
+    data_->parent = parent.span;
+    data_->name = name;
+    data_->start = clock::now();
+    detail::current = Parent{trace_, data_->id};
+}
+
+Span::~Span()
+{
+    if (!data_)
+        return;
+    data_->end = clock::now();
+    detail::current = std::move(previous_);
+    trace_->add(std::move(*data_));
+}
+
+void
+record(
+    Parent const& parent,
+    char const* name,
+    clock::time_point start,
+    clock::time_point end,
+    boost::json::object attributes)
+{
+    if (!parent)
+        return;
+    SpanData span;
+    span.id = newId();
+    span.parent = parent.span;
+    span.name = name;
+    span.start = start;
+    span.end = end;
+    span.attributes = std::move(attributes);
+    parent.trace->add(std::move(span));
+}
+
+Request::Request(char const* name)
+{
+    if (!exporter().sample())
+        return;
+    trace_ = std::make_shared<Trace>();
+    previous_ = detail::current;
+    detail::current = Parent{trace_, 0};
+    root_.emplace(name);
+}
+
+Request::~Request()
+{
+    if (!trace_)
+        return;
+    root_.reset();
+    detail::current = std::move(previous_);
+    exporter().write(*trace_);
+}
+
+void
+Exporter::setup(boost::json::object const& config)
+{
+    if (!config.contains("tracing") || !config.at("tracing").is_object())
+        return;
+    auto const& tracing = config.at("tracing").as_object();
+    if (!tracing.contains("sample_rate") || !tracing.contains("file"))
+    {
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " : tracing needs sample_rate and file."
+            << " Tracing is off";
+        return;
+    }
+    if (!tracing.at("sample_rate").as_int64())
+        return;
+    if (tracing.contains("min_duration_ms"))
+        minDuration_ = std::chrono::milliseconds{
+            tracing.at("min_duration_ms").as_int64()};
+    if (tracing.contains("service_name"))
+        serviceName_ = tracing.at("service_name").as_string().c_str();
+
+    auto const& path = tracing.at("file").as_string();
+    file_.open(path.c_str(), std::ios_base::app);
+    if (!file_)
+    {
+        BOOST_LOG_TRIVIAL(error)
+            << __func__ << " : could not open " << path << ". Tracing is off";
+        return;
+    }
+    sampleRate_ = tracing.at("sample_rate").as_int64();
+    BOOST_LOG_TRIVIAL(info)
+        << __func__ << " : tracing one in " << sampleRate_
+        << " requests to " << path;
+}
+
+bool
+Exporter::sample()
+{
+    auto const rate = sampleRate_.load(std::memory_order_relaxed);
+    if (!rate)
+        return false;
+    thread_local std::uint64_t requests = 0;
+    return requests++ % rate == 0;
+}
+
+void
+Exporter::write(Trace& trace)
+{
+    auto spans = trace.finish();
+    for (auto const& span : spans)
+    {
+        if (span.parent == 0 && span.end - span.start < minDuration_)
+            return;
+    }
+    auto line = boost::json::serialize(toOtlp(trace.id(), spans));
+    std::lock_guard lck{mtx_};
+    file_ << line << '\n';
+    file_.flush();
+    ++exported_;
+}
+
+boost::json::object
+Exporter::toOtlp(
+    std::array<unsigned char, 16> const& traceId,
+    std::vector<SpanData> const& spans) const
+{
+    auto const id = toHex(traceId.data(), traceId.size());
+    boost::json::array otlpSpans;
+    for (auto const& span : spans)
+    {
+        boost::json::object otlp;
+        otlp["traceId"] = id;
+        otlp["spanId"] = toHex(span.id);
+        if (span.parent)
+            otlp["parentSpanId"] = toHex(span.parent);
+        otlp["name"] = span.name;
+        // SPAN_KIND_SERVER for the request, SPAN_KIND_INTERNAL below it
+        otlp["kind"] = span.parent ? 1 : 2;
+        otlp["startTimeUnixNano"] = toNanos(span.start);
+        otlp["endTimeUnixNano"] = toNanos(span.end);
+        otlp["attributes"] = toAttributes(span.attributes);
+        otlpSpans.push_back(std::move(otlp));
+    }
+
+    boost::json::object resource;
+    resource["attributes"] = toAttributes({{"service.name", serviceName_}});
+    boost::json::object scopeSpans;
+    scopeSpans["scope"] = {{"name", "clio"}};
+    scopeSpans["spans"] = std::move(otlpSpans);
+    boost::json::object resourceSpans;
+    resourceSpans["resource"] = std::move(resource);
+    resourceSpans["scopeSpans"] = boost::json::array{};
+    resourceSpans["scopeSpans"].as_array().push_back(std::move(scopeSpans));
+    boost::json::object request;
+    request["resourceSpans"] = boost::json::array{};
+    request["resourceSpans"].as_array().push_back(std::move(resourceSpans));
+    return request;
+}
+
+boost::json::object
+Exporter::report() const
+{
+    boost::json::object report;
+    report["sample_rate"] = sampleRate_.load();
+    report["exported"] = exported_.load();
+    return report;
+}
+
+Exporter&
+exporter()
+{
+    static Exporter exporter;
+    return exporter;
+}
+
+}  // namespace Trace
@@ -0,0 +1,218 @@
+#ifndef CLIO_TRACE_H_INCLUDED
+#define CLIO_TRACE_H_INCLUDED
+
+#include <boost/json.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Sampled tracing of requests. One in every tracing.sample_rate requests is
+// traced: every Span opened while it runs records its name, parent, start,
+// end and attributes. Traces that took at least tracing.min_duration_ms are
+// appended to tracing.file, one OpenTelemetry (OTLP/JSON) export request per
+// line, which collectors read with their OTLP JSON file receivers.
+//
+// The span a thread is in is kept in a thread-local, so spans nest without
+// being passed around. Work handed to another thread takes Trace::current()
+// with it, and opens its spans under that parent. When a request is not
+// traced, opening a span only tests that thread-local.
+namespace Trace {
+
+using clock = std::chrono::system_clock;
+
+struct SpanData
+{
+    std::uint64_t id = 0;
+    std::uint64_t parent = 0;
+    char const* name = "";
+    clock::time_point start;
+    clock::time_point end;
+    boost::json::object attributes;
+};
+
+// The spans of one traced request. Spans may be added from any thread
+class Trace
+{
+    std::array<unsigned char, 16> const id_;
+    std::mutex mtx_;
+    std::vector<SpanData> spans_;
+    // spans ending after the trace was exported are dropped
+    bool exported_ = false;
+
+public:
+    Trace();
+
+    void
+    add(SpanData&& span);
+
+    // the spans so far, and drop those that end later
+    std::vector<SpanData>
+    finish();
+
+    std::array<unsigned char, 16> const&
+    id() const
+    {
+        return id_;
+    }
+};
+
+// A span to open others under. Empty if the request is not traced
+struct Parent
+{
+    std::shared_ptr<Trace> trace;
+    std::uint64_t span = 0;
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(trace);
+    }
+};
+
+namespace detail {
+inline thread_local Parent current;
+}  // namespace detail
+
+// The span this thread is in
+inline Parent const&
+current()
+{
+    return detail::current;
+}
+
+// Set the span this thread is in, for a coroutine that suspended in parent
+// and resumes on this thread
+inline void
+setCurrent(Parent parent)
+{
+    detail::current = std::move(parent);
+}
+
+// A span of the trace of the current request, from construction to
+// destruction. Does nothing if no request is traced
+class Span
+{
+    Parent previous_;
+    std::shared_ptr<Trace> trace_;
+    std::optional<SpanData> data_;
+
+public:
+    explicit Span(char const* name) : Span(name, current())
+    {
+    }
+
+    // A span under parent, which may be in another thread
+    Span(char const* name, Parent const& parent);
+
+    ~Span();
+
+    Span(Span const&) = delete;
+    Span&
+    operator=(Span const&) = delete;
+
+    explicit operator bool() const
+    {
+        return data_.has_value();
+    }
+
+    template <class T>
+    void
+    attribute(char const* key, T&& value)
+    {
+        if (data_)
+            data_->attributes[key] = std::forward<T>(value);
+    }
+};
+
+// Record a span under parent that has already ended, such as a read whose
+// callback runs on a driver thread. Does nothing if parent is empty
+void
+record(
+    Parent const& parent,
+    char const* name,
+    clock::time_point start,
+    clock::time_point end,
+    boost::json::object attributes = {});
+
+// The trace of a request, from construction to destruction, if the request
+// is sampled. Its root span is named name. Exported when destroyed
+class Request
+{
+    Parent previous_;
+    std::shared_ptr<Trace> trace_;
+    std::optional<Span> root_;
+
+public:
+    explicit Request(char const* name);
+
+    ~Request();
+
+    Request(Request const&) = delete;
+    Request&
+    operator=(Request const&) = delete;
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(trace_);
+    }
+
+    template <class T>
+    void
+    attribute(char const* key, T&& value)
+    {
+        if (root_)
+            root_->attribute(key, std::forward<T>(value));
+    }
+};
+
+// Samples requests, and writes out their traces
+class Exporter
+{
+    std::atomic_uint32_t sampleRate_{0};
+    std::chrono::milliseconds minDuration_{0};
+    std::string serviceName_ = "clio";
+    std::mutex mtx_;
+    std::ofstream file_;
+    std::atomic_uint64_t exported_{0};
+
+public:
+    // from tracing.sample_rate, file, min_duration_ms and service_name.
+    // Tracing is off unless sample_rate and file are set
+    void
+    setup(boost::json::object const& config);
+
+    bool
+    enabled() const
+    {
+        return sampleRate_.load(std::memory_order_relaxed) != 0;
+    }
+
+    // whether to trace the next request of this thread
+    bool
+    sample();
+
+    void
+    write(Trace& trace);
+
+    // the OTLP/JSON export request of spans
+    boost::json::object
+    toOtlp(
+        std::array<unsigned char, 16> const& traceId,
+        std::vector<SpanData> const& spans) const;
+
+    boost::json::object
+    report() const;
+};
+
+Exporter&
+exporter();
+
+}  // namespace Trace
+
+#endif  // CLIO_TRACE_H_INCLUDED
@@ -5,7 +5,12 @@
 #include <boost/json.hpp>
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
+#include <boost/core/null_deleter.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+#include <boost/log/sinks/drop_on_overflow.hpp>
 #include <boost/log/sinks/text_file_backend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
 #include <boost/log/sources/record_ostream.hpp>
 #include <boost/log/sources/severity_logger.hpp>
 #include <boost/log/support/date_time.hpp>
@@ -13,6 +18,8 @@
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/console.hpp>
 #include <boost/log/utility/setup/file.hpp>
+#include <boost/log/utility/setup/formatter_parser.hpp>
+#include <boost/make_shared.hpp>
 #include <algorithm>
 #include <backend/BackendFactory.h>
 #include <cstdlib>
@@ -20,12 +27,17 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <log/Log.h>
+#include <log/RequestLog.h>
+#include <log/Trace.h>
 #include <memory>
+#include <rpc/ResponseCache.h>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 #include <webserver/Listener.h>
+#include <webserver/MetricsServer.h>
 
 std::optional<boost::json::object>
 parse_config(const char* filename)
@@ -92,50 +104,115 @@ parse_certs(boost::json::object const& config)
     return ctx;
 }
 
+// Records queued for the writer thread of an asynchronous sink. Records
+// logged while its queue is full are dropped, so logging never blocks
+static constexpr std::size_t logQueueSize = 65536;
+
+using AsyncLogSink = boost::log::sinks::asynchronous_sink<
+    boost::log::sinks::text_ostream_backend,
+    boost::log::sinks::bounded_fifo_queue<
+        logQueueSize,
+        boost::log::sinks::drop_on_overflow>>;
+
+static std::vector<boost::shared_ptr<AsyncLogSink>> asyncLogSinks;
+
+// Write out the records still queued, before the process exits
+void
+stopLogging()
+{
+    for (auto& sink : asyncLogSinks)
+    {
+        boost::log::core::get()->remove_sink(sink);
+        sink->stop();
+        sink->flush();
+    }
+    asyncLogSinks.clear();
+}
+
+// A sink that formats and writes records to stream on a thread of its own
+void
+addAsyncLog(boost::shared_ptr<std::ostream> stream, std::string const& format)
+{
+    auto backend =
+        boost::make_shared<boost::log::sinks::text_ostream_backend>();
+    backend->add_stream(std::move(stream));
+    backend->auto_flush(true);
+    auto sink = boost::make_shared<AsyncLogSink>(std::move(backend));
+    sink->set_formatter(boost::log::parse_formatter(format));
+    boost::log::core::get()->add_sink(sink);
+    asyncLogSinks.push_back(std::move(sink));
+}
+
 void
 initLogging(boost::json::object const& config)
 {
     boost::log::add_common_attributes();
     std::string format = "[%TimeStamp%] [%ThreadID%] [%Severity%] %Message%";
-    boost::log::add_console_log(
-        std::cout, boost::log::keywords::format = format);
-    if (config.contains("log_file"))
+    bool const async = !config.contains("log_async") ||
+        config.at("log_async").as_bool();
+    if (async)
     {
-        boost::log::add_file_log(
-            config.at("log_file").as_string().c_str(),
-            boost::log::keywords::format = format,
-            boost::log::keywords::open_mode = std::ios_base::app);
+        boost::log::register_simple_formatter_factory<
+            boost::log::trivial::severity_level,
+            char>("Severity");
+        addAsyncLog(
+            boost::shared_ptr<std::ostream>(&std::cout, boost::null_deleter()),
+            format);
+        if (config.contains("log_file"))
+        {
+            auto file = boost::make_shared<std::ofstream>(
+                config.at("log_file").as_string().c_str(), std::ios_base::app);
+            if (!*file)
+                std::cerr << "Couldnt open log file" << std::endl;
+            else
+                addAsyncLog(file, format);
+        }
+        std::atexit(stopLogging);
     }
+    else
+    {
+        boost::log::add_console_log(
+            std::cout, boost::log::keywords::format = format);
+        if (config.contains("log_file"))
+        {
+            boost::log::add_file_log(
+                config.at("log_file").as_string().c_str(),
+                boost::log::keywords::format = format,
+                boost::log::keywords::open_mode = std::ios_base::app);
+        }
+    }
+    if (config.contains("log_sample_rate"))
+        Log::setSampleRate(config.at("log_sample_rate").as_int64());
+
     auto const logLevel = config.contains("log_level")
         ? config.at("log_level").as_string()
         : "info";
+    auto severity = boost::log::trivial::info;
+    bool recognized = true;
     if (boost::iequals(logLevel, "trace"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::trace);
+        severity = boost::log::trivial::trace;
     else if (boost::iequals(logLevel, "debug"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::debug);
+        severity = boost::log::trivial::debug;
     else if (boost::iequals(logLevel, "info"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::info);
+        severity = boost::log::trivial::info;
     else if (
         boost::iequals(logLevel, "warning") || boost::iequals(logLevel, "warn"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::warning);
+        severity = boost::log::trivial::warning;
     else if (boost::iequals(logLevel, "error"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::error);
+        severity = boost::log::trivial::error;
     else if (boost::iequals(logLevel, "fatal"))
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::fatal);
+        severity = boost::log::trivial::fatal;
     else
-    {
+        recognized = false;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= severity);
+    Log::setMinSeverity(severity);
+    if (!recognized)
         BOOST_LOG_TRIVIAL(warning) << "Unrecognized log level: " << logLevel
                                    << ". Setting log level to info";
-        boost::log::core::get()->set_filter(
-            boost::log::trivial::severity >= boost::log::trivial::info);
-    }
-    BOOST_LOG_TRIVIAL(info) << "Log level = " << logLevel;
+    BOOST_LOG_TRIVIAL(info) << "Log level = " << logLevel
+                            << ". Asynchronous = " << async
+                            << ". Sample rate = " << Log::sampleRate();
 }
 
 void
@@ -219,10 +296,71 @@ main(int argc, char* argv[])
     auto etl = ReportingETL::make_ReportingETL(
         *config, ioc, backend, subscriptions, balancer, ledgers);
 
+    // Responses to requests for immutable data, if enabled
+    RPC::responseCache().setup(*config);
+
+    // Traces of sampled requests, if enabled
+    Trace::exporter().setup(*config);
+
+    // Requests captured for clio_load to replay, if enabled
+    Log::requestLog().setup(*config);
+
     // The server handles incoming RPCs
     auto httpServer = Server::make_HttpServer(
         *config, ioc, ctxRef, backend, subscriptions, balancer, dosGuard);
 
+    // Prometheus metrics, if enabled
+    auto metricsServer = Metrics::make_MetricsServer(
+        *config, ioc, [=, &dosGuard]() {
+            Metrics::Writer writer;
+            writer.rpc(RPC::counters());
+            writer.gauges("clio_cache", backend->cache().report());
+            writer.gauges(
+                "clio_transaction_cache",
+                backend->transactionCache().report());
+            writer.gauges(
+                "clio_ledger_header_cache", backend->headerCache().report());
+            for (auto const& [kind, report] : backend->coalescedReads())
+                writer.gauges(
+                    "clio_coalesced_reads",
+                    report,
+                    "kind=\"" + std::string{kind} + "\"");
+            for (auto const& [table, report] : backend->codec().report())
+                writer.gauges(
+                    "clio_compression",
+                    report,
+                    "table=\"" + std::string{table} + "\"");
+            if (backend->partialCache().enabled())
+                writer.gauges(
+                    "clio_partial_cache", backend->partialCache().report());
+            auto [hits, misses] = backend->trustLineCache().stats();
+            writer.gauges(
+                "clio_trust_line_cache",
+                {{"size", backend->trustLineCache().size()},
+                 {"hits", hits},
+                 {"misses", misses}});
+            if (RPC::responseCache().enabled())
+                writer.gauges(
+                    "clio_response_cache", RPC::responseCache().report());
+            if (Trace::exporter().enabled())
+                writer.gauges("clio_tracing", Trace::exporter().report());
+            writer.gauges("clio_backend", backend->stats());
+            writer.gauges("clio_etl", etl->getInfo());
+            if (auto progress = balancer->loadProgress())
+                writer.gauges("clio_cache_load", *progress);
+            writer.gauges("clio_subscriptions", subscriptions->report());
+            writer.gauges("clio_dos_guard", dosGuard.report());
+            if (httpServer)
+            {
+                for (auto const& [lane, report] : httpServer->queue().report())
+                    writer.gauges(
+                        "clio_rpc_queue",
+                        report,
+                        "lane=\"" + std::string{lane} + "\"");
+            }
+            return writer.str();
+        });
+
     // Blocks until stopped.
     // When stopped, shared_ptrs fall out of scope
     // Calls destructors on all resources, and destructs in order
@@ -0,0 +1,132 @@
+#include <log/Trace.h>
+#include <rpc/Batch.h>
+#include <rpc/RPCHelpers.h>
+#include <algorithm>
+#include <thread>
+
+namespace RPC {
+
+namespace {
+// requests of one batch that run at the same time, so one batch cannot take
+// every thread of batchPool()
+constexpr std::size_t maxBatchChunks = 16;
+
+// The account root that a request with params reads, if it reads one as of
+// the validated ledger seq
+std::optional<ripple::uint256>
+accountRoot(boost::json::object const& params, std::uint32_t seq)
+{
+    if (params.contains("ledger_hash"))
+        return {};
+    if (auto index = params.find("ledger_index"); index != params.end())
+    {
+        auto const& value = index->value();
+        bool const validated =
+            value.is_string() && value.as_string() == "validated";
+        if (!validated && !(value.is_int64() && value.as_int64() == seq))
+            return {};
+    }
+    auto account = params.find("account");
+    if (account == params.end() || !account->value().is_string())
+        return {};
+    auto accountID =
+        accountFromStringStrict(account->value().as_string().c_str());
+    if (!accountID)
+        return {};
+    return ripple::keylet::account(*accountID).key;
+}
+}  // namespace
+
+boost::asio::thread_pool&
+batchPool()
+{
+    // requests wait on the database, like the workers of the WorkQueue
+    static boost::asio::thread_pool pool{
+        std::clamp(2 * std::thread::hardware_concurrency(), 4u, 64u)};
+    return pool;
+}
+
+bool
+isBatch(std::string_view request)
+{
+    auto first = request.find_first_not_of(" \t\r\n");
+    return first != std::string_view::npos && request[first] == '[';
+}
+
+std::vector<std::string>
+runBatch(
+    BackendInterface const& backend,
+    Backend::LedgerRange const& range,
+    std::vector<boost::json::object const*> const& params,
+    std::function<std::string(std::size_t, std::uint64_t&)> const& handle,
+    std::uint64_t& dbReads)
+{
+    auto const seq = range.maxSequence;
+    std::vector<ripple::uint256> keys;
+    for (auto const* p : params)
+    {
+        if (!p)
+            continue;
+        if (auto key = accountRoot(*p, seq))
+            keys.push_back(*key);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    Backend::Prefetched prefetched;
+    {
+        Trace::Span span{"prefetch"};
+        span.attribute("keys", keys.size());
+        Backend::ReadCounter::Scope reads{dbReads};
+        auto header = backend.fetchLedgerBySequence(seq);
+        std::vector<BlobView> objects;
+        if (header && keys.size())
+            objects = backend.fetchLedgerObjectViews(keys, seq);
+        prefetched = Backend::Prefetched{
+            seq, std::move(header), keys, std::move(objects)};
+    }
+    BOOST_LOG_TRIVIAL(debug)
+        << __func__ << " : " << params.size() << " requests. Read "
+        << keys.size() << " account roots ahead";
+
+    std::vector<std::string> responses(params.size());
+    std::vector<std::uint64_t> reads(params.size(), 0);
+    // the requests run on other threads, under the span of the batch
+    auto const parent = Trace::current();
+    ParallelFor work{
+        batchPool(),
+        params.size(),
+        maxBatchChunks,
+        1,
+        [&prefetched, &responses, &reads, &handle, &parent](std::size_t i) {
+            Trace::Span span{"batch_request", parent};
+            span.attribute("index", i);
+            Backend::Prefetched::Scope scope{prefetched};
+            responses[i] = handle(i, reads[i]);
+        }};
+    work.wait();
+    for (auto r : reads)
+        dbReads += r;
+    return responses;
+}
+
+std::string
+joinResponses(std::vector<std::string> const& responses)
+{
+    std::size_t size = 2;
+    for (auto const& response : responses)
+        size += response.size() + 1;
+    std::string joined;
+    joined.reserve(size);
+    joined += '[';
+    for (auto const& response : responses)
+    {
+        if (joined.size() > 1)
+            joined += ',';
+        joined += response;
+    }
+    joined += ']';
+    return joined;
+}
+
+}  // namespace RPC
@@ -0,0 +1,53 @@
+#ifndef RPC_BATCH_H
+#define RPC_BATCH_H
+
+#include <boost/asio/thread_pool.hpp>
+#include <boost/json.hpp>
+#include <backend/BackendInterface.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace RPC {
+
+// Requests sent together and answered together: a JSON-RPC array over http,
+// or the requests of a batch command over websocket. The requests of a batch
+// run concurrently, and all of them see the same ledger range, so those for
+// the validated ledger read the same one.
+//
+// The header of that ledger, and the account roots the requests name, are
+// read up front in one call, instead of once by every request. Sessions
+// charge DOSGuard for a batch at once, for all of its responses and reads.
+constexpr std::size_t maxBatchSize = 256;
+
+// Threads that the requests of batches run on. Separate from the workers of
+// the WorkQueue, which wait for whole batches
+boost::asio::thread_pool&
+batchPool();
+
+// Whether a serialized http request is a batch, found without parsing it
+bool
+isBatch(std::string_view request);
+
+// The serialized responses to the requests of a batch, by calling
+// handle(i, reads) for every request i concurrently. params[i] is the params
+// of request i, or nullptr if it has none. handle adds the objects request i
+// read from the database to reads, and should not throw. dbReads is
+// incremented by the objects that the whole batch read
+std::vector<std::string>
+runBatch(
+    BackendInterface const& backend,
+    Backend::LedgerRange const& range,
+    std::vector<boost::json::object const*> const& params,
+    std::function<std::string(std::size_t, std::uint64_t&)> const& handle,
+    std::uint64_t& dbReads);
+
+// responses as a JSON array
+std::string
+joinResponses(std::vector<std::string> const& responses);
+
+}  // namespace RPC
+
+#endif  // RPC_BATCH_H
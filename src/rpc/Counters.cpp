@@ -1,75 +1,167 @@
 #include <rpc/Counters.h>
+#include <algorithm>
+#include <cmath>
 
 namespace RPC {
 
-void
-Counters::initializeCounter(std::string const& method)
+std::size_t
+LatencyBuckets::bucket(std::uint64_t us)
 {
-    std::shared_lock lk(mutex_);
-    if (methodInfo_.count(method) == 0)
-    {
-        lk.unlock();
-        std::unique_lock ulk(mutex_);
+    us = std::min<std::uint64_t>(us, (std::uint64_t{1} << 32) - 1);
+    if (us < subBuckets)
+        return us;
+    // position of the highest bit, at least subBits
+    std::size_t exponent = 63 - __builtin_clzll(us);
+    std::size_t sub = (us >> (exponent - subBits)) & (subBuckets - 1);
+    return subBuckets * (exponent - subBits + 1) + sub;
+}
 
-        // This calls the default constructor for methodInfo of the method.
-        methodInfo_[method];
-    }
+std::uint64_t
+LatencyBuckets::upperBound(std::size_t bucket)
+{
+    if (bucket < subBuckets)
+        return bucket;
+    std::size_t exponent = bucket / subBuckets + subBits - 1;
+    std::uint64_t sub = bucket % subBuckets;
+    return ((subBuckets + sub + 1) << (exponent - subBits)) - 1;
 }
 
-void
-Counters::rpcErrored(std::string const& method)
+Counters::MethodInfo&
+Counters::info(MethodID method)
 {
-    initializeCounter(method);
+    // threads take the shards in turn
+    static std::atomic_size_t nextShard{0};
+    thread_local std::size_t const shard = nextShard++ % shardCount;
+    return shards_[shard].methods[static_cast<std::size_t>(method)];
+}
 
-    std::shared_lock lk(mutex_);
-    MethodInfo& counters = methodInfo_[method];
-    counters.started++;
-    counters.errored++;
+void
+Counters::rpcErrored(MethodID method)
+{
+    MethodInfo& counters = info(method);
+    counters.started.fetch_add(1, std::memory_order_relaxed);
+    counters.errored.fetch_add(1, std::memory_order_relaxed);
 }
 
 void
 Counters::rpcComplete(
-    std::string const& method,
+    MethodID method,
     std::chrono::microseconds const& rpcDuration)
 {
-    initializeCounter(method);
-
-    std::shared_lock lk(mutex_);
-    MethodInfo& counters = methodInfo_[method];
-    counters.started++;
-    counters.finished++;
-    counters.duration += rpcDuration.count();
+    MethodInfo& counters = info(method);
+    std::uint64_t const us = std::max<std::int64_t>(rpcDuration.count(), 0);
+    counters.started.fetch_add(1, std::memory_order_relaxed);
+    counters.finished.fetch_add(1, std::memory_order_relaxed);
+    counters.duration.fetch_add(us, std::memory_order_relaxed);
+    counters.latencies[LatencyBuckets::bucket(us)].fetch_add(
+        1, std::memory_order_relaxed);
 }
 
 void
-Counters::rpcForwarded(std::string const& method)
+Counters::rpcForwarded(
+    MethodID method,
+    std::chrono::microseconds const& connectDuration,
+    std::chrono::microseconds const& responseDuration)
 {
-    initializeCounter(method);
-
-    std::shared_lock lk(mutex_);
-    MethodInfo& counters = methodInfo_[method];
-    counters.forwarded++;
+    MethodInfo& counters = info(method);
+    counters.forwarded.fetch_add(1, std::memory_order_relaxed);
+    counters.forwardConnect.fetch_add(
+        connectDuration.count(), std::memory_order_relaxed);
+    counters.forwardDuration.fetch_add(
+        responseDuration.count(), std::memory_order_relaxed);
 }
 
 boost::json::object
 Counters::report()
 {
-    std::shared_lock lk(mutex_);
     boost::json::object obj = {};
 
-    for (auto const& [method, info] : methodInfo_)
+    for (std::size_t i = 0; i < methodCount; ++i)
     {
+        std::uint64_t started = 0;
+        std::uint64_t finished = 0;
+        std::uint64_t errored = 0;
+        std::uint64_t forwarded = 0;
+        std::uint64_t duration = 0;
+        std::uint64_t forwardConnect = 0;
+        std::uint64_t forwardDuration = 0;
+        for (std::size_t shard = 0; shard < shardCount; ++shard)
+        {
+            auto const& info = shards_[shard].methods[i];
+            started += info.started.load(std::memory_order_relaxed);
+            finished += info.finished.load(std::memory_order_relaxed);
+            errored += info.errored.load(std::memory_order_relaxed);
+            forwarded += info.forwarded.load(std::memory_order_relaxed);
+            duration += info.duration.load(std::memory_order_relaxed);
+            forwardConnect +=
+                info.forwardConnect.load(std::memory_order_relaxed);
+            forwardDuration +=
+                info.forwardDuration.load(std::memory_order_relaxed);
+        }
+        // only methods that were called
+        if (started == 0 && forwarded == 0)
+            continue;
+
         boost::json::object counters = {};
-        counters["started"] = std::to_string(info.started);
-        counters["finished"] = std::to_string(info.finished);
-        counters["errored"] = std::to_string(info.errored);
-        counters["forwarded"] = std::to_string(info.forwarded);
-        counters["duration_us"] = std::to_string(info.duration);
+        counters["started"] = std::to_string(started);
+        counters["finished"] = std::to_string(finished);
+        counters["errored"] = std::to_string(errored);
+        counters["forwarded"] = std::to_string(forwarded);
+        counters["duration_us"] = std::to_string(duration);
+        counters["forward_connect_us"] = std::to_string(forwardConnect);
+        counters["forward_duration_us"] = std::to_string(forwardDuration);
+
+        // the upper bounds of the buckets of the percentiles of the
+        // durations of finished requests
+        auto const latencies = this->latencies(static_cast<MethodID>(i));
+        std::uint64_t total = 0;
+        for (auto count : latencies)
+            total += count;
+        if (total)
+        {
+            std::pair<char const*, double> const percentiles[] = {
+                {"p50_us", 0.5},
+                {"p95_us", 0.95},
+                {"p99_us", 0.99},
+                {"p999_us", 0.999}};
+            std::size_t b = 0;
+            std::uint64_t seen = latencies[0];
+            for (auto const& [name, quantile] : percentiles)
+            {
+                auto const rank = static_cast<std::uint64_t>(
+                    std::ceil(quantile * total));
+                while (seen < rank)
+                    seen += latencies[++b];
+                counters[name] =
+                    std::to_string(LatencyBuckets::upperBound(b));
+            }
+        }
 
-        obj[method] = std::move(counters);
+        obj[toString(static_cast<MethodID>(i))] = std::move(counters);
     }
 
     return obj;
 }
 
-}  // namespace RPC
\ No newline at end of file
+std::array<std::uint64_t, LatencyBuckets::count>
+Counters::latencies(MethodID method) const
+{
+    std::array<std::uint64_t, LatencyBuckets::count> latencies{};
+    for (std::size_t shard = 0; shard < shardCount; ++shard)
+    {
+        auto const& info =
+            shards_[shard].methods[static_cast<std::size_t>(method)];
+        for (std::size_t b = 0; b < latencies.size(); ++b)
+            latencies[b] += info.latencies[b].load(std::memory_order_relaxed);
+    }
+    return latencies;
+}
+
+Counters&
+counters()
+{
+    static Counters counters;
+    return counters;
+}
+
+}  // namespace RPC
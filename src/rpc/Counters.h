@@ -2,13 +2,36 @@
 #define RPC_COUNTERS_H
 
 #include <boost/json.hpp>
+#include <rpc/Methods.h>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
-#include <shared_mutex>
-#include <string>
+#include <memory>
 
 namespace RPC {
 
+// Buckets of request durations, in microseconds. Like an HDR histogram with
+// three significant bits: each power of two is split into eight buckets, so a
+// bucket is at most an eighth of the values in it wide. Durations of more
+// than about 71 minutes all go into the last bucket
+struct LatencyBuckets
+{
+    static constexpr std::size_t subBits = 3;
+    static constexpr std::size_t subBuckets = 1 << subBits;
+    static constexpr std::size_t count = subBuckets * (32 - subBits + 1);
+
+    static std::size_t
+    bucket(std::uint64_t us);
+
+    // the largest duration in bucket
+    static std::uint64_t
+    upperBound(std::size_t bucket);
+};
+
+// Counters of the requests of each method. Every thread adds to one of a few
+// shards, so that threads do not contend on the same cache lines, and the
+// shards are only summed up by report()
 class Counters
 {
 private:
@@ -16,37 +39,63 @@ private:
     {
         MethodInfo() = default;
 
-        std::atomic_uint started{0};
-        std::atomic_uint finished{0};
-        std::atomic_uint errored{0};
-        std::atomic_uint forwarded{0};
-        std::atomic_uint duration{0};
+        std::atomic_uint64_t started{0};
+        std::atomic_uint64_t finished{0};
+        std::atomic_uint64_t errored{0};
+        std::atomic_uint64_t forwarded{0};
+        std::atomic_uint64_t duration{0};
+        // time spent on forwarded requests, in microseconds. connecting to
+        // rippled and waiting for its response are counted apart
+        std::atomic_uint64_t forwardConnect{0};
+        std::atomic_uint64_t forwardDuration{0};
+        std::array<std::atomic_uint64_t, LatencyBuckets::count> latencies{};
     };
 
-    void
-    initializeCounter(std::string const& method);
+    struct alignas(64) Shard
+    {
+        // indexed by MethodID
+        std::array<MethodInfo, methodCount> methods;
+    };
+
+    static constexpr std::size_t shardCount = 8;
+
+    std::unique_ptr<Shard[]> shards_;
 
-    std::shared_mutex mutex_;
-    std::unordered_map<std::string, MethodInfo> methodInfo_;
+    // the counters of method of the shard of this thread
+    MethodInfo&
+    info(MethodID method);
 
 public:
-    Counters() = default;
+    Counters() : shards_(std::make_unique<Shard[]>(shardCount))
+    {
+    }
 
     void
-    rpcErrored(std::string const& method);
+    rpcErrored(MethodID method);
 
     void
     rpcComplete(
-        std::string const& method,
+        MethodID method,
         std::chrono::microseconds const& rpcDuration);
 
     void
-    rpcForwarded(std::string const& method);
+    rpcForwarded(
+        MethodID method,
+        std::chrono::microseconds const& connectDuration = {},
+        std::chrono::microseconds const& responseDuration = {});
 
     boost::json::object
     report();
+
+    // durations of the finished requests of method, counted by bucket
+    std::array<std::uint64_t, LatencyBuckets::count>
+    latencies(MethodID method) const;
 };
 
+// the counters shared by all listeners
+Counters&
+counters();
+
 }  // namespace RPC
 
-#endif  // RPC_COUNTERS_H
\ No newline at end of file
+#endif  // RPC_COUNTERS_H
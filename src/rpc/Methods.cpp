@@ -0,0 +1,71 @@
+#include <rpc/Methods.h>
+#include <algorithm>
+#include <array>
+
+namespace RPC {
+
+namespace {
+// indexed by MethodID, so sorted
+constexpr std::array<std::string_view, methodCount> names{
+    "account_channels",
+    "account_currencies",
+    "account_info",
+    "account_lines",
+    "account_objects",
+    "account_offers",
+    "account_tx",
+    "book_offers",
+    "channel_authorize",
+    "channel_verify",
+    "fee",
+    "gateway_balances",
+    "ledger",
+    "ledger_data",
+    "ledger_entry",
+    "ledger_range",
+    "manifest",
+    "noripple_check",
+    "path_find",
+    "ping",
+    "random",
+    "ripple_path_find",
+    "server_info",
+    "submit",
+    "submit_multisigned",
+    "subscribe",
+    "transaction_entry",
+    "tx",
+    "unsubscribe",
+    "unknown"};
+
+constexpr bool
+isSorted()
+{
+    // the name of MethodID::unknown is not looked up
+    for (std::size_t i = 1; i + 1 < names.size(); ++i)
+    {
+        if (!(names[i - 1] < names[i]))
+            return false;
+    }
+    return true;
+}
+static_assert(isSorted(), "method names must be in the order of MethodID");
+}  // namespace
+
+MethodID
+toMethodID(std::string_view name)
+{
+    auto const end = names.end() - 1;
+    auto it = std::lower_bound(names.begin(), end, name);
+    if (it == end || *it != name)
+        return MethodID::unknown;
+    return static_cast<MethodID>(it - names.begin());
+}
+
+std::string_view
+toString(MethodID id)
+{
+    return names[static_cast<std::size_t>(id)];
+}
+
+}  // namespace RPC
@@ -0,0 +1,59 @@
+#ifndef RPC_METHODS_H
+#define RPC_METHODS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace RPC {
+
+// Every method clio handles or forwards, in the order of their names. A
+// request is resolved to one of these once, when its context is made, and
+// dispatch, forwarding and counters index by it from then on
+enum class MethodID : std::uint8_t {
+    accountChannels,
+    accountCurrencies,
+    accountInfo,
+    accountLines,
+    accountObjects,
+    accountOffers,
+    accountTx,
+    bookOffers,
+    channelAuthorize,
+    channelVerify,
+    fee,
+    gatewayBalances,
+    ledger,
+    ledgerData,
+    ledgerEntry,
+    ledgerRange,
+    manifest,
+    noRippleCheck,
+    pathFind,
+    ping,
+    random,
+    ripplePathFind,
+    serverInfo,
+    submit,
+    submitMultisigned,
+    subscribe,
+    transactionEntry,
+    tx,
+    unsubscribe,
+    // any other method
+    unknown
+};
+
+constexpr std::size_t methodCount =
+    static_cast<std::size_t>(MethodID::unknown) + 1;
+
+MethodID
+toMethodID(std::string_view name);
+
+// "unknown" for MethodID::unknown
+std::string_view
+toString(MethodID id);
+
+}  // namespace RPC
+
+#endif  // RPC_METHODS_H
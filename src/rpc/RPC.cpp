@@ -1,6 +1,5 @@
 #include <etl/ETLSource.h>
 #include <rpc/Handlers.h>
-#include <unordered_map>
 namespace RPC {
 
 std::optional<Context>
@@ -29,7 +28,8 @@ make_WsContext(
         session,
         range,
         counters,
-        clientIp};
+        clientIp,
+        boost::json::make_shared_resource<boost::json::monotonic_resource>()};
 }
 
 std::optional<Context>
@@ -71,7 +71,8 @@ make_HttpContext(
         nullptr,
         range,
         counters,
-        clientIp};
+        clientIp,
+        boost::json::make_shared_resource<boost::json::monotonic_resource>()};
 }
 
 boost::json::object
@@ -102,59 +103,98 @@ make_error(Status const& status)
     json["type"] = "response";
     return json;
 }
-static std::unordered_map<std::string, std::function<Result(Context const&)>>
-    handlerTable{
-        {"account_channels", &doAccountChannels},
-        {"account_currencies", &doAccountCurrencies},
-        {"account_info", &doAccountInfo},
-        {"account_lines", &doAccountLines},
-        {"account_objects", &doAccountObjects},
-        {"account_offers", &doAccountOffers},
-        {"account_tx", &doAccountTx},
-        {"gateway_balances", &doGatewayBalances},
-        {"noripple_check", &doNoRippleCheck},
-        {"book_offers", &doBookOffers},
-        {"channel_authorize", &doChannelAuthorize},
-        {"channel_verify", &doChannelVerify},
-        {"ledger", &doLedger},
-        {"ledger_data", &doLedgerData},
-        {"ledger_entry", &doLedgerEntry},
-        {"ledger_range", &doLedgerRange},
-        {"ledger_data", &doLedgerData},
-        {"subscribe", &doSubscribe},
-        {"server_info", &doServerInfo},
-        {"unsubscribe", &doUnsubscribe},
-        {"tx", &doTx},
-        {"transaction_entry", &doTransactionEntry},
-        {"random", &doRandom}};
-
-static std::unordered_set<std::string> forwardCommands{
-    "submit",
-    "submit_multisigned",
-    "fee",
-    "path_find",
-    "ripple_path_find",
-    "manifest"};
+namespace {
+using Handler = Result (*)(Context const&);
+
+// nullptr for methods without a handler
+Handler
+handlerFor(MethodID id)
+{
+    switch (id)
+    {
+        case MethodID::accountChannels:
+            return &doAccountChannels;
+        case MethodID::accountCurrencies:
+            return &doAccountCurrencies;
+        case MethodID::accountInfo:
+            return &doAccountInfo;
+        case MethodID::accountLines:
+            return &doAccountLines;
+        case MethodID::accountObjects:
+            return &doAccountObjects;
+        case MethodID::accountOffers:
+            return &doAccountOffers;
+        case MethodID::accountTx:
+            return &doAccountTx;
+        case MethodID::gatewayBalances:
+            return &doGatewayBalances;
+        case MethodID::noRippleCheck:
+            return &doNoRippleCheck;
+        case MethodID::bookOffers:
+            return &doBookOffers;
+        case MethodID::channelAuthorize:
+            return &doChannelAuthorize;
+        case MethodID::channelVerify:
+            return &doChannelVerify;
+        case MethodID::ledger:
+            return &doLedger;
+        case MethodID::ledgerData:
+            return &doLedgerData;
+        case MethodID::ledgerEntry:
+            return &doLedgerEntry;
+        case MethodID::ledgerRange:
+            return &doLedgerRange;
+        case MethodID::subscribe:
+            return &doSubscribe;
+        case MethodID::serverInfo:
+            return &doServerInfo;
+        case MethodID::unsubscribe:
+            return &doUnsubscribe;
+        case MethodID::tx:
+            return &doTx;
+        case MethodID::transactionEntry:
+            return &doTransactionEntry;
+        case MethodID::random:
+            return &doRandom;
+        default:
+            return nullptr;
+    }
+}
+
+// methods that are always forwarded
+bool
+isForwarded(MethodID id)
+{
+    switch (id)
+    {
+        case MethodID::submit:
+        case MethodID::submitMultisigned:
+        case MethodID::fee:
+        case MethodID::pathFind:
+        case MethodID::ripplePathFind:
+        case MethodID::manifest:
+            return true;
+        default:
+            return false;
+    }
+}
+}  // namespace
 
 bool
 shouldForwardToRippled(Context const& ctx)
 {
-    auto request = ctx.params;
+    auto const& request = ctx.params;
 
-    if (forwardCommands.find(ctx.method) != forwardCommands.end())
+    if (isForwarded(ctx.methodID))
         return true;
 
-    if (request.contains("ledger_index"))
+    if (auto index = request.find("ledger_index"); index != request.end())
     {
-        auto indexValue = request.at("ledger_index");
-        if (indexValue.is_string())
-        {
-            std::string index = indexValue.as_string().c_str();
-            return index == "current" || index == "closed";
-        }
+        if (auto const* str = index->value().if_string())
+            return *str == "current" || *str == "closed";
     }
 
-    if (ctx.method == "account_info" && request.contains("queue") &&
+    if (ctx.methodID == MethodID::accountInfo && request.contains("queue") &&
         request.at("queue").as_bool())
         return true;
 
@@ -169,9 +209,12 @@ buildResponse(Context const& ctx)
         boost::json::object toForward = ctx.params;
         toForward["command"] = ctx.method;
 
-        auto res = ctx.balancer->forwardToRippled(toForward, ctx.clientIp);
+        ForwardTiming timing;
+        auto res =
+            ctx.balancer->forwardToRippled(toForward, ctx.clientIp, &timing);
 
-        ctx.counters.rpcForwarded(ctx.method);
+        ctx.counters.rpcForwarded(
+            ctx.methodID, timing.connect, timing.response);
 
         if (!res)
             return Status{Error::rpcFAILED_TO_FORWARD};
@@ -182,14 +225,13 @@ buildResponse(Context const& ctx)
         return *res;
     }
 
-    if (ctx.method == "ping")
+    if (ctx.methodID == MethodID::ping)
         return boost::json::object{};
 
-    if (handlerTable.find(ctx.method) == handlerTable.end())
+    auto method = handlerFor(ctx.methodID);
+    if (!method)
         return Status{Error::rpcUNKNOWN_COMMAND};
 
-    auto method = handlerTable[ctx.method];
-
     try
     {
         return method(ctx);
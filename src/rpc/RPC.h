@@ -2,10 +2,12 @@
 #define REPORTING_RPC_H_INCLUDED
 
 #include <ripple/protocol/ErrorCodes.h>
+#include <boost/asio/spawn.hpp>
 #include <boost/json.hpp>
 #include <backend/BackendInterface.h>
 #include <optional>
 #include <rpc/Counters.h>
+#include <rpc/Methods.h>
 #include <string>
 #include <variant>
 /*
@@ -28,6 +30,7 @@ namespace RPC {
 struct Context
 {
     std::string method;
+    MethodID methodID;
     std::uint32_t version;
     boost::json::object const& params;
     std::shared_ptr<BackendInterface const> const& backend;
@@ -40,6 +43,17 @@ struct Context
     Backend::LedgerRange const& range;
     Counters& counters;
     std::string clientIp;
+    // Storage of the response. Requests allocate from an arena released
+    // with the response, once it is written out. Not thread-safe, so
+    // handlers that render on other threads use the default storage
+    boost::json::storage_ptr storage;
+    // objects the request read from the database, which DOSGuard charges
+    // it for. Counted around RPC::buildResponse
+    std::uint64_t dbReads = 0;
+    // The coroutine the request runs on, if any. Handlers suspend it while
+    // they wait on the database, through the reads of RPCHelpers.h. Without
+    // one, as for the requests of a batch, those reads block
+    std::optional<boost::asio::yield_context> yield;
 
     Context(
         std::string const& command_,
@@ -51,8 +65,10 @@ struct Context
         std::shared_ptr<WsBase> const& session_,
         Backend::LedgerRange const& range_,
         Counters& counters_,
-        std::string const& clientIp_)
+        std::string const& clientIp_,
+        boost::json::storage_ptr storage_ = {})
         : method(command_)
+        , methodID(toMethodID(command_))
         , version(version_)
         , params(params_)
         , backend(backend_)
@@ -62,6 +78,7 @@ struct Context
         , range(range_)
         , counters(counters_)
         , clientIp(clientIp_)
+        , storage(std::move(storage_))
     {
     }
 };
@@ -1,6 +1,13 @@
+#include <ripple/basics/hardened_hash.h>
 #include <boost/algorithm/string.hpp>
 #include <backend/BackendInterface.h>
+#include <log/Trace.h>
 #include <rpc/RPCHelpers.h>
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 namespace RPC {
 
 std::optional<bool>
@@ -245,22 +252,23 @@ deserializeTxPlusMeta(
 }
 
 boost::json::object
-toJson(ripple::STBase const& obj)
+toJson(ripple::STBase const& obj, boost::json::storage_ptr sp)
 {
-    boost::json::value value = boost::json::parse(
-        obj.getJson(ripple::JsonOptions::none).toStyledString());
+    auto value = toBoostJson(obj.getJson(ripple::JsonOptions::none), sp);
 
-    return value.as_object();
+    return std::move(value.as_object());
 }
 
 std::pair<boost::json::object, boost::json::object>
-toExpandedJson(Backend::TransactionAndMetadata const& blobs)
+toExpandedJson(
+    Backend::TransactionAndMetadata const& blobs,
+    boost::json::storage_ptr sp)
 {
     auto [txn, meta] = deserializeTxPlusMeta(blobs, blobs.ledgerSequence);
-    auto txnJson = toJson(*txn);
-    auto metaJson = toJson(*meta);
+    auto txnJson = toJson(*txn, sp);
+    auto metaJson = toJson(*meta, sp);
     insertDeliveredAmount(metaJson, txn, meta);
-    return {txnJson, metaJson};
+    return {std::move(txnJson), std::move(metaJson)};
 }
 
 bool
@@ -272,8 +280,9 @@ insertDeliveredAmount(
     if (canHaveDeliveredAmount(txn, meta))
     {
         if (auto amt = getDeliveredAmount(txn, meta, meta->getLgrSeq()))
-            metaJson["delivered_amount"] =
-                toBoostJson(amt->getJson(ripple::JsonOptions::include_date));
+            metaJson["delivered_amount"] = toBoostJson(
+                amt->getJson(ripple::JsonOptions::include_date),
+                metaJson.storage());
         else
             metaJson["delivered_amount"] = "unavailable";
         return true;
@@ -282,27 +291,54 @@ insertDeliveredAmount(
 }
 
 boost::json::object
-toJson(ripple::TxMeta const& meta)
+toJson(ripple::TxMeta const& meta, boost::json::storage_ptr sp)
 {
-    boost::json::value value = boost::json::parse(
-        meta.getJson(ripple::JsonOptions::none).toStyledString());
+    auto value = toBoostJson(meta.getJson(ripple::JsonOptions::none), sp);
 
-    return value.as_object();
+    return std::move(value.as_object());
 }
 
 boost::json::value
-toBoostJson(Json::Value const& value)
+toBoostJson(Json::Value const& value, boost::json::storage_ptr sp)
 {
-    boost::json::value boostValue = boost::json::parse(value.toStyledString());
-
-    return boostValue;
+    switch (value.type())
+    {
+        case Json::intValue:
+            return boost::json::value(
+                static_cast<std::int64_t>(value.asInt()), sp);
+        // parsed back from text, these were signed
+        case Json::uintValue:
+            return boost::json::value(
+                static_cast<std::int64_t>(value.asUInt()), sp);
+        case Json::realValue:
+            return boost::json::value(value.asDouble(), sp);
+        case Json::stringValue:
+            return boost::json::string(value.asString(), sp);
+        case Json::booleanValue:
+            return boost::json::value(value.asBool(), sp);
+        case Json::arrayValue: {
+            boost::json::array array(sp);
+            array.reserve(value.size());
+            for (auto const& element : value)
+                array.push_back(toBoostJson(element, sp));
+            return array;
+        }
+        case Json::objectValue: {
+            boost::json::object object(sp);
+            object.reserve(value.size());
+            for (auto it = value.begin(); it != value.end(); ++it)
+                object.emplace(it.memberName(), toBoostJson(*it, sp));
+            return object;
+        }
+        default:
+            return boost::json::value(nullptr, sp);
+    }
 }
 
 boost::json::object
-toJson(ripple::SLE const& sle)
+toJson(ripple::SLE const& sle, boost::json::storage_ptr sp)
 {
-    boost::json::value value = boost::json::parse(
-        sle.getJson(ripple::JsonOptions::none).toStyledString());
+    auto value = toBoostJson(sle.getJson(ripple::JsonOptions::none), sp);
     if (sle.getType() == ripple::ltACCOUNT_ROOT)
     {
         if (sle.isFieldPresent(ripple::sfEmailHash))
@@ -314,7 +350,7 @@ toJson(ripple::SLE const& sle)
                 str(boost::format("http://www.gravatar.com/avatar/%s") % md5);
         }
     }
-    return value.as_object();
+    return std::move(value.as_object());
 }
 
 boost::json::object
@@ -337,6 +373,132 @@ toJson(ripple::LedgerInfo const& lgrInfo)
     return header;
 }
 
+namespace {
+// The result of the asynchronous read that read(handler) starts, for which
+// the coroutine of ctx is suspended. It may resume on another thread, so
+// the thread-locals of the request go along with it, and are unset on this
+// thread for the requests it runs meanwhile
+template <class T, class Read>
+T
+suspendFor(Context const& ctx, Read&& read)
+{
+    auto const reads = Backend::ReadCounter::current();
+    auto const prefetched = Backend::Prefetched::current();
+    auto trace = Trace::current();
+    boost::system::error_code ec;
+    auto token = (*ctx.yield)[ec];
+    T result = boost::asio::async_initiate<
+        boost::asio::yield_context,
+        void(boost::system::error_code, T)>(
+        [&](auto handler) {
+            // started before the thread-locals are unset, since reads are
+            // counted as they start
+            read(std::move(handler));
+            Backend::ReadCounter::setCurrent(nullptr);
+            Backend::Prefetched::setCurrent(nullptr);
+            Trace::setCurrent({});
+        },
+        token);
+    Backend::ReadCounter::setCurrent(reads);
+    Backend::Prefetched::setCurrent(prefetched);
+    Trace::setCurrent(std::move(trace));
+    if (ec)
+        throw Backend::DatabaseTimeout();
+    return result;
+}
+}  // namespace
+
+std::optional<ripple::LedgerInfo>
+fetchLedgerBySequence(Context const& ctx, std::uint32_t sequence)
+{
+    if (!ctx.yield)
+        return ctx.backend->fetchLedgerBySequence(sequence);
+    return suspendFor<std::optional<ripple::LedgerInfo>>(
+        ctx, [&](auto handler) {
+            ctx.backend->asyncFetchLedgerBySequence(
+                sequence, std::move(handler));
+        });
+}
+
+std::optional<Backend::Blob>
+fetchLedgerObject(
+    Context const& ctx,
+    ripple::uint256 const& key,
+    std::uint32_t sequence)
+{
+    if (!ctx.yield)
+        return ctx.backend->fetchLedgerObject(key, sequence);
+    return suspendFor<std::optional<Backend::Blob>>(ctx, [&](auto handler) {
+        ctx.backend->asyncFetchLedgerObject(key, sequence, std::move(handler));
+    });
+}
+
+std::vector<Backend::Blob>
+fetchLedgerObjects(
+    Context const& ctx,
+    std::vector<ripple::uint256> const& keys,
+    std::uint32_t sequence)
+{
+    if (!ctx.yield)
+        return ctx.backend->fetchLedgerObjects(keys, sequence);
+    return suspendFor<std::vector<Backend::Blob>>(ctx, [&](auto handler) {
+        ctx.backend->asyncFetchLedgerObjects(
+            keys, sequence, std::move(handler));
+    });
+}
+
+std::vector<Backend::TransactionAndMetadata>
+fetchTransactions(
+    Context const& ctx,
+    std::vector<ripple::uint256> const& hashes)
+{
+    if (!ctx.yield)
+        return ctx.backend->fetchTransactions(hashes);
+    return suspendFor<std::vector<Backend::TransactionAndMetadata>>(
+        ctx, [&](auto handler) {
+            ctx.backend->asyncFetchTransactions(hashes, std::move(handler));
+        });
+}
+
+Backend::LedgerPage
+fetchLedgerPage(
+    Context const& ctx,
+    std::optional<ripple::uint256> const& cursor,
+    std::uint32_t sequence,
+    std::uint32_t limit)
+{
+    Backend::LedgerPage page;
+    auto keys = ctx.backend->fetchSuccessorKeys(
+        cursor ? *cursor : Backend::firstKey, sequence, limit);
+    auto objects = fetchLedgerObjects(ctx, keys, sequence);
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        assert(objects[i].size());
+        page.objects.push_back({std::move(keys[i]), std::move(objects[i])});
+    }
+    if (page.objects.size() >= limit)
+        page.cursor = page.objects.back().key;
+    return page;
+}
+
+Backend::BookOffersPage
+fetchBookOffers(
+    Context const& ctx,
+    ripple::uint256 const& book,
+    std::uint32_t sequence,
+    std::uint32_t limit)
+{
+    Backend::BookOffersPage page;
+    auto keys = ctx.backend->fetchBookOfferKeys(book, sequence, limit);
+    auto objects = fetchLedgerObjects(ctx, keys, sequence);
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        assert(objects[i].size());
+        page.offers.push_back({std::move(keys[i]), std::move(objects[i])});
+    }
+    return page;
+}
+
 std::variant<Status, ripple::LedgerInfo>
 ledgerInfoFromRequest(Context const& ctx)
 {
@@ -370,11 +532,11 @@ ledgerInfoFromRequest(Context const& ctx)
         else
             return Status{Error::rpcINVALID_PARAMS, "ledgerIndexMalformed"};
 
-        lgrInfo = ctx.backend->fetchLedgerBySequence(ledgerSequence);
+        lgrInfo = fetchLedgerBySequence(ctx, ledgerSequence);
     }
     else
     {
-        lgrInfo = ctx.backend->fetchLedgerBySequence(ctx.range.maxSequence);
+        lgrInfo = fetchLedgerBySequence(ctx, ctx.range.maxSequence);
     }
 
     if (!lgrInfo)
@@ -401,72 +563,203 @@ ledgerInfoToBlob(ripple::LedgerInfo const& info, bool includeHash)
     return s.peekData();
 }
 
+namespace {
+// Owned nodes of an account, fetched in batches while its directory is
+// walked. Each batch is requested before the previous one is handed to the
+// callback, so the callback runs while the next objects are read
+class OwnedNodeBatches
+{
+    using Objects = std::vector<Backend::Blob>;
+
+    BackendInterface const& backend_;
+    std::uint32_t const sequence_;
+    std::function<bool(ripple::SLE)> const& atOwnedNode_;
+    // walked, but not requested yet
+    std::vector<ripple::uint256> keys_;
+    std::vector<ripple::uint256> inFlightKeys_;
+    std::future<Objects> inFlight_;
+    std::size_t batchSize_;
+    bool stopped_ = false;
+    std::optional<ripple::uint256> nextCursor_;
+
+    // batches grow up to this, for callbacks that accept every node
+    static constexpr std::size_t maxBatchSize = 2048;
+
+    std::future<Objects>
+    request(std::vector<ripple::uint256> const& keys)
+    {
+        auto promise = std::make_shared<std::promise<Objects>>();
+        auto future = promise->get_future();
+        backend_.fetchLedgerObjectsAsync(
+            keys,
+            sequence_,
+            [promise](boost::system::error_code ec, Objects objs) {
+                if (ec)
+                    promise->set_exception(std::make_exception_ptr(
+                        Backend::DatabaseTimeout()));
+                else
+                    promise->set_value(std::move(objs));
+            });
+        return future;
+    }
+
+    // hand the batch in flight to the callback
+    void
+    process()
+    {
+        auto objects = inFlight_.get();
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            if (objects[i].empty())
+                continue;
+            ripple::SerialIter it{objects[i].data(), objects[i].size()};
+            ripple::SLE sle(it, inFlightKeys_[i]);
+            if (!atOwnedNode_(sle))
+            {
+                stopped_ = true;
+                // otherwise the cursor is the first key of the next batch
+                if (i + 1 < inFlightKeys_.size())
+                    nextCursor_ = inFlightKeys_[i + 1];
+                return;
+            }
+        }
+    }
+
+public:
+    // the callback usually accepts up to limit nodes, and then declines one
+    OwnedNodeBatches(
+        BackendInterface const& backend,
+        std::uint32_t sequence,
+        std::function<bool(ripple::SLE)> const& atOwnedNode,
+        std::uint32_t limit)
+        : backend_(backend)
+        , sequence_(sequence)
+        , atOwnedNode_(atOwnedNode)
+        , batchSize_(std::min<std::size_t>(limit, maxBatchSize - 1) + 1)
+    {
+    }
+
+    // false once the callback declined a node
+    bool
+    add(ripple::uint256 const& key)
+    {
+        keys_.push_back(key);
+        if (keys_.size() >= batchSize_)
+            flush();
+        return !stopped_;
+    }
+
+    // request the walked keys, and then process the previous batch
+    void
+    flush()
+    {
+        if (keys_.empty())
+            return;
+        auto next = request(keys_);
+        if (inFlight_.valid())
+        {
+            process();
+            if (stopped_)
+            {
+                if (!nextCursor_)
+                    nextCursor_ = keys_.front();
+                keys_.clear();
+                return;
+            }
+        }
+        inFlightKeys_ = std::move(keys_);
+        inFlight_ = std::move(next);
+        keys_.clear();
+        batchSize_ = std::min(2 * batchSize_, maxBatchSize);
+    }
+
+    // process the remaining nodes. Returns the cursor of the next page
+    std::optional<ripple::uint256>
+    finish()
+    {
+        flush();
+        if (!stopped_ && inFlight_.valid())
+            process();
+        return nextCursor_;
+    }
+};
+}  // namespace
+
 std::optional<ripple::uint256>
 traverseOwnedNodes(
     BackendInterface const& backend,
     ripple::AccountID const& accountID,
     std::uint32_t sequence,
     ripple::uint256 const& cursor,
+    std::uint32_t limit,
     std::function<bool(ripple::SLE)> atOwnedNode)
 {
-    if (!backend.fetchLedgerObject(
+    if (!backend.fetchLedgerObjectView(
             ripple::keylet::account(accountID).key, sequence))
         throw AccountNotFoundError(ripple::toBase58(accountID));
     auto const rootIndex = ripple::keylet::ownerDir(accountID);
-    auto currentIndex = rootIndex;
-
-    std::vector<ripple::uint256> keys;
-    std::optional<ripple::uint256> nextCursor = {};
 
     auto start = std::chrono::system_clock::now();
-    for (;;)
-    {
-        auto ownedNode = backend.fetchLedgerObject(currentIndex.key, sequence);
-
-        if (!ownedNode)
-        {
-            break;
-        }
-
-        ripple::SerialIter it{ownedNode->data(), ownedNode->size()};
-        ripple::SLE dir{it, currentIndex.key};
-
-        for (auto const& key : dir.getFieldV256(ripple::sfIndexes))
-        {
-            if (key >= cursor)
-                keys.push_back(key);
-        }
+    OwnedNodeBatches batches{backend, sequence, atOwnedNode, limit};
+    // a page holds up to 32 keys
+    auto const pages = std::min<std::uint32_t>(limit / 32, 31) + 1;
+    backend.walkDirectoryPages(
+        rootIndex.key,
+        sequence,
+        [&](ripple::SLE const& dir) {
+            for (auto const& key : dir.getFieldV256(ripple::sfIndexes))
+            {
+                if (key >= cursor && !batches.add(key))
+                    return false;
+            }
+            return true;
+        },
+        pages);
+    auto nextCursor = batches.finish();
+    auto end = std::chrono::system_clock::now();
 
-        auto const uNodeNext = dir.getFieldU64(ripple::sfIndexNext);
-        if (uNodeNext == 0)
-            break;
+    CLIO_LOG_SAMPLED(debug) << "Time traversing owned nodes: "
+                            << ((end - start).count() / 1000000000.0);
 
-        currentIndex = ripple::keylet::page(rootIndex, uNodeNext);
-    }
-    auto end = std::chrono::system_clock::now();
+    return nextCursor;
+}
 
-    BOOST_LOG_TRIVIAL(debug) << "Time loading owned directories: "
-                             << ((end - start).count() / 1000000000.0);
+Backend::TrustLineCache::Lines
+trustLines(
+    BackendInterface const& backend,
+    ripple::AccountID const& accountID,
+    std::uint32_t sequence)
+{
+    auto& cache = backend.trustLineCache();
+    if (auto lines = cache.get(accountID, sequence))
+        return lines;
 
-    start = std::chrono::system_clock::now();
-    auto objects = backend.fetchLedgerObjects(keys, sequence);
-    end = std::chrono::system_clock::now();
+    if (!backend.fetchLedgerObjectView(
+            ripple::keylet::account(accountID).key, sequence))
+        throw AccountNotFoundError(ripple::toBase58(accountID));
 
-    BOOST_LOG_TRIVIAL(debug) << "Time loading owned entries: "
-                             << ((end - start).count() / 1000000000.0);
+    std::vector<ripple::uint256> keys;
+    backend.walkDirectoryPages(
+        ripple::keylet::ownerDir(accountID).key,
+        sequence,
+        [&keys](ripple::SLE const& dir) {
+            for (auto const& key : dir.getFieldV256(ripple::sfIndexes))
+                keys.push_back(key);
+            return true;
+        });
 
-    for (auto i = 0; i < objects.size(); ++i)
+    auto objects = backend.fetchLedgerObjectViews(keys, sequence);
+    auto lines = std::make_shared<std::vector<Backend::TrustLine>>();
+    for (size_t i = 0; i < objects.size(); ++i)
     {
-        ripple::SerialIter it{objects[i].data(), objects[i].size()};
-        ripple::SLE sle(it, keys[i]);
-        if (!atOwnedNode(sle))
-        {
-            nextCursor = keys[i + 1];
-            break;
-        }
+        if (objects[i].empty())
+            continue;
+        if (auto line = Backend::TrustLine::parse(
+                keys[i], objects[i].data, objects[i].size))
+            lines->push_back(std::move(*line));
     }
-
-    return nextCursor;
+    cache.insert(accountID, sequence, lines);
+    return lines;
 }
 
 std::optional<ripple::Seed>
@@ -635,6 +928,55 @@ getAccountsFromTransaction(boost::json::object const& transaction)
     return accounts;
 }
 
+namespace {
+// XRP held by the account of root, its account root, beyond its reserve
+ripple::XRPAmount
+liquidXRP(ripple::SLE const& root, ripple::Fees const& fees)
+{
+    std::uint32_t const ownerCount = root.getFieldU32(ripple::sfOwnerCount);
+
+    auto const reserve = fees.accountReserve(ownerCount);
+
+    auto const balance = root.getFieldAmount(ripple::sfBalance);
+
+    ripple::STAmount amount = balance - reserve;
+    if (balance < reserve)
+        amount.clear();
+
+    return amount.xrp();
+}
+
+// balance of line, the trust line of account with issuer, in account terms
+ripple::STAmount
+lineBalance(
+    ripple::SLE const& line,
+    ripple::AccountID const& account,
+    ripple::AccountID const& issuer)
+{
+    auto amount = line.getFieldAmount(ripple::sfBalance);
+    if (account > issuer)
+    {
+        // Put balance in account terms.
+        amount.negate();
+    }
+    amount.setIssuer(issuer);
+    return amount;
+}
+
+// whether issuer froze line, its trust line with account
+bool
+isLineFrozen(
+    ripple::SLE const& line,
+    ripple::AccountID const& account,
+    ripple::AccountID const& issuer)
+{
+    auto frozen =
+        (issuer > account) ? ripple::lsfHighFreeze : ripple::lsfLowFreeze;
+
+    return line.isFlag(frozen);
+}
+}  // namespace
+
 bool
 isGlobalFrozen(
     BackendInterface const& backend,
@@ -645,12 +987,12 @@ isGlobalFrozen(
         return false;
 
     auto key = ripple::keylet::account(issuer).key;
-    auto blob = backend.fetchLedgerObject(key, sequence);
+    auto blob = backend.fetchLedgerObjectView(key, sequence);
 
     if (!blob)
         return false;
 
-    ripple::SerialIter it{blob->data(), blob->size()};
+    ripple::SerialIter it{blob->data, blob->size};
     ripple::SLE sle{it, key};
 
     return sle.isFlag(ripple::lsfGlobalFreeze);
@@ -668,12 +1010,12 @@ isFrozen(
         return false;
 
     auto key = ripple::keylet::account(issuer).key;
-    auto blob = backend.fetchLedgerObject(key, sequence);
+    auto blob = backend.fetchLedgerObjectView(key, sequence);
 
     if (!blob)
         return false;
 
-    ripple::SerialIter it{blob->data(), blob->size()};
+    ripple::SerialIter it{blob->data, blob->size};
     ripple::SLE sle{it, key};
 
     if (sle.isFlag(ripple::lsfGlobalFreeze))
@@ -682,18 +1024,15 @@ isFrozen(
     if (issuer != account)
     {
         key = ripple::keylet::line(account, issuer, currency).key;
-        blob = backend.fetchLedgerObject(key, sequence);
+        blob = backend.fetchLedgerObjectView(key, sequence);
 
         if (!blob)
             return false;
 
-        ripple::SerialIter issuerIt{blob->data(), blob->size()};
+        ripple::SerialIter issuerIt{blob->data, blob->size};
         ripple::SLE issuerLine{issuerIt, key};
 
-        auto frozen =
-            (issuer > account) ? ripple::lsfHighFreeze : ripple::lsfLowFreeze;
-
-        if (issuerLine.isFlag(frozen))
+        if (isLineFrozen(issuerLine, account, issuer))
             return true;
     }
 
@@ -707,26 +1046,15 @@ xrpLiquid(
     ripple::AccountID const& id)
 {
     auto key = ripple::keylet::account(id).key;
-    auto blob = backend.fetchLedgerObject(key, sequence);
+    auto blob = backend.fetchLedgerObjectView(key, sequence);
 
     if (!blob)
         return beast::zero;
 
-    ripple::SerialIter it{blob->data(), blob->size()};
+    ripple::SerialIter it{blob->data, blob->size};
     ripple::SLE sle{it, key};
 
-    std::uint32_t const ownerCount = sle.getFieldU32(ripple::sfOwnerCount);
-
-    auto const reserve =
-        backend.fetchFees(sequence)->accountReserve(ownerCount);
-
-    auto const balance = sle.getFieldAmount(ripple::sfBalance);
-
-    ripple::STAmount amount = balance - reserve;
-    if (balance < reserve)
-        amount.clear();
-
-    return amount.xrp();
+    return liquidXRP(sle, *backend.fetchFees(sequence));
 }
 
 ripple::STAmount
@@ -763,7 +1091,7 @@ accountHolds(
     }
     auto key = ripple::keylet::line(account, issuer, currency).key;
 
-    auto const blob = backend.fetchLedgerObject(key, sequence);
+    auto const blob = backend.fetchLedgerObjectView(key, sequence);
 
     if (!blob)
     {
@@ -771,7 +1099,7 @@ accountHolds(
         return amount;
     }
 
-    ripple::SerialIter it{blob->data(), blob->size()};
+    ripple::SerialIter it{blob->data, blob->size};
     ripple::SLE sle{it, key};
 
     if (zeroIfFrozen && isFrozen(backend, sequence, account, currency, issuer))
@@ -780,13 +1108,7 @@ accountHolds(
     }
     else
     {
-        amount = sle.getFieldAmount(ripple::sfBalance);
-        if (account > issuer)
-        {
-            // Put balance in account terms.
-            amount.negate();
-        }
-        amount.setIssuer(issuer);
+        amount = lineBalance(sle, account, issuer);
     }
 
     return amount;
@@ -799,11 +1121,11 @@ transferRate(
     ripple::AccountID const& issuer)
 {
     auto key = ripple::keylet::account(issuer).key;
-    auto blob = backend.fetchLedgerObject(key, sequence);
+    auto blob = backend.fetchLedgerObjectView(key, sequence);
 
     if (blob)
     {
-        ripple::SerialIter it{blob->data(), blob->size()};
+        ripple::SerialIter it{blob->data, blob->size};
         ripple::SLE sle{it, key};
 
         if (sle.isFieldPresent(ripple::sfTransferRate))
@@ -813,6 +1135,65 @@ transferRate(
     return ripple::parityRate;
 }
 
+namespace {
+// what order books need to know about the issuer of an asset
+struct IssuerInfo
+{
+    bool globalFreeze = false;
+    ripple::Rate rate = ripple::parityRate;
+};
+
+IssuerInfo
+issuerInfo(ripple::SLE const& root)
+{
+    IssuerInfo info;
+    info.globalFreeze = root.isFlag(ripple::lsfGlobalFreeze);
+    if (root.isFieldPresent(ripple::sfTransferRate))
+        info.rate = ripple::Rate{root.getFieldU32(ripple::sfTransferRate)};
+    return info;
+}
+
+// Issuers of the books read by recent requests and subscriptions, as of the
+// most recent ledger they were read at. Reads at older ledgers bypass it
+class IssuerCache
+{
+    std::mutex mtx_;
+    std::uint32_t sequence_ = 0;
+    std::unordered_map<ripple::AccountID, IssuerInfo, ripple::hardened_hash<>>
+        issuers_;
+
+public:
+    std::optional<IssuerInfo>
+    get(ripple::AccountID const& issuer, std::uint32_t sequence)
+    {
+        std::lock_guard lck{mtx_};
+        if (sequence != sequence_)
+            return {};
+        if (auto it = issuers_.find(issuer); it != issuers_.end())
+            return it->second;
+        return {};
+    }
+
+    void
+    put(ripple::AccountID const& issuer,
+        std::uint32_t sequence,
+        IssuerInfo const& info)
+    {
+        std::lock_guard lck{mtx_};
+        if (sequence < sequence_)
+            return;
+        if (sequence > sequence_)
+        {
+            issuers_.clear();
+            sequence_ = sequence;
+        }
+        issuers_[issuer] = info;
+    }
+};
+
+IssuerCache issuerCache;
+}  // namespace
+
 boost::json::array
 postProcessOrderBook(
     std::vector<Backend::LedgerObject> const& offers,
@@ -825,18 +1206,110 @@ postProcessOrderBook(
 
     std::map<ripple::AccountID, ripple::STAmount> umBalance;
 
-    bool globalFreeze =
-        isGlobalFrozen(backend, ledgerSequence, book.out.account) ||
-        isGlobalFrozen(backend, ledgerSequence, book.out.account);
-
-    auto rate = transferRate(backend, ledgerSequence, book.out.account);
+    // The issuers, and the account roots or trust lines that fund the
+    // offers, are all read in one batch, instead of per offer
+    std::vector<ripple::uint256> keys;
+    std::map<ripple::AccountID, IssuerInfo> issuers;
+    std::vector<ripple::AccountID> uncachedIssuers;
+    for (auto const& issuer : {book.in.account, book.out.account})
+    {
+        if (issuers.count(issuer))
+            continue;
+        if (ripple::isXRP(issuer))
+            issuers[issuer] = {};
+        else if (auto info = issuerCache.get(issuer, ledgerSequence))
+            issuers[issuer] = *info;
+        else
+        {
+            issuers[issuer] = {};
+            uncachedIssuers.push_back(issuer);
+            keys.push_back(ripple::keylet::account(issuer).key);
+        }
+    }
 
+    std::vector<ripple::SLE> parsed;
+    parsed.reserve(offers.size());
+    // index in keys of the object funding the offers of each owner
+    std::map<ripple::AccountID, std::size_t> funding;
     for (auto const& obj : offers)
     {
+        auto const count = parsed.size();
         try
         {
             ripple::SerialIter it{obj.blob.data(), obj.blob.size()};
-            ripple::SLE offer{it, obj.key};
+            auto const& offer = parsed.emplace_back(it, obj.key);
+            auto const owner = offer.getAccountID(ripple::sfAccount);
+            if (owner == book.out.account || funding.count(owner))
+                continue;
+            funding[owner] = keys.size();
+            keys.push_back(
+                ripple::isXRP(book.out.currency)
+                    ? ripple::keylet::account(owner).key
+                    : ripple::keylet::line(
+                          owner, book.out.account, book.out.currency)
+                          .key);
+        }
+        catch (std::exception const& e)
+        {
+            BOOST_LOG_TRIVIAL(error) << "caught exception: " << e.what();
+            if (parsed.size() > count)
+                parsed.pop_back();
+        }
+    }
+
+    auto const objects = backend.fetchLedgerObjectViews(keys, ledgerSequence);
+    for (size_t i = 0; i < uncachedIssuers.size(); ++i)
+    {
+        auto const& issuer = uncachedIssuers[i];
+        if (!objects[i].empty())
+        {
+            ripple::SerialIter it{objects[i].data, objects[i].size};
+            issuers[issuer] = issuerInfo(ripple::SLE{it, keys[i]});
+        }
+        issuerCache.put(issuer, ledgerSequence, issuers[issuer]);
+    }
+
+    bool globalFreeze = issuers[book.in.account].globalFreeze ||
+        issuers[book.out.account].globalFreeze;
+
+    auto rate = issuers[book.out.account].rate;
+
+    // the funds of owner, as accountHolds() returns them with zeroIfFrozen
+    // set. Frozen issuers were ruled out by globalFreeze
+    std::optional<ripple::Fees> fees;
+    auto const ownerFunds = [&](ripple::AccountID const& owner) {
+        auto const index = funding.at(owner);
+        auto const& blob = objects[index];
+        ripple::STAmount amount;
+        if (ripple::isXRP(book.out.currency))
+        {
+            if (blob.empty())
+                return ripple::STAmount{ripple::XRPAmount{beast::zero}};
+            if (!fees)
+                fees = backend.fetchFees(ledgerSequence);
+            ripple::SerialIter it{blob.data, blob.size};
+            return ripple::STAmount{
+                liquidXRP(ripple::SLE{it, keys[index]}, *fees)};
+        }
+
+        if (blob.empty())
+        {
+            amount.clear({book.out.currency, book.out.account});
+            return amount;
+        }
+        ripple::SerialIter it{blob.data, blob.size};
+        ripple::SLE line{it, keys[index]};
+        if (isLineFrozen(line, owner, book.out.account))
+            amount.clear(ripple::Issue(book.out.currency, book.out.account));
+        else
+            amount = lineBalance(line, owner, book.out.account);
+        return amount;
+    };
+
+    for (auto const& offer : parsed)
+    {
+        try
+        {
             ripple::uint256 bookDir =
                 offer.getFieldH256(ripple::sfBookDirectory);
 
@@ -870,14 +1343,7 @@ postProcessOrderBook(
                 }
                 else
                 {
-                    bool zeroIfFrozen = true;
-                    saOwnerFunds = accountHolds(
-                        backend,
-                        ledgerSequence,
-                        uOfferOwnerID,
-                        book.out.currency,
-                        book.out.account,
-                        zeroIfFrozen);
+                    saOwnerFunds = ownerFunds(uOfferOwnerID);
 
                     if (saOwnerFunds < beast::zero)
                         saOwnerFunds.clear();
@@ -1069,4 +1535,12 @@ parseTaker(boost::json::value const& taker)
     return *takerID;
 }
 
+boost::asio::thread_pool&
+renderPool()
+{
+    static boost::asio::thread_pool pool{
+        std::clamp(std::thread::hardware_concurrency() / 2, 1u, 8u)};
+    return pool;
+}
+
 }  // namespace RPC
@@ -11,7 +11,10 @@
 #include <ripple/protocol/STLedgerEntry.h>
 #include <ripple/protocol/STTx.h>
 #include <ripple/protocol/jss.h>
+#include <boost/asio/thread_pool.hpp>
 #include <backend/BackendInterface.h>
+#include <etl/ETLHelpers.h>
+#include <log/Log.h>
 #include <rpc/RPC.h>
 
 namespace RPC {
@@ -35,7 +38,9 @@ deserializeTxPlusMeta(
     std::uint32_t seq);
 
 std::pair<boost::json::object, boost::json::object>
-toExpandedJson(Backend::TransactionAndMetadata const& blobs);
+toExpandedJson(
+    Backend::TransactionAndMetadata const& blobs,
+    boost::json::storage_ptr sp = {});
 
 bool
 insertDeliveredAmount(
@@ -43,21 +48,24 @@ insertDeliveredAmount(
     std::shared_ptr<ripple::STTx const> const& txn,
     std::shared_ptr<ripple::TxMeta const> const& meta);
 
+// sp is the storage of the result; handlers pass the storage of the request
 boost::json::object
-toJson(ripple::STBase const& obj);
+toJson(ripple::STBase const& obj, boost::json::storage_ptr sp = {});
 
 boost::json::object
-toJson(ripple::SLE const& sle);
+toJson(ripple::SLE const& sle, boost::json::storage_ptr sp = {});
 
 boost::json::object
 toJson(ripple::LedgerInfo const& info);
 
 boost::json::object
-toJson(ripple::TxMeta const& meta);
+toJson(ripple::TxMeta const& meta, boost::json::storage_ptr sp = {});
 
 using RippledJson = Json::Value;
+// Converts value node by node, allocating from sp. Numbers come out signed,
+// as if value had been serialized and parsed
 boost::json::value
-toBoostJson(RippledJson const& value);
+toBoostJson(RippledJson const& value, boost::json::storage_ptr sp = {});
 
 boost::json::object
 generatePubLedgerMessage(
@@ -66,17 +74,73 @@ generatePubLedgerMessage(
     std::string const& ledgerRange,
     uint32_t txnCount);
 
+// Reads of ctx.backend for handlers. If the request runs on a coroutine,
+// they are asynchronous reads that suspend it until the database responds,
+// and its thread runs other requests meanwhile. Otherwise they are the
+// synchronous reads. Throw DatabaseTimeout
+std::optional<ripple::LedgerInfo>
+fetchLedgerBySequence(Context const& ctx, std::uint32_t sequence);
+
+std::optional<Backend::Blob>
+fetchLedgerObject(
+    Context const& ctx,
+    ripple::uint256 const& key,
+    std::uint32_t sequence);
+
+std::vector<Backend::Blob>
+fetchLedgerObjects(
+    Context const& ctx,
+    std::vector<ripple::uint256> const& keys,
+    std::uint32_t sequence);
+
+std::vector<Backend::TransactionAndMetadata>
+fetchTransactions(
+    Context const& ctx,
+    std::vector<ripple::uint256> const& hashes);
+
+// As the backend methods of the same names. Keys are found as they are
+// there, mostly in the caches, and the objects are read as above
+Backend::LedgerPage
+fetchLedgerPage(
+    Context const& ctx,
+    std::optional<ripple::uint256> const& cursor,
+    std::uint32_t sequence,
+    std::uint32_t limit);
+
+Backend::BookOffersPage
+fetchBookOffers(
+    Context const& ctx,
+    ripple::uint256 const& book,
+    std::uint32_t sequence,
+    std::uint32_t limit);
+
 std::variant<Status, ripple::LedgerInfo>
 ledgerInfoFromRequest(Context const& ctx);
 
+// Hands the objects owned by accountID from cursor onward to atOwnedNode,
+// until it returns false. Objects are fetched in batches as the directory is
+// walked, the first one sized for atOwnedNode to accept limit objects, so a
+// small page of a large directory only reads the start of it. Returns the
+// cursor of the next page, if atOwnedNode stopped the traversal
 std::optional<ripple::uint256>
 traverseOwnedNodes(
     BackendInterface const& backend,
     ripple::AccountID const& accountID,
     std::uint32_t sequence,
     ripple::uint256 const& cursor,
+    std::uint32_t limit,
     std::function<bool(ripple::SLE)> atOwnedNode);
 
+// Every trust line of accountID, in the order of its owner directory. For
+// handlers that visit all of the lines, and only read a few fields of each.
+// Lines at the most recent ledger are cached until a transaction affects
+// accountID. Throws AccountNotFoundError if accountID does not exist
+Backend::TrustLineCache::Lines
+trustLines(
+    BackendInterface const& backend,
+    ripple::AccountID const& accountID,
+    std::uint32_t sequence);
+
 std::variant<Status, std::pair<ripple::PublicKey, ripple::SecretKey>>
 keypairFromRequst(boost::json::object const& request);
 
@@ -176,5 +240,35 @@ getString(
     boost::json::object const& request,
     std::string const& field,
     std::string dfault);
+
+// Threads that handlers fan CPU bound work out to, such as rendering the
+// objects of a large page. Separate from the workers running the handlers,
+// which wait for that work
+boost::asio::thread_pool&
+renderPool();
+
+// The array of f(i) for every i in [0, n). Large arrays are rendered in
+// chunks on renderPool(), so f must be safe to call concurrently
+template <class F>
+boost::json::array
+renderArray(std::size_t n, F const& f)
+{
+    static constexpr std::size_t minChunk = 64;
+    static constexpr std::size_t maxChunks = 8;
+
+    boost::json::array array(n);
+    if (n < 2 * minChunk)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            array[i] = f(i);
+        return array;
+    }
+    ParallelFor work{
+        renderPool(), n, maxChunks, minChunk, [&array, &f](size_t i) {
+            array[i] = f(i);
+        }};
+    work.wait();
+    return array;
+}
 }  // namespace RPC
 #endif
@@ -0,0 +1,230 @@
+#include <rpc/RPC.h>
+#include <rpc/ResponseCache.h>
+#include <algorithm>
+#include <string_view>
+
+namespace RPC {
+
+namespace {
+// methods whose results only depend on their params and the ledger
+bool
+isCacheable(MethodID method)
+{
+    switch (method)
+    {
+        case MethodID::ledger:
+        case MethodID::ledgerData:
+        case MethodID::ledgerEntry:
+        case MethodID::tx:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// params that do not change the result
+bool
+isIgnored(std::string_view name)
+{
+    return name == "id" || name == "command" || name == "jsonrpc";
+}
+}  // namespace
+
+void
+ResponseCache::setup(boost::json::object const& config)
+{
+    if (!config.contains("response_cache"))
+        return;
+    auto const& cacheConfig = config.at("response_cache").as_object();
+    if (cacheConfig.contains("max_mb") && cacheConfig.at("max_mb").is_int64())
+        maxBytes_ = cacheConfig.at("max_mb").as_int64() << 20;
+}
+
+std::optional<ResponseCache::Key>
+ResponseCache::key(Context const& ctx, char const* transport)
+{
+    if (!isCacheable(ctx.methodID))
+        return {};
+
+    Key key;
+    key.minSeq = ctx.range.minSequence;
+    key.maxSeq = ctx.range.maxSequence;
+    auto const& params = ctx.params;
+    // a transaction is the same in every ledger, and so is a ledger hash
+    if (ctx.methodID != MethodID::tx && !params.contains("ledger_hash"))
+    {
+        auto index = params.find("ledger_index");
+        if (index == params.end() ||
+            (index->value().is_string() &&
+             index->value().as_string() == "validated"))
+        {
+            key.seq = ctx.range.maxSequence;
+            key.alias = true;
+        }
+        else if (index->value().is_int64())
+            key.seq = index->value().as_int64();
+        // "current" and "closed" are forwarded. Other strings are errors
+        else
+            return {};
+        // deleted by online delete. The handler answers with an error
+        if (key.seq < key.minSeq)
+            return {};
+    }
+
+    // the same params in another order are the same request
+    std::vector<std::pair<std::string_view, std::string>> members;
+    for (auto const& member : params)
+    {
+        if (!isIgnored(member.key()))
+            members.emplace_back(
+                member.key(), boost::json::serialize(member.value()));
+    }
+    std::sort(members.begin(), members.end());
+
+    key.str = transport;
+    key.str += '|';
+    key.str += ctx.method;
+    key.str += '|';
+    key.str += std::to_string(key.seq);
+    for (auto const& [name, value] : members)
+    {
+        key.str += '|';
+        key.str += name;
+        key.str += '=';
+        key.str += value;
+    }
+    return key;
+}
+
+std::uint32_t
+ResponseCache::ledgerOf(boost::json::object const& result)
+{
+    auto index = result.find("ledger_index");
+    if (index == result.end())
+        return 0;
+    if (index->value().is_uint64())
+        return index->value().as_uint64();
+    if (index->value().is_int64())
+        return index->value().as_int64();
+    return 0;
+}
+
+void
+ResponseCache::erase(std::unordered_map<std::string, Entry>::iterator it)
+{
+    bytes_ -= it->second.bytes;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+void
+ResponseCache::advance(std::uint32_t seq)
+{
+    if (seq <= latestSeq_)
+        return;
+    latestSeq_ = seq;
+    // some of these were evicted already
+    for (auto const& key : aliases_)
+    {
+        if (auto it = entries_.find(key); it != entries_.end())
+            erase(it);
+    }
+    aliases_.clear();
+}
+
+std::shared_ptr<std::string const>
+ResponseCache::get(Key const& key)
+{
+    std::lock_guard lck{mtx_};
+    if (key.alias)
+        advance(key.seq);
+    auto it = entries_.find(key.str);
+    if (it == entries_.end())
+    {
+        ++misses_;
+        return {};
+    }
+    // online delete removed the ledger since the response was cached
+    if (it->second.seq < key.minSeq)
+    {
+        erase(it);
+        ++misses_;
+        return {};
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return it->second.response;
+}
+
+void
+ResponseCache::put(
+    Key const& key,
+    std::uint32_t seq,
+    std::shared_ptr<std::string const> response)
+{
+    // a transaction of a ledger that was deleted, or not committed yet
+    if (seq < key.minSeq || seq > key.maxSeq || (key.seq && seq != key.seq))
+        return;
+    // the key is held by both the map and the list
+    std::size_t const bytes = response->size() + 2 * key.str.size() + 128;
+    // a few huge pages would evict everything else
+    if (bytes > maxBytes_ / 8)
+        return;
+
+    std::lock_guard lck{mtx_};
+    if (key.alias)
+    {
+        advance(key.seq);
+        // a newer ledger was validated while the request ran
+        if (key.seq < latestSeq_)
+            return;
+    }
+    if (entries_.count(key.str))
+        return;
+    while (bytes_ + bytes > maxBytes_)
+        erase(entries_.find(lru_.back()));
+
+    lru_.push_front(key.str);
+    entries_.emplace(
+        key.str, Entry{std::move(response), lru_.begin(), bytes, seq});
+    bytes_ += bytes;
+    if (key.alias)
+        aliases_.push_back(key.str);
+}
+
+boost::json::object
+ResponseCache::report()
+{
+    std::lock_guard lck{mtx_};
+    boost::json::object report;
+    report["size"] = entries_.size();
+    report["bytes"] = bytes_;
+    report["max_bytes"] = maxBytes_;
+    report["hits"] = hits_;
+    report["misses"] = misses_;
+    return report;
+}
+
+ResponseCache&
+responseCache()
+{
+    static ResponseCache cache;
+    return cache;
+}
+
+std::string
+wsResponseBody(boost::json::object response, std::string const& result)
+{
+    response.erase("result");
+    std::string body = boost::json::serialize(response);
+    // replace the closing brace with the result
+    body.pop_back();
+    if (!response.empty())
+        body += ',';
+    body += "\"result\":";
+    body += result;
+    body += '}';
+    return body;
+}
+
+}  // namespace RPC
@@ -0,0 +1,120 @@
+#ifndef RPC_RESPONSECACHE_H
+#define RPC_RESPONSECACHE_H
+
+#include <boost/json.hpp>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace RPC {
+
+struct Context;
+
+// Serialized responses to requests for data that never changes, such as a
+// transaction, or a ledger, object or page of ledger_data at a given ledger.
+// Sessions write a cached response straight out, without running the handler
+// or serializing anything. HTTP sessions cache the whole body, websocket
+// sessions the result, which goes into a response with the request id.
+//
+// Requests for the most recent validated ledger are cached too, under the
+// ledger they resolve to. Those entries are dropped once a newer ledger is
+// validated. Every entry remembers the ledger its response is from, and is
+// dropped once online delete removes that ledger. The cache is disabled
+// unless response_cache.max_mb is set.
+class ResponseCache
+{
+public:
+    struct Key
+    {
+        std::string str;
+        // ledger the request resolves to
+        std::uint32_t seq = 0;
+        // whether the request names that ledger as the validated one, rather
+        // than by sequence or hash
+        bool alias = false;
+        // the range of ledgers in the database when the request was made
+        std::uint32_t minSeq = 0;
+        std::uint32_t maxSeq = 0;
+    };
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<std::string const> response;
+        std::list<std::string>::iterator lru;
+        std::size_t bytes;
+        // ledger the response is from
+        std::uint32_t seq;
+    };
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, Entry> entries_;
+    // most recently used first
+    std::list<std::string> lru_;
+    // keys of the entries for the validated ledger, latestSeq_
+    std::vector<std::string> aliases_;
+    std::uint32_t latestSeq_ = 0;
+    std::size_t bytes_ = 0;
+    std::size_t maxBytes_ = 0;
+    std::uint64_t hits_ = 0;
+    std::uint64_t misses_ = 0;
+
+    void
+    erase(std::unordered_map<std::string, Entry>::iterator it);
+
+    // drop the entries for the validated ledger, once seq is newer
+    void
+    advance(std::uint32_t seq);
+
+public:
+    void
+    setup(boost::json::object const& config);
+
+    bool
+    enabled() const
+    {
+        return maxBytes_ != 0;
+    }
+
+    // the key of the response to ctx, if it is immutable. Sessions of each
+    // kind of transport cache their own responses
+    static std::optional<Key>
+    key(Context const& ctx, char const* transport);
+
+    // the ledger the result of a cacheable request is from, or 0
+    static std::uint32_t
+    ledgerOf(boost::json::object const& result);
+
+    // the cached response to key, unless its ledger was deleted since
+    std::shared_ptr<std::string const>
+    get(Key const& key);
+
+    // cache response, the response to key from ledger seq. Responses from
+    // ledgers outside the range of key are not cached
+    void
+    put(Key const& key,
+        std::uint32_t seq,
+        std::shared_ptr<std::string const> response);
+
+    boost::json::object
+    report();
+};
+
+// the cache shared by all sessions
+ResponseCache&
+responseCache();
+
+// Serialized websocket response, with the serialized result for the result
+// of response. response is the response without its result
+std::string
+wsResponseBody(boost::json::object response, std::string const& result);
+
+}  // namespace RPC
+
+#endif  // RPC_RESPONSECACHE_H
@@ -0,0 +1,328 @@
+#include <boost/asio/post.hpp>
+#include <rpc/WorkQueue.h>
+#include <algorithm>
+#include <thread>
+
+namespace RPC {
+
+namespace {
+// the contents of a JSON string, with its escapes replaced by the
+// characters they stand for. Invalid escapes are left as they are, as the
+// parser rejects the request anyway
+std::string
+unescape(std::string_view raw)
+{
+    if (raw.find('\\') == std::string_view::npos)
+        return std::string{raw};
+    auto hex = [](char c) -> int {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    };
+    std::string out;
+    out.reserve(raw.size());
+    for (std::size_t i = 0; i < raw.size(); ++i)
+    {
+        if (raw[i] != '\\' || i + 1 == raw.size())
+        {
+            out += raw[i];
+            continue;
+        }
+        switch (char c = raw[++i])
+        {
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u': {
+                std::uint32_t code = 0;
+                bool valid = i + 4 < raw.size();
+                for (std::size_t j = 1; valid && j <= 4; ++j)
+                {
+                    int digit = hex(raw[i + j]);
+                    valid = digit >= 0;
+                    code = code * 16 + digit;
+                }
+                if (!valid)
+                {
+                    out += "\\u";
+                    break;
+                }
+                i += 4;
+                // UTF-8. Method names are ASCII, so surrogates need not be
+                // paired
+                if (code < 0x80)
+                    out += static_cast<char>(code);
+                else if (code < 0x800)
+                {
+                    out += static_cast<char>(0xC0 | (code >> 6));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    out += static_cast<char>(0xE0 | (code >> 12));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            // '"', '\\' and '/'
+            default:
+                out += c;
+        }
+    }
+    return out;
+}
+}  // namespace
+
+CostClass
+costClass(MethodID method)
+{
+    switch (method)
+    {
+        // answered from memory, or forwarded without waiting on the database
+        case MethodID::fee:
+        case MethodID::ledgerRange:
+        case MethodID::ping:
+        case MethodID::random:
+        case MethodID::serverInfo:
+        case MethodID::subscribe:
+        case MethodID::unsubscribe:
+            return CostClass::cheap;
+        // pages of many objects or transactions
+        case MethodID::accountTx:
+        case MethodID::bookOffers:
+        case MethodID::ledger:
+        case MethodID::ledgerData:
+            return CostClass::expensive;
+        default:
+            return CostClass::standard;
+    }
+}
+
+char const*
+toString(CostClass costClass)
+{
+    switch (costClass)
+    {
+        case CostClass::cheap:
+            return "cheap";
+        case CostClass::expensive:
+            return "expensive";
+        default:
+            return "standard";
+    }
+}
+
+std::string
+peekString(std::string_view request, std::string_view field)
+{
+    auto isSpace = [](char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    };
+    auto skipSpace = [&](std::size_t i) {
+        while (i < request.size() && isSpace(request[i]))
+            ++i;
+        return i;
+    };
+    // the end of the string starting at i, the index of its closing quote
+    auto stringEnd = [&](std::size_t i) {
+        for (++i; i < request.size(); ++i)
+        {
+            if (request[i] == '\\')
+                ++i;
+            else if (request[i] == '"')
+                return i;
+        }
+        return std::string_view::npos;
+    };
+
+    // only members of the request itself count, not those of its params.
+    // The parser keeps the last of duplicate members, and so does this
+    std::string found;
+    int depth = 0;
+    for (std::size_t i = 0; i < request.size(); ++i)
+    {
+        char c = request[i];
+        if (c == '{' || c == '[')
+            ++depth;
+        else if (c == '}' || c == ']')
+            --depth;
+        if (c != '"')
+            continue;
+        auto end = stringEnd(i);
+        if (end == std::string_view::npos)
+            break;
+        auto name = request.substr(i + 1, end - i - 1);
+        i = end;
+        if (depth != 1 ||
+            (name != field &&
+             (name.find('\\') == std::string_view::npos ||
+              unescape(name) != field)))
+            continue;
+        auto colon = skipSpace(end + 1);
+        if (colon == request.size() || request[colon] != ':')
+            continue;
+        auto value = skipSpace(colon + 1);
+        if (value == request.size() || request[value] != '"')
+            continue;
+        end = stringEnd(value);
+        if (end == std::string_view::npos)
+            break;
+        found = unescape(request.substr(value + 1, end - value - 1));
+        i = end;
+    }
+    return found;
+}
+
+MethodID
+peekMethod(std::string_view request, std::string_view field)
+{
+    return toMethodID(peekString(request, field));
+}
+
+WorkQueue::Lane::Lane(LaneConfig const& config)
+    : workers(std::max<std::uint32_t>(config.workers, 1))
+    , maxRunning(
+          config.maxRunning ? config.maxRunning
+                            : workers * coroutinesPerWorker)
+    , maxSize(
+          config.maxSize ? config.maxSize
+                         : std::numeric_limits<std::uint64_t>::max())
+    , maxWait(config.maxWait)
+    , pool(workers)
+{
+}
+
+std::array<WorkQueue::LaneConfig, numCostClasses>
+WorkQueue::lanes(boost::json::object const& config)
+{
+    // handlers mostly wait on the database, and those that do so through
+    // synchronous reads block their worker, so there are more of them than
+    // cores
+    std::uint32_t rpcWorkers = 4 * std::thread::hardware_concurrency();
+    if (config.contains("rpc_workers") && config.at("rpc_workers").is_int64())
+        rpcWorkers = config.at("rpc_workers").as_int64();
+    std::uint32_t maxQueueSize = 0;
+    if (config.contains("max_queue_size") &&
+        config.at("max_queue_size").is_int64())
+        maxQueueSize = config.at("max_queue_size").as_int64();
+
+    std::array<LaneConfig, numCostClasses> lanes;
+    auto& cheap = lanes[static_cast<std::size_t>(CostClass::cheap)];
+    auto& standard = lanes[static_cast<std::size_t>(CostClass::standard)];
+    auto& expensive = lanes[static_cast<std::size_t>(CostClass::expensive)];
+    cheap.workers = std::max<std::uint32_t>(rpcWorkers / 8, 2);
+    expensive.workers = std::max<std::uint32_t>(rpcWorkers / 4, 1);
+    standard.workers = rpcWorkers > cheap.workers + expensive.workers
+        ? rpcWorkers - cheap.workers - expensive.workers
+        : 1;
+    for (auto& lane : lanes)
+        lane.maxSize = maxQueueSize;
+
+    if (!config.contains("rpc_lanes") || !config.at("rpc_lanes").is_object())
+        return lanes;
+    auto const& lanesConfig = config.at("rpc_lanes").as_object();
+    for (std::size_t i = 0; i < numCostClasses; ++i)
+    {
+        auto name = toString(static_cast<CostClass>(i));
+        if (!lanesConfig.contains(name) || !lanesConfig.at(name).is_object())
+            continue;
+        auto const& laneConfig = lanesConfig.at(name).as_object();
+        if (laneConfig.contains("workers"))
+            lanes[i].workers = laneConfig.at("workers").as_int64();
+        if (laneConfig.contains("max_running"))
+            lanes[i].maxRunning = laneConfig.at("max_running").as_int64();
+        if (laneConfig.contains("max_queue_size"))
+            lanes[i].maxSize = laneConfig.at("max_queue_size").as_int64();
+        if (laneConfig.contains("max_wait_ms"))
+            lanes[i].maxWait = std::chrono::milliseconds{
+                laneConfig.at("max_wait_ms").as_int64()};
+    }
+    return lanes;
+}
+
+WorkQueue::WorkQueue(boost::json::object const& config)
+{
+    auto configs = lanes(config);
+    for (std::size_t i = 0; i < numCostClasses; ++i)
+        lanes_[i] = std::make_unique<Lane>(configs[i]);
+}
+
+void
+WorkQueue::start(Lane& lane, Task&& task)
+{
+    {
+        std::lock_guard lock{lane.mtx};
+        if (lane.running == lane.maxRunning)
+        {
+            lane.waiting.push_back(std::move(task));
+            return;
+        }
+        ++lane.running;
+    }
+    boost::asio::spawn(
+        lane.pool,
+        [&lane, task = std::move(task)](
+            boost::asio::yield_context yield) mutable {
+            while (true)
+            {
+                task(yield);
+                std::unique_lock lock{lane.mtx};
+                if (lane.waiting.empty())
+                {
+                    --lane.running;
+                    return;
+                }
+                // the coroutine runs the next request, once the handlers
+                // that resumed meanwhile had their turn on the workers
+                task = std::move(lane.waiting.front());
+                lane.waiting.pop_front();
+                lock.unlock();
+                boost::asio::post(yield);
+            }
+        },
+        boost::coroutines::attributes{stackSize});
+}
+
+boost::json::object
+WorkQueue::report() const
+{
+    boost::json::object report;
+    for (std::size_t i = 0; i < numCostClasses; ++i)
+    {
+        auto const& lane = *lanes_[i];
+        boost::json::object laneReport;
+        auto queued = lane.queued.load();
+        auto started = queued + lane.shed.load();
+        laneReport["workers"] = lane.workers;
+        laneReport["max_running"] = lane.maxRunning;
+        laneReport["queued"] = queued;
+        laneReport["rejected"] = lane.rejected.load();
+        laneReport["shed"] = lane.shed.load();
+        laneReport["current_queue_size"] = lane.curSize.load();
+        laneReport["running"] = lane.running.load();
+        laneReport["avg_wait_us"] =
+            started ? lane.waitMicros.load() / started : 0;
+        laneReport["max_wait_us"] = lane.maxWaitMicros.load();
+        report[toString(static_cast<CostClass>(i))] = std::move(laneReport);
+    }
+    return report;
+}
+
+}  // namespace RPC
@@ -0,0 +1,173 @@
+#ifndef RPC_WORKQUEUE_H
+#define RPC_WORKQUEUE_H
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/json.hpp>
+#include <rpc/Methods.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace RPC {
+
+// How much work requests of a method cause. Each class has workers of its
+// own, so a burst of expensive requests cannot take the workers that cheap
+// ones need
+enum class CostClass : std::uint8_t { cheap, standard, expensive };
+
+constexpr std::size_t numCostClasses = 3;
+
+CostClass
+costClass(MethodID method);
+
+char const*
+toString(CostClass costClass);
+
+// The string member field of a serialized request, found without parsing
+// it, and unescaped. Members of nested objects are not. Empty if it is not
+// found
+std::string
+peekString(std::string_view request, std::string_view field);
+
+// The method of a serialized request, found without parsing it. field is
+// the member that names the method, "method" or "command". unknown if it
+// is not found
+MethodID
+peekMethod(std::string_view request, std::string_view field);
+
+// Runs RPC handlers on coroutines, on threads of their own rather than
+// the io_context. A handler suspends its coroutine while it waits on an
+// asynchronous read of the database, and its thread runs other requests
+// meanwhile. Synchronous reads still block the thread, so there are more
+// workers than cores.
+//
+// Every cost class is a lane with its own workers, bound on the requests
+// running at once, queue bound and maximum wait. Requests that waited longer
+// than that to start are shed before they do, since their client has likely
+// given up on them
+class WorkQueue
+{
+    using clock = std::chrono::steady_clock;
+    using Task = std::function<void(boost::asio::yield_context)>;
+
+    // as much stack as rippled gives the coroutines of its jobs
+    static constexpr std::size_t stackSize = 1024 * 1024;
+
+public:
+    // requests a lane runs at once by default, for every worker
+    static constexpr std::uint32_t coroutinesPerWorker = 4;
+
+    struct LaneConfig
+    {
+        std::uint32_t workers = 1;
+        // 0 runs coroutinesPerWorker requests for every worker at once
+        std::uint32_t maxRunning = 0;
+        // 0 queues any number of requests
+        std::uint32_t maxSize = 0;
+        // 0 never sheds requests
+        std::chrono::milliseconds maxWait{0};
+    };
+
+private:
+    struct Lane
+    {
+        std::atomic_uint64_t queued{0};
+        std::atomic_uint64_t rejected{0};
+        std::atomic_uint64_t shed{0};
+        std::atomic_uint64_t waitMicros{0};
+        std::atomic_uint64_t maxWaitMicros{0};
+        std::atomic_uint64_t curSize{0};
+        // changed under mtx, so that no request waits while fewer than
+        // maxRunning run
+        std::atomic_uint64_t running{0};
+        std::uint32_t const workers;
+        std::uint32_t const maxRunning;
+        std::uint64_t const maxSize;
+        std::chrono::milliseconds const maxWait;
+        std::mutex mtx;
+        // requests waiting for one of those running to finish
+        std::deque<Task> waiting;
+        boost::asio::thread_pool pool;
+
+        explicit Lane(LaneConfig const& config);
+    };
+
+    std::array<std::unique_ptr<Lane>, numCostClasses> lanes_;
+
+    // Run task on a new coroutine of lane, or queue it if lane already runs
+    // maxRunning requests
+    static void
+    start(Lane& lane, Task&& task);
+
+public:
+    // rpc_workers and max_queue_size are shared out to the lanes, and each
+    // lane can be configured in rpc_lanes
+    explicit WorkQueue(boost::json::object const& config);
+
+    // The lanes of config, by CostClass
+    static std::array<LaneConfig, numCostClasses>
+    lanes(boost::json::object const& config);
+
+    // Run f(yield) on a coroutine of the lane of costClass, or shed if f
+    // waited too long to start. returns false, without running either, if
+    // the lane already holds maxSize requests that have not started
+    template <class F, class S>
+    bool
+    post(CostClass costClass, F&& f, S&& shed)
+    {
+        auto& lane = *lanes_[static_cast<std::size_t>(costClass)];
+        if (++lane.curSize > lane.maxSize)
+        {
+            --lane.curSize;
+            ++lane.rejected;
+            return false;
+        }
+        start(
+            lane,
+            [&lane,
+             start = clock::now(),
+             f = std::forward<F>(f),
+             shed = std::forward<S>(shed)](
+                boost::asio::yield_context yield) mutable {
+                --lane.curSize;
+                auto waited = clock::now() - start;
+                std::uint64_t micros =
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        waited)
+                        .count();
+                lane.waitMicros += micros;
+                auto max = lane.maxWaitMicros.load();
+                while (micros > max &&
+                       !lane.maxWaitMicros.compare_exchange_weak(max, micros))
+                    ;
+                if (lane.maxWait.count() && waited > lane.maxWait)
+                {
+                    ++lane.shed;
+                    shed();
+                    return;
+                }
+                ++lane.queued;
+                f(yield);
+            });
+        return true;
+    }
+
+    // requests run, rejected and shed, the current queue size and number
+    // running, and the average and maximum time requests wait to start, by
+    // lane
+    boost::json::object
+    report() const;
+};
+
+}  // namespace RPC
+
+#endif  // RPC_WORKQUEUE_H
@@ -46,7 +46,7 @@ Result
 doAccountChannels(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     auto v = ledgerInfoFromRequest(context);
     if (auto status = std::get_if<Status>(&v))
@@ -122,7 +122,12 @@ doAccountChannels(Context const& context)
     };
 
     auto nextCursor = traverseOwnedNodes(
-        *context.backend, *accountID, lgrInfo.seq, marker, addToResponse);
+        *context.backend,
+        *accountID,
+        lgrInfo.seq,
+        marker,
+        limit,
+        addToResponse);
 
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
@@ -16,7 +16,7 @@ Result
 doAccountCurrencies(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     auto v = ledgerInfoFromRequest(context);
     if (auto status = std::get_if<Status>(&v))
@@ -37,30 +37,23 @@ doAccountCurrencies(Context const& context)
         return Status{Error::rpcINVALID_PARAMS, "malformedAccount"};
 
     std::set<std::string> send, receive;
-    auto const addToResponse = [&](ripple::SLE const& sle) {
-        if (sle.getType() == ripple::ltRIPPLE_STATE)
-        {
-            ripple::STAmount balance = sle.getFieldAmount(ripple::sfBalance);
-
-            auto lowLimit = sle.getFieldAmount(ripple::sfLowLimit);
-            auto highLimit = sle.getFieldAmount(ripple::sfHighLimit);
-            bool viewLowest = (lowLimit.getIssuer() == accountID);
-            auto lineLimit = viewLowest ? lowLimit : highLimit;
-            auto lineLimitPeer = !viewLowest ? lowLimit : highLimit;
-            if (!viewLowest)
-                balance.negate();
-
-            if (balance < lineLimit)
-                receive.insert(ripple::to_string(balance.getCurrency()));
-            if ((-balance) < lineLimitPeer)
-                send.insert(ripple::to_string(balance.getCurrency()));
-        }
-
-        return true;
-    };
-
-    traverseOwnedNodes(
-        *context.backend, *accountID, lgrInfo.seq, beast::zero, addToResponse);
+    auto const lines = trustLines(*context.backend, *accountID, lgrInfo.seq);
+    for (auto const& line : *lines)
+    {
+        ripple::STAmount balance = line.balance;
+
+        bool viewLowest = (line.lowLimit.getIssuer() == accountID);
+        auto const& lineLimit = viewLowest ? line.lowLimit : line.highLimit;
+        auto const& lineLimitPeer =
+            !viewLowest ? line.lowLimit : line.highLimit;
+        if (!viewLowest)
+            balance.negate();
+
+        if (balance < lineLimit)
+            receive.insert(ripple::to_string(balance.getCurrency()));
+        if ((-balance) < lineLimitPeer)
+            send.insert(ripple::to_string(balance.getCurrency()));
+    }
 
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
@@ -26,7 +26,7 @@ Result
 doAccountInfo(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     std::string strIdent;
     if (request.contains("account"))
@@ -64,7 +64,7 @@ doAccountInfo(Context const& context)
 
     auto start = std::chrono::system_clock::now();
     std::optional<std::vector<unsigned char>> dbResponse =
-        context.backend->fetchLedgerObject(key.key, lgrInfo.seq);
+        fetchLedgerObject(context, key.key, lgrInfo.seq);
     auto end = std::chrono::system_clock::now();
 
     auto time =
@@ -88,7 +88,7 @@ doAccountInfo(Context const& context)
     //     response["account_data"] = ripple::strHex(*dbResponse);
     // response["db_time"] = time;
 
-    response["account_data"] = toJson(sle);
+    response["account_data"] = toJson(sle, context.storage);
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
 
@@ -98,13 +98,13 @@ doAccountInfo(Context const& context)
     {
         // We put the SignerList in an array because of an anticipated
         // future when we support multiple signer lists on one account.
-        boost::json::array signerList;
+        boost::json::array signerList(context.storage);
         auto signersKey = ripple::keylet::signers(*accountID);
 
         // This code will need to be revisited if in the future we
         // support multiple SignerLists on one account.
         auto const signers =
-            context.backend->fetchLedgerObject(signersKey.key, lgrInfo.seq);
+            fetchLedgerObject(context, signersKey.key, lgrInfo.seq);
         if (signers)
         {
             ripple::STLedgerEntry sleSigners{
@@ -113,7 +113,7 @@ doAccountInfo(Context const& context)
             if (!signersKey.check(sleSigners))
                 return Status{Error::rpcDB_DESERIALIZATION};
 
-            signerList.push_back(toJson(sleSigners));
+            signerList.push_back(toJson(sleSigners, context.storage));
         }
 
         response["account_data"].as_object()["signer_lists"] =
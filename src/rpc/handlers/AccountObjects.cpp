@@ -29,7 +29,7 @@ Result
 doAccountObjects(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     auto v = ledgerInfoFromRequest(context);
     if (auto status = std::get_if<Status>(&v))
@@ -95,14 +95,19 @@ doAccountObjects(Context const& context)
                 return false;
             }
 
-            jsonObjects.push_back(toJson(sle));
+            jsonObjects.push_back(toJson(sle, context.storage));
         }
 
         return true;
     };
 
     auto nextCursor = traverseOwnedNodes(
-        *context.backend, *accountID, lgrInfo.seq, cursor, addToResponse);
+        *context.backend,
+        *accountID,
+        lgrInfo.seq,
+        cursor,
+        limit,
+        addToResponse);
 
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
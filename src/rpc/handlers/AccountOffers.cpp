@@ -66,7 +66,7 @@ Result
 doAccountOffers(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     auto v = ledgerInfoFromRequest(context);
     if (auto status = std::get_if<Status>(&v))
@@ -128,7 +128,12 @@ doAccountOffers(Context const& context)
     };
 
     auto nextCursor = traverseOwnedNodes(
-        *context.backend, *accountID, lgrInfo.seq, cursor, addToResponse);
+        *context.backend,
+        *accountID,
+        lgrInfo.seq,
+        cursor,
+        limit,
+        addToResponse);
 
     if (nextCursor)
         response["marker"] = ripple::strHex(*nextCursor);
@@ -1,5 +1,6 @@
 #include <backend/BackendInterface.h>
 #include <backend/Pg.h>
+#include <log/Trace.h>
 #include <rpc/RPCHelpers.h>
 
 namespace RPC {
@@ -10,7 +11,7 @@ Result
 doAccountTx(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     if (!request.contains("account"))
         return Status{Error::rpcINVALID_PARAMS, "missingAccount"};
@@ -164,15 +165,20 @@ doAccountTx(Context const& context)
         response["limit"] = limit;
     }
 
-    boost::json::array txns;
+    boost::json::array txns(context.storage);
     auto start = std::chrono::system_clock::now();
-    auto [blobs, retCursor] = context.backend->fetchAccountTransactions(
-        *accountID, limit, forward, cursor);
+    auto [blobs, retCursor] = [&]() {
+        Trace::Span span{"fetch_account_transactions"};
+        auto page = context.backend->fetchAccountTransactionHashes(
+            *accountID, limit, forward, cursor);
+        return Backend::AccountTransactions{
+            fetchTransactions(context, page.hashes), page.cursor};
+    }();
 
     auto end = std::chrono::system_clock::now();
-    BOOST_LOG_TRIVIAL(info) << __func__ << " db fetch took "
-                            << ((end - start).count() / 1000000000.0)
-                            << " num blobs = " << blobs.size();
+    CLIO_LOG_SAMPLED(info) << __func__ << " db fetch took "
+                           << ((end - start).count() / 1000000000.0)
+                           << " num blobs = " << blobs.size();
 
     response["account"] = ripple::to_string(*accountID);
 
@@ -197,13 +203,13 @@ doAccountTx(Context const& context)
             continue;
         }
 
-        boost::json::object obj;
+        boost::json::object obj(context.storage);
 
         if (!binary)
         {
-            auto [txn, meta] = toExpandedJson(txnPlusMeta);
-            obj["meta"] = meta;
-            obj["tx"] = txn;
+            auto [txn, meta] = toExpandedJson(txnPlusMeta, context.storage);
+            obj["meta"] = std::move(meta);
+            obj["tx"] = std::move(txn);
             obj["tx"].as_object()["ledger_index"] = txnPlusMeta.ledgerSequence;
             obj["tx"].as_object()["date"] = txnPlusMeta.date;
         }
@@ -217,7 +223,7 @@ doAccountTx(Context const& context)
 
         obj["validated"] = true;
 
-        txns.push_back(obj);
+        txns.push_back(std::move(obj));
         if (!minReturnedIndex || txnPlusMeta.ledgerSequence < *minReturnedIndex)
             minReturnedIndex = txnPlusMeta.ledgerSequence;
         if (!maxReturnedIndex || txnPlusMeta.ledgerSequence > *maxReturnedIndex)
@@ -242,11 +248,11 @@ doAccountTx(Context const& context)
             response["ledger_index_min"] = minIndex;
     }
 
-    response["transactions"] = txns;
+    response["transactions"] = std::move(txns);
 
     auto end2 = std::chrono::system_clock::now();
-    BOOST_LOG_TRIVIAL(info) << __func__ << " serialization took "
-                            << ((end2 - end).count() / 1000000000.0);
+    CLIO_LOG_SAMPLED(info) << __func__ << " serialization took "
+                           << ((end2 - end).count() / 1000000000.0);
 
     return response;
 }  // namespace RPC
@@ -11,6 +11,7 @@
 #include <backend/BackendInterface.h>
 #include <backend/DBHelpers.h>
 #include <backend/Pg.h>
+#include <log/Trace.h>
 
 namespace RPC {
 
@@ -81,24 +82,21 @@ doBookOffers(Context const& context)
             return Status{Error::rpcINVALID_PARAMS, "malformedCursor"};
     }
 
-    auto start = std::chrono::system_clock::now();
-    auto [offers, retCursor, warning] =
-        context.backend->fetchBookOffers(bookBase, lgrInfo.seq, limit, cursor);
-    auto end = std::chrono::system_clock::now();
-
-    BOOST_LOG_TRIVIAL(warning)
-        << "Time loading books: " << ((end - start).count() / 1000000000.0);
+    auto [offers, retCursor, warning] = [&]() {
+        Trace::Span span{"fetch_book_offers"};
+        span.attribute("limit", limit);
+        return fetchBookOffers(context, bookBase, lgrInfo.seq, limit);
+    }();
 
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
 
-    response["offers"] = postProcessOrderBook(
-        offers, book, takerID, *context.backend, lgrInfo.seq);
-
-    end = std::chrono::system_clock::now();
-
-    BOOST_LOG_TRIVIAL(warning) << "Time transforming to json: "
-                               << ((end - start).count() / 1000000000.0);
+    {
+        Trace::Span span{"post_process_order_book"};
+        span.attribute("offers", offers.size());
+        response["offers"] = postProcessOrderBook(
+            offers, book, takerID, *context.backend, lgrInfo.seq);
+    }
 
     if (retCursor)
         response["marker"] = ripple::strHex(*retCursor);
@@ -7,7 +7,7 @@ Result
 doGatewayBalances(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     if (!request.contains("account"))
         return Status{Error::rpcINVALID_PARAMS, "missingAccount"};
@@ -87,66 +87,59 @@ doGatewayBalances(Context const& context)
     }
 
     // Traverse the cold wallet's trust lines
-    auto const addToResponse = [&](ripple::SLE const& sle) {
-        if (sle.getType() == ripple::ltRIPPLE_STATE)
+    auto const lines = trustLines(*context.backend, *accountID, lgrInfo.seq);
+    for (auto const& line : *lines)
+    {
+        ripple::STAmount balance = line.balance;
+
+        auto const& lowLimit = line.lowLimit;
+        auto const& highLimit = line.highLimit;
+        auto lowID = lowLimit.getIssuer();
+        auto highID = highLimit.getIssuer();
+        bool viewLowest = (lowLimit.getIssuer() == accountID);
+        auto freeze = line.flags &
+            (viewLowest ? ripple::lsfLowFreeze : ripple::lsfHighFreeze);
+        if (!viewLowest)
+            balance.negate();
+
+        int balSign = balance.signum();
+        if (balSign == 0)
+            continue;
+
+        auto const& peer = !viewLowest ? lowID : highID;
+
+        // Here, a negative balance means the cold wallet owes (normal)
+        // A positive balance means the cold wallet has an asset
+        // (unusual)
+
+        if (hotWallets.count(peer) > 0)
         {
-            ripple::STAmount balance = sle.getFieldAmount(ripple::sfBalance);
-
-            auto lowLimit = sle.getFieldAmount(ripple::sfLowLimit);
-            auto highLimit = sle.getFieldAmount(ripple::sfHighLimit);
-            auto lowID = lowLimit.getIssuer();
-            auto highID = highLimit.getIssuer();
-            bool viewLowest = (lowLimit.getIssuer() == accountID);
-            auto lineLimit = viewLowest ? lowLimit : highLimit;
-            auto lineLimitPeer = !viewLowest ? lowLimit : highLimit;
-            auto flags = sle.getFieldU32(ripple::sfFlags);
-            auto freeze = flags &
-                (viewLowest ? ripple::lsfLowFreeze : ripple::lsfHighFreeze);
-            if (!viewLowest)
-                balance.negate();
-
-            int balSign = balance.signum();
-            if (balSign == 0)
-                return true;
-
-            auto const& peer = !viewLowest ? lowID : highID;
-
-            // Here, a negative balance means the cold wallet owes (normal)
-            // A positive balance means the cold wallet has an asset
-            // (unusual)
-
-            if (hotWallets.count(peer) > 0)
-            {
-                // This is a specified hot wallet
-                hotBalances[peer].push_back(balance);
-            }
-            else if (balSign > 0)
-            {
-                // This is a gateway asset
-                assets[peer].push_back(balance);
-            }
-            else if (freeze)
+            // This is a specified hot wallet
+            hotBalances[peer].push_back(balance);
+        }
+        else if (balSign > 0)
+        {
+            // This is a gateway asset
+            assets[peer].push_back(balance);
+        }
+        else if (freeze)
+        {
+            // An obligation the gateway has frozen
+            frozenBalances[peer].push_back(balance);
+        }
+        else
+        {
+            // normal negative balance, obligation to customer
+            auto& bal = sums[balance.getCurrency()];
+            if (bal == beast::zero)
             {
-                // An obligation the gateway has frozen
-                frozenBalances[peer].push_back(balance);
+                // This is needed to set the currency code correctly
+                bal = -balance;
             }
             else
-            {
-                // normal negative balance, obligation to customer
-                auto& bal = sums[balance.getCurrency()];
-                if (bal == beast::zero)
-                {
-                    // This is needed to set the currency code correctly
-                    bal = -balance;
-                }
-                else
-                    bal -= balance;
-            }
+                bal -= balance;
         }
-        return true;
-    };
-    traverseOwnedNodes(
-        *context.backend, *accountID, lgrInfo.seq, beast::zero, addToResponse);
+    }
 
     if (!sums.empty())
     {
@@ -1,8 +1,95 @@
 #include <backend/BackendInterface.h>
 #include <rpc/RPCHelpers.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
 
 namespace RPC {
 
+namespace {
+// The expanded transactions of the most recently requested ledgers. A
+// ledger never changes, and rendering a busy one takes a while
+class ExpandedLedgers
+{
+    using Key = std::pair<std::uint32_t, bool>;
+    using Transactions = std::shared_ptr<boost::json::array const>;
+
+    static constexpr std::size_t maxLedgers = 8;
+
+    std::mutex mtx_;
+    // most recently used first
+    std::deque<std::pair<Key, Transactions>> ledgers_;
+
+public:
+    Transactions
+    get(Key const& key)
+    {
+        std::lock_guard lck{mtx_};
+        auto it = std::find_if(
+            ledgers_.begin(), ledgers_.end(), [&key](auto const& ledger) {
+                return ledger.first == key;
+            });
+        if (it == ledgers_.end())
+            return {};
+        auto transactions = it->second;
+        std::rotate(ledgers_.begin(), it, it + 1);
+        return transactions;
+    }
+
+    void
+    put(Key const& key, Transactions transactions)
+    {
+        std::lock_guard lck{mtx_};
+        for (auto const& ledger : ledgers_)
+        {
+            if (ledger.first == key)
+                return;
+        }
+        ledgers_.emplace_front(key, std::move(transactions));
+        if (ledgers_.size() > maxLedgers)
+            ledgers_.pop_back();
+    }
+};
+
+ExpandedLedgers expandedLedgers;
+
+// every transaction of ledger sequence with its metadata, in binary or JSON
+std::shared_ptr<boost::json::array const>
+expandedTransactions(
+    Context const& context,
+    std::uint32_t sequence,
+    bool binary)
+{
+    if (auto cached = expandedLedgers.get({sequence, binary}))
+        return cached;
+
+    auto txns = context.backend->fetchAllTransactionsInLedger(sequence);
+    // deserializing and rendering dominate, so they are split across threads
+    auto jsonTxs = std::make_shared<boost::json::array const>(
+        renderArray(txns.size(), [&txns, binary](size_t i) {
+            auto const& obj = txns[i];
+            boost::json::object entry;
+            if (!binary)
+            {
+                auto [txn, meta] = toExpandedJson(obj);
+                entry = txn;
+                entry["metaData"] = meta;
+            }
+            else
+            {
+                entry["tx_blob"] = ripple::strHex(obj.transaction);
+                entry["meta"] = ripple::strHex(obj.metadata);
+            }
+            // entry["ledger_index"] = obj.ledgerSequence;
+            return boost::json::value(std::move(entry));
+        }));
+    expandedLedgers.put({sequence, binary}, jsonTxs);
+    return jsonTxs;
+}
+}  // namespace
+
 Result
 doLedger(Context const& context)
 {
@@ -76,29 +163,7 @@ doLedger(Context const& context)
         boost::json::array& jsonTxs = header.at("transactions").as_array();
         if (expand)
         {
-            auto txns =
-                context.backend->fetchAllTransactionsInLedger(lgrInfo.seq);
-
-            std::transform(
-                std::move_iterator(txns.begin()),
-                std::move_iterator(txns.end()),
-                std::back_inserter(jsonTxs),
-                [binary](auto obj) {
-                    boost::json::object entry;
-                    if (!binary)
-                    {
-                        auto [txn, meta] = toExpandedJson(obj);
-                        entry = txn;
-                        entry["metaData"] = meta;
-                    }
-                    else
-                    {
-                        entry["tx_blob"] = ripple::strHex(obj.transaction);
-                        entry["meta"] = ripple::strHex(obj.metadata);
-                    }
-                    // entry["ledger_index"] = obj.ledgerSequence;
-                    return entry;
-                });
+            jsonTxs = *expandedTransactions(context, lgrInfo.seq, binary);
         }
         else
         {
@@ -67,7 +67,7 @@ doLedgerData(Context const& context)
 
     Backend::LedgerPage page;
     auto start = std::chrono::system_clock::now();
-    page = context.backend->fetchLedgerPage(cursor, lgrInfo.seq, limit);
+    page = fetchLedgerPage(context, cursor, lgrInfo.seq, limit);
 
     auto end = std::chrono::system_clock::now();
 
@@ -111,7 +111,6 @@ doLedgerData(Context const& context)
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["ledger_index"] = lgrInfo.seq;
 
-    boost::json::array objects;
     std::vector<Backend::LedgerObject>& results = page.objects;
     std::optional<ripple::uint256> const& returnedCursor = page.cursor;
 
@@ -124,21 +123,27 @@ doLedgerData(Context const& context)
 
     BOOST_LOG_TRIVIAL(debug)
         << __func__ << " number of results = " << results.size();
-    for (auto const& [key, object] : results)
-    {
-        ripple::STLedgerEntry sle{
-            ripple::SerialIter{object.data(), object.size()}, key};
+    start = std::chrono::system_clock::now();
+    response["state"] = renderArray(results.size(), [&](size_t i) {
+        auto const& [key, object] = results[i];
+        // the blob is the serialized object, so there is nothing to parse
         if (binary)
         {
             boost::json::object entry;
-            entry["data"] = ripple::serializeHex(sle);
-            entry["index"] = ripple::to_string(sle.key());
-            objects.push_back(entry);
+            entry["data"] = ripple::strHex(object);
+            entry["index"] = ripple::strHex(key);
+            return boost::json::value(std::move(entry));
         }
-        else
-            objects.push_back(toJson(sle));
-    }
-    response["state"] = objects;
+        ripple::STLedgerEntry sle{
+            ripple::SerialIter{object.data(), object.size()}, key};
+        return boost::json::value(toJson(sle));
+    });
+    end = std::chrono::system_clock::now();
+    BOOST_LOG_TRIVIAL(debug)
+        << __func__ << " rendered in "
+        << std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+               .count()
+        << " microseconds";
 
     if (cursor && page.warning)
     {
@@ -18,7 +18,7 @@ Result
 doLedgerEntry(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     bool binary =
         request.contains("binary") ? request.at("binary").as_bool() : false;
@@ -363,7 +363,7 @@ doLedgerEntry(Context const& context)
     {
         ripple::STLedgerEntry sle{
             ripple::SerialIter{dbResponse->data(), dbResponse->size()}, key};
-        response["node"] = toJson(sle);
+        response["node"] = toJson(sle, context.storage);
     }
 
     return response;
@@ -7,7 +7,7 @@ namespace RPC {
 Result
 doLedgerRange(Context const& context)
 {
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     auto range = context.backend->fetchLedgerRange();
     if (!range)
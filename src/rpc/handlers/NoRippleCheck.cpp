@@ -85,76 +85,57 @@ doNoRippleCheck(Context const& context)
         }
     }
 
-    traverseOwnedNodes(
-        *context.backend,
-        *accountID,
-        lgrInfo.seq,
-        {},
-        [roleGateway,
-         includeTxs,
-         &fees,
-         &transactions,
-         &accountSeq,
-         &limit,
-         &accountID,
-         &problems](auto const& ownedItem) {
-            if (ownedItem.getType() == ripple::ltRIPPLE_STATE)
+    auto const lines = trustLines(*context.backend, *accountID, lgrInfo.seq);
+    for (auto const& line : *lines)
+    {
+        bool const bLow = accountID == line.lowLimit.getIssuer();
+
+        bool const bNoRipple = line.flags &
+            (bLow ? ripple::lsfLowNoRipple : ripple::lsfHighNoRipple);
+
+        std::string problem;
+        bool needFix = false;
+        if (bNoRipple & roleGateway)
+        {
+            problem = "You should clear the no ripple flag on your ";
+            needFix = true;
+        }
+        else if (!bNoRipple & !roleGateway)
+        {
+            problem =
+                "You should probably set the no ripple flag on "
+                "your ";
+            needFix = true;
+        }
+        if (needFix)
+        {
+            ripple::STAmount const& peerLimit =
+                bLow ? line.highLimit : line.lowLimit;
+            ripple::AccountID peer = peerLimit.getIssuer();
+            problem += to_string(peerLimit.getCurrency());
+            problem += " line to ";
+            problem += to_string(peerLimit.getIssuer());
+            problems.emplace_back(problem);
+            if (includeTxs)
             {
-                bool const bLow = accountID ==
-                    ownedItem.getFieldAmount(ripple::sfLowLimit).getIssuer();
-
-                bool const bNoRipple = ownedItem.getFieldU32(ripple::sfFlags) &
-                    (bLow ? ripple::lsfLowNoRipple : ripple::lsfHighNoRipple);
-
-                std::string problem;
-                bool needFix = false;
-                if (bNoRipple & roleGateway)
-                {
-                    problem = "You should clear the no ripple flag on your ";
-                    needFix = true;
-                }
-                else if (!bNoRipple & !roleGateway)
-                {
-                    problem =
-                        "You should probably set the no ripple flag on "
-                        "your ";
-                    needFix = true;
-                }
-                if (needFix)
-                {
-                    ripple::AccountID peer =
-                        ownedItem
-                            .getFieldAmount(
-                                bLow ? ripple::sfHighLimit : ripple::sfLowLimit)
-                            .getIssuer();
-                    ripple::STAmount peerLimit = ownedItem.getFieldAmount(
-                        bLow ? ripple::sfHighLimit : ripple::sfLowLimit);
-                    problem += to_string(peerLimit.getCurrency());
-                    problem += " line to ";
-                    problem += to_string(peerLimit.getIssuer());
-                    problems.emplace_back(problem);
-                    if (includeTxs)
-                    {
-                        ripple::STAmount limitAmount(ownedItem.getFieldAmount(
-                            bLow ? ripple::sfLowLimit : ripple::sfHighLimit));
-                        limitAmount.setIssuer(peer);
-                        auto tx = getBaseTx(*accountID, accountSeq++, *fees);
-                        tx["TransactionType"] = "TrustSet";
-                        tx["LimitAmount"] = RPC::toBoostJson(
-                            limitAmount.getJson(ripple::JsonOptions::none));
-                        tx["Flags"] = bNoRipple ? ripple::tfClearNoRipple
-                                                : ripple::tfSetNoRipple;
-                        transactions.push_back(tx);
-                    }
-
-                    if (limit-- == 0)
-                        return false;
-                }
+                ripple::STAmount limitAmount(
+                    bLow ? line.lowLimit : line.highLimit);
+                limitAmount.setIssuer(peer);
+                auto tx = getBaseTx(*accountID, accountSeq++, *fees);
+                tx["TransactionType"] = "TrustSet";
+                tx["LimitAmount"] = RPC::toBoostJson(
+                    limitAmount.getJson(ripple::JsonOptions::none));
+                tx["Flags"] = bNoRipple ? ripple::tfClearNoRipple
+                                        : ripple::tfSetNoRipple;
+                transactions.push_back(tx);
             }
-            return true;
-        });
 
-    boost::json::object response;
+            if (limit-- == 0)
+                break;
+        }
+    }
+
+    boost::json::object response(context.storage);
     response["ledger_index"] = lgrInfo.seq;
     response["ledger_hash"] = ripple::strHex(lgrInfo.hash);
     response["problems"] = std::move(problems);
@@ -1,7 +1,11 @@
 
 #include <backend/BackendInterface.h>
 #include <etl/ETLSource.h>
+#include <log/RequestLog.h>
+#include <log/Trace.h>
 #include <rpc/RPCHelpers.h>
+#include <rpc/ResponseCache.h>
+#include <subscriptions/SubscriptionManager.h>
 
 namespace RPC {
 
@@ -28,6 +32,35 @@ doServerInfo(Context const& context)
 
         info["counters"] = boost::json::object{};
         info["counters"].as_object()["rpc"] = context.counters.report();
+        info["counters"].as_object()["cache"] =
+            context.backend->cache().report();
+        info["counters"].as_object()["transactions"] =
+            context.backend->transactionCache().report();
+        info["counters"].as_object()["ledger_headers"] =
+            context.backend->headerCache().report();
+        info["counters"].as_object()["coalesced_reads"] =
+            context.backend->coalescedReads();
+        info["counters"].as_object()["compression"] =
+            context.backend->codec().report();
+        if (context.backend->partialCache().enabled())
+            info["counters"].as_object()["partial_cache"] =
+                context.backend->partialCache().report();
+        if (RPC::responseCache().enabled())
+            info["counters"].as_object()["responses"] =
+                RPC::responseCache().report();
+        if (Log::requestLog().enabled())
+            info["counters"].as_object()["request_log"] =
+                Log::requestLog().report();
+        if (Trace::exporter().enabled())
+            info["counters"].as_object()["tracing"] =
+                Trace::exporter().report();
+        if (auto progress = context.balancer->loadProgress())
+            info["counters"].as_object()["cache_load"] = std::move(*progress);
+        if (auto stats = context.backend->stats(); !stats.empty())
+            info["counters"].as_object()["backend"] = std::move(stats);
+        if (context.subscriptions)
+            info["counters"].as_object()["subscriptions"] =
+                context.subscriptions->report();
     }
 
     auto serverInfoRippled =
@@ -37,7 +37,8 @@ boost::json::object
 subscribeToStreams(
     boost::json::object const& request,
     std::shared_ptr<WsBase> session,
-    SubscriptionManager& manager)
+    SubscriptionManager& manager,
+    bool binary)
 {
     boost::json::array const& streams = request.at("streams").as_array();
 
@@ -49,7 +50,7 @@ subscribeToStreams(
         if (s == "ledger")
             response = manager.subLedger(session);
         else if (s == "transactions")
-            manager.subTransactions(session);
+            manager.subTransactions(session, binary);
         else if (s == "transactions_proposed")
             manager.subProposedTransactions(session);
         else if (s == "validations")
@@ -111,7 +112,8 @@ void
 subscribeToAccounts(
     boost::json::object const& request,
     std::shared_ptr<WsBase> session,
-    SubscriptionManager& manager)
+    SubscriptionManager& manager,
+    bool binary)
 {
     boost::json::array const& accounts = request.at("accounts").as_array();
 
@@ -127,7 +129,7 @@ subscribeToAccounts(
             continue;
         }
 
-        manager.subAccount(*accountID, session);
+        manager.subAccount(*accountID, session, binary);
     }
 }
 
@@ -283,6 +285,16 @@ doSubscribe(Context const& context)
 {
     auto request = context.params;
 
+    // transactions and accounts are streamed as serialized blobs
+    bool binary = false;
+    if (request.contains("binary"))
+    {
+        if (!request.at("binary").is_bool())
+            return Status{Error::rpcINVALID_PARAMS, "binaryFlagNotBool"};
+
+        binary = request.at("binary").as_bool();
+    }
+
     if (request.contains("streams"))
     {
         if (!request.at("streams").is_array())
@@ -335,10 +347,11 @@ doSubscribe(Context const& context)
     boost::json::object response;
     if (request.contains("streams"))
         response = subscribeToStreams(
-            request, context.session, *context.subscriptions);
+            request, context.session, *context.subscriptions, binary);
 
     if (request.contains("accounts"))
-        subscribeToAccounts(request, context.session, *context.subscriptions);
+        subscribeToAccounts(
+            request, context.session, *context.subscriptions, binary);
 
     if (request.contains("accounts_proposed"))
         subscribeToAccountsProposed(
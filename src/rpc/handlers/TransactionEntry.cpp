@@ -5,7 +5,7 @@ namespace RPC {
 Result
 doTransactionEntry(Context const& context)
 {
-    boost::json::object response;
+    boost::json::object response(context.storage);
     auto v = ledgerInfoFromRequest(context);
     if (auto status = std::get_if<Status>(&v))
         return *status;
@@ -32,7 +32,7 @@ doTransactionEntry(Context const& context)
             "transactionNotFound",
             "Transaction not found."};
 
-    auto [txn, meta] = toExpandedJson(*dbResponse);
+    auto [txn, meta] = toExpandedJson(*dbResponse, context.storage);
     response["tx_json"] = std::move(txn);
     response["metadata"] = std::move(meta);
     response["ledger_index"] = lgrInfo.seq;
@@ -12,7 +12,7 @@ Result
 doTx(Context const& context)
 {
     auto request = context.params;
-    boost::json::object response = {};
+    boost::json::object response(context.storage);
 
     if (!request.contains("transaction"))
         return Status{Error::rpcINVALID_PARAMS, "specifyTransaction"};
@@ -43,9 +43,9 @@ doTx(Context const& context)
 
     if (!binary)
     {
-        auto [txn, meta] = toExpandedJson(*dbResponse);
-        response = txn;
-        response["meta"] = meta;
+        auto [txn, meta] = toExpandedJson(*dbResponse, context.storage);
+        response = std::move(txn);
+        response["meta"] = std::move(meta);
     }
     else
     {
@@ -1,96 +1,226 @@
+#include <etl/ETLHelpers.h>
 #include <rpc/RPCHelpers.h>
 #include <subscriptions/SubscriptionManager.h>
 #include <webserver/WsBase.h>
 
+// every subscriber is sent the same message, which is only ever referenced.
+// returns the number of dead subscribers removed
 template <class T>
-inline void
+inline std::size_t
 sendToSubscribers(
-    std::string const& message,
-    T& subscribers,
-    boost::asio::io_context::strand& strand)
+    std::shared_ptr<std::string const> const& message,
+    std::shared_ptr<StreamQueue> const& queue,
+    T& subscribers)
 {
-    boost::asio::post(strand, [&subscribers, message]() {
-        for (auto it = subscribers.begin(); it != subscribers.end();)
+    std::size_t removed = 0;
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        auto& session = *it;
+        if (session->dead())
         {
-            auto& session = *it;
-            if (session->dead())
-            {
-                it = subscribers.erase(it);
-            }
-            else
-            {
-                session->send(message);
-                ++it;
-            }
+            it = subscribers.erase(it);
+            ++removed;
         }
-    });
+        else
+        {
+            session->send(message, queue);
+            ++it;
+        }
+    }
+    return removed;
 }
 
-template <class T>
-inline void
-addSession(
-    std::shared_ptr<WsBase> session,
-    T& subscribers,
-    boost::asio::io_context::strand& strand)
-{
-    boost::asio::post(strand, [&subscribers, s = std::move(session)]() {
-        subscribers.emplace(s);
-    });
+boost::json::object
+StreamQueue::report() const
+{
+    boost::json::object report;
+    report["queued_messages"] = messages.load();
+    report["queued_bytes"] = bytes.load();
+    report["dropped"] = dropped.load();
+    report["disconnects"] = disconnects.load();
+    return report;
 }
 
+// a batch is sent to one subscriber after the other, in order
 template <class T>
-inline void
-removeSession(
-    std::shared_ptr<WsBase> session,
-    T& subscribers,
-    boost::asio::io_context::strand& strand)
-{
-    boost::asio::post(strand, [&subscribers, s = std::move(session)]() {
-        subscribers.erase(s);
-    });
+inline std::size_t
+sendToSubscribers(
+    MessageBatch const& messages,
+    std::shared_ptr<StreamQueue> const& queue,
+    T& subscribers)
+{
+    std::size_t removed = 0;
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        auto& session = *it;
+        if (session->dead())
+        {
+            it = subscribers.erase(it);
+            ++removed;
+        }
+        else
+        {
+            for (auto const& message : messages)
+                session->send(message, queue);
+            ++it;
+        }
+    }
+    return removed;
+}
+
+Subscription::Subscription(
+    boost::asio::io_context& ioc,
+    std::size_t numShards,
+    std::shared_ptr<StreamQueue> queue)
+    : queue_(std::move(queue))
+{
+    numShards = std::max<std::size_t>(numShards, 1);
+    shards_.reserve(numShards);
+    for (std::size_t i = 0; i < numShards; ++i)
+        shards_.push_back(std::make_unique<Shard>(ioc));
+}
+
+Subscription::Shard&
+Subscription::shard(std::shared_ptr<WsBase> const& session)
+{
+    return *shards_[std::hash<WsBase*>{}(session.get()) % shards_.size()];
 }
 
 void
 Subscription::subscribe(std::shared_ptr<WsBase> const& session)
 {
-    addSession(session, subscribers_, strand_);
+    auto& shard = this->shard(session);
+    // counted right away, so that what is published next is not skipped
+    ++numSubscribers_;
+    boost::asio::post(shard.strand, [this, &shard, session]() {
+        if (!shard.subscribers.emplace(session).second)
+            --numSubscribers_;
+    });
 }
 
 void
 Subscription::unsubscribe(std::shared_ptr<WsBase> const& session)
 {
-    removeSession(session, subscribers_, strand_);
+    auto& shard = this->shard(session);
+    boost::asio::post(shard.strand, [this, &shard, session]() {
+        numSubscribers_ -= shard.subscribers.erase(session);
+    });
+}
+
+void
+Subscription::publish(std::shared_ptr<std::string const> const& message)
+{
+    for (auto& shard : shards_)
+    {
+        boost::asio::post(
+            shard->strand, [this, &shard = *shard, message]() {
+                numSubscribers_ -=
+                    sendToSubscribers(message, queue_, shard.subscribers);
+            });
+    }
 }
 
 void
-Subscription::publish(std::string const& message)
+Subscription::publish(std::shared_ptr<MessageBatch const> const& messages)
 {
-    sendToSubscribers(message, subscribers_, strand_);
+    if (messages->empty())
+        return;
+    for (auto& shard : shards_)
+    {
+        boost::asio::post(
+            shard->strand, [this, &shard = *shard, messages]() {
+                numSubscribers_ -=
+                    sendToSubscribers(*messages, queue_, shard.subscribers);
+            });
+    }
 }
 
+// the map of a shard is only accessed on the strand of the shard
 template <class Key>
 void
 SubscriptionMap<Key>::subscribe(
     std::shared_ptr<WsBase> const& session,
-    Key const& account)
+    Key const& key)
 {
-    addSession(session, subscribers_[account], strand_);
+    auto& shard = this->shard(key);
+    // counted right away, so that what is published next is not skipped
+    ++count(key);
+    ++numSubscribers_;
+    boost::asio::post(shard.strand, [this, &shard, session, key]() {
+        if (!shard.byKey[key].emplace(session).second)
+            removed(key, 1);
+    });
 }
 
 template <class Key>
 void
 SubscriptionMap<Key>::unsubscribe(
     std::shared_ptr<WsBase> const& session,
-    Key const& account)
+    Key const& key)
+{
+    auto& shard = this->shard(key);
+    boost::asio::post(shard.strand, [this, &shard, session, key]() {
+        auto it = shard.byKey.find(key);
+        if (it == shard.byKey.end())
+            return;
+        removed(key, it->second.erase(session));
+        if (it->second.empty())
+            shard.byKey.erase(it);
+    });
+}
+
+template <class Key>
+void
+SubscriptionMap<Key>::publish(
+    std::shared_ptr<std::string const> const& message,
+    Key const& key)
 {
-    removeSession(session, subscribers_[account], strand_);
+    if (!hasSubscribers(key))
+        return;
+    auto& shard = this->shard(key);
+    boost::asio::post(shard.strand, [this, &shard, message, key]() {
+        auto it = shard.byKey.find(key);
+        if (it == shard.byKey.end())
+            return;
+        removed(key, sendToSubscribers(message, queue_, it->second));
+        if (it->second.empty())
+            shard.byKey.erase(it);
+    });
 }
 
 template <class Key>
 void
-SubscriptionMap<Key>::publish(std::string const& message, Key const& account)
+SubscriptionMap<Key>::publish(std::unordered_map<Key, MessageBatch>&& byKey)
 {
-    sendToSubscribers(message, subscribers_[account], strand_);
+    // one post per shard, for every key of the shard
+    using Batches = std::vector<std::pair<Key, MessageBatch>>;
+    std::vector<Batches> byShard(shards_.size());
+    for (auto& [key, messages] : byKey)
+    {
+        if (hasSubscribers(key))
+            byShard[std::hash<Key>{}(key) % shards_.size()].emplace_back(
+                key, std::move(messages));
+    }
+
+    for (std::size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (byShard[i].empty())
+            continue;
+        auto& shard = *shards_[i];
+        auto batches = std::make_shared<Batches>(std::move(byShard[i]));
+        boost::asio::post(shard.strand, [this, &shard, batches]() {
+            for (auto const& [key, messages] : *batches)
+            {
+                auto it = shard.byKey.find(key);
+                if (it == shard.byKey.end())
+                    continue;
+                removed(
+                    key, sendToSubscribers(messages, queue_, it->second));
+                if (it->second.empty())
+                    shard.byKey.erase(it);
+            }
+        });
+    }
 }
 
 boost::json::object
@@ -147,23 +277,33 @@ SubscriptionManager::unsubLedger(std::shared_ptr<WsBase>& session)
 }
 
 void
-SubscriptionManager::subTransactions(std::shared_ptr<WsBase>& session)
+SubscriptionManager::subTransactions(
+    std::shared_ptr<WsBase>& session,
+    bool binary)
 {
-    txSubscribers_.subscribe(session);
+    if (binary)
+        txBinarySubscribers_.subscribe(session);
+    else
+        txSubscribers_.subscribe(session);
 }
 
 void
 SubscriptionManager::unsubTransactions(std::shared_ptr<WsBase>& session)
 {
     txSubscribers_.unsubscribe(session);
+    txBinarySubscribers_.unsubscribe(session);
 }
 
 void
 SubscriptionManager::subAccount(
     ripple::AccountID const& account,
-    std::shared_ptr<WsBase>& session)
+    std::shared_ptr<WsBase>& session,
+    bool binary)
 {
-    accountSubscribers_.subscribe(session, account);
+    if (binary)
+        accountBinarySubscribers_.subscribe(session, account);
+    else
+        accountSubscribers_.subscribe(session, account);
 }
 
 void
@@ -172,6 +312,7 @@ SubscriptionManager::unsubAccount(
     std::shared_ptr<WsBase>& session)
 {
     accountSubscribers_.unsubscribe(session, account);
+    accountBinarySubscribers_.unsubscribe(session, account);
 }
 
 void
@@ -197,56 +338,45 @@ SubscriptionManager::pubLedger(
     std::string const& ledgerRange,
     std::uint32_t txnCount)
 {
-    ledgerSubscribers_.publish(boost::json::serialize(
-        getLedgerPubMessage(lgrInfo, fees, ledgerRange, txnCount)));
+    if (!ledgerSubscribers_.hasSubscribers())
+        return;
+    ledgerSubscribers_.publish(
+        std::make_shared<std::string const>(boost::json::serialize(
+            getLedgerPubMessage(lgrInfo, fees, ledgerRange, txnCount))));
 }
 
-void
-SubscriptionManager::pubTransaction(
+SubscriptionManager::PreparedTransaction
+SubscriptionManager::prepareTransaction(
     Backend::TransactionAndMetadata const& blobs,
-    ripple::LedgerInfo const& lgrInfo)
+    ripple::LedgerInfo const& lgrInfo) const
 {
     auto [tx, meta] = RPC::deserializeTxPlusMeta(blobs, lgrInfo.seq);
-    boost::json::object pubObj;
-    pubObj["transaction"] = RPC::toJson(*tx);
-    pubObj["meta"] = RPC::toJson(*meta);
-    RPC::insertDeliveredAmount(pubObj["meta"].as_object(), tx, meta);
-    pubObj["type"] = "transaction";
-    pubObj["validated"] = true;
-    pubObj["status"] = "closed";
+    PreparedTransaction prepared;
 
-    pubObj["ledger_index"] = lgrInfo.seq;
-    pubObj["ledger_hash"] = ripple::strHex(lgrInfo.hash);
-    pubObj["transaction"].as_object()["date"] =
-        lgrInfo.closeTime.time_since_epoch().count();
-
-    pubObj["engine_result_code"] = meta->getResult();
-    std::string token;
-    std::string human;
-    ripple::transResultInfo(meta->getResultTER(), token, human);
-    pubObj["engine_result"] = token;
-    pubObj["engine_result_message"] = human;
-    if (tx->getTxnType() == ripple::ttOFFER_CREATE)
+    auto journal = ripple::debugLog();
+    for (auto const& account : meta->getAffectedAccounts(journal))
     {
-        auto account = tx->getAccountID(ripple::sfAccount);
-        auto amount = tx->getFieldAmount(ripple::sfTakerGets);
-        if (account != amount.issue().account)
-        {
-            auto ownerFunds =
-                RPC::accountFunds(*backend_, lgrInfo.seq, amount, account);
-            pubObj["transaction"].as_object()["owner_funds"] =
-                ownerFunds.getText();
-        }
+        if (accountSubscribers_.hasSubscribers(account))
+            prepared.accounts.push_back(account);
+        if (accountBinarySubscribers_.hasSubscribers(account))
+            prepared.binaryAccounts.push_back(account);
     }
 
-    std::string pubMsg{boost::json::serialize(pubObj)};
-    txSubscribers_.publish(pubMsg);
-
-    auto journal = ripple::debugLog();
-    auto accounts = meta->getAffectedAccounts(journal);
-
-    for (auto const& account : accounts)
-        accountSubscribers_.publish(pubMsg, account);
+    if (txBinarySubscribers_.hasSubscribers() ||
+        !prepared.binaryAccounts.empty())
+    {
+        boost::json::object pubObj;
+        pubObj["type"] = "transaction";
+        pubObj["tx_blob"] = ripple::strHex(blobs.transaction);
+        pubObj["meta"] = ripple::strHex(blobs.metadata);
+        pubObj["validated"] = true;
+        pubObj["status"] = "closed";
+        pubObj["ledger_index"] = lgrInfo.seq;
+        pubObj["ledger_hash"] = ripple::strHex(lgrInfo.hash);
+        pubObj["date"] = lgrInfo.closeTime.time_since_epoch().count();
+        prepared.binaryMessage = std::make_shared<std::string const>(
+            boost::json::serialize(pubObj));
+    }
 
     std::unordered_set<ripple::Book> alreadySent;
 
@@ -279,43 +409,171 @@ SubscriptionManager::pubTransaction(
                     ripple::Book book{
                         data->getFieldAmount(ripple::sfTakerGets).issue(),
                         data->getFieldAmount(ripple::sfTakerPays).issue()};
-                    if (alreadySent.find(book) == alreadySent.end())
-                    {
-                        bookSubscribers_.publish(pubMsg, book);
-                        alreadySent.insert(book);
-                    }
+                    if (alreadySent.insert(book).second &&
+                        bookSubscribers_.hasSubscribers(book))
+                        prepared.books.push_back(book);
                 }
             }
         }
     }
+
+    // the message is only built if someone is sent it
+    if (!txSubscribers_.hasSubscribers() && prepared.accounts.empty() &&
+        prepared.books.empty())
+        return prepared;
+
+    boost::json::object pubObj;
+    pubObj["transaction"] = RPC::toJson(*tx);
+    pubObj["meta"] = RPC::toJson(*meta);
+    RPC::insertDeliveredAmount(pubObj["meta"].as_object(), tx, meta);
+    pubObj["type"] = "transaction";
+    pubObj["validated"] = true;
+    pubObj["status"] = "closed";
+
+    pubObj["ledger_index"] = lgrInfo.seq;
+    pubObj["ledger_hash"] = ripple::strHex(lgrInfo.hash);
+    pubObj["transaction"].as_object()["date"] =
+        lgrInfo.closeTime.time_since_epoch().count();
+
+    pubObj["engine_result_code"] = meta->getResult();
+    std::string token;
+    std::string human;
+    ripple::transResultInfo(meta->getResultTER(), token, human);
+    pubObj["engine_result"] = token;
+    pubObj["engine_result_message"] = human;
+    if (tx->getTxnType() == ripple::ttOFFER_CREATE)
+    {
+        auto account = tx->getAccountID(ripple::sfAccount);
+        auto amount = tx->getFieldAmount(ripple::sfTakerGets);
+        if (account != amount.issue().account)
+        {
+            auto ownerFunds =
+                RPC::accountFunds(*backend_, lgrInfo.seq, amount, account);
+            pubObj["transaction"].as_object()["owner_funds"] =
+                ownerFunds.getText();
+        }
+    }
+
+    prepared.message =
+        std::make_shared<std::string const>(boost::json::serialize(pubObj));
+    return prepared;
+}
+
+void
+SubscriptionManager::pubTransactions(
+    std::vector<Backend::TransactionAndMetadata> const& transactions,
+    ripple::LedgerInfo const& lgrInfo,
+    boost::asio::thread_pool& pool,
+    std::size_t maxChunks)
+{
+    if (!txSubscribers_.hasSubscribers() &&
+        !txBinarySubscribers_.hasSubscribers() &&
+        !accountSubscribers_.hasSubscribers() &&
+        !accountBinarySubscribers_.hasSubscribers() &&
+        !bookSubscribers_.hasSubscribers())
+        return;
+
+    // building the message of a transaction takes tens of microseconds, so
+    // smaller chunks are not worth the handoff
+    constexpr std::size_t minChunk = 16;
+    std::vector<PreparedTransaction> prepared(transactions.size());
+    ParallelFor work{
+        pool,
+        transactions.size(),
+        maxChunks,
+        minChunk,
+        [this, &prepared, &transactions, &lgrInfo](std::size_t i) {
+            prepared[i] = prepareTransaction(transactions[i], lgrInfo);
+        }};
+    work.wait();
+
+    // messages of every stream and key stay in the order of the ledger
+    auto messages = std::make_shared<MessageBatch>();
+    auto binaryMessages = std::make_shared<MessageBatch>();
+    std::unordered_map<ripple::AccountID, MessageBatch> byAccount;
+    std::unordered_map<ripple::AccountID, MessageBatch> byAccountBinary;
+    std::unordered_map<ripple::Book, MessageBatch> byBook;
+    for (auto const& tx : prepared)
+    {
+        if (tx.binaryMessage)
+        {
+            binaryMessages->push_back(tx.binaryMessage);
+            for (auto const& account : tx.binaryAccounts)
+                byAccountBinary[account].push_back(tx.binaryMessage);
+        }
+        if (!tx.message)
+            continue;
+        messages->push_back(tx.message);
+        for (auto const& account : tx.accounts)
+            byAccount[account].push_back(tx.message);
+        for (auto const& book : tx.books)
+            byBook[book].push_back(tx.message);
+    }
+
+    if (txSubscribers_.hasSubscribers())
+        txSubscribers_.publish(std::move(messages));
+    if (txBinarySubscribers_.hasSubscribers())
+        txBinarySubscribers_.publish(std::move(binaryMessages));
+    accountSubscribers_.publish(std::move(byAccount));
+    accountBinarySubscribers_.publish(std::move(byAccountBinary));
+    bookSubscribers_.publish(std::move(byBook));
 }
 
 void
 SubscriptionManager::forwardProposedTransaction(
-    boost::json::object const& response)
+    std::shared_ptr<std::string const> const& message,
+    std::string_view transaction)
 {
-    std::string pubMsg{boost::json::serialize(response)};
-    txProposedSubscribers_.publish(pubMsg);
+    if (txProposedSubscribers_.hasSubscribers())
+        txProposedSubscribers_.publish(message);
 
-    auto transaction = response.at("transaction").as_object();
-    auto accounts = RPC::getAccountsFromTransaction(transaction);
+    if (!accountProposedSubscribers_.hasSubscribers())
+        return;
+    // only the transaction is parsed, and only for account subscribers
+    auto const parsed = boost::json::parse(
+        boost::json::string_view{transaction.data(), transaction.size()});
+    auto accounts = RPC::getAccountsFromTransaction(parsed.as_object());
 
     for (ripple::AccountID const& account : accounts)
-        accountProposedSubscribers_.publish(pubMsg, account);
+    {
+        if (accountProposedSubscribers_.hasSubscribers(account))
+            accountProposedSubscribers_.publish(message, account);
+    }
 }
 
 void
-SubscriptionManager::forwardManifest(boost::json::object const& response)
+SubscriptionManager::forwardManifest(
+    std::shared_ptr<std::string const> const& message)
 {
-    std::string pubMsg{boost::json::serialize(response)};
-    manifestSubscribers_.publish(pubMsg);
+    if (manifestSubscribers_.hasSubscribers())
+        manifestSubscribers_.publish(message);
 }
 
 void
-SubscriptionManager::forwardValidation(boost::json::object const& response)
+SubscriptionManager::forwardValidation(
+    std::shared_ptr<std::string const> const& message)
+{
+    if (validationsSubscribers_.hasSubscribers())
+        validationsSubscribers_.publish(message);
+}
+
+boost::json::object
+SubscriptionManager::report() const
 {
-    std::string pubMsg{boost::json::serialize(response)};
-    validationsSubscribers_.publish(std::move(pubMsg));
+    boost::json::object report;
+    for (StreamQueue const* queue :
+         {&ledgerSubscribers_.queue(),
+          &txSubscribers_.queue(),
+          &txBinarySubscribers_.queue(),
+          &txProposedSubscribers_.queue(),
+          &manifestSubscribers_.queue(),
+          &validationsSubscribers_.queue(),
+          &accountSubscribers_.queue(),
+          &accountBinarySubscribers_.queue(),
+          &accountProposedSubscribers_.queue(),
+          &bookSubscribers_.queue()})
+        report[queue->name] = queue->report();
+    return report;
 }
 
 void
@@ -2,23 +2,89 @@
 #define SUBSCRIPTION_MANAGER_H
 
 #include <backend/BackendInterface.h>
+#include <boost/asio/thread_pool.hpp>
+#include <atomic>
 #include <memory>
+#include <string_view>
 
 class WsBase;
 
+// messages published together, such as the transactions of a ledger
+using MessageBatch = std::vector<std::shared_ptr<std::string const>>;
+
+// Limits of the queue of messages waiting to be sent to one session, and what
+// is done with a session that exceeds them
+struct QueueLimits
+{
+    enum class Policy {
+        // discard the oldest messages of streams, until within the limits
+        dropOldest,
+        // discard messages superseded by a newer message of the same stream,
+        // as ledger messages are. disconnect if that is not enough
+        coalesce,
+        // close the session with a policy error
+        disconnect
+    };
+
+    std::size_t maxMessages = 8192;
+    std::size_t maxBytes = 32 * 1024 * 1024;
+    Policy policy = Policy::disconnect;
+};
+
+// Depth of the queues of the sessions subscribed to one stream, summed over
+// every session
+struct StreamQueue
+{
+    std::string const name;
+    // whether a message of this stream supersedes the ones before it
+    bool const coalesce;
+    QueueLimits const limits;
+
+    std::atomic_uint64_t messages{0};
+    std::atomic_uint64_t bytes{0};
+    std::atomic_uint64_t dropped{0};
+    std::atomic_uint64_t disconnects{0};
+
+    StreamQueue(std::string name, bool coalesce, QueueLimits const& limits)
+        : name(std::move(name)), coalesce(coalesce), limits(limits)
+    {
+    }
+
+    boost::json::object
+    report() const;
+};
+
+// Subscribers of a stream. They are split into shards, each with its own
+// strand, so that a message is delivered by as many workers as there are
+// shards, and a slow shard does not hold up the others
 class Subscription
 {
-    boost::asio::io_context::strand strand_;
-    std::unordered_set<std::shared_ptr<WsBase>> subscribers_ = {};
+    struct Shard
+    {
+        boost::asio::io_context::strand strand;
+        std::unordered_set<std::shared_ptr<WsBase>> subscribers = {};
+
+        explicit Shard(boost::asio::io_context& ioc) : strand(ioc)
+        {
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::shared_ptr<StreamQueue> queue_;
+    std::atomic_uint64_t numSubscribers_{0};
+
+    Shard&
+    shard(std::shared_ptr<WsBase> const& session);
 
 public:
     Subscription() = delete;
     Subscription(Subscription&) = delete;
     Subscription(Subscription&&) = delete;
 
-    explicit Subscription(boost::asio::io_context& ioc) : strand_(ioc)
-    {
-    }
+    Subscription(
+        boost::asio::io_context& ioc,
+        std::size_t numShards,
+        std::shared_ptr<StreamQueue> queue);
 
     ~Subscription() = default;
 
@@ -29,24 +95,96 @@ public:
     unsubscribe(std::shared_ptr<WsBase> const& session);
 
     void
-    publish(std::string const& message);
+    publish(std::shared_ptr<std::string const> const& message);
+
+    // publish messages, in order, with a single post per shard
+    void
+    publish(std::shared_ptr<MessageBatch const> const& messages);
+
+    // false if nothing published now would be sent to anyone, so that the
+    // message need not be built
+    bool
+    hasSubscribers() const
+    {
+        return numSubscribers_ != 0;
+    }
+
+    StreamQueue const&
+    queue() const
+    {
+        return *queue_;
+    }
 };
 
+// Subscribers by key, such as an account or a book. Keys are split into
+// shards, each with its own strand, so that messages for different keys are
+// delivered in parallel
 template <class Key>
 class SubscriptionMap
 {
     using subscribers = std::unordered_set<std::shared_ptr<WsBase>>;
 
-    boost::asio::io_context::strand strand_;
-    std::unordered_map<Key, subscribers> subscribers_ = {};
+    struct Shard
+    {
+        boost::asio::io_context::strand strand;
+        std::unordered_map<Key, subscribers> byKey = {};
+
+        explicit Shard(boost::asio::io_context& ioc) : strand(ioc)
+        {
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::shared_ptr<StreamQueue> queue_;
+    std::atomic_uint64_t numSubscribers_{0};
+    // subscribers by hash of their key, which tells without taking a strand
+    // whether a key may have subscribers. keys that share a counter only
+    // cost a message that is built for nothing
+    std::vector<std::atomic_uint32_t> counts_;
+
+    static constexpr std::size_t numCounts = 1 << 14;
+
+    Shard&
+    shard(Key const& key)
+    {
+        return *shards_[std::hash<Key>{}(key) % shards_.size()];
+    }
+
+    std::atomic_uint32_t&
+    count(Key const& key)
+    {
+        return counts_[std::hash<Key>{}(key) % numCounts];
+    }
+
+    std::atomic_uint32_t const&
+    count(Key const& key) const
+    {
+        return counts_[std::hash<Key>{}(key) % numCounts];
+    }
+
+    // account for subscribers of key that were removed
+    void
+    removed(Key const& key, std::size_t num)
+    {
+        count(key) -= num;
+        numSubscribers_ -= num;
+    }
 
 public:
     SubscriptionMap() = delete;
     SubscriptionMap(SubscriptionMap&) = delete;
     SubscriptionMap(SubscriptionMap&&) = delete;
 
-    explicit SubscriptionMap(boost::asio::io_context& ioc) : strand_(ioc)
+    SubscriptionMap(
+        boost::asio::io_context& ioc,
+        std::size_t numShards,
+        std::shared_ptr<StreamQueue> queue)
+        : queue_(std::move(queue)), counts_(numCounts)
     {
+        numShards = std::max<std::size_t>(numShards, 1);
+        shards_.reserve(numShards);
+        for (std::size_t i = 0; i < numShards; ++i)
+            shards_.push_back(std::make_unique<Shard>(ioc));
     }
 
     ~SubscriptionMap() = default;
@@ -58,22 +196,62 @@ public:
     unsubscribe(std::shared_ptr<WsBase> const& session, Key const& key);
 
     void
-    publish(std::string const& message, Key const& key);
+    publish(
+        std::shared_ptr<std::string const> const& message,
+        Key const& key);
+
+    // publish the messages of every key, in order, with a single post per
+    // shard
+    void
+    publish(std::unordered_map<Key, MessageBatch>&& byKey);
+
+    bool
+    hasSubscribers() const
+    {
+        return numSubscribers_ != 0;
+    }
+
+    // false if nothing published to key now would be sent to anyone. may be
+    // true for a key without subscribers
+    bool
+    hasSubscribers(Key const& key) const
+    {
+        return count(key) != 0;
+    }
+
+    StreamQueue const&
+    queue() const
+    {
+        return *queue_;
+    }
 };
 
 class SubscriptionManager
 {
+    // the message of a transaction, and where it is published
+    struct PreparedTransaction
+    {
+        std::shared_ptr<std::string const> message;
+        std::vector<ripple::AccountID> accounts;
+        std::vector<ripple::Book> books;
+        // the serialized transaction and metadata, for binary subscribers
+        std::shared_ptr<std::string const> binaryMessage;
+        std::vector<ripple::AccountID> binaryAccounts;
+    };
+
     std::vector<std::thread> workers_;
     boost::asio::io_context ioc_;
     std::optional<boost::asio::io_context::work> work_;
 
     Subscription ledgerSubscribers_;
     Subscription txSubscribers_;
+    Subscription txBinarySubscribers_;
     Subscription txProposedSubscribers_;
     Subscription manifestSubscribers_;
     Subscription validationsSubscribers_;
 
     SubscriptionMap<ripple::AccountID> accountSubscribers_;
+    SubscriptionMap<ripple::AccountID> accountBinarySubscribers_;
     SubscriptionMap<ripple::AccountID> accountProposedSubscribers_;
     SubscriptionMap<ripple::Book> bookSubscribers_;
 
@@ -93,27 +271,93 @@ public:
             numThreads = config.at("subscription_workers").as_int64();
         }
 
-        return std::make_shared<SubscriptionManager>(numThreads, b);
+        QueueLimits limits;
+        if (config.contains("subscription_queue") &&
+            config.at("subscription_queue").is_object())
+        {
+            auto const& queue = config.at("subscription_queue").as_object();
+            if (queue.contains("max_messages") &&
+                queue.at("max_messages").is_int64())
+                limits.maxMessages = queue.at("max_messages").as_int64();
+            if (queue.contains("max_bytes") && queue.at("max_bytes").is_int64())
+                limits.maxBytes = queue.at("max_bytes").as_int64();
+            if (queue.contains("policy") && queue.at("policy").is_string())
+            {
+                auto const& policy = queue.at("policy").as_string();
+                if (policy == "drop_oldest")
+                    limits.policy = QueueLimits::Policy::dropOldest;
+                else if (policy == "coalesce")
+                    limits.policy = QueueLimits::Policy::coalesce;
+                else if (policy == "disconnect")
+                    limits.policy = QueueLimits::Policy::disconnect;
+                else
+                    throw std::runtime_error(
+                        "unknown subscription_queue policy");
+            }
+        }
+
+        return std::make_shared<SubscriptionManager>(numThreads, limits, b);
     }
 
     SubscriptionManager(
         std::uint64_t numThreads,
+        QueueLimits const& limits,
         std::shared_ptr<Backend::BackendInterface const> const& b)
-        : ledgerSubscribers_(ioc_)
-        , txSubscribers_(ioc_)
-        , txProposedSubscribers_(ioc_)
-        , manifestSubscribers_(ioc_)
-        , validationsSubscribers_(ioc_)
-        , accountSubscribers_(ioc_)
-        , accountProposedSubscribers_(ioc_)
-        , bookSubscribers_(ioc_)
+        : ledgerSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("ledger", true, limits))
+        , txSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("transactions", false, limits))
+        , txBinarySubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>(
+                  "transactions_binary",
+                  false,
+                  limits))
+        , txProposedSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>(
+                  "transactions_proposed",
+                  false,
+                  limits))
+        , manifestSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("manifests", false, limits))
+        , validationsSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("validations", false, limits))
+        , accountSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("accounts", false, limits))
+        , accountBinarySubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("accounts_binary", false, limits))
+        , accountProposedSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>(
+                  "accounts_proposed",
+                  false,
+                  limits))
+        , bookSubscribers_(
+              ioc_,
+              numThreads,
+              std::make_shared<StreamQueue>("books", false, limits))
         , backend_(b)
     {
         work_.emplace(ioc_);
 
-        // We will eventually want to clamp this to be the number of strands,
-        // since adding more threads than we have strands won't see any
-        // performance benefits
+        // every subscription has a shard per worker, so that a message to
+        // many subscribers is delivered by every worker
         BOOST_LOG_TRIVIAL(info) << "Starting subscription manager with "
                                 << numThreads << " workers";
 
@@ -144,21 +388,30 @@ public:
     void
     unsubLedger(std::shared_ptr<WsBase>& session);
 
+    // binary subscribers are sent the serialized transaction and metadata,
+    // hex encoded, instead of their JSON
     void
-    subTransactions(std::shared_ptr<WsBase>& session);
+    subTransactions(std::shared_ptr<WsBase>& session, bool binary = false);
 
+    // unsubscribes from both the JSON and the binary stream
     void
     unsubTransactions(std::shared_ptr<WsBase>& session);
 
+    // Publish the transactions of a ledger. Their messages are built on pool,
+    // split into at most maxChunks chunks, then published in one batch per
+    // stream and shard
     void
-    pubTransaction(
-        Backend::TransactionAndMetadata const& blobs,
-        ripple::LedgerInfo const& lgrInfo);
+    pubTransactions(
+        std::vector<Backend::TransactionAndMetadata> const& transactions,
+        ripple::LedgerInfo const& lgrInfo,
+        boost::asio::thread_pool& pool,
+        std::size_t maxChunks);
 
     void
     subAccount(
         ripple::AccountID const& account,
-        std::shared_ptr<WsBase>& session);
+        std::shared_ptr<WsBase>& session,
+        bool binary = false);
 
     void
     unsubAccount(
@@ -183,14 +436,18 @@ public:
     void
     unsubValidation(std::shared_ptr<WsBase>& session);
 
+    // messages received from rippled are relayed as they are, without
+    // parsing them. transaction is the raw "transaction" field of message
     void
-    forwardProposedTransaction(boost::json::object const& response);
+    forwardProposedTransaction(
+        std::shared_ptr<std::string const> const& message,
+        std::string_view transaction);
 
     void
-    forwardManifest(boost::json::object const& response);
+    forwardManifest(std::shared_ptr<std::string const> const& message);
 
     void
-    forwardValidation(boost::json::object const& response);
+    forwardValidation(std::shared_ptr<std::string const> const& message);
 
     void
     subProposedAccount(
@@ -208,10 +465,19 @@ public:
     void
     unsubProposedTransactions(std::shared_ptr<WsBase>& session);
 
+    // depth of the queues of subscribers, by stream
+    boost::json::object
+    report() const;
+
 private:
+    PreparedTransaction
+    prepareTransaction(
+        Backend::TransactionAndMetadata const& blobs,
+        ripple::LedgerInfo const& lgrInfo) const;
+
     void
     sendAll(
-        std::string const& pubMsg,
+        std::shared_ptr<std::string const> const& pubMsg,
         std::unordered_set<std::shared_ptr<WsBase>>& subs);
 };
 
@@ -2,18 +2,90 @@
 #define RIPPLE_REPORTING_DOS_GUARD_H
 
 #include <boost/asio.hpp>
+#include <boost/json.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 
+// Rate limits clients by IP with a token bucket per client. A client may
+// spend max_fetches every sweep_interval seconds, and its bucket refills
+// smoothly at that rate. Requests are charged for the bytes of their
+// response, plus read_cost for every object they read from the database,
+// so requests that miss the cache are throttled before they overload it.
+//
+// A client is turned away while its bucket is empty. Its debt is capped at
+// one bucket, so a client is never turned away for much longer than
+// sweep_interval. Buckets are sharded by client, each with its own lock.
 class DOSGuard
 {
-    std::unordered_map<std::string, uint32_t> ipFetchCount_;
+public:
+    // IPv4 addresses are mapped to IPv6
+    using Client = std::array<unsigned char, 16>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct ClientHash
+    {
+        size_t
+        operator()(Client const& client) const
+        {
+            return std::hash<std::string_view>{}(
+                {reinterpret_cast<char const*>(client.data()), client.size()});
+        }
+    };
+
+    struct Bucket
+    {
+        double tokens;
+        clock::time_point refilled;
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<Client, Bucket, ClientHash> buckets;
+    };
+
+    static constexpr size_t numShards = 16;
+
+    std::array<Shard, numShards> shards_;
     uint32_t maxFetches_ = 100;
     uint32_t sweepInterval_ = 1;
-    std::unordered_set<std::string> whitelist_;
+    uint32_t readCost_ = 1000;
+    std::unordered_set<Client, ClientHash> whitelist_;
     boost::asio::io_context& ctx_;
-    std::mutex mtx_;
+    // requests turned away
+    std::atomic_uint64_t rejected_{0};
+
+    Shard&
+    shard(Client const& client)
+    {
+        return shards_[ClientHash{}(client) % numShards];
+    }
+
+    // tokens refilled per second
+    double
+    rate() const
+    {
+        return static_cast<double>(maxFetches_) / sweepInterval_;
+    }
+
+    // Requires the lock of the shard of bucket
+    void
+    refill(Bucket& bucket, clock::time_point now) const
+    {
+        std::chrono::duration<double> elapsed = now - bucket.refilled;
+        bucket.tokens = std::min<double>(
+            maxFetches_, bucket.tokens + elapsed.count() * rate());
+        bucket.refilled = now;
+    }
 
 public:
     DOSGuard(boost::json::object const& config, boost::asio::io_context& ctx)
@@ -26,18 +98,36 @@ public:
                 dosGuardConfig.contains("sweep_interval"))
             {
                 maxFetches_ = dosGuardConfig.at("max_fetches").as_int64();
-                sweepInterval_ = dosGuardConfig.at("sweep_interval").as_int64();
+                sweepInterval_ = std::max<uint32_t>(
+                    dosGuardConfig.at("sweep_interval").as_int64(), 1);
             }
+            if (dosGuardConfig.contains("read_cost"))
+                readCost_ = dosGuardConfig.at("read_cost").as_int64();
             if (dosGuardConfig.contains("whitelist"))
             {
                 auto whitelist = dosGuardConfig.at("whitelist").as_array();
                 for (auto& ip : whitelist)
-                    whitelist_.insert(ip.as_string().c_str());
+                    whitelist_.insert(parse(ip.as_string().c_str()));
             }
         }
         createTimer();
     }
 
+    // ip as a Client. Unparseable addresses are all the same client
+    static Client
+    parse(std::string_view ip)
+    {
+        boost::system::error_code ec;
+        auto address = boost::asio::ip::make_address(ip, ec);
+        if (ec)
+            return {};
+        if (address.is_v4())
+            return boost::asio::ip::make_address_v6(
+                       boost::asio::ip::v4_mapped, address.to_v4())
+                .to_bytes();
+        return address.to_v6().to_bytes();
+    }
+
     void
     createTimer()
     {
@@ -55,36 +145,81 @@ public:
     bool
     isOk(std::string const& ip)
     {
-        if (whitelist_.count(ip) > 0)
+        auto client = parse(ip);
+        if (whitelist_.count(client) > 0)
             return true;
-        std::unique_lock lck(mtx_);
-        auto it = ipFetchCount_.find(ip);
-        if (it == ipFetchCount_.end())
+        auto& shard = this->shard(client);
+        std::lock_guard lck(shard.mtx);
+        auto it = shard.buckets.find(client);
+        if (it == shard.buckets.end())
             return true;
-        return it->second < maxFetches_;
+        refill(it->second, clock::now());
+        if (it->second.tokens > 0)
+            return true;
+        rejected_++;
+        return false;
     }
 
+    // Charge ip with cost. false if its bucket is now empty
     bool
-    add(std::string const& ip, uint32_t numObjects)
+    add(std::string const& ip, uint64_t cost)
     {
-        if (whitelist_.count(ip) > 0)
+        auto client = parse(ip);
+        if (whitelist_.count(client) > 0)
             return true;
-        {
-            std::unique_lock lck(mtx_);
-            auto it = ipFetchCount_.find(ip);
-            if (it == ipFetchCount_.end())
-                ipFetchCount_[ip] = numObjects;
-            else
-                it->second += numObjects;
-        }
-        return isOk(ip);
+        auto now = clock::now();
+        auto& shard = this->shard(client);
+        std::lock_guard lck(shard.mtx);
+        auto [it, inserted] = shard.buckets.try_emplace(
+            client, Bucket{static_cast<double>(maxFetches_), now});
+        auto& bucket = it->second;
+        refill(bucket, now);
+        bucket.tokens = std::max<double>(
+            bucket.tokens - cost, -static_cast<double>(maxFetches_));
+        return bucket.tokens > 0;
+    }
+
+    // cost of a response of bytes, to a request that read dbReads objects
+    // from the database
+    uint64_t
+    cost(size_t bytes, uint64_t dbReads) const
+    {
+        return bytes + dbReads * readCost_;
     }
 
+    // Drop the buckets that refilled, which are the same as no bucket. Only
+    // idle clients are dropped, so no limit resets at once
     void
     clear()
     {
-        std::unique_lock lck(mtx_);
-        ipFetchCount_.clear();
+        auto now = clock::now();
+        for (auto& shard : shards_)
+        {
+            std::lock_guard lck(shard.mtx);
+            for (auto it = shard.buckets.begin(); it != shard.buckets.end();)
+            {
+                refill(it->second, now);
+                if (it->second.tokens >= maxFetches_)
+                    it = shard.buckets.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    boost::json::object
+    report()
+    {
+        boost::json::object report;
+        report["rejected"] = rejected_.load();
+        size_t tracked = 0;
+        for (auto& shard : shards_)
+        {
+            std::lock_guard lck(shard.mtx);
+            tracked += shard.buckets.size();
+        }
+        report["tracked_ips"] = tracked;
+        return report;
     }
 };
 #endif
@@ -17,8 +17,14 @@
 #include <string>
 #include <thread>
 
+#include <log/Log.h>
+#include <log/RequestLog.h>
+#include <log/Trace.h>
+#include <rpc/Batch.h>
 #include <rpc/Counters.h>
+#include <rpc/ResponseCache.h>
 #include <rpc/RPC.h>
+#include <rpc/WorkQueue.h>
 #include <vector>
 #include <webserver/DOSGuard.h>
 
@@ -59,10 +65,171 @@ httpFail(boost::beast::error_code ec, char const* what)
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
+// The serialized response to request, a JSON-RPC request. Adds the objects
+// it read from the database to dbReads. The handler suspends yield, if set,
+// while it waits on the database
+inline std::string
+buildHttpResponse(
+    boost::json::object request,
+    std::shared_ptr<BackendInterface const> const& backend,
+    std::shared_ptr<ETLLoadBalancer> const& balancer,
+    Backend::LedgerRange const& range,
+    RPC::Counters& counters,
+    std::string const& ip,
+    std::uint64_t& dbReads,
+    std::optional<boost::asio::yield_context> yield = {})
+{
+    if (!request.contains("params"))
+        request["params"] = boost::json::array({boost::json::object{}});
+
+    std::optional<RPC::Context> context = RPC::make_HttpContext(
+        request, backend, nullptr, balancer, range, counters, ip);
+
+    if (!context)
+        return boost::json::serialize(
+            RPC::make_error(RPC::Error::rpcBAD_SYNTAX));
+    context->yield = std::move(yield);
+
+    Log::requestLog().record("http", context->method, context->params);
+
+    Trace::Span span{"rpc"};
+    span.attribute("method", context->method);
+
+    auto& responseCache = RPC::responseCache();
+    std::optional<RPC::ResponseCache::Key> cacheKey;
+    if (responseCache.enabled())
+        cacheKey = RPC::ResponseCache::key(*context, "http");
+
+    auto start = std::chrono::system_clock::now();
+    if (cacheKey)
+    {
+        auto cached = [&]() {
+            Trace::Span cacheSpan{"response_cache"};
+            auto cached = responseCache.get(*cacheKey);
+            cacheSpan.attribute("hit", static_cast<bool>(cached));
+            return cached;
+        }();
+        if (cached)
+        {
+            counters.rpcComplete(
+                context->methodID,
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now() - start));
+            return *cached;
+        }
+    }
+
+    boost::json::object response(context->storage);
+    response["result"] = boost::json::object{};
+    boost::json::object& result = response["result"].as_object();
+
+    auto v = [&context]() {
+        Trace::Span handlerSpan{"handler"};
+        Backend::ReadCounter::Scope reads{context->dbReads};
+        return RPC::buildResponse(*context);
+    }();
+    dbReads += context->dbReads;
+    span.attribute("db_reads", context->dbReads);
+    auto end = std::chrono::system_clock::now();
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    Trace::Span serializeSpan{"serialize"};
+    std::string responseStr;
+    if (auto status = std::get_if<RPC::Status>(&v))
+    {
+        counters.rpcErrored(context->methodID);
+        auto error = RPC::make_error(*status);
+        span.attribute("error", error["error"]);
+
+        error["request"] = request;
+
+        result = error;
+
+        responseStr = boost::json::serialize(response);
+        BOOST_LOG_TRIVIAL(debug)
+            << __func__ << " Encountered error: " << responseStr;
+    }
+    else
+    {
+        counters.rpcComplete(context->methodID, us);
+        result = std::move(std::get<boost::json::object>(v));
+        result["status"] = "success";
+        result["validated"] = true;
+
+        responseStr = boost::json::serialize(response);
+        if (cacheKey)
+            responseCache.put(
+                *cacheKey,
+                RPC::ResponseCache::ledgerOf(result),
+                std::make_shared<std::string const>(responseStr));
+    }
+    return responseStr;
+}
+
+// The serialized responses to a JSON-RPC batch, in the order of requests.
+// Adds the objects they read from the database to dbReads
+inline std::string
+buildHttpBatchResponse(
+    boost::json::array const& requests,
+    std::shared_ptr<BackendInterface const> const& backend,
+    std::shared_ptr<ETLLoadBalancer> const& balancer,
+    Backend::LedgerRange const& range,
+    RPC::Counters& counters,
+    std::string const& ip,
+    std::uint64_t& dbReads)
+{
+    std::vector<boost::json::object const*> params;
+    params.reserve(requests.size());
+    for (auto const& request : requests)
+    {
+        boost::json::object const* p = nullptr;
+        if (request.is_object() && request.as_object().contains("params"))
+        {
+            auto const& array = request.as_object().at("params");
+            if (array.is_array() && array.as_array().size() == 1 &&
+                array.as_array().at(0).is_object())
+                p = &array.as_array().at(0).as_object();
+        }
+        params.push_back(p);
+    }
+
+    auto responses = RPC::runBatch(
+        *backend,
+        range,
+        params,
+        [&](std::size_t i, std::uint64_t& reads) {
+            if (!requests.at(i).is_object())
+                return boost::json::serialize(
+                    RPC::make_error(RPC::Error::rpcBAD_SYNTAX));
+            try
+            {
+                return buildHttpResponse(
+                    requests.at(i).as_object(),
+                    backend,
+                    balancer,
+                    range,
+                    counters,
+                    ip,
+                    reads);
+            }
+            catch (std::exception const& e)
+            {
+                BOOST_LOG_TRIVIAL(error)
+                    << __func__ << " Caught exception : " << e.what();
+                return boost::json::serialize(
+                    RPC::make_error(RPC::Error::rpcINTERNAL));
+            }
+        },
+        dbReads);
+    return RPC::joinResponses(responses);
+}
+
 // This function produces an HTTP response for the given
 // request. The type of the response object depends on the
 // contents of the request, so the interface requires the
 // caller to pass a generic lambda for receiving the response.
+// A request that is not a batch runs on the coroutine of yield, if set
 template <class Body, class Allocator, class Send>
 void
 handle_request(
@@ -73,7 +240,8 @@ handle_request(
     std::shared_ptr<ETLLoadBalancer> balancer,
     DOSGuard& dosGuard,
     RPC::Counters& counters,
-    std::string const& ip)
+    std::string const& ip,
+    std::optional<boost::asio::yield_context> yield = {})
 {
     auto const httpResponse = [&req](
                                   http::status status,
@@ -98,7 +266,14 @@ handle_request(
         return send(httpResponse(
             http::status::bad_request, "text/html", "Expected a POST request"));
 
-    if (!dosGuard.isOk(ip))
+    Trace::Request trace{"http"};
+    trace.attribute("bytes", req.body().size());
+    bool allowed;
+    {
+        Trace::Span span{"dos_guard"};
+        allowed = dosGuard.isOk(ip);
+    }
+    if (!allowed)
         return send(httpResponse(
             http::status::ok,
             "application/json",
@@ -106,24 +281,40 @@ handle_request(
 
     try
     {
-        BOOST_LOG_TRIVIAL(info) << "Received request: " << req.body();
+        CLIO_LOG_SAMPLED(info) << "Received request: " << req.body();
 
-        boost::json::object request;
-        std::string responseStr = "";
+        auto const badSyntax = [&httpResponse]() {
+            return httpResponse(
+                http::status::ok,
+                "application/json",
+                boost::json::serialize(
+                    RPC::make_error(RPC::Error::rpcBAD_SYNTAX)));
+        };
+
+        boost::json::value request;
         try
         {
-            request = boost::json::parse(req.body()).as_object();
-
-            if (!request.contains("params"))
-                request["params"] = boost::json::array({boost::json::object{}});
+            Trace::Span parseSpan{"parse"};
+            request = boost::json::parse(req.body());
         }
         catch (std::runtime_error const& e)
         {
-            return send(httpResponse(
-                http::status::ok,
-                "application/json",
-                boost::json::serialize(
-                    RPC::make_error(RPC::Error::rpcBAD_SYNTAX))));
+            return send(badSyntax());
+        }
+        if (!request.is_object() && !request.is_array())
+            return send(badSyntax());
+
+        if (request.is_array())
+        {
+            auto size = request.as_array().size();
+            if (size == 0)
+                return send(badSyntax());
+            if (size > RPC::maxBatchSize)
+                return send(httpResponse(
+                    http::status::ok,
+                    "application/json",
+                    boost::json::serialize(RPC::make_error(RPC::Status{
+                        RPC::Error::rpcINVALID_PARAMS, "batchTooLarge"}))));
         }
 
         auto range = backend->fetchLedgerRange();
@@ -134,49 +325,28 @@ handle_request(
                 boost::json::serialize(
                     RPC::make_error(RPC::Error::rpcNOT_READY))));
 
-        std::optional<RPC::Context> context = RPC::make_HttpContext(
-            request, backend, nullptr, balancer, *range, counters, ip);
-
-        if (!context)
-            return send(httpResponse(
-                http::status::ok,
-                "application/json",
-                boost::json::serialize(
-                    RPC::make_error(RPC::Error::rpcBAD_SYNTAX))));
-
-        boost::json::object response{{"result", boost::json::object{}}};
-        boost::json::object& result = response["result"].as_object();
-
-        auto start = std::chrono::system_clock::now();
-        auto v = RPC::buildResponse(*context);
-        auto end = std::chrono::system_clock::now();
-        auto us =
-            std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-
-        if (auto status = std::get_if<RPC::Status>(&v))
-        {
-            counters.rpcErrored(context->method);
-            auto error = RPC::make_error(*status);
-
-            error["request"] = request;
-
-            result = error;
-
-            responseStr = boost::json::serialize(response);
-            BOOST_LOG_TRIVIAL(debug)
-                << __func__ << " Encountered error: " << responseStr;
-        }
-        else
-        {
-            counters.rpcComplete(context->method, us);
-            result = std::get<boost::json::object>(v);
-            result["status"] = "success";
-            result["validated"] = true;
-
-            responseStr = boost::json::serialize(response);
-        }
-
-        dosGuard.add(ip, responseStr.size());
+        // objects the request read from the database
+        std::uint64_t dbReads = 0;
+        std::string responseStr = request.is_array()
+            ? buildHttpBatchResponse(
+                  request.as_array(),
+                  backend,
+                  balancer,
+                  *range,
+                  counters,
+                  ip,
+                  dbReads)
+            : buildHttpResponse(
+                  std::move(request.as_object()),
+                  backend,
+                  balancer,
+                  *range,
+                  counters,
+                  ip,
+                  dbReads,
+                  std::move(yield));
+
+        dosGuard.add(ip, dosGuard.cost(responseStr.size(), dbReads));
 
         return send(
             httpResponse(http::status::ok, "application/json", responseStr));
@@ -244,6 +414,7 @@ class HttpBase
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
     RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
     send_lambda lambda_;
 
 protected:
@@ -256,12 +427,14 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer buffer)
         : backend_(backend)
         , subscriptions_(subscriptions)
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , lambda_(*this)
         , buffer_(std::move(buffer))
     {
@@ -312,20 +485,57 @@ public:
                 subscriptions_,
                 balancer_,
                 dosGuard_,
-                counters_);
+                counters_,
+                queue_);
         }
 
         auto ip = derived().ip();
-
-        // Send the response
-        handle_request(
-            std::move(req_),
-            lambda_,
-            backend_,
-            balancer_,
-            dosGuard_,
-            counters_,
-            ip);
+        auto version = req_.version();
+        auto keepAlive = req_.keep_alive();
+        auto busy = [version, keepAlive]() {
+            http::response<http::string_body> res{http::status::ok, version};
+            res.set(http::field::server, "xrpl-reporting-server-v0.0.0");
+            res.set(http::field::content_type, "application/json");
+            res.keep_alive(keepAlive);
+            res.body() = boost::json::serialize(
+                RPC::make_error(RPC::Error::rpcTOO_BUSY));
+            res.prepare_payload();
+            return res;
+        };
+
+        // The request is handled on the RPC work queue, in the lane of its
+        // method. The response is written on the executor of the stream
+        // batches are expensive, whatever their requests
+        auto costClass = RPC::isBatch(req_.body())
+            ? RPC::CostClass::expensive
+            : RPC::costClass(RPC::peekMethod(req_.body(), "method"));
+        auto work = [this,
+                     session = derived().shared_from_this(),
+                     req = std::move(req_),
+                     ip](boost::asio::yield_context yield) mutable {
+            handle_request(
+                std::move(req),
+                [this, &session](http::response<http::string_body>&& res) {
+                    net::post(
+                        derived().stream().get_executor(),
+                        [this, session, res = std::move(res)]() mutable {
+                            lambda_(std::move(res));
+                        });
+                },
+                backend_,
+                balancer_,
+                dosGuard_,
+                counters_,
+                ip,
+                yield);
+        };
+        auto shed = [this, session = derived().shared_from_this(), busy]() {
+            net::post(
+                derived().stream().get_executor(),
+                [this, session, busy]() { lambda_(busy()); });
+        };
+        if (!queue_.post(costClass, std::move(work), std::move(shed)))
+            lambda_(busy());
     }
 
     void
@@ -5,12 +5,19 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <subscriptions/SubscriptionManager.h>
+#include <rpc/WorkQueue.h>
 #include <webserver/HttpSession.h>
 #include <webserver/PlainWsSession.h>
 #include <webserver/SslHttpSession.h>
 #include <webserver/SslWsSession.h>
 
 #include <iostream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
 
 class SubscriptionManager;
 
@@ -28,6 +35,7 @@ class Detector
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
     RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
     boost::beast::flat_buffer buffer_;
 
 public:
@@ -38,7 +46,8 @@ public:
         std::shared_ptr<SubscriptionManager> subscriptions,
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
-        RPC::Counters& counters)
+        RPC::Counters& counters,
+        RPC::WorkQueue& queue)
         : stream_(std::move(socket))
         , ctx_(ctx)
         , backend_(backend)
@@ -46,6 +55,7 @@ public:
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
     {
     }
 
@@ -83,6 +93,7 @@ public:
                 balancer_,
                 dosGuard_,
                 counters_,
+                queue_,
                 std::move(buffer_))
                 ->run();
             return;
@@ -96,6 +107,7 @@ public:
             balancer_,
             dosGuard_,
             counters_,
+            queue_,
             std::move(buffer_))
             ->run();
     }
@@ -110,7 +122,8 @@ make_websocket_session(
     std::shared_ptr<SubscriptionManager> subscriptions,
     std::shared_ptr<ETLLoadBalancer> balancer,
     DOSGuard& dosGuard,
-    RPC::Counters& counters)
+    RPC::Counters& counters,
+    RPC::WorkQueue& queue)
 {
     std::make_shared<WsUpgrader>(
         std::move(stream),
@@ -119,6 +132,7 @@ make_websocket_session(
         balancer,
         dosGuard,
         counters,
+        queue,
         std::move(buffer),
         std::move(req))
         ->run();
@@ -133,7 +147,8 @@ make_websocket_session(
     std::shared_ptr<SubscriptionManager> subscriptions,
     std::shared_ptr<ETLLoadBalancer> balancer,
     DOSGuard& dosGuard,
-    RPC::Counters& counters)
+    RPC::Counters& counters,
+    RPC::WorkQueue& queue)
 {
     std::make_shared<SslWsUpgrader>(
         std::move(stream),
@@ -142,6 +157,7 @@ make_websocket_session(
         balancer,
         dosGuard,
         counters,
+        queue,
         std::move(buffer),
         std::move(req))
         ->run();
@@ -161,9 +177,14 @@ class Listener
     std::shared_ptr<SubscriptionManager> subscriptions_;
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
-    RPC::Counters counters_;
+    RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
+    // ioc_ is run by one thread, so sessions need no strand
+    bool const singleThreaded_;
 
 public:
+    // With reusePort, any number of listeners can bind endpoint, and the
+    // kernel spreads connections across them
     Listener(
         net::io_context& ioc,
         std::optional<std::reference_wrapper<ssl::context>> ctx,
@@ -171,7 +192,9 @@ public:
         std::shared_ptr<BackendInterface const> backend,
         std::shared_ptr<SubscriptionManager> subscriptions,
         std::shared_ptr<ETLLoadBalancer> balancer,
-        DOSGuard& dosGuard)
+        DOSGuard& dosGuard,
+        RPC::WorkQueue& queue,
+        bool reusePort = false)
         : ioc_(ioc)
         , ctx_(ctx)
         , acceptor_(net::make_strand(ioc))
@@ -179,6 +202,9 @@ public:
         , subscriptions_(subscriptions)
         , balancer_(balancer)
         , dosGuard_(dosGuard)
+        , counters_(RPC::counters())
+        , queue_(queue)
+        , singleThreaded_(reusePort)
     {
         boost::beast::error_code ec;
 
@@ -198,6 +224,20 @@ public:
             return;
         }
 
+#ifdef SO_REUSEPORT
+        if (reusePort)
+        {
+            using reuse_port = boost::asio::detail::socket_option::
+                boolean<SOL_SOCKET, SO_REUSEPORT>;
+            acceptor_.set_option(reuse_port(true), ec);
+            if (ec)
+            {
+                httpFail(ec, "set_option");
+                return;
+            }
+        }
+#endif
+
         // Bind to the server address
         acceptor_.bind(endpoint, ec);
         if (ec)
@@ -222,15 +262,23 @@ public:
         do_accept();
     }
 
+    RPC::WorkQueue const&
+    queue() const
+    {
+        return queue_;
+    }
+
 private:
     void
     do_accept()
     {
+        auto handler = boost::beast::bind_front_handler(
+            &Listener::on_accept, shared_from_this());
+        if (singleThreaded_)
+            acceptor_.async_accept(ioc_, std::move(handler));
         // The new connection gets its own strand
-        acceptor_.async_accept(
-            net::make_strand(ioc_),
-            boost::beast::bind_front_handler(
-                &Listener::on_accept, shared_from_this()));
+        else
+            acceptor_.async_accept(net::make_strand(ioc_), std::move(handler));
     }
 
     void
@@ -254,7 +302,8 @@ private:
                 subscriptions_,
                 balancer_,
                 dosGuard_,
-                counters_)
+                counters_,
+                queue_)
                 ->run();
         }
 
@@ -268,7 +317,124 @@ namespace Server {
 using WebsocketServer = Listener<WsUpgrader, SslWsUpgrader>;
 using HttpServer = Listener<HttpSession, SslHttpSession>;
 
-static std::shared_ptr<HttpServer>
+// The listeners on the server port, and the queue their sessions share.
+//
+// By default there is one listener, on the io_context of the rest of the
+// server. With server.io_threads, every listener has an io_context of its
+// own, run by a single thread pinned to a core, and an SO_REUSEPORT acceptor
+// of its own. The kernel spreads connections across the acceptors, and a
+// session stays on the core that accepted it, so io threads never hand
+// sessions to each other or contend on strands
+class HttpServers
+{
+    RPC::WorkQueue queue_;
+    std::vector<std::unique_ptr<net::io_context>> contexts_;
+    std::vector<std::shared_ptr<HttpServer>> listeners_;
+    std::vector<std::thread> threads_;
+
+    // Bind the calling thread to core. false if that is not supported
+    static bool
+    pin(std::uint32_t core)
+    {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        return pthread_setaffinity_np(
+                   pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+        return false;
+#endif
+    }
+
+public:
+    HttpServers(
+        boost::json::object const& config,
+        boost::asio::io_context& ioc,
+        std::optional<std::reference_wrapper<ssl::context>> sslCtx,
+        tcp::endpoint const& endpoint,
+        std::shared_ptr<BackendInterface const> backend,
+        std::shared_ptr<SubscriptionManager> subscriptions,
+        std::shared_ptr<ETLLoadBalancer> balancer,
+        DOSGuard& dosGuard)
+        : queue_(config)
+    {
+        auto const& serverConfig = config.at("server").as_object();
+        std::uint32_t ioThreads = 0;
+        if (serverConfig.contains("io_threads") &&
+            serverConfig.at("io_threads").is_int64())
+            ioThreads = serverConfig.at("io_threads").as_int64();
+#ifndef SO_REUSEPORT
+        if (ioThreads)
+        {
+            BOOST_LOG_TRIVIAL(warning)
+                << __func__ << " : SO_REUSEPORT is not supported."
+                << " Ignoring io_threads";
+            ioThreads = 0;
+        }
+#endif
+        if (!ioThreads)
+        {
+            listeners_.push_back(std::make_shared<HttpServer>(
+                ioc,
+                sslCtx,
+                endpoint,
+                backend,
+                subscriptions,
+                balancer,
+                dosGuard,
+                queue_));
+            listeners_.back()->run();
+            return;
+        }
+
+        bool const pinThreads = !serverConfig.contains("pin_threads") ||
+            serverConfig.at("pin_threads").as_bool();
+        auto const cores = std::max(std::thread::hardware_concurrency(), 1u);
+        BOOST_LOG_TRIVIAL(info)
+            << __func__ << " : Running " << ioThreads
+            << " io threads with an acceptor each"
+            << (pinThreads ? ", pinned to cores" : "");
+        for (std::uint32_t i = 0; i < ioThreads; ++i)
+        {
+            auto& context =
+                *contexts_.emplace_back(std::make_unique<net::io_context>(1));
+            listeners_.push_back(std::make_shared<HttpServer>(
+                context,
+                sslCtx,
+                endpoint,
+                backend,
+                subscriptions,
+                balancer,
+                dosGuard,
+                queue_,
+                true));
+            listeners_.back()->run();
+            threads_.emplace_back([&context, i, cores, pinThreads]() {
+                if (pinThreads && !pin(i % cores))
+                    BOOST_LOG_TRIVIAL(warning)
+                        << "HttpServers : Could not pin io thread " << i;
+                context.run();
+            });
+        }
+    }
+
+    ~HttpServers()
+    {
+        for (auto& context : contexts_)
+            context->stop();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    RPC::WorkQueue const&
+    queue() const
+    {
+        return queue_;
+    }
+};
+
+static std::shared_ptr<HttpServers>
 make_HttpServer(
     boost::json::object const& config,
     boost::asio::io_context& ioc,
@@ -288,7 +454,8 @@ make_HttpServer(
     auto const port =
         static_cast<unsigned short>(serverConfig.at("port").as_int64());
 
-    auto server = std::make_shared<HttpServer>(
+    return std::make_shared<HttpServers>(
+        config,
         ioc,
         sslCtx,
         boost::asio::ip::tcp::endpoint{address, port},
@@ -296,9 +463,6 @@ make_HttpServer(
         subscriptions,
         balancer,
         dosGuard);
-
-    server->run();
-    return server;
 }
 }  // namespace Server
 
@@ -0,0 +1,334 @@
+#ifndef CLIO_METRICS_SERVER_H_INCLUDED
+#define CLIO_METRICS_SERVER_H_INCLUDED
+
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+#include <rpc/Counters.h>
+#include <webserver/HttpBase.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+// Metrics in the Prometheus text format, served on a port of their own. They
+// are the counters server_info reports, and the subsystems keep them anyway,
+// so a scrape costs about as much as a server_info request.
+namespace Metrics {
+
+class Writer
+{
+    struct Family
+    {
+        char const* type;
+        std::string samples;
+    };
+
+    // the samples of a family have to be written together
+    std::map<std::string, Family> families_;
+
+public:
+    void
+    add(std::string const& family,
+        char const* type,
+        char const* suffix,
+        std::string const& labels,
+        std::string const& value)
+    {
+        std::string name;
+        for (char c : family)
+            name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        auto& samples =
+            families_.emplace(name, Family{type, {}}).first->second.samples;
+        samples += name;
+        samples += suffix;
+        if (!labels.empty())
+        {
+            samples += '{';
+            samples += labels;
+            samples += '}';
+        }
+        samples += ' ';
+        samples += value;
+        samples += '\n';
+    }
+
+    // Add every number in report as a gauge named after its path from name.
+    // Numbers reported as strings count too; other strings are skipped, and
+    // the elements of arrays are labeled with their index
+    void
+    gauges(
+        std::string const& name,
+        boost::json::value const& report,
+        std::string const& labels = {})
+    {
+        switch (report.kind())
+        {
+            case boost::json::kind::object:
+                for (auto const& [key, value] : report.as_object())
+                    gauges(name + "_" + std::string{key}, value, labels);
+                break;
+            case boost::json::kind::array: {
+                auto const& array = report.as_array();
+                for (std::size_t i = 0; i < array.size(); ++i)
+                {
+                    std::string indexLabels =
+                        labels.empty() ? "" : labels + ",";
+                    indexLabels += "index=\"" + std::to_string(i) + "\"";
+                    gauges(name, array[i], indexLabels);
+                }
+                break;
+            }
+            case boost::json::kind::bool_:
+                add(name, "gauge", "", labels, report.as_bool() ? "1" : "0");
+                break;
+            case boost::json::kind::int64:
+            case boost::json::kind::uint64:
+            case boost::json::kind::double_:
+                add(name, "gauge", "", labels, boost::json::serialize(report));
+                break;
+            case boost::json::kind::string: {
+                std::string str = report.as_string().c_str();
+                char* end = nullptr;
+                std::strtod(str.c_str(), &end);
+                if (!str.empty() && *end == '\0')
+                    add(name, "gauge", "", labels, str);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // The RPC counters, labeled by method, and a histogram of the durations
+    // of the finished requests of each method
+    void
+    rpc(RPC::Counters& counters)
+    {
+        using RPC::LatencyBuckets;
+        for (auto const& [method, value] : counters.report())
+        {
+            auto const& report = value.as_object();
+            std::string const labels =
+                "method=\"" + std::string{method} + "\"";
+            for (char const* counter :
+                 {"started",
+                  "finished",
+                  "errored",
+                  "forwarded",
+                  "duration_us",
+                  "forward_connect_us",
+                  "forward_duration_us"})
+            {
+                add(std::string{"clio_rpc_"} + counter,
+                    "counter",
+                    "",
+                    labels,
+                    report.at(counter).as_string().c_str());
+            }
+
+            auto const latencies = counters.latencies(RPC::toMethodID(method));
+            std::uint64_t cumulative = 0;
+            for (std::size_t b = 0; b < latencies.size(); ++b)
+            {
+                cumulative += latencies[b];
+                // a bucket for each power of two
+                if (b % LatencyBuckets::subBuckets !=
+                    LatencyBuckets::subBuckets - 1)
+                    continue;
+                add("clio_rpc_latency_us",
+                    "histogram",
+                    "_bucket",
+                    labels + ",le=\"" +
+                        std::to_string(LatencyBuckets::upperBound(b)) + "\"",
+                    std::to_string(cumulative));
+            }
+            add("clio_rpc_latency_us",
+                "histogram",
+                "_bucket",
+                labels + ",le=\"+Inf\"",
+                std::to_string(cumulative));
+            add("clio_rpc_latency_us",
+                "histogram",
+                "_count",
+                labels,
+                std::to_string(cumulative));
+            add("clio_rpc_latency_us",
+                "histogram",
+                "_sum",
+                labels,
+                report.at("duration_us").as_string().c_str());
+        }
+    }
+
+    std::string
+    str() const
+    {
+        std::string out;
+        for (auto const& [name, family] : families_)
+        {
+            out += "# TYPE " + name + " " + family.type + "\n";
+            out += family.samples;
+        }
+        return out;
+    }
+};
+
+class Session : public std::enable_shared_from_this<Session>
+{
+    boost::beast::tcp_stream stream_;
+    boost::beast::flat_buffer buffer_;
+    http::request<http::string_body> req_;
+    http::response<http::string_body> res_;
+    std::function<std::string()> render_;
+
+public:
+    Session(tcp::socket&& socket, std::function<std::string()> render)
+        : stream_(std::move(socket)), render_(std::move(render))
+    {
+    }
+
+    void
+    run()
+    {
+        req_ = {};
+        stream_.expires_after(std::chrono::seconds(30));
+        http::async_read(
+            stream_,
+            buffer_,
+            req_,
+            boost::beast::bind_front_handler(
+                &Session::on_read, shared_from_this()));
+    }
+
+private:
+    void
+    on_read(boost::beast::error_code ec, std::size_t)
+    {
+        if (ec)
+        {
+            if (ec != http::error::end_of_stream)
+                httpFail(ec, "metrics_read");
+            stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+            return;
+        }
+
+        res_ = {};
+        res_.version(req_.version());
+        res_.keep_alive(req_.keep_alive());
+        res_.set(http::field::server, "clio-server-v0.1");
+        if (req_.method() != http::verb::get || req_.target() != "/metrics")
+        {
+            res_.result(http::status::not_found);
+            res_.set(http::field::content_type, "text/plain");
+            res_.body() = "not found\n";
+        }
+        else
+        {
+            res_.result(http::status::ok);
+            res_.set(http::field::content_type, "text/plain; version=0.0.4");
+            res_.body() = render_();
+        }
+        res_.prepare_payload();
+        http::async_write(
+            stream_,
+            res_,
+            boost::beast::bind_front_handler(
+                &Session::on_write, shared_from_this()));
+    }
+
+    void
+    on_write(boost::beast::error_code ec, std::size_t)
+    {
+        if (ec)
+            return httpFail(ec, "metrics_write");
+        if (!res_.keep_alive())
+        {
+            stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+            return;
+        }
+        run();
+    }
+};
+
+class Server : public std::enable_shared_from_this<Server>
+{
+    net::io_context& ioc_;
+    tcp::acceptor acceptor_;
+    std::function<std::string()> render_;
+
+public:
+    // render is called for every scrape, on the threads of ioc
+    Server(
+        net::io_context& ioc,
+        tcp::endpoint endpoint,
+        std::function<std::string()> render)
+        : ioc_(ioc)
+        , acceptor_(net::make_strand(ioc))
+        , render_(std::move(render))
+    {
+        boost::beast::error_code ec;
+        acceptor_.open(endpoint.protocol(), ec);
+        if (!ec)
+            acceptor_.set_option(net::socket_base::reuse_address(true), ec);
+        if (!ec)
+            acceptor_.bind(endpoint, ec);
+        if (!ec)
+            acceptor_.listen(net::socket_base::max_listen_connections, ec);
+        if (ec)
+            httpFail(ec, "metrics_listen");
+    }
+
+    void
+    run()
+    {
+        if (acceptor_.is_open())
+            accept();
+    }
+
+private:
+    void
+    accept()
+    {
+        acceptor_.async_accept(
+            net::make_strand(ioc_),
+            [self = shared_from_this()](
+                boost::beast::error_code ec, tcp::socket socket) {
+                if (ec)
+                    httpFail(ec, "metrics_accept");
+                else
+                    std::make_shared<Session>(std::move(socket), self->render_)
+                        ->run();
+                self->accept();
+            });
+    }
+};
+
+// The metrics server configured in the metrics section, if any
+inline std::shared_ptr<Server>
+make_MetricsServer(
+    boost::json::object const& config,
+    net::io_context& ioc,
+    std::function<std::string()> render)
+{
+    if (!config.contains("metrics"))
+        return nullptr;
+    auto const& metricsConfig = config.at("metrics").as_object();
+    auto const address =
+        net::ip::make_address(metricsConfig.at("ip").as_string().c_str());
+    auto const port =
+        static_cast<unsigned short>(metricsConfig.at("port").as_int64());
+
+    auto server = std::make_shared<Server>(
+        ioc, tcp::endpoint{address, port}, std::move(render));
+    server->run();
+    return server;
+}
+
+}  // namespace Metrics
+
+#endif  // CLIO_METRICS_SERVER_H_INCLUDED
@@ -36,6 +36,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& buffer)
         : WsSession(
               backend,
@@ -43,6 +44,7 @@ public:
               balancer,
               dosGuard,
               counters,
+              queue,
               std::move(buffer))
         , ws_(std::move(socket))
     {
@@ -78,6 +80,7 @@ class WsUpgrader : public std::enable_shared_from_this<WsUpgrader>
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
     RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
     http::request<http::string_body> req_;
 
 public:
@@ -88,6 +91,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& b)
         : http_(std::move(socket))
         , backend_(backend)
@@ -95,6 +99,7 @@ public:
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , buffer_(std::move(b))
     {
     }
@@ -105,6 +110,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& b,
         http::request<http::string_body> req)
         : http_(std::move(stream))
@@ -113,6 +119,7 @@ public:
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , buffer_(std::move(b))
         , req_(std::move(req))
     {
@@ -167,6 +174,7 @@ private:
             balancer_,
             dosGuard_,
             counters_,
+            queue_,
             std::move(buffer_))
             ->run(std::move(req_));
     }
@@ -34,6 +34,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& b)
         : WsSession(
               backend,
@@ -41,6 +42,7 @@ public:
               balancer,
               dosGuard,
               counters,
+              queue,
               std::move(b))
         , ws_(std::move(stream))
     {
@@ -74,6 +76,7 @@ class SslWsUpgrader : public std::enable_shared_from_this<SslWsUpgrader>
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
     RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
     http::request<http::string_body> req_;
 
 public:
@@ -85,6 +88,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& b)
         : https_(std::move(socket), ctx)
         , backend_(backend)
@@ -92,6 +96,7 @@ public:
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , buffer_(std::move(b))
     {
     }
@@ -102,6 +107,7 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& b,
         http::request<http::string_body> req)
         : https_(std::move(stream))
@@ -110,6 +116,7 @@ public:
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , buffer_(std::move(b))
         , req_(std::move(req))
     {
@@ -179,6 +186,7 @@ private:
             balancer_,
             dosGuard_,
             counters_,
+            queue_,
             std::move(buffer_))
             ->run(std::move(req_));
     }
@@ -4,13 +4,20 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <unordered_set>
 
 #include <backend/BackendInterface.h>
 #include <etl/ETLSource.h>
+#include <log/RequestLog.h>
+#include <log/Trace.h>
+#include <rpc/Batch.h>
 #include <rpc/Counters.h>
+#include <rpc/ResponseCache.h>
 #include <rpc/RPC.h>
+#include <rpc/WorkQueue.h>
 #include <subscriptions/SubscriptionManager.h>
 #include <webserver/DOSGuard.h>
 
@@ -41,14 +48,88 @@ getDefaultWsResponse(boost::json::value const& id)
     return defaultResp;
 }
 
+// A message in the queue of a session. It counts in the depth of the queue of
+// its stream for as long as it is queued. Responses have no stream
+class QueuedMessage
+{
+    std::shared_ptr<std::string const> message_;
+    std::shared_ptr<StreamQueue> stream_;
+
+    void
+    release()
+    {
+        if (!stream_)
+            return;
+        --stream_->messages;
+        stream_->bytes -= message_->size();
+        stream_.reset();
+    }
+
+public:
+    QueuedMessage(
+        std::shared_ptr<std::string const> message,
+        std::shared_ptr<StreamQueue> stream)
+        : message_(std::move(message)), stream_(std::move(stream))
+    {
+        if (!stream_)
+            return;
+        ++stream_->messages;
+        stream_->bytes += message_->size();
+    }
+
+    QueuedMessage(QueuedMessage const&) = delete;
+
+    QueuedMessage(QueuedMessage&& other)
+        : message_(std::move(other.message_))
+        , stream_(std::move(other.stream_))
+    {
+        other.stream_.reset();
+    }
+
+    QueuedMessage&
+    operator=(QueuedMessage&& other)
+    {
+        if (this != &other)
+        {
+            release();
+            message_ = std::move(other.message_);
+            stream_ = std::move(other.stream_);
+            other.stream_.reset();
+        }
+        return *this;
+    }
+
+    ~QueuedMessage()
+    {
+        release();
+    }
+
+    std::string const&
+    message() const
+    {
+        return *message_;
+    }
+
+    StreamQueue*
+    stream() const
+    {
+        return stream_.get();
+    }
+};
+
 class WsBase
 {
     std::atomic_bool dead_ = false;
 
 public:
-    // Send, that enables SubscriptionManager to publish to clients
+    // Send, that enables SubscriptionManager to publish to clients. The
+    // message is shared by every session it is published to, and is sent
+    // without being copied. stream is the stream it is published to, whose
+    // limits apply to the queue of this session
     virtual void
-    send(std::string const& msg) = 0;
+    send(
+        std::shared_ptr<std::string const> msg,
+        std::shared_ptr<StreamQueue> const& stream) = 0;
 
     virtual ~WsBase()
     {
@@ -66,6 +147,13 @@ public:
     {
         return dead_;
     }
+
+protected:
+    void
+    setDead()
+    {
+        dead_ = true;
+    }
 };
 
 class SubscriptionManager;
@@ -88,8 +176,76 @@ class WsSession : public WsBase,
     std::shared_ptr<ETLLoadBalancer> balancer_;
     DOSGuard& dosGuard_;
     RPC::Counters& counters_;
+    RPC::WorkQueue& queue_;
     std::mutex mtx_;
-    std::queue<std::string> messages_;
+    // the front message is being written
+    std::deque<QueuedMessage> messages_;
+    std::size_t queuedBytes_ = 0;
+    // set once the session is over its limits, and is being disconnected
+    bool closing_ = false;
+
+    bool
+    overLimits(QueueLimits const& limits) const
+    {
+        return messages_.size() > limits.maxMessages ||
+            queuedBytes_ > limits.maxBytes;
+    }
+
+    std::deque<QueuedMessage>::iterator
+    drop(std::deque<QueuedMessage>::iterator it)
+    {
+        ++it->stream()->dropped;
+        queuedBytes_ -= it->message().size();
+        return messages_.erase(it);
+    }
+
+    // Bring the queue back within the limits of stream, which the newest
+    // message was published to. Must be called with mtx_ held
+    void
+    applyLimits(StreamQueue& stream)
+    {
+        auto const& limits = stream.limits;
+        if (limits.policy == QueueLimits::Policy::dropOldest)
+        {
+            // responses are never dropped
+            for (auto it = std::next(messages_.begin());
+                 it != messages_.end() && overLimits(limits);)
+            {
+                if (it->stream())
+                    it = drop(it);
+                else
+                    ++it;
+            }
+        }
+        else if (limits.policy == QueueLimits::Policy::coalesce)
+        {
+            // every message of a coalescing stream but the newest is stale
+            std::unordered_set<StreamQueue*> newest;
+            for (auto it = messages_.end();
+                 it != std::next(messages_.begin()) && overLimits(limits);)
+            {
+                --it;
+                auto queue = it->stream();
+                if (!queue || !queue->coalesce ||
+                    newest.insert(queue).second)
+                    continue;
+                it = drop(it);
+            }
+        }
+        if (!overLimits(limits))
+            return;
+
+        BOOST_LOG_TRIVIAL(warning)
+            << __func__ << " disconnecting slow consumer. stream = "
+            << stream.name << " queued messages = " << messages_.size()
+            << " queued bytes = " << queuedBytes_;
+        ++stream.disconnects;
+        closing_ = true;
+        setDead();
+        // the close is sent once the write in flight completes
+        messages_.erase(std::next(messages_.begin()), messages_.end());
+        queuedBytes_ = messages_.front().message().size();
+    }
 
 public:
     explicit WsSession(
@@ -98,12 +254,14 @@ public:
         std::shared_ptr<ETLLoadBalancer> balancer,
         DOSGuard& dosGuard,
         RPC::Counters& counters,
+        RPC::WorkQueue& queue,
         boost::beast::flat_buffer&& buffer)
         : backend_(backend)
         , subscriptions_(subscriptions)
         , balancer_(balancer)
         , dosGuard_(dosGuard)
         , counters_(counters)
+        , queue_(queue)
         , buffer_(std::move(buffer))
     {
     }
@@ -124,29 +282,50 @@ public:
     {
         std::lock_guard<std::mutex> lck(mtx_);
         derived().ws().async_write(
-            boost::asio::buffer(messages_.front()),
+            boost::asio::buffer(messages_.front().message()),
             [shared = shared_from_this()](auto ec, size_t size) {
                 if (ec)
                     return shared->wsFail(ec, "publishToStream");
                 size_t left = 0;
+                bool closing = false;
                 {
                     std::lock_guard<std::mutex> lck(shared->mtx_);
-                    shared->messages_.pop();
+                    shared->queuedBytes_ -=
+                        shared->messages_.front().message().size();
+                    shared->messages_.pop_front();
                     left = shared->messages_.size();
+                    closing = shared->closing_;
                 }
-                if (left > 0)
+                if (closing)
+                    shared->derived().ws().async_close(
+                        websocket::close_reason(
+                            websocket::close_code::policy_error,
+                            "slow consumer"),
+                        [shared](auto ec) {
+                            if (ec)
+                                logError(ec, "close");
+                        });
+                else if (left > 0)
                     shared->sendNext();
             });
     }
 
     void
-    enqueueMessage(std::string&& msg)
+    enqueueMessage(
+        std::shared_ptr<std::string const> msg,
+        std::shared_ptr<StreamQueue> const& stream)
     {
         size_t left = 0;
         {
             std::lock_guard<std::mutex> lck(mtx_);
-            messages_.push(std::move(msg));
+            // a failed session is never written to again
+            if (closing_ || dead())
+                return;
+            queuedBytes_ += msg->size();
+            messages_.emplace_back(std::move(msg), stream);
             left = messages_.size();
+            if (left > 1 && stream && overLimits(stream->limits))
+                applyLimits(*stream);
         }
         // if the queue was previously empty, start the send chain
         if (left == 1)
@@ -154,9 +333,19 @@ public:
     }
 
     void
-    send(std::string const& msg) override
+    send(
+        std::shared_ptr<std::string const> msg,
+        std::shared_ptr<StreamQueue> const& stream) override
     {
-        enqueueMessage(std::string(msg));
+        enqueueMessage(std::move(msg), stream);
+    }
+
+    // Send a message to this session only
+    void
+    send(std::string&& msg)
+    {
+        enqueueMessage(
+            std::make_shared<std::string const>(std::move(msg)), nullptr);
     }
 
     void
@@ -175,6 +364,17 @@ public:
                         " websocket-server-async");
             }));
 
+        // Offer compression to clients that ask for it. Every message is
+        // compressed on its own, with a small window, which keeps the
+        // compression state of each session small
+        websocket::permessage_deflate deflate;
+        deflate.server_enable = true;
+        deflate.server_no_context_takeover = true;
+        deflate.server_max_window_bits = 12;
+        deflate.compLevel = 3;
+        deflate.memLevel = 4;
+        derived().ws().set_option(deflate);
+
         derived().ws().async_accept(
             req,
             boost::beast::bind_front_handler(
@@ -214,92 +414,277 @@ public:
 
         std::string msg{
             static_cast<char const*>(buffer_.data().data()), buffer_.size()};
-        boost::json::object response;
         auto ip = derived().ip();
         BOOST_LOG_TRIVIAL(debug)
             << __func__ << " received request from ip = " << ip;
-        if (!dosGuard_.isOk(ip))
-            response["error"] = "Too many requests. Slow down";
-        else
+
+        // the request is handled on the RPC work queue, in the lane of its
+        // method, and the next request is read once it has been answered
+        auto command = RPC::peekString(msg, "command");
+        // batches are expensive, whatever their requests
+        auto costClass = command == "batch"
+            ? RPC::CostClass::expensive
+            : RPC::costClass(RPC::toMethodID(command));
+        auto shared = shared_from_this();
+        auto work = [shared, msg = std::move(msg), ip](
+                        boost::asio::yield_context yield) {
+            shared->handle_request(msg, ip, yield);
+            net::dispatch(
+                shared->derived().ws().get_executor(),
+                boost::beast::bind_front_handler(&WsSession::do_read, shared));
+        };
+        auto shed = [shared]() {
+            shared->send(boost::json::serialize(
+                RPC::make_error(RPC::Error::rpcTOO_BUSY)));
+            net::dispatch(
+                shared->derived().ws().get_executor(),
+                boost::beast::bind_front_handler(&WsSession::do_read, shared));
+        };
+        if (!queue_.post(costClass, std::move(work), std::move(shed)))
+        {
+            send(boost::json::serialize(
+                RPC::make_error(RPC::Error::rpcTOO_BUSY)));
+            do_read();
+        }
+    }
+
+    static bool
+    isBatch(boost::json::object const& request)
+    {
+        auto command = request.find("command");
+        return command != request.end() && command->value().is_string() &&
+            command->value().as_string() == "batch";
+    }
+
+    // The serialized response to request. Adds the objects it read from
+    // the database to dbReads. The handler suspends yield, if set, while it
+    // waits on the database
+    std::string
+    buildResponse(
+        boost::json::object const& request,
+        Backend::LedgerRange const& range,
+        std::string const& ip,
+        std::uint64_t& dbReads,
+        std::optional<boost::asio::yield_context> yield = {})
+    {
+        try
         {
-            auto sendError = [this](auto error) {
-                send(boost::json::serialize(RPC::make_error(error)));
-            };
-            try
+            std::optional<RPC::Context> context = RPC::make_WsContext(
+                request,
+                backend_,
+                subscriptions_.lock(),
+                balancer_,
+                shared_from_this(),
+                range,
+                counters_,
+                ip);
+
+            if (!context)
+                return boost::json::serialize(
+                    RPC::make_error(RPC::Error::rpcBAD_SYNTAX));
+            context->yield = std::move(yield);
+
+            Log::requestLog().record("ws", context->method, context->params);
+
+            Trace::Span span{"rpc"};
+            span.attribute("method", context->method);
+
+            auto id = request.contains("id") ? request.at("id") : nullptr;
+
+            auto response = getDefaultWsResponse(id);
+            boost::json::object& result = response["result"].as_object();
+
+            auto& responseCache = RPC::responseCache();
+            std::optional<RPC::ResponseCache::Key> cacheKey;
+            if (responseCache.enabled())
+                cacheKey = RPC::ResponseCache::key(*context, "ws");
+
+            auto start = std::chrono::system_clock::now();
+            if (cacheKey)
             {
-                boost::json::value raw = boost::json::parse(msg);
-                boost::json::object request = raw.as_object();
-                BOOST_LOG_TRIVIAL(debug) << " received request : " << request;
-                try
+                auto cached = [&]() {
+                    Trace::Span cacheSpan{"response_cache"};
+                    auto cached = responseCache.get(*cacheKey);
+                    cacheSpan.attribute("hit", static_cast<bool>(cached));
+                    return cached;
+                }();
+                if (cached)
                 {
-                    auto range = backend_->fetchLedgerRange();
-                    if (!range)
-                        return sendError(RPC::Error::rpcNOT_READY);
-
-                    std::optional<RPC::Context> context = RPC::make_WsContext(
-                        request,
-                        backend_,
-                        subscriptions_.lock(),
-                        balancer_,
-                        shared_from_this(),
-                        *range,
-                        counters_,
-                        ip);
-
-                    if (!context)
-                        return sendError(RPC::Error::rpcBAD_SYNTAX);
-
-                    auto id =
-                        request.contains("id") ? request.at("id") : nullptr;
-
-                    response = getDefaultWsResponse(id);
-                    boost::json::object& result =
-                        response["result"].as_object();
-
-                    auto start = std::chrono::system_clock::now();
-                    auto v = RPC::buildResponse(*context);
-                    auto end = std::chrono::system_clock::now();
-                    auto us =
+                    counters_.rpcComplete(
+                        context->methodID,
                         std::chrono::duration_cast<std::chrono::microseconds>(
-                            end - start);
-
-                    if (auto status = std::get_if<RPC::Status>(&v))
-                    {
-                        counters_.rpcErrored(context->method);
-                        auto error = RPC::make_error(*status);
-
-                        if (!id.is_null())
-                            error["id"] = id;
-                        error["request"] = request;
-                        result = error;
-                    }
-                    else
-                    {
-                        counters_.rpcComplete(context->method, us);
-                        result = std::get<boost::json::object>(v);
-                    }
+                            std::chrono::system_clock::now() - start));
+                    return RPC::wsResponseBody(response, *cached);
                 }
-                catch (Backend::DatabaseTimeout const& t)
+            }
+
+            auto v = [&context]() {
+                Trace::Span handlerSpan{"handler"};
+                Backend::ReadCounter::Scope reads{context->dbReads};
+                return RPC::buildResponse(*context);
+            }();
+            dbReads += context->dbReads;
+            span.attribute("db_reads", context->dbReads);
+            auto end = std::chrono::system_clock::now();
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                end - start);
+
+            Trace::Span serializeSpan{"serialize"};
+            if (auto status = std::get_if<RPC::Status>(&v))
+            {
+                counters_.rpcErrored(context->methodID);
+                auto error = RPC::make_error(*status);
+                span.attribute("error", error["error"]);
+
+                if (!id.is_null())
+                    error["id"] = id;
+                error["request"] = request;
+                result = error;
+            }
+            else
+            {
+                counters_.rpcComplete(context->methodID, us);
+                // copied out of the arena, as response outlives it
+                result = std::move(std::get<boost::json::object>(v));
+                if (cacheKey)
                 {
-                    BOOST_LOG_TRIVIAL(error) << __func__ << " Database timeout";
-                    return sendError(RPC::Error::rpcNOT_READY);
+                    auto serialized = std::make_shared<std::string const>(
+                        boost::json::serialize(result));
+                    responseCache.put(
+                        *cacheKey,
+                        RPC::ResponseCache::ledgerOf(result),
+                        serialized);
+                    return RPC::wsResponseBody(response, *serialized);
                 }
             }
-            catch (std::exception const& e)
-            {
-                BOOST_LOG_TRIVIAL(error)
-                    << __func__ << " caught exception : " << e.what();
+            BOOST_LOG_TRIVIAL(trace)
+                << __func__ << " : " << boost::json::serialize(response);
+            return boost::json::serialize(response);
+        }
+        catch (Backend::DatabaseTimeout const& t)
+        {
+            BOOST_LOG_TRIVIAL(error) << __func__ << " Database timeout";
+            return boost::json::serialize(
+                RPC::make_error(RPC::Error::rpcNOT_READY));
+        }
+    }
 
-                return sendError(RPC::Error::rpcINTERNAL);
-            }
+    // The serialized response to a batch command, whose result holds the
+    // responses to its requests, in order. Adds the objects they read from
+    // the database to dbReads
+    std::string
+    buildBatchResponse(
+        boost::json::object const& batch,
+        Backend::LedgerRange const& range,
+        std::string const& ip,
+        std::uint64_t& dbReads)
+    {
+        auto id = batch.contains("id") ? batch.at("id") : nullptr;
+        auto error = [&id](RPC::Status const& status) {
+            auto response = getDefaultWsResponse(id);
+            response["result"] = RPC::make_error(status);
+            return boost::json::serialize(response);
+        };
+        if (!batch.contains("requests") || !batch.at("requests").is_array())
+            return error({RPC::Error::rpcINVALID_PARAMS, "missingRequests"});
+        auto const& requests = batch.at("requests").as_array();
+        if (requests.size() > RPC::maxBatchSize)
+            return error({RPC::Error::rpcINVALID_PARAMS, "batchTooLarge"});
+
+        std::vector<boost::json::object const*> params;
+        params.reserve(requests.size());
+        for (auto const& request : requests)
+            params.push_back(
+                request.is_object() ? &request.as_object() : nullptr);
+
+        auto responses = RPC::runBatch(
+            *backend_,
+            range,
+            params,
+            [&](std::size_t i, std::uint64_t& reads) {
+                // batches do not nest
+                if (!params[i] || isBatch(*params[i]))
+                    return boost::json::serialize(
+                        RPC::make_error(RPC::Error::rpcBAD_SYNTAX));
+                try
+                {
+                    return buildResponse(*params[i], range, ip, reads);
+                }
+                catch (std::exception const& e)
+                {
+                    BOOST_LOG_TRIVIAL(error)
+                        << __func__ << " caught exception : " << e.what();
+                    return boost::json::serialize(
+                        RPC::make_error(RPC::Error::rpcINTERNAL));
+                }
+            },
+            dbReads);
+
+        boost::json::object response = getDefaultWsResponse(id);
+        return RPC::wsResponseBody(
+            response, "{\"responses\":" + RPC::joinResponses(responses) + "}");
+    }
+
+    // A request that is not a batch runs on the coroutine of yield
+    void
+    handle_request(
+        std::string const& msg,
+        std::string const& ip,
+        boost::asio::yield_context yield)
+    {
+        // objects the request read from the database
+        std::uint64_t dbReads = 0;
+        auto sendResponse = [this, &ip, &dbReads](std::string responseStr) {
+            dosGuard_.add(ip, dosGuard_.cost(responseStr.size(), dbReads));
+            send(std::move(responseStr));
+        };
+        Trace::Request trace{"ws"};
+        trace.attribute("bytes", msg.size());
+        bool allowed;
+        {
+            Trace::Span span{"dos_guard"};
+            allowed = dosGuard_.isOk(ip);
+        }
+        if (!allowed)
+        {
+            boost::json::object response;
+            response["error"] = "Too many requests. Slow down";
+            return sendResponse(boost::json::serialize(response));
         }
-        BOOST_LOG_TRIVIAL(trace)
-            << __func__ << " : " << boost::json::serialize(response);
 
-        std::string responseStr = boost::json::serialize(response);
-        dosGuard_.add(ip, responseStr.size());
-        send(std::move(responseStr));
-        do_read();
+        auto sendError = [this](auto error) {
+            send(boost::json::serialize(RPC::make_error(error)));
+        };
+        try
+        {
+            boost::json::value raw = [&msg]() {
+                Trace::Span parseSpan{"parse"};
+                return boost::json::parse(msg);
+            }();
+            boost::json::object request = raw.as_object();
+            BOOST_LOG_TRIVIAL(debug) << " received request : " << request;
+
+            auto range = backend_->fetchLedgerRange();
+            if (!range)
+                return sendError(RPC::Error::rpcNOT_READY);
+
+            if (isBatch(request))
+                return sendResponse(
+                    buildBatchResponse(request, *range, ip, dbReads));
+            sendResponse(buildResponse(request, *range, ip, dbReads, yield));
+        }
+        catch (Backend::DatabaseTimeout const& t)
+        {
+            BOOST_LOG_TRIVIAL(error) << __func__ << " Database timeout";
+            sendError(RPC::Error::rpcNOT_READY);
+        }
+        catch (std::exception const& e)
+        {
+            BOOST_LOG_TRIVIAL(error)
+                << __func__ << " caught exception : " << e.what();
+
+            sendError(RPC::Error::rpcINTERNAL);
+        }
     }
 };
 
@@ -0,0 +1,191 @@
+#include <boost/json.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <backend/BackendFactory.h>
+#include <backend/BlobCodec.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// clio_dict trains the zstd dictionaries of BlobCodec on the database of a
+// clio config. It samples the objects of the most recent ledger, and the
+// transactions and metadata of the most recent ledgers, and writes one
+// dictionary per table:
+//
+//     clio_dict config.json --out ./dictionaries
+//
+// List the dictionaries under compression.dictionaries of the config of
+// every node that reads the database before the writer compresses with
+// them. Rows compressed with the dictionaries of the config are sampled
+// decompressed, so dictionaries can be retrained. The database is only read
+
+namespace {
+
+struct Options
+{
+    std::string config;
+    std::string out = ".";
+    // objects sampled, from the most recent ledger
+    std::uint32_t objects = 100000;
+    // transactions sampled, from the most recent ledgers back
+    std::uint32_t transactions = 100000;
+    // the maximum size of a dictionary, in bytes
+    std::uint32_t size = 112640;
+};
+
+void
+usage()
+{
+    std::cerr
+        << "usage: clio_dict <config> [options]\n"
+        << "  --out <dir>               default .\n"
+        << "  --objects <count>         objects sampled. default 100000\n"
+        << "  --transactions <count>    transactions sampled. default 100000\n"
+        << "  --size <bytes>            dictionary size. default 112640\n";
+}
+
+std::optional<Options>
+parseOptions(int argc, char* argv[])
+{
+    if (argc < 2)
+        return {};
+    Options options;
+    options.config = argv[1];
+    for (int i = 2; i < argc; i += 2)
+    {
+        std::string const name = argv[i];
+        if (i + 1 == argc)
+            return {};
+        std::string const value = argv[i + 1];
+        if (name == "--out")
+            options.out = value;
+        else if (name == "--objects")
+            options.objects = std::stoul(value);
+        else if (name == "--transactions")
+            options.transactions = std::stoul(value);
+        else if (name == "--size")
+            options.size = std::stoul(value);
+        else
+            return {};
+    }
+    if (!options.size)
+        return {};
+    return options;
+}
+
+std::optional<boost::json::object>
+parseConfig(std::string const& path)
+{
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    if (!in)
+        return {};
+    std::stringstream contents;
+    contents << in.rdbuf();
+    auto value = boost::json::parse(contents.str());
+    if (!value.is_object())
+        return {};
+    return value.as_object();
+}
+
+std::string
+toString(Backend::Blob const& blob)
+{
+    return {blob.begin(), blob.end()};
+}
+
+void
+write(
+    Backend::BlobTable table,
+    std::vector<std::string> const& samples,
+    Options const& options)
+{
+    auto const name = Backend::toString(table);
+    auto const path = options.out + "/" + name + ".dict";
+    auto const dict = Backend::BlobCodec::train(samples, options.size);
+    std::ofstream out{path, std::ios::out | std::ios::binary};
+    out << dict;
+    if (!out)
+        throw std::runtime_error("could not write " + path);
+    std::cout << name << ": " << samples.size() << " samples, "
+              << dict.size() << " byte dictionary written to " << path
+              << std::endl;
+}
+
+}  // namespace
+
+int
+main(int argc, char* argv[])
+{
+    auto options = parseOptions(argc, argv);
+    if (!options)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    auto config = parseConfig(options->config);
+    if (!config)
+    {
+        std::cerr << "could not read " << options->config << std::endl;
+        return EXIT_FAILURE;
+    }
+    (*config)["read_only"] = true;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    try
+    {
+        auto backend = Backend::make_Backend(*config);
+        auto range = backend->fetchLedgerRange();
+        if (!range)
+        {
+            std::cerr << "the database holds no ledgers" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<std::string> objects;
+        std::optional<ripple::uint256> cursor;
+        while (objects.size() < options->objects)
+        {
+            auto page =
+                backend->fetchLedgerPage(cursor, range->maxSequence, 2048);
+            for (auto const& object : page.objects)
+                objects.push_back(toString(object.blob));
+            cursor = page.cursor;
+            if (!cursor)
+                break;
+        }
+        objects.resize(std::min<std::size_t>(objects.size(), options->objects));
+
+        std::vector<std::string> transactions;
+        std::vector<std::string> metadata;
+        for (auto seq = range->maxSequence;
+             seq >= range->minSequence &&
+             transactions.size() < options->transactions;
+             --seq)
+        {
+            for (auto const& txn : backend->fetchAllTransactionsInLedger(seq))
+            {
+                transactions.push_back(toString(txn.transaction));
+                metadata.push_back(toString(txn.metadata));
+            }
+            if (seq == 0)
+                break;
+        }
+
+        write(Backend::BlobTable::objects, objects, *options);
+        write(Backend::BlobTable::transactions, transactions, *options);
+        write(Backend::BlobTable::metadata, metadata, *options);
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
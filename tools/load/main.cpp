@@ -0,0 +1,699 @@
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/json.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <rpc/Counters.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// clio_load sends requests to a clio server at a target rate, over http or
+// websocket, and reports the throughput and the latency percentiles of each
+// method. Requests are replayed from a request log captured by a server
+// with request_log set, or drawn from a weighted mix of requests:
+//
+//     [{"weight":8,"method":"account_info","params":{"account":"r..."}},
+//      {"weight":1,"method":"book_offers","params":{...}}]
+//
+// Requests are sent at the times of a schedule, by as many connections as
+// are asked for, and their latency is measured from the time they were
+// scheduled at. A server that falls behind the rate is not given time to
+// catch up: the requests that wait for a connection count that wait.
+// Subscriber sessions stay subscribed to streams while the load runs.
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    std::string port = "51233";
+    std::string transport = "ws";
+    // requests per second. 0 replays a request log at its own pace
+    double rate = 0;
+    // seconds. 0 runs through the whole request log once
+    double duration = 0;
+    // how much faster than captured a request log is replayed
+    double speed = 1;
+    std::uint32_t connections = 16;
+    std::uint32_t subscribers = 0;
+    std::vector<std::string> streams = {"ledger"};
+    std::string replay;
+    std::string mix;
+    std::string out;
+};
+
+void
+usage()
+{
+    std::cerr
+        << "usage: clio_load (--replay <log> | --mix <mix>) [options]\n"
+        << "  --host <host>             default 127.0.0.1\n"
+        << "  --port <port>             default 51233\n"
+        << "  --transport <ws|http>     default ws\n"
+        << "  --rate <requests/s>       required with --mix. A log is\n"
+        << "                            replayed at its own pace if unset\n"
+        << "  --speed <factor>          replay the log this much faster\n"
+        << "  --duration <seconds>      required with --mix\n"
+        << "  --connections <count>     default 16\n"
+        << "  --subscribers <count>     sessions subscribed to --streams\n"
+        << "  --streams <a,b,...>       default ledger\n"
+        << "  --out <file>              also write the report as JSON\n";
+}
+
+std::vector<std::string>
+split(std::string const& str, char separator)
+{
+    std::vector<std::string> parts;
+    std::string::size_type begin = 0;
+    while (begin <= str.size())
+    {
+        auto end = str.find(separator, begin);
+        if (end == std::string::npos)
+            end = str.size();
+        if (end > begin)
+            parts.push_back(str.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return parts;
+}
+
+std::optional<Options>
+parseOptions(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string const name = argv[i];
+        if (i + 1 == argc)
+            return {};
+        std::string const value = argv[i + 1];
+        if (name == "--host")
+            options.host = value;
+        else if (name == "--port")
+            options.port = value;
+        else if (name == "--transport")
+            options.transport = value;
+        else if (name == "--rate")
+            options.rate = std::stod(value);
+        else if (name == "--speed")
+            options.speed = std::stod(value);
+        else if (name == "--duration")
+            options.duration = std::stod(value);
+        else if (name == "--connections")
+            options.connections = std::max(std::stoul(value), 1ul);
+        else if (name == "--subscribers")
+            options.subscribers = std::stoul(value);
+        else if (name == "--streams")
+            options.streams = split(value, ',');
+        else if (name == "--replay")
+            options.replay = value;
+        else if (name == "--mix")
+            options.mix = value;
+        else if (name == "--out")
+            options.out = value;
+        else
+            return {};
+    }
+    if (options.replay.empty() == options.mix.empty())
+        return {};
+    if (!options.mix.empty() && (!options.rate || !options.duration))
+        return {};
+    if (options.transport != "ws" && options.transport != "http")
+        return {};
+    if (options.speed <= 0)
+        return {};
+    return options;
+}
+
+struct Request
+{
+    // when to send the request, since the start of the load
+    std::chrono::microseconds at;
+    std::string method;
+    std::string body;
+};
+
+// The body of a request of method with params, over transport
+std::string
+serialize(
+    std::string const& transport,
+    std::string const& method,
+    boost::json::object params,
+    std::size_t id)
+{
+    if (transport == "http")
+    {
+        boost::json::object request;
+        request["method"] = method;
+        request["params"] = boost::json::array{};
+        request["params"].as_array().push_back(std::move(params));
+        return boost::json::serialize(request);
+    }
+    params["command"] = method;
+    params["id"] = id;
+    return boost::json::serialize(params);
+}
+
+// The requests of a request log, at the times they were captured, or at
+// options.rate if it is set
+std::vector<Request>
+loadReplay(Options const& options)
+{
+    std::ifstream file{options.replay};
+    if (!file)
+        throw std::runtime_error("could not open " + options.replay);
+    std::vector<Request> requests;
+    std::optional<std::int64_t> first;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+        auto const captured = boost::json::parse(line).as_object();
+        auto const t = captured.at("t_us").as_int64();
+        if (!first)
+            first = t;
+        std::chrono::microseconds at{
+            options.rate ? static_cast<std::int64_t>(
+                               requests.size() * 1000000 / options.rate)
+                         : static_cast<std::int64_t>(
+                               (t - *first) / options.speed)};
+        if (options.duration &&
+            at > std::chrono::duration<double>(options.duration))
+            break;
+        std::string method = captured.at("method").as_string().c_str();
+        auto body = serialize(
+            options.transport,
+            method,
+            captured.at("params").as_object(),
+            requests.size());
+        requests.push_back({at, std::move(method), std::move(body)});
+    }
+    return requests;
+}
+
+// options.rate requests a second for options.duration seconds, drawn from
+// the weighted requests of a mix
+std::vector<Request>
+loadMix(Options const& options)
+{
+    std::ifstream file{options.mix};
+    if (!file)
+        throw std::runtime_error("could not open " + options.mix);
+    std::string json{
+        std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    auto const mix = boost::json::parse(json).as_array();
+    std::vector<double> weights;
+    for (auto const& entry : mix)
+        weights.push_back(
+            entry.as_object().contains("weight")
+                ? boost::json::value_to<double>(entry.at("weight"))
+                : 1.0);
+
+    std::mt19937_64 rng{std::random_device{}()};
+    std::discrete_distribution<std::size_t> pick{
+        weights.begin(), weights.end()};
+    auto const count =
+        static_cast<std::size_t>(options.rate * options.duration);
+    std::vector<Request> requests;
+    requests.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto const& entry = mix.at(pick(rng)).as_object();
+        std::string method = entry.at("method").as_string().c_str();
+        boost::json::object params;
+        if (entry.contains("params"))
+            params = entry.at("params").as_object();
+        auto body =
+            serialize(options.transport, method, std::move(params), i);
+        requests.push_back(
+            {std::chrono::microseconds{
+                 static_cast<std::int64_t>(i * 1000000 / options.rate)},
+             std::move(method),
+             std::move(body)});
+    }
+    return requests;
+}
+
+// whether a response reports success
+bool
+succeeded(std::string const& response)
+{
+    boost::json::value parsed;
+    try
+    {
+        parsed = boost::json::parse(response);
+    }
+    catch (std::exception const&)
+    {
+        return false;
+    }
+    if (!parsed.is_object())
+        return false;
+    auto const& obj = parsed.as_object();
+    if (obj.contains("error"))
+        return false;
+    if (obj.contains("result") && obj.at("result").is_object() &&
+        obj.at("result").as_object().contains("error"))
+        return false;
+    return true;
+}
+
+// A connection that sends one request at a time, and reconnects if it fails
+class Client
+{
+public:
+    virtual ~Client() = default;
+
+    // the response to body
+    virtual std::string
+    call(std::string const& body) = 0;
+
+    // drop the connection, so the next call makes a new one
+    virtual void
+    reset() = 0;
+};
+
+class HttpClient : public Client
+{
+    net::io_context ioc_;
+    std::string const host_;
+    tcp::resolver::results_type const endpoints_;
+    std::optional<beast::tcp_stream> stream_;
+
+public:
+    HttpClient(Options const& options)
+        : host_(options.host)
+        , endpoints_(tcp::resolver{ioc_}.resolve(options.host, options.port))
+    {
+    }
+
+    std::string
+    call(std::string const& body) override
+    {
+        if (!stream_)
+        {
+            stream_.emplace(ioc_);
+            stream_->connect(endpoints_);
+        }
+        http::request<http::string_body> req{http::verb::post, "/", 11};
+        req.set(http::field::host, host_);
+        req.set(http::field::content_type, "application/json");
+        req.keep_alive(true);
+        req.body() = body;
+        req.prepare_payload();
+        http::write(*stream_, req);
+
+        beast::flat_buffer buffer;
+        http::response<http::string_body> res;
+        http::read(*stream_, buffer, res);
+        if (!res.keep_alive())
+            stream_.reset();
+        if (res.result() != http::status::ok)
+            return {};
+        return std::move(res.body());
+    }
+
+    void
+    reset() override
+    {
+        stream_.reset();
+    }
+};
+
+class WsClient : public Client
+{
+    net::io_context ioc_;
+    std::string const host_;
+    tcp::resolver::results_type const endpoints_;
+    std::optional<websocket::stream<tcp::socket>> ws_;
+
+public:
+    WsClient(Options const& options)
+        : host_(options.host)
+        , endpoints_(tcp::resolver{ioc_}.resolve(options.host, options.port))
+    {
+    }
+
+    std::string
+    call(std::string const& body) override
+    {
+        if (!ws_)
+        {
+            ws_.emplace(ioc_);
+            net::connect(ws_->next_layer(), endpoints_);
+            ws_->handshake(host_, "/");
+        }
+        ws_->write(net::buffer(body));
+        beast::flat_buffer buffer;
+        ws_->read(buffer);
+        return beast::buffers_to_string(buffer.data());
+    }
+
+    void
+    reset() override
+    {
+        ws_.reset();
+    }
+};
+
+struct MethodStats
+{
+    std::uint64_t count = 0;
+    std::uint64_t errors = 0;
+    std::array<std::uint64_t, RPC::LatencyBuckets::count> latencies{};
+
+    void
+    add(MethodStats const& other)
+    {
+        count += other.count;
+        errors += other.errors;
+        for (std::size_t i = 0; i < latencies.size(); ++i)
+            latencies[i] += other.latencies[i];
+    }
+
+    // the upper bound of the bucket of the quantile of latencies, in
+    // microseconds
+    std::uint64_t
+    percentile(double quantile) const
+    {
+        auto const rank =
+            static_cast<std::uint64_t>(std::ceil(quantile * count));
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < latencies.size(); ++b)
+        {
+            seen += latencies[b];
+            if (seen >= rank && seen)
+                return RPC::LatencyBuckets::upperBound(b);
+        }
+        return 0;
+    }
+};
+
+using Stats = std::map<std::string, MethodStats>;
+
+// Send the requests of the schedule that no other worker took, each once
+// its time has come
+void
+work(
+    Options const& options,
+    std::vector<Request> const& requests,
+    std::atomic_size_t& next,
+    clock_type::time_point start,
+    Stats& stats)
+{
+    std::unique_ptr<Client> client;
+    if (options.transport == "http")
+        client = std::make_unique<HttpClient>(options);
+    else
+        client = std::make_unique<WsClient>(options);
+
+    for (auto i = next++; i < requests.size(); i = next++)
+    {
+        auto const& request = requests[i];
+        auto const scheduled = start + request.at;
+        std::this_thread::sleep_until(scheduled);
+        bool ok = false;
+        try
+        {
+            ok = succeeded(client->call(request.body));
+        }
+        catch (std::exception const&)
+        {
+            client->reset();
+        }
+        auto const latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                clock_type::now() - scheduled);
+        auto& methodStats = stats[request.method];
+        ++methodStats.count;
+        if (!ok)
+            ++methodStats.errors;
+        ++methodStats.latencies[RPC::LatencyBuckets::bucket(latency.count())];
+    }
+}
+
+struct SubscriberStats
+{
+    std::atomic_uint64_t open{0};
+    std::atomic_uint64_t failed{0};
+    std::atomic_uint64_t messages{0};
+};
+
+// A websocket session that subscribes to streams, and reads what they
+// publish until it is closed
+class Subscriber : public std::enable_shared_from_this<Subscriber>
+{
+    websocket::stream<beast::tcp_stream> ws_;
+    std::string const host_;
+    std::string const subscribe_;
+    beast::flat_buffer buffer_;
+    SubscriberStats& stats_;
+    bool opened_ = false;
+    bool closing_ = false;
+
+    void
+    fail()
+    {
+        if (closing_)
+            return;
+        if (opened_)
+            --stats_.open;
+        opened_ = false;
+        ++stats_.failed;
+    }
+
+    void
+    read()
+    {
+        ws_.async_read(
+            buffer_,
+            [self = shared_from_this()](beast::error_code ec, std::size_t) {
+                if (ec)
+                    return self->fail();
+                ++self->stats_.messages;
+                self->buffer_.consume(self->buffer_.size());
+                self->read();
+            });
+    }
+
+public:
+    Subscriber(
+        net::io_context& ioc,
+        Options const& options,
+        SubscriberStats& stats)
+        : ws_(ioc)
+        , host_(options.host)
+        , subscribe_([&options]() {
+            boost::json::object request;
+            request["command"] = "subscribe";
+            request["streams"] = boost::json::array{};
+            for (auto const& stream : options.streams)
+                request["streams"].as_array().push_back(stream.c_str());
+            return boost::json::serialize(request);
+        }())
+        , stats_(stats)
+    {
+    }
+
+    void
+    run(tcp::resolver::results_type const& endpoints)
+    {
+        beast::get_lowest_layer(ws_).async_connect(
+            endpoints,
+            [self = shared_from_this()](
+                beast::error_code ec, tcp::endpoint const&) {
+                if (ec)
+                    return self->fail();
+                self->ws_.async_handshake(
+                    self->host_, "/", [self](beast::error_code ec) {
+                        if (ec)
+                            return self->fail();
+                        self->opened_ = true;
+                        ++self->stats_.open;
+                        self->ws_.async_write(
+                            net::buffer(self->subscribe_),
+                            [self](beast::error_code ec, std::size_t) {
+                                if (ec)
+                                    return self->fail();
+                                self->read();
+                            });
+                    });
+            });
+    }
+
+    void
+    close()
+    {
+        closing_ = true;
+        beast::get_lowest_layer(ws_).cancel();
+    }
+};
+
+boost::json::object
+toJson(MethodStats const& stats, double seconds)
+{
+    boost::json::object obj;
+    obj["count"] = stats.count;
+    obj["errors"] = stats.errors;
+    obj["throughput"] = stats.count / seconds;
+    obj["p50_us"] = stats.percentile(0.5);
+    obj["p99_us"] = stats.percentile(0.99);
+    obj["p999_us"] = stats.percentile(0.999);
+    return obj;
+}
+
+void
+printRow(std::string const& method, MethodStats const& stats, double seconds)
+{
+    std::cout << std::left << std::setw(24) << method << std::right
+              << std::setw(10) << stats.count << std::setw(8) << stats.errors
+              << std::setw(12) << std::fixed << std::setprecision(1)
+              << stats.count / seconds << std::setw(10)
+              << stats.percentile(0.5) << std::setw(10)
+              << stats.percentile(0.99) << std::setw(10)
+              << stats.percentile(0.999) << "\n";
+}
+
+}  // namespace
+
+int
+main(int argc, char* argv[])
+{
+    auto options = parseOptions(argc, argv);
+    if (!options)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Request> requests;
+    try
+    {
+        requests = options->replay.empty() ? loadMix(*options)
+                                           : loadReplay(*options);
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "could not load requests: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    if (requests.empty())
+    {
+        std::cerr << "no requests to send\n";
+        return EXIT_FAILURE;
+    }
+
+    net::io_context ioc;
+    SubscriberStats subscriberStats;
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+    std::thread subscriberThread;
+    if (options->subscribers)
+    {
+        auto endpoints =
+            tcp::resolver{ioc}.resolve(options->host, options->port);
+        for (std::uint32_t i = 0; i < options->subscribers; ++i)
+        {
+            subscribers.push_back(
+                std::make_shared<Subscriber>(ioc, *options, subscriberStats));
+            subscribers.back()->run(endpoints);
+        }
+        subscriberThread = std::thread{[&ioc]() { ioc.run(); }};
+    }
+
+    std::cout << "sending " << requests.size() << " requests over "
+              << options->connections << " " << options->transport
+              << " connections to " << options->host << ":" << options->port
+              << "\n";
+    std::atomic_size_t next = 0;
+    std::vector<Stats> stats(options->connections);
+    std::vector<std::thread> workers;
+    auto const start = clock_type::now();
+    for (std::uint32_t i = 0; i < options->connections; ++i)
+        workers.emplace_back([&, i]() {
+            try
+            {
+                work(*options, requests, next, start, stats[i]);
+            }
+            catch (std::exception const& e)
+            {
+                std::cerr << "connection " << i << " failed: " << e.what()
+                          << "\n";
+            }
+        });
+    for (auto& worker : workers)
+        worker.join();
+    std::chrono::duration<double> const elapsed = clock_type::now() - start;
+    auto const seconds = elapsed.count();
+
+    if (options->subscribers)
+    {
+        net::post(ioc, [&subscribers]() {
+            for (auto& subscriber : subscribers)
+                subscriber->close();
+        });
+        subscriberThread.join();
+    }
+
+    Stats total;
+    for (auto const& workerStats : stats)
+    {
+        for (auto const& [method, methodStats] : workerStats)
+            total[method].add(methodStats);
+    }
+    MethodStats all;
+    for (auto const& [method, methodStats] : total)
+        all.add(methodStats);
+
+    std::cout << std::left << std::setw(24) << "method" << std::right
+              << std::setw(10) << "count" << std::setw(8) << "errors"
+              << std::setw(12) << "req/s" << std::setw(10) << "p50_us"
+              << std::setw(10) << "p99_us" << std::setw(10) << "p999_us"
+              << "\n";
+    for (auto const& [method, methodStats] : total)
+        printRow(method, methodStats, seconds);
+    printRow("all", all, seconds);
+    if (options->subscribers)
+        std::cout << "subscribers: " << subscriberStats.open.load()
+                  << " open at the end, " << subscriberStats.failed.load()
+                  << " failed, " << subscriberStats.messages.load()
+                  << " messages\n";
+
+    if (!options->out.empty())
+    {
+        boost::json::object report;
+        report["seconds"] = seconds;
+        report["all"] = toJson(all, seconds);
+        boost::json::object methods;
+        for (auto const& [method, methodStats] : total)
+            methods[method] = toJson(methodStats, seconds);
+        report["methods"] = std::move(methods);
+        report["subscribers"] = {
+            {"sessions", options->subscribers},
+            {"failed", subscriberStats.failed.load()},
+            {"messages", subscriberStats.messages.load()}};
+        std::ofstream{options->out} << boost::json::serialize(report) << "\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -6,8 +6,29 @@
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
 #include <boost/log/trivial.hpp>
+#include <fstream>
+#include <future>
+#include <map>
+#include <random>
+#include <thread>
+#include <backend/AccountTxCache.h>
 #include <backend/BackendFactory.h>
+#include <backend/BlobCodec.h>
+#include <backend/CacheSnapshot.h>
+#include <backend/ConcurrencyLimiter.h>
+#include <backend/SingleFlight.h>
+#include <backend/TransactionCache.h>
+#include <backend/TrustLineCache.h>
 #include <backend/BackendInterface.h>
+#include <etl/ETLHelpers.h>
+#include <etl/StreamMessage.h>
+#include <log/RequestLog.h>
+#include <log/Trace.h>
+#include <rpc/Batch.h>
+#include <rpc/ResponseCache.h>
+#include <rpc/WorkQueue.h>
+#include <webserver/DOSGuard.h>
+#include <webserver/MetricsServer.h>
 
 TEST(BackendTest, Basic)
 {
@@ -324,6 +345,69 @@ TEST(BackendTest, Basic)
                 (const char*)obj->data(), (const char*)accountBlob.data());
             obj = backend->fetchLedgerObject(key256, lgrInfoOld.seq - 1);
             EXPECT_FALSE(obj);
+
+            // the asynchronous reads return the same as the synchronous ones
+            obj = backend
+                      ->asyncFetchLedgerObject(
+                          key256, lgrInfoNext.seq, boost::asio::use_future)
+                      .get();
+            EXPECT_TRUE(obj);
+            EXPECT_STREQ(
+                (const char*)obj->data(), (const char*)accountBlob.data());
+            obj = backend
+                      ->asyncFetchLedgerObject(
+                          key256, lgrInfoOld.seq - 1, boost::asio::use_future)
+                      .get();
+            EXPECT_FALSE(obj);
+            auto asyncLgr = backend
+                                ->asyncFetchLedgerBySequence(
+                                    lgrInfoNext.seq, boost::asio::use_future)
+                                .get();
+            EXPECT_TRUE(asyncLgr);
+            EXPECT_EQ(
+                RPC::ledgerInfoToBlob(*asyncLgr),
+                RPC::ledgerInfoToBlob(lgrInfoNext));
+            auto asyncTxns =
+                backend->asyncFetchTransactions(hashes, boost::asio::use_future)
+                    .get();
+            EXPECT_EQ(asyncTxns.size(), 1);
+            EXPECT_EQ(asyncTxns[0], txns[0]);
+
+            // and so do the reads of handlers on a coroutine, which take the
+            // thread-locals of the request along while they suspend
+            std::shared_ptr<BackendInterface const> constBackend = backend;
+            std::shared_ptr<ETLLoadBalancer> balancer;
+            Backend::LedgerRange range{lgrInfoNext.seq, lgrInfoNext.seq};
+            RPC::Counters counters;
+            boost::json::object params;
+            boost::asio::thread_pool pool{2};
+            boost::asio::spawn(
+                pool, [&](boost::asio::yield_context yield) {
+                    RPC::Context ctx{
+                        "account_info",
+                        1,
+                        params,
+                        constBackend,
+                        nullptr,
+                        balancer,
+                        nullptr,
+                        range,
+                        counters,
+                        "127.0.0.1"};
+                    ctx.yield = yield;
+                    Backend::ReadCounter::Scope reads{ctx.dbReads};
+                    auto obj =
+                        RPC::fetchLedgerObject(ctx, key256, lgrInfoNext.seq);
+                    EXPECT_TRUE(obj);
+                    EXPECT_EQ(Backend::ReadCounter::current(), &ctx.dbReads);
+                    auto lgr =
+                        RPC::fetchLedgerBySequence(ctx, range.maxSequence);
+                    EXPECT_TRUE(lgr);
+                    auto page = RPC::fetchLedgerPage(ctx, {}, lgr->seq, 10);
+                    EXPECT_FALSE(page.objects.empty());
+                    EXPECT_EQ(RPC::fetchTransactions(ctx, hashes), txns);
+                });
+            pool.join();
         }
         // obtain a time-based seed:
         unsigned seed =
@@ -1502,6 +1586,2022 @@ TEST(Backend, cacheBackground)
     ASSERT_EQ(idx, allObjs.size());
 }
 
+TEST(Backend, cacheCompaction)
+{
+    using namespace Backend;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+    SimpleCache cache;
+
+    // enough objects to force the delta buffer to be merged several times
+    uint32_t curSeq = 1;
+    std::map<ripple::uint256, Blob> expected;
+    std::vector<LedgerObject> objs;
+    for (size_t i = 0; i < 300000; ++i)
+    {
+        objs.push_back(
+            {ripple::uint256{i * 2 + 1},
+             {(unsigned char)i, (unsigned char)(i >> 8)}});
+        expected[objs.back().key] = objs.back().blob;
+        if (objs.size() == 10000)
+        {
+            cache.update(objs, curSeq, true);
+            objs.clear();
+        }
+    }
+    cache.setFull();
+    ASSERT_EQ(cache.size(), expected.size());
+
+    // delete every third object, modify every fifth, insert between keys
+    curSeq++;
+    objs.clear();
+    for (size_t i = 0; i < 300000; ++i)
+    {
+        ripple::uint256 key{i * 2 + 1};
+        if (i % 3 == 0)
+        {
+            objs.push_back({key, {}});
+            expected.erase(key);
+        }
+        else if (i % 5 == 0)
+        {
+            objs.push_back({key, {0xAB}});
+            expected[key] = {0xAB};
+        }
+        if (i % 7 == 0)
+        {
+            objs.push_back({ripple::uint256{i * 2}, {0xCD}});
+            expected[ripple::uint256{i * 2}] = {0xCD};
+        }
+    }
+    cache.update(objs, curSeq);
+    ASSERT_EQ(cache.size(), expected.size());
+
+    for (size_t i = 0; i < 600000; i += 97)
+    {
+        ripple::uint256 key{i};
+        auto it = expected.find(key);
+        auto cacheObj = cache.get(key, curSeq);
+        ASSERT_EQ(cacheObj.has_value(), it != expected.end());
+        if (cacheObj)
+            ASSERT_EQ(*cacheObj, it->second);
+
+        auto succ = cache.getSuccessor(key, curSeq);
+        auto expSucc = expected.upper_bound(key);
+        ASSERT_EQ(succ.has_value(), expSucc != expected.end());
+        if (succ)
+            ASSERT_EQ(*succ, (LedgerObject{expSucc->first, expSucc->second}));
+
+        auto pred = cache.getPredecessor(key, curSeq);
+        auto expPred = expected.lower_bound(key);
+        ASSERT_EQ(pred.has_value(), expPred != expected.begin());
+        if (pred)
+        {
+            --expPred;
+            ASSERT_EQ(*pred, (LedgerObject{expPred->first, expPred->second}));
+        }
+    }
+
+    std::optional<LedgerObject> succ = {{firstKey, {}}};
+    auto it = expected.upper_bound(firstKey);
+    while ((succ = cache.getSuccessor(succ->key, curSeq)))
+    {
+        ASSERT_TRUE(it != expected.end());
+        ASSERT_EQ(*succ, (LedgerObject{it->first, it->second}));
+        ++it;
+    }
+    ASSERT_TRUE(it == expected.end());
+}
+
+TEST(Backend, cacheShards)
+{
+    using namespace Backend;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+    SimpleCache cache;
+    cache.setFull();
+
+    // spread objects over the whole key space, leaving gaps of several empty
+    // key ranges, so lookups have to cross range boundaries
+    uint32_t curSeq = 1;
+    std::vector<LedgerObject> objs;
+    for (size_t i = 0; i < 256; i += 13)
+    {
+        for (size_t j = 1; j < 4; ++j)
+        {
+            ripple::uint256 key{j};
+            *key.data() = static_cast<unsigned char>(i);
+            objs.push_back({key, {(unsigned char)i, (unsigned char)j}});
+        }
+    }
+    cache.update(objs, curSeq);
+    ASSERT_EQ(cache.size(), objs.size());
+
+    std::optional<LedgerObject> succ = {{firstKey, {}}};
+    size_t idx = 0;
+    while ((succ = cache.getSuccessor(succ->key, curSeq)))
+        ASSERT_EQ(*succ, objs[idx++]);
+    ASSERT_EQ(idx, objs.size());
+
+    std::optional<LedgerObject> pred = {{lastKey, {}}};
+    while ((pred = cache.getPredecessor(pred->key, curSeq)))
+        ASSERT_EQ(*pred, objs[--idx]);
+    ASSERT_EQ(idx, 0);
+
+    // delete all objects in every other range
+    curSeq++;
+    std::vector<LedgerObject> deletes;
+    std::vector<LedgerObject> remaining;
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        if ((i / 3) % 2)
+            deletes.push_back({objs[i].key, {}});
+        else
+            remaining.push_back(objs[i]);
+    }
+    cache.update(deletes, curSeq);
+    ASSERT_EQ(cache.size(), remaining.size());
+    succ = {{firstKey, {}}};
+    while ((succ = cache.getSuccessor(succ->key, curSeq)))
+        ASSERT_EQ(*succ, remaining[idx++]);
+    ASSERT_EQ(idx, remaining.size());
+    ASSERT_FALSE(cache.getSuccessor(objs[0].key, curSeq - 1));
+}
+
+TEST(Backend, cacheVersions)
+{
+    using namespace Backend;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+    uint32_t numVersions = 4;
+    SimpleCache cache{numVersions};
+    cache.setFull();
+
+    ripple::uint256 key{42};
+    ripple::uint256 created{43};
+    uint32_t startSeq = 10;
+    cache.update({{key, {0x01}}}, startSeq);
+
+    // modify the object in each of the next ledgers. create another object
+    // half way through
+    uint32_t lastSeq = startSeq + 6;
+    for (uint32_t seq = startSeq + 1; seq <= lastSeq; ++seq)
+    {
+        std::vector<LedgerObject> objs{
+            {key, {static_cast<unsigned char>(seq - startSeq)}}};
+        if (seq == startSeq + 3)
+            objs.push_back({created, {0xCC}});
+        cache.update(objs, seq);
+    }
+    ASSERT_EQ(cache.size(), 2);
+
+    // the last numVersions ledgers are served for every object
+    for (uint32_t seq = lastSeq - numVersions + 1; seq <= lastSeq; ++seq)
+    {
+        auto cacheObj = cache.get(key, seq);
+        ASSERT_TRUE(cacheObj);
+        ASSERT_EQ(*cacheObj, Blob{(unsigned char)(seq - startSeq)});
+    }
+    ASSERT_FALSE(cache.get(key, lastSeq - numVersions));
+    ASSERT_FALSE(cache.get(key, lastSeq + 1));
+
+    // an object that did not change is served for any ledger since it was
+    // written
+    ASSERT_TRUE(cache.get(created, startSeq + 3));
+    ASSERT_FALSE(cache.get(created, startSeq + 2));
+
+    // deleted objects are still served for ledgers prior to the deletion
+    uint32_t deleteSeq = lastSeq + 1;
+    cache.update({{key, {}}}, deleteSeq);
+    ASSERT_EQ(cache.size(), 1);
+    ASSERT_FALSE(cache.get(key, deleteSeq));
+    auto cacheObj = cache.get(key, deleteSeq - 1);
+    ASSERT_TRUE(cacheObj);
+    ASSERT_EQ(*cacheObj, Blob{(unsigned char)(lastSeq - startSeq)});
+
+    // recreated objects are not served for ledgers in which they did not
+    // exist
+    uint32_t recreateSeq = deleteSeq + 1;
+    cache.update({{key, {0xFF}}}, recreateSeq);
+    ASSERT_TRUE(cache.get(key, recreateSeq));
+    ASSERT_FALSE(cache.get(key, deleteSeq));
+    ASSERT_TRUE(cache.get(key, deleteSeq - 1));
+
+    // once enough ledgers have passed, replaced versions are dropped
+    for (uint32_t seq = recreateSeq + 1; seq <= recreateSeq + numVersions;
+         ++seq)
+        cache.update({{created, {(unsigned char)seq}}}, seq);
+    ASSERT_FALSE(cache.get(key, deleteSeq - 1));
+    ASSERT_TRUE(cache.get(key, recreateSeq + numVersions));
+
+    auto report = cache.report();
+    ASSERT_EQ(report.at("num_versions").as_int64(), numVersions);
+    ASSERT_EQ(report.at("size").as_int64(), 2);
+    ASSERT_TRUE(report.at("lags").as_array().size() > 0);
+}
+
+TEST(Backend, blobArena)
+{
+    using namespace Backend;
+    BlobArena arena;
+
+    // fill several slabs, then release most of the blobs
+    std::vector<std::pair<BlobRef, Blob>> blobs;
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        Blob blob(500 + i % 100, static_cast<unsigned char>(i));
+        blobs.push_back({arena.store(blob), blob});
+    }
+    ASSERT_FALSE(arena.needsReclaim());
+    auto allocated = arena.allocatedBytes();
+    ASSERT_TRUE(allocated > BlobArena::slabSize);
+
+    std::vector<std::pair<BlobRef, Blob>> live;
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        if (i % 4)
+            arena.release(blobs[i].first);
+        else
+            live.push_back(blobs[i]);
+    }
+    ASSERT_TRUE(arena.needsReclaim());
+
+    arena.reclaim([&](auto&& relocate) {
+        for (auto& [ref, blob] : live)
+            relocate(ref);
+    });
+    ASSERT_FALSE(arena.needsReclaim());
+    ASSERT_TRUE(arena.allocatedBytes() < allocated);
+    uint64_t liveBytes = 0;
+    for (auto const& [ref, blob] : live)
+    {
+        ASSERT_EQ(arena.load(ref), blob);
+        liveBytes += blob.size();
+    }
+    ASSERT_EQ(arena.liveBytes(), liveBytes);
+
+    // blobs larger than a slab are supported
+    Blob big(BlobArena::slabSize * 2, 0xAB);
+    ASSERT_EQ(arena.load(arena.store(big)), big);
+}
+
+TEST(Backend, cacheViews)
+{
+    using namespace Backend;
+    SimpleCache cache;
+    cache.setFull();
+
+    uint32_t curSeq = 1;
+    std::vector<LedgerObject> objs;
+    for (size_t i = 0; i < 5000; ++i)
+        objs.push_back({ripple::uint256{i + 1}, Blob(1000, (unsigned char)i)});
+    cache.update(objs, curSeq);
+
+    auto view = cache.getView(objs[0].key, curSeq);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->toBlob(), objs[0].blob);
+    ASSERT_FALSE(cache.getView(objs[0].key, curSeq + 1));
+
+    // delete everything, so the memory the view points to is reclaimed
+    curSeq++;
+    for (auto& obj : objs)
+        obj.blob = {};
+    cache.update(objs, curSeq);
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_FALSE(cache.getView(objs[0].key, curSeq));
+    ASSERT_EQ(view->toBlob(), Blob(1000, 0));
+}
+
+TEST(Backend, cacheSnapshot)
+{
+    using namespace Backend;
+    boost::log::core::get()->set_filter(
+        boost::log::trivial::severity >= boost::log::trivial::warning);
+    uint32_t numVersions = 4;
+    SimpleCache cache{numVersions};
+    std::string path = "clio_cache_snapshot_test";
+
+    // the state of each ledger, to compare loaded snapshots against
+    std::vector<std::map<ripple::uint256, Blob>> states(1);
+    uint32_t curSeq = 1;
+    std::vector<LedgerObject> objs;
+    for (size_t i = 0; i < 256; i += 7)
+    {
+        for (size_t j = 1; j < 4; ++j)
+        {
+            ripple::uint256 key{j};
+            *key.data() = static_cast<unsigned char>(i);
+            objs.push_back({key, Blob(100, (unsigned char)i)});
+        }
+    }
+    ripple::uint256 ledgerHash{1234};
+    cache.update(objs, curSeq);
+    ASSERT_FALSE(cache.save(path, curSeq, ledgerHash));
+    cache.setFull();
+    states.emplace_back();
+    for (auto& obj : objs)
+        states.back()[obj.key] = obj.blob;
+
+    // modify, delete and recreate objects in every ledger
+    auto nextLedger = [&]() {
+        ++curSeq;
+        auto state = states.back();
+        std::vector<LedgerObject> diff;
+        for (size_t i = curSeq % 5; i < objs.size(); i += 5)
+        {
+            auto& key = objs[i].key;
+            Blob blob;
+            if (!state.count(key) || i % 3)
+                blob = Blob(100 + curSeq, (unsigned char)curSeq);
+            diff.push_back({key, blob});
+            if (blob.size())
+                state[key] = blob;
+            else
+                state.erase(key);
+        }
+        states.push_back(state);
+        cache.update(diff, curSeq);
+    };
+    nextLedger();
+
+    ASSERT_TRUE(cache.save(path, curSeq, ledgerHash));
+    auto header = CacheSnapshot::readHeader(path);
+    ASSERT_TRUE(header);
+    ASSERT_EQ(header->seq, curSeq);
+    ASSERT_EQ(header->ledgerHash, ledgerHash);
+    ASSERT_EQ(header->numObjects, states[curSeq].size());
+    // ledgers older than the last numVersions can not be written
+    ASSERT_FALSE(cache.save(path, curSeq - numVersions, ledgerHash));
+
+    auto checkSnapshot = [&](uint32_t seq) {
+        SimpleCache loaded;
+        ASSERT_TRUE(loaded.load(path));
+        loaded.setFull();
+        auto const& state = states[seq];
+        ASSERT_EQ(loaded.size(), state.size());
+        for (auto const& [key, blob] : state)
+        {
+            auto obj = loaded.get(key, seq);
+            ASSERT_TRUE(obj);
+            ASSERT_EQ(*obj, blob);
+        }
+    };
+    checkSnapshot(curSeq);
+    {
+        // objects are served for every ledger since they were last modified
+        SimpleCache loaded;
+        ASSERT_TRUE(loaded.load(path));
+        ASSERT_TRUE(loaded.get(objs[0].key, 1));
+        ASSERT_FALSE(loaded.get(objs[2].key, 1));
+    }
+
+    // keep applying ledgers while writing snapshots. whenever a snapshot is
+    // written, it must match the ledger it claims to contain
+    std::atomic_bool done = false;
+    std::thread writer{[&]() {
+        for (size_t i = 0; i < 20; ++i)
+            nextLedger();
+        done = true;
+    }};
+    std::vector<uint32_t> written;
+    auto save = [&]() {
+        auto seq = cache.latestSequence();
+        if (cache.save(path, seq, ledgerHash))
+            written.push_back(seq);
+    };
+    while (!done)
+        save();
+    writer.join();
+    save();
+    ASSERT_FALSE(written.empty());
+    checkSnapshot(written.back());
+
+    // objects in the skip set are not loaded
+    SimpleCache partial;
+    partial.load(path, {objs[0].key});
+    ASSERT_FALSE(partial.get(objs[0].key, written.back()));
+
+    // background deletes do not remove newer versions
+    partial.update({{objs[1].key, {0x01}}}, curSeq + 1);
+    partial.update({{objs[1].key, {}}}, curSeq, true);
+    ASSERT_TRUE(partial.get(objs[1].key, curSeq + 1));
+
+    // truncated and corrupt snapshots are not loaded at all
+    std::string contents;
+    {
+        std::ifstream in{path, std::ios::binary};
+        contents.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    auto writeFile = [&](std::string const& data) {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        out.write(data.data(), data.size());
+    };
+    writeFile(contents.substr(0, contents.size() / 2));
+    SimpleCache truncated;
+    ASSERT_FALSE(truncated.load(path));
+    ASSERT_EQ(truncated.size(), 0);
+    auto corrupt = contents;
+    corrupt[corrupt.size() / 2] ^= 0x01;
+    writeFile(corrupt);
+    ASSERT_FALSE(truncated.load(path));
+    writeFile(contents);
+    ASSERT_TRUE(truncated.load(path));
+    std::remove(path.c_str());
+    ASSERT_FALSE(CacheSnapshot::readHeader(path));
+}
+
+TEST(Backend, bookIndex)
+{
+    using namespace Backend;
+    auto makePage = [](ripple::uint256 const& key,
+                       ripple::uint256 const& dir,
+                       std::vector<ripple::uint256> const& offers,
+                       uint64_t next) {
+        ripple::STLedgerEntry sle{ripple::ltDIR_NODE, key};
+        sle.setFieldH256(ripple::sfRootIndex, dir);
+        sle.setFieldV256(ripple::sfIndexes, ripple::STVector256{offers});
+        if (next)
+            sle.setFieldU64(ripple::sfIndexNext, next);
+        ripple::Serializer s;
+        sle.add(s);
+        return LedgerObject{key, s.peekData()};
+    };
+    auto offer = [](size_t i) { return ripple::uint256{i + 1}; };
+
+    ripple::uint256 book{};
+    book.data()[0] = 0xAB;
+    auto bestDir = ripple::getQualityIndex(book, 10);
+    auto worseDir = ripple::getQualityIndex(book, 20);
+    auto secondPage = ripple::keylet::page(bestDir, 1).key;
+
+    BookIndex index;
+    uint32_t seq = 5;
+    index.update({}, seq);
+    ASSERT_FALSE(index.getOffers(book, seq, 10));
+
+    // best quality directory with two pages, and one worse quality page
+    std::vector<LedgerObject> pages{
+        makePage(bestDir, bestDir, {offer(0), offer(1)}, 1),
+        makePage(secondPage, bestDir, {offer(2)}, 0),
+        makePage(worseDir, worseDir, {offer(3)}, 0)};
+    ASSERT_FALSE(index.insert(book, seq - 1, pages));
+    ASSERT_TRUE(index.insert(book, seq, pages));
+    ASSERT_EQ(index.numBooks(), 1);
+
+    auto offers = index.getOffers(book, seq, 10);
+    ASSERT_TRUE(offers);
+    std::vector<ripple::uint256> expected{
+        offer(0), offer(1), offer(2), offer(3)};
+    ASSERT_EQ(*offers, expected);
+    offers = index.getOffers(book, seq, 2);
+    ASSERT_EQ(offers->size(), 2);
+    ASSERT_FALSE(index.getOffers(book, seq + 1, 10));
+
+    // the second page is deleted and an offer is added to the worse quality
+    seq++;
+    index.update(
+        {makePage(bestDir, bestDir, {offer(0), offer(1)}, 0),
+         {secondPage, {}},
+         makePage(worseDir, worseDir, {offer(3), offer(4)}, 0)},
+        seq);
+    offers = index.getOffers(book, seq, 10);
+    ASSERT_TRUE(offers);
+    expected = {offer(0), offer(1), offer(3), offer(4)};
+    ASSERT_EQ(*offers, expected);
+
+    // the best quality directory is removed, and a new best one is created
+    seq++;
+    auto newDir = ripple::getQualityIndex(book, 5);
+    index.update(
+        {{bestDir, {}}, makePage(newDir, newDir, {offer(5)}, 0)}, seq);
+    offers = index.getOffers(book, seq, 10);
+    ASSERT_TRUE(offers);
+    expected = {offer(5), offer(3), offer(4)};
+    ASSERT_EQ(*offers, expected);
+
+    // if a ledger is skipped, books are dropped
+    seq += 2;
+    index.update({}, seq);
+    ASSERT_FALSE(index.getOffers(book, seq, 10));
+    ASSERT_EQ(index.numBooks(), 0);
+}
+
+TEST(Backend, groupAccountTransactions)
+{
+    ripple::AccountID alice, bob;
+    alice = 1;
+    bob = 2;
+    std::vector<AccountTransactionsData> data;
+    auto add = [&](uint32_t seq, uint32_t idx, auto accounts) {
+        AccountTransactionsData record;
+        record.ledgerSequence = seq;
+        record.transactionIndex = idx;
+        record.txHash = seq * 100 + idx;
+        for (auto& account : accounts)
+            record.accounts.insert(account);
+        data.push_back(record);
+    };
+    add(5, 2, std::vector{alice});
+    add(5, 0, std::vector{alice, bob});
+    add(5, 1, std::vector{bob});
+    add(6, 0, std::vector{alice});
+
+    // five rows in four transactions, written in three partitions
+    auto groups = groupAccountTransactions(data);
+    ASSERT_EQ(groups.size(), 3);
+    // one group per account and ledger, with the rows in index order
+    ASSERT_EQ(groups[0].account, alice);
+    ASSERT_EQ(groups[0].ledgerSequence, 5);
+    ASSERT_EQ(groups[0].transactions.size(), 2);
+    ASSERT_EQ(groups[0].transactions[0].first, 0);
+    ASSERT_EQ(groups[0].transactions[0].second, ripple::uint256{500});
+    ASSERT_EQ(groups[0].transactions[1].first, 2);
+    ASSERT_EQ(groups[0].transactions[1].second, ripple::uint256{502});
+    ASSERT_EQ(groups[1].account, alice);
+    ASSERT_EQ(groups[1].ledgerSequence, 6);
+    ASSERT_EQ(groups[1].transactions.size(), 1);
+    ASSERT_EQ(groups[2].account, bob);
+    ASSERT_EQ(groups[2].ledgerSequence, 5);
+    ASSERT_EQ(groups[2].transactions.size(), 2);
+    ASSERT_EQ(groups[2].transactions[1].second, ripple::uint256{501});
+
+    ASSERT_TRUE(groupAccountTransactions({}).empty());
+}
+
+TEST(Backend, accountTxCache)
+{
+    using namespace Backend;
+    using Cursor = AccountTransactionsCursor;
+    ripple::AccountID alice, bob;
+    alice = 1;
+    bob = 2;
+    ripple::uint256 hash;
+    auto row = [&hash](uint32_t seq, uint32_t idx) {
+        hash = seq * 100 + idx;
+        return AccountTxCache::Row{seq, idx, hash};
+    };
+    AccountTxCache cache{1};
+
+    // newest rows of alice as of ledger 10, read two at a time
+    std::vector<AccountTxCache::Row> rows{row(10, 3), row(10, 1)};
+    Cursor head{10, INT32_MAX};
+    ASSERT_FALSE(cache.get(alice, 2, false, head, 10));
+    // reads not from the head are not cached
+    cache.insert(alice, 10, Cursor{9, 0}, rows, 2);
+    ASSERT_EQ(cache.size(), 0);
+    cache.insert(alice, 10, head, rows, 2);
+    ASSERT_EQ(cache.size(), 1);
+
+    auto page = cache.get(alice, 2, false, head, 10);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 2);
+    ASSERT_EQ(page->hashes[0], ripple::uint256{1003});
+    ASSERT_TRUE(page->cursor);
+    ASSERT_EQ(page->cursor->ledgerSequence, 10);
+    ASSERT_EQ(page->cursor->transactionIndex, 1);
+    // the rest of the history is not cached yet
+    ASSERT_FALSE(cache.get(alice, 3, false, head, 10));
+    ASSERT_FALSE(cache.get(alice, 1, false, page->cursor, 10));
+    // nor the rows of ledgers after 10
+    ASSERT_FALSE(cache.get(alice, 2, false, Cursor{11, INT32_MAX}, 11));
+
+    // the next page continues the cached rows. It is the last one
+    cache.insert(alice, 10, page->cursor, {row(7, 0)}, 2);
+    page = cache.get(alice, 2, false, Cursor{10, 1}, 10);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 1);
+    ASSERT_EQ(page->hashes[0], ripple::uint256{700});
+    ASSERT_FALSE(page->cursor);
+
+    // forward pages, from the oldest row
+    page = cache.get(alice, 2, true, Cursor{0, 0}, 10);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 2);
+    ASSERT_EQ(page->hashes[0], ripple::uint256{700});
+    ASSERT_EQ(page->hashes[1], ripple::uint256{1001});
+    ASSERT_EQ(page->cursor->ledgerSequence, 10);
+    ASSERT_EQ(page->cursor->transactionIndex, 2);
+    page = cache.get(alice, 2, true, page->cursor, 10);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 1);
+    ASSERT_EQ(page->hashes[0], ripple::uint256{1003});
+    ASSERT_FALSE(page->cursor);
+
+    // ledger 11 affects alice and bob. Only alice is cached
+    auto txn = [](uint32_t seq, uint32_t idx, auto accounts) {
+        AccountTransactionsData data;
+        data.ledgerSequence = seq;
+        data.transactionIndex = idx;
+        data.txHash = seq * 100 + idx;
+        for (auto& account : accounts)
+            data.accounts.insert(account);
+        return data;
+    };
+    cache.update(
+        {txn(11, 0, std::vector{alice, bob}), txn(11, 4, std::vector{alice})},
+        11);
+    ASSERT_FALSE(cache.get(bob, 2, false, Cursor{11, INT32_MAX}, 11));
+    page = cache.get(alice, 3, false, Cursor{11, INT32_MAX}, 11);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 3);
+    ASSERT_EQ(page->hashes[0], ripple::uint256{1104});
+    ASSERT_EQ(page->hashes[1], ripple::uint256{1100});
+    ASSERT_EQ(page->hashes[2], ripple::uint256{1003});
+
+    // reads that started before ledger 11 was applied are not cached
+    cache.insert(bob, 10, Cursor{10, INT32_MAX}, {}, 2);
+    ASSERT_FALSE(cache.get(bob, 2, false, Cursor{11, INT32_MAX}, 11));
+    // caching bob evicts alice, the least recently used
+    cache.insert(bob, 11, Cursor{11, INT32_MAX}, {row(11, 0)}, 2);
+    ASSERT_EQ(cache.size(), 1);
+    ASSERT_FALSE(cache.get(alice, 1, false, Cursor{11, INT32_MAX}, 11));
+    page = cache.get(bob, 2, false, Cursor{11, INT32_MAX}, 11);
+    ASSERT_TRUE(page);
+    ASSERT_EQ(page->hashes.size(), 1);
+    ASSERT_FALSE(page->cursor);
+
+    // if a ledger is skipped, accounts are dropped
+    cache.update({}, 13);
+    ASSERT_EQ(cache.size(), 0);
+    auto [hits, misses] = cache.stats();
+    ASSERT_EQ(hits, 6);
+}
+
+TEST(Backend, transactionCache)
+{
+    using namespace Backend;
+    // 16 shards of 1024 bytes. Hashes with the same first byte share one
+    TransactionCache cache{16 * 1024};
+    auto txn = [](uint32_t seq, size_t size) {
+        return TransactionAndMetadata{
+            Blob(size, 1), Blob(size, 2), seq, seq * 10};
+    };
+    auto hash = [](uint8_t shard, uint8_t i) {
+        ripple::uint256 hash;
+        hash = i;
+        *hash.data() = shard;
+        return hash;
+    };
+
+    ASSERT_FALSE(cache.get(hash(0, 1)));
+    cache.put(hash(0, 1), txn(1, 150));
+    cache.put(hash(0, 2), txn(2, 150));
+    auto cached = cache.get(hash(0, 1));
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(cached->ledgerSequence, 1);
+    ASSERT_EQ(cached->date, 10);
+    ASSERT_EQ(cached->transaction, Blob(150, 1));
+    ASSERT_EQ(cached->metadata, Blob(150, 2));
+
+    // the shard is full. The least recently used transaction is evicted
+    cache.put(hash(0, 3), txn(3, 150));
+    ASSERT_TRUE(cache.get(hash(0, 1)));
+    ASSERT_FALSE(cache.get(hash(0, 2)));
+    ASSERT_TRUE(cache.get(hash(0, 3)));
+    // other shards are not affected
+    cache.put(hash(1, 1), txn(4, 150));
+    ASSERT_TRUE(cache.get(hash(0, 1)));
+    // transactions bigger than a shard are not cached
+    cache.put(hash(2, 1), txn(5, 1000));
+    ASSERT_FALSE(cache.get(hash(2, 1)));
+
+    auto report = cache.report();
+    ASSERT_EQ(report["size"].as_uint64(), 3);
+    ASSERT_EQ(report["hits"].as_uint64(), 4);
+    ASSERT_EQ(report["misses"].as_uint64(), 3);
+}
+
+TEST(Backend, trustLineCache)
+{
+    using namespace Backend;
+    ripple::AccountID alice, bob, carol;
+    alice = 1;
+    bob = 2;
+    carol = 3;
+    ripple::Currency usd;
+    usd = 4;
+
+    // the fields of a line are read without building the object
+    ripple::SLE state{ripple::keylet::line(alice, bob, usd)};
+    state.setFieldU32(ripple::sfFlags, ripple::lsfLowNoRipple);
+    state.setFieldAmount(
+        ripple::sfBalance, ripple::STAmount{{usd, ripple::noAccount()}, 5});
+    state.setFieldAmount(ripple::sfLowLimit, ripple::STAmount{{usd, alice}, 7});
+    state.setFieldAmount(ripple::sfHighLimit, ripple::STAmount{{usd, bob}, 0});
+    state.setFieldU64(ripple::sfLowNode, 1);
+    state.setFieldU32(ripple::sfLowQualityIn, 3);
+    ripple::Serializer s;
+    state.add(s);
+    auto line = TrustLine::parse(state.key(), s.data(), s.size());
+    ASSERT_TRUE(line);
+    ASSERT_EQ(line->key, state.key());
+    ASSERT_EQ(line->flags, ripple::lsfLowNoRipple);
+    ASSERT_EQ(line->balance, state.getFieldAmount(ripple::sfBalance));
+    ASSERT_EQ(line->lowLimit, state.getFieldAmount(ripple::sfLowLimit));
+    ASSERT_EQ(line->lowLimit.getIssuer(), alice);
+    ASSERT_EQ(line->highLimit, state.getFieldAmount(ripple::sfHighLimit));
+
+    ripple::SLE root{ripple::keylet::account(alice)};
+    ripple::Serializer rootData;
+    root.add(rootData);
+    ASSERT_FALSE(
+        TrustLine::parse(root.key(), rootData.data(), rootData.size()));
+
+    TrustLineCache cache{2};
+    auto lines = std::make_shared<std::vector<TrustLine> const>(1, *line);
+    cache.update({}, 10);
+    // read before ledger 10 was applied
+    cache.insert(alice, 9, lines);
+    ASSERT_FALSE(cache.get(alice, 9));
+    cache.insert(alice, 10, lines);
+    cache.insert(bob, 10, lines);
+    ASSERT_EQ(cache.get(alice, 10), lines);
+    ASSERT_FALSE(cache.get(alice, 9));
+    ASSERT_FALSE(cache.get(alice, 11));
+
+    // a transaction of ledger 11 affects bob
+    AccountTransactionsData tx;
+    tx.accounts = {bob, carol};
+    cache.update({tx}, 11);
+    ASSERT_EQ(cache.get(alice, 11), lines);
+    ASSERT_EQ(cache.get(alice, 10), lines);
+    ASSERT_FALSE(cache.get(bob, 11));
+    ASSERT_EQ(cache.size(), 1);
+
+    // the least recently used account is evicted
+    cache.insert(bob, 11, lines);
+    cache.insert(carol, 11, lines);
+    ASSERT_FALSE(cache.get(alice, 11));
+    ASSERT_TRUE(cache.get(bob, 11));
+
+    // accounts that missed a ledger are dropped
+    cache.update({}, 13);
+    ASSERT_EQ(cache.size(), 0);
+
+    auto [hits, misses] = cache.stats();
+    ASSERT_EQ(hits, 4);
+    ASSERT_EQ(misses, 5);
+}
+
+TEST(Backend, ledgerHeaderCache)
+{
+    using namespace Backend;
+    auto header = [](uint32_t seq) {
+        ripple::LedgerInfo info;
+        info.seq = seq;
+        info.hash = seq;
+        return info;
+    };
+    ripple::Fees fees;
+    fees.base = 10;
+
+    LedgerHeaderCache cache{4};
+    for (uint32_t seq = 10; seq < 15; ++seq)
+    {
+        fees.reserve = seq;
+        cache.put(header(seq), fees);
+    }
+    // 10 was replaced by 14
+    ASSERT_FALSE(cache.get(10));
+    ASSERT_FALSE(cache.get(ripple::uint256{10}));
+    ASSERT_FALSE(cache.fees(10));
+    for (uint32_t seq = 11; seq < 15; ++seq)
+    {
+        ASSERT_EQ(cache.get(seq)->hash, ripple::uint256{seq});
+        ASSERT_EQ(cache.get(ripple::uint256{seq})->seq, seq);
+        ASSERT_EQ(cache.fees(seq)->reserve, seq);
+    }
+    ASSERT_FALSE(cache.get(15));
+
+    // an older ledger does not replace a newer one
+    cache.put(header(10), fees);
+    ASSERT_FALSE(cache.get(10));
+    ASSERT_TRUE(cache.get(14));
+
+    auto report = cache.report();
+    ASSERT_EQ(report.at("size").as_uint64(), 4);
+    ASSERT_EQ(report.at("hits").as_uint64(), 13);
+    ASSERT_EQ(report.at("misses").as_uint64(), 5);
+
+    LedgerHeaderCache disabled{0};
+    disabled.put(header(1), fees);
+    ASSERT_FALSE(disabled.get(1));
+}
+
+TEST(Backend, partialCache)
+{
+    using namespace Backend;
+    auto key = [](unsigned char i) {
+        ripple::uint256 key;
+        *key.data() = i;
+        *(key.end() - 1) = i;
+        return key;
+    };
+    auto blob = [](size_t size) {
+        return BlobView{Blob(size, 1)};
+    };
+
+    // 64 KB for every shard, 1/4 of it for ranges
+    PartialCache cache{16 * 64 * 1024 * 4 / 3};
+    ASSERT_TRUE(cache.enabled());
+    // nothing is cached before the first ledger is applied
+    cache.put(key(1), 10, blob(10));
+    ASSERT_FALSE(cache.get(key(1), 10));
+
+    cache.update({}, 10);
+    cache.put(key(1), 10, blob(10));
+    cache.put(key(2), 10, {});
+    ASSERT_EQ(cache.get(key(1), 10)->size, 10);
+    // the object may have been different before
+    ASSERT_FALSE(cache.get(key(1), 9));
+    // deleted objects are cached as empty
+    ASSERT_TRUE(cache.get(key(2), 10));
+    ASSERT_TRUE(cache.get(key(2), 10)->empty());
+
+    cache.putSuccessors(key(0), 10, {key(3), key(5), key(9)});
+    ASSERT_EQ(*cache.successor(key(0), 10), key(3));
+    ASSERT_EQ(*cache.successor(key(4), 10), key(5));
+    ASSERT_FALSE(cache.successor(key(9), 10));
+    // touching ranges merge
+    cache.putSuccessors(key(9), 10, {key(12)});
+    ASSERT_EQ(*cache.successor(key(6), 10), key(9));
+    ASSERT_EQ(*cache.successor(key(10), 10), key(12));
+
+    // modified, deleted and created objects
+    cache.update(
+        {LedgerObject{key(1), {2}},
+         LedgerObject{key(5), {}},
+         LedgerObject{key(7), {3}}},
+        11);
+    ASSERT_EQ(cache.get(key(1), 11)->size, 1);
+    ASSERT_EQ(*cache.successor(key(4), 11), key(7));
+    // successors are only answered for the most recent ledger
+    ASSERT_FALSE(cache.successor(key(4), 10));
+    // read before ledger 11 was applied
+    cache.put(key(3), 10, blob(10));
+    ASSERT_FALSE(cache.get(key(3), 11));
+
+    // a skipped ledger drops everything
+    cache.update({}, 13);
+    ASSERT_FALSE(cache.get(key(1), 13));
+    ASSERT_FALSE(cache.successor(key(4), 13));
+
+    // every key goes to the same shard, which holds about 300 of these
+    for (unsigned i = 0; i < 1000; ++i)
+    {
+        auto k = key(16);
+        *(k.end() - 2) = i;
+        *(k.end() - 3) = i >> 8;
+        cache.put(k, 13, blob(100));
+    }
+    auto report = cache.report();
+    ASSERT_LE(report.at("object_bytes").as_uint64(), 64 * 1024);
+    ASSERT_GT(report.at("evictions").as_uint64(), 600);
+    ASSERT_EQ(
+        report.at("objects").as_uint64() + report.at("evictions").as_uint64(),
+        1000);
+
+    PartialCache disabled{0};
+    ASSERT_FALSE(disabled.enabled());
+    disabled.update({}, 1);
+    disabled.put(key(1), 1, blob(1));
+    ASSERT_FALSE(disabled.get(key(1), 1));
+}
+
+TEST(Backend, concurrencyLimiter)
+{
+    using namespace Backend;
+    using clock = ConcurrencyLimiter::clock;
+    using namespace std::chrono_literals;
+    {
+        // requests beyond the window are queued, and started one at a time
+        // as earlier requests complete
+        ConcurrencyLimiter limiter{4, 4, 4};
+        EXPECT_EQ(limiter.window(), 4);
+        std::vector<clock::time_point> starts;
+        for (int i = 0; i < 6; ++i)
+            limiter.submit([&starts]() { starts.push_back(clock::now()); });
+        EXPECT_EQ(starts.size(), 4);
+        EXPECT_EQ(limiter.inFlight(), 4);
+        EXPECT_EQ(limiter.report().at("queued").as_uint64(), 2);
+        limiter.release(starts[0]);
+        EXPECT_EQ(starts.size(), 5);
+        limiter.release(starts[1]);
+        EXPECT_EQ(starts.size(), 6);
+        for (size_t i = 2; i < starts.size(); ++i)
+            limiter.release(starts[i]);
+        EXPECT_EQ(limiter.inFlight(), 0);
+        EXPECT_EQ(limiter.report().at("completed").as_uint64(), 6);
+    }
+    {
+        // a window that grows by more than one starts as many queued
+        // requests as fit
+        ConcurrencyLimiter limiter{4, 2, 64};
+        std::vector<clock::time_point> starts;
+        for (int i = 0; i < 6; ++i)
+            limiter.submit([&starts]() { starts.push_back(clock::now()); });
+        limiter.release(starts[0]);
+        EXPECT_GT(limiter.window(), 4);
+        EXPECT_EQ(starts.size(), 6);
+        EXPECT_EQ(limiter.inFlight(), 5);
+    }
+    {
+        // with an io_context, queued requests are started there rather
+        // than by the thread that releases room for them
+        boost::asio::io_context ioc;
+        ConcurrencyLimiter limiter{2, 2, 2, &ioc};
+        std::vector<std::thread::id> started;
+        for (int i = 0; i < 3; ++i)
+            limiter.submit([&started]() {
+                started.push_back(std::this_thread::get_id());
+            });
+        EXPECT_EQ(started.size(), 2);
+        std::thread releaser{[&limiter]() { limiter.release(clock::now()); }};
+        releaser.join();
+        EXPECT_EQ(started.size(), 2);
+        EXPECT_EQ(limiter.inFlight(), 2);
+        ioc.run();
+        ASSERT_EQ(started.size(), 3);
+        EXPECT_EQ(started[2], std::this_thread::get_id());
+    }
+    {
+        ConcurrencyLimiter limiter{8, 2, 64};
+        auto fill = [&limiter]() {
+            while (limiter.inFlight() < limiter.window())
+                limiter.submit([]() {});
+        };
+        // a busy window with steady latency grows to the maximum
+        for (int i = 0; i < 1000; ++i)
+        {
+            fill();
+            limiter.release(clock::now() - 1ms);
+        }
+        EXPECT_EQ(limiter.window(), 64);
+
+        // latency far above the minimum means requests are queueing
+        for (int i = 0; i < 500; ++i)
+        {
+            fill();
+            limiter.release(clock::now() - 20ms);
+        }
+        auto window = limiter.window();
+        EXPECT_LT(window, 64);
+
+        // timeouts shrink the window multiplicatively, once per overload
+        limiter.failed();
+        limiter.failed();
+        EXPECT_LT(limiter.window(), window);
+        EXPECT_GE(limiter.window(), window * 0.75 - 1);
+        EXPECT_GE(limiter.report().at("timeouts").as_uint64(), 2);
+        EXPECT_TRUE(limiter.report().contains("p99_latency_us"));
+    }
+    {
+        // acquire blocks while the window is full
+        ConcurrencyLimiter limiter{2, 2, 2};
+        auto first = limiter.acquire();
+        limiter.acquire();
+        std::atomic_bool acquired = false;
+        std::thread waiter{[&]() {
+            limiter.release(limiter.acquire());
+            acquired = true;
+        }};
+        std::this_thread::sleep_for(10ms);
+        EXPECT_FALSE(acquired);
+        limiter.release(first);
+        waiter.join();
+        EXPECT_TRUE(acquired);
+    }
+}
+
+TEST(Backend, pgPoolHandoff)
+{
+    boost::json::object config{
+        {"contact_point", "127.0.0.1"},
+        {"username", "postgres"},
+        {"password", "postgres"},
+        {"database", "clio_test_pool"},
+        {"max_connections", 1u}};
+    auto pool = make_PgPool(config);
+    auto held = std::make_unique<PgQuery>(pool);
+    ASSERT_TRUE((*held)("SELECT 1"));
+
+    // the only connection is checked out, so this waits for it
+    auto waiter = std::async(std::launch::async, [&pool]() {
+        PgQuery query{pool};
+        return static_cast<bool>(query("SELECT 1"));
+    });
+    EXPECT_EQ(
+        waiter.wait_for(std::chrono::milliseconds(200)),
+        std::future_status::timeout);
+
+    // checked in on this thread, and handed to the waiter on its own
+    held.reset();
+    ASSERT_EQ(
+        waiter.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_TRUE(waiter.get());
+    EXPECT_EQ(pool->stats().at("waits").as_uint64(), 1);
+    pool->onStop();
+}
+
+TEST(Backend, singleFlight)
+{
+    using namespace Backend;
+    SingleFlight<uint32_t, std::optional<uint32_t>> flights;
+    std::promise<void> release;
+    std::atomic_uint32_t reads = 0;
+    auto read = [&reads, future = release.get_future().share()]() {
+        ++reads;
+        future.wait();
+        return std::optional<uint32_t>{7};
+    };
+    auto first = std::async(
+        std::launch::async, [&]() { return flights.run(1, read); });
+    while (reads == 0)
+        std::this_thread::yield();
+    // joins the running read
+    auto second = std::async(std::launch::async, [&]() {
+        return flights.run(1, []() { return std::optional<uint32_t>{8}; });
+    });
+    // another key is read on its own
+    EXPECT_EQ(
+        flights.run(2, []() { return std::optional<uint32_t>{9}; }), 9u);
+    while (flights.report().at("shared").as_uint64() == 0)
+        std::this_thread::yield();
+    release.set_value();
+    EXPECT_EQ(first.get(), 7u);
+    EXPECT_EQ(second.get(), 7u);
+    EXPECT_EQ(reads.load(), 1);
+
+    // the read above has landed, so this one runs
+    EXPECT_EQ(
+        flights.run(1, []() { return std::optional<uint32_t>{}; }),
+        std::nullopt);
+    EXPECT_THROW(
+        flights.run(1, []() -> std::optional<uint32_t> {
+            throw DatabaseTimeout();
+        }),
+        DatabaseTimeout);
+    auto report = flights.report();
+    EXPECT_EQ(report.at("reads").as_uint64(), 4);
+    EXPECT_EQ(report.at("shared").as_uint64(), 1);
+}
+
+TEST(ETL, parallelFor)
+{
+    boost::asio::thread_pool pool{4};
+    {
+        // every index is visited once, whatever the split
+        for (size_t n : {0, 1, 7, 100, 1000})
+        {
+            std::vector<std::atomic_int> visits(n);
+            ParallelFor work{pool, n, 4, 16, [&visits](size_t i) {
+                                 ++visits[i];
+                             }};
+            work.wait();
+            for (auto const& v : visits)
+                EXPECT_EQ(v, 1);
+        }
+    }
+    {
+        // the first exception is rethrown by wait, after the other chunks
+        // have been allowed to finish
+        std::atomic_int visited = 0;
+        ParallelFor work{pool, 100, 4, 1, [&visited](size_t i) {
+                             ++visited;
+                             if (i == 50)
+                                 throw std::runtime_error("failed");
+                         }};
+        EXPECT_THROW(work.wait(), std::runtime_error);
+    }
+    {
+        StageTimer timer;
+        timer.add(std::chrono::microseconds(10));
+        timer.add(std::chrono::microseconds(30));
+        auto report = timer.report();
+        EXPECT_EQ(report.at("count").as_uint64(), 2);
+        EXPECT_EQ(report.at("max_us").as_uint64(), 30);
+        EXPECT_EQ(report.at("last_us").as_uint64(), 30);
+        EXPECT_EQ(report.at("avg_us").as_uint64(), 20);
+    }
+}
+
+TEST(Backend, blobCodec)
+{
+    using namespace Backend;
+    // metadata-like blobs: shared structure around random accounts
+    auto bytes = [](std::initializer_list<unsigned char> list) {
+        return std::string{list.begin(), list.end()};
+    };
+    std::mt19937 rng{7};
+    auto makeBlob = [&rng, &bytes]() {
+        auto blob = bytes({0x20, 0x1C});
+        for (std::size_t node = 0; node < 4; ++node)
+        {
+            blob += bytes({0xE5, 0x11, 0x00, 0x72, 0x25, 0x00, 0x00, 0x55});
+            for (std::size_t i = 0; i < 20; ++i)
+                blob.push_back(static_cast<char>(rng()));
+            blob += bytes({0xE6, 0x62, 0x40, 0x00, 0x00, 0x00, 0xE1, 0xE7});
+        }
+        return blob;
+    };
+    std::vector<std::string> samples;
+    for (std::size_t i = 0; i < 2000; ++i)
+        samples.push_back(makeBlob());
+    auto toBlob = [](std::string const& str) {
+        return Blob{str.begin(), str.end()};
+    };
+
+    // without compression, blobs are stored as they are
+    BlobCodec plain;
+    auto stored = samples[0];
+    plain.encode(BlobTable::metadata, stored);
+    EXPECT_EQ(stored, samples[0]);
+
+    boost::json::object codecConfig;
+    codecConfig["enabled"] = true;
+    boost::json::object config;
+    config["compression"] = codecConfig;
+    BlobCodec codec{config};
+    EXPECT_TRUE(codec.enabled());
+
+    // small and empty blobs are stored as they are
+    auto small = bytes({0x11, 0x00, 0x61});
+    codec.encode(BlobTable::objects, small);
+    EXPECT_EQ(small, bytes({0x11, 0x00, 0x61}));
+    std::string deleted;
+    codec.encode(BlobTable::objects, deleted);
+    EXPECT_TRUE(deleted.empty());
+
+    stored = samples[0];
+    codec.encode(BlobTable::metadata, stored);
+    EXPECT_EQ(stored[0], BlobCodec::tag);
+    EXPECT_LT(stored.size(), samples[0].size());
+    EXPECT_EQ(
+        codec.decode(BlobTable::metadata, toBlob(stored)),
+        toBlob(samples[0]));
+    // blobs written before compression was enabled read back unchanged
+    EXPECT_EQ(
+        codec.decode(BlobTable::metadata, toBlob(samples[1])),
+        toBlob(samples[1]));
+    // readers without compression enabled decompress too
+    EXPECT_EQ(
+        plain.decode(BlobTable::metadata, toBlob(stored)),
+        toBlob(samples[0]));
+
+    // a trained dictionary compresses better
+    std::vector<std::string> training{samples.begin() + 100, samples.end()};
+    std::string dictPath = "/tmp/clio_blob_codec_test.dict";
+    {
+        std::ofstream out{dictPath, std::ios::binary};
+        out << BlobCodec::train(training, 16 << 10);
+    }
+    boost::json::object dicts;
+    dicts["metadata"] = dictPath;
+    codecConfig["dictionaries"] = dicts;
+    config["compression"] = codecConfig;
+    BlobCodec trained{config};
+    std::size_t plainBytes = 0;
+    std::size_t trainedBytes = 0;
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        auto withoutDict = samples[i];
+        codec.encode(BlobTable::metadata, withoutDict);
+        plainBytes += withoutDict.size();
+        auto withDict = samples[i];
+        trained.encode(BlobTable::metadata, withDict);
+        trainedBytes += withDict.size();
+        EXPECT_EQ(
+            trained.decode(BlobTable::metadata, toBlob(withDict)),
+            toBlob(samples[i]));
+        // each table has dictionaries of its own
+        EXPECT_THROW(
+            trained.decode(BlobTable::transactions, toBlob(withDict)),
+            std::runtime_error);
+        EXPECT_THROW(
+            plain.decode(BlobTable::metadata, toBlob(withDict)),
+            std::runtime_error);
+    }
+    EXPECT_LT(trainedBytes, plainBytes);
+    auto report = trained.report().at("metadata").as_object();
+    EXPECT_EQ(report.at("compressed").as_uint64(), 100);
+    EXPECT_EQ(report.at("decompressed").as_uint64(), 100);
+
+    auto corrupt = toBlob(stored);
+    corrupt.resize(corrupt.size() / 2);
+    EXPECT_THROW(
+        codec.decode(BlobTable::metadata, std::move(corrupt)),
+        std::runtime_error);
+    std::remove(dictPath.c_str());
+}
+
+TEST(ETL, midpoint)
+{
+    using Bytes = std::initializer_list<std::pair<size_t, unsigned char>>;
+    auto key = [](Bytes bytes) {
+        ripple::uint256 k{0};
+        for (auto [i, b] : bytes)
+            k.data()[i] = b;
+        return k;
+    };
+    // rounds down, one bit at a time from the first byte
+    EXPECT_EQ(midpoint(key({}), key({{0, 0x80}})), key({{0, 0x40}}));
+    EXPECT_EQ(midpoint(key({}), key({{0, 0x01}})), key({{1, 0x80}}));
+    EXPECT_EQ(midpoint(key({{31, 1}}), key({{31, 2}})), key({{31, 1}}));
+    // the carry out of the first byte is kept
+    auto const& last = Backend::lastKey;
+    auto mid = midpoint(last, last);
+    EXPECT_EQ(mid, last);
+    mid = midpoint(key({{0, 0x80}}), last);
+    EXPECT_EQ(mid.data()[0], 0xbf);
+    EXPECT_EQ(mid.data()[31], 0xff);
+    // the midpoint of a range is within it, and splits it in two
+    auto a = key({{0, 0x12}, {5, 0x34}});
+    auto b = key({{0, 0x12}, {5, 0x35}});
+    mid = midpoint(a, b);
+    EXPECT_TRUE(a < mid && mid < b);
+    EXPECT_EQ(midpoint(b, a), mid);
+}
+
+TEST(ETL, streamMessage)
+{
+    // values are skipped over, including brackets and quotes in strings
+    std::string tx =
+        R"({"engine_result":"tesSUCCESS","transaction":{"Account":"r\"}",)"
+        R"("Memos":[{"a":[1,2]}]},"type":"transaction","validated":false})";
+    auto msg = scanStreamMessage(tx);
+    ASSERT_TRUE(msg);
+    EXPECT_EQ(msg->type, "transaction");
+    EXPECT_EQ(msg->transaction, R"({"Account":"r\"}","Memos":[{"a":[1,2]}]})");
+    EXPECT_FALSE(msg->ledgerIndex);
+    EXPECT_FALSE(msg->validated);
+    EXPECT_TRUE(msg->result.empty());
+
+    msg = scanStreamMessage(
+        R"({"hash":"AB12","signature":"CD34","validated":true})");
+    ASSERT_TRUE(msg);
+    EXPECT_EQ(msg->hash, "AB12");
+    EXPECT_EQ(msg->signature, "CD34");
+    EXPECT_TRUE(msg->validated);
+
+    msg = scanStreamMessage(
+        R"( { "fee_base" : 10, "ledger_index": 75000000 ,)"
+        R"( "type":"ledgerClosed", "validated_ledgers":"32570-75000000" } )");
+    ASSERT_TRUE(msg);
+    EXPECT_EQ(msg->type, "ledgerClosed");
+    EXPECT_EQ(msg->ledgerIndex, 75000000u);
+    EXPECT_EQ(msg->validatedLedgers, "32570-75000000");
+
+    // the reply to subscribe has its fields in result
+    msg = scanStreamMessage(
+        R"({"id":1,"result":{"ledger_index":7,"validated_ledgers":"1-7"},)"
+        R"("status":"success","type":"response"})");
+    ASSERT_TRUE(msg);
+    auto result = scanStreamMessage(msg->result);
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result->ledgerIndex, 7u);
+    EXPECT_EQ(result->validatedLedgers, "1-7");
+
+    EXPECT_TRUE(scanStreamMessage("{}"));
+    EXPECT_FALSE(scanStreamMessage("[1]"));
+    EXPECT_FALSE(scanStreamMessage(R"({"a":{"b":1})"));
+    EXPECT_FALSE(scanStreamMessage(R"({"a":"b)"));
+    EXPECT_FALSE(scanStreamMessage(R"({"a":1,})"));
+}
+
+TEST(ETL, spscQueue)
+{
+    // elements arrive in order, though the producer runs ahead
+    SpscQueue<std::optional<int>> queue{4};
+    std::thread producer{[&queue]() {
+        for (int i = 0; i < 10000; ++i)
+            queue.push(i);
+        queue.push({});
+    }};
+    int expected = 0;
+    while (auto i = queue.pop())
+        EXPECT_EQ(*i, expected++);
+    producer.join();
+    EXPECT_EQ(expected, 10000);
+    EXPECT_FALSE(queue.tryPop());
+
+    // a full queue blocks the producer until an element is popped
+    SpscQueue<int> full{1};
+    full.push(1);
+    std::atomic_bool pushed = false;
+    std::thread blocked{[&full, &pushed]() {
+        full.push(2);
+        pushed = true;
+    }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(pushed);
+    EXPECT_EQ(full.tryPop(), 1);
+    blocked.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(full.pop(), 2);
+}
+
+TEST(ETL, readAheadRing)
+{
+    // producers claim sequences in order, but finish them out of order
+    ReadAheadRing<std::optional<int>> ring{8};
+    constexpr int numProducers = 4;
+    constexpr int count = 10000;
+    std::mutex claimMtx;
+    std::condition_variable claimCv;
+    int nextClaim = 0;
+    std::atomic_int nextTake = 0;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; ++p)
+    {
+        producers.emplace_back([&]() {
+            while (true)
+            {
+                int seq;
+                {
+                    std::unique_lock lck{claimMtx};
+                    claimCv.wait(lck, [&]() {
+                        return nextClaim - nextTake < 8 || nextClaim == count;
+                    });
+                    if (nextClaim == count)
+                    {
+                        ring.close(count);
+                        return;
+                    }
+                    seq = nextClaim++;
+                }
+                if (seq % 3 == 0)
+                    std::this_thread::yield();
+                ring.put(seq, seq);
+            }
+        });
+    }
+    int expected = 0;
+    while (auto i = ring.take(expected))
+    {
+        EXPECT_EQ(*i, expected++);
+        nextTake = expected;
+        {
+            std::lock_guard lck{claimMtx};
+        }
+        claimCv.notify_all();
+    }
+    for (auto& t : producers)
+        t.join();
+    EXPECT_EQ(expected, count);
+    // the end stays closed
+    EXPECT_FALSE(ring.take(count + 1));
+}
+
+TEST(ETL, recentFilter)
+{
+    RecentFilter filter{4};
+    EXPECT_TRUE(filter.insert(42));
+    EXPECT_FALSE(filter.insert(42));
+    EXPECT_TRUE(filter.insert(43));
+    EXPECT_FALSE(filter.insert(43));
+    // 0 marks empty slots, yet is a fingerprint like any other
+    EXPECT_TRUE(filter.insert(0));
+    EXPECT_FALSE(filter.insert(0));
+    // old fingerprints are forgotten
+    for (uint64_t i = 1; i < 1000; ++i)
+        filter.insert(i * 0x9e3779b97f4a7c15ull);
+    EXPECT_TRUE(filter.insert(42));
+
+    // of concurrent insertions of a fingerprint, exactly one is new
+    RecentFilter shared{1 << 10};
+    std::atomic_int numNew = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&shared, &numNew]() {
+            for (uint64_t i = 1; i <= 1000; ++i)
+            {
+                if (shared.insert(i * 0x9e3779b97f4a7c15ull))
+                    ++numNew;
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    EXPECT_EQ(numNew, 1000);
+}
+
+TEST(ETL, sourceScore)
+{
+    using namespace std::chrono_literals;
+    SourceScore fast;
+    SourceScore slow;
+    SourceScore failing;
+    // untried sources come first
+    EXPECT_EQ(fast.cost(), 0);
+    for (int i = 0; i < 20; ++i)
+    {
+        fast.record(1ms, true);
+        slow.record(10ms, true);
+        failing.record(100us, i % 2 == 0);
+    }
+    EXPECT_LT(fast.cost(), slow.cost());
+    // failures cost more than latency, however fast they are
+    EXPECT_LT(slow.cost(), failing.cost());
+    EXPECT_EQ(fast.p95(), std::chrono::microseconds(1000));
+
+    // a percentile needs enough samples
+    SourceScore fresh;
+    fresh.record(1ms, true);
+    EXPECT_FALSE(fresh.p95());
+    fresh.hedged();
+    auto report = fresh.report();
+    EXPECT_EQ(report.at("requests").as_uint64(), 1);
+    EXPECT_EQ(report.at("hedges").as_uint64(), 1);
+    EXPECT_EQ(report.at("latency_us").as_uint64(), 1000);
+    EXPECT_FALSE(report.contains("p95_latency_us"));
+}
+
+TEST(RPC, toBoostJson)
+{
+    Json::Value value{Json::objectValue};
+    value["string"] = "text";
+    value["int"] = -5;
+    value["uint"] = 4000000000u;
+    value["real"] = 0.5;
+    value["bool"] = true;
+    value["null"] = Json::nullValue;
+    value["array"] = Json::arrayValue;
+    value["array"].append(1);
+    value["array"].append("two");
+    value["object"]["nested"] = Json::arrayValue;
+    value["empty"] = Json::objectValue;
+
+    // the same as rendering the value and parsing it back
+    auto converted = RPC::toBoostJson(value);
+    ASSERT_EQ(converted, boost::json::parse(value.toStyledString()));
+    ASSERT_TRUE(converted.as_object()["uint"].is_int64());
+
+    boost::json::monotonic_resource resource;
+    boost::json::storage_ptr sp{&resource};
+    auto allocated = RPC::toBoostJson(value, sp);
+    ASSERT_EQ(allocated, converted);
+    ASSERT_EQ(allocated.storage().get(), sp.get());
+    ASSERT_EQ(allocated.as_object()["array"].storage().get(), sp.get());
+}
+
+TEST(RPC, methodIDs)
+{
+    using namespace RPC;
+    for (std::size_t i = 0; i + 1 < methodCount; ++i)
+    {
+        auto id = static_cast<MethodID>(i);
+        ASSERT_EQ(toMethodID(toString(id)), id);
+    }
+    ASSERT_EQ(toMethodID("account_info"), MethodID::accountInfo);
+    ASSERT_EQ(toMethodID("account_infos"), MethodID::unknown);
+    ASSERT_EQ(toMethodID("unknown"), MethodID::unknown);
+    ASSERT_EQ(toMethodID(""), MethodID::unknown);
+
+    Counters counters;
+    ASSERT_TRUE(counters.report().empty());
+    counters.rpcComplete(MethodID::tx, std::chrono::microseconds{5});
+    counters.rpcErrored(MethodID::tx);
+    counters.rpcForwarded(MethodID::submit);
+    counters.rpcErrored(toMethodID("no_such_method"));
+    auto report = counters.report();
+    ASSERT_EQ(report.size(), 3);
+    auto const& tx = report.at("tx").as_object();
+    EXPECT_EQ(tx.at("started").as_string(), "2");
+    EXPECT_EQ(tx.at("errored").as_string(), "1");
+    EXPECT_EQ(tx.at("duration_us").as_string(), "5");
+    EXPECT_EQ(report.at("submit").at("forwarded").as_string(), "1");
+    EXPECT_EQ(report.at("unknown").at("errored").as_string(), "1");
+    EXPECT_EQ(tx.at("p50_us").as_string(), "5");
+    ASSERT_FALSE(report.at("submit").as_object().contains("p50_us"));
+}
+
+TEST(RPC, workQueue)
+{
+    using namespace RPC;
+    EXPECT_EQ(
+        peekMethod(R"({"method" : "ledger_data", "params":[{}]})", "method"),
+        MethodID::ledgerData);
+    EXPECT_EQ(
+        peekMethod(R"({"command":"fee","id":1})", "command"), MethodID::fee);
+    EXPECT_EQ(peekMethod(R"({"my_method":"tx"})", "method"), MethodID::unknown);
+    EXPECT_EQ(peekMethod(R"({"method":)", "method"), MethodID::unknown);
+    // members of the params don't name the method
+    EXPECT_EQ(
+        peekMethod(
+            R"({"params":[{"command":"ping"}],"method":"ledger_data"})",
+            "command"),
+        MethodID::unknown);
+    EXPECT_EQ(
+        peekMethod(
+            R"({"params":[{"method":"ping"}],"method":"ledger_data"})",
+            "method"),
+        MethodID::ledgerData);
+    EXPECT_EQ(
+        peekMethod(R"({"x":"\"method\":\"ping\"","method":"tx"})", "method"),
+        MethodID::tx);
+    EXPECT_EQ(
+        peekMethod(R"({"method":"ping","method":"ledger_data"})", "method"),
+        MethodID::ledgerData);
+    // escapes are read as the parser reads them
+    EXPECT_EQ(
+        peekMethod(R"({"method":"ledger\u005fdata"})", "method"),
+        MethodID::ledgerData);
+    EXPECT_EQ(
+        peekMethod(R"({"me\u0074hod":"ledger_data"})", "method"),
+        MethodID::ledgerData);
+    EXPECT_EQ(peekString(R"({"command":"a\"b\\c\/"})", "command"), "a\"b\\c/");
+    EXPECT_EQ(costClass(MethodID::ping), CostClass::cheap);
+    EXPECT_EQ(costClass(MethodID::accountInfo), CostClass::standard);
+    EXPECT_EQ(costClass(MethodID::ledgerData), CostClass::expensive);
+
+    auto config = boost::json::parse(R"({
+        "rpc_workers":8,
+        "rpc_lanes":{"expensive":{"workers":1,"max_wait_ms":1}}})")
+                      .as_object();
+    auto lanes = WorkQueue::lanes(config);
+    EXPECT_EQ(lanes[0].workers, 2);
+    EXPECT_EQ(lanes[1].workers, 4);
+    EXPECT_EQ(lanes[2].workers, 1);
+    EXPECT_EQ(lanes[2].maxWait.count(), 1);
+
+    // the second request waits for the only worker, which the first one
+    // blocks, longer than 1ms
+    WorkQueue queue{config};
+    std::promise<void> release;
+    std::promise<bool> second;
+    EXPECT_TRUE(queue.post(
+        CostClass::expensive,
+        [future = release.get_future().share()](
+            boost::asio::yield_context) { future.wait(); },
+        []() {}));
+    EXPECT_TRUE(queue.post(
+        CostClass::expensive,
+        [&second](boost::asio::yield_context) { second.set_value(true); },
+        [&second]() { second.set_value(false); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release.set_value();
+    EXPECT_FALSE(second.get_future().get());
+
+    auto report = queue.report();
+    auto const& expensive = report.at("expensive").as_object();
+    EXPECT_EQ(expensive.at("queued").as_uint64(), 1);
+    EXPECT_EQ(expensive.at("shed").as_uint64(), 1);
+    EXPECT_EQ(report.at("cheap").as_object().at("workers").as_uint64(), 2);
+    EXPECT_EQ(expensive.at("max_running").as_uint64(), 4);
+
+    // a request that suspends its coroutine frees the only worker for the
+    // next one, and the third waits until one of the two that run finishes
+    config = boost::json::parse(R"({
+        "rpc_lanes":{"standard":{"workers":1,"max_running":2}}})")
+                 .as_object();
+    boost::asio::io_context timers;
+    auto work = boost::asio::make_work_guard(timers);
+    std::thread timerThread{[&timers]() { timers.run(); }};
+    std::mutex mtx;
+    std::vector<int> finished;
+    std::promise<void> done;
+    auto finish = [&](int i) {
+        std::lock_guard lock{mtx};
+        finished.push_back(i);
+        if (finished.size() == 3)
+            done.set_value();
+    };
+    WorkQueue suspending{config};
+    EXPECT_TRUE(suspending.post(
+        CostClass::standard,
+        [&](boost::asio::yield_context yield) {
+            boost::asio::steady_timer timer{
+                timers, std::chrono::milliseconds(50)};
+            timer.async_wait(yield);
+            finish(1);
+        },
+        []() {}));
+    EXPECT_TRUE(suspending.post(
+        CostClass::standard,
+        [&](boost::asio::yield_context yield) {
+            boost::asio::steady_timer timer{
+                timers, std::chrono::milliseconds(10)};
+            timer.async_wait(yield);
+            finish(2);
+        },
+        []() {}));
+    EXPECT_TRUE(suspending.post(
+        CostClass::standard,
+        [&](boost::asio::yield_context) { finish(3); },
+        []() {}));
+    done.get_future().wait();
+    EXPECT_EQ(finished, (std::vector<int>{2, 3, 1}));
+    work.reset();
+    timerThread.join();
+}
+
+TEST(RPC, latencyPercentiles)
+{
+    using namespace RPC;
+    std::uint64_t const durations[] = {0, 7, 8, 100, 12345, 4000000000};
+    for (auto us : durations)
+    {
+        auto bucket = LatencyBuckets::bucket(us);
+        ASSERT_GE(LatencyBuckets::upperBound(bucket), us);
+        // within an eighth
+        ASSERT_LE(LatencyBuckets::upperBound(bucket), us + us / 8);
+        if (bucket)
+            ASSERT_LT(LatencyBuckets::upperBound(bucket - 1), us);
+    }
+    ASSERT_EQ(
+        LatencyBuckets::bucket(std::uint64_t{1} << 40),
+        LatencyBuckets::count - 1);
+
+    // counted from several threads, which add to different shards
+    Counters counters;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&counters]() {
+            for (int i = 1; i <= 1000; ++i)
+                counters.rpcComplete(
+                    MethodID::ledger, std::chrono::microseconds{i});
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    auto report = counters.report().at("ledger").as_object();
+    EXPECT_EQ(report.at("finished").as_string(), "4000");
+    EXPECT_EQ(report.at("duration_us").as_string(), "2002000");
+    auto percentile = [&](char const* name) {
+        return std::stoull(report.at(name).as_string().c_str());
+    };
+    EXPECT_GE(percentile("p50_us"), 500);
+    EXPECT_LE(percentile("p50_us"), 500 + 500 / 8);
+    EXPECT_GE(percentile("p99_us"), 990);
+    EXPECT_LE(percentile("p999_us"), 1000 + 1000 / 8);
+    EXPECT_LE(percentile("p95_us"), percentile("p99_us"));
+}
+
+TEST(RPC, metrics)
+{
+    Metrics::Writer writer;
+    boost::json::object report{
+        {"size", 3},
+        {"is-full", true},
+        {"ms", "12"},
+        {"name", "text"},
+        {"stages", boost::json::array{{{"queued", 1}}, {{"queued", 2}}}}};
+    writer.gauges("clio_test", report);
+
+    RPC::Counters counters;
+    counters.rpcComplete(RPC::MethodID::tx, std::chrono::microseconds{20});
+    writer.rpc(counters);
+    auto text = writer.str();
+
+    EXPECT_NE(
+        text.find("# TYPE clio_test_size gauge\nclio_test_size 3\n"),
+        std::string::npos);
+    EXPECT_NE(text.find("clio_test_is_full 1\n"), std::string::npos);
+    EXPECT_NE(text.find("clio_test_ms 12\n"), std::string::npos);
+    EXPECT_EQ(text.find("clio_test_name"), std::string::npos);
+    EXPECT_NE(
+        text.find("clio_test_stages_queued{index=\"0\"} 1\n"
+                  "clio_test_stages_queued{index=\"1\"} 2\n"),
+        std::string::npos);
+
+    EXPECT_NE(
+        text.find("clio_rpc_finished{method=\"tx\"} 1\n"), std::string::npos);
+    EXPECT_NE(
+        text.find("# TYPE clio_rpc_latency_us histogram"), std::string::npos);
+    EXPECT_NE(
+        text.find("clio_rpc_latency_us_bucket{method=\"tx\",le=\"15\"} 0\n"
+                  "clio_rpc_latency_us_bucket{method=\"tx\",le=\"31\"} 1\n"),
+        std::string::npos);
+    EXPECT_NE(
+        text.find("clio_rpc_latency_us_sum{method=\"tx\"} 20\n"),
+        std::string::npos);
+}
+
+TEST(RPC, dosGuard)
+{
+    boost::asio::io_context ioc;
+    // refills too slowly to matter here
+    DOSGuard guard{
+        boost::json::parse(R"({"dos_guard":{
+            "max_fetches":100,
+            "sweep_interval":100000,
+            "read_cost":10,
+            "whitelist":["127.0.0.1"]}})")
+            .as_object(),
+        ioc};
+    EXPECT_EQ(guard.cost(5, 3), 35);
+
+    EXPECT_TRUE(guard.isOk("10.0.0.1"));
+    EXPECT_TRUE(guard.add("10.0.0.1", 60));
+    EXPECT_TRUE(guard.isOk("10.0.0.1"));
+    EXPECT_FALSE(guard.add("10.0.0.1", 60));
+    EXPECT_FALSE(guard.isOk("10.0.0.1"));
+    // the same client
+    EXPECT_FALSE(guard.isOk("::ffff:10.0.0.1"));
+    EXPECT_TRUE(guard.isOk("10.0.0.2"));
+    EXPECT_TRUE(guard.isOk("::1"));
+
+    guard.add("127.0.0.1", 1000);
+    EXPECT_TRUE(guard.isOk("127.0.0.1"));
+
+    // buckets that did not refill are kept
+    guard.clear();
+    auto report = guard.report();
+    EXPECT_EQ(report.at("tracked_ips").as_uint64(), 1);
+    EXPECT_EQ(report.at("rejected").as_uint64(), 2);
+}
+
+TEST(RPC, responseCache)
+{
+    using namespace RPC;
+    ResponseCache cache;
+    ASSERT_FALSE(cache.enabled());
+    boost::json::object config;
+    config["response_cache"] = boost::json::object{};
+    config["response_cache"].as_object()["max_mb"] = 1;
+    cache.setup(config);
+    ASSERT_TRUE(cache.enabled());
+
+    std::shared_ptr<BackendInterface const> backend;
+    std::shared_ptr<ETLLoadBalancer> balancer;
+    Backend::LedgerRange range{1, 10};
+    Counters counters;
+    auto key = [&](std::string method, boost::json::object params) {
+        Context ctx{
+            method,
+            1,
+            params,
+            backend,
+            nullptr,
+            balancer,
+            nullptr,
+            range,
+            counters,
+            "127.0.0.1"};
+        return ResponseCache::key(ctx, "http");
+    };
+
+    boost::json::object a;
+    a["ledger_index"] = 5;
+    a["transactions"] = true;
+    a["id"] = 1;
+    boost::json::object b;
+    b["transactions"] = true;
+    b["ledger_index"] = 5;
+    b["id"] = 2;
+    auto keyA = key("ledger", a);
+    auto keyB = key("ledger", b);
+    ASSERT_TRUE(keyA && keyB);
+    // the order of params and the id don't matter
+    ASSERT_EQ(keyA->str, keyB->str);
+    ASSERT_EQ(keyA->seq, 5);
+    ASSERT_FALSE(keyA->alias);
+    b["transactions"] = false;
+    ASSERT_NE(key("ledger", b)->str, keyA->str);
+    // only some methods are cached
+    ASSERT_FALSE(key("account_info", a));
+    boost::json::object closed;
+    closed["ledger_index"] = "closed";
+    ASSERT_FALSE(key("ledger", closed));
+
+    // the validated ledger resolves to the most recent one
+    auto validated = key("ledger", {});
+    ASSERT_TRUE(validated);
+    ASSERT_EQ(validated->seq, 10);
+    ASSERT_TRUE(validated->alias);
+
+    ASSERT_FALSE(cache.get(*keyA));
+    cache.put(*keyA, 5, std::make_shared<std::string const>("{\"a\":1}"));
+    cache.put(
+        *validated, 10, std::make_shared<std::string const>("{\"v\":1}"));
+    ASSERT_EQ(*cache.get(*keyA), "{\"a\":1}");
+    ASSERT_EQ(*cache.get(*validated), "{\"v\":1}");
+
+    // a new ledger drops the responses for the previous validated ledger
+    range.maxSequence = 11;
+    auto next = key("ledger", {});
+    ASSERT_FALSE(cache.get(*next));
+    ASSERT_FALSE(cache.get(*validated));
+    ASSERT_TRUE(cache.get(*keyA));
+    // and responses computed for it are not cached anymore
+    cache.put(
+        *validated, 10, std::make_shared<std::string const>("{\"v\":1}"));
+    ASSERT_FALSE(cache.get(*validated));
+
+    // a transaction is cached with the ledger it is in, and only once that
+    // ledger is in the database
+    boost::json::object tx;
+    tx["transaction"] = "ABCD";
+    auto txKey = key("tx", tx);
+    ASSERT_TRUE(txKey);
+    ASSERT_EQ(txKey->seq, 0);
+    cache.put(*txKey, 12, std::make_shared<std::string const>("{\"t\":1}"));
+    ASSERT_FALSE(cache.get(*txKey));
+    cache.put(*txKey, 3, std::make_shared<std::string const>("{\"t\":1}"));
+    ASSERT_TRUE(cache.get(*txKey));
+    // a response from another ledger than the key's is not cached
+    boost::json::object six;
+    six["ledger_index"] = 6;
+    cache.put(
+        *key("ledger", six), 7, std::make_shared<std::string const>("{}"));
+    ASSERT_FALSE(cache.get(*key("ledger", six)));
+
+    // online delete drops the responses for the ledgers it removed
+    range.minSequence = 4;
+    ASSERT_FALSE(cache.get(*key("tx", tx)));
+    boost::json::object three;
+    three["ledger_index"] = 3;
+    ASSERT_FALSE(key("ledger", three));
+    ASSERT_TRUE(cache.get(*key("ledger", a)));
+    range.minSequence = 1;
+
+    // the least recently used responses are evicted
+    std::string big(100000, 'x');
+    for (int seq = 1; seq <= 11; ++seq)
+    {
+        boost::json::object params;
+        params["ledger_index"] = seq;
+        cache.put(
+            *key("ledger_data", params),
+            seq,
+            std::make_shared<std::string const>(big));
+    }
+    ASSERT_FALSE(cache.get(*keyA));
+    ASSERT_LE(cache.report()["bytes"].as_uint64(), 1 << 20);
+    // too big to be cached
+    std::string huge(1 << 18, 'x');
+    cache.put(*keyB, 5, std::make_shared<std::string const>(huge));
+    ASSERT_FALSE(cache.get(*keyB));
+
+    boost::json::object response;
+    response["id"] = 1;
+    response["status"] = "success";
+    response["result"] = boost::json::object{};
+    ASSERT_EQ(
+        wsResponseBody(response, "{\"a\":1}"),
+        "{\"id\":1,\"status\":\"success\",\"result\":{\"a\":1}}");
+    ASSERT_EQ(
+        wsResponseBody(boost::json::object{}, "{}"), "{\"result\":{}}");
+}
+
+TEST(RPC, batch)
+{
+    using namespace RPC;
+    EXPECT_TRUE(isBatch(" \n[{\"method\":\"ping\"}]"));
+    EXPECT_FALSE(isBatch("{\"method\":\"ping\"}"));
+    EXPECT_FALSE(isBatch(""));
+    EXPECT_EQ(joinResponses({"{}", "{\"a\":1}"}), "[{},{\"a\":1}]");
+    EXPECT_EQ(joinResponses({}), "[]");
+    EXPECT_EQ(peekString(R"({"command" : "batch"})", "command"), "batch");
+    EXPECT_EQ(peekString(R"({"id":1})", "command"), "");
+
+    ripple::uint256 present{1}, absent{2}, other{3};
+    ripple::LedgerInfo header;
+    header.seq = 7;
+    Backend::Prefetched prefetched{
+        7,
+        header,
+        {present, absent},
+        {BlobView{Blob{1, 2, 3}}, BlobView{}}};
+    EXPECT_FALSE(Backend::Prefetched::object(present, 7));
+    {
+        Backend::Prefetched::Scope scope{prefetched};
+        auto object = Backend::Prefetched::object(present, 7);
+        ASSERT_TRUE(object);
+        EXPECT_EQ(object->toBlob(), (Blob{1, 2, 3}));
+        ASSERT_TRUE(Backend::Prefetched::object(absent, 7));
+        EXPECT_TRUE(Backend::Prefetched::object(absent, 7)->empty());
+        EXPECT_FALSE(Backend::Prefetched::object(other, 7));
+        EXPECT_FALSE(Backend::Prefetched::object(present, 8));
+        ASSERT_TRUE(Backend::Prefetched::header(7));
+        EXPECT_EQ(Backend::Prefetched::header(7)->seq, 7);
+        EXPECT_FALSE(Backend::Prefetched::header(6));
+
+        // other threads do not see it
+        std::async(std::launch::async, [&present]() {
+            EXPECT_FALSE(Backend::Prefetched::object(present, 7));
+        }).wait();
+    }
+    EXPECT_FALSE(Backend::Prefetched::header(7));
+}
+
+TEST(RPC, requestLog)
+{
+    boost::json::object params;
+    params["id"] = 7;
+    params["command"] = "account_info";
+    params["secret"] = "snoPBrXtMeMyMHUVTgbuqAfg1SUTb";
+    params["account"] = "rHb9CJAWyB4rj91VRWn96DkukG4bwdtyTh";
+    params["ledger_index"] = "validated";
+    auto anonymized = Log::RequestLog::anonymize(params);
+    EXPECT_EQ(anonymized.size(), 2);
+    EXPECT_TRUE(anonymized.contains("account"));
+    EXPECT_TRUE(anonymized.contains("ledger_index"));
+
+    std::string path = "/tmp/clio_request_log_test.log";
+    std::remove(path.c_str());
+    boost::json::object logConfig;
+    logConfig["file"] = path;
+    logConfig["sample_rate"] = 2;
+    boost::json::object config;
+    config["request_log"] = logConfig;
+    {
+        Log::RequestLog log;
+        log.setup(config);
+        EXPECT_TRUE(log.enabled());
+        for (std::size_t i = 0; i < 4; ++i)
+            log.record("ws", "account_info", params);
+        EXPECT_EQ(log.report().at("captured").as_uint64(), 2);
+    }
+
+    std::ifstream in{path};
+    std::string line;
+    std::size_t lines = 0;
+    while (std::getline(in, line))
+    {
+        auto captured = boost::json::parse(line).as_object();
+        EXPECT_EQ(captured.at("method").as_string(), "account_info");
+        EXPECT_EQ(captured.at("transport").as_string(), "ws");
+        EXPECT_FALSE(captured.at("params").as_object().contains("secret"));
+        ++lines;
+    }
+    EXPECT_EQ(lines, 2);
+    std::remove(path.c_str());
+}
+
+TEST(RPC, tracing)
+{
+    std::string const path = "clio_test_traces.json";
+    std::remove(path.c_str());
+    {
+        // nothing is traced until the exporter is set up
+        Trace::Request request{"untraced"};
+        EXPECT_FALSE(request);
+        Trace::Span span{"span"};
+        EXPECT_FALSE(span);
+    }
+    Trace::exporter().setup(
+        {{"tracing", {{"sample_rate", 1}, {"file", path.c_str()}}}});
+    ASSERT_TRUE(Trace::exporter().enabled());
+    {
+        Trace::Request request{"http"};
+        ASSERT_TRUE(request);
+        request.attribute("bytes", 42);
+        {
+            Trace::Span span{"rpc"};
+            EXPECT_TRUE(span);
+            span.attribute("method", "ledger");
+            auto const parent = Trace::current();
+            std::async(std::launch::async, [&parent]() {
+                // spans on other threads need their parent
+                EXPECT_FALSE(Trace::Span{"orphan"});
+                Trace::Span span{"db.object", parent};
+                EXPECT_TRUE(span);
+            }).wait();
+            auto now = Trace::clock::now();
+            Trace::record(Trace::current(), "cassandra.read", now, now);
+        }
+    }
+    EXPECT_FALSE(Trace::current());
+    EXPECT_EQ(Trace::exporter().report().at("exported"), 1);
+
+    std::ifstream file{path};
+    std::string line;
+    ASSERT_TRUE(std::getline(file, line));
+    auto otlp = boost::json::parse(line).as_object();
+    auto const& spans = otlp.at("resourceSpans")
+                            .at(0)
+                            .at("scopeSpans")
+                            .at(0)
+                            .at("spans")
+                            .as_array();
+    ASSERT_EQ(spans.size(), 4);
+    std::map<std::string, boost::json::object> byName;
+    for (auto const& span : spans)
+        byName[span.at("name").as_string().c_str()] = span.as_object();
+    auto const& root = byName.at("http");
+    EXPECT_FALSE(root.contains("parentSpanId"));
+    EXPECT_EQ(root.at("kind"), 2);
+    EXPECT_EQ(root.at("traceId").as_string().size(), 32);
+    EXPECT_EQ(root.at("attributes").at(0).at("key"), "bytes");
+    EXPECT_EQ(root.at("attributes").at(0).at("value").at("intValue"), "42");
+    auto const& rpc = byName.at("rpc");
+    EXPECT_EQ(rpc.at("parentSpanId"), root.at("spanId"));
+    EXPECT_EQ(rpc.at("kind"), 1);
+    EXPECT_EQ(
+        rpc.at("attributes").at(0).at("value").at("stringValue"), "ledger");
+    EXPECT_EQ(byName.at("db.object").at("parentSpanId"), rpc.at("spanId"));
+    EXPECT_EQ(
+        byName.at("cassandra.read").at("parentSpanId"), rpc.at("spanId"));
+    for (auto const& span : spans)
+        EXPECT_EQ(span.at("traceId"), root.at("traceId"));
+    EXPECT_FALSE(std::getline(file, line));
+    std::remove(path.c_str());
+}
+
 TEST(Backend, CacheIntegration)
 {
     boost::log::core::get()->set_filter(